@@ -47,6 +47,7 @@ DROP TABLE IF EXISTS gpo_subject_identifier;
 DROP TABLE IF EXISTS gpo_id_token;
 DROP TABLE IF EXISTS gpo_access_token_scope;
 DROP TABLE IF EXISTS gpo_access_token;
+DROP TABLE IF EXISTS gpo_access_token_revoked;
 DROP TABLE IF EXISTS gpo_refresh_token_scope;
 DROP TABLE IF EXISTS gpo_refresh_token;
 DROP TABLE IF EXISTS gpo_code_scheme;
@@ -469,6 +470,17 @@ CREATE TABLE gpo_access_token_scope (
   FOREIGN KEY(gpoa_id) REFERENCES gpo_access_token(gpoa_id) ON DELETE CASCADE
 );
 
+-- Revoked access tokens jti, used when the access tokens aren't stored in the database
+CREATE TABLE gpo_access_token_revoked (
+  gpoar_id INT(11) PRIMARY KEY AUTO_INCREMENT,
+  gpoar_plugin_name VARCHAR(256) NOT NULL,
+  gpoar_jti VARCHAR(128) NOT NULL,
+  gpoar_expires_at TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP,
+  gpoar_created_at TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP
+);
+CREATE INDEX i_gpoar_jti ON gpo_access_token_revoked(gpoar_jti);
+CREATE INDEX i_gpoar_created_at ON gpo_access_token_revoked(gpoar_created_at);
+
 -- Id token table, to store meta information on id token sent
 CREATE TABLE gpo_id_token (
   gpoi_id INT(11) PRIMARY KEY AUTO_INCREMENT,
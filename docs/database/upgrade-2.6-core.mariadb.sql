@@ -17,3 +17,14 @@ CREATE TABLE g_user_middleware_module_instance (
   gummi_parameters MEDIUMBLOB,
   gummi_enabled TINYINT(1) DEFAULT 1
 );
+
+-- Revoked access tokens jti, used when the access tokens aren't stored in the database
+CREATE TABLE gpo_access_token_revoked (
+  gpoar_id INT(11) PRIMARY KEY AUTO_INCREMENT,
+  gpoar_plugin_name VARCHAR(256) NOT NULL,
+  gpoar_jti VARCHAR(128) NOT NULL,
+  gpoar_expires_at TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP,
+  gpoar_created_at TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP
+);
+CREATE INDEX i_gpoar_jti ON gpo_access_token_revoked(gpoar_jti);
+CREATE INDEX i_gpoar_created_at ON gpo_access_token_revoked(gpoar_created_at);
@@ -17,3 +17,14 @@ CREATE TABLE g_user_middleware_module_instance (
   gummi_parameters TEXT,
   gummi_enabled INTEGER DEFAULT 1
 );
+
+-- Revoked access tokens jti, used when the access tokens aren't stored in the database
+CREATE TABLE gpo_access_token_revoked (
+  gpoar_id INTEGER PRIMARY KEY AUTOINCREMENT,
+  gpoar_plugin_name TEXT NOT NULL,
+  gpoar_jti TEXT NOT NULL,
+  gpoar_expires_at TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP,
+  gpoar_created_at TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP
+);
+CREATE INDEX i_gpoar_jti ON gpo_access_token_revoked(gpoar_jti);
+CREATE INDEX i_gpoar_created_at ON gpo_access_token_revoked(gpoar_created_at);
@@ -31,8 +31,11 @@
 #include <string.h>
 #include <time.h>
 #include <orcania.h>
+#include <yder.h>
 #include <ulfius.h>
 #include <jansson.h>
+#include <gnutls/gnutls.h>
+#include <gnutls/crypto.h>
 
 #include "oidc_resource.h"
 
@@ -96,6 +99,7 @@ static json_t * access_token_check_scope(struct _oidc_resource_config * config,
  * - aud: non empty string
  * - type: match "access_token" or "client_token"
  * - exp < now
+ * - not revoked if callback_is_revoked is set
  */
 static int access_token_check_validity(struct _oidc_resource_config * config, json_t * j_access_token) {
   time_t now;
@@ -120,6 +124,9 @@ static int access_token_check_validity(struct _oidc_resource_config * config, js
       } else {
         res = G_TOKEN_ERROR_INVALID_REQUEST;
       }
+      if (res == G_TOKEN_OK && config->callback_is_revoked != NULL && config->callback_is_revoked(config->callback_is_revoked_cls, j_access_token)) {
+        res = G_TOKEN_ERROR_INVALID_TOKEN;
+      }
     } else {
       res = G_TOKEN_ERROR_INVALID_REQUEST;
     }
@@ -129,17 +136,87 @@ static int access_token_check_validity(struct _oidc_resource_config * config, js
   return res;
 }
 
+/**
+ * Returns the cache entry where the token digest is stored
+ * The shard lock must be held by the caller
+ */
+static struct _oidc_resource_cache_entry * access_token_cache_get_entry(struct _oidc_resource_cache * cache, const unsigned char * digest, struct _oidc_resource_cache_shard ** shard) {
+  size_t index = ((size_t)digest[1]<<24 | (size_t)digest[2]<<16 | (size_t)digest[3]<<8 | (size_t)digest[4]) % cache->nb_entries;
+
+  *shard = &cache->shards[digest[0] % G_CACHE_NB_SHARDS];
+  return &(*shard)->entries[index];
+}
+
+/**
+ * Returns a copy of the grants of the verified token if its digest is in the cache and the token isn't expired
+ */
+static json_t * access_token_cache_get(struct _oidc_resource_cache * cache, const unsigned char * digest) {
+  struct _oidc_resource_cache_shard * shard;
+  struct _oidc_resource_cache_entry * entry;
+  json_t * j_grants = NULL;
+  time_t now;
+
+  time(&now);
+  entry = access_token_cache_get_entry(cache, digest, &shard);
+  if (!pthread_mutex_lock(&shard->lock)) {
+    if (entry->j_grants != NULL && 0 == memcmp(entry->digest, digest, G_CACHE_DIGEST_LEN)) {
+      if (entry->exp > now) {
+        j_grants = json_deep_copy(entry->j_grants);
+      } else {
+        json_decref(entry->j_grants);
+        entry->j_grants = NULL;
+      }
+    }
+    pthread_mutex_unlock(&shard->lock);
+  }
+  if (cache->callback_metrics != NULL) {
+    cache->callback_metrics(cache->callback_metrics_cls, j_grants!=NULL);
+  }
+  return j_grants;
+}
+
+/**
+ * Stores the grants of a verified token until it expires
+ * The entry replaces the previous token stored at the same place
+ */
+static void access_token_cache_set(struct _oidc_resource_cache * cache, const unsigned char * digest, json_t * j_grants) {
+  struct _oidc_resource_cache_shard * shard;
+  struct _oidc_resource_cache_entry * entry;
+  time_t now;
+
+  time(&now);
+  if (json_integer_value(json_object_get(j_grants, "exp")) > now) {
+    entry = access_token_cache_get_entry(cache, digest, &shard);
+    if (!pthread_mutex_lock(&shard->lock)) {
+      json_decref(entry->j_grants);
+      memcpy(entry->digest, digest, G_CACHE_DIGEST_LEN);
+      entry->exp = (time_t)json_integer_value(json_object_get(j_grants, "exp"));
+      entry->j_grants = json_deep_copy(j_grants);
+      pthread_mutex_unlock(&shard->lock);
+    }
+  }
+}
+
 /**
  * validates if the token value is a valid jwt and has a valid signature
+ * if the token is in the verified tokens cache, the parsing and the signature verification are skipped
  */
 static json_t * access_token_check_signature(struct _oidc_resource_config * config, const char * token_value) {
   json_t * j_return = NULL, * j_grants;
-  jwt_t * jwt = r_jwt_copy(config->jwt);
+  jwt_t * jwt = NULL;
   jwk_t * jwk = NULL;
   jwa_alg alg = R_JWA_ALG_UNKNOWN;
   const char * kid;
+  unsigned char digest[G_CACHE_DIGEST_LEN];
+  unsigned short use_cache = 0;
   
-  if (token_value != NULL) {
+  if (token_value != NULL && config->cache != NULL && gnutls_hash_fast(GNUTLS_DIG_SHA256, token_value, o_strlen(token_value), digest) == GNUTLS_E_SUCCESS) {
+    use_cache = 1;
+  }
+  if (use_cache && (j_grants = access_token_cache_get(config->cache, digest)) != NULL) {
+    j_return = json_pack("{siso}", "result", G_TOKEN_OK, "grants", j_grants);
+  } else if (token_value != NULL) {
+    jwt = r_jwt_copy(config->jwt);
     if (r_jwt_parse(jwt, token_value, 0) == RHN_OK) {
       if ((kid = r_jwt_get_header_str_value(jwt, "kid")) != NULL) {
         if ((jwk = r_jwks_get_by_kid(jwt->jwks_pubkey_sign, kid)) == NULL) {
@@ -155,6 +232,9 @@ static json_t * access_token_check_signature(struct _oidc_resource_config * conf
         if (r_jwt_verify_signature(jwt, jwk, 0) == RHN_OK && r_jwt_get_sign_alg(jwt) == alg) {
           j_grants = r_jwt_get_full_claims_json_t(jwt);
           if (j_grants != NULL) {
+            if (use_cache) {
+              access_token_cache_set(config->cache, digest, j_grants);
+            }
             j_return = json_pack("{siso}", "result", G_TOKEN_OK, "grants", j_grants);
           } else {
             j_return = json_pack("{si}", "result", G_TOKEN_ERROR);
@@ -174,6 +254,17 @@ static json_t * access_token_check_signature(struct _oidc_resource_config * conf
   return j_return;
 }
 
+/**
+ * validates the access token signature, using the verified tokens cache if enabled
+ */
+json_t * oidc_resource_verify_access_token(struct _oidc_resource_config * config, const char * token_value) {
+  if (config != NULL) {
+    return access_token_check_signature(config, token_value);
+  } else {
+    return json_pack("{si}", "result", G_TOKEN_ERROR_INVALID_REQUEST);
+  }
+}
+
 /**
  * check if bearer token has some of the specified scope
  */
@@ -257,6 +348,70 @@ int callback_check_glewlwyd_oidc_access_token (const struct _u_request * request
   return res;
 }
 
+/**
+ * Initialize the verified access tokens cache
+ * a size of 0 leaves config->cache to NULL, i.e. the cache disabled
+ */
+int oidc_resource_cache_init(struct _oidc_resource_config * config, size_t size, void (* callback_metrics)(void * cls, unsigned short hit), void * callback_metrics_cls) {
+  struct _oidc_resource_cache * cache;
+  size_t i, j;
+  int ret = G_TOKEN_OK;
+
+  if (config == NULL) {
+    ret = G_TOKEN_ERROR_INVALID_REQUEST;
+  } else if (!size) {
+    // Cache disabled
+    config->cache = NULL;
+  } else {
+    if ((cache = o_malloc(sizeof(struct _oidc_resource_cache))) != NULL) {
+      cache->nb_entries = (size + G_CACHE_NB_SHARDS - 1) / G_CACHE_NB_SHARDS;
+      cache->callback_metrics = callback_metrics;
+      cache->callback_metrics_cls = callback_metrics_cls;
+      for (i=0; i<G_CACHE_NB_SHARDS; i++) {
+        if ((cache->shards[i].entries = o_malloc(cache->nb_entries*sizeof(struct _oidc_resource_cache_entry))) == NULL || pthread_mutex_init(&cache->shards[i].lock, NULL)) {
+          y_log_message(Y_LOG_LEVEL_ERROR, "oidc_resource_cache_init - Error initializing shard");
+          o_free(cache->shards[i].entries);
+          for (j=0; j<i; j++) {
+            pthread_mutex_destroy(&cache->shards[j].lock);
+            o_free(cache->shards[j].entries);
+          }
+          o_free(cache);
+          cache = NULL;
+          ret = G_TOKEN_ERROR_INTERNAL;
+          break;
+        }
+        memset(cache->shards[i].entries, 0, cache->nb_entries*sizeof(struct _oidc_resource_cache_entry));
+      }
+      config->cache = cache;
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "oidc_resource_cache_init - Error allocating resources for cache");
+      config->cache = NULL;
+      ret = G_TOKEN_ERROR_INTERNAL;
+    }
+  }
+  return ret;
+}
+
+/**
+ * Free the verified access tokens cache
+ * does nothing if config->cache is NULL
+ */
+void oidc_resource_cache_close(struct _oidc_resource_config * config) {
+  size_t i, j;
+
+  if (config != NULL && config->cache != NULL) {
+    for (i=0; i<G_CACHE_NB_SHARDS; i++) {
+      for (j=0; j<config->cache->nb_entries; j++) {
+        json_decref(config->cache->shards[i].entries[j].j_grants);
+      }
+      o_free(config->cache->shards[i].entries);
+      pthread_mutex_destroy(&config->cache->shards[i].lock);
+    }
+    o_free(config->cache);
+    config->cache = NULL;
+  }
+}
+
 /**
  * Parse the DPoP header and extract its jkt value if the DPoP is valid
  */
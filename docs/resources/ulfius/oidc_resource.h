@@ -27,6 +27,8 @@
  * SOFTWARE.
  *
  */
+#include <time.h>
+#include <pthread.h>
 #include <jansson.h>
 #include <rhonabwy.h>
 
@@ -47,6 +49,32 @@
 #define BODY_URL_PARAMETER   "access_token"
 #define HEADER_DPOP          "DPoP"
 
+#define G_CACHE_NB_SHARDS 16
+#define G_CACHE_DIGEST_LEN 32
+
+struct _oidc_resource_cache_entry {
+  unsigned char   digest[G_CACHE_DIGEST_LEN];
+  time_t          exp;
+  json_t        * j_grants;
+};
+
+struct _oidc_resource_cache_shard {
+  pthread_mutex_t                     lock;
+  struct _oidc_resource_cache_entry * entries;
+};
+
+struct _oidc_resource_cache {
+  size_t                            nb_entries; // number of entries per shard
+  struct _oidc_resource_cache_shard shards[G_CACHE_NB_SHARDS];
+  void                           (* callback_metrics)(void * cls, unsigned short hit);
+  void                            * callback_metrics_cls;
+};
+
+/**
+ * The config must be zeroed before its fields are set, with OIDC_RESOURCE_CONFIG_INIT or memset,
+ * so the optional fields cache, callback_is_revoked and callback_is_revoked_cls are disabled
+ * if the caller doesn't set them
+ */
 struct _oidc_resource_config {
   int       method;
   char    * oauth_scope;
@@ -56,8 +84,13 @@ struct _oidc_resource_config {
   char    * realm;
   unsigned short accept_access_token;
   unsigned short accept_client_token;
+  struct _oidc_resource_cache * cache;
+  int                        (* callback_is_revoked)(void * cls, json_t * j_access_token);
+  void                        * callback_is_revoked_cls;
 };
 
+#define OIDC_RESOURCE_CONFIG_INIT {.method = G_METHOD_HEADER, .oauth_scope = NULL, .jwt = NULL, .jwk_verify_default = NULL, .alg = R_JWA_ALG_UNKNOWN, .realm = NULL, .accept_access_token = 0, .accept_client_token = 0, .cache = NULL, .callback_is_revoked = NULL, .callback_is_revoked_cls = NULL}
+
 /**
  * 
  * check if bearer token has some of the specified scope
@@ -67,6 +100,25 @@ struct _oidc_resource_config {
  */
 int callback_check_glewlwyd_oidc_access_token (const struct _u_request * request, struct _u_response * response, void * user_data);
 
+/**
+ * Verifies the access token signature and returns its claims
+ * The verified tokens cache is used if config->cache isn't NULL
+ * Return a json_t * object with the format {"result":G_TOKEN_OK,"grants":{claims}} on success
+ */
+json_t * oidc_resource_verify_access_token(struct _oidc_resource_config * config, const char * token_value);
+
+/**
+ * Initialize the verified access tokens cache of config with size entries
+ * callback_metrics is optional and called on each cache lookup with hit set to 1 on cache hit
+ * Return G_TOKEN_OK on success
+ */
+int oidc_resource_cache_init(struct _oidc_resource_config * config, size_t size, void (* callback_metrics)(void * cls, unsigned short hit), void * callback_metrics_cls);
+
+/**
+ * Free the verified access tokens cache of config
+ */
+void oidc_resource_cache_close(struct _oidc_resource_config * config);
+
 /**
  * Verifies if a DPoP header exists and if it does, verifies that it's a valid DPoP header
  */
@@ -24,60 +24,378 @@
  * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
  *
  */
+#include <time.h>
+
 #include "glewlwyd.h"
 
+#define GLEWLWYD_API_KEY_BATCH_SIZE 100
+
+/**
+ * Returns the hash of an API key as stored in the column gak_token_hash
+ */
+static char * api_key_hash(struct config_elements * config, const char * token) {
+  char * token_hash = generate_hash(config->hash_algorithm, token), * tmp;
+
+  tmp = str_replace(token_hash, "/", "_");
+  o_free(token_hash);
+  token_hash = str_replace(tmp, "+", "-");
+  o_free(tmp);
+  return token_hash;
+}
+
+/**
+ * Loads the hashes of the enabled API keys in a new json object
+ * Format: {"<token_hash>": true}
+ */
+static json_t * api_key_cache_load_db(struct config_elements * config) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
+  json_t * j_query, * j_result = NULL, * j_return = NULL, * j_element = NULL;
+  size_t index = 0;
+  int res;
+
+  j_query = json_pack("{sss[s]s{si}}",
+                      "table",
+                      GLEWLWYD_TABLE_API_KEY,
+                      "columns",
+                        "gak_token_hash",
+                      "where",
+                        "gak_enabled",
+                        1);
+  res = h_select(conn, j_query, &j_result, NULL);
+  json_decref(j_query);
+  if (res == H_OK) {
+    j_return = json_object();
+    json_array_foreach(j_result, index, j_element) {
+      json_object_set(j_return, json_string_value(json_object_get(j_element, "gak_token_hash")), json_true());
+    }
+    json_decref(j_result);
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "api_key_cache_load_db - Error executing j_query");
+  }
+  glewlwyd_db_pool_release(config, conn);
+  return j_return;
+}
+
+/**
+ * Replaces the enabled API keys set with the content of the database
+ * The new set is ignored if an API key was added or disabled by this instance during the query
+ */
+static int api_key_cache_reload(struct config_elements * config) {
+  struct _glwd_api_key_cache * api_key_cache = &config->api_key_cache;
+  json_t * j_keys;
+  unsigned int version = 0;
+  int ret;
+
+  if (!pthread_mutex_lock(&api_key_cache->lock)) {
+    version = api_key_cache->version;
+    pthread_mutex_unlock(&api_key_cache->lock);
+  }
+  if ((j_keys = api_key_cache_load_db(config)) != NULL) {
+    if (!pthread_mutex_lock(&api_key_cache->lock)) {
+      if (version == api_key_cache->version) {
+        json_decref(api_key_cache->j_keys);
+        api_key_cache->j_keys = json_incref(j_keys);
+      }
+      pthread_mutex_unlock(&api_key_cache->lock);
+      ret = G_OK;
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "api_key_cache_reload - Error lock");
+      ret = G_ERROR;
+    }
+    json_decref(j_keys);
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "api_key_cache_reload - Error api_key_cache_load_db");
+    ret = G_ERROR_DB;
+  }
+  return ret;
+}
+
+/**
+ * Adds or removes an API key hash in the enabled API keys set
+ */
+static void api_key_cache_set(struct config_elements * config, const char * token_hash, int enabled) {
+  struct _glwd_api_key_cache * api_key_cache = &config->api_key_cache;
+
+  if (api_key_cache->initialized) {
+    if (!pthread_mutex_lock(&api_key_cache->lock)) {
+      if (enabled) {
+        json_object_set(api_key_cache->j_keys, token_hash, json_true());
+      } else {
+        json_object_del(api_key_cache->j_keys, token_hash);
+      }
+      api_key_cache->version++;
+      pthread_mutex_unlock(&api_key_cache->lock);
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "api_key_cache_set - Error lock");
+    }
+  }
+}
+
+/**
+ * Writes the counters of a list of API keys with the same increment in one query
+ */
+static int api_key_cache_update(struct _h_connection * conn, const char * increment, json_t * j_hash_list) {
+  json_t * j_query, * j_hash = NULL;
+  char * hash_clause = NULL, * hash_escaped, * counter_clause;
+  size_t index = 0;
+  int res, ret;
+
+  json_array_foreach(j_hash_list, index, j_hash) {
+    hash_escaped = h_escape_string_with_quotes(conn, json_string_value(j_hash));
+    if (hash_clause == NULL) {
+      hash_clause = msprintf("IN (%s", hash_escaped);
+    } else {
+      hash_clause = mstrcatf(hash_clause, ",%s", hash_escaped);
+    }
+    o_free(hash_escaped);
+  }
+  hash_clause = mstrcatf(hash_clause, ")");
+  counter_clause = msprintf("(gak_counter + %s)", increment);
+  j_query = json_pack("{sss{s{ss}}s{s{ssss}}}",
+                      "table",
+                      GLEWLWYD_TABLE_API_KEY,
+                      "set",
+                        "gak_counter",
+                          "raw",
+                          counter_clause,
+                      "where",
+                        "gak_token_hash",
+                          "operator",
+                          "raw",
+                          "value",
+                          hash_clause);
+  o_free(counter_clause);
+  o_free(hash_clause);
+  res = h_update(conn, j_query, NULL);
+  json_decref(j_query);
+  if (res == H_OK) {
+    ret = G_OK;
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "api_key_cache_update - Error executing j_query");
+    ret = G_ERROR_DB;
+  }
+  return ret;
+}
+
+/**
+ * Writes the pending API keys counters in the database
+ * The API keys with the same increment are updated together, by batches of GLEWLWYD_API_KEY_BATCH_SIZE API keys
+ */
+static void api_key_cache_flush(struct config_elements * config) {
+  struct _glwd_api_key_cache * api_key_cache = &config->api_key_cache;
+  struct _h_connection * conn;
+  json_t * j_counters = NULL, * j_counter = NULL, * j_groups, * j_group = NULL, * j_batch, * j_hash = NULL;
+  const char * key_hash = NULL, * key_count = NULL;
+  char * count;
+  size_t index = 0;
+
+  if (!pthread_mutex_lock(&api_key_cache->lock)) {
+    if (json_object_size(api_key_cache->j_counters)) {
+      j_counters = api_key_cache->j_counters;
+      api_key_cache->j_counters = json_object();
+    }
+    pthread_mutex_unlock(&api_key_cache->lock);
+  }
+  if (j_counters != NULL) {
+    j_groups = json_object();
+    json_object_foreach(j_counters, key_hash, j_counter) {
+      count = msprintf("%" JSON_INTEGER_FORMAT, json_integer_value(j_counter));
+      if (json_object_get(j_groups, count) == NULL) {
+        json_object_set_new(j_groups, count, json_array());
+      }
+      json_array_append_new(json_object_get(j_groups, count), json_string(key_hash));
+      o_free(count);
+    }
+    conn = glewlwyd_db_pool_acquire(config);
+    json_object_foreach(j_groups, key_count, j_group) {
+      j_batch = json_array();
+      json_array_foreach(j_group, index, j_hash) {
+        json_array_append(j_batch, j_hash);
+        if (json_array_size(j_batch) == GLEWLWYD_API_KEY_BATCH_SIZE || index == json_array_size(j_group)-1) {
+          if (api_key_cache_update(conn, key_count, j_batch) != G_OK) {
+            y_log_message(Y_LOG_LEVEL_ERROR, "api_key_cache_flush - Error api_key_cache_update, %zu counters lost", json_array_size(j_batch));
+          }
+          json_array_clear(j_batch);
+        }
+      }
+      json_decref(j_batch);
+    }
+    glewlwyd_db_pool_release(config, conn);
+    json_decref(j_groups);
+    json_decref(j_counters);
+  }
+}
+
+/**
+ * Worker thread, flushes the pending API keys counters and reloads the enabled API keys every flush_interval seconds
+ * The remaining counters are flushed when the thread is stopped
+ */
+static void * api_key_cache_run(void * args) {
+  struct config_elements * config = (struct config_elements *)args;
+  struct _glwd_api_key_cache * api_key_cache = &config->api_key_cache;
+  struct timespec abstime;
+  int end = 0;
+
+  while (!end) {
+    if (!pthread_mutex_lock(&api_key_cache->lock)) {
+      if (!api_key_cache->stop) {
+        clock_gettime(CLOCK_REALTIME, &abstime);
+        abstime.tv_sec += api_key_cache->flush_interval;
+        pthread_cond_timedwait(&api_key_cache->cond, &api_key_cache->lock, &abstime);
+      }
+      end = api_key_cache->stop;
+      pthread_mutex_unlock(&api_key_cache->lock);
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "api_key_cache_run - Error lock");
+      end = 1;
+    }
+    api_key_cache_flush(config);
+    if (!end && api_key_cache_reload(config) != G_OK) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "api_key_cache_run - Error api_key_cache_reload");
+    }
+  }
+  return NULL;
+}
+
+int glewlwyd_api_key_cache_init(struct config_elements * config) {
+  struct _glwd_api_key_cache * api_key_cache = &config->api_key_cache;
+  int ret = G_OK;
+
+  api_key_cache->initialized = 0;
+  api_key_cache->stop = 0;
+  api_key_cache->version = 0;
+  api_key_cache->j_keys = NULL;
+  api_key_cache->j_counters = NULL;
+  if (api_key_cache->flush_interval) {
+    if ((api_key_cache->j_keys = api_key_cache_load_db(config)) != NULL) {
+      if (!pthread_mutex_init(&api_key_cache->lock, NULL)) {
+        if (!pthread_cond_init(&api_key_cache->cond, NULL)) {
+          api_key_cache->j_counters = json_object();
+          if (!pthread_create(&api_key_cache->thread, NULL, api_key_cache_run, (void *)config)) {
+            api_key_cache->initialized = 1;
+          } else {
+            y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_api_key_cache_init - Error pthread_create");
+            pthread_cond_destroy(&api_key_cache->cond);
+            pthread_mutex_destroy(&api_key_cache->lock);
+            ret = G_ERROR;
+          }
+        } else {
+          y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_api_key_cache_init - Error initializing cond");
+          pthread_mutex_destroy(&api_key_cache->lock);
+          ret = G_ERROR;
+        }
+      } else {
+        y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_api_key_cache_init - Error initializing lock");
+        ret = G_ERROR;
+      }
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_api_key_cache_init - Error api_key_cache_load_db");
+      ret = G_ERROR_DB;
+    }
+    if (ret != G_OK) {
+      json_decref(api_key_cache->j_keys);
+      api_key_cache->j_keys = NULL;
+      json_decref(api_key_cache->j_counters);
+      api_key_cache->j_counters = NULL;
+    }
+  }
+  return ret;
+}
+
+/**
+ * Stops the worker thread after the pending counters are written in the database
+ */
+void glewlwyd_api_key_cache_close(struct config_elements * config) {
+  struct _glwd_api_key_cache * api_key_cache = &config->api_key_cache;
+
+  if (api_key_cache->initialized) {
+    if (!pthread_mutex_lock(&api_key_cache->lock)) {
+      api_key_cache->stop = 1;
+      pthread_cond_signal(&api_key_cache->cond);
+      pthread_mutex_unlock(&api_key_cache->lock);
+    }
+    pthread_join(api_key_cache->thread, NULL);
+    json_decref(api_key_cache->j_keys);
+    api_key_cache->j_keys = NULL;
+    json_decref(api_key_cache->j_counters);
+    api_key_cache->j_counters = NULL;
+    pthread_cond_destroy(&api_key_cache->cond);
+    pthread_mutex_destroy(&api_key_cache->lock);
+    api_key_cache->initialized = 0;
+  }
+}
+
+/**
+ * Verifies an API key and increments its counter
+ * If the API key cache is enabled, the key is checked in memory and the counter is written later in the database
+ */
 int verify_api_key(struct config_elements * config, const char * token) {
+  struct _glwd_api_key_cache * api_key_cache = &config->api_key_cache;
+  struct _h_connection * conn;
   json_t * j_query, * j_result = NULL;
   int res, ret;
-  char * token_hash = NULL, * tmp;
+  char * token_hash = NULL;
   
   if (o_strlen(token) == GLEWLWYD_API_KEY_LENGTH) {
-    token_hash = generate_hash(config->hash_algorithm, token);
-    tmp = str_replace(token_hash, "/", "_");
-    o_free(token_hash);
-    token_hash = str_replace(tmp, "+", "-");
-    o_free(tmp);
-    j_query = json_pack("{sss[ss]s{ss?si}}",
-                        "table",
-                        GLEWLWYD_TABLE_API_KEY,
-                        "columns",
-                          "gak_id",
-                          "gak_counter",
-                        "where",
-                          "gak_token_hash",
-                          token_hash,
-                          "gak_enabled",
-                          1);
-    o_free(token_hash);
-    res = h_select(config->conn, j_query, &j_result, NULL);
-    json_decref(j_query);
-    if (res == H_OK) {
-      if (json_array_size(j_result)) {
-        j_query = json_pack("{sss{sI}s{sO}}",
-                            "table",
-                            GLEWLWYD_TABLE_API_KEY,
-                            "set",
-                              "gak_counter",
-                              json_integer_value(json_object_get(json_array_get(j_result, 0), "gak_counter"))+1,
-                            "where",
-                              "gak_id",
-                              json_object_get(json_array_get(j_result, 0), "gak_id"));
-        res = h_update(config->conn, j_query, NULL);
-        json_decref(j_query);
-        if (res == H_OK) {
+    token_hash = api_key_hash(config, token);
+    if (api_key_cache->initialized) {
+      if (!pthread_mutex_lock(&api_key_cache->lock)) {
+        if (json_object_get(api_key_cache->j_keys, token_hash) != NULL) {
+          json_object_set_new(api_key_cache->j_counters, token_hash, json_integer(json_integer_value(json_object_get(api_key_cache->j_counters, token_hash))+1));
           ret = G_OK;
         } else {
-          y_log_message(Y_LOG_LEVEL_ERROR, "verify_api_key - Error executing j_query (2)");
-          ret = G_ERROR_DB;
+          ret = G_ERROR_UNAUTHORIZED;
         }
+        pthread_mutex_unlock(&api_key_cache->lock);
       } else {
-        ret = G_ERROR_UNAUTHORIZED;
+        y_log_message(Y_LOG_LEVEL_ERROR, "verify_api_key - Error lock");
+        ret = G_ERROR;
       }
-      json_decref(j_result);
     } else {
-      y_log_message(Y_LOG_LEVEL_ERROR, "verify_api_key - Error executing j_query (1)");
-      ret = G_ERROR_DB;
+      conn = glewlwyd_db_pool_acquire(config);
+      j_query = json_pack("{sss[s]s{ss?si}}",
+                          "table",
+                          GLEWLWYD_TABLE_API_KEY,
+                          "columns",
+                            "gak_id",
+                          "where",
+                            "gak_token_hash",
+                            token_hash,
+                            "gak_enabled",
+                            1);
+      res = h_select(conn, j_query, &j_result, NULL);
+      json_decref(j_query);
+      if (res == H_OK) {
+        if (json_array_size(j_result)) {
+          j_query = json_pack("{sss{s{ss}}s{sO}}",
+                              "table",
+                              GLEWLWYD_TABLE_API_KEY,
+                              "set",
+                                "gak_counter",
+                                  "raw",
+                                  "(gak_counter + 1)",
+                              "where",
+                                "gak_id",
+                                json_object_get(json_array_get(j_result, 0), "gak_id"));
+          res = h_update(conn, j_query, NULL);
+          json_decref(j_query);
+          if (res == H_OK) {
+            ret = G_OK;
+          } else {
+            y_log_message(Y_LOG_LEVEL_ERROR, "verify_api_key - Error executing j_query (2)");
+            ret = G_ERROR_DB;
+          }
+        } else {
+          ret = G_ERROR_UNAUTHORIZED;
+        }
+        json_decref(j_result);
+      } else {
+        y_log_message(Y_LOG_LEVEL_ERROR, "verify_api_key - Error executing j_query (1)");
+        ret = G_ERROR_DB;
+      }
+      glewlwyd_db_pool_release(config, conn);
     }
+    o_free(token_hash);
   } else {
     ret = G_ERROR_UNAUTHORIZED;
   }
@@ -85,6 +403,7 @@ int verify_api_key(struct config_elements * config, const char * token) {
 }
 
 json_t * get_api_key_list(struct config_elements * config, const char * pattern, size_t offset, size_t limit) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   json_t * j_query, * j_result, * j_return, * j_element;
   int res;
   size_t index;
@@ -97,7 +416,7 @@ json_t * get_api_key_list(struct config_elements * config, const char * pattern,
                         "gak_token_hash AS token_hash",
                         "gak_counter AS counter",
                         "gak_username AS username",
-                        SWITCH_DB_TYPE(config->conn->type, "UNIX_TIMESTAMP(gak_issued_at) AS issued_at", "strftime('%s', gak_issued_at) AS issued_at", "EXTRACT(EPOCH FROM gak_issued_at)::integer AS issued_at"),
+                        SWITCH_DB_TYPE(conn->type, "UNIX_TIMESTAMP(gak_issued_at) AS issued_at", "strftime('%s', gak_issued_at) AS issued_at", "EXTRACT(EPOCH FROM gak_issued_at)::integer AS issued_at"),
                         "gak_issued_for AS issued_for",
                         "gak_user_agent AS user_agent",
                         "gak_enabled",
@@ -109,13 +428,13 @@ json_t * get_api_key_list(struct config_elements * config, const char * pattern,
     json_object_set_new(j_query, "limit", json_integer(limit));
   }
   if (o_strlen(pattern)) {
-    pattern_escaped = h_escape_string_with_quotes(config->conn, pattern);
+    pattern_escaped = h_escape_string_with_quotes(conn, pattern);
     pattern_clause = msprintf("IN (SELECT gak_id FROM " GLEWLWYD_TABLE_API_KEY " WHERE gak_username LIKE '%%'||%s||'%%' OR gak_issued_for LIKE '%%'||%s||'%%' OR gak_user_agent LIKE '%%'||%s||'%%')", pattern_escaped, pattern_escaped, pattern_escaped);
     json_object_set_new(j_query, "where", json_pack("{s{ssss}}", "gak_id", "operator", "raw", "value", pattern_clause));
     o_free(pattern_escaped);
     o_free(pattern_clause);
   }
-  res = h_select(config->conn, j_query, &j_result, NULL);
+  res = h_select(conn, j_query, &j_result, NULL);
   json_decref(j_query);
   if (res == H_OK) {
     json_array_foreach(j_result, index, j_element) {
@@ -127,20 +446,18 @@ json_t * get_api_key_list(struct config_elements * config, const char * pattern,
     y_log_message(Y_LOG_LEVEL_ERROR, "get_api_key_list - Error executing j_query");
     j_return = json_pack("{si}", "result", G_ERROR_DB);
   }
+  glewlwyd_db_pool_release(config, conn);
   return j_return;
 }
 
 json_t * generate_api_key(struct config_elements * config, const char * username, const char * issued_for, const char * user_agent) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   json_t * j_query, * j_return;
   int res;
-  char token[GLEWLWYD_API_KEY_LENGTH+1] = {0}, * token_hash, * tmp;
+  char token[GLEWLWYD_API_KEY_LENGTH+1] = {0}, * token_hash;
   
   rand_string(token, GLEWLWYD_API_KEY_LENGTH);
-  token_hash = generate_hash(config->hash_algorithm, token);
-  tmp = str_replace(token_hash, "/", "_");
-  o_free(token_hash);
-  token_hash = str_replace(tmp, "+", "-");
-  o_free(tmp);
+  token_hash = api_key_hash(config, token);
   if (token_hash != NULL) {
     j_query = json_pack("{sss{ssssssss?}}",
                         "table",
@@ -154,9 +471,10 @@ json_t * generate_api_key(struct config_elements * config, const char * username
                           issued_for,
                           "gak_user_agent",
                           user_agent);
-    res = h_insert(config->conn, j_query, NULL);
+    res = h_insert(conn, j_query, NULL);
     json_decref(j_query);
     if (res == H_OK) {
+      api_key_cache_set(config, token_hash, 1);
       j_return = json_pack("{sis{ss}}", "result", G_OK, "api_key", "key", token);
     } else {
       y_log_message(Y_LOG_LEVEL_ERROR, "generate_api_key - Error executing j_query");
@@ -167,10 +485,12 @@ json_t * generate_api_key(struct config_elements * config, const char * username
     j_return = json_pack("{si}", "result", G_ERROR);
   }
   o_free(token_hash);
+  glewlwyd_db_pool_release(config, conn);
   return j_return;
 }
 
 int disable_api_key(struct config_elements * config, const char * token_hash) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   json_t * j_query;
   int res, ret;
   
@@ -185,13 +505,15 @@ int disable_api_key(struct config_elements * config, const char * token_hash) {
                         token_hash,
                         "gak_enabled",
                         1);
-  res = h_update(config->conn, j_query, NULL);
+  res = h_update(conn, j_query, NULL);
   json_decref(j_query);
   if (res == H_OK) {
+    api_key_cache_set(config, token_hash, 0);
     ret = G_OK;
   } else {
     y_log_message(Y_LOG_LEVEL_ERROR, "disable_api_key - Error executing j_query");
     ret = G_ERROR_DB;
   }
+  glewlwyd_db_pool_release(config, conn);
   return ret;
 }
@@ -38,13 +38,15 @@ json_t * auth_check_client_credentials(struct config_elements * config, const ch
         client_module = get_client_module_instance(config, json_string_value(json_object_get(j_module, "name")));
         if (client_module != NULL) {
           if (client_module->enabled) {
-            j_client = client_module->module->client_module_get(config->config_m, client_id, client_module->cls);
+            j_client = client_module_instance_get(config, client_module, client_id);
             if (check_result_value(j_client, G_OK)) {
-              res = client_module->module->client_module_check_password(config->config_m, client_id, password, client_module->cls);
+              res = client_module_instance_check_password(config, client_module, client_id, password);
               if (res == G_OK) {
                 j_return = json_pack("{si}", "result", G_OK);
               } else if (res == G_ERROR_UNAUTHORIZED) {
                 j_return = json_pack("{si}", "result", G_ERROR_UNAUTHORIZED);
+              } else if (res == G_ERROR_UNAVAILABLE) {
+                j_return = json_pack("{si}", "result", G_ERROR_UNAVAILABLE);
               } else if (res != G_ERROR_NOT_FOUND) {
                 y_log_message(Y_LOG_LEVEL_ERROR, "auth_check_client_credentials - Error, client_module_check_password for module '%s', skip", client_module->name);
 	      }
@@ -80,7 +82,7 @@ json_t * get_client(struct config_elements * config, const char * client_id, con
   } else if (source != NULL) {
     client_module = get_client_module_instance(config, source);
     if (client_module != NULL) {
-      j_client = client_module->module->client_module_get(config->config_m, client_id, client_module->cls);
+      j_client = client_module_instance_get(config, client_module, client_id);
       if (check_result_value(j_client, G_OK)) {
         json_object_set_new(json_object_get(j_client, "client"), "source", json_string(source));
         j_return = json_incref(j_client);
@@ -102,7 +104,7 @@ json_t * get_client(struct config_elements * config, const char * client_id, con
           client_module = get_client_module_instance(config, json_string_value(json_object_get(j_module, "name")));
           if (client_module != NULL) {
             if (client_module->enabled) {
-              j_client = client_module->module->client_module_get(config->config_m, client_id, client_module->cls);
+              j_client = client_module_instance_get(config, client_module, client_id);
               if (check_result_value(j_client, G_OK)) {
                 json_object_set_new(json_object_get(j_client, "client"), "source", json_string(client_module->name));
                 j_return = json_incref(j_client);
@@ -140,7 +142,7 @@ json_t * get_client_list(struct config_elements * config, const char * pattern,
     client_module = get_client_module_instance(config, source);
     if (client_module != NULL && client_module->enabled) {
       result = G_ERROR;
-      j_list_parsed = client_module->module->client_module_get_list(config->config_m, pattern, offset, limit, client_module->cls);
+      j_list_parsed = client_module_instance_get_list(config, client_module, pattern, offset, limit);
       if (check_result_value(j_list_parsed, G_OK)) {
         json_array_foreach(json_object_get(j_list_parsed, "list"), index, j_element) {
           json_object_set_new(j_element, "source", json_string(client_module->name));
@@ -169,8 +171,8 @@ json_t * get_client_list(struct config_elements * config, const char * pattern,
             client_module = get_client_module_instance(config, json_string_value(json_object_get(j_module, "name")));
             if (client_module != NULL && client_module->enabled) {
               result = G_ERROR;
-              if ((count_total = client_module->module->client_module_count_total(config->config_m, pattern, client_module->cls)) > cur_offset && cur_limit) {
-                j_list_parsed = client_module->module->client_module_get_list(config->config_m, pattern, cur_offset, cur_limit, client_module->cls);
+              if ((count_total = client_module_instance_count_total(config, client_module, pattern)) > cur_offset && cur_limit) {
+                j_list_parsed = client_module_instance_get_list(config, client_module, pattern, cur_offset, cur_limit);
                 if (check_result_value(j_list_parsed, G_OK)) {
                   json_array_foreach(json_object_get(j_list_parsed, "list"), index_c, j_element) {
                     json_object_set_new(j_element, "source", json_string(client_module->name));
@@ -216,7 +218,7 @@ json_t * is_client_valid(struct config_elements * config, const char * client_id
   if (source != NULL) {
     client_module = get_client_module_instance(config, source);
     if (client_module != NULL && client_module->enabled && !client_module->readonly) {
-      j_error_list = client_module->module->client_module_is_valid(config->config_m, client_id, j_client, add?GLEWLWYD_IS_VALID_MODE_ADD:GLEWLWYD_IS_VALID_MODE_UPDATE, client_module->cls);
+      j_error_list = client_module_instance_is_valid(config, client_module, client_id, j_client, add?GLEWLWYD_IS_VALID_MODE_ADD:GLEWLWYD_IS_VALID_MODE_UPDATE);
       if (check_result_value(j_error_list, G_ERROR_PARAM) || check_result_value(j_error_list, G_OK)) {
         j_return = json_incref(j_error_list);
       } else {
@@ -240,7 +242,7 @@ json_t * is_client_valid(struct config_elements * config, const char * client_id
           client_module = get_client_module_instance(config, json_string_value(json_object_get(j_module, "name")));
           if (client_module != NULL && client_module->enabled && !client_module->readonly) {
             found = 1;
-            j_error_list = client_module->module->client_module_is_valid(config->config_m, client_id, j_client, add?GLEWLWYD_IS_VALID_MODE_ADD:GLEWLWYD_IS_VALID_MODE_UPDATE, client_module->cls);
+            j_error_list = client_module_instance_is_valid(config, client_module, client_id, j_client, add?GLEWLWYD_IS_VALID_MODE_ADD:GLEWLWYD_IS_VALID_MODE_UPDATE);
             if (check_result_value(j_error_list, G_ERROR_PARAM) || check_result_value(j_error_list, G_OK)) {
               j_return = json_incref(j_error_list);
             } else {
@@ -274,7 +276,7 @@ int add_client(struct config_elements * config, json_t * j_client, const char *
   if (source != NULL) {
     client_module = get_client_module_instance(config, source);
     if (client_module != NULL && client_module->enabled && !client_module->readonly) {
-      result = client_module->module->client_module_add(config->config_m, j_client, client_module->cls);
+      result = client_module_instance_add(config, client_module, j_client);
       if (result == G_OK) {
         ret = G_OK;
       } else {
@@ -296,7 +298,7 @@ int add_client(struct config_elements * config, json_t * j_client, const char *
           client_module = get_client_module_instance(config, json_string_value(json_object_get(j_module, "name")));
           if (client_module != NULL && client_module->enabled && !client_module->readonly) {
             found = 1;
-            result = client_module->module->client_module_add(config->config_m, j_client, client_module->cls);
+            result = client_module_instance_add(config, client_module, j_client);
             if (result == G_OK) {
               ret = G_OK;
             } else {
@@ -330,9 +332,9 @@ int set_client(struct config_elements * config, const char * client_id, json_t *
   if (source != NULL) {
     client_module = get_client_module_instance(config, source);
     if (client_module != NULL && client_module->enabled && !client_module->readonly) {
-      j_cur_client = client_module->module->client_module_get(config->config_m, client_id, client_module->cls);
+      j_cur_client = client_module_instance_get(config, client_module, client_id);
       if (check_result_value(j_cur_client, G_OK)) {
-        ret = client_module->module->client_module_update(config->config_m, client_id, j_client, client_module->cls);
+        ret = client_module_instance_update(config, client_module, client_id, j_client);
         if (ret != G_OK) {
           y_log_message(Y_LOG_LEVEL_ERROR, "set_client - Error client_module_update");
         }
@@ -357,7 +359,7 @@ int set_client(struct config_elements * config, const char * client_id, json_t *
           client_module = get_client_module_instance(config, json_string_value(json_object_get(j_module, "name")));
           if (client_module != NULL && client_module->enabled && !client_module->readonly) {
             found = 1;
-            result = client_module->module->client_module_update(config->config_m, client_id, j_client, client_module->cls);
+            result = client_module_instance_update(config, client_module, client_id, j_client);
             if (result == G_OK) {
               ret = G_OK;
             } else {
@@ -391,9 +393,9 @@ int delete_client(struct config_elements * config, const char * client_id, const
   if (source != NULL) {
     client_module = get_client_module_instance(config, source);
     if (client_module != NULL && client_module->enabled && !client_module->readonly) {
-      j_client = client_module->module->client_module_get(config->config_m, client_id, client_module->cls);
+      j_client = client_module_instance_get(config, client_module, client_id);
       if (check_result_value(j_client, G_OK)) {
-        result = client_module->module->client_module_delete(config->config_m, client_id, client_module->cls);
+        result = client_module_instance_delete(config, client_module, client_id);
         if (result == G_OK) {
           ret = G_OK;
         } else {
@@ -421,7 +423,7 @@ int delete_client(struct config_elements * config, const char * client_id, const
           client_module = get_client_module_instance(config, json_string_value(json_object_get(j_module, "name")));
           if (client_module != NULL && client_module->enabled && !client_module->readonly) {
             found = 1;
-            result = client_module->module->client_module_delete(config->config_m, client_id, client_module->cls);
+            result = client_module_instance_delete(config, client_module, client_id);
             if (result == G_OK) {
               ret = G_OK;
             } else {
@@ -445,3 +447,114 @@ int delete_client(struct config_elements * config, const char * client_id, const
   }
   return ret;
 }
+
+/**
+ * Client module calls, measure the duration and the number of concurrent calls of each module function
+ */
+json_t * client_module_instance_init(struct config_elements * config, struct _client_module_instance * instance, json_t * j_parameters) {
+  struct timespec start;
+  json_t * j_return;
+
+  glewlwyd_metrics_call_start(instance->metrics_in_flight, &start);
+  j_return = instance->module->client_module_init(config->config_m, instance->readonly, j_parameters, &instance->cls);
+  glewlwyd_metrics_call_end(instance->metrics_in_flight, instance->metrics_duration[GLWD_METRICS_CLIENT_MODULE_INIT], &start);
+  return j_return;
+}
+
+int client_module_instance_close(struct config_elements * config, struct _client_module_instance * instance) {
+  struct timespec start;
+  int ret;
+
+  glewlwyd_metrics_call_start(instance->metrics_in_flight, &start);
+  ret = instance->module->client_module_close(config->config_m, instance->cls);
+  glewlwyd_metrics_call_end(instance->metrics_in_flight, instance->metrics_duration[GLWD_METRICS_CLIENT_MODULE_CLOSE], &start);
+  return ret;
+}
+
+size_t client_module_instance_count_total(struct config_elements * config, struct _client_module_instance * instance, const char * pattern) {
+  struct timespec start;
+  size_t ret;
+
+  glewlwyd_metrics_call_start(instance->metrics_in_flight, &start);
+  ret = instance->module->client_module_count_total(config->config_m, pattern, instance->cls);
+  glewlwyd_metrics_call_end(instance->metrics_in_flight, instance->metrics_duration[GLWD_METRICS_CLIENT_MODULE_COUNT_TOTAL], &start);
+  return ret;
+}
+
+json_t * client_module_instance_get_list(struct config_elements * config, struct _client_module_instance * instance, const char * pattern, size_t offset, size_t limit) {
+  struct timespec start;
+  json_t * j_return;
+
+  glewlwyd_metrics_call_start(instance->metrics_in_flight, &start);
+  j_return = instance->module->client_module_get_list(config->config_m, pattern, offset, limit, instance->cls);
+  glewlwyd_metrics_call_end(instance->metrics_in_flight, instance->metrics_duration[GLWD_METRICS_CLIENT_MODULE_GET_LIST], &start);
+  return j_return;
+}
+
+json_t * client_module_instance_get(struct config_elements * config, struct _client_module_instance * instance, const char * client_id) {
+  struct timespec start;
+  json_t * j_return;
+
+  glewlwyd_metrics_call_start(instance->metrics_in_flight, &start);
+  j_return = instance->module->client_module_get(config->config_m, client_id, instance->cls);
+  glewlwyd_metrics_call_end(instance->metrics_in_flight, instance->metrics_duration[GLWD_METRICS_CLIENT_MODULE_GET], &start);
+  return j_return;
+}
+
+json_t * client_module_instance_is_valid(struct config_elements * config, struct _client_module_instance * instance, const char * client_id, json_t * j_client, int mode) {
+  struct timespec start;
+  json_t * j_return;
+
+  glewlwyd_metrics_call_start(instance->metrics_in_flight, &start);
+  j_return = instance->module->client_module_is_valid(config->config_m, client_id, j_client, mode, instance->cls);
+  glewlwyd_metrics_call_end(instance->metrics_in_flight, instance->metrics_duration[GLWD_METRICS_CLIENT_MODULE_IS_VALID], &start);
+  return j_return;
+}
+
+int client_module_instance_add(struct config_elements * config, struct _client_module_instance * instance, json_t * j_client) {
+  struct timespec start;
+  int ret;
+
+  glewlwyd_metrics_call_start(instance->metrics_in_flight, &start);
+  ret = instance->module->client_module_add(config->config_m, j_client, instance->cls);
+  glewlwyd_metrics_call_end(instance->metrics_in_flight, instance->metrics_duration[GLWD_METRICS_CLIENT_MODULE_ADD], &start);
+  return ret;
+}
+
+int client_module_instance_update(struct config_elements * config, struct _client_module_instance * instance, const char * client_id, json_t * j_client) {
+  struct timespec start;
+  int ret;
+
+  glewlwyd_metrics_call_start(instance->metrics_in_flight, &start);
+  ret = instance->module->client_module_update(config->config_m, client_id, j_client, instance->cls);
+  glewlwyd_metrics_call_end(instance->metrics_in_flight, instance->metrics_duration[GLWD_METRICS_CLIENT_MODULE_UPDATE], &start);
+  return ret;
+}
+
+int client_module_instance_delete(struct config_elements * config, struct _client_module_instance * instance, const char * client_id) {
+  struct timespec start;
+  int ret;
+
+  glewlwyd_metrics_call_start(instance->metrics_in_flight, &start);
+  ret = instance->module->client_module_delete(config->config_m, client_id, instance->cls);
+  glewlwyd_metrics_call_end(instance->metrics_in_flight, instance->metrics_duration[GLWD_METRICS_CLIENT_MODULE_DELETE], &start);
+  return ret;
+}
+
+static int client_module_instance_run_check_password(struct config_elements * config, void * instance, const char * client_id, const char * password) {
+  struct _client_module_instance * client_module = (struct _client_module_instance *)instance;
+  struct timespec start;
+  int ret;
+
+  glewlwyd_metrics_call_start(client_module->metrics_in_flight, &start);
+  ret = client_module->module->client_module_check_password(config->config_m, client_id, password, client_module->cls);
+  glewlwyd_metrics_call_end(client_module->metrics_in_flight, client_module->metrics_duration[GLWD_METRICS_CLIENT_MODULE_CHECK_PASSWORD], &start);
+  return ret;
+}
+
+/**
+ * The password check is run by the password pool if enabled, returns G_ERROR_UNAVAILABLE if the pool is busy
+ */
+int client_module_instance_check_password(struct config_elements * config, struct _client_module_instance * instance, const char * client_id, const char * password) {
+  return glewlwyd_password_pool_run(config, 1, &client_module_instance_run_check_password, (void *)instance, client_id, password);
+}
@@ -25,6 +25,9 @@
  */
 
 #include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
 #include <ldap.h>
 #include <jansson.h>
 #include <yder.h>
@@ -32,6 +35,22 @@
 #include "glewlwyd-common.h"
 
 #define LDAP_DEFAULT_PAGE_SIZE 50
+#define LDAP_DEFAULT_POOL_SIZE 4
+#define LDAP_DEFAULT_POOL_IDLE_TIMEOUT 300
+
+struct ldap_pool_handle {
+  LDAP * ldap;
+  time_t last_used;
+  int    in_use;
+};
+
+struct mod_parameters {
+  json_t                  * j_params;
+  pthread_mutex_t           lock;
+  struct ldap_pool_handle * handles;
+  size_t                    pool_size;
+  time_t                    idle_timeout;
+};
 
 static json_t * is_client_ldap_parameters_valid(json_t * j_params, int readonly) {
   json_t * j_return, * j_error = json_array(), * j_element = NULL, * j_element_p;
@@ -64,6 +83,16 @@ static json_t * is_client_ldap_parameters_valid(json_t * j_params, int readonly)
       } else if (json_object_get(j_params, "page-size") == NULL) {
         json_object_set_new(j_params, "page-size", json_integer(LDAP_DEFAULT_PAGE_SIZE));
       }
+      if (json_object_get(j_params, "pool-size") != NULL && (!json_is_integer(json_object_get(j_params, "pool-size")) || json_integer_value(json_object_get(j_params, "pool-size")) < 0)) {
+        json_array_append_new(j_error, json_string("pool-size is optional and must be a positive integer or 0"));
+      } else if (json_object_get(j_params, "pool-size") == NULL) {
+        json_object_set_new(j_params, "pool-size", json_integer(LDAP_DEFAULT_POOL_SIZE));
+      }
+      if (json_object_get(j_params, "pool-idle-timeout") != NULL && (!json_is_integer(json_object_get(j_params, "pool-idle-timeout")) || json_integer_value(json_object_get(j_params, "pool-idle-timeout")) < 0)) {
+        json_array_append_new(j_error, json_string("pool-idle-timeout is optional and must be a positive integer or 0"));
+      } else if (json_object_get(j_params, "pool-idle-timeout") == NULL) {
+        json_object_set_new(j_params, "pool-idle-timeout", json_integer(LDAP_DEFAULT_POOL_IDLE_TIMEOUT));
+      }
       if (!json_string_length(json_object_get(j_params, "base-search"))) {
         json_array_append_new(j_error, json_string("base-search is mandatory and must be a string"));
       }
@@ -354,6 +383,185 @@ static LDAP * connect_ldap_server(json_t * j_params) {
   return ldap;
 }
 
+/**
+ * Returns true if the connection looks still open
+ * A bound connection waiting for a request has nothing to read,
+ * so a readable socket means the server closed it or sent a notice of disconnection
+ */
+static int is_ldap_connection_alive(LDAP * ldap) {
+  struct pollfd pfd;
+  int fd = -1, ret = 0;
+
+  if (ldap_get_option(ldap, LDAP_OPT_DESC, &fd) == LDAP_OPT_SUCCESS && fd >= 0) {
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    ret = (poll(&pfd, 1, 0) == 0);
+  }
+  return ret;
+}
+
+static int is_ldap_connection_error(int result_code) {
+  return (result_code == LDAP_SERVER_DOWN || result_code == LDAP_CONNECT_ERROR || result_code == LDAP_TIMEOUT || result_code == LDAP_UNAVAILABLE);
+}
+
+/**
+ * Checkout a connection bound with the service account
+ * Pooled connections idle for more than pool-idle-timeout seconds or closed by the server are reopened
+ * If all the pooled connections are in use, a new connection is opened and closed on release
+ * Every call must be followed by a call to ldap_pool_release
+ */
+static LDAP * ldap_pool_acquire(struct mod_parameters * param) {
+  LDAP * ldap = NULL;
+  struct ldap_pool_handle * handle = NULL;
+  size_t i;
+  time_t now, last_used = 0;
+
+  if (param->pool_size) {
+    time(&now);
+    if (!pthread_mutex_lock(&param->lock)) {
+      for (i=0; i<param->pool_size; i++) {
+        if (!param->handles[i].in_use) {
+          if (param->handles[i].ldap != NULL) {
+            handle = &param->handles[i];
+            break;
+          } else if (handle == NULL) {
+            handle = &param->handles[i];
+          }
+        }
+      }
+      if (handle != NULL) {
+        handle->in_use = 1;
+        ldap = handle->ldap;
+        last_used = handle->last_used;
+      }
+      pthread_mutex_unlock(&param->lock);
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "ldap_pool_acquire - Error lock");
+    }
+    if (handle != NULL) {
+      if (ldap != NULL && ((param->idle_timeout && (now - last_used) >= param->idle_timeout) || !is_ldap_connection_alive(ldap))) {
+        ldap_unbind_ext(ldap, NULL, NULL);
+        ldap = NULL;
+      }
+      if (ldap == NULL) {
+        ldap = connect_ldap_server(param->j_params);
+      }
+      if (!pthread_mutex_lock(&param->lock)) {
+        handle->ldap = ldap;
+        if (ldap == NULL) {
+          handle->in_use = 0;
+        }
+        pthread_mutex_unlock(&param->lock);
+      }
+    } else {
+      ldap = connect_ldap_server(param->j_params);
+    }
+  } else {
+    ldap = connect_ldap_server(param->j_params);
+  }
+  return ldap;
+}
+
+/**
+ * Gives back a connection checked out with ldap_pool_acquire
+ * The connection is closed if the last operation failed with a connection error,
+ * so the next checkout reconnects
+ */
+static void ldap_pool_release(struct mod_parameters * param, LDAP * ldap) {
+  int result_code = LDAP_SUCCESS, found = 0;
+  size_t i;
+
+  if (ldap != NULL) {
+    ldap_get_option(ldap, LDAP_OPT_RESULT_CODE, &result_code);
+    if (param->pool_size && !pthread_mutex_lock(&param->lock)) {
+      for (i=0; i<param->pool_size; i++) {
+        if (param->handles[i].in_use && param->handles[i].ldap == ldap) {
+          found = 1;
+          param->handles[i].in_use = 0;
+          if (is_ldap_connection_error(result_code)) {
+            param->handles[i].ldap = NULL;
+          } else {
+            time(&param->handles[i].last_used);
+          }
+          break;
+        }
+      }
+      pthread_mutex_unlock(&param->lock);
+    }
+    if (!found || is_ldap_connection_error(result_code)) {
+      ldap_unbind_ext(ldap, NULL, NULL);
+    }
+  }
+}
+
+/**
+ * Checks a password by binding with the given dn on a new connection
+ * so the pooled connections stay bound with the service account
+ */
+static int check_ldap_bind(json_t * j_params, const char * dn, const char * password) {
+  LDAP * ldap = NULL;
+  int ldap_version = LDAP_VERSION3, ret;
+  char * ldap_mech = LDAP_SASL_SIMPLE;
+  struct berval cred, * servcred;
+
+  cred.bv_val = (char *)password;
+  cred.bv_len = o_strlen(password);
+
+  if (ldap_initialize(&ldap, json_string_value(json_object_get(j_params, "uri"))) != LDAP_SUCCESS) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "check_ldap_bind ldap - Error initializing ldap");
+    ret = G_ERROR;
+  } else if (ldap_set_option(ldap, LDAP_OPT_PROTOCOL_VERSION, &ldap_version) != LDAP_OPT_SUCCESS) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "check_ldap_bind ldap - Error setting ldap protocol version");
+    ret = G_ERROR;
+  } else if (ldap_sasl_bind_s(ldap, dn, ldap_mech, &cred, NULL, NULL, &servcred) == LDAP_SUCCESS) {
+    ret = G_OK;
+  } else {
+    ret = G_ERROR_UNAUTHORIZED;
+  }
+  if (ldap != NULL) {
+    ldap_unbind_ext(ldap, NULL, NULL);
+  }
+  return ret;
+}
+
+static int init_ldap_pool(struct mod_parameters * param) {
+  int ret = G_OK;
+
+  param->pool_size = (size_t)json_integer_value(json_object_get(param->j_params, "pool-size"));
+  param->idle_timeout = (time_t)json_integer_value(json_object_get(param->j_params, "pool-idle-timeout"));
+  param->handles = NULL;
+  if (param->pool_size) {
+    if ((param->handles = o_malloc(param->pool_size*sizeof(struct ldap_pool_handle))) != NULL) {
+      memset(param->handles, 0, param->pool_size*sizeof(struct ldap_pool_handle));
+      if (pthread_mutex_init(&param->lock, NULL)) {
+        y_log_message(Y_LOG_LEVEL_ERROR, "init_ldap_pool - Error pthread_mutex_init");
+        o_free(param->handles);
+        param->handles = NULL;
+        ret = G_ERROR;
+      }
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "init_ldap_pool - Error allocating resources for handles");
+      ret = G_ERROR_MEMORY;
+    }
+  }
+  return ret;
+}
+
+static void close_ldap_pool(struct mod_parameters * param) {
+  size_t i;
+
+  if (param->pool_size && param->handles != NULL) {
+    for (i=0; i<param->pool_size; i++) {
+      if (param->handles[i].ldap != NULL) {
+        ldap_unbind_ext(param->handles[i].ldap, NULL, NULL);
+      }
+    }
+    pthread_mutex_destroy(&param->lock);
+  }
+  o_free(param->handles);
+}
+
 static const char * get_read_property(json_t * j_params, const char * property) {
   if (json_is_string(json_object_get(j_params, property))) {
     return json_string_value(json_object_get(j_params, property));
@@ -1088,8 +1296,21 @@ json_t * client_module_init(struct config_module * config, int readonly, json_t
   
   j_properties = is_client_ldap_parameters_valid(j_parameters, readonly);
   if (check_result_value(j_properties, G_OK)) {
-    *cls = json_incref(j_parameters);
-    j_return = json_pack("{si}", "result", G_OK);
+    if ((*cls = o_malloc(sizeof(struct mod_parameters))) != NULL) {
+      ((struct mod_parameters *)*cls)->j_params = json_incref(j_parameters);
+      if (init_ldap_pool((struct mod_parameters *)*cls) == G_OK) {
+        j_return = json_pack("{si}", "result", G_OK);
+      } else {
+        y_log_message(Y_LOG_LEVEL_ERROR, "client_module_init ldap - Error init_ldap_pool");
+        json_decref(((struct mod_parameters *)*cls)->j_params);
+        o_free(*cls);
+        *cls = NULL;
+        j_return = json_pack("{sis[s]}", "result", G_ERROR, "error", "internal error");
+      }
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "client_module_init ldap - Error allocating resources for cls");
+      j_return = json_pack("{sis[s]}", "result", G_ERROR_MEMORY, "error", "internal error");
+    }
   } else if (check_result_value(j_properties, G_ERROR_PARAM)) {
     error_message = json_dumps(json_object_get(j_properties, "error"), JSON_COMPACT);
     y_log_message(Y_LOG_LEVEL_ERROR, "client_module_init database - Error parsing parameters");
@@ -1106,14 +1327,16 @@ json_t * client_module_init(struct config_module * config, int readonly, json_t
 
 int client_module_close(struct config_module * config, void * cls) {
   UNUSED(config);
-  json_decref((json_t *)cls);
+  close_ldap_pool((struct mod_parameters *)cls);
+  json_decref(((struct mod_parameters *)cls)->j_params);
+  o_free(cls);
   return G_OK;
 }
 
 size_t client_module_count_total(struct config_module * config, const char * pattern, void * cls) {
   UNUSED(config);
-  json_t * j_params = (json_t *)cls;
-  LDAP * ldap = connect_ldap_server(j_params);
+  json_t * j_params = ((struct mod_parameters *)cls)->j_params;
+  LDAP * ldap = ldap_pool_acquire((struct mod_parameters *)cls);
   LDAPMessage * answer = NULL;
   char * attrs[] = { NULL }, * filter;
   int  attrsonly = 0;
@@ -1133,18 +1356,18 @@ size_t client_module_count_total(struct config_module * config, const char * pat
       counter = ldap_count_entries(ldap, answer);
     }
     ldap_msgfree(answer);
-    ldap_unbind_ext(ldap, NULL, NULL);
+    ldap_pool_release((struct mod_parameters *)cls, ldap);
     o_free(filter);
   } else {
-    y_log_message(Y_LOG_LEVEL_ERROR, "client_module_count_total ldap - Error connect_ldap_server");
+    y_log_message(Y_LOG_LEVEL_ERROR, "client_module_count_total ldap - Error ldap_pool_acquire");
   }
   return counter;
 }
 
 json_t * client_module_get_list(struct config_module * config, const char * pattern, size_t offset, size_t limit, void * cls) {
   UNUSED(config);
-  json_t * j_params = (json_t *)cls, * j_properties_client = NULL, * j_client_list, * j_client, * j_return;
-  LDAP * ldap = connect_ldap_server(j_params);
+  json_t * j_params = ((struct mod_parameters *)cls)->j_params, * j_properties_client = NULL, * j_client_list, * j_client, * j_return;
+  LDAP * ldap = ldap_pool_acquire((struct mod_parameters *)cls);
   LDAPMessage * entry;
   
   int  ldap_result;
@@ -1252,13 +1475,13 @@ json_t * client_module_get_list(struct config_module * config, const char * patt
     ber_bvfree(cookie);
     cookie = NULL;
     
-    ldap_unbind_ext(ldap, NULL, NULL);
+    ldap_pool_release((struct mod_parameters *)cls, ldap);
     j_return = json_pack("{sisO}", "result", G_OK, "list", j_client_list);
     json_decref(j_client_list);
     json_decref(j_properties_client);
     o_free(attrs);
   } else {
-    y_log_message(Y_LOG_LEVEL_ERROR, "client_module_get_list ldap - Error connect_ldap_server");
+    y_log_message(Y_LOG_LEVEL_ERROR, "client_module_get_list ldap - Error ldap_pool_acquire");
     j_return = json_pack("{si}", "result", G_ERROR);
   }
   return j_return;
@@ -1266,8 +1489,8 @@ json_t * client_module_get_list(struct config_module * config, const char * patt
 
 json_t * client_module_get(struct config_module * config, const char * client_id, void * cls) {
   UNUSED(config);
-  json_t * j_params = (json_t *)cls, * j_properties_client = NULL, * j_client, * j_return;
-  LDAP * ldap = connect_ldap_server(j_params);
+  json_t * j_params = ((struct mod_parameters *)cls)->j_params, * j_properties_client = NULL, * j_client, * j_return;
+  LDAP * ldap = ldap_pool_acquire((struct mod_parameters *)cls);
   LDAPMessage * entry, * answer;
   int ldap_result;
   
@@ -1309,9 +1532,9 @@ json_t * client_module_get(struct config_module * config, const char * client_id
     o_free(attrs);
     o_free(filter);
     ldap_msgfree(answer);
-    ldap_unbind_ext(ldap, NULL, NULL);
+    ldap_pool_release((struct mod_parameters *)cls, ldap);
   } else {
-    y_log_message(Y_LOG_LEVEL_ERROR, "client_module_get_list ldap - Error connect_ldap_server");
+    y_log_message(Y_LOG_LEVEL_ERROR, "client_module_get_list ldap - Error ldap_pool_acquire");
     j_return = json_pack("{si}", "result", G_ERROR);
   }
   return j_return;
@@ -1319,7 +1542,7 @@ json_t * client_module_get(struct config_module * config, const char * client_id
 
 json_t * client_module_is_valid(struct config_module * config, const char * client_id, json_t * j_client, int mode, void * cls) {
   UNUSED(config);
-  json_t * j_params = (json_t *)cls;
+  json_t * j_params = ((struct mod_parameters *)cls)->j_params;
   json_t * j_result = json_array(), * j_element, * j_format, * j_value, * j_return, * j_cur_client;
   char * message;
   size_t index = 0, len = 0;
@@ -1428,8 +1651,8 @@ json_t * client_module_is_valid(struct config_module * config, const char * clie
 
 int client_module_add(struct config_module * config, json_t * j_client, void * cls) {
   UNUSED(config);
-  json_t * j_params = (json_t *)cls, * j_mod_value_free_array = NULL, * j_element = NULL;
-  LDAP * ldap = connect_ldap_server(j_params);
+  json_t * j_params = ((struct mod_parameters *)cls)->j_params, * j_mod_value_free_array = NULL, * j_element = NULL;
+  LDAP * ldap = ldap_pool_acquire((struct mod_parameters *)cls);
   int ret, i, result;
   LDAPMod ** mods = NULL;
   char * new_dn;
@@ -1466,9 +1689,9 @@ int client_module_add(struct config_module * config, json_t * j_client, void * c
       y_log_message(Y_LOG_LEVEL_ERROR, "client_module_add ldap - Error get_ldap_write_mod");
       ret = G_ERROR;
     }
-    ldap_unbind_ext(ldap, NULL, NULL);
+    ldap_pool_release((struct mod_parameters *)cls, ldap);
   } else {
-    y_log_message(Y_LOG_LEVEL_ERROR, "client_module_add ldap - Error connect_ldap_server");
+    y_log_message(Y_LOG_LEVEL_ERROR, "client_module_add ldap - Error ldap_pool_acquire");
     ret = G_ERROR;
   }
   return ret;
@@ -1476,8 +1699,8 @@ int client_module_add(struct config_module * config, json_t * j_client, void * c
 
 int client_module_update(struct config_module * config, const char * client_id, json_t * j_client, void * cls) {
   UNUSED(config);
-  json_t * j_params = (json_t *)cls, * j_mod_value_free_array, * j_element = NULL;
-  LDAP * ldap = connect_ldap_server(j_params);
+  json_t * j_params = ((struct mod_parameters *)cls)->j_params, * j_mod_value_free_array, * j_element = NULL;
+  LDAP * ldap = ldap_pool_acquire((struct mod_parameters *)cls);
   int ret, i, result;
   LDAPMod ** mods = NULL;
   char * cur_dn;
@@ -1514,9 +1737,9 @@ int client_module_update(struct config_module * config, const char * client_id,
       y_log_message(Y_LOG_LEVEL_ERROR, "client_module_update ldap - Error get_ldap_write_mod");
       ret = G_ERROR;
     }
-    ldap_unbind_ext(ldap, NULL, NULL);
+    ldap_pool_release((struct mod_parameters *)cls, ldap);
   } else {
-    y_log_message(Y_LOG_LEVEL_ERROR, "client_module_update ldap - Error connect_ldap_server");
+    y_log_message(Y_LOG_LEVEL_ERROR, "client_module_update ldap - Error ldap_pool_acquire");
     ret = G_ERROR;
   }
   return ret;
@@ -1524,8 +1747,8 @@ int client_module_update(struct config_module * config, const char * client_id,
 
 int client_module_delete(struct config_module * config, const char * client_id, void * cls) {
   UNUSED(config);
-  json_t * j_params = (json_t *)cls;
-  LDAP * ldap = connect_ldap_server(j_params);
+  json_t * j_params = ((struct mod_parameters *)cls)->j_params;
+  LDAP * ldap = ldap_pool_acquire((struct mod_parameters *)cls);
   int ret, result;
   char * cur_dn;
   
@@ -1543,9 +1766,9 @@ int client_module_delete(struct config_module * config, const char * client_id,
       ret = G_ERROR;
     }
     o_free(cur_dn);
-    ldap_unbind_ext(ldap, NULL, NULL);
+    ldap_pool_release((struct mod_parameters *)cls, ldap);
   } else {
-    y_log_message(Y_LOG_LEVEL_ERROR, "client_module_update ldap - Error connect_ldap_server");
+    y_log_message(Y_LOG_LEVEL_ERROR, "client_module_update ldap - Error ldap_pool_acquire");
     ret = G_ERROR;
   }
   return ret;
@@ -1553,19 +1776,16 @@ int client_module_delete(struct config_module * config, const char * client_id,
 
 int client_module_check_password(struct config_module * config, const char * client_id, const char * password, void * cls) {
   UNUSED(config);
-  json_t * j_params = (json_t *)cls;
-  LDAP * ldap = connect_ldap_server(j_params);
+  json_t * j_params = ((struct mod_parameters *)cls)->j_params;
+  LDAP * ldap = ldap_pool_acquire((struct mod_parameters *)cls);
   LDAPMessage * entry, * answer;
-  int ldap_result, result_login, result;
+  int ldap_result, result;
   char * client_dn = NULL;
   
   int  scope = LDAP_SCOPE_ONELEVEL;
   char * filter = NULL;
   char * attrs[] = {"memberOf", NULL, NULL};
   int attrsonly = 0;
-  char * ldap_mech = LDAP_SASL_SIMPLE;
-  struct berval cred;
-  struct berval *servcred;
 
   if (0 == o_strcmp(json_string_value(json_object_get(j_params, "search-scope")), "subtree")) {
     scope = LDAP_SCOPE_SUBTREE;
@@ -1583,15 +1803,8 @@ int client_module_check_password(struct config_module * config, const char * cli
         // Testing the first result to client_id with the given password
         entry = ldap_first_entry(ldap, answer);
         client_dn = ldap_get_dn(ldap, entry);
-        cred.bv_val = (char *)password;
-        cred.bv_len = o_strlen(password);
-        result_login = ldap_sasl_bind_s(ldap, client_dn, ldap_mech, &cred, NULL, NULL, &servcred);
+        result = check_ldap_bind(j_params, client_dn, password);
         ldap_memfree(client_dn);
-        if (result_login == LDAP_SUCCESS) {
-          result = G_OK;
-        } else {
-          result = G_ERROR_UNAUTHORIZED;
-        }
       } else {
         result = G_ERROR_NOT_FOUND;
       }
@@ -1599,9 +1812,9 @@ int client_module_check_password(struct config_module * config, const char * cli
     
     o_free(filter);
     ldap_msgfree(answer);
-    ldap_unbind_ext(ldap, NULL, NULL);
+    ldap_pool_release((struct mod_parameters *)cls, ldap);
   } else {
-    y_log_message(Y_LOG_LEVEL_ERROR, "client_module_check_password ldap - Error connect_ldap_server");
+    y_log_message(Y_LOG_LEVEL_ERROR, "client_module_check_password ldap - Error ldap_pool_acquire");
     result = G_ERROR;
   }
   return result;
@@ -0,0 +1,300 @@
+/**
+ *
+ * Glewlwyd SSO Server
+ *
+ * Authentiation server
+ * Users are authenticated via various backend available: database, ldap
+ * Using various authentication methods available: password, OTP, send code, etc.
+ *
+ * Database connection pool functions definitions
+ *
+ * Copyright 2016-2021 Nicolas Mora <mail@babelouest.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU GENERAL PUBLIC LICENSE
+ * License as published by the Free Software Foundation;
+ * version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU GENERAL PUBLIC LICENSE for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <time.h>
+#include <errno.h>
+
+#include "glewlwyd.h"
+
+/**
+ * Connection currently checked out by a thread
+ * depth is used to allow nested acquire calls in the same thread
+ * to share the same connection, e.g. h_last_insert_id after h_insert
+ */
+struct _glwd_db_pool_thread {
+  struct _glwd_db_pool_slot * slot;
+  size_t                      depth;
+};
+
+static void free_glwd_db_pool_thread(void * data) {
+  o_free(data);
+}
+
+static struct _h_connection * glewlwyd_db_pool_connect(struct _glwd_db_pool * db_pool) {
+  struct _h_connection * conn = NULL;
+
+  if (db_pool->type == HOEL_DB_TYPE_MARIADB) {
+    if ((conn = h_connect_mariadb(db_pool->host, db_pool->user, db_pool->password, db_pool->dbname, db_pool->port, NULL)) != NULL) {
+      if (h_execute_query_mariadb(conn, "SET sql_mode='PIPES_AS_CONCAT';", NULL) != H_OK) {
+        y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_db_pool_connect - Error executing mariadb query 'SET sql_mode='PIPES_AS_CONCAT';'");
+        h_close_db(conn);
+        h_clean_connection(conn);
+        conn = NULL;
+      }
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_db_pool_connect - Error opening mariadb database %s", db_pool->dbname);
+    }
+  } else if (db_pool->type == HOEL_DB_TYPE_PGSQL) {
+    if ((conn = h_connect_pgsql(db_pool->conninfo)) == NULL) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_db_pool_connect - Error opening postgre database");
+    }
+  }
+  return conn;
+}
+
+static void glewlwyd_db_pool_disconnect(struct _h_connection * conn) {
+  if (conn != NULL) {
+    h_close_db(conn);
+    h_clean_connection(conn);
+  }
+}
+
+/**
+ * Check that a connection is still alive if it wasn't checked for a while,
+ * reconnect if the connection is lost
+ * Called without the pool lock, the slot is owned by the current thread
+ */
+static void glewlwyd_db_pool_check_slot(struct config_elements * config, struct _glwd_db_pool_slot * slot) {
+  time_t now;
+  json_t * j_result = NULL;
+
+  time(&now);
+  if (slot->conn != NULL && config->db_pool.health_check_interval && (now - slot->last_check) >= (time_t)config->db_pool.health_check_interval) {
+    if (h_execute_query_json(slot->conn, "SELECT 1", &j_result) != H_OK) {
+      y_log_message(Y_LOG_LEVEL_WARNING, "glewlwyd_db_pool_check_slot - Database connection lost, reconnecting");
+      glewlwyd_db_pool_disconnect(slot->conn);
+      slot->conn = NULL;
+    }
+    json_decref(j_result);
+  }
+  if (slot->conn == NULL) {
+    if ((slot->conn = glewlwyd_db_pool_connect(&config->db_pool)) != NULL) {
+      glewlwyd_metrics_increment_counter_va(config, GLWD_METRICS_DATABASE_POOL_RECONNECT, 1, NULL);
+    }
+  }
+  slot->last_check = now;
+}
+
+int glewlwyd_db_pool_init(struct config_elements * config) {
+  size_t i;
+  int ret = G_OK;
+  time_t now;
+
+  glewlwyd_metrics_add_metric(config, GLWD_METRICS_DATABASE_POOL_WAIT, "Total number of database connection checkouts that had to wait for a free connection");
+  glewlwyd_metrics_add_metric(config, GLWD_METRICS_DATABASE_POOL_WAIT_MS, "Total time spent waiting for a free database connection in milliseconds");
+  glewlwyd_metrics_add_metric(config, GLWD_METRICS_DATABASE_POOL_TIMEOUT, "Total number of database connection checkouts that timed out");
+  glewlwyd_metrics_add_metric(config, GLWD_METRICS_DATABASE_POOL_RECONNECT, "Total number of database pool connections reopened");
+  glewlwyd_metrics_increment_counter_va(config, GLWD_METRICS_DATABASE_POOL_WAIT, 0, NULL);
+  glewlwyd_metrics_increment_counter_va(config, GLWD_METRICS_DATABASE_POOL_WAIT_MS, 0, NULL);
+  glewlwyd_metrics_increment_counter_va(config, GLWD_METRICS_DATABASE_POOL_TIMEOUT, 0, NULL);
+  glewlwyd_metrics_increment_counter_va(config, GLWD_METRICS_DATABASE_POOL_RECONNECT, 0, NULL);
+
+  if (config->db_pool.size && config->conn != NULL && config->conn->type != HOEL_DB_TYPE_SQLITE) {
+    config->db_pool.type = config->conn->type;
+    if ((config->db_pool.slots = o_malloc(config->db_pool.size*sizeof(struct _glwd_db_pool_slot))) != NULL) {
+      time(&now);
+      for (i=0; i<config->db_pool.size; i++) {
+        config->db_pool.slots[i].conn = glewlwyd_db_pool_connect(&config->db_pool);
+        config->db_pool.slots[i].in_use = 0;
+        config->db_pool.slots[i].last_check = now;
+      }
+      config->db_pool.nb_free = config->db_pool.size;
+      if (pthread_mutex_init(&config->db_pool.lock, NULL)) {
+        y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_db_pool_init - Error initializing pool lock");
+        ret = G_ERROR;
+      } else if (pthread_cond_init(&config->db_pool.cond, NULL)) {
+        y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_db_pool_init - Error initializing pool cond");
+        pthread_mutex_destroy(&config->db_pool.lock);
+        ret = G_ERROR;
+      } else if (pthread_key_create(&config->db_pool.thread_key, free_glwd_db_pool_thread)) {
+        y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_db_pool_init - Error initializing pool thread key");
+        pthread_cond_destroy(&config->db_pool.cond);
+        pthread_mutex_destroy(&config->db_pool.lock);
+        ret = G_ERROR;
+      } else {
+        config->db_pool.initialized = 1;
+        y_log_message(Y_LOG_LEVEL_INFO, "Database connection pool initialized with %zu connections", config->db_pool.size);
+      }
+      if (ret != G_OK) {
+        for (i=0; i<config->db_pool.size; i++) {
+          glewlwyd_db_pool_disconnect(config->db_pool.slots[i].conn);
+        }
+        o_free(config->db_pool.slots);
+        config->db_pool.slots = NULL;
+      }
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_db_pool_init - Error allocating resources for slots");
+      ret = G_ERROR_MEMORY;
+    }
+  } else if (config->db_pool.size && config->conn != NULL) {
+    y_log_message(Y_LOG_LEVEL_WARNING, "Database connection pool is not available for sqlite3 databases, using a single connection");
+  }
+  return ret;
+}
+
+void glewlwyd_db_pool_close(struct config_elements * config) {
+  size_t i;
+
+  if (config->db_pool.initialized) {
+    pthread_mutex_lock(&config->db_pool.lock);
+    config->db_pool.initialized = 0;
+    for (i=0; i<config->db_pool.size; i++) {
+      glewlwyd_db_pool_disconnect(config->db_pool.slots[i].conn);
+    }
+    pthread_cond_broadcast(&config->db_pool.cond);
+    pthread_mutex_unlock(&config->db_pool.lock);
+    pthread_key_delete(config->db_pool.thread_key);
+    pthread_cond_destroy(&config->db_pool.cond);
+    pthread_mutex_destroy(&config->db_pool.lock);
+  }
+  o_free(config->db_pool.slots);
+  config->db_pool.slots = NULL;
+  o_free(config->db_pool.host);
+  o_free(config->db_pool.user);
+  o_free(config->db_pool.password);
+  o_free(config->db_pool.dbname);
+  o_free(config->db_pool.conninfo);
+}
+
+/**
+ * Checkout a database connection for the current thread
+ * If the current thread already owns a connection, the same one is returned
+ * If the pool is disabled or no connection is available before the timeout,
+ * the main shared connection is returned
+ * Every call must be followed by a call to glewlwyd_db_pool_release
+ */
+struct _h_connection * glewlwyd_db_pool_acquire(struct config_elements * config) {
+  struct _glwd_db_pool_thread * thread_data;
+  struct _glwd_db_pool_slot * slot = NULL;
+  struct timespec abstime, wait_start, wait_end;
+  size_t i;
+  int waited = 0, timeout = 0;
+
+  if (!config->db_pool.initialized) {
+    return config->conn;
+  }
+
+  if ((thread_data = pthread_getspecific(config->db_pool.thread_key)) == NULL) {
+    if ((thread_data = o_malloc(sizeof(struct _glwd_db_pool_thread))) == NULL) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_db_pool_acquire - Error allocating resources for thread_data");
+      return config->conn;
+    }
+    thread_data->slot = NULL;
+    thread_data->depth = 0;
+    pthread_setspecific(config->db_pool.thread_key, thread_data);
+  }
+
+  if (!thread_data->depth) {
+    pthread_mutex_lock(&config->db_pool.lock);
+    if (!config->db_pool.nb_free) {
+      waited = 1;
+      clock_gettime(CLOCK_MONOTONIC, &wait_start);
+      clock_gettime(CLOCK_REALTIME, &abstime);
+      abstime.tv_sec += config->db_pool.wait_timeout/1000;
+      abstime.tv_nsec += (long)(config->db_pool.wait_timeout%1000)*1000000L;
+      if (abstime.tv_nsec >= 1000000000L) {
+        abstime.tv_sec++;
+        abstime.tv_nsec -= 1000000000L;
+      }
+      while (config->db_pool.initialized && !config->db_pool.nb_free && !timeout) {
+        if (pthread_cond_timedwait(&config->db_pool.cond, &config->db_pool.lock, &abstime) == ETIMEDOUT) {
+          timeout = 1;
+        }
+      }
+    }
+    if (config->db_pool.initialized && config->db_pool.nb_free) {
+      for (i=0; i<config->db_pool.size; i++) {
+        if (!config->db_pool.slots[i].in_use) {
+          slot = &config->db_pool.slots[i];
+          slot->in_use = 1;
+          config->db_pool.nb_free--;
+          break;
+        }
+      }
+    }
+    pthread_mutex_unlock(&config->db_pool.lock);
+
+    if (waited) {
+      clock_gettime(CLOCK_MONOTONIC, &wait_end);
+      glewlwyd_metrics_increment_counter_va(config, GLWD_METRICS_DATABASE_POOL_WAIT, 1, NULL);
+      glewlwyd_metrics_increment_counter_va(config, GLWD_METRICS_DATABASE_POOL_WAIT_MS, (size_t)((wait_end.tv_sec-wait_start.tv_sec)*1000 + (wait_end.tv_nsec-wait_start.tv_nsec)/1000000), NULL);
+    }
+    if (slot != NULL) {
+      glewlwyd_db_pool_check_slot(config, slot);
+    } else {
+      y_log_message(Y_LOG_LEVEL_WARNING, "glewlwyd_db_pool_acquire - No database connection available after %u ms, using main connection", config->db_pool.wait_timeout);
+      glewlwyd_metrics_increment_counter_va(config, GLWD_METRICS_DATABASE_POOL_TIMEOUT, 1, NULL);
+    }
+    thread_data->slot = slot;
+  }
+  thread_data->depth++;
+
+  if (thread_data->slot != NULL && thread_data->slot->conn != NULL) {
+    return thread_data->slot->conn;
+  } else {
+    return config->conn;
+  }
+}
+
+/**
+ * Release a database connection checked out with glewlwyd_db_pool_acquire
+ */
+void glewlwyd_db_pool_release(struct config_elements * config, struct _h_connection * conn) {
+  struct _glwd_db_pool_thread * thread_data;
+
+  if (config->db_pool.initialized && conn != NULL) {
+    if ((thread_data = pthread_getspecific(config->db_pool.thread_key)) != NULL && thread_data->depth) {
+      thread_data->depth--;
+      if (!thread_data->depth && thread_data->slot != NULL) {
+        pthread_mutex_lock(&config->db_pool.lock);
+        thread_data->slot->in_use = 0;
+        config->db_pool.nb_free++;
+        pthread_cond_signal(&config->db_pool.cond);
+        pthread_mutex_unlock(&config->db_pool.lock);
+        thread_data->slot = NULL;
+      }
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_db_pool_release - Error, no connection acquired for current thread");
+    }
+  }
+}
+
+struct _h_connection * glewlwyd_plugin_callback_db_acquire(struct config_plugin * config) {
+  return glewlwyd_db_pool_acquire(config->glewlwyd_config);
+}
+
+void glewlwyd_plugin_callback_db_release(struct config_plugin * config, struct _h_connection * conn) {
+  glewlwyd_db_pool_release(config->glewlwyd_config, conn);
+}
+
+struct _h_connection * glewlwyd_module_callback_db_acquire(struct config_module * config) {
+  return glewlwyd_db_pool_acquire(config->glewlwyd_config);
+}
+
+void glewlwyd_module_callback_db_release(struct config_module * config, struct _h_connection * conn) {
+  glewlwyd_db_pool_release(config->glewlwyd_config, conn);
+}
@@ -57,6 +57,7 @@
 #define G_ERROR_DB           4
 #define G_ERROR_MEMORY       5
 #define G_ERROR_NOT_FOUND    6
+#define G_ERROR_UNAVAILABLE  7
 
 /**
  * Callback priority
@@ -137,6 +138,36 @@ typedef enum {
 
 struct config_module;
 
+/**
+ * Index of the user and client modules calls measured in the metrics
+ */
+#define GLWD_METRICS_USER_MODULE_INIT              0
+#define GLWD_METRICS_USER_MODULE_CLOSE             1
+#define GLWD_METRICS_USER_MODULE_COUNT_TOTAL       2
+#define GLWD_METRICS_USER_MODULE_GET_LIST          3
+#define GLWD_METRICS_USER_MODULE_GET               4
+#define GLWD_METRICS_USER_MODULE_GET_PROFILE       5
+#define GLWD_METRICS_USER_MODULE_IS_VALID          6
+#define GLWD_METRICS_USER_MODULE_ADD               7
+#define GLWD_METRICS_USER_MODULE_UPDATE            8
+#define GLWD_METRICS_USER_MODULE_UPDATE_PROFILE    9
+#define GLWD_METRICS_USER_MODULE_DELETE            10
+#define GLWD_METRICS_USER_MODULE_CHECK_PASSWORD    11
+#define GLWD_METRICS_USER_MODULE_UPDATE_PASSWORD   12
+#define GLWD_METRICS_USER_MODULE_CALLS             13
+
+#define GLWD_METRICS_CLIENT_MODULE_INIT            0
+#define GLWD_METRICS_CLIENT_MODULE_CLOSE           1
+#define GLWD_METRICS_CLIENT_MODULE_COUNT_TOTAL     2
+#define GLWD_METRICS_CLIENT_MODULE_GET_LIST        3
+#define GLWD_METRICS_CLIENT_MODULE_GET             4
+#define GLWD_METRICS_CLIENT_MODULE_IS_VALID        5
+#define GLWD_METRICS_CLIENT_MODULE_ADD             6
+#define GLWD_METRICS_CLIENT_MODULE_UPDATE          7
+#define GLWD_METRICS_CLIENT_MODULE_DELETE          8
+#define GLWD_METRICS_CLIENT_MODULE_CHECK_PASSWORD  9
+#define GLWD_METRICS_CLIENT_MODULE_CALLS           10
+
 /**
  * Structure used to store a user module
  */
@@ -187,12 +218,16 @@ struct _user_middleware_module {
  * Structure used to store a user module instance
  */
 struct _user_module_instance {
-  char                * name;
-  struct _user_module * module;
-  void                * cls;
-  short int             enabled;
-  short int             readonly;
-  short int             multiple_passwords;
+  char                      * name;
+  struct _user_module       * module;
+  void                      * cls;
+  short int                   enabled;
+  short int                   readonly;
+  short int                   multiple_passwords;
+  struct _glwd_metrics_data * metrics_duration[GLWD_METRICS_USER_MODULE_CALLS];
+  struct _glwd_metrics_data * metrics_in_flight;
+  struct _glwd_metrics_data * metrics_route_hit;
+  struct _glwd_metrics_data * metrics_route_miss;
 };
 
 /**
@@ -232,11 +267,13 @@ struct _client_module {
  * Structure used to store a client module instance
  */
 struct _client_module_instance {
-  char                  * name;
-  struct _client_module * module;
-  void                  * cls;
-  short int               enabled;
-  short int               readonly;
+  char                      * name;
+  struct _client_module     * module;
+  void                      * cls;
+  short int                   enabled;
+  short int                   readonly;
+  struct _glwd_metrics_data * metrics_duration[GLWD_METRICS_CLIENT_MODULE_CALLS];
+  struct _glwd_metrics_data * metrics_in_flight;
 };
 
 /**
@@ -308,20 +345,399 @@ struct _plugin_module_instance {
 #define GLWD_METRICS_AUTH_USER_VALID_SCHEME   "glewlwyd_auth_user_valid_scheme"
 #define GLWD_METRICS_AUTH_USER_INVALID        "glewlwyd_auth_user_invalid"
 #define GLWD_METRICS_AUTH_USER_INVALID_SCHEME "glewlwyd_auth_user_invalid_scheme"
+#define GLWD_METRICS_DATABASE_POOL_WAIT       "glewlwyd_database_pool_wait"
+#define GLWD_METRICS_DATABASE_POOL_WAIT_MS    "glewlwyd_database_pool_wait_milliseconds"
+#define GLWD_METRICS_DATABASE_POOL_TIMEOUT    "glewlwyd_database_pool_timeout"
+#define GLWD_METRICS_DATABASE_POOL_RECONNECT  "glewlwyd_database_pool_reconnect"
+#define GLWD_METRICS_HTTP_REQUEST_DURATION    "glewlwyd_http_request_duration_seconds"
+#define GLWD_METRICS_HTTP_REQUEST_IN_FLIGHT   "glewlwyd_http_requests_in_flight"
+#define GLWD_METRICS_MODULE_CALL_DURATION     "glewlwyd_module_call_duration_seconds"
+#define GLWD_METRICS_MODULE_CALL_IN_FLIGHT    "glewlwyd_module_calls_in_flight"
+#define GLWD_METRICS_USER_ROUTE_HIT           "glewlwyd_user_route_hit"
+#define GLWD_METRICS_USER_ROUTE_MISS          "glewlwyd_user_route_miss"
+#define GLWD_METRICS_MAIL_QUEUE_DEPTH         "glewlwyd_mail_queue_depth"
+#define GLWD_METRICS_MAIL_SENT                "glewlwyd_mail_sent"
+#define GLWD_METRICS_MAIL_RETRY               "glewlwyd_mail_retry"
+#define GLWD_METRICS_MAIL_FAILED              "glewlwyd_mail_failed"
+#define GLWD_METRICS_REAPER_RUN               "glewlwyd_reaper_run"
+#define GLWD_METRICS_REAPER_DELETED           "glewlwyd_reaper_deleted"
+#define GLWD_METRICS_PASSWORD_POOL_DEPTH      "glewlwyd_password_pool_depth"
+#define GLWD_METRICS_PASSWORD_POOL_WAIT       "glewlwyd_password_pool_wait_seconds"
+#define GLWD_METRICS_PASSWORD_POOL_DURATION   "glewlwyd_password_pool_check_duration_seconds"
+#define GLWD_METRICS_PASSWORD_POOL_REJECTED   "glewlwyd_password_pool_rejected"
+
+#define GLWD_METRICS_TYPE_COUNTER   0
+#define GLWD_METRICS_TYPE_GAUGE     1
+#define GLWD_METRICS_TYPE_HISTOGRAM 2
+
+#define GLWD_METRICS_SHARDS     16
+#define GLWD_METRICS_CACHE_LINE 64
+#define GLWD_METRICS_HASH_SIZE  256
 
 /**
- * Structure used to store a prometheus metrics
+ * Histogram buckets upper bounds in microseconds, the last bucket is +Inf
+ */
+#define GLWD_METRICS_HISTOGRAM_BUCKETS 14
+#define GLWD_METRICS_HISTOGRAM_BOUNDS {1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000}
+#define GLWD_METRICS_HISTOGRAM_LABELS {"0.001", "0.0025", "0.005", "0.01", "0.025", "0.05", "0.1", "0.25", "0.5", "1", "2.5", "5", "10", "+Inf"}
+
+/**
+ * Counter shard, aligned on a cache line to avoid false sharing between threads
+ */
+struct _glwd_metrics_shard {
+  size_t value;
+  char   padding[GLWD_METRICS_CACHE_LINE - sizeof(size_t)];
+};
+
+/**
+ * Histogram shard, buckets are not cumulative, sum is in microseconds
+ */
+struct _glwd_metrics_histogram_shard {
+  size_t buckets[GLWD_METRICS_HISTOGRAM_BUCKETS];
+  size_t sum;
+  size_t count;
+};
+
+/**
+ * Structure used to store a prometheus metrics value for a label set
+ * A pointer to this structure is a counter handle, it stays valid until the metrics are closed
+ * The counter value is the sum of all the shards, aggregated when the metrics are exported
  */
 struct _glwd_metrics_data {
-  char * label;
-  size_t counter;
+  char                                 * label;
+  unsigned int                           hash;
+  struct _glwd_metric                  * metric;
+  struct _glwd_metrics_data            * next;
+  struct _glwd_metrics_shard             shards[GLWD_METRICS_SHARDS];
+  struct _glwd_metrics_histogram_shard * histogram;
 };
 
+/**
+ * Structure used to store a prometheus metrics
+ * type is one of GLWD_METRICS_TYPE_COUNTER, GLWD_METRICS_TYPE_GAUGE or GLWD_METRICS_TYPE_HISTOGRAM
+ */
 struct _glwd_metric {
-  char                      * name;
-  char                      * help;
-  struct _glwd_metrics_data * data;
-  size_t                      data_size;
+  char                       * name;
+  char                       * help;
+  unsigned short               type;
+  struct _glwd_metrics_data ** data;
+  size_t                       data_size;
+};
+
+/**
+ * Structure used to wrap an endpoint callback to measure its duration
+ */
+struct _glwd_endpoint_metrics {
+  char                      * label;
+  int                      (* callback)(const struct _u_request * request, struct _u_response * response, void * user_data);
+  void                      * user_data;
+  struct _glwd_metrics_data * duration;
+  struct _glwd_metrics_data * in_flight;
+};
+
+/**
+ * Structure used to store a database connection of the pool
+ */
+struct _glwd_db_pool_slot {
+  struct _h_connection * conn;
+  unsigned short         in_use;
+  time_t                 last_check;
+};
+
+/**
+ * Structure used to store the database connection pool
+ * Connection parameters are kept to reconnect lost connections
+ */
+struct _glwd_db_pool {
+  int                         type;
+  char                      * host;
+  char                      * user;
+  char                      * password;
+  char                      * dbname;
+  unsigned int                port;
+  char                      * conninfo;
+  size_t                      size;
+  unsigned int                wait_timeout;
+  unsigned int                health_check_interval;
+  struct _glwd_db_pool_slot * slots;
+  size_t                      nb_free;
+  unsigned short              initialized;
+  pthread_key_t               thread_key;
+  pthread_mutex_t             lock;
+  pthread_cond_t              cond;
+};
+
+/**
+ * Structure used to store an e-mail waiting in the mail queue
+ */
+struct _glwd_mail_message {
+  char                      * host;
+  int                         port;
+  int                         use_tls;
+  int                         verify_certificate;
+  char                      * user;
+  char                      * password;
+  char                      * from;
+  char                      * to;
+  char                      * content_type;
+  char                      * subject;
+  char                      * body;
+  unsigned int                attempts;
+  time_t                      next_attempt;
+  struct _glwd_mail_message * next;
+};
+
+/**
+ * Structure used to store the mail queue and its worker threads
+ */
+struct _glwd_mail_queue {
+  size_t                      nb_workers;
+  size_t                      max_size;
+  unsigned int                max_attempts;
+  unsigned int                retry_delay;
+  unsigned int                close_timeout;
+  time_t                      close_deadline;
+  pthread_t                 * workers;
+  size_t                      nb_workers_started;
+  struct _glwd_mail_message * first;
+  struct _glwd_mail_message * last;
+  size_t                      size;
+  unsigned short              stop;
+  unsigned short              initialized;
+  pthread_mutex_t             lock;
+  pthread_cond_t              cond;
+  struct _glwd_metrics_data * metrics_depth;
+  struct _glwd_metrics_data * metrics_sent;
+  struct _glwd_metrics_data * metrics_retry;
+  struct _glwd_metrics_data * metrics_failed;
+};
+
+/**
+ * Structure used to store a reaper thread
+ * A reaper deletes the expired rows of its tasks every interval seconds,
+ * by batches of batch_size rows with a pause of batch_delay milliseconds between batches
+ */
+struct _glwd_reaper {
+  char                   * name;
+  struct config_elements * config;
+  json_t                 * j_tasks;
+  unsigned int             interval;
+  unsigned int             batch_size;
+  unsigned int             batch_delay;
+  unsigned short           stop;
+  pthread_t                thread;
+  pthread_mutex_t          lock;
+  pthread_cond_t           cond;
+  struct _glwd_reaper    * next;
+};
+
+/**
+ * Structure used to store the list of reaper threads
+ */
+struct _glwd_reaper_list {
+  unsigned int          interval;
+  unsigned int          session_retention;
+  unsigned int          batch_size;
+  unsigned int          batch_delay;
+  unsigned short        initialized;
+  pthread_mutex_t       lock;
+  struct _glwd_reaper * first;
+};
+
+struct config_elements;
+
+/**
+ * Structure used to store a password check waiting in the password pool
+ * The job is allocated by the thread waiting for its result
+ */
+struct _glwd_password_job {
+  int                       (* check)(struct config_elements * config, void * instance, const char * name, const char * password);
+  void                      * instance;
+  const char                * name;
+  const char                * password;
+  unsigned short              is_client;
+  int                         result;
+  unsigned short              status;
+  struct timespec             queued_at;
+  pthread_cond_t              cond;
+  struct _glwd_password_job * next;
+};
+
+/**
+ * Structure used to store the password pool and its worker threads
+ * The user and client password checks are run by nb_workers threads,
+ * at most max_queue checks can wait for a worker, during max_wait milliseconds
+ * at most client_max client checks can be queued or running, so the clients can't take all the pool from the users
+ */
+struct _glwd_password_pool {
+  size_t                      nb_workers;
+  size_t                      max_queue;
+  unsigned int                max_wait;
+  size_t                      client_max;
+  size_t                      nb_client;
+  pthread_t                 * workers;
+  size_t                      nb_workers_started;
+  struct _glwd_password_job * first;
+  struct _glwd_password_job * last;
+  size_t                      size;
+  unsigned short              stop;
+  unsigned short              initialized;
+  pthread_mutex_t             lock;
+  pthread_cond_t              cond;
+  struct _glwd_metrics_data * metrics_depth;
+  struct _glwd_metrics_data * metrics_wait;
+  struct _glwd_metrics_data * metrics_duration;
+  struct _glwd_metrics_data * metrics_rejected;
+};
+
+/**
+ * Structure used to store the session schemes use counters not written in the database yet
+ * j_pending format: {"<guasmi_id>": {"<session_hash>:<username>": {"session_hash": string, "username": string, "count": integer}}}
+ * j_flushing is the previous j_pending being written in the database
+ */
+struct _glwd_session_usage {
+  unsigned int      flush_interval;
+  size_t            nb_pending;
+  json_t          * j_pending;
+  json_t          * j_flushing;
+  unsigned short    stop;
+  unsigned short    initialized;
+  pthread_t         thread;
+  pthread_mutex_t   lock;
+  pthread_cond_t    cond;
+};
+
+/**
+ * Structure used to store the enabled API keys and their counters not written in the database yet
+ * j_keys format: {"<token_hash>": true}
+ * j_counters format: {"<token_hash>": integer}
+ * version is incremented every time an API key is added or disabled by this instance
+ */
+struct _glwd_api_key_cache {
+  unsigned int      flush_interval;
+  unsigned int      version;
+  json_t          * j_keys;
+  json_t          * j_counters;
+  unsigned short    stop;
+  unsigned short    initialized;
+  pthread_t         thread;
+  pthread_mutex_t   lock;
+  pthread_cond_t    cond;
+};
+
+#define GLWD_USER_ROUTE_SHARDS  16
+#define GLWD_USER_ROUTE_BUCKETS 256
+
+/**
+ * Structure used to store the user module instance where a username was found
+ */
+struct _glwd_user_route_entry {
+  char                          * username;
+  char                          * source;
+  unsigned int                    hash;
+  time_t                          expires_at;
+  struct _glwd_user_route_entry * next;
+};
+
+/**
+ * Structure used to store a username routing index shard
+ */
+struct _glwd_user_route_shard {
+  pthread_mutex_t                 lock;
+  struct _glwd_user_route_entry * buckets[GLWD_USER_ROUTE_BUCKETS];
+  size_t                          count;
+};
+
+/**
+ * Structure used to store the username routing index
+ * The index is a negative cache: the user module instances before the source in the list order are skipped,
+ * the source and the following instances are always checked
+ * An entry expires after max_age seconds, so a user added in a previous instance outside of Glewlwyd is eventually found
+ */
+struct _glwd_user_route {
+  size_t                        size;
+  unsigned int                  max_age;
+  unsigned short                initialized;
+  struct _glwd_user_route_shard shards[GLWD_USER_ROUTE_SHARDS];
+};
+
+#define GLWD_USER_CACHE_SHARDS  16
+#define GLWD_USER_CACHE_BUCKETS 64
+
+/**
+ * Structure used to store a cached user, after the user middleware modules
+ * The key is the user module instance name and the username,
+ * source is NULL for a user looked up in all the user module instances
+ */
+struct _glwd_user_cache_entry {
+  char                          * source;
+  char                          * username;
+  unsigned int                    hash;
+  json_t                        * j_user;
+  time_t                          expires_at;
+  struct _glwd_user_cache_entry * next;
+};
+
+/**
+ * Structure used to store a user cache shard
+ * generation is incremented on each invalidation, so a user read in the backend
+ * before an invalidation isn't stored in the cache after it
+ */
+struct _glwd_user_cache_shard {
+  pthread_mutex_t                 lock;
+  struct _glwd_user_cache_entry * buckets[GLWD_USER_CACHE_BUCKETS];
+  size_t                          count;
+  unsigned int                    generation;
+};
+
+/**
+ * Structure used to store the in-memory user cache
+ */
+struct _glwd_user_cache {
+  size_t                        size;
+  unsigned int                  max_age;
+  unsigned short                initialized;
+  struct _glwd_user_cache_shard shards[GLWD_USER_CACHE_SHARDS];
+};
+
+#define GLWD_SESSION_CACHE_SHARDS  16
+#define GLWD_SESSION_CACHE_BUCKETS 64
+
+/**
+ * Structure used to store a cached session
+ * j_session contains the session objects per username
+ * expires_at is the lowest value of the session expiration, the schemes expiration and the cache max age
+ */
+struct _glwd_session_cache_entry {
+  char                             * session_uid;
+  char                             * session_hash;
+  unsigned int                       hash;
+  char                             * current_username;
+  json_t                           * j_session;
+  time_t                             expires_at;
+  struct _glwd_session_cache_entry * next;
+};
+
+/**
+ * Structure used to store a session cache shard
+ * generation is incremented on each invalidation, so a value read in the database
+ * before an invalidation isn't stored in the cache after it
+ */
+struct _glwd_session_cache_shard {
+  pthread_mutex_t                    lock;
+  struct _glwd_session_cache_entry * buckets[GLWD_SESSION_CACHE_BUCKETS];
+  size_t                             count;
+  unsigned int                       generation;
+};
+
+/**
+ * Structure used to store the in-memory session cache
+ */
+struct _glwd_session_cache {
+  size_t                           size;
+  unsigned int                     max_age;
+  unsigned short                   initialized;
+  struct _glwd_session_cache_shard shards[GLWD_SESSION_CACHE_SHARDS];
 };
 
 /**
@@ -342,6 +758,9 @@ struct config_elements {
   unsigned long                                  log_level;
   char *                                         log_file;
   struct _u_compressed_inmemory_website_config * static_file_config;
+  unsigned short                                 static_files_watch;
+  size_t                                         http_compression_min_size;
+  int                                            http_compression_level;
   char *                                         admin_scope;
   char *                                         profile_scope;
   char *                                         allow_origin;
@@ -350,6 +769,15 @@ struct config_elements {
   char *                                         secure_connection_pem_file;
   char *                                         secure_connection_ca_file;
   struct _h_connection *                         conn;
+  struct _glwd_db_pool                           db_pool;
+  struct _glwd_session_cache                     session_cache;
+  struct _glwd_user_route                        user_route;
+  struct _glwd_user_cache                        user_cache;
+  struct _glwd_mail_queue                        mail_queue;
+  struct _glwd_reaper_list                       reaper;
+  struct _glwd_session_usage                     session_usage;
+  struct _glwd_password_pool                     password_pool;
+  struct _glwd_api_key_cache                     api_key_cache;
   struct _u_instance *                           instance;
   unsigned int                                   instance_initialized;
   struct _u_instance *                           instance_metrics;
@@ -369,6 +797,14 @@ struct config_elements {
   char *                                         client_module_path;
   struct _pointer_list *                         client_module_list;
   struct _pointer_list *                         client_module_instance_list;
+  pthread_mutex_t                                module_list_cache_lock;
+  json_t *                                       j_user_module_list_cache;
+  json_t *                                       j_client_module_list_cache;
+  pthread_mutex_t                                scope_policy_lock;
+  json_t *                                       j_scope_policy;
+  unsigned int                                   scope_policy_cache_max_age;
+  time_t                                         scope_policy_expires_at;
+  unsigned int                                   scope_policy_generation;
   char *                                         user_auth_scheme_module_path;
   struct _pointer_list *                         user_auth_scheme_module_list;
   struct _pointer_list *                         user_auth_scheme_module_instance_list;
@@ -382,6 +818,12 @@ struct config_elements {
   unsigned short                                 metrics_endpoint_admin_session;
   pthread_mutex_t                                metrics_lock;
   struct _pointer_list                           metrics_list;
+  struct _glwd_metrics_data *                    metrics_hash[GLWD_METRICS_HASH_SIZE];
+  struct _pointer_list                           metrics_endpoint_list;
+  struct _glwd_metrics_data *                    metrics_auth_user_valid;
+  struct _glwd_metrics_data *                    metrics_auth_user_valid_password;
+  struct _glwd_metrics_data *                    metrics_auth_user_invalid;
+  struct _glwd_metrics_data *                    metrics_auth_user_invalid_password;
 };
 
 /**
@@ -432,11 +874,24 @@ struct config_plugin {
   // Prometheus metrics functions
   int      (* glewlwyd_plugin_callback_metrics_add_metric)(struct config_plugin * config, const char * name, const char * help);
   int      (* glewlwyd_plugin_callback_metrics_increment_counter)(struct config_plugin * config, const char * name, size_t inc, ...);
+  struct _glwd_metrics_data * (* glewlwyd_plugin_callback_metrics_get_counter)(struct config_plugin * config, const char * name, ...);
+  void     (* glewlwyd_plugin_callback_metrics_counter_add)(struct _glwd_metrics_data * counter, size_t inc);
 
   // Misc functions
   char   * (* glewlwyd_callback_get_plugin_external_url)(struct config_plugin * config, const char * name);
   char   * (* glewlwyd_callback_get_login_url)(struct config_plugin * config, const char * client_id, const char * scope_list, const char * callback_url, struct _u_map * additional_parameters);
   char   * (* glewlwyd_callback_generate_hash)(struct config_plugin * config, const char * data);
+
+  // Database connection pool functions
+  struct _h_connection * (* glewlwyd_plugin_callback_db_acquire)(struct config_plugin * config);
+  void                   (* glewlwyd_plugin_callback_db_release)(struct config_plugin * config, struct _h_connection * conn);
+
+  // Mail queue functions
+  int      (* glewlwyd_plugin_callback_send_email)(struct config_plugin * config, const char * host, int port, int use_tls, int verify_certificate, const char * user, const char * password, const char * from, const char * to, const char * content_type, const char * subject, const char * body);
+
+  // Expired data reaper functions
+  int      (* glewlwyd_plugin_callback_reaper_start)(struct config_plugin * config, const char * name, json_t * j_tasks, unsigned int interval, unsigned int batch_size, unsigned int batch_delay);
+  int      (* glewlwyd_plugin_callback_reaper_stop)(struct config_plugin * config, const char * name);
 };
 
 /**
@@ -455,6 +910,9 @@ struct config_module {
   int                    (* glewlwyd_module_callback_set_user)(struct config_module * config, const char * username, json_t * j_user);
   int                    (* glewlwyd_module_callback_check_user_password)(struct config_module * config, const char * username, const char * password);
   json_t               * (* glewlwyd_module_callback_check_user_session)(struct config_module * config, const struct _u_request * request, const char * username);
+  struct _h_connection * (* glewlwyd_module_callback_db_acquire)(struct config_module * config);
+  void                   (* glewlwyd_module_callback_db_release)(struct config_module * config, struct _h_connection * conn);
+  int                    (* glewlwyd_module_callback_send_email)(struct config_module * config, const char * host, int port, int use_tls, int verify_certificate, const char * user, const char * password, const char * from, const char * to, const char * content_type, const char * subject, const char * body);
 };
 
 /**
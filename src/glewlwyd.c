@@ -112,6 +112,13 @@ int main (int argc, char ** argv) {
   config->config_p->glewlwyd_plugin_callback_get_scheme_module = &glewlwyd_plugin_callback_get_scheme_module;
   config->config_p->glewlwyd_plugin_callback_metrics_add_metric = &glewlwyd_plugin_callback_metrics_add_metric;
   config->config_p->glewlwyd_plugin_callback_metrics_increment_counter = &glewlwyd_plugin_callback_metrics_increment_counter;
+  config->config_p->glewlwyd_plugin_callback_metrics_get_counter = &glewlwyd_plugin_callback_metrics_get_counter;
+  config->config_p->glewlwyd_plugin_callback_metrics_counter_add = &glewlwyd_plugin_callback_metrics_counter_add;
+  config->config_p->glewlwyd_plugin_callback_db_acquire = &glewlwyd_plugin_callback_db_acquire;
+  config->config_p->glewlwyd_plugin_callback_db_release = &glewlwyd_plugin_callback_db_release;
+  config->config_p->glewlwyd_plugin_callback_send_email = &glewlwyd_plugin_callback_send_email;
+  config->config_p->glewlwyd_plugin_callback_reaper_start = &glewlwyd_plugin_callback_reaper_start;
+  config->config_p->glewlwyd_plugin_callback_reaper_stop = &glewlwyd_plugin_callback_reaper_stop;
 
   // Init config structure with default values
   config->config_m->external_url = NULL;
@@ -124,6 +131,9 @@ int main (int argc, char ** argv) {
   config->config_m->glewlwyd_module_callback_set_user = &glewlwyd_module_callback_set_user;
   config->config_m->glewlwyd_module_callback_check_user_password = &glewlwyd_module_callback_check_user_password;
   config->config_m->glewlwyd_module_callback_check_user_session = &glewlwyd_module_callback_check_user_session;
+  config->config_m->glewlwyd_module_callback_db_acquire = &glewlwyd_module_callback_db_acquire;
+  config->config_m->glewlwyd_module_callback_db_release = &glewlwyd_module_callback_db_release;
+  config->config_m->glewlwyd_module_callback_send_email = &glewlwyd_module_callback_send_email;
   config->config_file = NULL;
   config->port = 0;
   config->bind_address = NULL;
@@ -147,6 +157,40 @@ int main (int argc, char ** argv) {
   config->secure_connection_pem_file = NULL;
   config->secure_connection_ca_file = NULL;
   config->conn = NULL;
+  memset(&config->db_pool, 0, sizeof(struct _glwd_db_pool));
+  config->db_pool.size = GLEWLWYD_DEFAULT_DATABASE_POOL_SIZE;
+  config->db_pool.wait_timeout = GLEWLWYD_DEFAULT_DATABASE_POOL_WAIT_TIMEOUT;
+  config->db_pool.health_check_interval = GLEWLWYD_DEFAULT_DATABASE_POOL_HEALTH_CHECK;
+  memset(&config->session_cache, 0, sizeof(struct _glwd_session_cache));
+  config->session_cache.size = GLEWLWYD_DEFAULT_SESSION_CACHE_SIZE;
+  config->session_cache.max_age = GLEWLWYD_DEFAULT_SESSION_CACHE_MAX_AGE;
+  memset(&config->user_route, 0, sizeof(struct _glwd_user_route));
+  config->user_route.size = GLEWLWYD_DEFAULT_USER_ROUTE_SIZE;
+  config->user_route.max_age = GLEWLWYD_DEFAULT_USER_ROUTE_MAX_AGE;
+  memset(&config->user_cache, 0, sizeof(struct _glwd_user_cache));
+  config->user_cache.size = GLEWLWYD_DEFAULT_USER_CACHE_SIZE;
+  config->user_cache.max_age = GLEWLWYD_DEFAULT_USER_CACHE_MAX_AGE;
+  config->scope_policy_cache_max_age = GLEWLWYD_DEFAULT_SCOPE_POLICY_CACHE_MAX_AGE;
+  memset(&config->mail_queue, 0, sizeof(struct _glwd_mail_queue));
+  config->mail_queue.nb_workers = GLEWLWYD_DEFAULT_MAIL_QUEUE_WORKERS;
+  config->mail_queue.max_size = GLEWLWYD_DEFAULT_MAIL_QUEUE_MAX_SIZE;
+  config->mail_queue.max_attempts = GLEWLWYD_DEFAULT_MAIL_QUEUE_MAX_ATTEMPTS;
+  config->mail_queue.retry_delay = GLEWLWYD_DEFAULT_MAIL_QUEUE_RETRY_DELAY;
+  config->mail_queue.close_timeout = GLEWLWYD_DEFAULT_MAIL_QUEUE_CLOSE_TIMEOUT;
+  memset(&config->reaper, 0, sizeof(struct _glwd_reaper_list));
+  config->reaper.interval = GLEWLWYD_DEFAULT_REAPER_INTERVAL;
+  config->reaper.session_retention = GLEWLWYD_DEFAULT_REAPER_SESSION_RETENTION;
+  config->reaper.batch_size = GLEWLWYD_DEFAULT_REAPER_BATCH_SIZE;
+  config->reaper.batch_delay = GLEWLWYD_DEFAULT_REAPER_BATCH_DELAY;
+  memset(&config->session_usage, 0, sizeof(struct _glwd_session_usage));
+  config->session_usage.flush_interval = GLEWLWYD_DEFAULT_SESSION_USAGE_FLUSH_INTERVAL;
+  memset(&config->password_pool, 0, sizeof(struct _glwd_password_pool));
+  config->password_pool.nb_workers = GLEWLWYD_DEFAULT_PASSWORD_POOL_WORKERS;
+  config->password_pool.max_queue = GLEWLWYD_DEFAULT_PASSWORD_POOL_MAX_QUEUE;
+  config->password_pool.max_wait = GLEWLWYD_DEFAULT_PASSWORD_POOL_MAX_WAIT;
+  config->password_pool.client_max = GLEWLWYD_DEFAULT_PASSWORD_POOL_CLIENT_MAX;
+  memset(&config->api_key_cache, 0, sizeof(struct _glwd_api_key_cache));
+  config->api_key_cache.flush_interval = GLEWLWYD_DEFAULT_API_KEY_FLUSH_INTERVAL;
   config->session_key = o_strdup(GLEWLWYD_DEFAULT_SESSION_KEY);
   config->session_expiration = GLEWLWYD_DEFAULT_SESSION_EXPIRATION_PASSWORD;
   config->salt_length = GLEWLWYD_DEFAULT_SALT_LENGTH;
@@ -173,8 +217,13 @@ int main (int argc, char ** argv) {
   config->metrics_endpoint = 0;
   config->metrics_endpoint_port = GLEWLWYD_DEFAULT_METRICS_PORT;
   config->metrics_endpoint_admin_session = 1;
+  config->static_files_watch = 0;
+  config->http_compression_min_size = GLEWLWYD_DEFAULT_HTTP_COMPRESSION_MIN_SIZE;
+  config->http_compression_level = GLEWLWYD_DEFAULT_HTTP_COMPRESSION_LEVEL;
   http_comression_config.allow_gzip = 1;
   http_comression_config.allow_deflate = 1;
+  http_comression_config.min_size = GLEWLWYD_DEFAULT_HTTP_COMPRESSION_MIN_SIZE;
+  http_comression_config.level = GLEWLWYD_DEFAULT_HTTP_COMPRESSION_LEVEL;
 
   config->static_file_config = o_malloc(sizeof(struct _u_compressed_inmemory_website_config));
   if (config->static_file_config == NULL) {
@@ -196,6 +245,20 @@ int main (int argc, char ** argv) {
     y_log_message(Y_LOG_LEVEL_ERROR, "init - Error initializing global_handler_close_lock or global_handler_close_cond");
   }
 
+  config->j_user_module_list_cache = NULL;
+  config->j_client_module_list_cache = NULL;
+  if (pthread_mutex_init(&config->module_list_cache_lock, NULL)) {
+    fprintf(stderr, "Error initializing module_list_cache_lock, aborting\n");
+    return 2;
+  }
+  config->j_scope_policy = NULL;
+  config->scope_policy_expires_at = 0;
+  config->scope_policy_generation = 0;
+  if (pthread_mutex_init(&config->scope_policy_lock, NULL)) {
+    fprintf(stderr, "Error initializing scope_policy_lock, aborting\n");
+    return 2;
+  }
+
   // Process end signals on dedicated thread
   if (sigemptyset(&close_signals) == -1 ||
       sigaddset(&close_signals, SIGQUIT) == -1 ||
@@ -296,10 +359,83 @@ int main (int argc, char ** argv) {
   glewlwyd_metrics_add_metric(config, GLWD_METRICS_AUTH_USER_VALID_SCHEME, "Total number of successful authentication by scheme");
   glewlwyd_metrics_add_metric(config, GLWD_METRICS_AUTH_USER_INVALID, "Total number of invalid authentication");
   glewlwyd_metrics_add_metric(config, GLWD_METRICS_AUTH_USER_INVALID_SCHEME, "Total number of invalid authentication by scheme");
-  glewlwyd_metrics_increment_counter_va(config, GLWD_METRICS_AUTH_USER_VALID, 0, NULL);
-  glewlwyd_metrics_increment_counter_va(config, GLWD_METRICS_AUTH_USER_INVALID, 0, NULL);
-  glewlwyd_metrics_increment_counter_va(config, GLWD_METRICS_AUTH_USER_VALID_SCHEME, 0, "scheme_type", "password", NULL);
-  glewlwyd_metrics_increment_counter_va(config, GLWD_METRICS_AUTH_USER_INVALID_SCHEME, 0, "scheme_type", "password", NULL);
+  glewlwyd_metrics_add_metric_type(config, GLWD_METRICS_HTTP_REQUEST_DURATION, "Duration of HTTP endpoint callbacks in seconds", GLWD_METRICS_TYPE_HISTOGRAM);
+  glewlwyd_metrics_add_metric_type(config, GLWD_METRICS_HTTP_REQUEST_IN_FLIGHT, "Number of HTTP endpoint callbacks currently running", GLWD_METRICS_TYPE_GAUGE);
+  glewlwyd_metrics_add_metric_type(config, GLWD_METRICS_MODULE_CALL_DURATION, "Duration of user and client module calls in seconds", GLWD_METRICS_TYPE_HISTOGRAM);
+  glewlwyd_metrics_add_metric_type(config, GLWD_METRICS_MODULE_CALL_IN_FLIGHT, "Number of user and client module calls currently running", GLWD_METRICS_TYPE_GAUGE);
+  glewlwyd_metrics_add_metric(config, GLWD_METRICS_USER_ROUTE_HIT, "Total number of user lookups resolved by the user module instance found in the routing index");
+  glewlwyd_metrics_add_metric(config, GLWD_METRICS_USER_ROUTE_MISS, "Total number of user module instances queried that didn't have the user");
+  config->metrics_auth_user_valid = glewlwyd_metrics_get_counter(config, GLWD_METRICS_AUTH_USER_VALID, NULL);
+  config->metrics_auth_user_invalid = glewlwyd_metrics_get_counter(config, GLWD_METRICS_AUTH_USER_INVALID, NULL);
+  config->metrics_auth_user_valid_password = glewlwyd_metrics_get_counter(config, GLWD_METRICS_AUTH_USER_VALID_SCHEME, "scheme_type=\"password\"");
+  config->metrics_auth_user_invalid_password = glewlwyd_metrics_get_counter(config, GLWD_METRICS_AUTH_USER_INVALID_SCHEME, "scheme_type=\"password\"");
+
+  // Initialize database connection pool
+  if (glewlwyd_db_pool_init(config) != G_OK) {
+    fprintf(stderr, "Error initializing database connection pool\n");
+    exit_server(&config, GLEWLWYD_ERROR);
+  }
+
+  // Initialize session cache
+  if (glewlwyd_session_cache_init(config) != G_OK) {
+    fprintf(stderr, "Error initializing session cache\n");
+    exit_server(&config, GLEWLWYD_ERROR);
+  }
+
+  // Initialize username routing index
+  if (glewlwyd_user_route_init(config) != G_OK) {
+    fprintf(stderr, "Error initializing username routing index\n");
+    exit_server(&config, GLEWLWYD_ERROR);
+  }
+
+  // Initialize user cache
+  if (glewlwyd_user_cache_init(config) != G_OK) {
+    fprintf(stderr, "Error initializing user cache\n");
+    exit_server(&config, GLEWLWYD_ERROR);
+  }
+
+  // Initialize mail queue
+  if (glewlwyd_mail_queue_init(config) != G_OK) {
+    fprintf(stderr, "Error initializing mail queue\n");
+    exit_server(&config, GLEWLWYD_ERROR);
+  }
+
+  // Initialize expired data reaper
+  if (glewlwyd_reaper_init(config) != G_OK) {
+    fprintf(stderr, "Error initializing expired data reaper\n");
+    exit_server(&config, GLEWLWYD_ERROR);
+  }
+
+  // Initialize session schemes use counters write-behind
+  if (glewlwyd_session_usage_init(config) != G_OK) {
+    fprintf(stderr, "Error initializing session usage write-behind\n");
+    exit_server(&config, GLEWLWYD_ERROR);
+  }
+
+  // Initialize password check pool
+  if (glewlwyd_password_pool_init(config) != G_OK) {
+    fprintf(stderr, "Error initializing password pool\n");
+    exit_server(&config, GLEWLWYD_ERROR);
+  }
+
+  // Initialize API keys cache
+  if (glewlwyd_api_key_cache_init(config) != G_OK) {
+    fprintf(stderr, "Error initializing API keys cache\n");
+    exit_server(&config, GLEWLWYD_ERROR);
+  }
+
+  // Load webapp files in memory
+  if (config->static_file_config->files_path != NULL) {
+    if (u_load_compressed_inmemory_website(config->static_file_config) != U_OK) {
+      y_log_message(Y_LOG_LEVEL_WARNING, "Error loading static files in memory, the files will be read from the disk");
+    } else if (config->static_files_watch && u_watch_compressed_inmemory_website(config->static_file_config) != U_OK) {
+      y_log_message(Y_LOG_LEVEL_WARNING, "Error starting static files watcher, the files changed will be served after restart");
+    }
+  }
+
+  // Set API responses compression parameters
+  http_comression_config.min_size = config->http_compression_min_size;
+  http_comression_config.level = config->http_compression_level;
 
   // Initialize module config structure
   config->config_m->external_url = config->external_url;
@@ -362,133 +498,133 @@ int main (int argc, char ** argv) {
   // At this point, we declare all API endpoints and configure
 
   // Authentication
-  ulfius_add_endpoint_by_val(config->instance, "POST", config->api_prefix, "/auth/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_user_auth, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "POST", config->api_prefix, "/auth/scheme/trigger/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_user_auth_trigger, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "GET", config->api_prefix, "/auth/scheme/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_user_get_schemes_from_scopes, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "DELETE", config->api_prefix, "/auth/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_user_delete_session, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "POST", config->api_prefix, "/auth/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_user_auth, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "POST", config->api_prefix, "/auth/scheme/trigger/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_user_auth_trigger, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "GET", config->api_prefix, "/auth/scheme/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_user_get_schemes_from_scopes, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "DELETE", config->api_prefix, "/auth/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_user_delete_session, (void*)config);
 
   // User profile
-  ulfius_add_endpoint_by_val(config->instance, "GET", config->api_prefix, "/profile_list/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_user_get_profile, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "GET", config->api_prefix, "/profile_list/", GLEWLWYD_CALLBACK_PRIORITY_COMPRESSION, &callback_http_compression, &http_comression_config);
-  ulfius_add_endpoint_by_val(config->instance, "*", config->api_prefix, "/profile/*", GLEWLWYD_CALLBACK_PRIORITY_AUTHENTICATION, &callback_glewlwyd_check_user_profile_valid, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "*", config->api_prefix, "/profile/*", GLEWLWYD_CALLBACK_PRIORITY_COMPRESSION, &callback_http_compression, &http_comression_config);
-  ulfius_add_endpoint_by_val(config->instance, "PUT", config->api_prefix, "/profile/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_user_update_profile, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "DELETE", config->api_prefix, "/profile/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_user_delete_profile, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "PUT", config->api_prefix, "/profile/password", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_user_update_password, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "GET", config->api_prefix, "/profile/plugin", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_user_get_plugin_list, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "GET", config->api_prefix, "/profile/grant", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_user_get_client_grant_list, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "GET", config->api_prefix, "/profile/session", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_user_get_session_list, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "DELETE", config->api_prefix, "/profile/session/:session_hash", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_delete_session, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "GET", config->api_prefix, "/profile/scheme", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_user_get_scheme_list, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "*", config->api_prefix, "/profile/scheme/register/*", GLEWLWYD_CALLBACK_PRIORITY_PRE_APPLICATION, &callback_glewlwyd_scheme_check_forbid_profile, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "POST", config->api_prefix, "/profile/scheme/register/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_user_auth_register, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "PUT", config->api_prefix, "/profile/scheme/register/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_user_auth_register_get, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "GET", config->api_prefix, "/profile_list/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_user_get_profile, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "GET", config->api_prefix, "/profile_list/", GLEWLWYD_CALLBACK_PRIORITY_COMPRESSION, &callback_http_compression, &http_comression_config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "*", config->api_prefix, "/profile/*", GLEWLWYD_CALLBACK_PRIORITY_AUTHENTICATION, &callback_glewlwyd_check_user_profile_valid, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "*", config->api_prefix, "/profile/*", GLEWLWYD_CALLBACK_PRIORITY_COMPRESSION, &callback_http_compression, &http_comression_config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "PUT", config->api_prefix, "/profile/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_user_update_profile, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "DELETE", config->api_prefix, "/profile/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_user_delete_profile, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "PUT", config->api_prefix, "/profile/password", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_user_update_password, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "GET", config->api_prefix, "/profile/plugin", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_user_get_plugin_list, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "GET", config->api_prefix, "/profile/grant", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_user_get_client_grant_list, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "GET", config->api_prefix, "/profile/session", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_user_get_session_list, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "DELETE", config->api_prefix, "/profile/session/:session_hash", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_delete_session, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "GET", config->api_prefix, "/profile/scheme", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_user_get_scheme_list, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "*", config->api_prefix, "/profile/scheme/register/*", GLEWLWYD_CALLBACK_PRIORITY_PRE_APPLICATION, &callback_glewlwyd_scheme_check_forbid_profile, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "POST", config->api_prefix, "/profile/scheme/register/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_user_auth_register, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "PUT", config->api_prefix, "/profile/scheme/register/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_user_auth_register_get, (void*)config);
 
   // Grant scopes endpoints
-  ulfius_add_endpoint_by_val(config->instance, "*", config->api_prefix, "/auth/grant/*", GLEWLWYD_CALLBACK_PRIORITY_AUTHENTICATION, &callback_glewlwyd_check_user_session, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "GET", config->api_prefix, "/auth/grant/:client_id/:scope_list", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_get_user_session_scope_grant, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "PUT", config->api_prefix, "/auth/grant/:client_id/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_set_user_session_scope_grant, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "*", config->api_prefix, "/auth/grant/*", GLEWLWYD_CALLBACK_PRIORITY_COMPRESSION, &callback_http_compression, &http_comression_config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "*", config->api_prefix, "/auth/grant/*", GLEWLWYD_CALLBACK_PRIORITY_AUTHENTICATION, &callback_glewlwyd_check_user_session, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "GET", config->api_prefix, "/auth/grant/:client_id/:scope_list", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_get_user_session_scope_grant, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "PUT", config->api_prefix, "/auth/grant/:client_id/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_set_user_session_scope_grant, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "*", config->api_prefix, "/auth/grant/*", GLEWLWYD_CALLBACK_PRIORITY_COMPRESSION, &callback_http_compression, &http_comression_config);
 
   // User profile by delegation
-  ulfius_add_endpoint_by_val(config->instance, "*", config->api_prefix, "/delegate/:username/profile/*", GLEWLWYD_CALLBACK_PRIORITY_AUTHENTICATION, &callback_glewlwyd_check_admin_session_delegate, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "*", config->api_prefix, "/delegate/:username/profile/*", GLEWLWYD_CALLBACK_PRIORITY_COMPRESSION, &callback_http_compression, &http_comression_config);
-  ulfius_add_endpoint_by_val(config->instance, "PUT", config->api_prefix, "/delegate/:username/profile/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_user_update_profile, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "GET", config->api_prefix, "/delegate/:username/profile/session", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_user_get_session_list, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "GET", config->api_prefix, "/delegate/:username/profile/plugin", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_user_get_plugin_list, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "DELETE", config->api_prefix, "/delegate/:username/profile/session/:session_hash", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_delete_session, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "GET", config->api_prefix, "/delegate/:username/profile/scheme", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_user_get_scheme_list, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "POST", config->api_prefix, "/delegate/:username/profile/scheme/register/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_user_auth_register_delegate, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "PUT", config->api_prefix, "/delegate/:username/profile/scheme/register/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_user_auth_register_get_delegate, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "*", config->api_prefix, "/delegate/:username/profile/*", GLEWLWYD_CALLBACK_PRIORITY_AUTHENTICATION, &callback_glewlwyd_check_admin_session_delegate, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "*", config->api_prefix, "/delegate/:username/profile/*", GLEWLWYD_CALLBACK_PRIORITY_COMPRESSION, &callback_http_compression, &http_comression_config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "PUT", config->api_prefix, "/delegate/:username/profile/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_user_update_profile, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "GET", config->api_prefix, "/delegate/:username/profile/session", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_user_get_session_list, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "GET", config->api_prefix, "/delegate/:username/profile/plugin", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_user_get_plugin_list, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "DELETE", config->api_prefix, "/delegate/:username/profile/session/:session_hash", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_delete_session, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "GET", config->api_prefix, "/delegate/:username/profile/scheme", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_user_get_scheme_list, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "POST", config->api_prefix, "/delegate/:username/profile/scheme/register/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_user_auth_register_delegate, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "PUT", config->api_prefix, "/delegate/:username/profile/scheme/register/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_user_auth_register_get_delegate, (void*)config);
 
   // Modules check session
-  ulfius_add_endpoint_by_val(config->instance, "*", config->api_prefix, "/mod/*", GLEWLWYD_CALLBACK_PRIORITY_AUTHENTICATION, &callback_glewlwyd_check_admin_session_or_api_key, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "*", config->api_prefix, "/mod/*", GLEWLWYD_CALLBACK_PRIORITY_COMPRESSION, &callback_http_compression, &http_comression_config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "*", config->api_prefix, "/mod/*", GLEWLWYD_CALLBACK_PRIORITY_AUTHENTICATION, &callback_glewlwyd_check_admin_session_or_api_key, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "*", config->api_prefix, "/mod/*", GLEWLWYD_CALLBACK_PRIORITY_COMPRESSION, &callback_http_compression, &http_comression_config);
 
   // Get all module types available
-  ulfius_add_endpoint_by_val(config->instance, "GET", config->api_prefix, "/mod/type/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_get_module_type_list, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "PUT", config->api_prefix, "/mod/reload/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_reload_modules, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "GET", config->api_prefix, "/mod/type/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_get_module_type_list, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "PUT", config->api_prefix, "/mod/reload/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_reload_modules, (void*)config);
 
   // User modules management
-  ulfius_add_endpoint_by_val(config->instance, "GET", config->api_prefix, "/mod/user/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_get_user_module_list, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "GET", config->api_prefix, "/mod/user/:name", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_get_user_module, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "POST", config->api_prefix, "/mod/user/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_add_user_module, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "PUT", config->api_prefix, "/mod/user/:name", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_set_user_module, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "DELETE", config->api_prefix, "/mod/user/:name", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_delete_user_module, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "PUT", config->api_prefix, "/mod/user/:name/:action", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_manage_user_module, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "GET", config->api_prefix, "/mod/user/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_get_user_module_list, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "GET", config->api_prefix, "/mod/user/:name", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_get_user_module, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "POST", config->api_prefix, "/mod/user/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_add_user_module, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "PUT", config->api_prefix, "/mod/user/:name", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_set_user_module, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "DELETE", config->api_prefix, "/mod/user/:name", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_delete_user_module, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "PUT", config->api_prefix, "/mod/user/:name/:action", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_manage_user_module, (void*)config);
 
   // User middleware modules management
-  ulfius_add_endpoint_by_val(config->instance, "GET", config->api_prefix, "/mod/user_middleware/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_get_user_middleware_module_list, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "GET", config->api_prefix, "/mod/user_middleware/:name", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_get_user_middleware_module, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "POST", config->api_prefix, "/mod/user_middleware/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_add_user_middleware_module, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "PUT", config->api_prefix, "/mod/user_middleware/:name", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_set_user_middleware_module, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "DELETE", config->api_prefix, "/mod/user_middleware/:name", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_delete_user_middleware_module, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "PUT", config->api_prefix, "/mod/user_middleware/:name/:action", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_manage_user_middleware_module, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "GET", config->api_prefix, "/mod/user_middleware/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_get_user_middleware_module_list, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "GET", config->api_prefix, "/mod/user_middleware/:name", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_get_user_middleware_module, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "POST", config->api_prefix, "/mod/user_middleware/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_add_user_middleware_module, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "PUT", config->api_prefix, "/mod/user_middleware/:name", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_set_user_middleware_module, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "DELETE", config->api_prefix, "/mod/user_middleware/:name", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_delete_user_middleware_module, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "PUT", config->api_prefix, "/mod/user_middleware/:name/:action", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_manage_user_middleware_module, (void*)config);
 
   // User auth scheme modules management
-  ulfius_add_endpoint_by_val(config->instance, "GET", config->api_prefix, "/mod/scheme/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_get_user_auth_scheme_module_list, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "GET", config->api_prefix, "/mod/scheme/:name", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_get_user_auth_scheme_module, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "POST", config->api_prefix, "/mod/scheme/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_add_user_auth_scheme_module, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "PUT", config->api_prefix, "/mod/scheme/:name", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_set_user_auth_scheme_module, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "DELETE", config->api_prefix, "/mod/scheme/:name", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_delete_user_auth_scheme_module, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "PUT", config->api_prefix, "/mod/scheme/:name/:action", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_manage_user_auth_scheme_module, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "GET", config->api_prefix, "/mod/scheme/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_get_user_auth_scheme_module_list, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "GET", config->api_prefix, "/mod/scheme/:name", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_get_user_auth_scheme_module, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "POST", config->api_prefix, "/mod/scheme/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_add_user_auth_scheme_module, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "PUT", config->api_prefix, "/mod/scheme/:name", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_set_user_auth_scheme_module, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "DELETE", config->api_prefix, "/mod/scheme/:name", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_delete_user_auth_scheme_module, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "PUT", config->api_prefix, "/mod/scheme/:name/:action", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_manage_user_auth_scheme_module, (void*)config);
 
   // Client modules management
-  ulfius_add_endpoint_by_val(config->instance, "GET", config->api_prefix, "/mod/client/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_get_client_module_list, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "GET", config->api_prefix, "/mod/client/:name", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_get_client_module, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "POST", config->api_prefix, "/mod/client/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_add_client_module, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "PUT", config->api_prefix, "/mod/client/:name", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_set_client_module, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "DELETE", config->api_prefix, "/mod/client/:name", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_delete_client_module, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "PUT", config->api_prefix, "/mod/client/:name/:action", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_manage_client_module, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "GET", config->api_prefix, "/mod/client/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_get_client_module_list, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "GET", config->api_prefix, "/mod/client/:name", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_get_client_module, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "POST", config->api_prefix, "/mod/client/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_add_client_module, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "PUT", config->api_prefix, "/mod/client/:name", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_set_client_module, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "DELETE", config->api_prefix, "/mod/client/:name", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_delete_client_module, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "PUT", config->api_prefix, "/mod/client/:name/:action", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_manage_client_module, (void*)config);
 
   // Plugin modules management
-  ulfius_add_endpoint_by_val(config->instance, "GET", config->api_prefix, "/mod/plugin/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_get_plugin_module_list, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "GET", config->api_prefix, "/mod/plugin/:name", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_get_plugin_module, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "POST", config->api_prefix, "/mod/plugin/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_add_plugin_module, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "PUT", config->api_prefix, "/mod/plugin/:name", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_set_plugin_module, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "DELETE", config->api_prefix, "/mod/plugin/:name", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_delete_plugin_module, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "PUT", config->api_prefix, "/mod/plugin/:name/:action", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_manage_plugin_module, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "GET", config->api_prefix, "/mod/plugin/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_get_plugin_module_list, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "GET", config->api_prefix, "/mod/plugin/:name", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_get_plugin_module, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "POST", config->api_prefix, "/mod/plugin/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_add_plugin_module, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "PUT", config->api_prefix, "/mod/plugin/:name", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_set_plugin_module, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "DELETE", config->api_prefix, "/mod/plugin/:name", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_delete_plugin_module, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "PUT", config->api_prefix, "/mod/plugin/:name/:action", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_manage_plugin_module, (void*)config);
 
   // Users CRUD
-  ulfius_add_endpoint_by_val(config->instance, "*", config->api_prefix, "/user/*", GLEWLWYD_CALLBACK_PRIORITY_AUTHENTICATION, &callback_glewlwyd_check_admin_session_or_api_key, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "*", config->api_prefix, "/user/*", GLEWLWYD_CALLBACK_PRIORITY_COMPRESSION, &callback_http_compression, &http_comression_config);
-  ulfius_add_endpoint_by_val(config->instance, "GET", config->api_prefix, "/user/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_get_user_list, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "GET", config->api_prefix, "/user/:username", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_get_user, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "POST", config->api_prefix, "/user/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_add_user, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "PUT", config->api_prefix, "/user/:username", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_set_user, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "DELETE", config->api_prefix, "/user/:username", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_delete_user, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "*", config->api_prefix, "/user/*", GLEWLWYD_CALLBACK_PRIORITY_AUTHENTICATION, &callback_glewlwyd_check_admin_session_or_api_key, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "*", config->api_prefix, "/user/*", GLEWLWYD_CALLBACK_PRIORITY_COMPRESSION, &callback_http_compression, &http_comression_config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "GET", config->api_prefix, "/user/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_get_user_list, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "GET", config->api_prefix, "/user/:username", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_get_user, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "POST", config->api_prefix, "/user/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_add_user, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "PUT", config->api_prefix, "/user/:username", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_set_user, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "DELETE", config->api_prefix, "/user/:username", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_delete_user, (void*)config);
 
   // Clients CRUD
-  ulfius_add_endpoint_by_val(config->instance, "*", config->api_prefix, "/client/*", GLEWLWYD_CALLBACK_PRIORITY_AUTHENTICATION, &callback_glewlwyd_check_admin_session_or_api_key, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "*", config->api_prefix, "/client/*", GLEWLWYD_CALLBACK_PRIORITY_COMPRESSION, &callback_http_compression, &http_comression_config);
-  ulfius_add_endpoint_by_val(config->instance, "GET", config->api_prefix, "/client/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_get_client_list, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "GET", config->api_prefix, "/client/:client_id", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_get_client, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "POST", config->api_prefix, "/client/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_add_client, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "PUT", config->api_prefix, "/client/:client_id", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_set_client, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "DELETE", config->api_prefix, "/client/:client_id", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_delete_client, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "*", config->api_prefix, "/client/*", GLEWLWYD_CALLBACK_PRIORITY_AUTHENTICATION, &callback_glewlwyd_check_admin_session_or_api_key, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "*", config->api_prefix, "/client/*", GLEWLWYD_CALLBACK_PRIORITY_COMPRESSION, &callback_http_compression, &http_comression_config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "GET", config->api_prefix, "/client/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_get_client_list, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "GET", config->api_prefix, "/client/:client_id", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_get_client, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "POST", config->api_prefix, "/client/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_add_client, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "PUT", config->api_prefix, "/client/:client_id", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_set_client, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "DELETE", config->api_prefix, "/client/:client_id", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_delete_client, (void*)config);
 
   // Scopes CRUD
-  ulfius_add_endpoint_by_val(config->instance, "*", config->api_prefix, "/scope/*", GLEWLWYD_CALLBACK_PRIORITY_AUTHENTICATION, &callback_glewlwyd_check_admin_session_or_api_key, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "*", config->api_prefix, "/scope/*", GLEWLWYD_CALLBACK_PRIORITY_COMPRESSION, &callback_http_compression, &http_comression_config);
-  ulfius_add_endpoint_by_val(config->instance, "GET", config->api_prefix, "/scope/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_get_scope_list, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "GET", config->api_prefix, "/scope/:scope", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_get_scope, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "POST", config->api_prefix, "/scope/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_add_scope, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "PUT", config->api_prefix, "/scope/:scope", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_set_scope, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "DELETE", config->api_prefix, "/scope/:scope", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_delete_scope, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "*", config->api_prefix, "/scope/*", GLEWLWYD_CALLBACK_PRIORITY_AUTHENTICATION, &callback_glewlwyd_check_admin_session_or_api_key, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "*", config->api_prefix, "/scope/*", GLEWLWYD_CALLBACK_PRIORITY_COMPRESSION, &callback_http_compression, &http_comression_config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "GET", config->api_prefix, "/scope/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_get_scope_list, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "GET", config->api_prefix, "/scope/:scope", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_get_scope, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "POST", config->api_prefix, "/scope/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_add_scope, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "PUT", config->api_prefix, "/scope/:scope", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_set_scope, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "DELETE", config->api_prefix, "/scope/:scope", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_delete_scope, (void*)config);
 
   // API key CRD
-  ulfius_add_endpoint_by_val(config->instance, "*", config->api_prefix, "/key/*", GLEWLWYD_CALLBACK_PRIORITY_AUTHENTICATION, &callback_glewlwyd_check_admin_session, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "*", config->api_prefix, "/key/*", GLEWLWYD_CALLBACK_PRIORITY_COMPRESSION, &callback_http_compression, &http_comression_config);
-  ulfius_add_endpoint_by_val(config->instance, "GET", config->api_prefix, "/key/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_get_api_key_list, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "DELETE", config->api_prefix, "/key/:key_hash", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_delete_api_key, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "POST", config->api_prefix, "/key/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_add_api_key, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "*", config->api_prefix, "/key/*", GLEWLWYD_CALLBACK_PRIORITY_AUTHENTICATION, &callback_glewlwyd_check_admin_session, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "*", config->api_prefix, "/key/*", GLEWLWYD_CALLBACK_PRIORITY_COMPRESSION, &callback_http_compression, &http_comression_config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "GET", config->api_prefix, "/key/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_get_api_key_list, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "DELETE", config->api_prefix, "/key/:key_hash", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_delete_api_key, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "POST", config->api_prefix, "/key/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_add_api_key, (void*)config);
 
   // Other configuration
-  ulfius_add_endpoint_by_val(config->instance, "GET", "/config", NULL, GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_server_configuration, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "GET", "/config", NULL, GLEWLWYD_CALLBACK_PRIORITY_COMPRESSION, &callback_http_compression, &http_comression_config);
-  ulfius_add_endpoint_by_val(config->instance, "OPTIONS", NULL, "*", GLEWLWYD_CALLBACK_PRIORITY_ZERO, &callback_glewlwyd_options, (void*)config);
-  ulfius_add_endpoint_by_val(config->instance, "GET", NULL, "*", GLEWLWYD_CALLBACK_PRIORITY_FILE, &callback_static_compressed_inmemory_website, (void*)config->static_file_config);
-  ulfius_add_endpoint_by_val(config->instance, "GET", NULL, "*", GLEWLWYD_CALLBACK_PRIORITY_POST_FILE, &callback_404_if_necessary, NULL);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "GET", "/config", NULL, GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_glewlwyd_server_configuration, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "GET", "/config", NULL, GLEWLWYD_CALLBACK_PRIORITY_COMPRESSION, &callback_http_compression, &http_comression_config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "OPTIONS", NULL, "*", GLEWLWYD_CALLBACK_PRIORITY_ZERO, &callback_glewlwyd_options, (void*)config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "GET", NULL, "*", GLEWLWYD_CALLBACK_PRIORITY_FILE, &callback_static_compressed_inmemory_website, (void*)config->static_file_config);
+  glewlwyd_metrics_add_endpoint(config, config->instance, "GET", NULL, "*", GLEWLWYD_CALLBACK_PRIORITY_POST_FILE, &callback_404_if_necessary, NULL);
   ulfius_set_default_endpoint(config->instance, &callback_default, (void*)config);
 
   // Set default headers
@@ -598,6 +734,9 @@ void exit_server(struct config_elements ** config, int exit_value) {
   if (config != NULL && *config != NULL) {
     close_logs = ((*config)->log_mode != Y_LOG_MODE_NONE && (*config)->log_level != Y_LOG_LEVEL_NONE);
 
+    // The pending password checks use the user and client module instances
+    glewlwyd_password_pool_close(*config);
+
     close_user_module_instance_list(*config);
     close_user_module_list(*config);
 
@@ -612,6 +751,9 @@ void exit_server(struct config_elements ** config, int exit_value) {
 
     close_plugin_module_instance_list(*config);
     close_plugin_module_list(*config);
+    pthread_mutex_destroy(&(*config)->module_list_cache_lock);
+    json_decref((*config)->j_scope_policy);
+    pthread_mutex_destroy(&(*config)->scope_policy_lock);
 
     /* stop framework */
     if ((*config)->instance_initialized) {
@@ -622,9 +764,16 @@ void exit_server(struct config_elements ** config, int exit_value) {
     if ((*config)->instance_metrics_initialized) {
       ulfius_stop_framework((*config)->instance_metrics);
       ulfius_clean_instance((*config)->instance_metrics);
-      pthread_mutex_destroy(&(*config)->metrics_lock);
     }
 
+    glewlwyd_api_key_cache_close(*config);
+    glewlwyd_session_usage_close(*config);
+    glewlwyd_reaper_close(*config);
+    glewlwyd_mail_queue_close(*config);
+    glewlwyd_user_cache_close(*config);
+    glewlwyd_user_route_close(*config);
+    glewlwyd_session_cache_close(*config);
+    glewlwyd_db_pool_close(*config);
     h_close_db((*config)->conn);
     h_clean_connection((*config)->conn);
     ulfius_global_close();
@@ -945,6 +1094,246 @@ int build_config_from_file(struct config_elements * config) {
       config->session_expiration = (uint)int_value;
     }
 
+    if (config_lookup_int(&cfg, "session_cache_size", &int_value) == CONFIG_TRUE) {
+      if (int_value >= 0) {
+        config->session_cache.size = (size_t)int_value;
+      } else {
+        fprintf(stderr, "Error - session_cache_size invalid\n");
+        ret = G_ERROR_PARAM;
+        break;
+      }
+    }
+
+    if (config_lookup_int(&cfg, "session_cache_max_age", &int_value) == CONFIG_TRUE) {
+      if (int_value >= 0) {
+        config->session_cache.max_age = (unsigned int)int_value;
+      } else {
+        fprintf(stderr, "Error - session_cache_max_age invalid\n");
+        ret = G_ERROR_PARAM;
+        break;
+      }
+    }
+
+    if (config_lookup_int(&cfg, "user_route_size", &int_value) == CONFIG_TRUE) {
+      if (int_value >= 0) {
+        config->user_route.size = (size_t)int_value;
+      } else {
+        fprintf(stderr, "Error - user_route_size invalid\n");
+        ret = G_ERROR_PARAM;
+        break;
+      }
+    }
+
+    if (config_lookup_int(&cfg, "user_route_max_age", &int_value) == CONFIG_TRUE) {
+      if (int_value > 0) {
+        config->user_route.max_age = (unsigned int)int_value;
+      } else {
+        fprintf(stderr, "Error - user_route_max_age invalid\n");
+        ret = G_ERROR_PARAM;
+        break;
+      }
+    }
+
+    if (config_lookup_int(&cfg, "user_cache_size", &int_value) == CONFIG_TRUE) {
+      if (int_value >= 0) {
+        config->user_cache.size = (size_t)int_value;
+      } else {
+        fprintf(stderr, "Error - user_cache_size invalid\n");
+        ret = G_ERROR_PARAM;
+        break;
+      }
+    }
+
+    if (config_lookup_int(&cfg, "user_cache_max_age", &int_value) == CONFIG_TRUE) {
+      if (int_value >= 0) {
+        config->user_cache.max_age = (unsigned int)int_value;
+      } else {
+        fprintf(stderr, "Error - user_cache_max_age invalid\n");
+        ret = G_ERROR_PARAM;
+        break;
+      }
+    }
+
+    if (config_lookup_int(&cfg, "scope_policy_cache_max_age", &int_value) == CONFIG_TRUE) {
+      if (int_value >= 0) {
+        config->scope_policy_cache_max_age = (unsigned int)int_value;
+      } else {
+        fprintf(stderr, "Error - scope_policy_cache_max_age invalid\n");
+        ret = G_ERROR_PARAM;
+        break;
+      }
+    }
+
+    if (config_lookup_int(&cfg, "mail_queue_workers", &int_value) == CONFIG_TRUE) {
+      if (int_value >= 0) {
+        config->mail_queue.nb_workers = (size_t)int_value;
+      } else {
+        fprintf(stderr, "Error - mail_queue_workers invalid\n");
+        ret = G_ERROR_PARAM;
+        break;
+      }
+    }
+
+    if (config_lookup_int(&cfg, "mail_queue_max_size", &int_value) == CONFIG_TRUE) {
+      if (int_value >= 0) {
+        config->mail_queue.max_size = (size_t)int_value;
+      } else {
+        fprintf(stderr, "Error - mail_queue_max_size invalid\n");
+        ret = G_ERROR_PARAM;
+        break;
+      }
+    }
+
+    if (config_lookup_int(&cfg, "mail_queue_max_attempts", &int_value) == CONFIG_TRUE) {
+      if (int_value >= 0) {
+        config->mail_queue.max_attempts = (unsigned int)int_value;
+      } else {
+        fprintf(stderr, "Error - mail_queue_max_attempts invalid\n");
+        ret = G_ERROR_PARAM;
+        break;
+      }
+    }
+
+    if (config_lookup_int(&cfg, "mail_queue_retry_delay", &int_value) == CONFIG_TRUE) {
+      if (int_value >= 0) {
+        config->mail_queue.retry_delay = (unsigned int)int_value;
+      } else {
+        fprintf(stderr, "Error - mail_queue_retry_delay invalid\n");
+        ret = G_ERROR_PARAM;
+        break;
+      }
+    }
+
+    if (config_lookup_int(&cfg, "mail_queue_close_timeout", &int_value) == CONFIG_TRUE) {
+      if (int_value >= 0) {
+        config->mail_queue.close_timeout = (unsigned int)int_value;
+      } else {
+        fprintf(stderr, "Error - mail_queue_close_timeout invalid\n");
+        ret = G_ERROR_PARAM;
+        break;
+      }
+    }
+
+    if (config_lookup_int(&cfg, "reaper_interval", &int_value) == CONFIG_TRUE) {
+      if (int_value >= 0) {
+        config->reaper.interval = (unsigned int)int_value;
+      } else {
+        fprintf(stderr, "Error - reaper_interval invalid\n");
+        ret = G_ERROR_PARAM;
+        break;
+      }
+    }
+
+    if (config_lookup_int(&cfg, "reaper_session_retention", &int_value) == CONFIG_TRUE) {
+      if (int_value > 0) {
+        config->reaper.session_retention = (unsigned int)int_value;
+      } else {
+        fprintf(stderr, "Error - reaper_session_retention invalid\n");
+        ret = G_ERROR_PARAM;
+        break;
+      }
+    }
+
+    if (config_lookup_int(&cfg, "reaper_batch_size", &int_value) == CONFIG_TRUE) {
+      if (int_value > 0) {
+        config->reaper.batch_size = (unsigned int)int_value;
+      } else {
+        fprintf(stderr, "Error - reaper_batch_size invalid\n");
+        ret = G_ERROR_PARAM;
+        break;
+      }
+    }
+
+    if (config_lookup_int(&cfg, "reaper_batch_delay", &int_value) == CONFIG_TRUE) {
+      if (int_value >= 0) {
+        config->reaper.batch_delay = (unsigned int)int_value;
+      } else {
+        fprintf(stderr, "Error - reaper_batch_delay invalid\n");
+        ret = G_ERROR_PARAM;
+        break;
+      }
+    }
+
+    if (config_lookup_int(&cfg, "session_usage_flush_interval", &int_value) == CONFIG_TRUE) {
+      if (int_value >= 0) {
+        config->session_usage.flush_interval = (unsigned int)int_value;
+      } else {
+        fprintf(stderr, "Error - session_usage_flush_interval invalid\n");
+        ret = G_ERROR_PARAM;
+        break;
+      }
+    }
+
+    if (config_lookup_int(&cfg, "password_pool_workers", &int_value) == CONFIG_TRUE) {
+      if (int_value >= 0) {
+        config->password_pool.nb_workers = (size_t)int_value;
+      } else {
+        fprintf(stderr, "Error - password_pool_workers invalid\n");
+        ret = G_ERROR_PARAM;
+        break;
+      }
+    }
+
+    if (config_lookup_int(&cfg, "password_pool_max_queue", &int_value) == CONFIG_TRUE) {
+      if (int_value >= 0) {
+        config->password_pool.max_queue = (size_t)int_value;
+      } else {
+        fprintf(stderr, "Error - password_pool_max_queue invalid\n");
+        ret = G_ERROR_PARAM;
+        break;
+      }
+    }
+
+    if (config_lookup_int(&cfg, "password_pool_max_wait", &int_value) == CONFIG_TRUE) {
+      if (int_value >= 0) {
+        config->password_pool.max_wait = (unsigned int)int_value;
+      } else {
+        fprintf(stderr, "Error - password_pool_max_wait invalid\n");
+        ret = G_ERROR_PARAM;
+        break;
+      }
+    }
+
+    if (config_lookup_int(&cfg, "password_pool_client_max", &int_value) == CONFIG_TRUE) {
+      if (int_value >= 0) {
+        config->password_pool.client_max = (size_t)int_value;
+      } else {
+        fprintf(stderr, "Error - password_pool_client_max invalid\n");
+        ret = G_ERROR_PARAM;
+        break;
+      }
+    }
+
+    if (config_lookup_int(&cfg, "api_key_flush_interval", &int_value) == CONFIG_TRUE) {
+      if (int_value >= 0) {
+        config->api_key_cache.flush_interval = (unsigned int)int_value;
+      } else {
+        fprintf(stderr, "Error - api_key_flush_interval invalid\n");
+        ret = G_ERROR_PARAM;
+        break;
+      }
+    }
+
+    if (config_lookup_int(&cfg, "http_compression_min_size", &int_value) == CONFIG_TRUE) {
+      if (int_value >= 0) {
+        config->http_compression_min_size = (size_t)int_value;
+      } else {
+        fprintf(stderr, "Error - http_compression_min_size invalid\n");
+        ret = G_ERROR_PARAM;
+        break;
+      }
+    }
+
+    if (config_lookup_int(&cfg, "http_compression_level", &int_value) == CONFIG_TRUE) {
+      if (int_value >= -1 && int_value <= 9) {
+        config->http_compression_level = int_value;
+      } else {
+        fprintf(stderr, "Error - http_compression_level invalid, must be between -1 and 9\n");
+        ret = G_ERROR_PARAM;
+        break;
+      }
+    }
+
     if (config_lookup_string(&cfg, "external_url", &str_value) == CONFIG_TRUE) {
       o_free(config->external_url);
       config->external_url = o_strdup(str_value);
@@ -1012,6 +1401,20 @@ int build_config_from_file(struct config_elements * config) {
       }
     }
 
+    if (config_lookup_int(&cfg, "static_files_max_age", &int_value) == CONFIG_TRUE) {
+      if (int_value >= 0) {
+        config->static_file_config->max_age = (unsigned int)int_value;
+      } else {
+        fprintf(stderr, "Error - static_files_max_age invalid\n");
+        ret = G_ERROR_PARAM;
+        break;
+      }
+    }
+
+    if (config_lookup_bool(&cfg, "static_files_watch", &int_value) == CONFIG_TRUE) {
+      config->static_files_watch = (unsigned short)int_value;
+    }
+
     if (config_lookup_bool(&cfg, "use_secure_connection", &int_value) == CONFIG_TRUE) {
       if (config_lookup_string(&cfg, "secure_connection_key_file", &str_value) == CONFIG_TRUE &&
           config_lookup_string(&cfg, "secure_connection_pem_file", &str_value_2) == CONFIG_TRUE) {
@@ -1084,6 +1487,11 @@ int build_config_from_file(struct config_elements * config) {
             ret = G_ERROR_PARAM;
             break;
           } else {
+            config->db_pool.host = o_strdup(str_value_2);
+            config->db_pool.user = o_strdup(str_value_3);
+            config->db_pool.password = o_strdup(str_value_4);
+            config->db_pool.dbname = o_strdup(str_value_5);
+            config->db_pool.port = (unsigned int)int_value;
             if (h_execute_query_mariadb(config->conn, "SET sql_mode='PIPES_AS_CONCAT';", NULL) != H_OK) {
               y_log_message(Y_LOG_LEVEL_ERROR, "Error executing mariadb query 'SET sql_mode='PIPES_AS_CONCAT';', exiting");
               ret = G_ERROR_PARAM;
@@ -1097,12 +1505,29 @@ int build_config_from_file(struct config_elements * config) {
             fprintf(stderr, "Error opening postgre database %s, exiting\n", str_value_2);
             ret = G_ERROR_PARAM;
             break;
+          } else {
+            config->db_pool.conninfo = o_strdup(str_value_2);
           }
         } else {
           fprintf(stderr, "Error - database type unknown\n");
           ret = G_ERROR_PARAM;
           break;
         }
+        if (config_setting_lookup_int(database, "pool_size", &int_value) == CONFIG_TRUE) {
+          if (int_value >= 0) {
+            config->db_pool.size = (size_t)int_value;
+          } else {
+            fprintf(stderr, "Error - database pool_size invalid\n");
+            ret = G_ERROR_PARAM;
+            break;
+          }
+        }
+        if (config_setting_lookup_int(database, "pool_wait_timeout", &int_value) == CONFIG_TRUE) {
+          config->db_pool.wait_timeout = (unsigned int)int_value;
+        }
+        if (config_setting_lookup_int(database, "pool_health_check_interval", &int_value) == CONFIG_TRUE) {
+          config->db_pool.health_check_interval = (unsigned int)int_value;
+        }
       } else {
         fprintf(stderr, "Error - no database type found\n");
         ret = G_ERROR_PARAM;
@@ -1280,6 +1705,21 @@ int build_config_from_env(struct config_elements * config) {
     json_decref(j_mime_types);
   }
 
+  if ((value = getenv(GLEWLWYD_ENV_STATIC_FILES_MAX_AGE)) != NULL && o_strlen(value)) {
+    endptr = NULL;
+    lvalue = strtol(value, &endptr, 10);
+    if (!(*endptr) && lvalue >= 0) {
+      config->static_file_config->max_age = (unsigned int)lvalue;
+    } else {
+      fprintf(stderr, "Error invalid static_files_max_age number (env), exiting\n");
+      ret = G_ERROR_PARAM;
+    }
+  }
+
+  if ((value = getenv(GLEWLWYD_ENV_STATIC_FILES_WATCH)) != NULL) {
+    config->static_files_watch = (unsigned short)(o_strcmp(value, "1")==0);
+  }
+
   if ((value = getenv(GLEWLWYD_ENV_ALLOW_ORIGIN)) != NULL && o_strlen(value)) {
     o_free(config->allow_origin);
     config->allow_origin = o_strdup(value);
@@ -1355,6 +1795,270 @@ int build_config_from_env(struct config_elements * config) {
     }
   }
 
+  if ((value = getenv(GLEWLWYD_ENV_SESSION_CACHE_SIZE)) != NULL && o_strlen(value)) {
+    endptr = NULL;
+    lvalue = strtol(value, &endptr, 10);
+    if (!(*endptr) && lvalue >= 0) {
+      config->session_cache.size = (size_t)lvalue;
+    } else {
+      fprintf(stderr, "Error invalid session_cache_size number (env), exiting\n");
+      ret = G_ERROR_PARAM;
+    }
+  }
+
+  if ((value = getenv(GLEWLWYD_ENV_SESSION_CACHE_MAX_AGE)) != NULL && o_strlen(value)) {
+    endptr = NULL;
+    lvalue = strtol(value, &endptr, 10);
+    if (!(*endptr) && lvalue >= 0) {
+      config->session_cache.max_age = (unsigned int)lvalue;
+    } else {
+      fprintf(stderr, "Error invalid session_cache_max_age number (env), exiting\n");
+      ret = G_ERROR_PARAM;
+    }
+  }
+
+  if ((value = getenv(GLEWLWYD_ENV_USER_ROUTE_SIZE)) != NULL && o_strlen(value)) {
+    endptr = NULL;
+    lvalue = strtol(value, &endptr, 10);
+    if (!(*endptr) && lvalue >= 0) {
+      config->user_route.size = (size_t)lvalue;
+    } else {
+      fprintf(stderr, "Error invalid user_route_size number (env), exiting\n");
+      ret = G_ERROR_PARAM;
+    }
+  }
+
+  if ((value = getenv(GLEWLWYD_ENV_USER_ROUTE_MAX_AGE)) != NULL && o_strlen(value)) {
+    endptr = NULL;
+    lvalue = strtol(value, &endptr, 10);
+    if (!(*endptr) && lvalue > 0) {
+      config->user_route.max_age = (unsigned int)lvalue;
+    } else {
+      fprintf(stderr, "Error invalid user_route_max_age number (env), exiting\n");
+      ret = G_ERROR_PARAM;
+    }
+  }
+
+  if ((value = getenv(GLEWLWYD_ENV_USER_CACHE_SIZE)) != NULL && o_strlen(value)) {
+    endptr = NULL;
+    lvalue = strtol(value, &endptr, 10);
+    if (!(*endptr) && lvalue >= 0) {
+      config->user_cache.size = (size_t)lvalue;
+    } else {
+      fprintf(stderr, "Error invalid user_cache_size number (env), exiting\n");
+      ret = G_ERROR_PARAM;
+    }
+  }
+
+  if ((value = getenv(GLEWLWYD_ENV_USER_CACHE_MAX_AGE)) != NULL && o_strlen(value)) {
+    endptr = NULL;
+    lvalue = strtol(value, &endptr, 10);
+    if (!(*endptr) && lvalue >= 0) {
+      config->user_cache.max_age = (unsigned int)lvalue;
+    } else {
+      fprintf(stderr, "Error invalid user_cache_max_age number (env), exiting\n");
+      ret = G_ERROR_PARAM;
+    }
+  }
+
+  if ((value = getenv(GLEWLWYD_ENV_SCOPE_POLICY_CACHE_MAX_AGE)) != NULL && o_strlen(value)) {
+    endptr = NULL;
+    lvalue = strtol(value, &endptr, 10);
+    if (!(*endptr) && lvalue >= 0) {
+      config->scope_policy_cache_max_age = (unsigned int)lvalue;
+    } else {
+      fprintf(stderr, "Error invalid scope_policy_cache_max_age number (env), exiting\n");
+      ret = G_ERROR_PARAM;
+    }
+  }
+
+  if ((value = getenv(GLEWLWYD_ENV_MAIL_QUEUE_WORKERS)) != NULL && o_strlen(value)) {
+    endptr = NULL;
+    lvalue = strtol(value, &endptr, 10);
+    if (!(*endptr) && lvalue >= 0) {
+      config->mail_queue.nb_workers = (size_t)lvalue;
+    } else {
+      fprintf(stderr, "Error invalid mail_queue_workers number (env), exiting\n");
+      ret = G_ERROR_PARAM;
+    }
+  }
+
+  if ((value = getenv(GLEWLWYD_ENV_MAIL_QUEUE_MAX_SIZE)) != NULL && o_strlen(value)) {
+    endptr = NULL;
+    lvalue = strtol(value, &endptr, 10);
+    if (!(*endptr) && lvalue >= 0) {
+      config->mail_queue.max_size = (size_t)lvalue;
+    } else {
+      fprintf(stderr, "Error invalid mail_queue_max_size number (env), exiting\n");
+      ret = G_ERROR_PARAM;
+    }
+  }
+
+  if ((value = getenv(GLEWLWYD_ENV_MAIL_QUEUE_MAX_ATTEMPTS)) != NULL && o_strlen(value)) {
+    endptr = NULL;
+    lvalue = strtol(value, &endptr, 10);
+    if (!(*endptr) && lvalue >= 0) {
+      config->mail_queue.max_attempts = (unsigned int)lvalue;
+    } else {
+      fprintf(stderr, "Error invalid mail_queue_max_attempts number (env), exiting\n");
+      ret = G_ERROR_PARAM;
+    }
+  }
+
+  if ((value = getenv(GLEWLWYD_ENV_MAIL_QUEUE_RETRY_DELAY)) != NULL && o_strlen(value)) {
+    endptr = NULL;
+    lvalue = strtol(value, &endptr, 10);
+    if (!(*endptr) && lvalue >= 0) {
+      config->mail_queue.retry_delay = (unsigned int)lvalue;
+    } else {
+      fprintf(stderr, "Error invalid mail_queue_retry_delay number (env), exiting\n");
+      ret = G_ERROR_PARAM;
+    }
+  }
+
+  if ((value = getenv(GLEWLWYD_ENV_MAIL_QUEUE_CLOSE_TIMEOUT)) != NULL && o_strlen(value)) {
+    endptr = NULL;
+    lvalue = strtol(value, &endptr, 10);
+    if (!(*endptr) && lvalue >= 0) {
+      config->mail_queue.close_timeout = (unsigned int)lvalue;
+    } else {
+      fprintf(stderr, "Error invalid mail_queue_close_timeout number (env), exiting\n");
+      ret = G_ERROR_PARAM;
+    }
+  }
+
+  if ((value = getenv(GLEWLWYD_ENV_REAPER_INTERVAL)) != NULL && o_strlen(value)) {
+    endptr = NULL;
+    lvalue = strtol(value, &endptr, 10);
+    if (!(*endptr) && lvalue >= 0) {
+      config->reaper.interval = (unsigned int)lvalue;
+    } else {
+      fprintf(stderr, "Error invalid reaper_interval number (env), exiting\n");
+      ret = G_ERROR_PARAM;
+    }
+  }
+
+  if ((value = getenv(GLEWLWYD_ENV_REAPER_SESSION_RETENTION)) != NULL && o_strlen(value)) {
+    endptr = NULL;
+    lvalue = strtol(value, &endptr, 10);
+    if (!(*endptr) && lvalue > 0) {
+      config->reaper.session_retention = (unsigned int)lvalue;
+    } else {
+      fprintf(stderr, "Error invalid reaper_session_retention number (env), exiting\n");
+      ret = G_ERROR_PARAM;
+    }
+  }
+
+  if ((value = getenv(GLEWLWYD_ENV_REAPER_BATCH_SIZE)) != NULL && o_strlen(value)) {
+    endptr = NULL;
+    lvalue = strtol(value, &endptr, 10);
+    if (!(*endptr) && lvalue > 0) {
+      config->reaper.batch_size = (unsigned int)lvalue;
+    } else {
+      fprintf(stderr, "Error invalid reaper_batch_size number (env), exiting\n");
+      ret = G_ERROR_PARAM;
+    }
+  }
+
+  if ((value = getenv(GLEWLWYD_ENV_REAPER_BATCH_DELAY)) != NULL && o_strlen(value)) {
+    endptr = NULL;
+    lvalue = strtol(value, &endptr, 10);
+    if (!(*endptr) && lvalue >= 0) {
+      config->reaper.batch_delay = (unsigned int)lvalue;
+    } else {
+      fprintf(stderr, "Error invalid reaper_batch_delay number (env), exiting\n");
+      ret = G_ERROR_PARAM;
+    }
+  }
+
+  if ((value = getenv(GLEWLWYD_ENV_SESSION_USAGE_FLUSH_INTERVAL)) != NULL && o_strlen(value)) {
+    endptr = NULL;
+    lvalue = strtol(value, &endptr, 10);
+    if (!(*endptr) && lvalue >= 0) {
+      config->session_usage.flush_interval = (unsigned int)lvalue;
+    } else {
+      fprintf(stderr, "Error invalid session_usage_flush_interval number (env), exiting\n");
+      ret = G_ERROR_PARAM;
+    }
+  }
+
+  if ((value = getenv(GLEWLWYD_ENV_PASSWORD_POOL_WORKERS)) != NULL && o_strlen(value)) {
+    endptr = NULL;
+    lvalue = strtol(value, &endptr, 10);
+    if (!(*endptr) && lvalue >= 0) {
+      config->password_pool.nb_workers = (size_t)lvalue;
+    } else {
+      fprintf(stderr, "Error invalid password_pool_workers number (env), exiting\n");
+      ret = G_ERROR_PARAM;
+    }
+  }
+
+  if ((value = getenv(GLEWLWYD_ENV_PASSWORD_POOL_MAX_QUEUE)) != NULL && o_strlen(value)) {
+    endptr = NULL;
+    lvalue = strtol(value, &endptr, 10);
+    if (!(*endptr) && lvalue >= 0) {
+      config->password_pool.max_queue = (size_t)lvalue;
+    } else {
+      fprintf(stderr, "Error invalid password_pool_max_queue number (env), exiting\n");
+      ret = G_ERROR_PARAM;
+    }
+  }
+
+  if ((value = getenv(GLEWLWYD_ENV_PASSWORD_POOL_MAX_WAIT)) != NULL && o_strlen(value)) {
+    endptr = NULL;
+    lvalue = strtol(value, &endptr, 10);
+    if (!(*endptr) && lvalue >= 0) {
+      config->password_pool.max_wait = (unsigned int)lvalue;
+    } else {
+      fprintf(stderr, "Error invalid password_pool_max_wait number (env), exiting\n");
+      ret = G_ERROR_PARAM;
+    }
+  }
+
+  if ((value = getenv(GLEWLWYD_ENV_PASSWORD_POOL_CLIENT_MAX)) != NULL && o_strlen(value)) {
+    endptr = NULL;
+    lvalue = strtol(value, &endptr, 10);
+    if (!(*endptr) && lvalue >= 0) {
+      config->password_pool.client_max = (size_t)lvalue;
+    } else {
+      fprintf(stderr, "Error invalid password_pool_client_max number (env), exiting\n");
+      ret = G_ERROR_PARAM;
+    }
+  }
+
+  if ((value = getenv(GLEWLWYD_ENV_API_KEY_FLUSH_INTERVAL)) != NULL && o_strlen(value)) {
+    endptr = NULL;
+    lvalue = strtol(value, &endptr, 10);
+    if (!(*endptr) && lvalue >= 0) {
+      config->api_key_cache.flush_interval = (unsigned int)lvalue;
+    } else {
+      fprintf(stderr, "Error invalid api_key_flush_interval number (env), exiting\n");
+      ret = G_ERROR_PARAM;
+    }
+  }
+
+  if ((value = getenv(GLEWLWYD_ENV_HTTP_COMPRESSION_MIN_SIZE)) != NULL && o_strlen(value)) {
+    endptr = NULL;
+    lvalue = strtol(value, &endptr, 10);
+    if (!(*endptr) && lvalue >= 0) {
+      config->http_compression_min_size = (size_t)lvalue;
+    } else {
+      fprintf(stderr, "Error invalid http_compression_min_size number (env), exiting\n");
+      ret = G_ERROR_PARAM;
+    }
+  }
+
+  if ((value = getenv(GLEWLWYD_ENV_HTTP_COMPRESSION_LEVEL)) != NULL && o_strlen(value)) {
+    endptr = NULL;
+    lvalue = strtol(value, &endptr, 10);
+    if (!(*endptr) && lvalue >= -1 && lvalue <= 9) {
+      config->http_compression_level = (int)lvalue;
+    } else {
+      fprintf(stderr, "Error invalid http_compression_level number (env), must be between -1 and 9, exiting\n");
+      ret = G_ERROR_PARAM;
+    }
+  }
+
   if ((value = getenv(GLEWLWYD_ENV_SESSION_KEY)) != NULL && o_strlen(value)) {
     o_free(config->session_key);
     config->session_key = o_strdup(value);
@@ -1499,6 +2203,15 @@ int build_config_from_env(struct config_elements * config) {
           fprintf(stderr, "Error opening mariadb database '%s'\n", getenv(GLEWLWYD_ENV_DATABASE_MARIADB_DBNAME));
           ret = G_ERROR_PARAM;
         } else {
+          o_free(config->db_pool.host);
+          o_free(config->db_pool.user);
+          o_free(config->db_pool.password);
+          o_free(config->db_pool.dbname);
+          config->db_pool.host = o_strdup(getenv(GLEWLWYD_ENV_DATABASE_MARIADB_HOST));
+          config->db_pool.user = o_strdup(getenv(GLEWLWYD_ENV_DATABASE_MARIADB_USER));
+          config->db_pool.password = o_strdup(getenv(GLEWLWYD_ENV_DATABASE_MARIADB_PASSWORD));
+          config->db_pool.dbname = o_strdup(getenv(GLEWLWYD_ENV_DATABASE_MARIADB_DBNAME));
+          config->db_pool.port = (unsigned int)lvalue;
           if (h_execute_query_mariadb(config->conn, "SET sql_mode='PIPES_AS_CONCAT';", NULL) != H_OK) {
             y_log_message(Y_LOG_LEVEL_ERROR, "Error executing mariadb query 'SET sql_mode='PIPES_AS_CONCAT'; (env), exiting'");
             ret = G_ERROR_PARAM;
@@ -1509,6 +2222,9 @@ int build_config_from_env(struct config_elements * config) {
       if ((config->conn = h_connect_pgsql(getenv(GLEWLWYD_ENV_DATABASE_POSTGRE_CONNINFO))) == NULL) {
         fprintf(stderr, "Error opening postgre database %s (env), exiting\n", getenv(GLEWLWYD_ENV_DATABASE_POSTGRE_CONNINFO));
         ret = G_ERROR_PARAM;
+      } else {
+        o_free(config->db_pool.conninfo);
+        config->db_pool.conninfo = o_strdup(getenv(GLEWLWYD_ENV_DATABASE_POSTGRE_CONNINFO));
       }
     } else {
       fprintf(stderr, "Error - database type unknown (env), exiting\n");
@@ -1516,6 +2232,36 @@ int build_config_from_env(struct config_elements * config) {
     }
   }
 
+  if ((value = getenv(GLEWLWYD_ENV_DATABASE_POOL_SIZE)) != NULL && o_strlen(value)) {
+    lvalue = strtol(value, &endptr, 10);
+    if (!(*endptr) && lvalue >= 0) {
+      config->db_pool.size = (size_t)lvalue;
+    } else {
+      fprintf(stderr, "Error - database pool size invalid (env), exiting\n");
+      ret = G_ERROR_PARAM;
+    }
+  }
+
+  if ((value = getenv(GLEWLWYD_ENV_DATABASE_POOL_WAIT_TIMEOUT)) != NULL && o_strlen(value)) {
+    lvalue = strtol(value, &endptr, 10);
+    if (!(*endptr) && lvalue >= 0) {
+      config->db_pool.wait_timeout = (unsigned int)lvalue;
+    } else {
+      fprintf(stderr, "Error - database pool wait timeout invalid (env), exiting\n");
+      ret = G_ERROR_PARAM;
+    }
+  }
+
+  if ((value = getenv(GLEWLWYD_ENV_DATABASE_POOL_HEALTH_CHECK)) != NULL && o_strlen(value)) {
+    lvalue = strtol(value, &endptr, 10);
+    if (!(*endptr) && lvalue >= 0) {
+      config->db_pool.health_check_interval = (unsigned int)lvalue;
+    } else {
+      fprintf(stderr, "Error - database pool health check interval invalid (env), exiting\n");
+      ret = G_ERROR_PARAM;
+    }
+  }
+
   if ((value = getenv(GLEWLWYD_ENV_METRICS)) != NULL) {
     config->metrics_endpoint = (ushort)(o_strcmp(value, "1")==0);
   }
@@ -1906,13 +2652,14 @@ int load_user_module_instance_list(struct config_elements * config) {
             cur_instance->cls = NULL;
             cur_instance->name = o_strdup(json_string_value(json_object_get(j_instance, "name")));
             cur_instance->module = module;
+            glewlwyd_metrics_init_user_module_instance(config, cur_instance);
             cur_instance->readonly = json_integer_value(json_object_get(j_instance, "readonly"));
             cur_instance->multiple_passwords = json_integer_value(json_object_get(j_instance, "multiple_passwords"));
             if (pointer_list_append(config->user_module_instance_list, cur_instance)) {
               if (json_integer_value(json_object_get(j_instance, "enabled"))) {
                 j_parameters = json_loads(json_string_value(json_object_get(j_instance, "parameters")), JSON_DECODE_ANY, NULL);
                 if (j_parameters != NULL) {
-                  j_init = module->user_module_init(config->config_m, cur_instance->readonly, cur_instance->multiple_passwords, j_parameters, &cur_instance->cls);
+                  j_init = user_module_instance_init(config, cur_instance, j_parameters);
                   if (check_result_value(j_init, G_OK)) {
                     cur_instance->enabled = 1;
                   } else {
@@ -1984,10 +2731,11 @@ struct _user_module * get_user_module_lib(struct config_elements * config, const
 void close_user_module_instance_list(struct config_elements * config) {
   size_t i;
 
+  invalidate_user_module_list(config);
   for (i=0; i<pointer_list_size(config->user_module_instance_list); i++) {
     struct _user_module_instance * instance = (struct _user_module_instance *)pointer_list_get_at(config->user_module_instance_list, i);
     if (instance != NULL) {
-      if (instance->enabled && instance->module->user_module_close(config->config_m, instance->cls) != G_OK) {
+      if (instance->enabled && user_module_instance_close(config, instance) != G_OK) {
         y_log_message(Y_LOG_LEVEL_ERROR, "close_user_module_instance_list - Error user_module_close for instance '%s'/'%s'", instance->module->name, instance->name);
       }
       o_free(instance->name);
@@ -2317,6 +3065,7 @@ void close_user_middleware_module_instance_list(struct config_elements * config)
   }
   pointer_list_clean(config->user_middleware_module_instance_list);
   o_free(config->user_middleware_module_instance_list);
+  glewlwyd_user_cache_clear(config);
 }
 
 void close_user_middleware_module_list(struct config_elements * config) {
@@ -2858,11 +3607,12 @@ int load_client_module_instance_list(struct config_elements * config) {
             cur_instance->name = o_strdup(json_string_value(json_object_get(j_instance, "name")));
             cur_instance->readonly = json_integer_value(json_object_get(j_instance, "readonly"));
             cur_instance->module = module;
+            glewlwyd_metrics_init_client_module_instance(config, cur_instance);
             if (pointer_list_append(config->client_module_instance_list, cur_instance)) {
               if (json_integer_value(json_object_get(j_instance, "enabled"))) {
                 j_parameters = json_loads(json_string_value(json_object_get(j_instance, "parameters")), JSON_DECODE_ANY, NULL);
                 if (j_parameters != NULL) {
-                  j_init = module->client_module_init(config->config_m, cur_instance->readonly, j_parameters, &cur_instance->cls);
+                  j_init = client_module_instance_init(config, cur_instance, j_parameters);
                   if (check_result_value(j_init, G_OK)) {
                     cur_instance->enabled = 1;
                   } else {
@@ -2931,10 +3681,11 @@ struct _client_module * get_client_module_lib(struct config_elements * config, c
 void close_client_module_instance_list(struct config_elements * config) {
   size_t i;
 
+  invalidate_client_module_list(config);
   for (i=0; i<pointer_list_size(config->client_module_instance_list); i++) {
     struct _client_module_instance * instance = (struct _client_module_instance *)pointer_list_get_at(config->client_module_instance_list, i);
     if (instance != NULL) {
-      if (instance->enabled && instance->module->client_module_close(config->config_m, instance->cls) != G_OK) {
+      if (instance->enabled && client_module_instance_close(config, instance) != G_OK) {
         y_log_message(Y_LOG_LEVEL_ERROR, "close_client_module_instance_list - Error client_module_close for instance '%s'/'%s'", instance->module->name, instance->name);
       }
       o_free(instance->name);
@@ -68,6 +68,33 @@
 #define GLEWLWYD_DEFAULT_LOGIN_URL                         "login.html"
 #define GLEWLWYD_DEFAULT_SESSION_KEY                       "GLEWLWYD2_SESSION_ID"
 #define GLEWLWYD_DEFAULT_SESSION_EXPIRATION_COOKIE         5256000 // 10 years
+#define GLEWLWYD_DEFAULT_DATABASE_POOL_SIZE                0       // disabled
+#define GLEWLWYD_DEFAULT_DATABASE_POOL_WAIT_TIMEOUT        5000    // 5 seconds
+#define GLEWLWYD_DEFAULT_DATABASE_POOL_HEALTH_CHECK        60      // 1 minute
+#define GLEWLWYD_DEFAULT_SESSION_CACHE_SIZE                0       // disabled
+#define GLEWLWYD_DEFAULT_SESSION_CACHE_MAX_AGE             60      // 1 minute
+#define GLEWLWYD_DEFAULT_USER_ROUTE_SIZE                   0       // disabled
+#define GLEWLWYD_DEFAULT_USER_ROUTE_MAX_AGE                300     // 5 minutes
+#define GLEWLWYD_DEFAULT_USER_CACHE_SIZE                   0       // disabled
+#define GLEWLWYD_DEFAULT_USER_CACHE_MAX_AGE                30      // 30 seconds
+#define GLEWLWYD_DEFAULT_SCOPE_POLICY_CACHE_MAX_AGE        60      // 1 minute
+#define GLEWLWYD_DEFAULT_MAIL_QUEUE_WORKERS                2
+#define GLEWLWYD_DEFAULT_MAIL_QUEUE_MAX_SIZE               1000
+#define GLEWLWYD_DEFAULT_MAIL_QUEUE_MAX_ATTEMPTS           3
+#define GLEWLWYD_DEFAULT_MAIL_QUEUE_RETRY_DELAY            10      // 10 seconds
+#define GLEWLWYD_DEFAULT_MAIL_QUEUE_CLOSE_TIMEOUT          10      // 10 seconds
+#define GLEWLWYD_DEFAULT_REAPER_INTERVAL                   0       // disabled
+#define GLEWLWYD_DEFAULT_REAPER_SESSION_RETENTION          2592000 // 30 days
+#define GLEWLWYD_DEFAULT_REAPER_BATCH_SIZE                 500
+#define GLEWLWYD_DEFAULT_REAPER_BATCH_DELAY                100     // 100 milliseconds
+#define GLEWLWYD_DEFAULT_SESSION_USAGE_FLUSH_INTERVAL      0       // disabled
+#define GLEWLWYD_DEFAULT_PASSWORD_POOL_WORKERS             0       // disabled
+#define GLEWLWYD_DEFAULT_PASSWORD_POOL_MAX_QUEUE           64
+#define GLEWLWYD_DEFAULT_PASSWORD_POOL_MAX_WAIT            2000    // 2 seconds
+#define GLEWLWYD_DEFAULT_PASSWORD_POOL_CLIENT_MAX          0       // half of the queue
+#define GLEWLWYD_DEFAULT_API_KEY_FLUSH_INTERVAL            0       // disabled
+#define GLEWLWYD_DEFAULT_HTTP_COMPRESSION_MIN_SIZE         1024    // 1 KB
+#define GLEWLWYD_DEFAULT_HTTP_COMPRESSION_LEVEL            6
 
 #define GLEWLWYD_DEFAULT_SESSION_EXPIRATION_PASSWORD       40320   // 4 weeks
 #define GLEWLWYD_RESET_PASSWORD_DEFAULT_SESSION_EXPIRATION 2592000 // 30 days
@@ -107,6 +134,8 @@
 #define GLEWLWYD_ENV_PROFILE_DELETE              "GLWD_PROFILE_DELETE"
 #define GLEWLWYD_ENV_STATIC_FILES_PATH           "GLWD_STATIC_FILES_PATH"
 #define GLEWLWYD_ENV_STATIC_FILES_MIME_TYPES     "GLWD_STATIC_FILES_MIME_TYPES"
+#define GLEWLWYD_ENV_STATIC_FILES_MAX_AGE        "GLWD_STATIC_FILES_MAX_AGE"
+#define GLEWLWYD_ENV_STATIC_FILES_WATCH          "GLWD_STATIC_FILES_WATCH"
 #define GLEWLWYD_ENV_ALLOW_ORIGIN                "GLWD_ALLOW_ORIGIN"
 #define GLEWLWYD_ENV_LOG_MODE                    "GLWD_LOG_MODE"
 #define GLEWLWYD_ENV_LOG_LEVEL                   "GLWD_LOG_LEVEL"
@@ -114,6 +143,30 @@
 #define GLEWLWYD_ENV_COOKIE_DOMAIN               "GLWD_COOKIE_DOMAIN"
 #define GLEWLWYD_ENV_COOKIE_SECURE               "GLWD_COOKIE_SECURE"
 #define GLEWLWYD_ENV_SESSION_EXPIRATION          "GLWD_SESSION_EXPIRATION"
+#define GLEWLWYD_ENV_SESSION_CACHE_SIZE          "GLWD_SESSION_CACHE_SIZE"
+#define GLEWLWYD_ENV_SESSION_CACHE_MAX_AGE       "GLWD_SESSION_CACHE_MAX_AGE"
+#define GLEWLWYD_ENV_USER_ROUTE_SIZE             "GLWD_USER_ROUTE_SIZE"
+#define GLEWLWYD_ENV_USER_ROUTE_MAX_AGE          "GLWD_USER_ROUTE_MAX_AGE"
+#define GLEWLWYD_ENV_USER_CACHE_SIZE             "GLWD_USER_CACHE_SIZE"
+#define GLEWLWYD_ENV_USER_CACHE_MAX_AGE          "GLWD_USER_CACHE_MAX_AGE"
+#define GLEWLWYD_ENV_SCOPE_POLICY_CACHE_MAX_AGE  "GLWD_SCOPE_POLICY_CACHE_MAX_AGE"
+#define GLEWLWYD_ENV_MAIL_QUEUE_WORKERS          "GLWD_MAIL_QUEUE_WORKERS"
+#define GLEWLWYD_ENV_MAIL_QUEUE_MAX_SIZE         "GLWD_MAIL_QUEUE_MAX_SIZE"
+#define GLEWLWYD_ENV_MAIL_QUEUE_MAX_ATTEMPTS     "GLWD_MAIL_QUEUE_MAX_ATTEMPTS"
+#define GLEWLWYD_ENV_MAIL_QUEUE_RETRY_DELAY      "GLWD_MAIL_QUEUE_RETRY_DELAY"
+#define GLEWLWYD_ENV_MAIL_QUEUE_CLOSE_TIMEOUT    "GLWD_MAIL_QUEUE_CLOSE_TIMEOUT"
+#define GLEWLWYD_ENV_REAPER_INTERVAL             "GLWD_REAPER_INTERVAL"
+#define GLEWLWYD_ENV_REAPER_SESSION_RETENTION    "GLWD_REAPER_SESSION_RETENTION"
+#define GLEWLWYD_ENV_REAPER_BATCH_SIZE           "GLWD_REAPER_BATCH_SIZE"
+#define GLEWLWYD_ENV_REAPER_BATCH_DELAY          "GLWD_REAPER_BATCH_DELAY"
+#define GLEWLWYD_ENV_SESSION_USAGE_FLUSH_INTERVAL "GLWD_SESSION_USAGE_FLUSH_INTERVAL"
+#define GLEWLWYD_ENV_PASSWORD_POOL_WORKERS       "GLWD_PASSWORD_POOL_WORKERS"
+#define GLEWLWYD_ENV_PASSWORD_POOL_MAX_QUEUE     "GLWD_PASSWORD_POOL_MAX_QUEUE"
+#define GLEWLWYD_ENV_PASSWORD_POOL_MAX_WAIT      "GLWD_PASSWORD_POOL_MAX_WAIT"
+#define GLEWLWYD_ENV_PASSWORD_POOL_CLIENT_MAX    "GLWD_PASSWORD_POOL_CLIENT_MAX"
+#define GLEWLWYD_ENV_API_KEY_FLUSH_INTERVAL      "GLWD_API_KEY_FLUSH_INTERVAL"
+#define GLEWLWYD_ENV_HTTP_COMPRESSION_MIN_SIZE   "GLWD_HTTP_COMPRESSION_MIN_SIZE"
+#define GLEWLWYD_ENV_HTTP_COMPRESSION_LEVEL      "GLWD_HTTP_COMPRESSION_LEVEL"
 #define GLEWLWYD_ENV_SESSION_KEY                 "GLWD_SESSION_KEY"
 #define GLEWLWYD_ENV_ADMIN_SCOPE                 "GLWD_ADMIN_SCOPE"
 #define GLEWLWYD_ENV_PROFILE_SCOPE               "GLWD_PROFILE_SCOPE"
@@ -135,6 +188,9 @@
 #define GLEWLWYD_ENV_DATABASE_MARIADB_PORT       "GLWD_DATABASE_MARIADB_PORT"
 #define GLEWLWYD_ENV_DATABASE_SQLITE3_PATH       "GLWD_DATABASE_SQLITE3_PATH"
 #define GLEWLWYD_ENV_DATABASE_POSTGRE_CONNINFO   "GLWD_DATABASE_POSTGRE_CONNINFO"
+#define GLEWLWYD_ENV_DATABASE_POOL_SIZE          "GLWD_DATABASE_POOL_SIZE"
+#define GLEWLWYD_ENV_DATABASE_POOL_WAIT_TIMEOUT  "GLWD_DATABASE_POOL_WAIT_TIMEOUT"
+#define GLEWLWYD_ENV_DATABASE_POOL_HEALTH_CHECK  "GLWD_DATABASE_POOL_HEALTH_CHECK_INTERVAL"
 #define GLEWLWYD_ENV_METRICS                     "GLWD_METRICS"
 #define GLEWLWYD_ENV_METRICS_PORT                "GLWD_METRICS_PORT"
 #define GLEWLWYD_ENV_METRICS_ADMIN               "GLWD_METRICS_ADMIN"
@@ -193,6 +249,11 @@ char * get_session_id(struct config_elements * config, const struct _u_request *
 char * generate_session_id();
 json_t * get_user_session_list(struct config_elements * config, const char * username, const char * pattern, size_t offset, size_t limit, const char * sort);
 int delete_user_session_from_hash(struct config_elements * config, const char * username, const char * session_hash);
+int glewlwyd_session_cache_init(struct config_elements * config);
+void glewlwyd_session_cache_close(struct config_elements * config);
+void glewlwyd_session_cache_clear(struct config_elements * config);
+void glewlwyd_session_cache_invalidate(struct config_elements * config, const char * session_uid);
+void glewlwyd_session_cache_invalidate_hash(struct config_elements * config, const char * session_hash);
 
 // Profile
 json_t * user_set_profile(struct config_elements * config, const char * username, json_t * j_profile);
@@ -213,6 +274,8 @@ json_t * auth_check_client_credentials(struct config_elements * config, const ch
 json_t * get_auth_scheme_list_from_scope(struct config_elements * config, const char * scope);
 json_t * get_auth_scheme_list_from_scope_list(struct config_elements * config, const char * scope_list);
 json_t * get_validated_auth_scheme_list_from_scope_list(struct config_elements * config, const char * scope_list, const char * session_uid);
+json_t * get_session_auth_state(struct config_elements * config, const char * session_uid);
+json_t * get_validated_auth_scheme_list_from_session_auth_state(struct config_elements * config, const char * scope_list, json_t * j_state);
 int is_scope_list_valid_for_session(struct config_elements * config, const char * scope_list, const char * session_uid);
 json_t * get_client_user_scope_grant(struct config_elements * config, const char * client_id, const char * username, const char * scope_list);
 json_t * get_granted_scopes_for_client(struct config_elements * config, json_t * j_user, const char * client_id, const char * scope_list);
@@ -225,6 +288,7 @@ json_t * get_module_type_list(struct config_elements * config);
 
 // User module functions
 json_t * get_user_module_list(struct config_elements * config);
+void invalidate_user_module_list(struct config_elements * config);
 json_t * get_user_module(struct config_elements * config, const char * name);
 json_t * is_user_module_valid(struct config_elements * config, json_t * j_module, int add);
 json_t * add_user_module(struct config_elements * config, json_t * j_module);
@@ -258,6 +322,7 @@ void close_user_auth_scheme_module_list(struct config_elements * config);
 
 // Client module functions
 json_t * get_client_module_list(struct config_elements * config);
+void invalidate_client_module_list(struct config_elements * config);
 json_t * get_client_module(struct config_elements * config, const char * name);
 json_t * is_client_module_valid(struct config_elements * config, json_t * j_module, int add);
 json_t * add_client_module(struct config_elements * config, json_t * j_module);
@@ -313,6 +378,8 @@ int glewlwyd_plugin_callback_scheme_can_use(struct config_plugin * config, const
 int glewlwyd_plugin_callback_scheme_deregister(struct config_plugin * config, const char * mod_name, const char * username);
 int glewlwyd_plugin_callback_metrics_add_metric(struct config_plugin * config, const char * name, const char * help);
 int glewlwyd_plugin_callback_metrics_increment_counter(struct config_plugin * config, const char * name, size_t inc, ...);
+struct _glwd_metrics_data * glewlwyd_plugin_callback_metrics_get_counter(struct config_plugin * config, const char * name, ...);
+void glewlwyd_plugin_callback_metrics_counter_add(struct _glwd_metrics_data * counter, size_t inc);
 
 // User CRUD functions
 json_t * get_user_list(struct config_elements * config, const char * pattern, size_t offset, size_t limit, const char * source);
@@ -327,6 +394,15 @@ int glewlwyd_module_callback_set_user(struct config_module * config, const char
 int glewlwyd_module_callback_check_user_password(struct config_module * config, const char * username, const char * password);
 json_t * glewlwyd_module_callback_check_user_session(struct config_module * config, const struct _u_request * request, const char * username);
 int glewlwyd_module_metrics_increment_counter(struct config_module * config, const char * metrics_name, size_t inc, const char * module_type, const char * module_name);
+int glewlwyd_user_route_init(struct config_elements * config);
+void glewlwyd_user_route_close(struct config_elements * config);
+void glewlwyd_user_route_clear(struct config_elements * config);
+char * glewlwyd_user_route_get(struct config_elements * config, const char * username);
+void glewlwyd_user_route_set(struct config_elements * config, const char * username, const char * source);
+int glewlwyd_user_cache_init(struct config_elements * config);
+void glewlwyd_user_cache_close(struct config_elements * config);
+void glewlwyd_user_cache_clear(struct config_elements * config);
+void glewlwyd_user_cache_invalidate(struct config_elements * config, const char * source, const char * username);
 
 // Client CRUD functions
 json_t * get_client_list(struct config_elements * config, const char * pattern, size_t offset, size_t limit, const char * source);
@@ -343,8 +419,11 @@ json_t * is_scope_valid(struct config_elements * config, json_t * j_scope, int a
 int add_scope(struct config_elements * config, json_t * j_scope);
 int set_scope(struct config_elements * config, const char * scope, json_t * j_scope);
 int delete_scope(struct config_elements * config, const char * scope);
+void invalidate_scope_policy(struct config_elements * config);
 
 // API key CRD functions
+int glewlwyd_api_key_cache_init(struct config_elements * config);
+void glewlwyd_api_key_cache_close(struct config_elements * config);
 int verify_api_key(struct config_elements * config, const char * api_key);
 json_t * get_api_key_list(struct config_elements * config, const char * pattern, size_t offset, size_t limit);
 json_t * generate_api_key(struct config_elements * config, const char * username, const char * issued_for, const char * user_agent);
@@ -357,6 +436,93 @@ void free_glwd_metrics(void * data);
 int glewlwyd_metrics_add_metric(struct config_elements * config, const char * name, const char * help);
 int glewlwyd_metrics_increment_counter_va(struct config_elements * config, const char * name, size_t inc, ...);
 int glewlwyd_metrics_increment_counter(struct config_elements * config, const char * name, const char * label, size_t inc);
+struct _glwd_metrics_data * glewlwyd_metrics_get_counter(struct config_elements * config, const char * name, const char * label);
+void glewlwyd_metrics_counter_add(struct _glwd_metrics_data * counter, size_t inc);
+size_t glewlwyd_metrics_counter_value(struct _glwd_metrics_data * counter);
+char * glewlwyd_metrics_build_label(va_list vl);
+char * glewlwyd_metrics_build_label_values(struct config_elements * config, ...);
+int glewlwyd_metrics_add_metric_type(struct config_elements * config, const char * name, const char * help, unsigned short type);
+struct _glwd_metrics_data * glewlwyd_metrics_get_gauge(struct config_elements * config, const char * name, const char * label);
+struct _glwd_metrics_data * glewlwyd_metrics_get_histogram(struct config_elements * config, const char * name, const char * label);
+void glewlwyd_metrics_gauge_add(struct _glwd_metrics_data * gauge, long delta);
+long long glewlwyd_metrics_gauge_value(struct _glwd_metrics_data * gauge);
+void glewlwyd_metrics_histogram_observe(struct _glwd_metrics_data * histogram, size_t value);
+void glewlwyd_metrics_call_start(struct _glwd_metrics_data * in_flight, struct timespec * start);
+void glewlwyd_metrics_call_end(struct _glwd_metrics_data * in_flight, struct _glwd_metrics_data * duration, struct timespec * start);
+char * glewlwyd_metrics_export(struct config_elements * config);
+int glewlwyd_metrics_add_endpoint(struct config_elements * config,
+                                  struct _u_instance * instance,
+                                  const char * http_method,
+                                  const char * url_prefix,
+                                  const char * url_format,
+                                  unsigned int priority,
+                                  int (* callback_function)(const struct _u_request * request, struct _u_response * response, void * user_data),
+                                  void * user_data);
+void glewlwyd_metrics_init_user_module_instance(struct config_elements * config, struct _user_module_instance * instance);
+void glewlwyd_metrics_init_client_module_instance(struct config_elements * config, struct _client_module_instance * instance);
+
+// User module calls
+json_t * user_module_instance_init(struct config_elements * config, struct _user_module_instance * instance, json_t * j_parameters);
+int user_module_instance_close(struct config_elements * config, struct _user_module_instance * instance);
+size_t user_module_instance_count_total(struct config_elements * config, struct _user_module_instance * instance, const char * pattern);
+json_t * user_module_instance_get_list(struct config_elements * config, struct _user_module_instance * instance, const char * pattern, size_t offset, size_t limit);
+json_t * user_module_instance_get(struct config_elements * config, struct _user_module_instance * instance, const char * username);
+json_t * user_module_instance_get_profile(struct config_elements * config, struct _user_module_instance * instance, const char * username);
+json_t * user_module_instance_is_valid(struct config_elements * config, struct _user_module_instance * instance, const char * username, json_t * j_user, int mode);
+int user_module_instance_add(struct config_elements * config, struct _user_module_instance * instance, json_t * j_user);
+int user_module_instance_update(struct config_elements * config, struct _user_module_instance * instance, const char * username, json_t * j_user);
+int user_module_instance_update_profile(struct config_elements * config, struct _user_module_instance * instance, const char * username, json_t * j_user);
+int user_module_instance_delete(struct config_elements * config, struct _user_module_instance * instance, const char * username);
+int user_module_instance_check_password(struct config_elements * config, struct _user_module_instance * instance, const char * username, const char * password);
+int user_module_instance_update_password(struct config_elements * config, struct _user_module_instance * instance, const char * username, const char ** new_passwords, size_t new_passwords_len);
+
+// Client module calls
+json_t * client_module_instance_init(struct config_elements * config, struct _client_module_instance * instance, json_t * j_parameters);
+int client_module_instance_close(struct config_elements * config, struct _client_module_instance * instance);
+size_t client_module_instance_count_total(struct config_elements * config, struct _client_module_instance * instance, const char * pattern);
+json_t * client_module_instance_get_list(struct config_elements * config, struct _client_module_instance * instance, const char * pattern, size_t offset, size_t limit);
+json_t * client_module_instance_get(struct config_elements * config, struct _client_module_instance * instance, const char * client_id);
+json_t * client_module_instance_is_valid(struct config_elements * config, struct _client_module_instance * instance, const char * client_id, json_t * j_client, int mode);
+int client_module_instance_add(struct config_elements * config, struct _client_module_instance * instance, json_t * j_client);
+int client_module_instance_update(struct config_elements * config, struct _client_module_instance * instance, const char * client_id, json_t * j_client);
+int client_module_instance_delete(struct config_elements * config, struct _client_module_instance * instance, const char * client_id);
+int client_module_instance_check_password(struct config_elements * config, struct _client_module_instance * instance, const char * client_id, const char * password);
+
+// Database connection pool functions
+int glewlwyd_db_pool_init(struct config_elements * config);
+void glewlwyd_db_pool_close(struct config_elements * config);
+struct _h_connection * glewlwyd_db_pool_acquire(struct config_elements * config);
+void glewlwyd_db_pool_release(struct config_elements * config, struct _h_connection * conn);
+struct _h_connection * glewlwyd_plugin_callback_db_acquire(struct config_plugin * config);
+void glewlwyd_plugin_callback_db_release(struct config_plugin * config, struct _h_connection * conn);
+struct _h_connection * glewlwyd_module_callback_db_acquire(struct config_module * config);
+void glewlwyd_module_callback_db_release(struct config_module * config, struct _h_connection * conn);
+
+// Mail queue
+int glewlwyd_mail_queue_init(struct config_elements * config);
+void glewlwyd_mail_queue_close(struct config_elements * config);
+int glewlwyd_mail_queue_push(struct config_elements * config, const char * host, int port, int use_tls, int verify_certificate, const char * user, const char * password, const char * from, const char * to, const char * content_type, const char * subject, const char * body);
+int glewlwyd_module_callback_send_email(struct config_module * config, const char * host, int port, int use_tls, int verify_certificate, const char * user, const char * password, const char * from, const char * to, const char * content_type, const char * subject, const char * body);
+int glewlwyd_plugin_callback_send_email(struct config_plugin * config, const char * host, int port, int use_tls, int verify_certificate, const char * user, const char * password, const char * from, const char * to, const char * content_type, const char * subject, const char * body);
+
+// Expired data reaper
+int glewlwyd_reaper_init(struct config_elements * config);
+void glewlwyd_reaper_close(struct config_elements * config);
+int glewlwyd_reaper_start(struct config_elements * config, const char * name, json_t * j_tasks, unsigned int interval, unsigned int batch_size, unsigned int batch_delay);
+int glewlwyd_reaper_stop(struct config_elements * config, const char * name);
+int glewlwyd_plugin_callback_reaper_start(struct config_plugin * config, const char * name, json_t * j_tasks, unsigned int interval, unsigned int batch_size, unsigned int batch_delay);
+int glewlwyd_plugin_callback_reaper_stop(struct config_plugin * config, const char * name);
+
+// Session schemes use counters write-behind
+int glewlwyd_session_usage_init(struct config_elements * config);
+void glewlwyd_session_usage_close(struct config_elements * config);
+int glewlwyd_session_usage_add(struct config_elements * config, const char * session_hash, const char * username, json_int_t guasmi_id);
+json_int_t glewlwyd_session_usage_get_pending(struct config_elements * config, const char * session_hash, const char * username, json_int_t guasmi_id);
+
+// Password check pool
+int glewlwyd_password_pool_init(struct config_elements * config);
+void glewlwyd_password_pool_close(struct config_elements * config);
+int glewlwyd_password_pool_run(struct config_elements * config, unsigned short is_client, int (* check)(struct config_elements * config, void * instance, const char * name, const char * password), void * instance, const char * name, const char * password);
 
 // Callback functions
 int callback_glewlwyd_check_user_session (const struct _u_request * request, struct _u_response * response, void * user_data);
@@ -32,6 +32,7 @@
  * 
  */
 
+#include <pthread.h>
 #include <zlib.h>
 #include <string.h>
 #include <ulfius.h>
@@ -63,15 +64,117 @@ static void u_zfree(void *q, void *p) {
   o_free(p);
 }
 
+/**
+ * zlib streams of the current thread, initialized on first use and reset after each response
+ */
+struct _u_compression_streams {
+  z_stream gzip;
+  int      gzip_level;
+  int      gzip_init;
+  z_stream deflate;
+  int      deflate_level;
+  int      deflate_init;
+};
+
+static pthread_key_t u_compression_streams_key;
+static pthread_once_t u_compression_streams_once = PTHREAD_ONCE_INIT;
+static int u_compression_streams_key_init = 0;
+
+static void u_compression_streams_free(void * data) {
+  struct _u_compression_streams * streams = (struct _u_compression_streams *)data;
+
+  if (streams != NULL) {
+    if (streams->gzip_init) {
+      deflateEnd(&streams->gzip);
+    }
+    if (streams->deflate_init) {
+      deflateEnd(&streams->deflate);
+    }
+    o_free(streams);
+  }
+}
+
+static void u_compression_streams_key_create(void) {
+  if (!pthread_key_create(&u_compression_streams_key, u_compression_streams_free)) {
+    u_compression_streams_key_init = 1;
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "u_compression_streams_key_create - Error pthread_key_create");
+  }
+}
+
+/**
+ * Returns the zlib stream of the current thread for the compress mode and the level
+ * The stream is created if necessary, or its level is changed if the configuration has changed
+ */
+static z_stream * u_get_compression_stream(int compress_mode, int level) {
+  struct _u_compression_streams * streams = NULL;
+  z_stream * defstream = NULL;
+  int * stream_init, * stream_level;
+
+  pthread_once(&u_compression_streams_once, u_compression_streams_key_create);
+  if (u_compression_streams_key_init) {
+    if ((streams = pthread_getspecific(u_compression_streams_key)) == NULL) {
+      if ((streams = o_malloc(sizeof(struct _u_compression_streams))) != NULL) {
+        memset(streams, 0, sizeof(struct _u_compression_streams));
+        if (pthread_setspecific(u_compression_streams_key, streams)) {
+          y_log_message(Y_LOG_LEVEL_ERROR, "u_get_compression_stream - Error pthread_setspecific");
+          o_free(streams);
+          streams = NULL;
+        }
+      } else {
+        y_log_message(Y_LOG_LEVEL_ERROR, "u_get_compression_stream - Error allocating resources for streams");
+      }
+    }
+  }
+  if (streams != NULL) {
+    if (compress_mode == U_COMPRESS_GZIP) {
+      defstream = &streams->gzip;
+      stream_init = &streams->gzip_init;
+      stream_level = &streams->gzip_level;
+    } else {
+      defstream = &streams->deflate;
+      stream_init = &streams->deflate_init;
+      stream_level = &streams->deflate_level;
+    }
+    if (!*stream_init) {
+      defstream->zalloc = u_zalloc;
+      defstream->zfree = u_zfree;
+      defstream->opaque = Z_NULL;
+      if (compress_mode == U_COMPRESS_GZIP) {
+        *stream_init = (deflateInit2(defstream, level, Z_DEFLATED, U_GZIP_WINDOW_BITS | U_GZIP_ENCODING, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+      } else {
+        *stream_init = (deflateInit(defstream, level) == Z_OK);
+      }
+      if (*stream_init) {
+        *stream_level = level;
+      } else {
+        y_log_message(Y_LOG_LEVEL_ERROR, "u_get_compression_stream - Error deflateInit (%s)", compress_mode==U_COMPRESS_GZIP?U_ACCEPT_GZIP:U_ACCEPT_DEFLATE);
+        defstream = NULL;
+      }
+    } else if (*stream_level != level) {
+      if (deflateParams(defstream, level, Z_DEFAULT_STRATEGY) == Z_OK) {
+        *stream_level = level;
+      } else {
+        y_log_message(Y_LOG_LEVEL_ERROR, "u_get_compression_stream - Error deflateParams");
+        defstream = NULL;
+      }
+    }
+  }
+  return defstream;
+}
+
 int callback_http_compression (const struct _u_request * request, struct _u_response * response, void * user_data) {
   struct _http_compression_config * config = (struct _http_compression_config *)user_data;
   char ** accept_list = NULL;
   int ret = U_CALLBACK_IGNORE, compress_mode = U_COMPRESS_NONE, res;
-  z_stream defstream;
+  z_stream * defstream;
   char * data_zip = NULL;
-  size_t data_zip_len = 0;
+  uLong data_zip_len;
 
-  if (response->binary_body_length && u_map_has_key_case(request->map_header, U_ACCEPT_HEADER)) {
+  if (response->binary_body_length &&
+      (config == NULL || response->binary_body_length >= config->min_size) &&
+      !u_map_has_key_case(response->map_header, U_CONTENT_HEADER) &&
+      u_map_has_key_case(request->map_header, U_ACCEPT_HEADER)) {
     if (split_string(u_map_get_case(request->map_header, U_ACCEPT_HEADER), ",", &accept_list)) {
       if ((config == NULL || config->allow_gzip) && string_array_has_trimmed_value((const char **)accept_list, U_ACCEPT_GZIP)) {
         compress_mode = U_COMPRESS_GZIP;
@@ -80,56 +183,32 @@ int callback_http_compression (const struct _u_request * request, struct _u_resp
       }
 
       if (compress_mode != U_COMPRESS_NONE) {
-        defstream.zalloc = u_zalloc;
-        defstream.zfree = u_zfree;
-        defstream.opaque = Z_NULL;
-        defstream.avail_in = (uInt)response->binary_body_length;
-        defstream.next_in = (Bytef *)response->binary_body;
-
-        if (compress_mode == U_COMPRESS_GZIP) {
-          if (deflateInit2(&defstream, 
-                           Z_BEST_COMPRESSION, 
-                           Z_DEFLATED,
-                           U_GZIP_WINDOW_BITS | U_GZIP_ENCODING,
-                           8,
-                           Z_DEFAULT_STRATEGY) != Z_OK) {
-            y_log_message(Y_LOG_LEVEL_ERROR, "callback_http_compression - Error deflateInit (gzip)");
-            ret = U_CALLBACK_ERROR;
-          }
-        } else {
-          if (deflateInit(&defstream, Z_BEST_COMPRESSION) != Z_OK) {
-            y_log_message(Y_LOG_LEVEL_ERROR, "callback_http_compression - Error deflateInit (deflate)");
-            ret = U_CALLBACK_ERROR;
-          }
-        }
-        if (ret == U_CALLBACK_IGNORE) {
-          do {
-            if ((data_zip = o_realloc(data_zip, data_zip_len+_U_C_BLOCK_SIZE)) != NULL) {
-              defstream.avail_out = _U_C_BLOCK_SIZE;
-              defstream.next_out = ((Bytef *)data_zip)+data_zip_len;
-              switch ((res = deflate(&defstream, Z_FINISH))) {
-                case Z_OK:
-                case Z_STREAM_END:
-                case Z_BUF_ERROR:
-                  break;
-                default:
-                  y_log_message(Y_LOG_LEVEL_ERROR, "callback_http_compression - Error deflate %d", res);
-                  ret = U_CALLBACK_ERROR;
-                  break;
+        if ((defstream = u_get_compression_stream(compress_mode, config!=NULL?config->level:Z_DEFAULT_COMPRESSION)) != NULL) {
+          data_zip_len = deflateBound(defstream, (uLong)response->binary_body_length);
+          if ((data_zip = o_malloc(data_zip_len)) != NULL) {
+            defstream->avail_in = (uInt)response->binary_body_length;
+            defstream->next_in = (Bytef *)response->binary_body;
+            defstream->avail_out = (uInt)data_zip_len;
+            defstream->next_out = (Bytef *)data_zip;
+            if ((res = deflate(defstream, Z_FINISH)) == Z_STREAM_END) {
+              // Keep the body uncompressed if the compression doesn't reduce its size
+              if (defstream->total_out < response->binary_body_length) {
+                ulfius_set_binary_body_response(response, response->status, (const char *)data_zip, defstream->total_out);
+                u_map_put(response->map_header, U_CONTENT_HEADER, compress_mode==U_COMPRESS_GZIP?U_ACCEPT_GZIP:U_ACCEPT_DEFLATE);
               }
-              data_zip_len += _U_C_BLOCK_SIZE - defstream.avail_out;
             } else {
-              y_log_message(Y_LOG_LEVEL_ERROR, "callback_http_compression - Error allocating resources for data_zip");
+              y_log_message(Y_LOG_LEVEL_ERROR, "callback_http_compression - Error deflate %d", res);
               ret = U_CALLBACK_ERROR;
             }
-          } while (U_CALLBACK_IGNORE == ret && defstream.avail_out == 0);
-
-          if (ret == U_CALLBACK_IGNORE) {
-            ulfius_set_binary_body_response(response, response->status, (const char *)data_zip, defstream.total_out);
-            u_map_put(response->map_header, U_CONTENT_HEADER, compress_mode==U_COMPRESS_GZIP?U_ACCEPT_GZIP:U_ACCEPT_DEFLATE);
+            o_free(data_zip);
+          } else {
+            y_log_message(Y_LOG_LEVEL_ERROR, "callback_http_compression - Error allocating resources for data_zip");
+            ret = U_CALLBACK_ERROR;
           }
-          deflateEnd(&defstream);
-          o_free(data_zip);
+          deflateReset(defstream);
+        } else {
+          y_log_message(Y_LOG_LEVEL_ERROR, "callback_http_compression - Error u_get_compression_stream");
+          ret = U_CALLBACK_ERROR;
         }
       }
     }
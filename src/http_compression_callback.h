@@ -39,17 +39,22 @@
 
 /**
  * If both values are set to true, the first compression algorithm used will be gzip
+ * Responses smaller than min_size bytes aren't compressed, 0 to compress all responses
+ * level is the zlib compression level, from 1 (fastest) to 9 (best), or -1 for zlib default
  */
 struct _http_compression_config {
-  int allow_gzip;
-  int allow_deflate;
+  int    allow_gzip;
+  int    allow_deflate;
+  size_t min_size;
+  int    level;
 };
 
 /**
  * Compress response->binary_body using gzip or deflate algorithm
  * depending on the request header Accept-Encoding and the
  * struct _http_compression_config configuration value
- * If user_data is NULL, it will considered as allow_gzip and allow_deflate to true
+ * If user_data is NULL, it will considered as allow_gzip and allow_deflate to true, min_size to 0 and level to zlib default
+ * The zlib streams are reused by the next responses of the same thread
  * After compressing response body, will set response header Content-Encoding accordingly
  */
 int callback_http_compression (const struct _u_request * request, struct _u_response * response, void * user_data);
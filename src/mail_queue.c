@@ -0,0 +1,305 @@
+/**
+ *
+ * Glewlwyd SSO Server
+ *
+ * Authentiation server
+ * Users are authenticated via various backend available: database, ldap
+ * Using various authentication methods available: password, OTP, send code, etc.
+ *
+ * Mail queue functions definitions
+ *
+ * Copyright 2016-2021 Nicolas Mora <mail@babelouest.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU GENERAL PUBLIC LICENSE
+ * License as published by the Free Software Foundation;
+ * version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU GENERAL PUBLIC LICENSE for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <time.h>
+
+#include "glewlwyd.h"
+
+static void free_glwd_mail_message(struct _glwd_mail_message * message) {
+  o_free(message->host);
+  o_free(message->user);
+  o_free(message->password);
+  o_free(message->from);
+  o_free(message->to);
+  o_free(message->content_type);
+  o_free(message->subject);
+  o_free(message->body);
+  o_free(message);
+}
+
+static int glewlwyd_mail_send(struct _glwd_mail_message * message) {
+  return ulfius_send_smtp_rich_email(message->host, message->port, message->use_tls, message->verify_certificate, message->user, message->password, message->from, message->to, NULL, NULL, message->content_type, message->subject, message->body);
+}
+
+/**
+ * Removes and returns the first message ready to be sent, the queue must be locked
+ * If no message is ready, next_attempt is set to the earliest retry date, 0 if the queue is empty
+ */
+static struct _glwd_mail_message * glewlwyd_mail_queue_pop(struct _glwd_mail_queue * mail_queue, time_t now, time_t * next_attempt) {
+  struct _glwd_mail_message ** p_message, * message = NULL, * previous = NULL;
+
+  *next_attempt = 0;
+  for (p_message = &mail_queue->first; *p_message != NULL; previous = *p_message, p_message = &(*p_message)->next) {
+    if ((*p_message)->next_attempt <= now || mail_queue->stop) {
+      message = *p_message;
+      *p_message = message->next;
+      if (mail_queue->last == message) {
+        mail_queue->last = previous;
+      }
+      message->next = NULL;
+      mail_queue->size--;
+      break;
+    } else if (!(*next_attempt) || (*p_message)->next_attempt < *next_attempt) {
+      *next_attempt = (*p_message)->next_attempt;
+    }
+  }
+  return message;
+}
+
+/**
+ * Adds a message at the end of the queue, the queue must be locked
+ */
+static void glewlwyd_mail_queue_append(struct _glwd_mail_queue * mail_queue, struct _glwd_mail_message * message) {
+  message->next = NULL;
+  if (mail_queue->last != NULL) {
+    mail_queue->last->next = message;
+  } else {
+    mail_queue->first = message;
+  }
+  mail_queue->last = message;
+  mail_queue->size++;
+}
+
+/**
+ * Worker thread, sends the messages of the queue until the queue is stopped
+ * A message that can't be sent is sent again after retry_delay seconds,
+ * the delay is doubled on each attempt, up to max_attempts attempts
+ * When the queue is stopped, the remaining messages are sent once until the close deadline,
+ * then the worker ends and the messages left are dropped by glewlwyd_mail_queue_close
+ */
+static void * glewlwyd_mail_queue_worker(void * args) {
+  struct config_elements * config = (struct config_elements *)args;
+  struct _glwd_mail_queue * mail_queue = &config->mail_queue;
+  struct _glwd_mail_message * message;
+  struct timespec abstime;
+  time_t now, next_attempt;
+  int end = 0;
+
+  while (!end) {
+    message = NULL;
+    if (!pthread_mutex_lock(&mail_queue->lock)) {
+      while (message == NULL && !end) {
+        time(&now);
+        if (mail_queue->stop && now >= mail_queue->close_deadline) {
+          end = 1;
+        } else if ((message = glewlwyd_mail_queue_pop(mail_queue, now, &next_attempt)) == NULL) {
+          if (mail_queue->stop) {
+            end = 1;
+          } else if (next_attempt) {
+            abstime.tv_sec = next_attempt;
+            abstime.tv_nsec = 0;
+            pthread_cond_timedwait(&mail_queue->cond, &mail_queue->lock, &abstime);
+          } else {
+            pthread_cond_wait(&mail_queue->cond, &mail_queue->lock);
+          }
+        }
+      }
+      pthread_mutex_unlock(&mail_queue->lock);
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_mail_queue_worker - Error lock");
+      end = 1;
+    }
+    if (message != NULL) {
+      glewlwyd_metrics_gauge_add(mail_queue->metrics_depth, -1);
+      message->attempts++;
+      if (glewlwyd_mail_send(message) == U_OK) {
+        glewlwyd_metrics_counter_add(mail_queue->metrics_sent, 1);
+        free_glwd_mail_message(message);
+      } else {
+        if (message->attempts < mail_queue->max_attempts && !pthread_mutex_lock(&mail_queue->lock)) {
+          if (!mail_queue->stop) {
+            y_log_message(Y_LOG_LEVEL_WARNING, "glewlwyd_mail_queue_worker - Error sending e-mail to %s, attempt %u/%u", message->to, message->attempts, mail_queue->max_attempts);
+            message->next_attempt = time(NULL) + ((time_t)mail_queue->retry_delay << (message->attempts-1));
+            glewlwyd_mail_queue_append(mail_queue, message);
+            glewlwyd_metrics_counter_add(mail_queue->metrics_retry, 1);
+            glewlwyd_metrics_gauge_add(mail_queue->metrics_depth, 1);
+            message = NULL;
+          }
+          pthread_mutex_unlock(&mail_queue->lock);
+        }
+        if (message != NULL) {
+          y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_mail_queue_worker - Error sending e-mail to %s after %u attempts, e-mail dropped", message->to, message->attempts);
+          glewlwyd_metrics_counter_add(mail_queue->metrics_failed, 1);
+          free_glwd_mail_message(message);
+        }
+      }
+    }
+  }
+  return NULL;
+}
+
+int glewlwyd_mail_queue_init(struct config_elements * config) {
+  struct _glwd_mail_queue * mail_queue = &config->mail_queue;
+  int ret = G_OK;
+
+  glewlwyd_metrics_add_metric_type(config, GLWD_METRICS_MAIL_QUEUE_DEPTH, "Number of e-mails waiting in the mail queue", GLWD_METRICS_TYPE_GAUGE);
+  glewlwyd_metrics_add_metric(config, GLWD_METRICS_MAIL_SENT, "Total number of e-mails sent");
+  glewlwyd_metrics_add_metric(config, GLWD_METRICS_MAIL_RETRY, "Total number of e-mails that failed to be sent and will be sent again");
+  glewlwyd_metrics_add_metric(config, GLWD_METRICS_MAIL_FAILED, "Total number of e-mails dropped after failing to be sent");
+  mail_queue->metrics_depth = glewlwyd_metrics_get_gauge(config, GLWD_METRICS_MAIL_QUEUE_DEPTH, NULL);
+  mail_queue->metrics_sent = glewlwyd_metrics_get_counter(config, GLWD_METRICS_MAIL_SENT, NULL);
+  mail_queue->metrics_retry = glewlwyd_metrics_get_counter(config, GLWD_METRICS_MAIL_RETRY, NULL);
+  mail_queue->metrics_failed = glewlwyd_metrics_get_counter(config, GLWD_METRICS_MAIL_FAILED, NULL);
+
+  if (mail_queue->nb_workers) {
+    mail_queue->first = NULL;
+    mail_queue->last = NULL;
+    mail_queue->size = 0;
+    mail_queue->stop = 0;
+    mail_queue->nb_workers_started = 0;
+    if (!mail_queue->max_attempts) {
+      mail_queue->max_attempts = 1;
+    }
+    if (pthread_mutex_init(&mail_queue->lock, NULL)) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_mail_queue_init - Error initializing queue lock");
+      ret = G_ERROR;
+    } else if (pthread_cond_init(&mail_queue->cond, NULL)) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_mail_queue_init - Error initializing queue cond");
+      pthread_mutex_destroy(&mail_queue->lock);
+      ret = G_ERROR;
+    } else if ((mail_queue->workers = o_malloc(mail_queue->nb_workers*sizeof(pthread_t))) == NULL) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_mail_queue_init - Error allocating resources for workers");
+      pthread_cond_destroy(&mail_queue->cond);
+      pthread_mutex_destroy(&mail_queue->lock);
+      ret = G_ERROR_MEMORY;
+    } else {
+      // The workers already started are stopped by glewlwyd_mail_queue_close if one fails to start
+      mail_queue->initialized = 1;
+      for (; mail_queue->nb_workers_started<mail_queue->nb_workers; mail_queue->nb_workers_started++) {
+        if (pthread_create(&mail_queue->workers[mail_queue->nb_workers_started], NULL, glewlwyd_mail_queue_worker, (void *)config)) {
+          y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_mail_queue_init - Error pthread_create");
+          ret = G_ERROR;
+          break;
+        }
+      }
+      if (ret == G_OK) {
+        y_log_message(Y_LOG_LEVEL_INFO, "Mail queue initialized with %zu workers", mail_queue->nb_workers);
+      }
+    }
+  }
+  return ret;
+}
+
+/**
+ * Stops the mail queue, the messages waiting in the queue are sent before the workers end,
+ * until close_timeout seconds are spent, then the messages left are dropped
+ * A message being sent when the deadline is reached is sent until the end
+ */
+void glewlwyd_mail_queue_close(struct config_elements * config) {
+  struct _glwd_mail_queue * mail_queue = &config->mail_queue;
+  struct _glwd_mail_message * message;
+  size_t i;
+
+  if (mail_queue->initialized) {
+    if (!pthread_mutex_lock(&mail_queue->lock)) {
+      mail_queue->stop = 1;
+      mail_queue->close_deadline = time(NULL) + mail_queue->close_timeout;
+      pthread_cond_broadcast(&mail_queue->cond);
+      pthread_mutex_unlock(&mail_queue->lock);
+    }
+    for (i=0; i<mail_queue->nb_workers_started; i++) {
+      pthread_join(mail_queue->workers[i], NULL);
+    }
+    while ((message = mail_queue->first) != NULL) {
+      mail_queue->first = message->next;
+      y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_mail_queue_close - Mail queue closed, e-mail to %s dropped", message->to);
+      glewlwyd_metrics_gauge_add(mail_queue->metrics_depth, -1);
+      glewlwyd_metrics_counter_add(mail_queue->metrics_failed, 1);
+      free_glwd_mail_message(message);
+    }
+    mail_queue->size = 0;
+    mail_queue->last = NULL;
+    pthread_cond_destroy(&mail_queue->cond);
+    pthread_mutex_destroy(&mail_queue->lock);
+    o_free(mail_queue->workers);
+    mail_queue->workers = NULL;
+    mail_queue->initialized = 0;
+  }
+}
+
+/**
+ * Adds an e-mail to the mail queue, the e-mail is sent by a worker thread
+ * If the mail queue is disabled or full, the e-mail is sent in the current thread
+ */
+int glewlwyd_mail_queue_push(struct config_elements * config, const char * host, int port, int use_tls, int verify_certificate, const char * user, const char * password, const char * from, const char * to, const char * content_type, const char * subject, const char * body) {
+  struct _glwd_mail_queue * mail_queue = &config->mail_queue;
+  struct _glwd_mail_message * message;
+  int ret, queued = 0;
+
+  if ((message = o_malloc(sizeof(struct _glwd_mail_message))) != NULL) {
+    message->host = o_strdup(host);
+    message->port = port;
+    message->use_tls = use_tls;
+    message->verify_certificate = verify_certificate;
+    message->user = o_strdup(user);
+    message->password = o_strdup(password);
+    message->from = o_strdup(from);
+    message->to = o_strdup(to);
+    message->content_type = o_strdup(content_type);
+    message->subject = o_strdup(subject);
+    message->body = o_strdup(body);
+    message->attempts = 0;
+    message->next_attempt = 0;
+    message->next = NULL;
+    if (mail_queue->initialized && !pthread_mutex_lock(&mail_queue->lock)) {
+      if (!mail_queue->stop && (!mail_queue->max_size || mail_queue->size < mail_queue->max_size)) {
+        glewlwyd_mail_queue_append(mail_queue, message);
+        glewlwyd_metrics_gauge_add(mail_queue->metrics_depth, 1);
+        pthread_cond_signal(&mail_queue->cond);
+        queued = 1;
+      } else if (!mail_queue->stop) {
+        y_log_message(Y_LOG_LEVEL_WARNING, "glewlwyd_mail_queue_push - Mail queue full, sending e-mail in the current thread");
+      }
+      pthread_mutex_unlock(&mail_queue->lock);
+    }
+    if (queued) {
+      ret = G_OK;
+    } else {
+      if (glewlwyd_mail_send(message) == U_OK) {
+        glewlwyd_metrics_counter_add(mail_queue->metrics_sent, 1);
+        ret = G_OK;
+      } else {
+        y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_mail_queue_push - Error ulfius_send_smtp_rich_email");
+        glewlwyd_metrics_counter_add(mail_queue->metrics_failed, 1);
+        ret = G_ERROR;
+      }
+      free_glwd_mail_message(message);
+    }
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_mail_queue_push - Error allocating resources for message");
+    ret = G_ERROR_MEMORY;
+  }
+  return ret;
+}
+
+int glewlwyd_module_callback_send_email(struct config_module * config, const char * host, int port, int use_tls, int verify_certificate, const char * user, const char * password, const char * from, const char * to, const char * content_type, const char * subject, const char * body) {
+  return glewlwyd_mail_queue_push(config->glewlwyd_config, host, port, use_tls, verify_certificate, user, password, from, to, content_type, subject, body);
+}
+
+int glewlwyd_plugin_callback_send_email(struct config_plugin * config, const char * host, int port, int use_tls, int verify_certificate, const char * user, const char * password, const char * from, const char * to, const char * content_type, const char * subject, const char * body) {
+  return glewlwyd_mail_queue_push(config->glewlwyd_config, host, port, use_tls, verify_certificate, user, password, from, to, content_type, subject, body);
+}
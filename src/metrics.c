@@ -25,91 +25,275 @@
  *
  */
 
-#include <sched.h>
+#include <ctype.h>
 
 #include "glewlwyd.h"
 
-struct _glwd_increment_counter_data {
-  struct config_elements * config;
-  char                   * name;
-  char                   * label;
-  size_t                   inc;
-};
+static unsigned int glwd_metrics_next_shard = 0;
+static __thread int glwd_metrics_shard_index = -1;
 
-void * glewlwyd_metrics_increment_counter_thread(void * args) {
-  struct _glwd_increment_counter_data * data = (struct _glwd_increment_counter_data *)args;
+/**
+ * Returns the shard index of the current thread
+ * Each thread gets a shard index on its first increment, in a round-robin way
+ */
+static inline size_t glewlwyd_metrics_get_shard_index(void) {
+  if (glwd_metrics_shard_index < 0) {
+    glwd_metrics_shard_index = (int)(__atomic_fetch_add(&glwd_metrics_next_shard, 1, __ATOMIC_RELAXED) % GLWD_METRICS_SHARDS);
+  }
+  return (size_t)glwd_metrics_shard_index;
+}
+
+/**
+ * FNV-1a hash of the metric name and the label, label is case insensitive
+ */
+static unsigned int glewlwyd_metrics_hash(const char * name, const char * label) {
+  unsigned int hash = 2166136261U;
+  const char * c;
+
+  for (c = name; c != NULL && *c; c++) {
+    hash = (hash ^ (unsigned char)*c) * 16777619U;
+  }
+  hash = (hash ^ 0xff) * 16777619U;
+  for (c = label; c != NULL && *c; c++) {
+    hash = (hash ^ (unsigned char)tolower((unsigned char)*c)) * 16777619U;
+  }
+  return hash;
+}
+
+/**
+ * Lock-free lookup of a counter in the hash table
+ * Elements are never removed from the hash table until the metrics are closed
+ */
+static struct _glwd_metrics_data * glewlwyd_metrics_lookup(struct config_elements * config, const char * name, const char * label, unsigned int hash) {
+  struct _glwd_metrics_data * data;
+
+  for (data = __atomic_load_n(&config->metrics_hash[hash%GLWD_METRICS_HASH_SIZE], __ATOMIC_ACQUIRE); data != NULL; data = data->next) {
+    if (data->hash == hash && 0 == o_strcmp(name, data->metric->name) && ((label == NULL && data->label == NULL) || 0 == o_strcasecmp(label, data->label))) {
+      break;
+    }
+  }
+  return data;
+}
+
+static struct _glwd_metric * glewlwyd_metrics_get_metric(struct config_elements * config, const char * name) {
+  struct _glwd_metric * metric = NULL;
+  size_t i;
+
+  for (i=0; i<pointer_list_size(&config->metrics_list); i++) {
+    if (0 == o_strcmp(name, ((struct _glwd_metric *)pointer_list_get_at(&config->metrics_list, i))->name)) {
+      metric = (struct _glwd_metric *)pointer_list_get_at(&config->metrics_list, i);
+      break;
+    }
+  }
+  return metric;
+}
+
+/**
+ * Returns a metrics handle for the metric name and the label
+ * The label value is created if it doesn't exist
+ * Returns NULL if the metrics are disabled or if the metric name isn't registered
+ */
+static struct _glwd_metrics_data * glewlwyd_metrics_get_data(struct config_elements * config, const char * name, const char * label) {
+  struct _glwd_metrics_data * data = NULL, ** new_data;
   struct _glwd_metric * metric;
-  size_t i, j;
-  int found;
-  
-  if (!pthread_mutex_lock(&data->config->metrics_lock)) {
-    for (i=0; i<pointer_list_size(&data->config->metrics_list); i++) {
-      metric = (struct _glwd_metric *)pointer_list_get_at(&data->config->metrics_list, i);
-      if (0 == o_strcmp(data->name, metric->name)) {
-        found = 0;
-        for (j=0; j<metric->data_size; j++) {
-          if ((data->label == NULL && metric->data[j].label == NULL) || 0 == o_strcasecmp(data->label, metric->data[j].label)) {
-            metric->data[j].counter += data->inc;
-            found = 1;
-          }
-        }
-        if (!found) {
-          if ((metric->data = o_realloc(metric->data, (metric->data_size+1)*sizeof(struct _glwd_metrics_data))) != NULL) {
-            metric->data[metric->data_size].label = o_strdup(data->label);
-            metric->data[metric->data_size].counter = data->inc;
-            metric->data_size++;
+  unsigned int hash;
+
+  if (config != NULL && config->metrics_endpoint && o_strlen(name)) {
+    hash = glewlwyd_metrics_hash(name, label);
+    if ((data = glewlwyd_metrics_lookup(config, name, label, hash)) == NULL) {
+      if (!pthread_mutex_lock(&config->metrics_lock)) {
+        if ((data = glewlwyd_metrics_lookup(config, name, label, hash)) == NULL) {
+          if ((metric = glewlwyd_metrics_get_metric(config, name)) != NULL) {
+            if ((new_data = o_realloc(metric->data, (metric->data_size+1)*sizeof(struct _glwd_metrics_data *))) != NULL) {
+              metric->data = new_data;
+              if ((data = o_malloc(sizeof(struct _glwd_metrics_data))) != NULL) {
+                memset(data, 0, sizeof(struct _glwd_metrics_data));
+                if (metric->type == GLWD_METRICS_TYPE_HISTOGRAM) {
+                  if ((data->histogram = o_malloc(GLWD_METRICS_SHARDS*sizeof(struct _glwd_metrics_histogram_shard))) != NULL) {
+                    memset(data->histogram, 0, GLWD_METRICS_SHARDS*sizeof(struct _glwd_metrics_histogram_shard));
+                  } else {
+                    y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_metrics_get_data - Error allocating resources for histogram");
+                  }
+                }
+                data->label = o_strdup(label);
+                data->hash = hash;
+                data->metric = metric;
+                data->next = config->metrics_hash[hash%GLWD_METRICS_HASH_SIZE];
+                metric->data[metric->data_size] = data;
+                metric->data_size++;
+                __atomic_store_n(&config->metrics_hash[hash%GLWD_METRICS_HASH_SIZE], data, __ATOMIC_RELEASE);
+              } else {
+                y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_metrics_get_data - Error allocating resources for data");
+              }
+            } else {
+              y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_metrics_get_data - Error realloc metric->data");
+            }
           } else {
-            y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_metrics_increment_counter_thread - Error realloc metric->data");
+            y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_metrics_get_data - Error metric %s not found", name);
           }
         }
+        pthread_mutex_unlock(&config->metrics_lock);
+      } else {
+        y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_metrics_get_data - Error lock");
       }
     }
-    pthread_mutex_unlock(&data->config->metrics_lock);
-  } else {
-    y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_metrics_increment_counter_thread - Error lock");
   }
-  o_free(data->name);
-  o_free(data->label);
-  o_free(data);
-  pthread_exit(NULL);
+  return data;
+}
+
+struct _glwd_metrics_data * glewlwyd_metrics_get_counter(struct config_elements * config, const char * name, const char * label) {
+  return glewlwyd_metrics_get_data(config, name, label);
+}
+
+struct _glwd_metrics_data * glewlwyd_metrics_get_gauge(struct config_elements * config, const char * name, const char * label) {
+  return glewlwyd_metrics_get_data(config, name, label);
+}
+
+struct _glwd_metrics_data * glewlwyd_metrics_get_histogram(struct config_elements * config, const char * name, const char * label) {
+  return glewlwyd_metrics_get_data(config, name, label);
 }
 
 /**
- * Runs a single thread with a low priority to increment a metrics value
+ * Increments a counter handle, lock-free
  */
-int glewlwyd_metrics_increment_counter(struct config_elements * config, const char * name, const char * label, size_t inc) {
-  struct _glwd_increment_counter_data * data;
-  pthread_t thread_metrics;
-  int thread_ret, thread_detach;
-  pthread_attr_t attr;
-  struct sched_param param;
-  int ret;
+void glewlwyd_metrics_counter_add(struct _glwd_metrics_data * counter, size_t inc) {
+  if (counter != NULL && inc) {
+    __atomic_fetch_add(&counter->shards[glewlwyd_metrics_get_shard_index()].value, inc, __ATOMIC_RELAXED);
+  }
+}
 
-  if (config->metrics_endpoint) {
-    if (config != NULL && o_strlen(name)) {
-      if ((data = o_malloc(sizeof(struct _glwd_increment_counter_data))) != NULL) {
-        data->config = config;
-        data->name = o_strdup(name);
-        data->label = o_strdup(label);
-        data->inc = inc;
-        pthread_attr_init (&attr);
-        pthread_attr_getschedparam (&attr, &param);
-        param.sched_priority = 0;
-        pthread_attr_setschedparam (&attr, &param);
-        thread_ret = pthread_create(&thread_metrics, &attr, glewlwyd_metrics_increment_counter_thread, (void *)data);
-        thread_detach = pthread_detach(thread_metrics);
-        if (thread_ret || thread_detach) {
-          y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_metrics_increment_counter - Error thread");
-          ret = G_ERROR_MEMORY;
-          o_free(data->name);
-          o_free(data->label);
-          o_free(data);
+/**
+ * Adds a positive or negative value to a gauge handle, lock-free
+ * The shards values are unsigned, the sum is converted back to a signed value
+ */
+void glewlwyd_metrics_gauge_add(struct _glwd_metrics_data * gauge, long delta) {
+  if (gauge != NULL && delta) {
+    __atomic_fetch_add(&gauge->shards[glewlwyd_metrics_get_shard_index()].value, (size_t)delta, __ATOMIC_RELAXED);
+  }
+}
+
+/**
+ * Adds an observation in microseconds to a histogram handle, lock-free
+ */
+void glewlwyd_metrics_histogram_observe(struct _glwd_metrics_data * histogram, size_t value) {
+  static const size_t bounds[GLWD_METRICS_HISTOGRAM_BUCKETS-1] = GLWD_METRICS_HISTOGRAM_BOUNDS;
+  struct _glwd_metrics_histogram_shard * shard;
+  size_t i;
+
+  if (histogram != NULL && histogram->histogram != NULL) {
+    shard = &histogram->histogram[glewlwyd_metrics_get_shard_index()];
+    for (i=0; i<GLWD_METRICS_HISTOGRAM_BUCKETS-1 && value > bounds[i]; i++);
+    __atomic_fetch_add(&shard->buckets[i], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&shard->sum, value, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&shard->count, 1, __ATOMIC_RELAXED);
+  }
+}
+
+/**
+ * Starts measuring a call: increments the in-flight gauge and stores the start time
+ * Does nothing if the metrics are disabled
+ */
+void glewlwyd_metrics_call_start(struct _glwd_metrics_data * in_flight, struct timespec * start) {
+  if (in_flight != NULL) {
+    glewlwyd_metrics_gauge_add(in_flight, 1);
+    clock_gettime(CLOCK_MONOTONIC, start);
+  }
+}
+
+/**
+ * Ends measuring a call: decrements the in-flight gauge and adds the call duration to the histogram
+ */
+void glewlwyd_metrics_call_end(struct _glwd_metrics_data * in_flight, struct _glwd_metrics_data * duration, struct timespec * start) {
+  struct timespec end;
+
+  if (in_flight != NULL) {
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    glewlwyd_metrics_gauge_add(in_flight, -1);
+    glewlwyd_metrics_histogram_observe(duration, (size_t)((end.tv_sec - start->tv_sec)*1000000 + (end.tv_nsec - start->tv_nsec)/1000));
+  }
+}
+
+/**
+ * Returns the aggregated value of a counter
+ */
+size_t glewlwyd_metrics_counter_value(struct _glwd_metrics_data * counter) {
+  size_t value = 0, i;
+
+  if (counter != NULL) {
+    for (i=0; i<GLWD_METRICS_SHARDS; i++) {
+      value += __atomic_load_n(&counter->shards[i].value, __ATOMIC_RELAXED);
+    }
+  }
+  return value;
+}
+
+/**
+ * Returns the aggregated value of a gauge
+ */
+long long glewlwyd_metrics_gauge_value(struct _glwd_metrics_data * gauge) {
+  return (long long)glewlwyd_metrics_counter_value(gauge);
+}
+
+/**
+ * Builds a label string with the list of key/value pairs
+ * Values are quoted and escaped as expected by prometheus
+ */
+char * glewlwyd_metrics_build_label(va_list vl) {
+  const char * label_arg, * c;
+  char * label = NULL;
+  int flag = 0;
+
+  for (label_arg = va_arg(vl, const char *); label_arg != NULL; label_arg = va_arg(vl, const char *)) {
+    if (!flag) {
+      if (label == NULL) {
+        label = msprintf("%s=\"", label_arg);
+      } else {
+        label = mstrcatf(label, ", %s=\"", label_arg);
+      }
+    } else {
+      for (c = label_arg; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+          label = mstrcatf(label, "\\%c", *c);
+        } else if (*c == '\n') {
+          label = mstrcatf(label, "\\n");
         } else {
-          ret = G_OK;
+          label = mstrcatf(label, "%c", *c);
         }
+      }
+      label = mstrcatf(label, "\"");
+    }
+    flag = !flag;
+  }
+  return label;
+}
+
+/**
+ * Builds a label string with the list of key/value pairs
+ */
+char * glewlwyd_metrics_build_label_values(struct config_elements * config, ...) {
+  va_list vl;
+  char * label;
+
+  va_start(vl, config);
+  label = glewlwyd_metrics_build_label(vl);
+  va_end(vl);
+  return label;
+}
+
+/**
+ * Increments a metrics value
+ * Kept for compatibility, prefer glewlwyd_metrics_get_counter and glewlwyd_metrics_counter_add
+ */
+int glewlwyd_metrics_increment_counter(struct config_elements * config, const char * name, const char * label, size_t inc) {
+  struct _glwd_metrics_data * counter;
+  int ret = G_OK;
+
+  if (config != NULL && config->metrics_endpoint) {
+    if (o_strlen(name)) {
+      if ((counter = glewlwyd_metrics_get_counter(config, name, label)) != NULL) {
+        glewlwyd_metrics_counter_add(counter, inc);
       } else {
-        y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_metrics_increment_counter - Error allocating resources for struct _glwd_increment_counter_data");
-        ret = G_ERROR_MEMORY;
+        ret = G_ERROR;
       }
     } else {
       y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_metrics_increment_counter - Error input values");
@@ -121,27 +305,15 @@ int glewlwyd_metrics_increment_counter(struct config_elements * config, const ch
 
 int glewlwyd_metrics_increment_counter_va(struct config_elements * config, const char * name, size_t inc, ...) {
   va_list vl;
-  const char * label_arg;
   char * label = NULL;
-  int ret = G_OK, flag = 0;
+  int ret = G_OK;
 
-  if (config->metrics_endpoint) {
-    if (config != NULL && o_strlen(name)) {
+  if (config != NULL && config->metrics_endpoint) {
+    if (o_strlen(name)) {
       va_start(vl, inc);
-      for (label_arg = va_arg(vl, const char *); label_arg != NULL && ret == G_OK; label_arg = va_arg(vl, const char *)) {
-        if (!flag) {
-          if (label == NULL) {
-            label = msprintf("%s=", label_arg);
-          } else {
-            label = mstrcatf(label, ", %s=", label_arg);
-          }
-        } else {
-          label = mstrcatf(label, "%s", label_arg);
-        }
-        flag = !flag;
-      }
+      label = glewlwyd_metrics_build_label(vl);
       va_end(vl);
-      
+
       ret = glewlwyd_metrics_increment_counter(config, name, label, inc);
       o_free(label);
     } else {
@@ -160,7 +332,9 @@ void free_glwd_metrics(void * data) {
     o_free(glwd_metrics->name);
     o_free(glwd_metrics->help);
     for (i=0; i<glwd_metrics->data_size; i++) {
-      o_free(glwd_metrics->data[i].label);
+      o_free(glwd_metrics->data[i]->label);
+      o_free(glwd_metrics->data[i]->histogram);
+      o_free(glwd_metrics->data[i]);
     }
     o_free(glwd_metrics->data);
     o_free(glwd_metrics);
@@ -168,34 +342,249 @@ void free_glwd_metrics(void * data) {
 }
 
 int glewlwyd_metrics_add_metric(struct config_elements * config, const char * name, const char * help) {
+  return glewlwyd_metrics_add_metric_type(config, name, help, GLWD_METRICS_TYPE_COUNTER);
+}
+
+int glewlwyd_metrics_add_metric_type(struct config_elements * config, const char * name, const char * help, unsigned short type) {
   struct _glwd_metric * glwd_metrics;
-  int ret;
+  int ret = G_OK;
   
   if (config->metrics_endpoint) {
     if (o_strlen(name)) {
-      if ((glwd_metrics = o_malloc(sizeof(struct _glwd_metric))) != NULL) {
-        glwd_metrics->name = o_strdup(name);
-        glwd_metrics->help = o_strdup(help);
-        glwd_metrics->data_size = 0;
-        glwd_metrics->data = NULL;
-        pointer_list_append(&config->metrics_list, glwd_metrics);
+      if (!pthread_mutex_lock(&config->metrics_lock)) {
+        if (glewlwyd_metrics_get_metric(config, name) == NULL) {
+          if ((glwd_metrics = o_malloc(sizeof(struct _glwd_metric))) != NULL) {
+            glwd_metrics->name = o_strdup(name);
+            glwd_metrics->help = o_strdup(help);
+            glwd_metrics->type = type;
+            glwd_metrics->data_size = 0;
+            glwd_metrics->data = NULL;
+            pointer_list_append(&config->metrics_list, glwd_metrics);
+          } else {
+            ret = G_ERROR_MEMORY;
+          }
+        }
+        pthread_mutex_unlock(&config->metrics_lock);
       } else {
-        ret = G_ERROR_MEMORY;
+        y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_metrics_add_metric - Error lock");
+        ret = G_ERROR;
       }
     } else {
       ret = G_ERROR_PARAM;
     }
+  }
+  return ret;
+}
+
+/**
+ * Appends the lines of a histogram value to the prometheus output
+ * The buckets are cumulative, the sum is in seconds
+ */
+static char * glewlwyd_metrics_export_histogram(char * content, struct _glwd_metric * metric, struct _glwd_metrics_data * data) {
+  static const char * bucket_labels[GLWD_METRICS_HISTOGRAM_BUCKETS] = GLWD_METRICS_HISTOGRAM_LABELS;
+  size_t buckets[GLWD_METRICS_HISTOGRAM_BUCKETS] = {0}, sum = 0, count = 0, cumul = 0, i, j;
+
+  if (data->histogram != NULL) {
+    for (i=0; i<GLWD_METRICS_SHARDS; i++) {
+      for (j=0; j<GLWD_METRICS_HISTOGRAM_BUCKETS; j++) {
+        buckets[j] += __atomic_load_n(&data->histogram[i].buckets[j], __ATOMIC_RELAXED);
+      }
+      sum += __atomic_load_n(&data->histogram[i].sum, __ATOMIC_RELAXED);
+      count += __atomic_load_n(&data->histogram[i].count, __ATOMIC_RELAXED);
+    }
+  }
+  for (j=0; j<GLWD_METRICS_HISTOGRAM_BUCKETS; j++) {
+    cumul += buckets[j];
+    if (data->label != NULL) {
+      content = mstrcatf(content, "%s_bucket{%s, le=\"%s\"} %zu\n", metric->name, data->label, bucket_labels[j], cumul);
+    } else {
+      content = mstrcatf(content, "%s_bucket{le=\"%s\"} %zu\n", metric->name, bucket_labels[j], cumul);
+    }
+  }
+  if (data->label != NULL) {
+    content = mstrcatf(content, "%s_sum{%s} %zu.%06zu\n", metric->name, data->label, sum/1000000, sum%1000000);
+    content = mstrcatf(content, "%s_count{%s} %zu\n", metric->name, data->label, count);
   } else {
-    ret = G_OK;
+    content = mstrcatf(content, "%s_sum %zu.%06zu\n", metric->name, sum/1000000, sum%1000000);
+    content = mstrcatf(content, "%s_count %zu\n", metric->name, count);
+  }
+  return content;
+}
+
+/**
+ * Builds the prometheus output of all the metrics
+ * Returned value must be o_free'd after use
+ */
+char * glewlwyd_metrics_export(struct config_elements * config) {
+  static const char * type_names[] = {"counter", "gauge", "histogram"};
+  char * content = o_strdup("# We have seen handsome noble-looking men but I have never seen a man like the one who now stands at the entrance of the gate.\n");
+  struct _glwd_metric * metric;
+  size_t i, j;
+
+  if (!pthread_mutex_lock(&config->metrics_lock)) {
+    for (i=0; i<pointer_list_size(&config->metrics_list); i++) {
+      metric = (struct _glwd_metric *)pointer_list_get_at(&config->metrics_list, i);
+      content = mstrcatf(content, "# HELP %s %s\n", metric->name, metric->help);
+      content = mstrcatf(content, "# TYPE %s %s\n", metric->name, type_names[metric->type<=GLWD_METRICS_TYPE_HISTOGRAM?metric->type:GLWD_METRICS_TYPE_COUNTER]);
+      for (j=0; j<metric->data_size; j++) {
+        if (metric->type == GLWD_METRICS_TYPE_HISTOGRAM) {
+          content = glewlwyd_metrics_export_histogram(content, metric, metric->data[j]);
+        } else if (metric->type == GLWD_METRICS_TYPE_GAUGE) {
+          if (metric->data[j]->label != NULL) {
+            content = mstrcatf(content, "%s{%s} %lld\n", metric->name, metric->data[j]->label, glewlwyd_metrics_gauge_value(metric->data[j]));
+          } else {
+            content = mstrcatf(content, "%s %lld\n", metric->name, glewlwyd_metrics_gauge_value(metric->data[j]));
+          }
+        } else {
+          if (metric->data[j]->label != NULL) {
+            content = mstrcatf(content, "%s{%s} %zu\n", metric->name, metric->data[j]->label, glewlwyd_metrics_counter_value(metric->data[j]));
+          } else {
+            content = mstrcatf(content, "%s %zu\n", metric->name, glewlwyd_metrics_counter_value(metric->data[j]));
+          }
+        }
+      }
+    }
+    pthread_mutex_unlock(&config->metrics_lock);
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_metrics_export - Error lock");
+    o_free(content);
+    content = NULL;
+  }
+  return content;
+}
+
+/**
+ * Endpoint callback wrapper, measures the duration and the number of concurrent calls of the wrapped callback
+ */
+static int callback_glewlwyd_metrics_endpoint(const struct _u_request * request, struct _u_response * response, void * user_data) {
+  struct _glwd_endpoint_metrics * endpoint = (struct _glwd_endpoint_metrics *)user_data;
+  struct timespec start;
+  int ret;
+
+  glewlwyd_metrics_call_start(endpoint->in_flight, &start);
+  ret = endpoint->callback(request, response, endpoint->user_data);
+  glewlwyd_metrics_call_end(endpoint->in_flight, endpoint->duration, &start);
+  return ret;
+}
+
+/**
+ * Adds an endpoint to the webservice instance
+ * If metrics are enabled, the callback is wrapped to measure its duration and its number of concurrent calls
+ * The metrics label is made of the method, the url and the priority of the endpoint
+ */
+int glewlwyd_metrics_add_endpoint(struct config_elements * config,
+                                  struct _u_instance * instance,
+                                  const char * http_method,
+                                  const char * url_prefix,
+                                  const char * url_format,
+                                  unsigned int priority,
+                                  int (* callback_function)(const struct _u_request * request, struct _u_response * response, void * user_data),
+                                  void * user_data) {
+  struct _glwd_endpoint_metrics * endpoint = NULL;
+  char * label, * url, str_priority[16];
+  size_t i;
+  int ret;
+
+  if (config->metrics_endpoint) {
+    url = msprintf("%s%s%s", url_prefix!=NULL?url_prefix:"", (url_prefix!=NULL&&url_format!=NULL)?"/":"", url_format!=NULL?url_format:"");
+    snprintf(str_priority, 15, "%u", priority);
+    label = glewlwyd_metrics_build_label_values(config, "method", http_method, "url", url, "priority", str_priority, NULL);
+    if (!pthread_mutex_lock(&config->metrics_lock)) {
+      // Removed endpoints keep their wrapper, reuse it if the same endpoint is added again
+      for (i=0; i<pointer_list_size(&config->metrics_endpoint_list); i++) {
+        if (0 == o_strcmp(label, ((struct _glwd_endpoint_metrics *)pointer_list_get_at(&config->metrics_endpoint_list, i))->label)) {
+          endpoint = (struct _glwd_endpoint_metrics *)pointer_list_get_at(&config->metrics_endpoint_list, i);
+          break;
+        }
+      }
+      if (endpoint == NULL) {
+        if ((endpoint = o_malloc(sizeof(struct _glwd_endpoint_metrics))) != NULL) {
+          endpoint->label = label;
+          label = NULL;
+          endpoint->duration = glewlwyd_metrics_get_histogram(config, GLWD_METRICS_HTTP_REQUEST_DURATION, endpoint->label);
+          endpoint->in_flight = glewlwyd_metrics_get_gauge(config, GLWD_METRICS_HTTP_REQUEST_IN_FLIGHT, endpoint->label);
+          pointer_list_append(&config->metrics_endpoint_list, endpoint);
+        } else {
+          y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_metrics_add_endpoint - Error allocating resources for endpoint");
+        }
+      }
+      if (endpoint != NULL) {
+        endpoint->callback = callback_function;
+        endpoint->user_data = user_data;
+      }
+      pthread_mutex_unlock(&config->metrics_lock);
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_metrics_add_endpoint - Error lock");
+    }
+    o_free(label);
+    o_free(url);
+    if (endpoint != NULL) {
+      ret = ulfius_add_endpoint_by_val(instance, http_method, url_prefix, url_format, priority, &callback_glewlwyd_metrics_endpoint, endpoint);
+    } else {
+      ret = U_ERROR_MEMORY;
+    }
+  } else {
+    ret = ulfius_add_endpoint_by_val(instance, http_method, url_prefix, url_format, priority, callback_function, user_data);
   }
   return ret;
 }
 
+static void free_glwd_endpoint_metrics(void * data) {
+  struct _glwd_endpoint_metrics * endpoint = (struct _glwd_endpoint_metrics *)data;
+
+  if (endpoint != NULL) {
+    o_free(endpoint->label);
+    o_free(endpoint);
+  }
+}
+
+/**
+ * Registers the metrics handles of a user module instance
+ */
+void glewlwyd_metrics_init_user_module_instance(struct config_elements * config, struct _user_module_instance * instance) {
+  static const char * functions[GLWD_METRICS_USER_MODULE_CALLS] = {"init", "close", "count_total", "get_list", "get", "get_profile", "is_valid", "add", "update", "update_profile", "delete", "check_password", "update_password"};
+  char * label;
+  size_t i;
+
+  label = glewlwyd_metrics_build_label_values(config, "module_type", "user", "module_name", instance->name, NULL);
+  instance->metrics_in_flight = glewlwyd_metrics_get_gauge(config, GLWD_METRICS_MODULE_CALL_IN_FLIGHT, label);
+  o_free(label);
+  label = glewlwyd_metrics_build_label_values(config, "module_name", instance->name, NULL);
+  instance->metrics_route_hit = glewlwyd_metrics_get_counter(config, GLWD_METRICS_USER_ROUTE_HIT, label);
+  instance->metrics_route_miss = glewlwyd_metrics_get_counter(config, GLWD_METRICS_USER_ROUTE_MISS, label);
+  o_free(label);
+  for (i=0; i<GLWD_METRICS_USER_MODULE_CALLS; i++) {
+    label = glewlwyd_metrics_build_label_values(config, "module_type", "user", "module_name", instance->name, "function", functions[i], NULL);
+    instance->metrics_duration[i] = glewlwyd_metrics_get_histogram(config, GLWD_METRICS_MODULE_CALL_DURATION, label);
+    o_free(label);
+  }
+}
+
+/**
+ * Registers the metrics handles of a client module instance
+ */
+void glewlwyd_metrics_init_client_module_instance(struct config_elements * config, struct _client_module_instance * instance) {
+  static const char * functions[GLWD_METRICS_CLIENT_MODULE_CALLS] = {"init", "close", "count_total", "get_list", "get", "is_valid", "add", "update", "delete", "check_password"};
+  char * label;
+  size_t i;
+
+  label = glewlwyd_metrics_build_label_values(config, "module_type", "client", "module_name", instance->name, NULL);
+  instance->metrics_in_flight = glewlwyd_metrics_get_gauge(config, GLWD_METRICS_MODULE_CALL_IN_FLIGHT, label);
+  o_free(label);
+  for (i=0; i<GLWD_METRICS_CLIENT_MODULE_CALLS; i++) {
+    label = glewlwyd_metrics_build_label_values(config, "module_type", "client", "module_name", instance->name, "function", functions[i], NULL);
+    instance->metrics_duration[i] = glewlwyd_metrics_get_histogram(config, GLWD_METRICS_MODULE_CALL_DURATION, label);
+    o_free(label);
+  }
+}
+
 int glewlwyd_metrics_init(struct config_elements * config) {
   pthread_mutexattr_t mutexattr;
   int ret = G_OK;
   
   pointer_list_init(&config->metrics_list);
+  pointer_list_init(&config->metrics_endpoint_list);
+  memset(config->metrics_hash, 0, sizeof(config->metrics_hash));
   pthread_mutexattr_init ( &mutexattr );
   pthread_mutexattr_settype( &mutexattr, PTHREAD_MUTEX_RECURSIVE );
   if (pthread_mutex_init(&config->metrics_lock, &mutexattr) != 0) {
@@ -207,7 +596,9 @@ int glewlwyd_metrics_init(struct config_elements * config) {
 
 void glewlwyd_metrics_close(struct config_elements * config) {
   if (config->metrics_endpoint) {
+    memset(config->metrics_hash, 0, sizeof(config->metrics_hash));
     pointer_list_clean_free(&config->metrics_list, &free_glwd_metrics);
+    pointer_list_clean_free(&config->metrics_endpoint_list, &free_glwd_endpoint_metrics);
     pthread_mutex_destroy(&config->metrics_lock);
   }
 }
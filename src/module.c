@@ -103,7 +103,8 @@ json_t * get_module_type_list(struct config_elements * config) {
   return j_return;
 }
 
-json_t * get_user_module_list(struct config_elements * config) {
+static json_t * get_user_module_list_db(struct config_elements * config) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   int res;
   json_t * j_query, * j_result = NULL, * j_return, * j_parameters, * j_element;
   size_t index;
@@ -122,7 +123,7 @@ json_t * get_user_module_list(struct config_elements * config) {
                         "gumi_enabled",
                       "order_by",
                       "gumi_order");
-  res = h_select(config->conn, j_query, &j_result, NULL);
+  res = h_select(conn, j_query, &j_result, NULL);
   json_decref(j_query);
   if (res == H_OK) {
     json_array_foreach(j_result, index, j_element) {
@@ -150,10 +151,52 @@ json_t * get_user_module_list(struct config_elements * config) {
     j_return = json_pack("{si}", "result", G_ERROR_DB);
   }
   json_decref(j_result);
+  glewlwyd_db_pool_release(config, conn);
   return j_return;
 }
 
+/**
+ * Returns the user module instance list ordered by gumi_order
+ * The list is kept in memory and must not be modified by the caller
+ * It's loaded from the database on the first call after an invalidation
+ */
+json_t * get_user_module_list(struct config_elements * config) {
+  json_t * j_return;
+
+  if (!pthread_mutex_lock(&config->module_list_cache_lock)) {
+    if (config->j_user_module_list_cache == NULL) {
+      j_return = get_user_module_list_db(config);
+      if (check_result_value(j_return, G_OK)) {
+        config->j_user_module_list_cache = json_incref(json_object_get(j_return, "module"));
+      }
+    } else {
+      j_return = json_pack("{sisO}", "result", G_OK, "module", config->j_user_module_list_cache);
+    }
+    pthread_mutex_unlock(&config->module_list_cache_lock);
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "get_user_module_list - Error lock");
+    j_return = json_pack("{si}", "result", G_ERROR);
+  }
+  return j_return;
+}
+
+/**
+ * Removes the user module instance list from memory, the next call to get_user_module_list will reload it
+ */
+void invalidate_user_module_list(struct config_elements * config) {
+  if (!pthread_mutex_lock(&config->module_list_cache_lock)) {
+    json_decref(config->j_user_module_list_cache);
+    config->j_user_module_list_cache = NULL;
+    pthread_mutex_unlock(&config->module_list_cache_lock);
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "invalidate_user_module_list - Error lock");
+  }
+  glewlwyd_user_route_clear(config);
+  glewlwyd_user_cache_clear(config);
+}
+
 json_t * get_user_module(struct config_elements * config, const char * name) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   int res;
   json_t * j_query, * j_result = NULL, * j_return, * j_parameters;
   
@@ -172,7 +215,7 @@ json_t * get_user_module(struct config_elements * config, const char * name) {
                       "where",
                         "gumi_name",
                         name);
-  res = h_select(config->conn, j_query, &j_result, NULL);
+  res = h_select(conn, j_query, &j_result, NULL);
   json_decref(j_query);
   if (res == H_OK) {
     if (json_array_size(j_result) > 0) {
@@ -203,6 +246,7 @@ json_t * get_user_module(struct config_elements * config, const char * name) {
     j_return = json_pack("{si}", "result", G_ERROR_DB);
   }
   json_decref(j_result);
+  glewlwyd_db_pool_release(config, conn);
   return j_return;
 }
 
@@ -287,6 +331,7 @@ json_t * is_user_module_valid(struct config_elements * config, json_t * j_module
 }
 
 json_t * add_user_module(struct config_elements * config, json_t * j_module) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   struct _user_module * module;
   struct _user_module_instance * cur_instance;
   json_t * j_query;
@@ -318,7 +363,7 @@ json_t * add_user_module(struct config_elements * config, json_t * j_module) {
   } else {
     json_object_set_new(json_object_get(j_query, "values"), "gumi_order", json_integer(pointer_list_size(config->user_module_list)));
   }
-  res = h_insert(config->conn, j_query, NULL);
+  res = h_insert(conn, j_query, NULL);
   json_decref(j_query);
   if (res == H_OK) {
     module = NULL;
@@ -336,11 +381,12 @@ json_t * add_user_module(struct config_elements * config, json_t * j_module) {
         cur_instance->cls = NULL;
         cur_instance->name = o_strdup(json_string_value(json_object_get(j_module, "name")));
         cur_instance->module = module;
+        glewlwyd_metrics_init_user_module_instance(config, cur_instance);
         cur_instance->enabled = 0;
         cur_instance->readonly = json_object_get(j_module, "readonly")==json_true()?1:0;
         cur_instance->multiple_passwords = json_object_get(j_module, "multiple_passwords")==json_true()?1:0;
         if (pointer_list_append(config->user_module_instance_list, cur_instance)) {
-          j_result = module->user_module_init(config->config_m, cur_instance->readonly, cur_instance->multiple_passwords, json_object_get(j_module, "parameters"), &cur_instance->cls);
+          j_result = user_module_instance_init(config, cur_instance, json_object_get(j_module, "parameters"));
           if (check_result_value(j_result, G_OK)) {
             cur_instance->enabled = 1;
             j_return = json_pack("{si}", "result", G_OK);
@@ -369,10 +415,13 @@ json_t * add_user_module(struct config_elements * config, json_t * j_module) {
     j_return = json_pack("{si}", "result", G_ERROR_DB);
   }
   o_free(parameters);
+  glewlwyd_db_pool_release(config, conn);
+  invalidate_user_module_list(config);
   return j_return;
 }
 
 int set_user_module(struct config_elements * config, const char * name, json_t * j_module) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   json_t * j_query;
   int res, ret;
   char * parameters = json_dumps(json_object_get(j_module, "parameters"), JSON_COMPACT);
@@ -403,7 +452,7 @@ int set_user_module(struct config_elements * config, const char * name, json_t *
   if (json_object_get(j_module, "readonly") != NULL) {
     json_object_set_new(json_object_get(j_query, "set"), "gumi_readonly", json_object_get(j_module, "readonly")==json_true()?json_integer(1):json_integer(0));
   }
-  res = h_update(config->conn, j_query, NULL);
+  res = h_update(conn, j_query, NULL);
   json_decref(j_query);
   if (res == H_OK) {
     if ((cur_instance = get_user_module_instance(config, name)) != NULL) {
@@ -419,10 +468,13 @@ int set_user_module(struct config_elements * config, const char * name, json_t *
     ret = G_ERROR_DB;
   }
   o_free(parameters);
+  glewlwyd_db_pool_release(config, conn);
+  invalidate_user_module_list(config);
   return ret;
 }
 
 int delete_user_module(struct config_elements * config, const char * name) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   int ret, res, error = 0;
   json_t * j_query, * j_result;
   struct _user_module_instance * instance;
@@ -444,7 +496,7 @@ int delete_user_module(struct config_elements * config, const char * name) {
                             "where",
                               "gumi_name",
                               name);
-        res = h_delete(config->conn, j_query, NULL);
+        res = h_delete(conn, j_query, NULL);
         json_decref(j_query);
         if (res == H_OK) {
           ret = G_OK;
@@ -464,6 +516,8 @@ int delete_user_module(struct config_elements * config, const char * name) {
     y_log_message(Y_LOG_LEVEL_ERROR, "delete_user_module - Error module not found");
     ret = G_ERROR;
   }
+  glewlwyd_db_pool_release(config, conn);
+  invalidate_user_module_list(config);
   return ret;
 }
 
@@ -474,7 +528,7 @@ json_t * manage_user_module(struct config_elements * config, const char * name,
   if (check_result_value(j_module, G_OK) && instance != NULL) {
     if (action == GLEWLWYD_MODULE_ACTION_START) {
       if (!instance->enabled) {
-        j_result = instance->module->user_module_init(config->config_m, instance->readonly, instance->multiple_passwords, json_object_get(json_object_get(j_module, "module"), "parameters"), &instance->cls);
+        j_result = user_module_instance_init(config, instance, json_object_get(json_object_get(j_module, "module"), "parameters"));
         if (check_result_value(j_result, G_OK)) {
           instance->enabled = 1;
           json_object_set(json_object_get(j_module, "module"), "enabled", json_true());
@@ -496,7 +550,7 @@ json_t * manage_user_module(struct config_elements * config, const char * name,
       }
     } else if (action == GLEWLWYD_MODULE_ACTION_STOP) {
       if (instance->enabled) {
-        if (instance->module->user_module_close(config->config_m, instance->cls) == G_OK) {
+        if (user_module_instance_close(config, instance) == G_OK) {
           instance->enabled = 0;
           json_object_set(json_object_get(j_module, "module"), "enabled", json_false());
           if (set_user_module(config, name, json_object_get(j_module, "module")) == G_OK) {
@@ -521,10 +575,12 @@ json_t * manage_user_module(struct config_elements * config, const char * name,
     j_return = json_pack("{sis[s]}", "result", G_ERROR_PARAM, "error", "Error module not found");
   }
   json_decref(j_module);
+  invalidate_user_module_list(config);
   return j_return;
 }
 
 json_t * get_user_middleware_module_list(struct config_elements * config) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   int res;
   json_t * j_query, * j_result = NULL, * j_return, * j_parameters, * j_element;
   size_t index;
@@ -541,7 +597,7 @@ json_t * get_user_middleware_module_list(struct config_elements * config) {
                         "gummi_enabled",
                       "order_by",
                       "gummi_order");
-  res = h_select(config->conn, j_query, &j_result, NULL);
+  res = h_select(conn, j_query, &j_result, NULL);
   json_decref(j_query);
   if (res == H_OK) {
     json_array_foreach(j_result, index, j_element) {
@@ -563,10 +619,12 @@ json_t * get_user_middleware_module_list(struct config_elements * config) {
     j_return = json_pack("{si}", "result", G_ERROR_DB);
   }
   json_decref(j_result);
+  glewlwyd_db_pool_release(config, conn);
   return j_return;
 }
 
 json_t * get_user_middleware_module(struct config_elements * config, const char * name) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   int res;
   json_t * j_query, * j_result = NULL, * j_return, * j_parameters;
   
@@ -583,7 +641,7 @@ json_t * get_user_middleware_module(struct config_elements * config, const char
                       "where",
                         "gummi_name",
                         name);
-  res = h_select(config->conn, j_query, &j_result, NULL);
+  res = h_select(conn, j_query, &j_result, NULL);
   json_decref(j_query);
   if (res == H_OK) {
     if (json_array_size(j_result) > 0) {
@@ -608,6 +666,7 @@ json_t * get_user_middleware_module(struct config_elements * config, const char
     j_return = json_pack("{si}", "result", G_ERROR_DB);
   }
   json_decref(j_result);
+  glewlwyd_db_pool_release(config, conn);
   return j_return;
 }
 
@@ -686,6 +745,7 @@ json_t * is_user_middleware_module_valid(struct config_elements * config, json_t
 }
 
 json_t * add_user_middleware_module(struct config_elements * config, json_t * j_module) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   json_t * j_query;
   int res;
   json_t * j_return;
@@ -710,7 +770,7 @@ json_t * add_user_middleware_module(struct config_elements * config, json_t * j_
   } else {
     json_object_set_new(json_object_get(j_query, "values"), "gummi_order", json_integer(pointer_list_size(config->user_middleware_module_list)));
   }
-  res = h_insert(config->conn, j_query, NULL);
+  res = h_insert(conn, j_query, NULL);
   json_decref(j_query);
   if (res == H_OK) {
     close_user_middleware_module_instance_list(config);
@@ -720,10 +780,12 @@ json_t * add_user_middleware_module(struct config_elements * config, json_t * j_
     j_return = json_pack("{si}", "result", G_ERROR_DB);
   }
   o_free(parameters);
+  glewlwyd_db_pool_release(config, conn);
   return j_return;
 }
 
 int set_user_middleware_module(struct config_elements * config, const char * name, json_t * j_module) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   json_t * j_query;
   int res, ret;
   char * parameters = json_dumps(json_object_get(j_module, "parameters"), JSON_COMPACT);
@@ -746,7 +808,7 @@ int set_user_middleware_module(struct config_elements * config, const char * nam
   } else {
     json_object_set_new(json_object_get(j_query, "set"), "gummi_order", json_integer(pointer_list_size(config->user_middleware_module_list)));
   }
-  res = h_update(config->conn, j_query, NULL);
+  res = h_update(conn, j_query, NULL);
   json_decref(j_query);
   if (res == H_OK) {
     close_user_middleware_module_instance_list(config);
@@ -757,10 +819,12 @@ int set_user_middleware_module(struct config_elements * config, const char * nam
     ret = G_ERROR_DB;
   }
   o_free(parameters);
+  glewlwyd_db_pool_release(config, conn);
   return ret;
 }
 
 int delete_user_middleware_module(struct config_elements * config, const char * name) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   int ret, res;
   json_t * j_query;
   struct _user_middleware_module_instance * instance;
@@ -773,7 +837,7 @@ int delete_user_middleware_module(struct config_elements * config, const char *
                         "where",
                           "gummi_name",
                           name);
-    res = h_delete(config->conn, j_query, NULL);
+    res = h_delete(conn, j_query, NULL);
     json_decref(j_query);
     if (res == H_OK) {
       close_user_middleware_module_instance_list(config);
@@ -787,6 +851,7 @@ int delete_user_middleware_module(struct config_elements * config, const char *
     y_log_message(Y_LOG_LEVEL_ERROR, "delete_user_middleware_module - Error module not found");
     ret = G_ERROR;
   }
+  glewlwyd_db_pool_release(config, conn);
   return ret;
 }
 
@@ -848,6 +913,7 @@ json_t * manage_user_middleware_module(struct config_elements * config, const ch
 }
 
 json_t * get_user_auth_scheme_module_list(struct config_elements * config) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   int res;
   json_t * j_query, * j_result = NULL, * j_return, * j_parameters, * j_element;
   size_t index;
@@ -868,7 +934,7 @@ json_t * get_user_auth_scheme_module_list(struct config_elements * config) {
                         "guasmi_enabled",
                       "order_by",
                       "guasmi_module");
-  res = h_select(config->conn, j_query, &j_result, NULL);
+  res = h_select(conn, j_query, &j_result, NULL);
   json_decref(j_query);
   if (res == H_OK) {
     json_array_foreach(j_result, index, j_element) {
@@ -896,10 +962,12 @@ json_t * get_user_auth_scheme_module_list(struct config_elements * config) {
     j_return = json_pack("{si}", "result", G_ERROR_DB);
   }
   json_decref(j_result);
+  glewlwyd_db_pool_release(config, conn);
   return j_return;
 }
 
 json_t * get_user_auth_scheme_module(struct config_elements * config, const char * name) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   int res;
   json_t * j_query, * j_result = NULL, * j_return, * j_parameters;
   
@@ -920,7 +988,7 @@ json_t * get_user_auth_scheme_module(struct config_elements * config, const char
                       "where",
                         "guasmi_name",
                         name);
-  res = h_select(config->conn, j_query, &j_result, NULL);
+  res = h_select(conn, j_query, &j_result, NULL);
   json_decref(j_query);
   if (res == H_OK) {
     if (json_array_size(j_result) > 0) {
@@ -951,6 +1019,7 @@ json_t * get_user_auth_scheme_module(struct config_elements * config, const char
     j_return = json_pack("{si}", "result", G_ERROR_DB);
   }
   json_decref(j_result);
+  glewlwyd_db_pool_release(config, conn);
   return j_return;
 }
 
@@ -1035,6 +1104,7 @@ json_t * is_user_auth_scheme_module_valid(struct config_elements * config, json_
 }
 
 json_t * add_user_auth_scheme_module(struct config_elements * config, json_t * j_module) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   struct _user_auth_scheme_module * module;
   struct _user_auth_scheme_module_instance * cur_instance;
   json_t * j_query, * j_last_id, * j_result, * j_return;
@@ -1066,10 +1136,10 @@ json_t * add_user_auth_scheme_module(struct config_elements * config, json_t * j
                         json_object_get(j_module, "forbid_user_reset_credential")==json_true()?1:0,
                         "guasmi_enabled",
                         1);
-  res = h_insert(config->conn, j_query, NULL);
+  res = h_insert(conn, j_query, NULL);
   json_decref(j_query);
   if (res == H_OK) {
-    j_last_id = h_last_insert_id(config->conn);
+    j_last_id = h_last_insert_id(conn);
     if (j_last_id != NULL) {
       module = NULL;
       for (i=0; i<pointer_list_size(config->user_auth_scheme_module_list); i++) {
@@ -1130,10 +1200,12 @@ json_t * add_user_auth_scheme_module(struct config_elements * config, json_t * j
     j_return = json_pack("{si}", "result", G_ERROR_DB);
   }
   o_free(parameters);
+  glewlwyd_db_pool_release(config, conn);
   return j_return;
 }
 
 int set_user_auth_scheme_module(struct config_elements * config, const char * name, json_t * j_module) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   json_t * j_query;
   int res, ret;
   char * parameters = json_dumps(json_object_get(j_module, "parameters"), JSON_COMPACT);
@@ -1163,7 +1235,7 @@ int set_user_auth_scheme_module(struct config_elements * config, const char * na
                         "guasmi_name",
                         name);
   o_free(parameters);
-  res = h_update(config->conn, j_query, NULL);
+  res = h_update(conn, j_query, NULL);
   json_decref(j_query);
   if (res == H_OK) {
     scheme_instance = get_user_auth_scheme_module_instance(config, name);
@@ -1173,6 +1245,8 @@ int set_user_auth_scheme_module(struct config_elements * config, const char * na
       scheme_instance->guasmi_allow_user_register = json_object_get(j_module, "allow_user_register")!=json_false();
       scheme_instance->guasmi_forbid_user_profile = json_object_get(j_module, "forbid_user_profile")==json_true();
       scheme_instance->guasmi_forbid_user_reset_credential = json_object_get(j_module, "forbid_user_reset_credential")==json_true();
+      // The scheme display name is in the scope policy graph
+      invalidate_scope_policy(config);
       ret = G_OK;
     } else {
       y_log_message(Y_LOG_LEVEL_ERROR, "set_user_auth_scheme_module - Error get_user_auth_scheme_module_instance");
@@ -1182,10 +1256,12 @@ int set_user_auth_scheme_module(struct config_elements * config, const char * na
     y_log_message(Y_LOG_LEVEL_ERROR, "set_user_auth_scheme_module - Error executing j_query");
     ret = G_ERROR_DB;
   }
+  glewlwyd_db_pool_release(config, conn);
   return ret;
 }
 
 int delete_user_auth_scheme_module(struct config_elements * config, const char * name) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   int ret, res;
   json_t * j_query, * j_result = manage_user_auth_scheme_module(config, name, GLEWLWYD_MODULE_ACTION_STOP);
   struct _user_auth_scheme_module_instance * instance;
@@ -1201,9 +1277,12 @@ int delete_user_auth_scheme_module(struct config_elements * config, const char *
                           "where",
                             "guasmi_name",
                             name);
-      res = h_delete(config->conn, j_query, NULL);
+      res = h_delete(conn, j_query, NULL);
       json_decref(j_query);
       if (res == H_OK) {
+        // Session schemes and scope groups links of this instance are deleted with it
+        glewlwyd_session_cache_clear(config);
+        invalidate_scope_policy(config);
         ret = G_OK;
       } else {
         y_log_message(Y_LOG_LEVEL_ERROR, "delete_user_auth_scheme_module - Error executing j_query");
@@ -1218,6 +1297,7 @@ int delete_user_auth_scheme_module(struct config_elements * config, const char *
     ret = G_ERROR;
   }
   json_decref(j_result);
+  glewlwyd_db_pool_release(config, conn);
   return ret;
 }
 
@@ -1280,7 +1360,8 @@ json_t * manage_user_auth_scheme_module(struct config_elements * config, const c
   return j_return;
 }
 
-json_t * get_client_module_list(struct config_elements * config) {
+static json_t * get_client_module_list_db(struct config_elements * config) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   int res;
   json_t * j_query, * j_result = NULL, * j_return, * j_parameters, * j_element;
   size_t index;
@@ -1298,7 +1379,7 @@ json_t * get_client_module_list(struct config_elements * config) {
                         "gcmi_enabled",
                       "order_by",
                       "gcmi_order");
-  res = h_select(config->conn, j_query, &j_result, NULL);
+  res = h_select(conn, j_query, &j_result, NULL);
   json_decref(j_query);
   if (res == H_OK) {
     json_array_foreach(j_result, index, j_element) {
@@ -1323,10 +1404,50 @@ json_t * get_client_module_list(struct config_elements * config) {
     j_return = json_pack("{si}", "result", G_ERROR_DB);
   }
   json_decref(j_result);
+  glewlwyd_db_pool_release(config, conn);
   return j_return;
 }
 
+/**
+ * Returns the client module instance list ordered by gcmi_order
+ * The list is kept in memory and must not be modified by the caller
+ * It's loaded from the database on the first call after an invalidation
+ */
+json_t * get_client_module_list(struct config_elements * config) {
+  json_t * j_return;
+
+  if (!pthread_mutex_lock(&config->module_list_cache_lock)) {
+    if (config->j_client_module_list_cache == NULL) {
+      j_return = get_client_module_list_db(config);
+      if (check_result_value(j_return, G_OK)) {
+        config->j_client_module_list_cache = json_incref(json_object_get(j_return, "module"));
+      }
+    } else {
+      j_return = json_pack("{sisO}", "result", G_OK, "module", config->j_client_module_list_cache);
+    }
+    pthread_mutex_unlock(&config->module_list_cache_lock);
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "get_client_module_list - Error lock");
+    j_return = json_pack("{si}", "result", G_ERROR);
+  }
+  return j_return;
+}
+
+/**
+ * Removes the client module instance list from memory, the next call to get_client_module_list will reload it
+ */
+void invalidate_client_module_list(struct config_elements * config) {
+  if (!pthread_mutex_lock(&config->module_list_cache_lock)) {
+    json_decref(config->j_client_module_list_cache);
+    config->j_client_module_list_cache = NULL;
+    pthread_mutex_unlock(&config->module_list_cache_lock);
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "invalidate_client_module_list - Error lock");
+  }
+}
+
 json_t * get_client_module(struct config_elements * config, const char * name) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   int res;
   json_t * j_query, * j_result = NULL, * j_return, * j_parameters;
   
@@ -1344,7 +1465,7 @@ json_t * get_client_module(struct config_elements * config, const char * name) {
                       "where",
                         "gcmi_name",
                         name);
-  res = h_select(config->conn, j_query, &j_result, NULL);
+  res = h_select(conn, j_query, &j_result, NULL);
   json_decref(j_query);
   if (res == H_OK) {
     if (json_array_size(j_result) > 0) {
@@ -1372,6 +1493,7 @@ json_t * get_client_module(struct config_elements * config, const char * name) {
     j_return = json_pack("{si}", "result", G_ERROR_DB);
   }
   json_decref(j_result);
+  glewlwyd_db_pool_release(config, conn);
   return j_return;
 }
 
@@ -1453,6 +1575,7 @@ json_t * is_client_module_valid(struct config_elements * config, json_t * j_modu
 }
 
 json_t * add_client_module(struct config_elements * config, json_t * j_module) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   struct _client_module * module;
   struct _client_module_instance * cur_instance;
   json_t * j_query, * j_result, * j_return;
@@ -1481,7 +1604,7 @@ json_t * add_client_module(struct config_elements * config, json_t * j_module) {
   } else {
     json_object_set_new(json_object_get(j_query, "values"), "gcmi_order", json_integer(pointer_list_size(config->client_module_list)));
   }
-  res = h_insert(config->conn, j_query, NULL);
+  res = h_insert(conn, j_query, NULL);
   json_decref(j_query);
   if (res == H_OK) {
     module = NULL;
@@ -1499,10 +1622,11 @@ json_t * add_client_module(struct config_elements * config, json_t * j_module) {
         cur_instance->cls = NULL;
         cur_instance->name = o_strdup(json_string_value(json_object_get(j_module, "name")));
         cur_instance->module = module;
+        glewlwyd_metrics_init_client_module_instance(config, cur_instance);
         cur_instance->enabled = 0;
         cur_instance->readonly = json_object_get(j_module, "readonly")==json_true()?1:0;
         if (pointer_list_append(config->client_module_instance_list, cur_instance)) {
-          j_result = module->client_module_init(config->config_m, cur_instance->readonly, json_object_get(j_module, "parameters"), &cur_instance->cls);
+          j_result = client_module_instance_init(config, cur_instance, json_object_get(j_module, "parameters"));
           if (check_result_value(j_result, G_OK)) {
             cur_instance->enabled = 1;
             j_return = json_pack("{si}", "result", G_OK);
@@ -1531,10 +1655,13 @@ json_t * add_client_module(struct config_elements * config, json_t * j_module) {
     j_return = json_pack("{si}", "result", G_ERROR_DB);
   }
   o_free(parameters);
+  glewlwyd_db_pool_release(config, conn);
+  invalidate_client_module_list(config);
   return j_return;
 }
 
 int set_client_module(struct config_elements * config, const char * name, json_t * j_module) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   json_t * j_query;
   size_t res;
   int ret;
@@ -1565,7 +1692,7 @@ int set_client_module(struct config_elements * config, const char * name, json_t
     json_object_set_new(json_object_get(j_query, "set"), "gcmi_readonly", json_object_get(j_module, "readonly")==json_true()?json_integer(1):json_integer(0));
   }
   o_free(parameters);
-  res = h_update(config->conn, j_query, NULL);
+  res = h_update(conn, j_query, NULL);
   json_decref(j_query);
   if (res == H_OK) {
     if ((cur_instance = get_client_module_instance(config, name)) != NULL) {
@@ -1579,10 +1706,13 @@ int set_client_module(struct config_elements * config, const char * name, json_t
     y_log_message(Y_LOG_LEVEL_ERROR, "set_client_module - Error executing j_query");
     ret = G_ERROR_DB;
   }
+  glewlwyd_db_pool_release(config, conn);
+  invalidate_client_module_list(config);
   return ret;
 }
 
 int delete_client_module(struct config_elements * config, const char * name) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   int ret, res, error = 0;
   json_t * j_query, * j_result;
   struct _client_module_instance * instance;
@@ -1604,7 +1734,7 @@ int delete_client_module(struct config_elements * config, const char * name) {
                             "where",
                               "gcmi_name",
                               name);
-        res = h_delete(config->conn, j_query, NULL);
+        res = h_delete(conn, j_query, NULL);
         json_decref(j_query);
         if (res == H_OK) {
           ret = G_OK;
@@ -1624,6 +1754,8 @@ int delete_client_module(struct config_elements * config, const char * name) {
     y_log_message(Y_LOG_LEVEL_ERROR, "delete_client_module - Error instance not found");
     ret = G_ERROR;
   }
+  glewlwyd_db_pool_release(config, conn);
+  invalidate_client_module_list(config);
   return ret;
 }
 
@@ -1634,7 +1766,7 @@ json_t * manage_client_module(struct config_elements * config, const char * name
   if (check_result_value(j_module, G_OK) && instance != NULL) {
     if (action == GLEWLWYD_MODULE_ACTION_START) {
       if (!instance->enabled) {
-        j_result = instance->module->client_module_init(config->config_m, instance->readonly, json_object_get(json_object_get(j_module, "module"), "parameters"), &instance->cls);
+        j_result = client_module_instance_init(config, instance, json_object_get(json_object_get(j_module, "module"), "parameters"));
         if (check_result_value(j_result, G_OK)) {
           instance->enabled = 1;
           json_object_set(json_object_get(j_module, "module"), "enabled", json_true());
@@ -1656,7 +1788,7 @@ json_t * manage_client_module(struct config_elements * config, const char * name
       }
     } else if (action == GLEWLWYD_MODULE_ACTION_STOP) {
       if (instance->enabled) {
-        if (instance->module->client_module_close(config->config_m, instance->cls) == G_OK) {
+        if (client_module_instance_close(config, instance) == G_OK) {
           instance->enabled = 0;
           json_object_set(json_object_get(j_module, "module"), "enabled", json_false());
           if (set_client_module(config, name, json_object_get(j_module, "module")) == G_OK) {
@@ -1681,10 +1813,12 @@ json_t * manage_client_module(struct config_elements * config, const char * name
     j_return = json_pack("{sis[s]}", "result", G_ERROR_PARAM, "error", "Error module not found");
   }
   json_decref(j_module);
+  invalidate_client_module_list(config);
   return j_return;
 }
 
 json_t * get_plugin_module_list(struct config_elements * config) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   int res;
   json_t * j_query, * j_result = NULL, * j_return, * j_parameters, * j_element;
   size_t index;
@@ -1700,7 +1834,7 @@ json_t * get_plugin_module_list(struct config_elements * config) {
                         "gpmi_enabled",
                       "order_by",
                       "gpmi_module,gpmi_name");
-  res = h_select(config->conn, j_query, &j_result, NULL);
+  res = h_select(conn, j_query, &j_result, NULL);
   json_decref(j_query);
   if (res == H_OK) {
     json_array_foreach(j_result, index, j_element) {
@@ -1722,6 +1856,7 @@ json_t * get_plugin_module_list(struct config_elements * config) {
     j_return = json_pack("{si}", "result", G_ERROR_DB);
   }
   json_decref(j_result);
+  glewlwyd_db_pool_release(config, conn);
   return j_return;
 }
 
@@ -1752,6 +1887,7 @@ json_t * get_plugin_module_list_for_user(struct config_elements * config) {
 }
 
 json_t * get_plugin_module(struct config_elements * config, const char * name) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   int res;
   json_t * j_query, * j_result = NULL, * j_return, * j_parameters;
   
@@ -1767,7 +1903,7 @@ json_t * get_plugin_module(struct config_elements * config, const char * name) {
                       "where",
                         "gpmi_name",
                         name);
-  res = h_select(config->conn, j_query, &j_result, NULL);
+  res = h_select(conn, j_query, &j_result, NULL);
   json_decref(j_query);
   if (res == H_OK) {
     if (json_array_size(j_result) > 0) {
@@ -1792,6 +1928,7 @@ json_t * get_plugin_module(struct config_elements * config, const char * name) {
     j_return = json_pack("{si}", "result", G_ERROR_DB);
   }
   json_decref(j_result);
+  glewlwyd_db_pool_release(config, conn);
   return j_return;
 }
 
@@ -1867,6 +2004,7 @@ json_t * is_plugin_module_valid(struct config_elements * config, json_t * j_modu
 }
 
 json_t * add_plugin_module(struct config_elements * config, json_t * j_module) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   struct _plugin_module * module;
   struct _plugin_module_instance * cur_instance;
   json_t * j_query, * j_return, * j_result;
@@ -1888,7 +2026,7 @@ json_t * add_plugin_module(struct config_elements * config, json_t * j_module) {
                         1,
                         "gpmi_parameters",
                         parameters);
-  res = h_insert(config->conn, j_query, NULL);
+  res = h_insert(conn, j_query, NULL);
   json_decref(j_query);
   if (res == H_OK) {
     module = NULL;
@@ -1937,10 +2075,12 @@ json_t * add_plugin_module(struct config_elements * config, json_t * j_module) {
     j_return = json_pack("{si}", "result", G_ERROR_DB);
   }
   o_free(parameters);
+  glewlwyd_db_pool_release(config, conn);
   return j_return;
 }
 
 int set_plugin_module(struct config_elements * config, const char * name, json_t * j_module) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   json_t * j_query;
   int res, ret;
   char * parameters = json_dumps(json_object_get(j_module, "parameters"), JSON_COMPACT);
@@ -1959,7 +2099,7 @@ int set_plugin_module(struct config_elements * config, const char * name, json_t
                         "gpmi_name",
                         name);
   o_free(parameters);
-  res = h_update(config->conn, j_query, NULL);
+  res = h_update(conn, j_query, NULL);
   json_decref(j_query);
   if (res == H_OK) {
     ret = G_OK;
@@ -1967,10 +2107,12 @@ int set_plugin_module(struct config_elements * config, const char * name, json_t
     y_log_message(Y_LOG_LEVEL_ERROR, "add_plugin_module - Error executing j_query");
     ret = G_ERROR_DB;
   }
+  glewlwyd_db_pool_release(config, conn);
   return ret;
 }
 
 int delete_plugin_module(struct config_elements * config, const char * name) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   int ret, res;
   json_t * j_query, * j_result = manage_plugin_module(config, name, GLEWLWYD_MODULE_ACTION_STOP);
   struct _plugin_module_instance * instance;
@@ -1986,7 +2128,7 @@ int delete_plugin_module(struct config_elements * config, const char * name) {
                           "where",
                             "gpmi_name",
                             name);
-      res = h_delete(config->conn, j_query, NULL);
+      res = h_delete(conn, j_query, NULL);
       json_decref(j_query);
       if (res == H_OK) {
         ret = G_OK;
@@ -2003,6 +2145,7 @@ int delete_plugin_module(struct config_elements * config, const char * name) {
     ret = G_ERROR;
   }
   json_decref(j_result);
+  glewlwyd_db_pool_release(config, conn);
   return ret;
 }
 
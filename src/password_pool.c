@@ -0,0 +1,284 @@
+/**
+ *
+ * Glewlwyd SSO Server
+ *
+ * Authentiation server
+ * Users are authenticated via various backend available: database, ldap
+ * Using various authentication methods available: password, OTP, send code, etc.
+ *
+ * Password check pool functions definitions
+ *
+ * Copyright 2016-2021 Nicolas Mora <mail@babelouest.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU GENERAL PUBLIC LICENSE
+ * License as published by the Free Software Foundation;
+ * version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU GENERAL PUBLIC LICENSE for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <errno.h>
+#include <time.h>
+
+#include "glewlwyd.h"
+
+#define GLWD_PASSWORD_JOB_QUEUED  0
+#define GLWD_PASSWORD_JOB_RUNNING 1
+#define GLWD_PASSWORD_JOB_DONE    2
+
+static size_t glewlwyd_password_pool_elapsed(struct timespec * start, struct timespec * end) {
+  return (size_t)((end->tv_sec - start->tv_sec)*1000000 + (end->tv_nsec - start->tv_nsec)/1000);
+}
+
+/**
+ * Adds a job at the end of the queue, the queue must be locked
+ */
+static void glewlwyd_password_pool_append(struct _glwd_password_pool * password_pool, struct _glwd_password_job * job) {
+  job->next = NULL;
+  if (password_pool->last != NULL) {
+    password_pool->last->next = job;
+  } else {
+    password_pool->first = job;
+  }
+  password_pool->last = job;
+  password_pool->size++;
+}
+
+/**
+ * Removes a job from the queue, the queue must be locked
+ */
+static void glewlwyd_password_pool_remove(struct _glwd_password_pool * password_pool, struct _glwd_password_job * job) {
+  struct _glwd_password_job ** p_job, * previous = NULL;
+
+  for (p_job = &password_pool->first; *p_job != NULL; p_job = &(*p_job)->next) {
+    if (*p_job == job) {
+      *p_job = job->next;
+      if (password_pool->last == job) {
+        password_pool->last = previous;
+      }
+      job->next = NULL;
+      password_pool->size--;
+      break;
+    }
+    previous = *p_job;
+  }
+}
+
+/**
+ * Worker thread, runs the password checks of the queue until the pool is stopped
+ * When the pool is stopped, the remaining jobs are run before the worker ends
+ */
+static void * glewlwyd_password_pool_worker(void * args) {
+  struct config_elements * config = (struct config_elements *)args;
+  struct _glwd_password_pool * password_pool = &config->password_pool;
+  struct _glwd_password_job * job;
+  struct timespec start, end;
+  int result, stop = 0;
+
+  while (!stop) {
+    job = NULL;
+    if (!pthread_mutex_lock(&password_pool->lock)) {
+      while (password_pool->first == NULL && !password_pool->stop) {
+        pthread_cond_wait(&password_pool->cond, &password_pool->lock);
+      }
+      if ((job = password_pool->first) != NULL) {
+        glewlwyd_password_pool_remove(password_pool, job);
+        job->status = GLWD_PASSWORD_JOB_RUNNING;
+      } else {
+        stop = 1;
+      }
+      pthread_mutex_unlock(&password_pool->lock);
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_password_pool_worker - Error lock");
+      stop = 1;
+    }
+    if (job != NULL) {
+      glewlwyd_metrics_gauge_add(password_pool->metrics_depth, -1);
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      glewlwyd_metrics_histogram_observe(password_pool->metrics_wait, glewlwyd_password_pool_elapsed(&job->queued_at, &start));
+      result = job->check(config, job->instance, job->name, job->password);
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      glewlwyd_metrics_histogram_observe(password_pool->metrics_duration, glewlwyd_password_pool_elapsed(&start, &end));
+      if (!pthread_mutex_lock(&password_pool->lock)) {
+        job->result = result;
+        job->status = GLWD_PASSWORD_JOB_DONE;
+        pthread_cond_signal(&job->cond);
+        pthread_mutex_unlock(&password_pool->lock);
+      } else {
+        y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_password_pool_worker - Error lock job");
+      }
+    }
+  }
+  return NULL;
+}
+
+int glewlwyd_password_pool_init(struct config_elements * config) {
+  struct _glwd_password_pool * password_pool = &config->password_pool;
+  int ret = G_OK;
+
+  glewlwyd_metrics_add_metric_type(config, GLWD_METRICS_PASSWORD_POOL_DEPTH, "Number of password checks waiting in the password pool", GLWD_METRICS_TYPE_GAUGE);
+  glewlwyd_metrics_add_metric_type(config, GLWD_METRICS_PASSWORD_POOL_WAIT, "Time spent by password checks waiting in the password pool in seconds", GLWD_METRICS_TYPE_HISTOGRAM);
+  glewlwyd_metrics_add_metric_type(config, GLWD_METRICS_PASSWORD_POOL_DURATION, "Duration of password checks run by the password pool in seconds", GLWD_METRICS_TYPE_HISTOGRAM);
+  glewlwyd_metrics_add_metric(config, GLWD_METRICS_PASSWORD_POOL_REJECTED, "Total number of password checks rejected because the password pool is full or the wait is too long");
+  password_pool->metrics_depth = glewlwyd_metrics_get_gauge(config, GLWD_METRICS_PASSWORD_POOL_DEPTH, NULL);
+  password_pool->metrics_wait = glewlwyd_metrics_get_histogram(config, GLWD_METRICS_PASSWORD_POOL_WAIT, NULL);
+  password_pool->metrics_duration = glewlwyd_metrics_get_histogram(config, GLWD_METRICS_PASSWORD_POOL_DURATION, NULL);
+  password_pool->metrics_rejected = glewlwyd_metrics_get_counter(config, GLWD_METRICS_PASSWORD_POOL_REJECTED, NULL);
+
+  if (password_pool->nb_workers) {
+    password_pool->first = NULL;
+    password_pool->last = NULL;
+    password_pool->size = 0;
+    password_pool->stop = 0;
+    password_pool->nb_workers_started = 0;
+    password_pool->nb_client = 0;
+    if (!password_pool->max_queue) {
+      password_pool->max_queue = password_pool->nb_workers;
+    }
+    if (!password_pool->client_max) {
+      password_pool->client_max = password_pool->max_queue>1?password_pool->max_queue/2:1;
+    }
+    if (!pthread_mutex_init(&password_pool->lock, NULL)) {
+      if (!pthread_cond_init(&password_pool->cond, NULL)) {
+        if ((password_pool->workers = o_malloc(password_pool->nb_workers*sizeof(pthread_t))) != NULL) {
+          password_pool->initialized = 1;
+          for (; password_pool->nb_workers_started<password_pool->nb_workers; password_pool->nb_workers_started++) {
+            if (pthread_create(&password_pool->workers[password_pool->nb_workers_started], NULL, glewlwyd_password_pool_worker, (void *)config)) {
+              y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_password_pool_init - Error pthread_create");
+              ret = G_ERROR;
+              break;
+            }
+          }
+          if (ret == G_OK) {
+            y_log_message(Y_LOG_LEVEL_INFO, "Password pool initialized with %zu workers", password_pool->nb_workers);
+          }
+        } else {
+          y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_password_pool_init - Error allocating resources for workers");
+          pthread_cond_destroy(&password_pool->cond);
+          pthread_mutex_destroy(&password_pool->lock);
+          ret = G_ERROR_MEMORY;
+        }
+      } else {
+        y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_password_pool_init - Error initializing pool cond");
+        pthread_mutex_destroy(&password_pool->lock);
+        ret = G_ERROR;
+      }
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_password_pool_init - Error initializing pool lock");
+      ret = G_ERROR;
+    }
+  }
+  return ret;
+}
+
+/**
+ * Stops the password pool, the jobs waiting in the queue are run before the workers end
+ */
+void glewlwyd_password_pool_close(struct config_elements * config) {
+  struct _glwd_password_pool * password_pool = &config->password_pool;
+  size_t i;
+
+  if (password_pool->initialized) {
+    if (!pthread_mutex_lock(&password_pool->lock)) {
+      password_pool->stop = 1;
+      pthread_cond_broadcast(&password_pool->cond);
+      pthread_mutex_unlock(&password_pool->lock);
+    }
+    for (i=0; i<password_pool->nb_workers_started; i++) {
+      pthread_join(password_pool->workers[i], NULL);
+    }
+    pthread_cond_destroy(&password_pool->cond);
+    pthread_mutex_destroy(&password_pool->lock);
+    o_free(password_pool->workers);
+    password_pool->workers = NULL;
+    password_pool->initialized = 0;
+  }
+}
+
+/**
+ * Runs a password check in a worker of the password pool and waits for its result
+ * If the pool is disabled, the password check is run in the current thread
+ * Returns G_ERROR_UNAVAILABLE without running the check if the queue is full,
+ * if is_client is set and client_max client checks are already queued or running,
+ * or if the check is still in the queue after max_wait milliseconds
+ */
+int glewlwyd_password_pool_run(struct config_elements * config, unsigned short is_client, int (* check)(struct config_elements * config, void * instance, const char * name, const char * password), void * instance, const char * name, const char * password) {
+  struct _glwd_password_pool * password_pool = &config->password_pool;
+  struct _glwd_password_job job;
+  struct timespec abstime;
+  int ret, rejected = 0;
+
+  if (password_pool->initialized) {
+    job.check = check;
+    job.instance = instance;
+    job.name = name;
+    job.password = password;
+    job.is_client = is_client;
+    job.result = G_ERROR;
+    job.status = GLWD_PASSWORD_JOB_QUEUED;
+    job.next = NULL;
+    clock_gettime(CLOCK_MONOTONIC, &job.queued_at);
+    clock_gettime(CLOCK_REALTIME, &abstime);
+    abstime.tv_sec += password_pool->max_wait/1000;
+    abstime.tv_nsec += (long)(password_pool->max_wait%1000)*1000000;
+    if (abstime.tv_nsec >= 1000000000) {
+      abstime.tv_sec++;
+      abstime.tv_nsec -= 1000000000;
+    }
+    if (!pthread_cond_init(&job.cond, NULL)) {
+      if (!pthread_mutex_lock(&password_pool->lock)) {
+        if (!password_pool->stop && password_pool->size < password_pool->max_queue && (!is_client || password_pool->nb_client < password_pool->client_max)) {
+          if (is_client) {
+            password_pool->nb_client++;
+          }
+          glewlwyd_password_pool_append(password_pool, &job);
+          glewlwyd_metrics_gauge_add(password_pool->metrics_depth, 1);
+          pthread_cond_signal(&password_pool->cond);
+          while (job.status != GLWD_PASSWORD_JOB_DONE) {
+            if (job.status == GLWD_PASSWORD_JOB_QUEUED && password_pool->max_wait) {
+              if (pthread_cond_timedwait(&job.cond, &password_pool->lock, &abstime) == ETIMEDOUT && job.status == GLWD_PASSWORD_JOB_QUEUED) {
+                glewlwyd_password_pool_remove(password_pool, &job);
+                glewlwyd_metrics_gauge_add(password_pool->metrics_depth, -1);
+                job.result = G_ERROR_UNAVAILABLE;
+                job.status = GLWD_PASSWORD_JOB_DONE;
+                rejected = 1;
+              }
+            } else {
+              pthread_cond_wait(&job.cond, &password_pool->lock);
+            }
+          }
+          if (is_client) {
+            password_pool->nb_client--;
+          }
+          ret = job.result;
+        } else {
+          ret = G_ERROR_UNAVAILABLE;
+          rejected = 1;
+        }
+        pthread_mutex_unlock(&password_pool->lock);
+        if (rejected) {
+          y_log_message(Y_LOG_LEVEL_WARNING, "glewlwyd_password_pool_run - Password pool busy, password check rejected");
+          glewlwyd_metrics_counter_add(password_pool->metrics_rejected, 1);
+        }
+      } else {
+        y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_password_pool_run - Error lock");
+        ret = G_ERROR;
+      }
+      pthread_cond_destroy(&job.cond);
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_password_pool_run - Error initializing job cond");
+      ret = G_ERROR;
+    }
+  } else {
+    ret = check(config, instance, name, password);
+  }
+  return ret;
+}
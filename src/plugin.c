@@ -36,8 +36,8 @@ int glewlwyd_callback_add_plugin_endpoint(struct config_plugin * config, const c
   if (config != NULL && config->glewlwyd_config != NULL && config->glewlwyd_config->instance != NULL && method != NULL && name != NULL && url != NULL && callback != NULL && 0 != o_strncasecmp(name, "auth", o_strlen("auth"))) {
     p_url = msprintf("%s/%s", name, url);
     if (p_url != NULL) {
-      if ((ret = ulfius_add_endpoint_by_val(config->glewlwyd_config->instance, method, config->glewlwyd_config->api_prefix, p_url, GLEWLWYD_CALLBACK_PRIORITY_PLUGIN + priority, callback, user_data)) != U_OK) {
-        y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_callback_add_plugin_endpoint - Error %d ulfius_add_endpoint_by_val %s - %s/%s",ret, method, config->glewlwyd_config->api_prefix, p_url);
+      if ((ret = glewlwyd_metrics_add_endpoint(config->glewlwyd_config, config->glewlwyd_config->instance, method, config->glewlwyd_config->api_prefix, p_url, GLEWLWYD_CALLBACK_PRIORITY_PLUGIN + priority, callback, user_data)) != U_OK) {
+        y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_callback_add_plugin_endpoint - Error %d glewlwyd_metrics_add_endpoint %s - %s/%s",ret, method, config->glewlwyd_config->api_prefix, p_url);
         ret = G_ERROR;
       } else {
         y_log_message(Y_LOG_LEVEL_INFO, "Add endpoint %s %s/%s", method, config->glewlwyd_config->api_prefix, p_url);
@@ -81,24 +81,26 @@ int glewlwyd_callback_remove_plugin_endpoint(struct config_plugin * config, cons
   return ret;
 }
 
-json_t * glewlwyd_callback_check_session_valid(struct config_plugin * config, const struct _u_request * request, const char * scope_list) {
+/**
+ * Checks the session authentication state j_state against scope_list
+ * The session tables aren't queried again, so the state can be shared with the caller
+ */
+static json_t * check_session_valid_from_auth_state(struct config_plugin * config, json_t * j_state, const char * scope_list) {
   json_t * j_user, * j_return, * j_scope_allowed;
-  char * session_uid = NULL;
   
-  if (config != NULL && request != NULL) {
-    session_uid = get_session_id(config->glewlwyd_config, request);
-    j_user = get_current_user_for_session(config->glewlwyd_config, session_uid);
+  if (check_result_value(j_state, G_OK)) {
+    j_user = get_user(config->glewlwyd_config, json_string_value(json_object_get(json_object_get(j_state, "session"), "username")), NULL);
     // Check if session is valid
     if (check_result_value(j_user, G_OK)) {
       if (o_strlen(scope_list)) {
         // For all allowed scope, check that the current session has a valid session
-        j_scope_allowed = get_validated_auth_scheme_list_from_scope_list(config->glewlwyd_config, scope_list, session_uid);
+        j_scope_allowed = get_validated_auth_scheme_list_from_session_auth_state(config->glewlwyd_config, scope_list, j_state);
         if (check_result_value(j_scope_allowed, G_OK)) {
           j_return = json_pack("{sis{sOsO}}", "result", G_OK, "session", "scope", json_object_get(j_scope_allowed, "scheme"), "user", json_object_get(j_user, "user"));
         } else if (check_result_value(j_scope_allowed, G_ERROR_UNAUTHORIZED) || check_result_value(j_scope_allowed, G_ERROR_NOT_FOUND)) {
           j_return = json_pack("{sis{sO}}", "result", G_ERROR_UNAUTHORIZED, "session", "user", json_object_get(j_user, "user"));
         } else {
-          y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_callback_check_session_valid - Error get_validated_auth_scheme_list_from_scope_list");
+          y_log_message(Y_LOG_LEVEL_ERROR, "check_session_valid_from_auth_state - Error get_validated_auth_scheme_list_from_session_auth_state");
           j_return = json_pack("{si}", "result", G_ERROR);
         }
         json_decref(j_scope_allowed);
@@ -108,10 +110,28 @@ json_t * glewlwyd_callback_check_session_valid(struct config_plugin * config, co
     } else if (check_result_value(j_user, G_ERROR_NOT_FOUND)) {
       j_return = json_pack("{si}", "result", G_ERROR_NOT_FOUND);
     } else {
-      y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_callback_check_session_valid - Error get_current_user_for_session");
+      y_log_message(Y_LOG_LEVEL_ERROR, "check_session_valid_from_auth_state - Error get_user");
       j_return = json_pack("{si}", "result", G_ERROR);
     }
     json_decref(j_user);
+  } else if (check_result_value(j_state, G_ERROR_NOT_FOUND)) {
+    j_return = json_pack("{si}", "result", G_ERROR_NOT_FOUND);
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "check_session_valid_from_auth_state - Error get_session_auth_state");
+    j_return = json_pack("{si}", "result", G_ERROR);
+  }
+  return j_return;
+}
+
+json_t * glewlwyd_callback_check_session_valid(struct config_plugin * config, const struct _u_request * request, const char * scope_list) {
+  json_t * j_state, * j_return;
+  char * session_uid = NULL;
+  
+  if (config != NULL && request != NULL) {
+    session_uid = get_session_id(config->glewlwyd_config, request);
+    j_state = get_session_auth_state(config->glewlwyd_config, session_uid);
+    j_return = check_session_valid_from_auth_state(config, j_state, scope_list);
+    json_decref(j_state);
   } else {
     j_return = json_pack("{si}", "result", G_ERROR_PARAM);
   }
@@ -121,7 +141,7 @@ json_t * glewlwyd_callback_check_session_valid(struct config_plugin * config, co
 
 json_t * glewlwyd_callback_check_user_valid(struct config_plugin * config, const char * username, const char * password, const char * scope) {
   json_t * j_user, * j_return, * j_auth, * j_element, * j_scope;
-  int check_password, check_scope;
+  int check_password, check_scope, unavailable = 0;
   char ** scope_array = NULL, * scope_list = NULL, * tmp;
   size_t index;
 
@@ -133,6 +153,7 @@ json_t * glewlwyd_callback_check_user_valid(struct config_plugin * config, const
         j_auth = auth_check_user_credentials(config->glewlwyd_config, username, password);
         if (!check_result_value(j_auth, G_OK)) {
           check_password = 0;
+          unavailable = check_result_value(j_auth, G_ERROR_UNAVAILABLE);
         }
         json_decref(j_auth);
       }
@@ -173,6 +194,8 @@ json_t * glewlwyd_callback_check_user_valid(struct config_plugin * config, const
       }
       if (check_password && check_scope) {
         j_return = json_pack("{sisO}", "result", G_OK, "user", json_object_get(j_user, "user"));
+      } else if (unavailable) {
+        j_return = json_pack("{si}", "result", G_ERROR_UNAVAILABLE);
       } else {
         j_return = json_pack("{si}", "result", G_ERROR_UNAUTHORIZED);
       }
@@ -192,7 +215,7 @@ json_t * glewlwyd_callback_check_user_valid(struct config_plugin * config, const
 
 json_t * glewlwyd_callback_check_client_valid(struct config_plugin * config, const char * client_id, const char * password) {
   json_t * j_return, * j_client, * j_client_credentials;
-  int password_checked = 1;
+  int password_checked = 1, unavailable = 0;
 
   if (config != NULL && client_id != NULL) {
     j_client = get_client(config->glewlwyd_config, client_id, NULL);
@@ -206,12 +229,15 @@ json_t * glewlwyd_callback_check_client_valid(struct config_plugin * config, con
           j_client_credentials = auth_check_client_credentials(config->glewlwyd_config, client_id, password);
           if (!check_result_value(j_client_credentials, G_OK)) {
             password_checked = 0;
+            unavailable = check_result_value(j_client_credentials, G_ERROR_UNAVAILABLE);
           }
           json_decref(j_client_credentials);
         }
       }
       if (password_checked) {
         j_return = json_pack("{sisO}", "result", G_OK, "client", json_object_get(j_client, "client"));
+      } else if (unavailable) {
+        j_return = json_pack("{si}", "result", G_ERROR_UNAVAILABLE);
       } else {
         j_return = json_pack("{si}", "result", G_ERROR_UNAUTHORIZED);
       }
@@ -243,50 +269,56 @@ json_t * glewlwyd_callback_get_client_granted_scopes(struct config_plugin * conf
 }
 
 int glewlwyd_callback_trigger_session_used(struct config_plugin * config, const struct _u_request * request, const char * scope_list) {
-  json_t * j_session = glewlwyd_callback_check_session_valid(config, request, scope_list), * j_query, * j_scope, * j_scheme_processed, * j_group, * j_scheme;
-  char * session_uid = get_session_id(config->glewlwyd_config, request), * session_hash = NULL, * clause_session, * username_escaped, * clause_scheme, * escape_scheme_module, * escape_scheme_name;
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config->glewlwyd_config);
+  char * session_uid = get_session_id(config->glewlwyd_config, request), * clause_session, * username_escaped, * clause_scheme, * escape_scheme_module, * escape_scheme_name;
+  json_t * j_state = get_session_auth_state(config->glewlwyd_config, session_uid), * j_session = check_session_valid_from_auth_state(config, j_state, scope_list), * j_query, * j_scope, * j_scheme_processed, * j_group, * j_scheme;
   int ret, res, password_processed = 0;
-  const char * key_scope, * key_group;
+  const char * key_scope, * key_group, * username, * session_hash;
+  struct _user_auth_scheme_module_instance * scheme_instance;
   size_t index;
 
   if (check_result_value(j_session, G_OK) || session_uid == NULL) {
-    if ((session_hash = generate_hash(config->glewlwyd_config->hash_algorithm, session_uid)) != NULL) {
+    if ((session_hash = json_string_value(json_object_get(j_state, "session_hash"))) != NULL) {
       j_scheme_processed = json_object();
       if (j_scheme_processed != NULL) {
         ret = G_OK;
-        username_escaped = h_escape_string_with_quotes(config->glewlwyd_config->conn, json_string_value(json_object_get(json_object_get(json_object_get(j_session, "session"), "user"), "username")));
-        clause_session = msprintf("IN (SELECT gus_id FROM " GLEWLWYD_TABLE_USER_SESSION " WHERE gus_session_hash='%s' AND gus_username=%s AND gus_expiration %s AND gus_enabled=1 AND gus_current=1)", session_hash, username_escaped, SWITCH_DB_TYPE(config->glewlwyd_config->conn->type, "> NOW()", "> (strftime('%s','now'))", "> NOW()"));
+        username = json_string_value(json_object_get(json_object_get(json_object_get(j_session, "session"), "user"), "username"));
+        username_escaped = h_escape_string_with_quotes(conn, username);
+        clause_session = msprintf("IN (SELECT gus_id FROM " GLEWLWYD_TABLE_USER_SESSION " WHERE gus_session_hash='%s' AND gus_username=%s AND gus_expiration %s AND gus_enabled=1 AND gus_current=1)", session_hash, username_escaped, SWITCH_DB_TYPE(conn->type, "> NOW()", "> (strftime('%s','now'))", "> NOW()"));
         json_object_foreach(json_object_get(json_object_get(j_session, "session"), "scope"), key_scope, j_scope) {
           if (!password_processed && json_object_get(j_scope, "password_authenticated") == json_true()) {
             password_processed = 1;
             // Increment guss_use_counter for the password scheme on the specified session
-            j_query = json_pack("{sss{s{ss}}s{sOs{ssss}sis{ssss}}}",
-                                "table",
-                                GLEWLWYD_TABLE_USER_SESSION_SCHEME,
-                                "set",
-                                  "guss_use_counter",
-                                    "raw",
-                                    "(guss_use_counter + 1)",
-                                "where",
-                                  "guasmi_id",
-                                  json_null(),
-                                  "gus_id",
-                                    "operator",
-                                    "raw",
-                                    "value",
-                                    clause_session,
-                                  "guss_enabled",
-                                  1,
-                                  "guss_expiration",
-                                    "operator",
-                                    "raw",
-                                    "value",
-                                    SWITCH_DB_TYPE(config->glewlwyd_config->conn->type, "> NOW()", "> (strftime('%s','now'))", "> NOW()"));
-            res = h_update(config->glewlwyd_config->conn, j_query, NULL);
-            json_decref(j_query);
-            if (res != H_OK) {
-              y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_callback_trigger_session_used - Error h_update for password scheme");
-              ret = G_ERROR_DB;
+            // The counter is written later if the session usage write-behind is enabled
+            if (glewlwyd_session_usage_add(config->glewlwyd_config, session_hash, username, 0) != G_OK) {
+              j_query = json_pack("{sss{s{ss}}s{sOs{ssss}sis{ssss}}}",
+                                  "table",
+                                  GLEWLWYD_TABLE_USER_SESSION_SCHEME,
+                                  "set",
+                                    "guss_use_counter",
+                                      "raw",
+                                      "(guss_use_counter + 1)",
+                                  "where",
+                                    "guasmi_id",
+                                    json_null(),
+                                    "gus_id",
+                                      "operator",
+                                      "raw",
+                                      "value",
+                                      clause_session,
+                                    "guss_enabled",
+                                    1,
+                                    "guss_expiration",
+                                      "operator",
+                                      "raw",
+                                      "value",
+                                      SWITCH_DB_TYPE(conn->type, "> NOW()", "> (strftime('%s','now'))", "> NOW()"));
+              res = h_update(conn, j_query, NULL);
+              json_decref(j_query);
+              if (res != H_OK) {
+                y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_callback_trigger_session_used - Error h_update for password scheme");
+                ret = G_ERROR_DB;
+              }
             }
           }
           json_object_foreach(json_object_get(j_scope, "schemes"), key_group, j_group) {
@@ -294,42 +326,45 @@ int glewlwyd_callback_trigger_session_used(struct config_plugin * config, const
               if (json_object_get(j_scheme, "scheme_authenticated") == json_true() && json_object_get(j_scheme_processed, json_string_value(json_object_get(j_scheme, "scheme_name"))) == NULL) {
                 json_object_set_new(j_scheme_processed, json_string_value(json_object_get(j_scheme, "scheme_name")), json_object());
                 // Increment guss_use_counter for the specified scheme on the specified session
-                escape_scheme_module = h_escape_string_with_quotes(config->glewlwyd_config->conn, json_string_value(json_object_get(j_scheme, "scheme_type")));
-                escape_scheme_name = h_escape_string_with_quotes(config->glewlwyd_config->conn, json_string_value(json_object_get(j_scheme, "scheme_name")));
-                clause_scheme = msprintf("IN (SELECT guasmi_id FROM " GLEWLWYD_TABLE_USER_AUTH_SCHEME_MODULE_INSTANCE " WHERE guasmi_module=%s AND guasmi_name=%s)", escape_scheme_module, escape_scheme_name);
-                j_query = json_pack("{sss{s{ss}}s{s{ssss}s{ssss}sis{ssss}}}",
-                                    "table",
-                                    GLEWLWYD_TABLE_USER_SESSION_SCHEME,
-                                    "set",
-                                      "guss_use_counter",
-                                        "raw",
-                                        "(guss_use_counter + 1)",
-                                    "where",
-                                      "guasmi_id",
-                                        "operator",
-                                        "raw",
-                                        "value",
-                                        clause_scheme,
-                                      "gus_id",
-                                        "operator",
-                                        "raw",
-                                        "value",
-                                        clause_session,
-                                      "guss_enabled",
-                                      1,
-                                      "guss_expiration",
-                                        "operator",
-                                        "raw",
-                                        "value",
-                                        SWITCH_DB_TYPE(config->glewlwyd_config->conn->type, "> NOW()", "> (strftime('%s','now'))", "> NOW()"));
-                o_free(clause_scheme);
-                o_free(escape_scheme_name);
-                o_free(escape_scheme_module);
-                res = h_update(config->glewlwyd_config->conn, j_query, NULL);
-                json_decref(j_query);
-                if (res != H_OK) {
-                  y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_callback_trigger_session_used - Error h_update for scheme %s/%s", json_string_value(json_object_get(j_scheme, "scheme_type")), json_string_value(json_object_get(j_scheme, "scheme_name")));
-                  ret = G_ERROR_DB;
+                scheme_instance = get_user_auth_scheme_module_instance(config->glewlwyd_config, json_string_value(json_object_get(j_scheme, "scheme_name")));
+                if (scheme_instance == NULL || glewlwyd_session_usage_add(config->glewlwyd_config, session_hash, username, scheme_instance->guasmi_id) != G_OK) {
+                  escape_scheme_module = h_escape_string_with_quotes(conn, json_string_value(json_object_get(j_scheme, "scheme_type")));
+                  escape_scheme_name = h_escape_string_with_quotes(conn, json_string_value(json_object_get(j_scheme, "scheme_name")));
+                  clause_scheme = msprintf("IN (SELECT guasmi_id FROM " GLEWLWYD_TABLE_USER_AUTH_SCHEME_MODULE_INSTANCE " WHERE guasmi_module=%s AND guasmi_name=%s)", escape_scheme_module, escape_scheme_name);
+                  j_query = json_pack("{sss{s{ss}}s{s{ssss}s{ssss}sis{ssss}}}",
+                                      "table",
+                                      GLEWLWYD_TABLE_USER_SESSION_SCHEME,
+                                      "set",
+                                        "guss_use_counter",
+                                          "raw",
+                                          "(guss_use_counter + 1)",
+                                      "where",
+                                        "guasmi_id",
+                                          "operator",
+                                          "raw",
+                                          "value",
+                                          clause_scheme,
+                                        "gus_id",
+                                          "operator",
+                                          "raw",
+                                          "value",
+                                          clause_session,
+                                        "guss_enabled",
+                                        1,
+                                        "guss_expiration",
+                                          "operator",
+                                          "raw",
+                                          "value",
+                                          SWITCH_DB_TYPE(conn->type, "> NOW()", "> (strftime('%s','now'))", "> NOW()"));
+                  o_free(clause_scheme);
+                  o_free(escape_scheme_name);
+                  o_free(escape_scheme_module);
+                  res = h_update(conn, j_query, NULL);
+                  json_decref(j_query);
+                  if (res != H_OK) {
+                    y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_callback_trigger_session_used - Error h_update for scheme %s/%s", json_string_value(json_object_get(j_scheme, "scheme_type")), json_string_value(json_object_get(j_scheme, "scheme_name")));
+                    ret = G_ERROR_DB;
+                  }
                 }
               }
             }
@@ -343,20 +378,22 @@ int glewlwyd_callback_trigger_session_used(struct config_plugin * config, const
         ret = G_ERROR;
       }
     } else {
-      y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_callback_trigger_session_used - Error generate_hash");
+      y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_callback_trigger_session_used - Error session_hash");
       ret = G_ERROR;
     }
-    o_free(session_hash);
   } else {
-    y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_callback_trigger_session_used - Error glewlwyd_callback_check_session_valid or session_uid NULL");
+    y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_callback_trigger_session_used - Error check_session_valid_from_auth_state or session_uid NULL");
     ret = G_ERROR;
   }
   json_decref(j_session);
+  json_decref(j_state);
   o_free(session_uid);
+  glewlwyd_db_pool_release(config->glewlwyd_config, conn);
   return ret;
 }
 
 time_t glewlwyd_callback_get_session_age(struct config_plugin * config, const struct _u_request * request, const char * scope_list) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config->glewlwyd_config);
   time_t age = 0;
   char * session_uid = get_session_id(config->glewlwyd_config, request), * session_uid_hash, * query, ** scope_array = NULL, * scope_escaped, * scope_list_clause = NULL;
   json_t * j_result;
@@ -366,7 +403,7 @@ time_t glewlwyd_callback_get_session_age(struct config_plugin * config, const st
     if (session_uid_hash != NULL) {
       if (split_string(scope_list, " ", &scope_array)) {
         for (int i=0; scope_array[i] != NULL; i++) {
-          scope_escaped = h_escape_string_with_quotes(config->glewlwyd_config->conn, scope_array[i]);
+          scope_escaped = h_escape_string_with_quotes(conn, scope_array[i]);
           if (scope_list_clause == NULL) {
             scope_list_clause = msprintf("%s", scope_escaped);
           } else {
@@ -376,8 +413,8 @@ time_t glewlwyd_callback_get_session_age(struct config_plugin * config, const st
         }
         if (scope_list_clause != NULL) {
           // Quey to retreive the most recent, enabled and succeeded authentication date for the current session
-          query = msprintf("SELECT %s FROM " GLEWLWYD_TABLE_USER_SESSION_SCHEME " WHERE guss_enabled=1 AND gus_id IN (SELECT gus_id FROM " GLEWLWYD_TABLE_USER_SESSION " WHERE gus_session_hash='%s' AND gus_current=1) AND (guasmi_id IS NULL OR guasmi_id IN (SELECT guasmi_id FROM " GLEWLWYD_TABLE_SCOPE_GROUP_AUTH_SCHEME_MODULE_INSTANCE " WHERE gsg_id IN (SELECT gsg_id FROM " GLEWLWYD_TABLE_SCOPE_GROUP " WHERE gs_id IN (SELECT gs_id FROM " GLEWLWYD_TABLE_SCOPE " WHERE gs_name IN (%s))))) ORDER BY guss_last_login DESC LIMIT 1;", (SWITCH_DB_TYPE(config->glewlwyd_config->conn->type, "UNIX_TIMESTAMP(guss_last_login) AS guss_last_login", "guss_last_login", "EXTRACT(EPOCH FROM guss_last_login)::integer AS guss_last_login")), session_uid_hash, scope_list_clause);
-          if (h_execute_query_json(config->glewlwyd_config->conn, query, &j_result) == H_OK) {
+          query = msprintf("SELECT %s FROM " GLEWLWYD_TABLE_USER_SESSION_SCHEME " WHERE guss_enabled=1 AND gus_id IN (SELECT gus_id FROM " GLEWLWYD_TABLE_USER_SESSION " WHERE gus_session_hash='%s' AND gus_current=1) AND (guasmi_id IS NULL OR guasmi_id IN (SELECT guasmi_id FROM " GLEWLWYD_TABLE_SCOPE_GROUP_AUTH_SCHEME_MODULE_INSTANCE " WHERE gsg_id IN (SELECT gsg_id FROM " GLEWLWYD_TABLE_SCOPE_GROUP " WHERE gs_id IN (SELECT gs_id FROM " GLEWLWYD_TABLE_SCOPE " WHERE gs_name IN (%s))))) ORDER BY guss_last_login DESC LIMIT 1;", (SWITCH_DB_TYPE(conn->type, "UNIX_TIMESTAMP(guss_last_login) AS guss_last_login", "guss_last_login", "EXTRACT(EPOCH FROM guss_last_login)::integer AS guss_last_login")), session_uid_hash, scope_list_clause);
+          if (h_execute_query_json(conn, query, &j_result) == H_OK) {
             if (json_array_size(j_result)) {
               age = (time_t)json_integer_value(json_object_get(json_array_get(j_result, 0), "guss_last_login"));
             }
@@ -398,6 +435,7 @@ time_t glewlwyd_callback_get_session_age(struct config_plugin * config, const st
     o_free(session_uid_hash);
   }
   o_free(session_uid);
+  glewlwyd_db_pool_release(config->glewlwyd_config, conn);
   return age;
 }
 
@@ -616,31 +654,45 @@ int glewlwyd_plugin_callback_metrics_add_metric(struct config_plugin * config, c
 
 int glewlwyd_plugin_callback_metrics_increment_counter(struct config_plugin * config, const char * name, size_t inc, ...) {
   va_list vl;
-  const char * label_arg;
   char * label = NULL;
-  int ret = G_OK, flag = 0;
+  int ret = G_OK;
 
   if (config != NULL && o_strlen(name)) {
-    va_start(vl, inc);
-    for (label_arg = va_arg(vl, const char *); label_arg != NULL && ret == G_OK; label_arg = va_arg(vl, const char *)) {
-      if (!flag) {
-        if (label == NULL) {
-          label = msprintf("%s=", label_arg);
-        } else {
-          label = mstrcatf(label, ", %s=", label_arg);
-        }
-      } else {
-        label = mstrcatf(label, "%s", label_arg);
-      }
-      flag = !flag;
+    if (config->glewlwyd_config->metrics_endpoint) {
+      va_start(vl, inc);
+      label = glewlwyd_metrics_build_label(vl);
+      va_end(vl);
+      
+      ret = glewlwyd_metrics_increment_counter(config->glewlwyd_config, name, label, inc);
+      o_free(label);
     }
-    va_end(vl);
-    
-    ret = glewlwyd_metrics_increment_counter(config->glewlwyd_config, name, label, inc);
-    o_free(label);
   } else {
     y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_plugin_callback_metrics_increment_counter - Error input values");
     ret = G_ERROR_PARAM;
   }
   return ret;
 }
+
+struct _glwd_metrics_data * glewlwyd_plugin_callback_metrics_get_counter(struct config_plugin * config, const char * name, ...) {
+  va_list vl;
+  char * label = NULL;
+  struct _glwd_metrics_data * counter = NULL;
+
+  if (config != NULL && o_strlen(name)) {
+    if (config->glewlwyd_config->metrics_endpoint) {
+      va_start(vl, name);
+      label = glewlwyd_metrics_build_label(vl);
+      va_end(vl);
+      
+      counter = glewlwyd_metrics_get_counter(config->glewlwyd_config, name, label);
+      o_free(label);
+    }
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_plugin_callback_metrics_get_counter - Error input values");
+  }
+  return counter;
+}
+
+void glewlwyd_plugin_callback_metrics_counter_add(struct _glwd_metrics_data * counter, size_t inc) {
+  glewlwyd_metrics_counter_add(counter, inc);
+}
@@ -41,6 +41,9 @@
 #define GLEWLWYD_ACCESS_TOKEN_EXP_DEFAULT 3600
 #define GLEWLWYD_REFRESH_TOKEN_EXP_DEFAULT 1209600
 #define GLEWLWYD_CODE_EXP_DEFAULT 600
+#define GLEWLWYD_REAPER_RETENTION_DEFAULT 86400
+#define GLEWLWYD_REAPER_BATCH_SIZE_DEFAULT 500
+#define GLEWLWYD_REAPER_BATCH_DELAY_DEFAULT 100
 #define GLEWLWYD_CODE_CHALLENGE_MAX_LENGTH 128
 #define GLEWLWYD_CODE_CHALLENGE_S256_PREFIX "{SHA256}"
 
@@ -267,6 +270,22 @@ static json_t * check_parameters (json_t * j_params) {
         ret = G_ERROR_PARAM;
       }
     }
+    if (json_object_get(j_params, "reaper-interval") != NULL && (!json_is_integer(json_object_get(j_params, "reaper-interval")) || json_integer_value(json_object_get(j_params, "reaper-interval")) < 0)) {
+      json_array_append_new(j_error, json_string("Property 'reaper-interval' is optional and must be a positive integer"));
+      ret = G_ERROR_PARAM;
+    }
+    if (json_object_get(j_params, "reaper-retention") != NULL && (!json_is_integer(json_object_get(j_params, "reaper-retention")) || json_integer_value(json_object_get(j_params, "reaper-retention")) < 0)) {
+      json_array_append_new(j_error, json_string("Property 'reaper-retention' is optional and must be a positive integer"));
+      ret = G_ERROR_PARAM;
+    }
+    if (json_object_get(j_params, "reaper-batch-size") != NULL && (!json_is_integer(json_object_get(j_params, "reaper-batch-size")) || json_integer_value(json_object_get(j_params, "reaper-batch-size")) < 0)) {
+      json_array_append_new(j_error, json_string("Property 'reaper-batch-size' is optional and must be a positive integer"));
+      ret = G_ERROR_PARAM;
+    }
+    if (json_object_get(j_params, "reaper-batch-delay") != NULL && (!json_is_integer(json_object_get(j_params, "reaper-batch-delay")) || json_integer_value(json_object_get(j_params, "reaper-batch-delay")) < 0)) {
+      json_array_append_new(j_error, json_string("Property 'reaper-batch-delay' is optional and must be a positive integer"));
+      ret = G_ERROR_PARAM;
+    }
     if (json_array_size(j_error) && ret == G_ERROR_PARAM) {
       j_return = json_pack("{sisO}", "result", G_ERROR_PARAM, "error", j_error);
     } else {
@@ -1229,6 +1248,7 @@ static json_t * validate_session_client_scope(struct _oauth2_config * config, co
 }
 
 static json_t * validate_refresh_token(struct _oauth2_config * config, const char * refresh_token) {
+  struct _h_connection * conn;
   json_t * j_return, * j_query, * j_result, * j_result_scope, * j_element = NULL;
   char * token_hash, * expires_at_clause;
   int res;
@@ -1272,7 +1292,9 @@ static json_t * validate_refresh_token(struct _oauth2_config * config, const cha
                               "value",
                               expires_at_clause);
       o_free(expires_at_clause);
-      res = h_select(config->glewlwyd_config->glewlwyd_config->conn, j_query, &j_result, NULL);
+      conn = config->glewlwyd_config->glewlwyd_plugin_callback_db_acquire(config->glewlwyd_config);
+      res = h_select(conn, j_query, &j_result, NULL);
+      config->glewlwyd_config->glewlwyd_plugin_callback_db_release(config->glewlwyd_config, conn);
       json_decref(j_query);
       if (res == H_OK) {
         if (json_array_size(j_result) > 0) {
@@ -1286,7 +1308,9 @@ static json_t * validate_refresh_token(struct _oauth2_config * config, const cha
                               "where",
                                 "gpgr_id",
                                 json_object_get(json_array_get(j_result, 0), "gpgr_id"));
-          res = h_select(config->glewlwyd_config->glewlwyd_config->conn, j_query, &j_result_scope, NULL);
+          conn = config->glewlwyd_config->glewlwyd_plugin_callback_db_acquire(config->glewlwyd_config);
+          res = h_select(conn, j_query, &j_result_scope, NULL);
+          config->glewlwyd_config->glewlwyd_plugin_callback_db_release(config->glewlwyd_config, conn);
           json_decref(j_query);
           if (res == H_OK) {
             if (!json_object_set_new(json_array_get(j_result, 0), "scope", json_array())) {
@@ -1473,6 +1497,7 @@ static int refresh_token_disable(struct _oauth2_config * config, const char * us
 }
 
 static int update_refresh_token(struct _oauth2_config * config, json_int_t gpgr_id, json_int_t refresh_token_duration, int disable, time_t now) {
+  struct _h_connection * conn;
   json_t * j_query;
   int res, ret;
   char * expires_at_clause, * last_seen_clause;
@@ -1511,7 +1536,9 @@ static int update_refresh_token(struct _oauth2_config * config, json_int_t gpgr_
   if (disable) {
     json_object_set_new(json_object_get(j_query, "set"), "gpgr_enabled", json_integer(0));
   }
-  res = h_update(config->glewlwyd_config->glewlwyd_config->conn, j_query, NULL);
+  conn = config->glewlwyd_config->glewlwyd_plugin_callback_db_acquire(config->glewlwyd_config);
+  res = h_update(conn, j_query, NULL);
+  config->glewlwyd_config->glewlwyd_plugin_callback_db_release(config->glewlwyd_config, conn);
   json_decref(j_query);
   if (res == H_OK) {
     ret = G_OK;
@@ -2781,6 +2808,8 @@ static int check_auth_type_resource_owner_pwd_cred (const struct _u_request * re
       }
     } else if (check_result_value(j_client, G_ERROR_NOT_FOUND) || check_result_value(j_client, G_ERROR_UNAUTHORIZED)) {
       ret = G_ERROR_PARAM;
+    } else if (check_result_value(j_client, G_ERROR_UNAVAILABLE)) {
+      ret = G_ERROR_UNAVAILABLE;
     } else {
       y_log_message(Y_LOG_LEVEL_ERROR, "check_auth_type_resource_owner_pwd_cred - oauth2 - Error glewlwyd_callback_check_client_valid");
       ret = G_ERROR;
@@ -2893,6 +2922,9 @@ static int check_auth_type_resource_owner_pwd_cred (const struct _u_request * re
       y_log_message(Y_LOG_LEVEL_DEBUG, "check_auth_type_resource_owner_pwd_cred - oauth2 - Error user '%s'", username);
       y_log_message(Y_LOG_LEVEL_WARNING, "Security - Authorization invalid for username %s at IP Address %s", username, ip_source);
       response->status = 403;
+    } else if (check_result_value(j_user, G_ERROR_UNAVAILABLE)) {
+      u_map_put(response->map_header, "Retry-After", "1");
+      response->status = 503;
     } else {
       y_log_message(Y_LOG_LEVEL_ERROR, "check_auth_type_resource_owner_pwd_cred - oauth2 - glewlwyd_callback_check_user_valid");
       response->status = 403;
@@ -2900,6 +2932,9 @@ static int check_auth_type_resource_owner_pwd_cred (const struct _u_request * re
     json_decref(j_user);
   } else if (ret == G_ERROR_PARAM) {
     response->status = 400;
+  } else if (ret == G_ERROR_UNAVAILABLE) {
+    u_map_put(response->map_header, "Retry-After", "1");
+    response->status = 503;
   } else {
     response->status = 500;
   }
@@ -3568,6 +3603,64 @@ static int jwt_autocheck(struct _oauth2_config * config) {
   return ret;
 }
 
+/**
+ * Starts the core reaper that deletes the expired codes and tokens of this plugin instance
+ * Rows are kept reaper-retention seconds after their expiration
+ * Codes linked to a refresh token are kept
+ * Refresh tokens are kept until the access tokens issued from them expire, since deleting them deletes those access tokens
+ */
+static int start_reaper(struct _oauth2_config * config) {
+  json_t * j_tasks;
+  json_int_t retention = GLEWLWYD_REAPER_RETENTION_DEFAULT, batch_size = GLEWLWYD_REAPER_BATCH_SIZE_DEFAULT, batch_delay = GLEWLWYD_REAPER_BATCH_DELAY_DEFAULT;
+  int ret;
+
+  if (json_object_get(config->j_params, "reaper-retention") != NULL) {
+    retention = json_integer_value(json_object_get(config->j_params, "reaper-retention"));
+  }
+  if (json_integer_value(json_object_get(config->j_params, "reaper-batch-size")) > 0) {
+    batch_size = json_integer_value(json_object_get(config->j_params, "reaper-batch-size"));
+  }
+  if (json_object_get(config->j_params, "reaper-batch-delay") != NULL) {
+    batch_delay = json_integer_value(json_object_get(config->j_params, "reaper-batch-delay"));
+  }
+  j_tasks = json_pack("[{sssssssIs{ss}}{sssssssIs{sss{ssss}}}{sssssssIs{ss}}{sssssssIs{ss}}]",
+                      "table", GLEWLWYD_PLUGIN_OAUTH2_TABLE_REFRESH_TOKEN,
+                      "id", "gpgr_id",
+                      "date", "gpgr_expires_at",
+                      "age", config->access_token_duration + retention,
+                      "where",
+                        "gpgr_plugin_name", config->name,
+                      "table", GLEWLWYD_PLUGIN_OAUTH2_TABLE_CODE,
+                      "id", "gpgc_id",
+                      "date", "gpgc_expires_at",
+                      "age", retention,
+                      "where",
+                        "gpgc_plugin_name", config->name,
+                        "gpgc_id",
+                          "operator", "raw",
+                          "value", "NOT IN (SELECT gpgc_id FROM " GLEWLWYD_PLUGIN_OAUTH2_TABLE_REFRESH_TOKEN " WHERE gpgc_id IS NOT NULL)",
+                      "table", GLEWLWYD_PLUGIN_OAUTH2_TABLE_ACCESS_TOKEN,
+                      "id", "gpga_id",
+                      "date", "gpga_issued_at",
+                      "age", config->access_token_duration + retention,
+                      "where",
+                        "gpga_plugin_name", config->name,
+                      "table", GLEWLWYD_PLUGIN_OAUTH2_TABLE_DEVICE_AUTHORIZATION,
+                      "id", "gpgda_id",
+                      "date", "gpgda_expires_at",
+                      "age", retention,
+                      "where",
+                        "gpgda_plugin_name", config->name);
+  ret = config->glewlwyd_config->glewlwyd_plugin_callback_reaper_start(config->glewlwyd_config,
+                                                                       config->name,
+                                                                       j_tasks,
+                                                                       (unsigned int)json_integer_value(json_object_get(config->j_params, "reaper-interval")),
+                                                                       (unsigned int)batch_size,
+                                                                       (unsigned int)batch_delay);
+  json_decref(j_tasks);
+  return ret;
+}
+
 json_t * plugin_module_load(struct config_plugin * config) {
   UNUSED(config);
   return json_pack("{si ss ss ss}",
@@ -3876,6 +3969,11 @@ json_t * plugin_module_init(struct config_plugin * config, const char * name, js
       if (json_object_get(p_config->j_params, "introspection-revocation-allowed") == json_true()) {
         config->glewlwyd_plugin_callback_metrics_increment_counter(config, GLWD_METRICS_OAUTH2_INVALID_ACCESS_TOKEN, 0, "plugin", name, NULL);
       }
+      if (json_integer_value(json_object_get(p_config->j_params, "reaper-interval")) > 0 && start_reaper(p_config) != G_OK) {
+        y_log_message(Y_LOG_LEVEL_ERROR, "plugin_module_init - oauth2 - Error start_reaper");
+        j_return = json_pack("{si}", "result", G_ERROR);
+        break;
+      }
       
     } while (0);
     json_decref(j_result);
@@ -3916,6 +4014,9 @@ int plugin_module_close(struct config_plugin * config, const char * name, void *
   UNUSED(name);
   if (cls != NULL) {
     y_log_message(Y_LOG_LEVEL_INFO, "Close plugin Glewlwyd Oauth2 '%s'", name);
+    if (json_integer_value(json_object_get(((struct _oauth2_config *)cls)->j_params, "reaper-interval")) > 0) {
+      config->glewlwyd_plugin_callback_reaper_stop(config, name);
+    }
     config->glewlwyd_callback_remove_plugin_endpoint(config, "GET", name, "auth/");
     config->glewlwyd_callback_remove_plugin_endpoint(config, "POST", name, "token/");
     config->glewlwyd_callback_remove_plugin_endpoint(config, "GET", name, "profile/");
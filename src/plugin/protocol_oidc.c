@@ -52,6 +52,24 @@
 #define GLEWLWYD_CODE_CHALLENGE_MAX_LENGTH 128
 #define GLEWLWYD_CODE_CHALLENGE_S256_PREFIX "{SHA256}"
 #define GLEWLWYD_REQUEST_URI_EXP_DEFAULT   90
+#define GLEWLWYD_REAPER_RETENTION_DEFAULT  86400
+#define GLEWLWYD_REAPER_BATCH_SIZE_DEFAULT 500
+#define GLEWLWYD_REAPER_BATCH_DELAY_DEFAULT 100
+#define GLEWLWYD_ACCESS_TOKEN_CACHE_SIZE_DEFAULT 1024
+#define GLEWLWYD_JWKS_CACHE_DURATION_DEFAULT 3600
+#define GLEWLWYD_INTROSPECTION_BATCH_MAX_TOKENS_DEFAULT 100
+#define GLEWLWYD_REVOKED_JTI_BLOOM_BITS      (1<<20)
+#define GLEWLWYD_REVOKED_JTI_BLOOM_HASHES    7
+#define GLEWLWYD_REVOKED_JTI_SYNC_INTERVAL   10
+#define GLEWLWYD_REVOKED_JTI_PURGE_INTERVAL  3600
+#define GLEWLWYD_REVOKED_JTI_SYNC_OVERLAP    60
+#define GLEWLWYD_REVOKED_JTI_SYNC_BACKOFF_MAX 300
+#define GLEWLWYD_JWKS_CACHE_DURATION_MIN     60
+#define GLEWLWYD_JWKS_CACHE_DURATION_MAX     86400
+#define GLEWLWYD_JWKS_CACHE_RETRY_DELAY      30
+#define GLEWLWYD_JWKS_CACHE_MAX_ENTRIES      1024
+#define GLEWLWYD_JWKS_CACHE_HTTP_TIMEOUT     10
+#define GLEWLWYD_JWKS_CACHE_STALE_MAX        3600
 
 #define GLEWLWYD_CHECK_JWT_USERNAME "myrddin"
 #define GLEWLWYD_CHECK_JWT_SCOPE    "caledonia"
@@ -63,6 +81,7 @@
 #define GLEWLWYD_PLUGIN_OIDC_TABLE_REFRESH_TOKEN_SCOPE        "gpo_refresh_token_scope"
 #define GLEWLWYD_PLUGIN_OIDC_TABLE_ACCESS_TOKEN               "gpo_access_token"
 #define GLEWLWYD_PLUGIN_OIDC_TABLE_ACCESS_TOKEN_SCOPE         "gpo_access_token_scope"
+#define GLEWLWYD_PLUGIN_OIDC_TABLE_ACCESS_TOKEN_REVOKED       "gpo_access_token_revoked"
 #define GLEWLWYD_PLUGIN_OIDC_TABLE_ID_TOKEN                   "gpo_id_token"
 #define GLEWLWYD_PLUGIN_OIDC_TABLE_SUBJECT_IDENTIFIER         "gpo_subject_identifier"
 #define GLEWLWYD_PLUGIN_OIDC_TABLE_CLIENT_REGISTRATION        "gpo_client_registration"
@@ -146,6 +165,42 @@
 #define GLWD_METRICS_OIDC_INVALID_DEVICE_CODE         "glewlwyd_oidc_invalid_device_code"
 #define GLWD_METRICS_OIDC_INVALID_REFRESH_TOKEN       "glewlwyd_oidc_invalid_refresh_token"
 #define GLWD_METRICS_OIDC_INVALID_ACCESS_TOKEN        "glewlwyd_oidc_invalid_acccess_token"
+#define GLWD_METRICS_OIDC_ACCESS_TOKEN_CACHE          "glewlwyd_oidc_access_token_cache"
+
+/**
+ * Signing key ready to use, with a jwt template holding the header
+ * The jwt template doesn't contain any key so it's cheap to copy
+ */
+struct _oidc_sign_key {
+  char  * kid;
+  jwt_t * jwt;
+  jwk_t * jwk;
+  int     key_size;
+};
+
+/**
+ * Revoked access tokens jti, used when the access tokens aren't stored in the database
+ * The list also contains the jti of the revoked refresh tokens, to revoke the access tokens issued with them
+ * The bloom filter answers most of the lookups without checking the exact list
+ * The revoked jti are stored in the database and loaded every GLEWLWYD_REVOKED_JTI_SYNC_INTERVAL seconds
+ * by a background thread, so the revocations made by other instances sharing the same database are taken into account
+ * Each sync loads the jti created since the last one seen minus GLEWLWYD_REVOKED_JTI_SYNC_OVERLAP seconds,
+ * so a revocation committed after a more recent one isn't missed
+ * The lookups only take the read lock, the sync thread takes the write lock to merge the rows loaded
+ */
+struct _oidc_revoked_jti {
+  pthread_rwlock_t  lock;
+  unsigned char   * bloom;
+  json_t          * j_jti;
+  json_int_t        last_created_at;
+  time_t            next_sync;
+  time_t            next_purge;
+  unsigned int      nb_sync_errors;
+  pthread_t         sync_thread;
+  pthread_mutex_t   sync_lock;
+  pthread_cond_t    sync_cond;
+  unsigned short    sync_stop;
+};
 
 /**
  * Structure used to store all the plugin parameters and data duringexecution
@@ -158,6 +213,9 @@ struct _oidc_config {
   int                            jwt_key_size;
   jwt_t                        * jwt_sign;
   jwk_t                        * jwk_sign_default;
+  struct _oidc_sign_key          sign_key_default;
+  struct _oidc_sign_key        * sign_keys;
+  size_t                         nb_sign_keys;
   int                            x5u_flags;
 
   char                         * discovery_str;
@@ -169,12 +227,25 @@ struct _oidc_config {
   json_int_t                     code_duration;
   json_int_t                     auth_token_max_age;
   json_int_t                     request_uri_duration;
+  json_int_t                     introspection_batch_max_tokens;
   unsigned short int             allow_non_oidc;
   unsigned short int             refresh_token_rolling;
   unsigned short int             refresh_token_one_use;
   unsigned short int             auth_type_enabled[7];
   unsigned short int             subject_type;
   pthread_mutex_t                insert_lock;
+  unsigned short int             access_token_stateless;
+  struct _oidc_revoked_jti       revoked_jti;
+  json_t                       * j_jwks_cache;
+  json_int_t                     jwks_cache_duration;
+  json_t                       * j_jwks_cache_refresh;
+  unsigned short int             jwks_cache_stop;
+  unsigned short int             jwks_cache_thread_started;
+  pthread_t                      jwks_cache_thread;
+  pthread_mutex_t                jwks_cache_lock;
+  pthread_cond_t                 jwks_cache_cond;
+  json_t                       * j_jwks_cache_download;
+  pthread_cond_t                 jwks_cache_download_cond;
   struct _oidc_resource_config * oidc_resource_config;
   struct _oidc_resource_config * introspect_revoke_resource_config;
   struct _oidc_resource_config * client_register_resource_config;
@@ -364,6 +435,10 @@ static json_t * check_parameters (json_t * j_params) {
       json_array_append_new(j_error, json_string("Property 'refresh-token-rolling' is optional and must be a boolean"));
       ret = G_ERROR_PARAM;
     }
+    if (json_object_get(j_params, "access-token-stateless") != NULL && !json_is_boolean(json_object_get(j_params, "access-token-stateless"))) {
+      json_array_append_new(j_error, json_string("Property 'access-token-stateless' is optional and must be a boolean"));
+      ret = G_ERROR_PARAM;
+    }
     if (json_object_get(j_params, "auth-type-code-enabled") != NULL && !json_is_boolean(json_object_get(j_params, "auth-type-code-enabled"))) {
       json_array_append_new(j_error, json_string("Property 'auth-type-code-enabled' is optional and must be a boolean"));
       ret = G_ERROR_PARAM;
@@ -762,6 +837,10 @@ static json_t * check_parameters (json_t * j_params) {
         json_array_append_new(j_error, json_string("Property 'introspection-revocation-allow-target-client' is optional and must be a boolean"));
         ret = G_ERROR_PARAM;
       }
+      if (json_object_get(j_params, "introspection-batch-max-tokens") != NULL && (!json_is_integer(json_object_get(j_params, "introspection-batch-max-tokens")) || json_integer_value(json_object_get(j_params, "introspection-batch-max-tokens")) < 0)) {
+        json_array_append_new(j_error, json_string("Property 'introspection-batch-max-tokens' is optional and must be a positive integer"));
+        ret = G_ERROR_PARAM;
+      }
     }
     if (json_object_get(j_params, "register-client-allowed") != NULL && !json_is_boolean(json_object_get(j_params, "register-client-allowed"))) {
       json_array_append_new(j_error, json_string("Property 'register-client-allowed' is optional and must be a boolean"));
@@ -862,6 +941,30 @@ static json_t * check_parameters (json_t * j_params) {
       json_array_append_new(j_error, json_string("Property 'oauth-dpop-iat-duration' is mandatory and must be a non null positive integer"));
       ret = G_ERROR_PARAM;
     }
+    if (json_object_get(j_params, "jwks-cache-duration") != NULL && (!json_is_integer(json_object_get(j_params, "jwks-cache-duration")) || json_integer_value(json_object_get(j_params, "jwks-cache-duration")) < 0)) {
+      json_array_append_new(j_error, json_string("Property 'jwks-cache-duration' is optional and must be a positive integer"));
+      ret = G_ERROR_PARAM;
+    }
+    if (json_object_get(j_params, "access-token-cache-size") != NULL && (!json_is_integer(json_object_get(j_params, "access-token-cache-size")) || json_integer_value(json_object_get(j_params, "access-token-cache-size")) < 0)) {
+      json_array_append_new(j_error, json_string("Property 'access-token-cache-size' is optional and must be a positive integer"));
+      ret = G_ERROR_PARAM;
+    }
+    if (json_object_get(j_params, "reaper-interval") != NULL && (!json_is_integer(json_object_get(j_params, "reaper-interval")) || json_integer_value(json_object_get(j_params, "reaper-interval")) < 0)) {
+      json_array_append_new(j_error, json_string("Property 'reaper-interval' is optional and must be a positive integer"));
+      ret = G_ERROR_PARAM;
+    }
+    if (json_object_get(j_params, "reaper-retention") != NULL && (!json_is_integer(json_object_get(j_params, "reaper-retention")) || json_integer_value(json_object_get(j_params, "reaper-retention")) < 0)) {
+      json_array_append_new(j_error, json_string("Property 'reaper-retention' is optional and must be a positive integer"));
+      ret = G_ERROR_PARAM;
+    }
+    if (json_object_get(j_params, "reaper-batch-size") != NULL && (!json_is_integer(json_object_get(j_params, "reaper-batch-size")) || json_integer_value(json_object_get(j_params, "reaper-batch-size")) < 0)) {
+      json_array_append_new(j_error, json_string("Property 'reaper-batch-size' is optional and must be a positive integer"));
+      ret = G_ERROR_PARAM;
+    }
+    if (json_object_get(j_params, "reaper-batch-delay") != NULL && (!json_is_integer(json_object_get(j_params, "reaper-batch-delay")) || json_integer_value(json_object_get(j_params, "reaper-batch-delay")) < 0)) {
+      json_array_append_new(j_error, json_string("Property 'reaper-batch-delay' is optional and must be a positive integer"));
+      ret = G_ERROR_PARAM;
+    }
     if (json_object_get(j_params, "resource-allowed") != NULL && !json_is_boolean(json_object_get(j_params, "resource-allowed"))) {
       json_array_append_new(j_error, json_string("Property 'resource-allowed' is optional and must be a boolean"));
       ret = G_ERROR_PARAM;
@@ -1571,6 +1674,376 @@ static int is_encrypt_token_allowed(struct _oidc_config * config, json_t * j_cli
   return (0 == o_strcmp("1", value) || 0 == o_strcasecmp("yes", value) || 0 == o_strcasecmp("true", value) || 0 == o_strcasecmp("indeed, my friend", value));
 }
 
+/**
+ * Returns the cache duration of a JWKS based on the Cache-Control header of the response
+ */
+static json_int_t jwks_cache_get_duration(struct _oidc_config * config, const char * cache_control) {
+  json_int_t duration = config->jwks_cache_duration;
+  const char * max_age;
+
+  if (o_strcasestr(cache_control, "no-cache") != NULL || o_strcasestr(cache_control, "no-store") != NULL) {
+    duration = GLEWLWYD_JWKS_CACHE_DURATION_MIN;
+  } else if ((max_age = o_strcasestr(cache_control, "max-age=")) != NULL) {
+    duration = strtol(max_age+o_strlen("max-age="), NULL, 10);
+  }
+  if (duration < GLEWLWYD_JWKS_CACHE_DURATION_MIN) {
+    duration = GLEWLWYD_JWKS_CACHE_DURATION_MIN;
+  } else if (duration > GLEWLWYD_JWKS_CACHE_DURATION_MAX) {
+    duration = GLEWLWYD_JWKS_CACHE_DURATION_MAX;
+  }
+  return duration;
+}
+
+/**
+ * Downloads the JWKS at uri and returns a new cache entry
+ * If j_entry has an etag, the JWKS is downloaded only if it was modified
+ */
+static json_t * jwks_cache_download(struct _oidc_config * config, const char * uri, json_t * j_entry) {
+  struct _u_request req;
+  struct _u_response resp;
+  json_t * j_jwks, * j_new_entry = NULL;
+  json_int_t duration;
+  time_t now;
+
+  ulfius_init_request(&req);
+  ulfius_init_response(&resp);
+
+  req.http_verb = o_strdup("GET");
+  req.http_url = o_strdup(uri);
+  req.timeout = GLEWLWYD_JWKS_CACHE_HTTP_TIMEOUT;
+  if (config->x5u_flags & R_FLAG_IGNORE_SERVER_CERTIFICATE) {
+    req.check_server_certificate = 0;
+  }
+  if (config->x5u_flags & R_FLAG_FOLLOW_REDIRECT) {
+    req.follow_redirect = 1;
+  }
+  if (json_string_length(json_object_get(j_entry, "etag"))) {
+    u_map_put(req.map_header, "If-None-Match", json_string_value(json_object_get(j_entry, "etag")));
+  }
+
+  if (ulfius_send_http_request(&req, &resp) != U_OK) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "jwks_cache_download - Error ulfius_send_http_request %s", uri);
+  } else if (resp.status == 304 && j_entry != NULL) {
+    j_new_entry = json_pack("{sOsO}", "jwks", json_object_get(j_entry, "jwks"), "etag", json_object_get(j_entry, "etag"));
+  } else if (resp.status == 200) {
+    j_jwks = json_loadb(resp.binary_body, resp.binary_body_length, JSON_DECODE_ANY, NULL);
+    if (json_is_array(json_object_get(j_jwks, "keys"))) {
+      j_new_entry = json_pack("{sOss?}", "jwks", j_jwks, "etag", u_map_get_case(resp.map_header, "ETag"));
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "jwks_cache_download - Invalid JWKS at %s", uri);
+    }
+    json_decref(j_jwks);
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "jwks_cache_download - Error ulfius_send_http_request %s response status is %d", uri, resp.status);
+  }
+  if (j_new_entry != NULL) {
+    time(&now);
+    duration = jwks_cache_get_duration(config, u_map_get_case(resp.map_header, "Cache-Control"));
+    json_object_set_new(j_new_entry, "fetched_at", json_integer(now));
+    json_object_set_new(j_new_entry, "refresh_at", json_integer(now + (duration*3)/4));
+    json_object_set_new(j_new_entry, "expires_at", json_integer(now + duration));
+  }
+
+  ulfius_clean_request(&req);
+  ulfius_clean_response(&resp);
+  return j_new_entry;
+}
+
+/**
+ * Stores a new cache entry, the lock must be held by the caller
+ * If the cache is full, the expired entries are removed, then the entry fetched first if the cache is still full
+ */
+static void jwks_cache_set(struct _oidc_config * config, const char * uri, json_t * j_entry) {
+  json_t * j_element = NULL;
+  const char * key = NULL, * oldest_key = NULL;
+  json_int_t oldest_fetched_at = 0;
+  void * tmp;
+  time_t now;
+
+  if (json_object_get(config->j_jwks_cache, uri) == NULL && json_object_size(config->j_jwks_cache) >= GLEWLWYD_JWKS_CACHE_MAX_ENTRIES) {
+    time(&now);
+    json_object_foreach_safe(config->j_jwks_cache, tmp, key, j_element) {
+      if (json_integer_value(json_object_get(j_element, "expires_at")) <= now && json_object_get(j_element, "refreshing") != json_true()) {
+        json_object_del(config->j_jwks_cache, key);
+      }
+    }
+    if (json_object_size(config->j_jwks_cache) >= GLEWLWYD_JWKS_CACHE_MAX_ENTRIES) {
+      json_object_foreach(config->j_jwks_cache, key, j_element) {
+        if (oldest_key == NULL || json_integer_value(json_object_get(j_element, "fetched_at")) < oldest_fetched_at) {
+          oldest_key = key;
+          oldest_fetched_at = json_integer_value(json_object_get(j_element, "fetched_at"));
+        }
+      }
+      if (oldest_key != NULL) {
+        json_object_del(config->j_jwks_cache, oldest_key);
+      }
+    }
+  }
+  json_object_set(config->j_jwks_cache, uri, j_entry);
+}
+
+/**
+ * Downloads the JWKS of the queued uris in background, one at a time, until the cache is closed
+ */
+static void * jwks_cache_refresh_run(void * args) {
+  struct _oidc_config * config = (struct _oidc_config *)args;
+  json_t * j_entry, * j_new_entry;
+  char * uri;
+  time_t now;
+
+  if (!pthread_mutex_lock(&config->jwks_cache_lock)) {
+    while (!config->jwks_cache_stop) {
+      if (!json_array_size(config->j_jwks_cache_refresh)) {
+        pthread_cond_wait(&config->jwks_cache_cond, &config->jwks_cache_lock);
+      } else {
+        uri = o_strdup(json_string_value(json_array_get(config->j_jwks_cache_refresh, 0)));
+        json_array_remove(config->j_jwks_cache_refresh, 0);
+        j_entry = json_deep_copy(json_object_get(config->j_jwks_cache, uri));
+        pthread_mutex_unlock(&config->jwks_cache_lock);
+
+        j_new_entry = jwks_cache_download(config, uri, j_entry);
+
+        if (pthread_mutex_lock(&config->jwks_cache_lock)) {
+          y_log_message(Y_LOG_LEVEL_ERROR, "jwks_cache_refresh_run - Error pthread_mutex_lock");
+          json_decref(j_entry);
+          json_decref(j_new_entry);
+          o_free(uri);
+          return NULL;
+        }
+        if (j_new_entry != NULL) {
+          jwks_cache_set(config, uri, j_new_entry);
+        } else if (json_object_get(config->j_jwks_cache, uri) != NULL) {
+          // Keep the current JWKS and try again later
+          time(&now);
+          json_object_set_new(json_object_get(config->j_jwks_cache, uri), "refresh_at", json_integer(now + GLEWLWYD_JWKS_CACHE_RETRY_DELAY));
+          json_object_del(json_object_get(config->j_jwks_cache, uri), "refreshing");
+        }
+        json_decref(j_entry);
+        json_decref(j_new_entry);
+        o_free(uri);
+      }
+    }
+    pthread_mutex_unlock(&config->jwks_cache_lock);
+  }
+  return NULL;
+}
+
+/**
+ * Queues the JWKS at uri to be downloaded again by the refresh thread before its cache entry expires
+ * The lock must be held by the caller
+ */
+static void jwks_cache_refresh_start(struct _oidc_config * config, const char * uri) {
+  if (!config->jwks_cache_stop && config->jwks_cache_thread_started) {
+    if (!json_array_append_new(config->j_jwks_cache_refresh, json_string(uri))) {
+      json_object_set(json_object_get(config->j_jwks_cache, uri), "refreshing", json_true());
+      pthread_cond_signal(&config->jwks_cache_cond);
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "jwks_cache_refresh_start - Error json_array_append_new");
+    }
+  }
+}
+
+/**
+ * Returns true if the JWKS has a key with this kid
+ */
+static int jwks_cache_has_kid(json_t * j_jwks, const char * kid) {
+  json_t * j_element = NULL;
+  size_t index = 0;
+  int ret = 0;
+
+  json_array_foreach(json_object_get(j_jwks, "keys"), index, j_element) {
+    if (0 == o_strcmp(kid, json_string_value(json_object_get(j_element, "kid")))) {
+      ret = 1;
+      break;
+    }
+  }
+  return ret;
+}
+
+/**
+ * Returns true if j_entry can be used while the JWKS at uri can't be downloaded
+ */
+static int jwks_cache_is_usable(json_t * j_entry, time_t now) {
+  return j_entry != NULL && now < json_integer_value(json_object_get(j_entry, "expires_at")) + GLEWLWYD_JWKS_CACHE_STALE_MAX;
+}
+
+/**
+ * Marks the synchronous download of the JWKS at uri as started, the lock must be held by the caller
+ * Returns G_ERROR_UNAVAILABLE if the download failed less than GLEWLWYD_JWKS_CACHE_RETRY_DELAY seconds ago,
+ * G_ERROR_PARAM if another thread is downloading it
+ */
+static int jwks_cache_download_start(struct _oidc_config * config, const char * uri, time_t now) {
+  json_t * j_download = json_object_get(config->j_jwks_cache_download, uri), * j_element = NULL;
+  const char * key = NULL;
+  void * tmp;
+  int ret = G_OK;
+
+  if (json_object_get(j_download, "downloading") == json_true()) {
+    ret = G_ERROR_PARAM;
+  } else if (now < json_integer_value(json_object_get(j_download, "retry_at"))) {
+    ret = G_ERROR_UNAVAILABLE;
+  } else {
+    if (j_download == NULL && json_object_size(config->j_jwks_cache_download) >= GLEWLWYD_JWKS_CACHE_MAX_ENTRIES) {
+      json_object_foreach_safe(config->j_jwks_cache_download, tmp, key, j_element) {
+        if (json_object_get(j_element, "downloading") != json_true() && json_integer_value(json_object_get(j_element, "retry_at")) <= now) {
+          json_object_del(config->j_jwks_cache_download, key);
+        }
+      }
+    }
+    json_object_set_new(config->j_jwks_cache_download, uri, json_pack("{so}", "downloading", json_true()));
+  }
+  return ret;
+}
+
+/**
+ * Marks the synchronous download of the JWKS at uri as ended and wakes up the threads waiting for it
+ * The lock must be held by the caller
+ * On failure, the next synchronous download is allowed in GLEWLWYD_JWKS_CACHE_RETRY_DELAY seconds
+ */
+static void jwks_cache_download_end(struct _oidc_config * config, const char * uri, int success) {
+  time_t now;
+
+  if (success) {
+    json_object_del(config->j_jwks_cache_download, uri);
+  } else {
+    time(&now);
+    json_object_set_new(config->j_jwks_cache_download, uri, json_pack("{sI}", "retry_at", (json_int_t)(now + GLEWLWYD_JWKS_CACHE_RETRY_DELAY)));
+  }
+  pthread_cond_broadcast(&config->jwks_cache_download_cond);
+}
+
+/**
+ * Imports in jwks the JWKS available at uri, using the JWKS cache of the plugin instance
+ * A cached JWKS is downloaded again in background when 3/4 of its cache duration is spent
+ * If kid is set and isn't in the cached JWKS, the JWKS is downloaded again,
+ * but not more than once every GLEWLWYD_JWKS_CACHE_RETRY_DELAY seconds
+ * Only one thread downloads a JWKS at a time, the other threads use the cached JWKS if usable or wait for the download
+ * If the download fails, the expired JWKS is used if available,
+ * but not more than GLEWLWYD_JWKS_CACHE_STALE_MAX seconds after it has expired,
+ * and the JWKS isn't downloaded again for GLEWLWYD_JWKS_CACHE_RETRY_DELAY seconds
+ */
+static int import_jwks_from_uri(struct _oidc_config * config, jwks_t * jwks, const char * uri, const char * kid) {
+  json_t * j_entry = NULL, * j_new_entry;
+  time_t now;
+  int ret, download, res_download;
+
+  if (config->jwks_cache_duration) {
+    if (!pthread_mutex_lock(&config->jwks_cache_lock)) {
+      do {
+        time(&now);
+        json_decref(j_entry);
+        j_entry = json_deep_copy(json_object_get(config->j_jwks_cache, uri));
+        download = 1;
+        if (j_entry != NULL &&
+            now < json_integer_value(json_object_get(j_entry, "expires_at")) &&
+            (!o_strlen(kid) || jwks_cache_has_kid(json_object_get(j_entry, "jwks"), kid) || now < json_integer_value(json_object_get(j_entry, "fetched_at")) + GLEWLWYD_JWKS_CACHE_RETRY_DELAY)) {
+          download = 0;
+          if (now >= json_integer_value(json_object_get(j_entry, "refresh_at")) && json_object_get(j_entry, "refreshing") != json_true()) {
+            jwks_cache_refresh_start(config, uri);
+          }
+        } else if ((res_download = jwks_cache_download_start(config, uri, now)) == G_ERROR_UNAVAILABLE) {
+          // The last download failed, the JWKS isn't downloaded again before the retry delay
+          download = 0;
+          if (!jwks_cache_is_usable(j_entry, now)) {
+            json_decref(j_entry);
+            j_entry = NULL;
+          }
+        } else if (res_download == G_ERROR_PARAM) {
+          // Another thread is downloading the JWKS, use the cached one if it has the kid, otherwise wait for the download
+          download = 0;
+          if (!jwks_cache_is_usable(j_entry, now) || (o_strlen(kid) && !jwks_cache_has_kid(json_object_get(j_entry, "jwks"), kid))) {
+            download = -1;
+            pthread_cond_wait(&config->jwks_cache_download_cond, &config->jwks_cache_lock);
+          }
+        }
+      } while (download == -1);
+      pthread_mutex_unlock(&config->jwks_cache_lock);
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "import_jwks_from_uri - Error pthread_mutex_lock");
+      download = 0;
+    }
+    if (download) {
+      j_new_entry = jwks_cache_download(config, uri, j_entry);
+      if (!pthread_mutex_lock(&config->jwks_cache_lock)) {
+        if (j_new_entry != NULL) {
+          jwks_cache_set(config, uri, j_new_entry);
+        } else if (j_entry != NULL && !jwks_cache_is_usable(j_entry, now)) {
+          json_object_del(config->j_jwks_cache, uri);
+        }
+        jwks_cache_download_end(config, uri, j_new_entry != NULL);
+        pthread_mutex_unlock(&config->jwks_cache_lock);
+      }
+      if (j_new_entry != NULL) {
+        json_decref(j_entry);
+        j_entry = j_new_entry;
+      } else if (jwks_cache_is_usable(j_entry, now)) {
+        y_log_message(Y_LOG_LEVEL_WARNING, "import_jwks_from_uri - Error downloading JWKS at %s, using the cached JWKS", uri);
+      } else if (j_entry != NULL) {
+        // The keys may have been rotated out since, the stale JWKS isn't used anymore
+        y_log_message(Y_LOG_LEVEL_ERROR, "import_jwks_from_uri - Error downloading JWKS at %s, the cached JWKS is too old", uri);
+        json_decref(j_entry);
+        j_entry = NULL;
+      }
+    }
+    if (j_entry != NULL) {
+      ret = r_jwks_import_from_json_t(jwks, json_object_get(j_entry, "jwks"));
+    } else {
+      ret = RHN_ERROR;
+    }
+    json_decref(j_entry);
+  } else {
+    ret = r_jwks_import_from_uri(jwks, uri, config->x5u_flags);
+  }
+  return ret;
+}
+
+/**
+ * Initializes the JWKS cache of the plugin instance and starts its refresh thread
+ */
+static int jwks_cache_init(struct _oidc_config * config) {
+  int ret = G_OK;
+
+  config->jwks_cache_stop = 0;
+  config->jwks_cache_thread_started = 0;
+  config->j_jwks_cache = NULL;
+  config->j_jwks_cache_refresh = NULL;
+  config->j_jwks_cache_download = NULL;
+  if (pthread_mutex_init(&config->jwks_cache_lock, NULL) || pthread_cond_init(&config->jwks_cache_cond, NULL) || pthread_cond_init(&config->jwks_cache_download_cond, NULL) || (config->j_jwks_cache = json_object()) == NULL || (config->j_jwks_cache_refresh = json_array()) == NULL || (config->j_jwks_cache_download = json_object()) == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "jwks_cache_init - Error initializing JWKS cache");
+    ret = G_ERROR;
+  } else if (pthread_create(&config->jwks_cache_thread, NULL, jwks_cache_refresh_run, (void *)config)) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "jwks_cache_init - Error pthread_create");
+    ret = G_ERROR;
+  } else {
+    config->jwks_cache_thread_started = 1;
+  }
+  return ret;
+}
+
+/**
+ * Stops the refresh thread, a download in progress is completed, and frees the JWKS cache
+ */
+static void jwks_cache_close(struct _oidc_config * config) {
+  if (config->j_jwks_cache != NULL) {
+    if (config->jwks_cache_thread_started && !pthread_mutex_lock(&config->jwks_cache_lock)) {
+      config->jwks_cache_stop = 1;
+      pthread_cond_signal(&config->jwks_cache_cond);
+      pthread_mutex_unlock(&config->jwks_cache_lock);
+      pthread_join(config->jwks_cache_thread, NULL);
+      config->jwks_cache_thread_started = 0;
+    }
+    json_decref(config->j_jwks_cache);
+    config->j_jwks_cache = NULL;
+    json_decref(config->j_jwks_cache_refresh);
+    config->j_jwks_cache_refresh = NULL;
+    json_decref(config->j_jwks_cache_download);
+    config->j_jwks_cache_download = NULL;
+    pthread_cond_destroy(&config->jwks_cache_cond);
+    pthread_cond_destroy(&config->jwks_cache_download_cond);
+    pthread_mutex_destroy(&config->jwks_cache_lock);
+  }
+}
+
 static char * encrypt_token_if_required(struct _oidc_config * config, const char * token, json_t * j_client, int type) {
   char * token_out = NULL;
   unsigned char key[64] = {0};
@@ -1639,7 +2112,7 @@ static char * encrypt_token_if_required(struct _oidc_config * config, const char
       } else if (alg == R_JWA_ALG_ECDH_ES || alg == R_JWA_ALG_ECDH_ES_A128KW || alg == R_JWA_ALG_ECDH_ES_A192KW || alg == R_JWA_ALG_ECDH_ES_A256KW || alg == R_JWA_ALG_RSA1_5 || alg == R_JWA_ALG_RSA_OAEP || alg == R_JWA_ALG_RSA_OAEP_256) {
         if (r_jwks_init(&jwks) == RHN_OK) {
           if (json_string_length(json_object_get(j_client, jwks_uri_p)) && json_string_length(json_object_get(j_client, alg_kid_p))) {
-            if (r_jwks_import_from_uri(jwks, json_string_value(json_object_get(j_client, jwks_uri_p)), config->x5u_flags) == RHN_OK) {
+            if (import_jwks_from_uri(config, jwks, json_string_value(json_object_get(j_client, jwks_uri_p)), json_string_value(json_object_get(j_client, alg_kid_p))) == RHN_OK) {
               if ((jwk = r_jwks_get_by_kid(jwks, json_string_value(json_object_get(j_client, alg_kid_p)))) == NULL) {
                 y_log_message(Y_LOG_LEVEL_DEBUG, "encrypt_token_if_required - unable to get pubkey from jwks_uri, client_id %s", json_string_value(json_object_get(j_client, "client_id")));
               }
@@ -1678,6 +2151,104 @@ static char * encrypt_token_if_required(struct _oidc_config * config, const char
   return token_out;
 }
 
+/**
+ * Builds a signing key and its jwt template, the jwk will be owned by sign_key
+ */
+static int sign_key_init(struct _oidc_config * config, struct _oidc_sign_key * sign_key, jwk_t * jwk, int key_size) {
+  int ret = G_OK;
+  jwa_alg alg = r_jwt_get_sign_alg(config->jwt_sign);
+
+  sign_key->jwk = jwk;
+  sign_key->kid = o_strdup(r_jwk_get_property_str(jwk, "kid"));
+  sign_key->key_size = key_size;
+  if (r_jwk_get_property_str(jwk, "alg") != NULL) {
+    alg = r_str_to_jwa_alg(r_jwk_get_property_str(jwk, "alg"));
+  }
+  if (r_jwt_init(&sign_key->jwt) != RHN_OK) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "sign_key_init - Error r_jwt_init");
+    ret = G_ERROR;
+  } else if (r_jwt_set_sign_alg(sign_key->jwt, alg) != RHN_OK) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "sign_key_init - Error r_jwt_set_sign_alg");
+    ret = G_ERROR;
+  } else if (sign_key->kid != NULL && r_jwt_set_header_str_value(sign_key->jwt, "kid", sign_key->kid) != RHN_OK) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "sign_key_init - Error r_jwt_set_header_str_value kid");
+    ret = G_ERROR;
+  }
+  return ret;
+}
+
+static void sign_key_clean(struct _oidc_sign_key * sign_key) {
+  o_free(sign_key->kid);
+  r_jwt_free(sign_key->jwt);
+  r_jwk_free(sign_key->jwk);
+  sign_key->kid = NULL;
+  sign_key->jwt = NULL;
+  sign_key->jwk = NULL;
+}
+
+/**
+ * Builds the signing keys from the private keys of the plugin instance
+ * so the tokens generation doesn't have to copy the keys for each token
+ */
+static int sign_keys_init(struct _oidc_config * config) {
+  int ret;
+  size_t index;
+  jwk_t * jwk;
+
+  ret = sign_key_init(config, &config->sign_key_default, r_jwk_copy(config->jwk_sign_default), config->jwt_key_size);
+  if (ret == G_OK && r_jwks_size(config->jwt_sign->jwks_privkey_sign)) {
+    if ((config->sign_keys = o_malloc(r_jwks_size(config->jwt_sign->jwks_privkey_sign)*sizeof(struct _oidc_sign_key))) != NULL) {
+      for (index=0; index<r_jwks_size(config->jwt_sign->jwks_privkey_sign) && ret == G_OK; index++) {
+        jwk = r_jwks_get_at(config->jwt_sign->jwks_privkey_sign, index);
+        ret = sign_key_init(config, &config->sign_keys[index], jwk, get_key_size_from_alg(r_jwk_get_property_str(jwk, "alg")));
+        config->nb_sign_keys++;
+      }
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "sign_keys_init - Error allocating resources for sign_keys");
+      ret = G_ERROR_MEMORY;
+    }
+  }
+  return ret;
+}
+
+static void sign_keys_close(struct _oidc_config * config) {
+  size_t index;
+
+  sign_key_clean(&config->sign_key_default);
+  for (index=0; index<config->nb_sign_keys; index++) {
+    sign_key_clean(&config->sign_keys[index]);
+  }
+  o_free(config->sign_keys);
+  config->sign_keys = NULL;
+  config->nb_sign_keys = 0;
+}
+
+/**
+ * Returns the signing key to use for the client
+ * The signing key must not be freed nor modified
+ * If the client kid isn't in the private keys, returns NULL so the token isn't signed with another key
+ */
+static const struct _oidc_sign_key * get_sign_key(struct _oidc_config * config, json_t * j_client) {
+  const struct _oidc_sign_key * sign_key = NULL;
+  const char * kid = json_string_value(json_object_get(j_client, json_string_value(json_object_get(config->j_params, "client-sign_kid-parameter"))));
+  size_t index;
+
+  if (o_strlen(kid)) {
+    for (index=0; index<config->nb_sign_keys; index++) {
+      if (0 == o_strcmp(kid, config->sign_keys[index].kid)) {
+        sign_key = &config->sign_keys[index];
+        break;
+      }
+    }
+    if (sign_key == NULL) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "get_sign_key - Unknown sign kid '%s' for client_id %s", kid, json_string_value(json_object_get(j_client, "client_id")));
+    }
+  } else {
+    sign_key = &config->sign_key_default;
+  }
+  return sign_key;
+}
+
 /**
  * Generates a client_access_token from the specified parameters that are considered valid
  */
@@ -1689,24 +2260,13 @@ static char * generate_client_access_token(struct _oidc_config * config,
                                            char * jti,
                                            const char * x5t_s256,
                                            const char * ip_source) {
-  jwt_t * jwt;
-  jwk_t * jwk;
+  jwt_t * jwt = NULL;
+  const struct _oidc_sign_key * sign_key = get_sign_key(config, j_client);
   char * token = NULL;
-  const char * sign_kid = json_string_value(json_object_get(config->j_params, "client-sign_kid-parameter"));
   json_t * j_cnf;
 
-  jwt = r_jwt_copy(config->jwt_sign);
-  if (jwt != NULL) {
+  if (sign_key != NULL && (jwt = r_jwt_copy(sign_key->jwt)) != NULL) {
     rand_string_nonce(jti, OIDC_JTI_LENGTH);
-    if (j_client != NULL) {
-      if (json_string_length(json_object_get(j_client, sign_kid))) {
-        jwk = r_jwks_get_by_kid(config->jwt_sign->jwks_privkey_sign, json_string_value(json_object_get(j_client, sign_kid)));
-      } else {
-        jwk = r_jwk_copy(config->jwk_sign_default);
-      }
-    } else {
-      jwk = r_jwk_copy(config->jwk_sign_default);
-    }
     r_jwt_set_header_str_value(jwt, "typ", "at+jwt");
     // Build jwt payload
     r_jwt_set_claim_str_value(jwt, "iss", json_string_value(json_object_get(config->j_params, "iss")));
@@ -1727,11 +2287,7 @@ static char * generate_client_access_token(struct _oidc_config * config,
       r_jwt_set_claim_json_t_value(jwt, "cnf", j_cnf);
       json_decref(j_cnf);
     }
-    if (r_jwk_get_property_str(jwk, "alg") != NULL) {
-      r_jwt_set_sign_alg(jwt, r_str_to_jwa_alg(r_jwk_get_property_str(jwk, "alg")));
-    }
-    token = r_jwt_serialize_signed(jwt, jwk, 0);
-    r_jwk_free(jwk);
+    token = r_jwt_serialize_signed(jwt, sign_key->jwk, 0);
     if (token == NULL) {
       y_log_message(Y_LOG_LEVEL_ERROR, "generate_client_access_token - oidc - Error generating token");
     } else {
@@ -2070,6 +2626,28 @@ static json_t * get_userinfo(struct _oidc_config * config, const char * sub, jso
   return j_userinfo;
 }
 
+/**
+ * Checks out the database connection used to insert a row and read its id with h_last_insert_id
+ * A pooled connection belongs to the current thread, so the insert_lock is only needed
+ * when the shared connection is used, i.e. with SQLite3 or when the pool is disabled or exhausted
+ */
+static struct _h_connection * insert_conn_acquire(struct _oidc_config * config) {
+  struct _h_connection * conn = config->glewlwyd_config->glewlwyd_plugin_callback_db_acquire(config->glewlwyd_config);
+
+  if (conn == config->glewlwyd_config->glewlwyd_config->conn && pthread_mutex_lock(&config->insert_lock)) {
+    config->glewlwyd_config->glewlwyd_plugin_callback_db_release(config->glewlwyd_config, conn);
+    conn = NULL;
+  }
+  return conn;
+}
+
+static void insert_conn_release(struct _oidc_config * config, struct _h_connection * conn) {
+  if (conn == config->glewlwyd_config->glewlwyd_config->conn) {
+    pthread_mutex_unlock(&config->insert_lock);
+  }
+  config->glewlwyd_config->glewlwyd_plugin_callback_db_release(config->glewlwyd_config, conn);
+}
+
 /**
  * Return the id_token_hash of the last id_token provided to the client for the user
  */
@@ -2155,6 +2733,7 @@ static int serialize_pushed_request_uri(struct _oidc_config * config,
                                         const char * code_challenge,
                                         json_t * j_authorization_details,
                                         struct _u_map * additional_parameters) {
+  struct _h_connection * conn;
   json_t * j_query, * j_last_id, * j_additional_parameters = NULL;
   int ret, res, i;
   char * request_uri_hash = config->glewlwyd_config->glewlwyd_callback_generate_hash(config->glewlwyd_config, request_uri),
@@ -2169,8 +2748,8 @@ static int serialize_pushed_request_uri(struct _oidc_config * config,
   time(&now);
   if (request_uri_hash != NULL) {
     if (split_string(scope_list, " ", &scope_array)) {
-      if (pthread_mutex_lock(&config->insert_lock)) {
-        y_log_message(Y_LOG_LEVEL_ERROR, "serialize_pushed_request_uri oidc - Error pthread_mutex_lock");
+      if ((conn = insert_conn_acquire(config)) == NULL) {
+        y_log_message(Y_LOG_LEVEL_ERROR, "serialize_pushed_request_uri oidc - Error insert_conn_acquire");
         ret = G_ERROR;
       } else {
         if (j_claims != NULL) {
@@ -2179,9 +2758,9 @@ static int serialize_pushed_request_uri(struct _oidc_config * config,
         if (j_authorization_details != NULL) {
           str_authorization_details = json_dumps(j_authorization_details, JSON_COMPACT);
         }
-        if (config->glewlwyd_config->glewlwyd_config->conn->type==HOEL_DB_TYPE_MARIADB) {
+        if (conn->type==HOEL_DB_TYPE_MARIADB) {
           expires_at_clause = msprintf("FROM_UNIXTIME(%u)", (now + (unsigned int)config->request_uri_duration));
-        } else if (config->glewlwyd_config->glewlwyd_config->conn->type==HOEL_DB_TYPE_PGSQL) {
+        } else if (conn->type==HOEL_DB_TYPE_PGSQL) {
           expires_at_clause = msprintf("TO_TIMESTAMP(%u)", (now + (unsigned int)config->request_uri_duration ));
         } else { // HOEL_DB_TYPE_SQLITE
           expires_at_clause = msprintf("%u", (now + (unsigned int)config->request_uri_duration));
@@ -2223,15 +2802,15 @@ static int serialize_pushed_request_uri(struct _oidc_config * config,
         o_free(str_claims_request);
         o_free(str_authorization_details);
         o_free(str_additional_parameters);
-        res = h_insert(config->glewlwyd_config->glewlwyd_config->conn, j_query, NULL);
+        res = h_insert(conn, j_query, NULL);
         json_decref(j_query);
         if (res == H_OK) {
-          j_last_id = h_last_insert_id(config->glewlwyd_config->glewlwyd_config->conn);
+          j_last_id = h_last_insert_id(conn);
           j_query = json_pack("{sss[]}", "table", GLEWLWYD_PLUGIN_OIDC_TABLE_PAR_SCOPE, "values");
           for (i=0; scope_array[i]!= NULL; i++) {
             json_array_append_new(json_object_get(j_query, "values"), json_pack("{sOss}", "gpop_id", j_last_id, "gpops_scope", scope_array[i]));
           }
-          res = h_insert(config->glewlwyd_config->glewlwyd_config->conn, j_query, NULL);
+          res = h_insert(conn, j_query, NULL);
           json_decref(j_query);
           if (res == H_OK) {
             ret = G_OK;
@@ -2244,7 +2823,7 @@ static int serialize_pushed_request_uri(struct _oidc_config * config,
           y_log_message(Y_LOG_LEVEL_ERROR, "serialize_pushed_request_uri oidc - Error executing j_query (1)");
           ret = G_ERROR_DB;
         }
-        pthread_mutex_unlock(&config->insert_lock);
+        insert_conn_release(config, conn);
       }
       free_string_array(scope_array);
     } else {
@@ -2285,18 +2864,19 @@ static int serialize_id_token(struct _oidc_config * config,
                               time_t now,
                               const char * issued_for,
                               const char * user_agent) {
+  struct _h_connection * conn;
   json_t * j_query;
   int res, ret;
   char * issued_at_clause, * id_token_hash = config->glewlwyd_config->glewlwyd_callback_generate_hash(config->glewlwyd_config, id_token);
 
-  if (pthread_mutex_lock(&config->insert_lock)) {
-    y_log_message(Y_LOG_LEVEL_ERROR, "oidc serialize_id_token - Error pthread_mutex_lock");
+  if ((conn = insert_conn_acquire(config)) == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "oidc serialize_id_token - Error insert_conn_acquire");
     ret = G_ERROR;
   } else {
     if (issued_for != NULL && now > 0 && id_token_hash != NULL) {
-      if (config->glewlwyd_config->glewlwyd_config->conn->type==HOEL_DB_TYPE_MARIADB) {
+      if (conn->type==HOEL_DB_TYPE_MARIADB) {
         issued_at_clause = msprintf("FROM_UNIXTIME(%u)", (now));
-      } else if (config->glewlwyd_config->glewlwyd_config->conn->type==HOEL_DB_TYPE_PGSQL) {
+      } else if (conn->type==HOEL_DB_TYPE_PGSQL) {
         issued_at_clause = msprintf("TO_TIMESTAMP(%u)", (now));
       } else { // HOEL_DB_TYPE_SQLITE
         issued_at_clause = msprintf("%u", (now));
@@ -2323,7 +2903,7 @@ static int serialize_id_token(struct _oidc_config * config,
                             "gpoi_hash",
                             id_token_hash);
       o_free(issued_at_clause);
-      res = h_insert(config->glewlwyd_config->glewlwyd_config->conn, j_query, NULL);
+      res = h_insert(conn, j_query, NULL);
       json_decref(j_query);
       if (res == H_OK) {
         ret = G_OK;
@@ -2334,7 +2914,7 @@ static int serialize_id_token(struct _oidc_config * config,
     } else {
       ret = G_ERROR_PARAM;
     }
-    pthread_mutex_unlock(&config->insert_lock);
+    insert_conn_release(config, conn);
     o_free(id_token_hash);
   }
   return ret;
@@ -2357,30 +2937,17 @@ static char * generate_id_token(struct _oidc_config * config,
                                 json_t * j_claims_request,
                                 const char * ip_source) {
   jwt_t * jwt = NULL;
-  jwk_t * jwk = NULL;
   char * token = NULL, at_hash_encoded[128] = {0}, c_hash_encoded[128] = {0}, * sub = get_sub(config, username, j_client);
   unsigned char at_hash[128] = {0}, c_hash[128] = {0};
   json_t * j_user_info;
   size_t at_hash_len = 128, at_hash_encoded_len = 0, c_hash_len = 128, c_hash_encoded_len = 0;
   int alg = GNUTLS_DIG_UNKNOWN;
   gnutls_datum_t hash_data;
-  const char * sign_kid = json_string_value(json_object_get(config->j_params, "client-sign_kid-parameter"));
-  int key_size = 0;
+  const struct _oidc_sign_key * sign_key = get_sign_key(config, j_client);
+  int key_size = sign_key!=NULL?sign_key->key_size:0;
 
   if (sub != NULL) {
-    if ((jwt = r_jwt_copy(config->jwt_sign)) != NULL) {
-      if (j_client != NULL) {
-        if (json_string_length(json_object_get(j_client, sign_kid))) {
-          jwk = r_jwks_get_by_kid(config->jwt_sign->jwks_privkey_sign, json_string_value(json_object_get(j_client, sign_kid)));
-          key_size = get_key_size_from_alg(r_jwk_get_property_str(jwk, "alg"));
-        } else {
-          jwk = r_jwk_copy(config->jwk_sign_default);
-          key_size = config->jwt_key_size;
-        }
-      } else {
-        jwk = r_jwk_copy(config->jwk_sign_default);
-        key_size = config->jwt_key_size;
-      }
+    if (sign_key != NULL && (jwt = r_jwt_copy(sign_key->jwt)) != NULL) {
       if (key_size) {
         if ((j_user_info = get_userinfo(config, sub, j_user, j_claims_request, scopes)) != NULL) {
           json_object_set(j_user_info, "iss", json_object_get(config->j_params, "iss"));
@@ -2441,10 +3008,7 @@ static char * generate_id_token(struct _oidc_config * config,
           }
           //jwt_add_grant(jwt, "acr", "plop"); // TODO?
           if (r_jwt_set_full_claims_json_t(jwt, j_user_info) == RHN_OK) {
-            if (r_jwk_get_property_str(jwk, "alg") != NULL) {
-              r_jwt_set_sign_alg(jwt, r_str_to_jwa_alg(r_jwk_get_property_str(jwk, "alg")));
-            }
-            token = r_jwt_serialize_signed(jwt, jwk, 0);
+            token = r_jwt_serialize_signed(jwt, sign_key->jwk, 0);
             if (token == NULL) {
               y_log_message(Y_LOG_LEVEL_ERROR, "generate_id_token - oidc - Error r_jwt_serialize_signed");
             } else {
@@ -2454,7 +3018,6 @@ static char * generate_id_token(struct _oidc_config * config,
             y_log_message(Y_LOG_LEVEL_ERROR, "generate_id_token - oidc - Error jwt_add_grants_json");
           }
           json_decref(j_user_info);
-          r_jwk_free(jwk);
         } else {
           y_log_message(Y_LOG_LEVEL_ERROR, "generate_id_token - oidc - Error get_userinfo");
         }
@@ -2473,34 +3036,392 @@ static char * generate_id_token(struct _oidc_config * config,
 }
 
 /**
- * Store a signature of the acces token in the database
+ * Bloom filter bits positions for a jti, using FNV-1a and djb2 hashes combined by double hashing
  */
-static int serialize_access_token(struct _oidc_config * config,
-                                  uint auth_type,
-                                  json_int_t gpor_id,
-                                  const char * username,
-                                  const char * client_id,
-                                  const char * scope_list,
-                                  const char * resource,
-                                  time_t now,
-                                  const char * issued_for,
-                                  const char * user_agent,
-                                  const char * access_token,
-                                  const char * jti,
-                                  json_t * j_authorization_details) {
-  json_t * j_query, * j_last_id;
-  int res, ret, i;
+static void revoked_jti_bloom_positions(const char * jti, size_t * positions) {
+  uint64_t h1 = 14695981039346656037ULL, h2 = 5381;
+  size_t i, len = o_strlen(jti);
+
+  for (i=0; i<len; i++) {
+    h1 = (h1 ^ (unsigned char)jti[i]) * 1099511628211ULL;
+    h2 = ((h2 << 5) + h2) + (unsigned char)jti[i];
+  }
+  h2 |= 1;
+  for (i=0; i<GLEWLWYD_REVOKED_JTI_BLOOM_HASHES; i++) {
+    positions[i] = (size_t)((h1 + i*h2) % GLEWLWYD_REVOKED_JTI_BLOOM_BITS);
+  }
+}
+
+static void revoked_jti_bloom_add(struct _oidc_config * config, const char * jti) {
+  size_t positions[GLEWLWYD_REVOKED_JTI_BLOOM_HASHES], i;
+
+  revoked_jti_bloom_positions(jti, positions);
+  for (i=0; i<GLEWLWYD_REVOKED_JTI_BLOOM_HASHES; i++) {
+    config->revoked_jti.bloom[positions[i]/8] |= (unsigned char)(1 << (positions[i]%8));
+  }
+}
+
+/**
+ * Returns true if the jti may be in the revoked list, false if it's certainly not
+ */
+static int revoked_jti_bloom_check(struct _oidc_config * config, const char * jti) {
+  size_t positions[GLEWLWYD_REVOKED_JTI_BLOOM_HASHES], i;
+  int ret = 1;
+
+  revoked_jti_bloom_positions(jti, positions);
+  for (i=0; i<GLEWLWYD_REVOKED_JTI_BLOOM_HASHES && ret; i++) {
+    if (!(config->revoked_jti.bloom[positions[i]/8] & (1 << (positions[i]%8)))) {
+      ret = 0;
+    }
+  }
+  return ret;
+}
+
+/**
+ * Loads the revoked jti added in the database since the last sync
+ * with an overlap window, the jti already loaded are skipped
+ * and removes the expired ones from time to time
+ * The query runs without holding revoked_jti.lock, so the lookups aren't blocked during the sync
+ * On error, the next sync is delayed with an exponential backoff and the list loaded so far is kept
+ * Only the sync thread and revoked_jti_init call this function
+ */
+static int revoked_jti_sync(struct _oidc_config * config, time_t now) {
+  struct _h_connection * conn;
+  json_t * j_query, * j_result = NULL, * j_element = NULL;
+  const char * jti = NULL;
+  char * expires_at_clause, * created_at_clause;
+  json_int_t created_at_min = config->revoked_jti.last_created_at>GLEWLWYD_REVOKED_JTI_SYNC_OVERLAP?(config->revoked_jti.last_created_at - GLEWLWYD_REVOKED_JTI_SYNC_OVERLAP):0;
+  time_t backoff;
+  void * tmp;
+  size_t index = 0;
+  int res, ret;
+
+  if (config->glewlwyd_config->glewlwyd_config->conn->type==HOEL_DB_TYPE_MARIADB) {
+    expires_at_clause = msprintf("> FROM_UNIXTIME(%u)", (now));
+    created_at_clause = msprintf(">= FROM_UNIXTIME(%" JSON_INTEGER_FORMAT ")", created_at_min);
+  } else if (config->glewlwyd_config->glewlwyd_config->conn->type==HOEL_DB_TYPE_PGSQL) {
+    expires_at_clause = msprintf("> TO_TIMESTAMP(%u)", (now));
+    created_at_clause = msprintf(">= TO_TIMESTAMP(%" JSON_INTEGER_FORMAT ")", created_at_min);
+  } else { // HOEL_DB_TYPE_SQLITE
+    expires_at_clause = msprintf("> %u", (now));
+    created_at_clause = msprintf(">= %" JSON_INTEGER_FORMAT, created_at_min);
+  }
+  j_query = json_pack("{sss[sss]s{sss{ssss}s{ssss}}ss}",
+                      "table",
+                      GLEWLWYD_PLUGIN_OIDC_TABLE_ACCESS_TOKEN_REVOKED,
+                      "columns",
+                        SWITCH_DB_TYPE(config->glewlwyd_config->glewlwyd_config->conn->type, "UNIX_TIMESTAMP(gpoar_created_at) AS created_at", "gpoar_created_at AS created_at", "EXTRACT(EPOCH FROM gpoar_created_at)::integer AS created_at"),
+                        "gpoar_jti AS jti",
+                        SWITCH_DB_TYPE(config->glewlwyd_config->glewlwyd_config->conn->type, "UNIX_TIMESTAMP(gpoar_expires_at) AS exp", "gpoar_expires_at AS exp", "EXTRACT(EPOCH FROM gpoar_expires_at)::integer AS exp"),
+                      "where",
+                        "gpoar_plugin_name",
+                        config->name,
+                        "gpoar_created_at",
+                          "operator",
+                          "raw",
+                          "value",
+                          created_at_clause,
+                        "gpoar_expires_at",
+                          "operator",
+                          "raw",
+                          "value",
+                          expires_at_clause,
+                      "order_by",
+                      "gpoar_created_at");
+  o_free(expires_at_clause);
+  o_free(created_at_clause);
+  conn = config->glewlwyd_config->glewlwyd_plugin_callback_db_acquire(config->glewlwyd_config);
+  res = h_select(conn, j_query, &j_result, NULL);
+  config->glewlwyd_config->glewlwyd_plugin_callback_db_release(config->glewlwyd_config, conn);
+  json_decref(j_query);
+  if (res == H_OK) {
+    if (!pthread_rwlock_wrlock(&config->revoked_jti.lock)) {
+      json_array_foreach(j_result, index, j_element) {
+        if (json_object_get(config->revoked_jti.j_jti, json_string_value(json_object_get(j_element, "jti"))) == NULL) {
+          json_object_set(config->revoked_jti.j_jti, json_string_value(json_object_get(j_element, "jti")), json_object_get(j_element, "exp"));
+          revoked_jti_bloom_add(config, json_string_value(json_object_get(j_element, "jti")));
+        }
+        if (json_integer_value(json_object_get(j_element, "created_at")) > config->revoked_jti.last_created_at) {
+          config->revoked_jti.last_created_at = json_integer_value(json_object_get(j_element, "created_at"));
+        }
+      }
+      if (now >= config->revoked_jti.next_purge) {
+        // A bloom filter can't remove values, so it's rebuilt with the jti not expired yet
+        memset(config->revoked_jti.bloom, 0, GLEWLWYD_REVOKED_JTI_BLOOM_BITS/8);
+        json_object_foreach_safe(config->revoked_jti.j_jti, tmp, jti, j_element) {
+          if (json_integer_value(j_element) <= (json_int_t)now) {
+            json_object_del(config->revoked_jti.j_jti, jti);
+          } else {
+            revoked_jti_bloom_add(config, jti);
+          }
+        }
+        config->revoked_jti.next_purge = now + GLEWLWYD_REVOKED_JTI_PURGE_INTERVAL;
+      }
+      pthread_rwlock_unlock(&config->revoked_jti.lock);
+      config->revoked_jti.nb_sync_errors = 0;
+      config->revoked_jti.next_sync = now + GLEWLWYD_REVOKED_JTI_SYNC_INTERVAL;
+      ret = G_OK;
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "revoked_jti_sync - Error pthread_rwlock_wrlock");
+      ret = G_ERROR;
+    }
+    json_decref(j_result);
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "revoked_jti_sync - Error executing j_query");
+    ret = G_ERROR_DB;
+  }
+  if (ret != G_OK) {
+    // The database isn't hammered while it's unavailable, the lookups keep using the list loaded so far
+    if (config->revoked_jti.nb_sync_errors < 16) {
+      config->revoked_jti.nb_sync_errors++;
+    }
+    backoff = ((time_t)GLEWLWYD_REVOKED_JTI_SYNC_INTERVAL) << (config->revoked_jti.nb_sync_errors - 1);
+    if (backoff > GLEWLWYD_REVOKED_JTI_SYNC_BACKOFF_MAX) {
+      backoff = GLEWLWYD_REVOKED_JTI_SYNC_BACKOFF_MAX;
+    }
+    config->revoked_jti.next_sync = now + backoff;
+  }
+  return ret;
+}
+
+/**
+ * Background thread that syncs the revoked jti list until revoked_jti_close is called
+ */
+static void * revoked_jti_sync_run(void * args) {
+  struct _oidc_config * config = (struct _oidc_config *)args;
+  struct timespec abstime;
+  time_t now;
+  int stop = 0;
+
+  while (!stop) {
+    time(&now);
+    if (now >= config->revoked_jti.next_sync && revoked_jti_sync(config, now) != G_OK) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "revoked_jti_sync_run - Error revoked_jti_sync, next attempt in %u seconds", (unsigned int)(config->revoked_jti.next_sync - now));
+    }
+    clock_gettime(CLOCK_REALTIME, &abstime);
+    abstime.tv_sec += (config->revoked_jti.next_sync > now)?(config->revoked_jti.next_sync - now):1;
+    if (!pthread_mutex_lock(&config->revoked_jti.sync_lock)) {
+      if (!config->revoked_jti.sync_stop) {
+        pthread_cond_timedwait(&config->revoked_jti.sync_cond, &config->revoked_jti.sync_lock, &abstime);
+      }
+      stop = config->revoked_jti.sync_stop;
+      pthread_mutex_unlock(&config->revoked_jti.sync_lock);
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Returns G_OK if the jti is revoked, G_ERROR_NOT_FOUND if it's not
+ * Any other error must be considered as a revoked jti
+ */
+static int is_jti_revoked(struct _oidc_config * config, const char * jti) {
+  int ret;
+
+  if (!pthread_rwlock_rdlock(&config->revoked_jti.lock)) {
+    if (!revoked_jti_bloom_check(config, jti)) {
+      ret = G_ERROR_NOT_FOUND;
+    } else if (json_object_get(config->revoked_jti.j_jti, jti) != NULL) {
+      ret = G_OK;
+    } else {
+      ret = G_ERROR_NOT_FOUND;
+    }
+    pthread_rwlock_unlock(&config->revoked_jti.lock);
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "is_jti_revoked - Error pthread_rwlock_rdlock");
+    ret = G_ERROR;
+  }
+  return ret;
+}
+
+/**
+ * Returns G_OK if the stateless access token is revoked, by its jti or with the refresh token it was issued with,
+ * G_ERROR_NOT_FOUND if it's not
+ * Any other error must be considered as a revoked access token
+ */
+static int is_access_token_revoked(struct _oidc_config * config, json_t * j_claims) {
+  int ret;
+
+  if (!json_string_length(json_object_get(j_claims, "jti"))) {
+    ret = G_ERROR_PARAM;
+  } else if ((ret = is_jti_revoked(config, json_string_value(json_object_get(j_claims, "jti")))) == G_ERROR_NOT_FOUND && json_string_length(json_object_get(j_claims, "refresh_token_jti"))) {
+    ret = is_jti_revoked(config, json_string_value(json_object_get(j_claims, "refresh_token_jti")));
+  }
+  return ret;
+}
+
+/**
+ * Adds a jti to the revoked list until the access token expires
+ */
+static int revoke_jti(struct _oidc_config * config, const char * jti, json_int_t exp) {
+  json_t * j_query;
+  char * expires_at_clause;
+  int res, ret;
+
+  if (config->glewlwyd_config->glewlwyd_config->conn->type==HOEL_DB_TYPE_MARIADB) {
+    expires_at_clause = msprintf("FROM_UNIXTIME(%" JSON_INTEGER_FORMAT ")", exp);
+  } else if (config->glewlwyd_config->glewlwyd_config->conn->type==HOEL_DB_TYPE_PGSQL) {
+    expires_at_clause = msprintf("TO_TIMESTAMP(%" JSON_INTEGER_FORMAT ")", exp);
+  } else { // HOEL_DB_TYPE_SQLITE
+    expires_at_clause = msprintf("%" JSON_INTEGER_FORMAT, exp);
+  }
+  j_query = json_pack("{sss{sssss{ss}s{ss}}}",
+                      "table",
+                      GLEWLWYD_PLUGIN_OIDC_TABLE_ACCESS_TOKEN_REVOKED,
+                      "values",
+                        "gpoar_plugin_name",
+                        config->name,
+                        "gpoar_jti",
+                        jti,
+                        "gpoar_expires_at",
+                          "raw",
+                          expires_at_clause,
+                        "gpoar_created_at",
+                          "raw",
+                          SWITCH_DB_TYPE(config->glewlwyd_config->glewlwyd_config->conn->type, "CURRENT_TIMESTAMP", "strftime('%s','now')", "CURRENT_TIMESTAMP"));
+  o_free(expires_at_clause);
+  res = h_insert(config->glewlwyd_config->glewlwyd_config->conn, j_query, NULL);
+  json_decref(j_query);
+  if (res == H_OK) {
+    // The local list is updated right away, the other instances will get it on their next sync
+    if (!pthread_rwlock_wrlock(&config->revoked_jti.lock)) {
+      json_object_set_new(config->revoked_jti.j_jti, jti, json_integer(exp));
+      revoked_jti_bloom_add(config, jti);
+      pthread_rwlock_unlock(&config->revoked_jti.lock);
+    }
+    ret = G_OK;
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "revoke_jti - Error executing j_query");
+    ret = G_ERROR_DB;
+  }
+  return ret;
+}
+
+/**
+ * Revokes the stateless access tokens issued with a refresh token
+ * The refresh token jti is added to the revoked list until the last access token issued with it expires
+ */
+static int revoke_refresh_token_jti(struct _oidc_config * config, const char * refresh_token_jti) {
+  int ret;
+
+  if (!config->access_token_stateless || !o_strlen(refresh_token_jti)) {
+    ret = G_OK;
+  } else {
+    ret = revoke_jti(config, refresh_token_jti, ((json_int_t)time(NULL)) + config->access_token_duration);
+  }
+  return ret;
+}
+
+/**
+ * Loads the revoked jti list and starts the sync thread
+ * If the first sync fails, the plugin starts anyway and the sync thread retries
+ */
+static int revoked_jti_init(struct _oidc_config * config) {
+  int ret;
+
+  config->revoked_jti.j_jti = NULL;
+  config->revoked_jti.last_created_at = 0;
+  config->revoked_jti.next_sync = 0;
+  config->revoked_jti.next_purge = time(NULL) + GLEWLWYD_REVOKED_JTI_PURGE_INTERVAL;
+  config->revoked_jti.nb_sync_errors = 0;
+  config->revoked_jti.sync_stop = 0;
+  if ((config->revoked_jti.bloom = o_malloc(GLEWLWYD_REVOKED_JTI_BLOOM_BITS/8)) != NULL && (config->revoked_jti.j_jti = json_object()) != NULL) {
+    memset(config->revoked_jti.bloom, 0, GLEWLWYD_REVOKED_JTI_BLOOM_BITS/8);
+    if (!pthread_rwlock_init(&config->revoked_jti.lock, NULL)) {
+      if (!pthread_mutex_init(&config->revoked_jti.sync_lock, NULL)) {
+        if (!pthread_cond_init(&config->revoked_jti.sync_cond, NULL)) {
+          if (revoked_jti_sync(config, time(NULL)) != G_OK) {
+            y_log_message(Y_LOG_LEVEL_ERROR, "revoked_jti_init - Error revoked_jti_sync, the sync thread will retry");
+          }
+          if (!pthread_create(&config->revoked_jti.sync_thread, NULL, revoked_jti_sync_run, (void *)config)) {
+            ret = G_OK;
+          } else {
+            y_log_message(Y_LOG_LEVEL_ERROR, "revoked_jti_init - Error pthread_create");
+            pthread_cond_destroy(&config->revoked_jti.sync_cond);
+            pthread_mutex_destroy(&config->revoked_jti.sync_lock);
+            pthread_rwlock_destroy(&config->revoked_jti.lock);
+            ret = G_ERROR;
+          }
+        } else {
+          y_log_message(Y_LOG_LEVEL_ERROR, "revoked_jti_init - Error pthread_cond_init");
+          pthread_mutex_destroy(&config->revoked_jti.sync_lock);
+          pthread_rwlock_destroy(&config->revoked_jti.lock);
+          ret = G_ERROR;
+        }
+      } else {
+        y_log_message(Y_LOG_LEVEL_ERROR, "revoked_jti_init - Error pthread_mutex_init");
+        pthread_rwlock_destroy(&config->revoked_jti.lock);
+        ret = G_ERROR;
+      }
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "revoked_jti_init - Error pthread_rwlock_init");
+      ret = G_ERROR;
+    }
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "revoked_jti_init - Error allocating resources for bloom");
+    ret = G_ERROR_MEMORY;
+  }
+  if (ret != G_OK) {
+    o_free(config->revoked_jti.bloom);
+    config->revoked_jti.bloom = NULL;
+    json_decref(config->revoked_jti.j_jti);
+    config->revoked_jti.j_jti = NULL;
+  }
+  return ret;
+}
+
+static void revoked_jti_close(struct _oidc_config * config) {
+  if (config->revoked_jti.bloom != NULL) {
+    if (!pthread_mutex_lock(&config->revoked_jti.sync_lock)) {
+      config->revoked_jti.sync_stop = 1;
+      pthread_cond_signal(&config->revoked_jti.sync_cond);
+      pthread_mutex_unlock(&config->revoked_jti.sync_lock);
+    }
+    pthread_join(config->revoked_jti.sync_thread, NULL);
+    pthread_cond_destroy(&config->revoked_jti.sync_cond);
+    pthread_mutex_destroy(&config->revoked_jti.sync_lock);
+    pthread_rwlock_destroy(&config->revoked_jti.lock);
+    o_free(config->revoked_jti.bloom);
+    config->revoked_jti.bloom = NULL;
+    json_decref(config->revoked_jti.j_jti);
+    config->revoked_jti.j_jti = NULL;
+  }
+}
+
+/**
+ * Store a signature of the acces token in the database
+ */
+static int serialize_access_token(struct _oidc_config * config,
+                                  uint auth_type,
+                                  json_int_t gpor_id,
+                                  const char * username,
+                                  const char * client_id,
+                                  const char * scope_list,
+                                  const char * resource,
+                                  time_t now,
+                                  const char * issued_for,
+                                  const char * user_agent,
+                                  const char * access_token,
+                                  const char * jti,
+                                  json_t * j_authorization_details) {
+  struct _h_connection * conn;
+  json_t * j_query, * j_last_id;
+  int res, ret, i;
   char * issued_at_clause, ** scope_array = NULL, * access_token_hash = NULL, * str_authorization_details = NULL;
 
-  if (pthread_mutex_lock(&config->insert_lock)) {
-    y_log_message(Y_LOG_LEVEL_ERROR, "serialize_access_token - oidc - Error pthread_mutex_lock");
+  if (config->access_token_stateless) {
+    // Stateless access tokens are self-contained and aren't stored, the ones linked to a refresh token
+    // have a refresh_token_jti claim so they're revoked with their refresh token
+    ret = G_OK;
+  } else if ((conn = insert_conn_acquire(config)) == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "serialize_access_token - oidc - Error insert_conn_acquire");
     ret = G_ERROR;
   } else {
     if ((access_token_hash = config->glewlwyd_config->glewlwyd_callback_generate_hash(config->glewlwyd_config, access_token)) != NULL) {
       if (issued_for != NULL && now > 0) {
-        if (config->glewlwyd_config->glewlwyd_config->conn->type==HOEL_DB_TYPE_MARIADB) {
+        if (conn->type==HOEL_DB_TYPE_MARIADB) {
           issued_at_clause = msprintf("FROM_UNIXTIME(%u)", (now));
-        } else if (config->glewlwyd_config->glewlwyd_config->conn->type==HOEL_DB_TYPE_PGSQL) {
+        } else if (conn->type==HOEL_DB_TYPE_PGSQL) {
           issued_at_clause = msprintf("TO_TIMESTAMP(%u)", (now));
         } else { // HOEL_DB_TYPE_SQLITE
           issued_at_clause = msprintf("%u", (now));
@@ -2539,10 +3460,10 @@ static int serialize_access_token(struct _oidc_config * config,
                               str_authorization_details);
         o_free(issued_at_clause);
         o_free(str_authorization_details);
-        res = h_insert(config->glewlwyd_config->glewlwyd_config->conn, j_query, NULL);
+        res = h_insert(conn, j_query, NULL);
         json_decref(j_query);
         if (res == H_OK) {
-          j_last_id = h_last_insert_id(config->glewlwyd_config->glewlwyd_config->conn);
+          j_last_id = h_last_insert_id(conn);
           if (j_last_id != NULL) {
             if (split_string(scope_list, " ", &scope_array) > 0) {
               j_query = json_pack("{sss[]}",
@@ -2553,7 +3474,7 @@ static int serialize_access_token(struct _oidc_config * config,
                 for (i=0; scope_array[i] != NULL; i++) {
                   json_array_append_new(json_object_get(j_query, "values"), json_pack("{sOss}", "gpoa_id", j_last_id, "gpoas_scope", scope_array[i]));
                 }
-                res = h_insert(config->glewlwyd_config->glewlwyd_config->conn, j_query, NULL);
+                res = h_insert(conn, j_query, NULL);
                 json_decref(j_query);
                 if (res == H_OK) {
                   ret = G_OK;
@@ -2587,7 +3508,7 @@ static int serialize_access_token(struct _oidc_config * config,
       y_log_message(Y_LOG_LEVEL_ERROR, "oidc serialize_access_token - Error glewlwyd_callback_generate_hash");
       ret = G_ERROR;
     }
-    pthread_mutex_unlock(&config->insert_lock);
+    insert_conn_release(config, conn);
   }
   return ret;
 }
@@ -2604,31 +3525,24 @@ static char * generate_access_token(struct _oidc_config * config,
                                     const char * resource,
                                     time_t now,
                                     char * jti,
+                                    const char * refresh_token_jti,
                                     const char * x5t_s256,
                                     const char * dpop_jkt,
                                     json_t * j_authorization_details,
                                     const char * ip_source) {
   jwt_t * jwt = NULL;
-  jwk_t * jwk = NULL;
+  const struct _oidc_sign_key * sign_key = get_sign_key(config, j_client);
   char * token = NULL, * property = NULL, * sub = get_sub(config, username, j_client);
   json_t * j_element = NULL, * j_value, * j_cnf;
   size_t index = 0, index_p = 0;
-  const char * sign_kid = json_string_value(json_object_get(config->j_params, "client-sign_kid-parameter"));
 
   if (sub != NULL) {
-    if ((jwt = r_jwt_copy(config->jwt_sign)) != NULL) {
+    if (sign_key != NULL && (jwt = r_jwt_copy(sign_key->jwt)) != NULL) {
       r_jwt_set_header_str_value(jwt, "typ", "at+jwt");
       rand_string_nonce(jti, OIDC_JTI_LENGTH);
       r_jwt_set_claim_str_value(jwt, "iss", json_string_value(json_object_get(config->j_params, "iss")));
       if (j_client != NULL) {
         r_jwt_set_claim_str_value(jwt, "client_id", json_string_value(json_object_get(j_client, "client_id")));
-        if (json_string_length(json_object_get(j_client, sign_kid))) {
-          jwk = r_jwks_get_by_kid(config->jwt_sign->jwks_privkey_sign, json_string_value(json_object_get(j_client, sign_kid)));
-        } else {
-          jwk = r_jwk_copy(config->jwk_sign_default);
-        }
-      } else {
-        jwk = r_jwk_copy(config->jwk_sign_default);
       }
       if (resource != NULL) {
         r_jwt_set_claim_str_value(jwt, "aud", resource);
@@ -2637,6 +3551,10 @@ static char * generate_access_token(struct _oidc_config * config,
       }
       r_jwt_set_claim_str_value(jwt, "sub", sub);
       r_jwt_set_claim_str_value(jwt, "jti", jti);
+      if (config->access_token_stateless && o_strlen(refresh_token_jti)) {
+        // A stateless access token isn't stored, this claim allows to revoke it with its refresh token
+        r_jwt_set_claim_str_value(jwt, "refresh_token_jti", refresh_token_jti);
+      }
       r_jwt_set_claim_str_value(jwt, "type", "access_token");
       r_jwt_set_claim_int_value(jwt, "iat", now);
       r_jwt_set_claim_int_value(jwt, "exp", (((json_int_t)now) + config->access_token_duration));
@@ -2679,18 +3597,13 @@ static char * generate_access_token(struct _oidc_config * config,
           }
         }
       }
-      if (jwk != NULL) {
-        if (r_jwk_get_property_str(jwk, "alg") != NULL) {
-          r_jwt_set_sign_alg(jwt, r_str_to_jwa_alg(r_jwk_get_property_str(jwk, "alg")));
-        }
-        if ((token = r_jwt_serialize_signed(jwt, jwk, 0)) == NULL) {
-          y_log_message(Y_LOG_LEVEL_ERROR, "generate_access_token - oidc - Error r_jwt_serialize_signed");
-        } else {
-          y_log_message(Y_LOG_LEVEL_INFO, "Event oidc - Plugin '%s' - Access token generated for client '%s' granted by user '%s' with scope list '%s', origin: %s", config->name, json_string_value(json_object_get(j_client, "client_id")), username, scope_list, ip_source);
-        }
+      if ((token = r_jwt_serialize_signed(jwt, sign_key->jwk, 0)) == NULL) {
+        y_log_message(Y_LOG_LEVEL_ERROR, "generate_access_token - oidc - Error r_jwt_serialize_signed");
       } else {
-        y_log_message(Y_LOG_LEVEL_ERROR, "generate_access_token - oidc - Error no jwk to sign");
+        y_log_message(Y_LOG_LEVEL_INFO, "Event oidc - Plugin '%s' - Access token generated for client '%s' granted by user '%s' with scope list '%s', origin: %s", config->name, json_string_value(json_object_get(j_client, "client_id")), username, scope_list, ip_source);
       }
+    } else if (sign_key == NULL) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "generate_access_token - oidc - Error no jwk to sign");
     } else {
       y_log_message(Y_LOG_LEVEL_ERROR, "generate_access_token - oidc - Error r_jwt_copy");
     }
@@ -2699,7 +3612,6 @@ static char * generate_access_token(struct _oidc_config * config,
     y_log_message(Y_LOG_LEVEL_ERROR, "generate_access_token - oidc - Error get_sub");
   }
   o_free(sub);
-  r_jwk_free(jwk);
   return token;
 }
 
@@ -2723,34 +3635,35 @@ static json_t * serialize_refresh_token(struct _oidc_config * config,
                                         char * jti,
                                         const char * dpop_jkt,
                                         json_t * j_authorization_details) {
+  struct _h_connection * conn;
   char * token_hash = config->glewlwyd_config->glewlwyd_callback_generate_hash(config->glewlwyd_config, token);
   json_t * j_query, * j_return, * j_last_id;
   int res, i;
   char * issued_at_clause, * expires_at_clause, * last_seen_clause, ** scope_array = NULL, * str_claims_request = NULL, * str_authorization_details = NULL;
 
-  if (pthread_mutex_lock(&config->insert_lock)) {
-    y_log_message(Y_LOG_LEVEL_ERROR, "serialize_refresh_token - oidc - Error pthread_mutex_lock");
+  if ((conn = insert_conn_acquire(config)) == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "serialize_refresh_token - oidc - Error insert_conn_acquire");
     j_return = json_pack("{si}", "result", G_ERROR);
   } else {
     if (token_hash != NULL && username != NULL && issued_for != NULL && now > 0 && duration > 0) {
       json_error_t error;
-      if (config->glewlwyd_config->glewlwyd_config->conn->type==HOEL_DB_TYPE_MARIADB) {
+      if (conn->type==HOEL_DB_TYPE_MARIADB) {
         issued_at_clause = msprintf("FROM_UNIXTIME(%u)", (now));
-      } else if (config->glewlwyd_config->glewlwyd_config->conn->type==HOEL_DB_TYPE_PGSQL) {
+      } else if (conn->type==HOEL_DB_TYPE_PGSQL) {
         issued_at_clause = msprintf("TO_TIMESTAMP(%u)", (now));
       } else { // HOEL_DB_TYPE_SQLITE
         issued_at_clause = msprintf("%u", (now));
       }
-      if (config->glewlwyd_config->glewlwyd_config->conn->type==HOEL_DB_TYPE_MARIADB) {
+      if (conn->type==HOEL_DB_TYPE_MARIADB) {
         last_seen_clause = msprintf("FROM_UNIXTIME(%u)", (now));
-      } else if (config->glewlwyd_config->glewlwyd_config->conn->type==HOEL_DB_TYPE_PGSQL) {
+      } else if (conn->type==HOEL_DB_TYPE_PGSQL) {
         last_seen_clause = msprintf("TO_TIMESTAMP(%u)", (now));
       } else { // HOEL_DB_TYPE_SQLITE
         last_seen_clause = msprintf("%u", (now));
       }
-      if (config->glewlwyd_config->glewlwyd_config->conn->type==HOEL_DB_TYPE_MARIADB) {
+      if (conn->type==HOEL_DB_TYPE_MARIADB) {
         expires_at_clause = msprintf("FROM_UNIXTIME(%u)", (now + (unsigned int)duration));
-      } else if (config->glewlwyd_config->glewlwyd_config->conn->type==HOEL_DB_TYPE_PGSQL) {
+      } else if (conn->type==HOEL_DB_TYPE_PGSQL) {
         expires_at_clause = msprintf("TO_TIMESTAMP(%u)", (now + (unsigned int)duration ));
       } else { // HOEL_DB_TYPE_SQLITE
         expires_at_clause = msprintf("%u", (now + (unsigned int)duration));
@@ -2804,7 +3717,8 @@ static json_t * serialize_refresh_token(struct _oidc_config * config,
                             dpop_jkt,
                             "gpor_authorization_details",
                             str_authorization_details);
-      if (config->refresh_token_one_use) {
+      if ((config->refresh_token_one_use || config->access_token_stateless) && jti != NULL) {
+        // In stateless mode, the jti links the access tokens to the refresh token they were issued with
         if (!o_strlen(jti)) {
           rand_string_nonce(jti, OIDC_JTI_LENGTH);
         }
@@ -2815,10 +3729,10 @@ static json_t * serialize_refresh_token(struct _oidc_config * config,
       o_free(last_seen_clause);
       o_free(str_claims_request);
       o_free(str_authorization_details);
-      res = h_insert(config->glewlwyd_config->glewlwyd_config->conn, j_query, NULL);
+      res = h_insert(conn, j_query, NULL);
       json_decref(j_query);
       if (res == H_OK) {
-        j_last_id = h_last_insert_id(config->glewlwyd_config->glewlwyd_config->conn);
+        j_last_id = h_last_insert_id(conn);
         if (j_last_id != NULL) {
           if (split_string(scope_list, " ", &scope_array) > 0) {
             j_query = json_pack("{sss[]}",
@@ -2829,7 +3743,7 @@ static json_t * serialize_refresh_token(struct _oidc_config * config,
               for (i=0; scope_array[i] != NULL; i++) {
                 json_array_append_new(json_object_get(j_query, "values"), json_pack("{sOss}", "gpor_id", j_last_id, "gpors_scope", scope_array[i]));
               }
-              res = h_insert(config->glewlwyd_config->glewlwyd_config->conn, j_query, NULL);
+              res = h_insert(conn, j_query, NULL);
               json_decref(j_query);
               if (res == H_OK) {
                 j_return = json_pack("{sisO}", "result", G_OK, "gpor_id", j_last_id);
@@ -2859,7 +3773,7 @@ static json_t * serialize_refresh_token(struct _oidc_config * config,
       j_return = json_pack("{si}", "result", G_ERROR_PARAM);
     }
     o_free(token_hash);
-    pthread_mutex_unlock(&config->insert_lock);
+    insert_conn_release(config, conn);
   }
   return j_return;
 }
@@ -3110,6 +4024,9 @@ static json_t * check_client_valid(struct _oidc_config * config,
         j_return = json_pack("{siss*}", "result", G_ERROR_PARAM, "error_description", error_description);
       }
     }
+  } else if (check_result_value(j_client, G_ERROR_UNAVAILABLE)) {
+    y_log_message(Y_LOG_LEVEL_DEBUG, "check_client_valid - oidc - Error, password check for client '%s' unavailable, origin: %s", client_id, ip_source);
+    j_return = json_pack("{si}", "result", G_ERROR_UNAVAILABLE);
   } else {
     y_log_message(Y_LOG_LEVEL_DEBUG, "check_client_valid - oidc - Error, client '%s' is invalid, origin: %s", client_id, ip_source);
     j_return = json_pack("{si}", "result", G_ERROR_UNAUTHORIZED);
@@ -3179,13 +4096,14 @@ static char * generate_authorization_code(struct _oidc_config * config,
                                           int auth_type,
                                           const char * code_challenge,
                                           json_t * j_authorization_details) {
+  struct _h_connection * conn;
   char * code = NULL, * code_hash = NULL, * expiration_clause, ** scope_array = NULL, * str_claims = NULL, * str_authorization_details = NULL;
   json_t * j_query, * j_code_id;
   int res, i;
   time_t now;
 
-  if (pthread_mutex_lock(&config->insert_lock)) {
-    y_log_message(Y_LOG_LEVEL_ERROR, "generate_authorization_code - oidc - Error pthread_mutex_lock");
+  if ((conn = insert_conn_acquire(config)) == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "generate_authorization_code - oidc - Error insert_conn_acquire");
   } else {
     code = o_malloc(33*sizeof(char));
     if (code != NULL) {
@@ -3199,9 +4117,9 @@ static char * generate_authorization_code(struct _oidc_config * config,
             }
           }
           time(&now);
-          if (config->glewlwyd_config->glewlwyd_config->conn->type==HOEL_DB_TYPE_MARIADB) {
+          if (conn->type==HOEL_DB_TYPE_MARIADB) {
             expiration_clause = msprintf("FROM_UNIXTIME(%u)", (now + (unsigned int)config->code_duration ));
-          } else if (config->glewlwyd_config->glewlwyd_config->conn->type==HOEL_DB_TYPE_PGSQL) {
+          } else if (conn->type==HOEL_DB_TYPE_PGSQL) {
             expiration_clause = msprintf("TO_TIMESTAMP(%u)", (now + (unsigned int)config->code_duration ));
           } else { // HOEL_DB_TYPE_SQLITE
             expiration_clause = msprintf("%u", (now + (unsigned int)config->code_duration ));
@@ -3232,7 +4150,7 @@ static char * generate_authorization_code(struct _oidc_config * config,
           o_free(expiration_clause);
           o_free(str_claims);
           o_free(str_authorization_details);
-          res = h_insert(config->glewlwyd_config->glewlwyd_config->conn, j_query, NULL);
+          res = h_insert(conn, j_query, NULL);
           json_decref(j_query);
           if (res != H_OK) {
             y_log_message(Y_LOG_LEVEL_ERROR, "generate_authorization_code - oidc - Error executing j_query (1)");
@@ -3240,7 +4158,7 @@ static char * generate_authorization_code(struct _oidc_config * config,
             code = NULL;
           } else {
             if (scope_list != NULL) {
-              j_code_id = h_last_insert_id(config->glewlwyd_config->glewlwyd_config->conn);
+              j_code_id = h_last_insert_id(conn);
               if (j_code_id != NULL) {
                 j_query = json_pack("{sss[]}",
                                     "table",
@@ -3250,7 +4168,7 @@ static char * generate_authorization_code(struct _oidc_config * config,
                   for (i=0; scope_array[i] != NULL; i++) {
                     json_array_append_new(json_object_get(j_query, "values"), json_pack("{sOss}", "gpoc_id", j_code_id, "gpocs_scope", scope_array[i]));
                   }
-                  res = h_insert(config->glewlwyd_config->glewlwyd_config->conn, j_query, NULL);
+                  res = h_insert(conn, j_query, NULL);
                   json_decref(j_query);
                   if (res != H_OK) {
                     y_log_message(Y_LOG_LEVEL_ERROR, "generate_authorization_code - oidc - Error executing j_query (2)");
@@ -3290,7 +4208,7 @@ static char * generate_authorization_code(struct _oidc_config * config,
     } else {
       y_log_message(Y_LOG_LEVEL_ERROR, "generate_authorization_code - oidc - Error allocating resources for code");
     }
-    pthread_mutex_unlock(&config->insert_lock);
+    insert_conn_release(config, conn);
   }
 
   return code;
@@ -3589,13 +4507,19 @@ static int revoke_tokens_from_code(struct _oidc_config * config, json_int_t gpoc
       y_log_message(Y_LOG_LEVEL_INFO, "Event oidc - Plugin '%s' - Access token jti '%s' generated for client '%s' revoked, origin: %s", config->name, json_string_value(json_object_get(j_element, "jti")), json_string_value(json_object_get(j_element, "client_id")), ip_source);
     }
     json_decref(j_result);
-    query = msprintf("SELECT gpor_client_id AS client_id FROM " GLEWLWYD_PLUGIN_OIDC_TABLE_REFRESH_TOKEN " WHERE gpoc_id=%" JSON_INTEGER_FORMAT " AND gpor_enabled=1", gpoc_id);
+    query = msprintf("SELECT DISTINCT gpor_client_id AS client_id, gpor_jti AS jti FROM " GLEWLWYD_PLUGIN_OIDC_TABLE_REFRESH_TOKEN " WHERE gpoc_id=%" JSON_INTEGER_FORMAT " AND gpor_enabled=1", gpoc_id);
     res = h_execute_query_json(config->glewlwyd_config->glewlwyd_config->conn, query, &j_result_r);
     o_free(query);
     if (res == H_OK) {
       if (json_array_size(j_result_r)) {
         y_log_message(Y_LOG_LEVEL_INFO, "Event oidc - Plugin '%s' - Refresh token generated for client '%s' revoked, origin: %s", config->name, json_string_value(json_object_get(json_array_get(j_result_r, 0), "client_id")), ip_source);
       }
+      json_array_foreach(j_result_r, index, j_element) {
+        // The stateless access tokens aren't stored, they're revoked with the refresh token they were issued with
+        if (revoke_refresh_token_jti(config, json_string_value(json_object_get(j_element, "jti"))) != G_OK) {
+          y_log_message(Y_LOG_LEVEL_ERROR, "oidc revoke_tokens_from_code - Error revoke_refresh_token_jti");
+        }
+      }
       json_decref(j_result_r);
       query = msprintf("UPDATE " GLEWLWYD_PLUGIN_OIDC_TABLE_ACCESS_TOKEN " SET gpoa_enabled='0' WHERE gpor_id IN (SELECT gpor_id FROM " GLEWLWYD_PLUGIN_OIDC_TABLE_REFRESH_TOKEN " WHERE gpoc_id=%" JSON_INTEGER_FORMAT ")", gpoc_id);
       res = h_execute_query(config->glewlwyd_config->glewlwyd_config->conn, query, NULL, H_OPTION_EXEC);
@@ -3894,14 +4818,83 @@ static json_t * validate_session_client_scope(struct _oidc_config * config, cons
   return j_return;
 }
 
+/**
+ * Returns a column expression with the space separated scope list of a token,
+ * aggregated from its scope table with a subquery in the database dialect
+ * On MariaDB, GROUP_CONCAT truncates its result to group_concat_max_len bytes,
+ * so the column scope_length, the length in bytes of the complete list, is added to detect a truncated list
+ * Setting group_concat_max_len in the session isn't reliable since the connections may be shared
+ */
+static char * get_scope_list_column(struct _oidc_config * config, const char * table, const char * scope_table, const char * id_column, const char * scope_column) {
+  char * column = NULL;
+
+  switch (config->glewlwyd_config->glewlwyd_config->conn->type) {
+    case HOEL_DB_TYPE_MARIADB:
+      column = msprintf("(SELECT GROUP_CONCAT(%s SEPARATOR ' ') FROM %s WHERE %s.%s=%s.%s) AS scope, (SELECT CAST(COALESCE(SUM(LENGTH(%s))+COUNT(%s)-1, 0) AS SIGNED) FROM %s WHERE %s.%s=%s.%s) AS scope_length", scope_column, scope_table, scope_table, id_column, table, id_column, scope_column, scope_column, scope_table, scope_table, id_column, table, id_column);
+      break;
+    case HOEL_DB_TYPE_PGSQL:
+      column = msprintf("(SELECT string_agg(%s, ' ') FROM %s WHERE %s.%s=%s.%s) AS scope", scope_column, scope_table, scope_table, id_column, table, id_column);
+      break;
+    default: // HOEL_DB_TYPE_SQLITE
+      column = msprintf("(SELECT group_concat(%s, ' ') FROM %s WHERE %s.%s=%s.%s) AS scope", scope_column, scope_table, scope_table, id_column, table, id_column);
+      break;
+  }
+  return column;
+}
+
+/**
+ * Sets the scope value of a token read with get_scope_list_column again if it was truncated by the database
+ * The scope list is then read from the scope table without aggregation
+ */
+static int check_scope_list_column(struct _oidc_config * config, json_t * j_token, const char * scope_table, const char * id_column, const char * scope_column) {
+  json_t * j_query, * j_result, * j_element = NULL;
+  char * scope_list = NULL;
+  size_t index = 0;
+  int res, ret = G_OK;
+
+  if (json_object_get(j_token, "scope_length") != NULL) {
+    if (json_integer_value(json_object_get(j_token, "scope_length")) != (json_int_t)json_string_length(json_object_get(j_token, "scope"))) {
+      y_log_message(Y_LOG_LEVEL_WARNING, "check_scope_list_column - Scope list truncated by the database, increase group_concat_max_len");
+      j_query = json_pack("{sss[s]s{sO}}",
+                          "table",
+                          scope_table,
+                          "columns",
+                            scope_column,
+                          "where",
+                            id_column,
+                            json_object_get(j_token, id_column));
+      res = h_select(config->glewlwyd_config->glewlwyd_config->conn, j_query, &j_result, NULL);
+      json_decref(j_query);
+      if (res == H_OK) {
+        json_array_foreach(j_result, index, j_element) {
+          if (scope_list == NULL) {
+            scope_list = o_strdup(json_string_value(json_object_get(j_element, scope_column)));
+          } else {
+            scope_list = mstrcatf(scope_list, " %s", json_string_value(json_object_get(j_element, scope_column)));
+          }
+        }
+        json_object_set_new(j_token, "scope", json_string(scope_list!=NULL?scope_list:""));
+        o_free(scope_list);
+        json_decref(j_result);
+      } else {
+        y_log_message(Y_LOG_LEVEL_ERROR, "check_scope_list_column - Error executing j_query");
+        ret = G_ERROR_DB;
+      }
+    }
+    json_object_del(j_token, "scope_length");
+  }
+  return ret;
+}
+
 /**
  * Verify that the refresh token is still valid to get an access token
+ * The token and its space separated scope list are read in one query
  */
 static json_t * validate_refresh_token(struct _oidc_config * config, const char * refresh_token) {
-  json_t * j_return, * j_query, * j_result, * j_result_scope, * j_element = NULL;
-  char * token_hash, * expires_at_clause;
+  struct _h_connection * conn;
+  json_t * j_return, * j_query, * j_result, * j_token;
+  char * token_hash, * expires_at_clause, * scope_column;
   int res, enabled;
-  size_t index = 0;
   time_t now;
 
   if (refresh_token != NULL) {
@@ -3915,7 +4908,8 @@ static json_t * validate_refresh_token(struct _oidc_config * config, const char
       } else { // HOEL_DB_TYPE_SQLITE
         expires_at_clause = msprintf("> %u", (now));
       }
-      j_query = json_pack("{sss[ssssssssssssssss]s{sssss{ssss}}}",
+      scope_column = get_scope_list_column(config, GLEWLWYD_PLUGIN_OIDC_TABLE_REFRESH_TOKEN, GLEWLWYD_PLUGIN_OIDC_TABLE_REFRESH_TOKEN_SCOPE, "gpor_id", "gpors_scope");
+      j_query = json_pack("{sss[sssssssssssssssss]s{sssss{ssss}}}",
                           "table",
                           GLEWLWYD_PLUGIN_OIDC_TABLE_REFRESH_TOKEN,
                           "columns",
@@ -3935,6 +4929,7 @@ static json_t * validate_refresh_token(struct _oidc_config * config, const char
                             "gpor_resource AS resource",
                             "gpor_authorization_details",
                             "gpor_enabled",
+                            scope_column,
                           "where",
                             "gpor_plugin_name",
                             config->name,
@@ -3946,49 +4941,36 @@ static json_t * validate_refresh_token(struct _oidc_config * config, const char
                               "value",
                               expires_at_clause);
       o_free(expires_at_clause);
-      res = h_select(config->glewlwyd_config->glewlwyd_config->conn, j_query, &j_result, NULL);
+      o_free(scope_column);
+      conn = config->glewlwyd_config->glewlwyd_plugin_callback_db_acquire(config->glewlwyd_config);
+      res = h_select(conn, j_query, &j_result, NULL);
+      config->glewlwyd_config->glewlwyd_plugin_callback_db_release(config->glewlwyd_config, conn);
       json_decref(j_query);
       if (res == H_OK) {
-        if (json_array_size(j_result) > 0) {
-          enabled = json_integer_value(json_object_get(json_array_get(j_result, 0), "gpor_enabled"));
-          json_object_set(json_array_get(j_result, 0), "rolling_expiration", json_integer_value(json_object_get(json_array_get(j_result, 0), "gpor_rolling_expiration"))?json_true():json_false());
-          json_object_del(json_array_get(j_result, 0), "gpor_rolling_expiration");
-          json_object_del(json_array_get(j_result, 0), "gpor_enabled");
-          if (json_object_get(json_array_get(j_result, 0), "gpor_authorization_details") != json_null()) {
-            json_object_set_new(json_array_get(j_result, 0), "authorization_details", json_loads(json_string_value(json_object_get(json_array_get(j_result, 0), "gpor_authorization_details")), JSON_DECODE_ANY, NULL));
-          }
-          json_object_del(json_array_get(j_result, 0), "gpor_authorization_details");
-          j_query = json_pack("{sss[s]s{sO}}",
-                              "table",
-                              GLEWLWYD_PLUGIN_OIDC_TABLE_REFRESH_TOKEN_SCOPE,
-                              "columns",
-                                "gpors_scope AS scope",
-                              "where",
-                                "gpor_id",
-                                json_object_get(json_array_get(j_result, 0), "gpor_id"));
-          res = h_select(config->glewlwyd_config->glewlwyd_config->conn, j_query, &j_result_scope, NULL);
-          if (res == H_OK) {
-            if (!json_object_set_new(json_array_get(j_result, 0), "scope", json_array())) {
-              json_array_foreach(j_result_scope, index, j_element) {
-                json_array_append(json_object_get(json_array_get(j_result, 0), "scope"), json_object_get(j_element, "scope"));
-              }
-              j_return = json_pack("{sisO}", "result", enabled?G_OK:G_ERROR_UNAUTHORIZED, "token", json_array_get(j_result, 0));
-            } else {
-              y_log_message(Y_LOG_LEVEL_ERROR, "oidc validate_refresh_token - Error json_object_set_new");
-              j_return = json_pack("{si}", "result", G_ERROR);
-            }
-            json_decref(j_result_scope);
+        if ((j_token = json_array_get(j_result, 0)) != NULL) {
+          enabled = json_integer_value(json_object_get(j_token, "gpor_enabled"));
+          json_object_set(j_token, "rolling_expiration", json_integer_value(json_object_get(j_token, "gpor_rolling_expiration"))?json_true():json_false());
+          json_object_del(j_token, "gpor_rolling_expiration");
+          json_object_del(j_token, "gpor_enabled");
+          if (json_object_get(j_token, "gpor_authorization_details") != json_null()) {
+            json_object_set_new(j_token, "authorization_details", json_loads(json_string_value(json_object_get(j_token, "gpor_authorization_details")), JSON_DECODE_ANY, NULL));
+          }
+          json_object_del(j_token, "gpor_authorization_details");
+          if (!json_is_string(json_object_get(j_token, "scope"))) {
+            json_object_set_new(j_token, "scope", json_string(""));
+          }
+          if (check_scope_list_column(config, j_token, GLEWLWYD_PLUGIN_OIDC_TABLE_REFRESH_TOKEN_SCOPE, "gpor_id", "gpors_scope") == G_OK) {
+            j_return = json_pack("{sisO}", "result", enabled?G_OK:G_ERROR_UNAUTHORIZED, "token", j_token);
           } else {
-            y_log_message(Y_LOG_LEVEL_ERROR, "oidc validate_refresh_token - Error executing j_query (2)");
+            y_log_message(Y_LOG_LEVEL_ERROR, "oidc validate_refresh_token - Error check_scope_list_column");
             j_return = json_pack("{si}", "result", G_ERROR_DB);
           }
-          json_decref(j_query);
         } else {
           j_return = json_pack("{si}", "result", G_ERROR_NOT_FOUND);
         }
         json_decref(j_result);
       } else {
-        y_log_message(Y_LOG_LEVEL_ERROR, "oidc validate_refresh_token - Error executing j_query (1)");
+        y_log_message(Y_LOG_LEVEL_ERROR, "oidc validate_refresh_token - Error executing j_query");
         j_return = json_pack("{si}", "result", G_ERROR_DB);
       }
     } else {
@@ -4093,11 +5075,12 @@ static int refresh_token_disable(struct _oidc_config * config, const char * user
   size_t token_hash_dec_len = 0;
 
   if (o_base64url_2_base64((unsigned char *)token_hash, o_strlen(token_hash), token_hash_dec, &token_hash_dec_len)) {
-    j_query = json_pack("{sss[ss]s{ssssss%}}",
+    j_query = json_pack("{sss[sss]s{ssssss%}}",
                         "table",
                         GLEWLWYD_PLUGIN_OIDC_TABLE_REFRESH_TOKEN,
                         "columns",
                           "gpor_id",
+                          "gpor_jti AS jti",
                           "gpor_enabled",
                         "where",
                           "gpor_plugin_name",
@@ -4130,7 +5113,12 @@ static int refresh_token_disable(struct _oidc_config * config, const char * user
           json_decref(j_query);
           if (res == H_OK) {
             y_log_message(Y_LOG_LEVEL_DEBUG, "refresh_token_disable - token '[...%s]' disabled, origin: %s", token_hash + (o_strlen(token_hash) - (o_strlen(token_hash)>=8?8:o_strlen(token_hash))), ip_source);
-            ret = G_OK;
+            if (revoke_refresh_token_jti(config, json_string_value(json_object_get(json_array_get(j_result, 0), "jti"))) != G_OK) {
+              y_log_message(Y_LOG_LEVEL_ERROR, "refresh_token_disable - Error revoke_refresh_token_jti");
+              ret = G_ERROR_DB;
+            } else {
+              ret = G_OK;
+            }
           } else {
             y_log_message(Y_LOG_LEVEL_ERROR, "refresh_token_disable - Error executing j_query (2)");
             ret = G_ERROR_DB;
@@ -4159,6 +5147,7 @@ static int refresh_token_disable(struct _oidc_config * config, const char * user
  * update settings for a refresh token
  */
 static int update_refresh_token(struct _oidc_config * config, json_int_t gpor_id, json_int_t refresh_token_duration, int disable, time_t now) {
+  struct _h_connection * conn;
   json_t * j_query;
   int res, ret;
   char * expires_at_clause, * last_seen_clause;
@@ -4197,7 +5186,9 @@ static int update_refresh_token(struct _oidc_config * config, json_int_t gpor_id
   if (disable) {
     json_object_set_new(json_object_get(j_query, "set"), "gpor_enabled", json_integer(0));
   }
-  res = h_update(config->glewlwyd_config->glewlwyd_config->conn, j_query, NULL);
+  conn = config->glewlwyd_config->glewlwyd_plugin_callback_db_acquire(config->glewlwyd_config);
+  res = h_update(conn, j_query, NULL);
+  config->glewlwyd_config->glewlwyd_plugin_callback_db_release(config->glewlwyd_config, conn);
   json_decref(j_query);
   if (res == H_OK) {
     ret = G_OK;
@@ -4284,7 +5275,7 @@ static json_t * verify_request_signature(struct _oidc_config * config, jwt_t * j
         }
       } else if (alg == R_JWA_ALG_ES256 || alg == R_JWA_ALG_ES384 || alg == R_JWA_ALG_ES512 || alg == R_JWA_ALG_RS256 || alg == R_JWA_ALG_RS384 || alg == R_JWA_ALG_RS512 || alg == R_JWA_ALG_PS256 || alg == R_JWA_ALG_PS384 || alg == R_JWA_ALG_PS512 || alg == R_JWA_ALG_EDDSA) {
         if (json_string_length(json_object_get(json_object_get(j_client, "client"), json_string_value(json_object_get(config->j_params, "client-jwks_uri-parameter")))) && o_strlen(kid)) {
-          if (r_jwks_init(&jwks) == RHN_OK && r_jwks_import_from_uri(jwks, json_string_value(json_object_get(json_object_get(j_client, "client"), json_string_value(json_object_get(config->j_params, "client-jwks_uri-parameter")))), config->x5u_flags) == RHN_OK) {
+          if (r_jwks_init(&jwks) == RHN_OK && import_jwks_from_uri(config, jwks, json_string_value(json_object_get(json_object_get(j_client, "client"), json_string_value(json_object_get(config->j_params, "client-jwks_uri-parameter")))), kid) == RHN_OK) {
             if ((jwk = r_jwks_get_by_kid(jwks, kid)) == NULL) {
               y_log_message(Y_LOG_LEVEL_DEBUG, "verify_request_signature - unable to get pubkey from jwks_uri, origin: %s", ip_source);
             }
@@ -4621,57 +5612,102 @@ static char * get_state_param(const char * state_value) {
 }
 
 static int revoke_refresh_token(struct _oidc_config * config, const char * token) {
-  json_t * j_query;
-  int res, ret;
+  json_t * j_query, * j_result = NULL;
+  int res = H_OK, ret;
   char * token_hash = config->glewlwyd_config->glewlwyd_callback_generate_hash(config->glewlwyd_config, token);
 
-  j_query = json_pack("{sss{si}s{ssss}}",
-                      "table",
-                      GLEWLWYD_PLUGIN_OIDC_TABLE_REFRESH_TOKEN,
-                      "set",
-                        "gpor_enabled",
-                        0,
-                      "where",
-                        "gpor_plugin_name",
-                        config->name,
-                        "gpor_token_hash",
-                        token_hash);
-  o_free(token_hash);
-  res = h_update(config->glewlwyd_config->glewlwyd_config->conn, j_query, NULL);
-  json_decref(j_query);
+  if (config->access_token_stateless) {
+    // The refresh token jti is needed to revoke the stateless access tokens issued with it
+    j_query = json_pack("{sss[s]s{sssssi}}",
+                        "table",
+                        GLEWLWYD_PLUGIN_OIDC_TABLE_REFRESH_TOKEN,
+                        "columns",
+                          "gpor_jti AS jti",
+                        "where",
+                          "gpor_plugin_name",
+                          config->name,
+                          "gpor_token_hash",
+                          token_hash,
+                          "gpor_enabled",
+                          1);
+    res = h_select(config->glewlwyd_config->glewlwyd_config->conn, j_query, &j_result, NULL);
+    json_decref(j_query);
+  }
   if (res == H_OK) {
-    ret = G_OK;
+    j_query = json_pack("{sss{si}s{ssss}}",
+                        "table",
+                        GLEWLWYD_PLUGIN_OIDC_TABLE_REFRESH_TOKEN,
+                        "set",
+                          "gpor_enabled",
+                          0,
+                        "where",
+                          "gpor_plugin_name",
+                          config->name,
+                          "gpor_token_hash",
+                          token_hash);
+    res = h_update(config->glewlwyd_config->glewlwyd_config->conn, j_query, NULL);
+    json_decref(j_query);
+    if (res == H_OK) {
+      if (json_array_size(j_result) && revoke_refresh_token_jti(config, json_string_value(json_object_get(json_array_get(j_result, 0), "jti"))) != G_OK) {
+        y_log_message(Y_LOG_LEVEL_ERROR, "revoke_refresh_token - Error revoke_refresh_token_jti");
+        ret = G_ERROR_DB;
+      } else {
+        ret = G_OK;
+      }
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "revoke_refresh_token - Error executing j_query (2)");
+      ret = G_ERROR_DB;
+    }
   } else {
-    y_log_message(Y_LOG_LEVEL_ERROR, "revoke_refresh_token - Error executing j_query");
+    y_log_message(Y_LOG_LEVEL_ERROR, "revoke_refresh_token - Error executing j_query (1)");
     ret = G_ERROR_DB;
   }
+  json_decref(j_result);
+  o_free(token_hash);
   return ret;
 }
 
 static int revoke_access_token(struct _oidc_config * config, const char * token) {
   json_t * j_query;
   int res, ret;
-  char * token_hash = config->glewlwyd_config->glewlwyd_callback_generate_hash(config->glewlwyd_config, token);
+  char * token_hash;
+  jwt_t * jwt = NULL;
 
-  j_query = json_pack("{sss{si}s{ssss}}",
-                      "table",
-                      GLEWLWYD_PLUGIN_OIDC_TABLE_ACCESS_TOKEN,
-                      "set",
-                        "gpoa_enabled",
-                        0,
-                      "where",
-                        "gpoa_plugin_name",
-                        config->name,
-                        "gpoa_token_hash",
-                        token_hash);
-  o_free(token_hash);
-  res = h_update(config->glewlwyd_config->glewlwyd_config->conn, j_query, NULL);
-  json_decref(j_query);
-  if (res == H_OK) {
-    ret = G_OK;
+  if (config->access_token_stateless) {
+    // The token signature has already been verified by the caller
+    if (r_jwt_init(&jwt) == RHN_OK && r_jwt_parse(jwt, token, config->x5u_flags) == RHN_OK && r_jwt_get_claim_str_value(jwt, "jti") != NULL) {
+      if (r_jwt_get_claim_int_value(jwt, "exp") > time(NULL)) {
+        ret = revoke_jti(config, r_jwt_get_claim_str_value(jwt, "jti"), r_jwt_get_claim_int_value(jwt, "exp"));
+      } else {
+        ret = G_OK;
+      }
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "revoke_access_token - Error parsing token");
+      ret = G_ERROR_PARAM;
+    }
+    r_jwt_free(jwt);
   } else {
-    y_log_message(Y_LOG_LEVEL_ERROR, "revoke_access_token - Error executing j_query");
-    ret = G_ERROR_DB;
+    token_hash = config->glewlwyd_config->glewlwyd_callback_generate_hash(config->glewlwyd_config, token);
+    j_query = json_pack("{sss{si}s{ssss}}",
+                        "table",
+                        GLEWLWYD_PLUGIN_OIDC_TABLE_ACCESS_TOKEN,
+                        "set",
+                          "gpoa_enabled",
+                          0,
+                        "where",
+                          "gpoa_plugin_name",
+                          config->name,
+                          "gpoa_token_hash",
+                          token_hash);
+    o_free(token_hash);
+    res = h_update(config->glewlwyd_config->glewlwyd_config->conn, j_query, NULL);
+    json_decref(j_query);
+    if (res == H_OK) {
+      ret = G_OK;
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "revoke_access_token - Error executing j_query");
+      ret = G_ERROR_DB;
+    }
   }
   return ret;
 }
@@ -4704,286 +5740,564 @@ static int revoke_id_token(struct _oidc_config * config, const char * token) {
   return ret;
 }
 
-static json_t * get_token_metadata(struct _oidc_config * config, const char * token, const char * token_type_hint, const char * client_id) {
-  json_t * j_query, * j_result, * j_result_scope, * j_return = NULL, * j_element = NULL, * j_client = NULL, * j_cnf = NULL;
-  int res, found_refresh = 0, found_access = 0, found_id_token = 0;
+/**
+ * Builds a raw IN clause with the hashes of the tokens not found yet
+ * Returns NULL if all the tokens are found
+ */
+static char * get_token_hash_pending_clause(struct _oidc_config * config, json_t * j_hash_list, json_t * j_metadata_list) {
+  char * clause = NULL, * hash_escaped;
+  json_t * j_element = NULL;
   size_t index = 0;
-  char * token_hash = NULL, * scope_list = NULL, * expires_at_clause, * sub = NULL;
-  time_t now;
-  jwt_t * jwt = NULL;
 
-  if (o_strlen(token)) {
-    token_hash = config->glewlwyd_config->glewlwyd_callback_generate_hash(config->glewlwyd_config, token);
-    time(&now);
-    if (config->glewlwyd_config->glewlwyd_config->conn->type==HOEL_DB_TYPE_MARIADB) {
-      expires_at_clause = msprintf("> FROM_UNIXTIME(%u)", (now));
-    } else if (config->glewlwyd_config->glewlwyd_config->conn->type==HOEL_DB_TYPE_PGSQL) {
-      expires_at_clause = msprintf("> TO_TIMESTAMP(%u)", now);
-    } else { // HOEL_DB_TYPE_SQLITE
-      expires_at_clause = msprintf("> %u", (now));
+  json_array_foreach(j_hash_list, index, j_element) {
+    if (json_array_get(j_metadata_list, index) == json_null() && json_string_length(j_element)) {
+      hash_escaped = h_escape_string_with_quotes(config->glewlwyd_config->glewlwyd_config->conn, json_string_value(j_element));
+      if (clause == NULL) {
+        clause = msprintf("IN (%s", hash_escaped);
+      } else {
+        clause = mstrcatf(clause, ",%s", hash_escaped);
+      }
+      o_free(hash_escaped);
     }
-    if (token_type_hint == NULL || 0 == o_strcmp("refresh_token", token_type_hint)) {
-      j_query = json_pack("{sss[ssssssss]s{sssss{ssss}}}",
-                          "table",
-                          GLEWLWYD_PLUGIN_OIDC_TABLE_REFRESH_TOKEN,
-                          "columns",
-                            "gpor_id",
-                            "gpor_username AS username",
-                            "gpor_client_id AS client_id",
-                            "gpor_client_id AS aud",
-                            SWITCH_DB_TYPE(config->glewlwyd_config->glewlwyd_config->conn->type, "UNIX_TIMESTAMP(gpor_issued_at) AS iat", "gpor_issued_at AS iat", "EXTRACT(EPOCH FROM gpor_issued_at)::integer AS iat"),
-                            SWITCH_DB_TYPE(config->glewlwyd_config->glewlwyd_config->conn->type, "UNIX_TIMESTAMP(gpor_issued_at) AS nbf", "gpor_issued_at AS nbf", "EXTRACT(EPOCH FROM gpor_issued_at)::integer AS nbf"),
-                            SWITCH_DB_TYPE(config->glewlwyd_config->glewlwyd_config->conn->type, "UNIX_TIMESTAMP(gpor_expires_at) AS exp", "gpor_expires_at AS exp", "EXTRACT(EPOCH FROM gpor_expires_at)::integer AS exp"),
-                            "gpor_enabled",
-                          "where",
-                            "gpor_plugin_name",
-                            config->name,
-                            "gpor_token_hash",
-                            token_hash,
-                            "gpor_expires_at",
-                              "operator",
-                              "raw",
-                              "value",
-                              expires_at_clause);
-      if (client_id != NULL) {
-        json_object_set_new(json_object_get(j_query, "where"), "gpor_client_id", json_string(client_id));
+  }
+  if (clause != NULL) {
+    clause = mstrcatf(clause, ")");
+  }
+  return clause;
+}
+
+/**
+ * Returns a JSON object with the space separated scope list of each token id in j_result
+ * using one query for all the tokens
+ */
+static json_t * get_token_scope_list(struct _oidc_config * config, json_t * j_result, const char * table, const char * id_column, const char * scope_column) {
+  json_t * j_query, * j_result_scope, * j_return = NULL, * j_element = NULL;
+  char * id_clause = NULL, * key, * column = msprintf("%s AS scope", scope_column);
+  const char * scope_list;
+  size_t index = 0;
+  int res;
+
+  json_array_foreach(j_result, index, j_element) {
+    if (id_clause == NULL) {
+      id_clause = msprintf("IN (%" JSON_INTEGER_FORMAT, json_integer_value(json_object_get(j_element, id_column)));
+    } else {
+      id_clause = mstrcatf(id_clause, ",%" JSON_INTEGER_FORMAT, json_integer_value(json_object_get(j_element, id_column)));
+    }
+  }
+  if (id_clause != NULL) {
+    id_clause = mstrcatf(id_clause, ")");
+    j_query = json_pack("{sss[ss]s{s{ssss}}}",
+                        "table",
+                        table,
+                        "columns",
+                          id_column,
+                          column,
+                        "where",
+                          id_column,
+                            "operator",
+                            "raw",
+                            "value",
+                            id_clause);
+    res = h_select(config->glewlwyd_config->glewlwyd_config->conn, j_query, &j_result_scope, NULL);
+    json_decref(j_query);
+    if (res == H_OK) {
+      j_return = json_object();
+      json_array_foreach(j_result_scope, index, j_element) {
+        key = msprintf("%" JSON_INTEGER_FORMAT, json_integer_value(json_object_get(j_element, id_column)));
+        if ((scope_list = json_string_value(json_object_get(j_return, key))) == NULL) {
+          json_object_set(j_return, key, json_object_get(j_element, "scope"));
+        } else {
+          json_object_set_new(j_return, key, json_pack("s++", scope_list, " ", json_string_value(json_object_get(j_element, "scope"))));
+        }
+        o_free(key);
       }
-      res = h_select(config->glewlwyd_config->glewlwyd_config->conn, j_query, &j_result, NULL);
-      json_decref(j_query);
-      if (res == H_OK) {
-        if (json_array_size(j_result)) {
-          found_refresh = 1;
-          if (json_integer_value(json_object_get(json_array_get(j_result, 0), "gpor_enabled"))) {
-            json_object_set_new(json_array_get(j_result, 0), "active", json_true());
-            json_object_set_new(json_array_get(j_result, 0), "token_type", json_string("refresh_token"));
-            json_object_del(json_array_get(j_result, 0), "gpor_enabled");
-            if (json_object_get(json_array_get(j_result, 0), "client_id") == json_null()) {
-              json_object_del(json_array_get(j_result, 0), "client_id");
-              json_object_del(json_array_get(j_result, 0), "aud");
-              sub = get_sub(config, json_string_value(json_object_get(json_array_get(j_result, 0), "username")), NULL);
-            } else {
-              j_client = config->glewlwyd_config->glewlwyd_plugin_callback_get_client(config->glewlwyd_config, json_string_value(json_object_get(json_array_get(j_result, 0), "client_id")));
-              if (check_result_value(j_client, G_OK) && json_object_get(json_object_get(j_client, "client"), "enabled") == json_true()) {
-                sub = get_sub(config, json_string_value(json_object_get(json_array_get(j_result, 0), "username")), json_object_get(j_client, "client"));
-              }
-              json_decref(j_client);
-            }
-            if (sub != NULL) {
-              json_object_set_new(json_array_get(j_result, 0), "sub", json_string(sub));
-              o_free(sub);
-            }
-            if (json_object_get(json_array_get(j_result, 0), "username") == json_null()) {
-              json_object_del(json_array_get(j_result, 0), "username");
-            }
-            j_query = json_pack("{sss[s]s{sO}}",
-                                "table",
-                                GLEWLWYD_PLUGIN_OIDC_TABLE_REFRESH_TOKEN_SCOPE,
-                                "columns",
-                                  "gpors_scope AS scope",
-                                "where",
-                                  "gpor_id",
-                                  json_object_get(json_array_get(j_result, 0), "gpor_id"));
-            res = h_select(config->glewlwyd_config->glewlwyd_config->conn, j_query, &j_result_scope, NULL);
-            json_decref(j_query);
-            if (res == H_OK) {
-              json_array_foreach(j_result_scope, index, j_element) {
-                if (scope_list == NULL) {
-                  scope_list = o_strdup(json_string_value(json_object_get(j_element, "scope")));
-                } else {
-                  scope_list = mstrcatf(scope_list, " %s", json_string_value(json_object_get(j_element, "scope")));
-                }
-              }
-              json_object_set_new(json_array_get(j_result, 0), "scope", json_string(scope_list));
-              o_free(scope_list);
-              json_decref(j_result_scope);
-              json_object_del(json_array_get(j_result, 0), "gpor_id");
-              j_return = json_pack("{sisO}", "result", G_OK, "token", json_array_get(j_result, 0));
-            } else {
-              y_log_message(Y_LOG_LEVEL_ERROR, "oidc validate_refresh_token - Error executing j_query scope refresh_token");
-              j_return = json_pack("{si}", "result", G_ERROR_DB);
-            }
+      json_decref(j_result_scope);
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "get_token_scope_list - Error executing j_query on table %s", table);
+    }
+  } else {
+    j_return = json_object();
+  }
+  o_free(id_clause);
+  o_free(column);
+  return j_return;
+}
+
+/**
+ * Sets the scope value of a token from the result of get_token_scope_list
+ */
+static void set_token_scope(json_t * j_token, json_t * j_scope_list, const char * id_column) {
+  char * key = msprintf("%" JSON_INTEGER_FORMAT, json_integer_value(json_object_get(j_token, id_column)));
+
+  json_object_set_new(j_token, "scope", json_string(json_string_value(json_object_get(j_scope_list, key))));
+  json_object_del(j_token, id_column);
+  o_free(key);
+}
+
+/**
+ * Returns a client from the cache of the tokens list, or gets it and adds it to the cache
+ */
+static json_t * get_client_cached(struct _oidc_config * config, json_t * j_cache, const char * client_id) {
+  json_t * j_client;
+
+  if (client_id != NULL && (j_client = json_object_get(json_object_get(j_cache, "client"), client_id)) != NULL) {
+    json_incref(j_client);
+  } else {
+    j_client = config->glewlwyd_config->glewlwyd_plugin_callback_get_client(config->glewlwyd_config, client_id);
+    if (client_id != NULL && j_client != NULL) {
+      json_object_set(json_object_get(j_cache, "client"), client_id, j_client);
+    }
+  }
+  return j_client;
+}
+
+/**
+ * Returns the sub of a user for a client from the cache of the tokens list, or gets it and adds it to the cache
+ */
+static char * get_sub_cached(struct _oidc_config * config, json_t * j_cache, const char * username, const char * client_id, json_t * j_client) {
+  json_t * j_sub_list = NULL;
+  char * sub;
+
+  if (username != NULL && (j_sub_list = json_object_get(json_object_get(j_cache, "sub"), client_id!=NULL?client_id:"")) == NULL) {
+    j_sub_list = json_object();
+    json_object_set_new(json_object_get(j_cache, "sub"), client_id!=NULL?client_id:"", j_sub_list);
+  }
+  if (json_object_get(j_sub_list, username) != NULL) {
+    sub = o_strdup(json_string_value(json_object_get(j_sub_list, username)));
+  } else if ((sub = get_sub(config, username, j_client)) != NULL && j_sub_list != NULL) {
+    json_object_set_new(j_sub_list, username, json_string(sub));
+  }
+  return sub;
+}
+
+/**
+ * Sets the sub value of a token and removes the empty client_id and username
+ * Returns the client if the token has a client and a username
+ * The clients and the subs are cached in j_cache for the whole tokens list
+ */
+static json_t * set_token_sub(struct _oidc_config * config, json_t * j_cache, json_t * j_token, int remove_aud, int require_username) {
+  json_t * j_client = NULL;
+  char * sub = NULL;
+
+  if (json_object_get(j_token, "client_id") == json_null()) {
+    json_object_del(j_token, "client_id");
+    if (remove_aud) {
+      json_object_del(j_token, "aud");
+    }
+    sub = get_sub_cached(config, j_cache, json_string_value(json_object_get(j_token, "username")), NULL, NULL);
+  } else if (!require_username || json_object_get(j_token, "username") != json_null()) {
+    j_client = get_client_cached(config, j_cache, json_string_value(json_object_get(j_token, "client_id")));
+    if (check_result_value(j_client, G_OK) && json_object_get(json_object_get(j_client, "client"), "enabled") == json_true()) {
+      sub = get_sub_cached(config, j_cache, json_string_value(json_object_get(j_token, "username")), json_string_value(json_object_get(j_token, "client_id")), json_object_get(j_client, "client"));
+    }
+  }
+  if (sub != NULL) {
+    json_object_set_new(j_token, "sub", json_string(sub));
+    o_free(sub);
+  }
+  if (json_object_get(j_token, "username") == json_null()) {
+    json_object_del(j_token, "username");
+  }
+  return j_client;
+}
+
+/**
+ * Sets j_metadata to all the tokens not found yet with this hash
+ */
+static void set_token_metadata(json_t * j_hash_list, json_t * j_metadata_list, const char * hash, json_t * j_metadata) {
+  json_t * j_hash = NULL;
+  size_t index = 0;
+
+  json_array_foreach(j_hash_list, index, j_hash) {
+    if (json_array_get(j_metadata_list, index) == json_null() && 0 == o_strcmp(hash, json_string_value(j_hash))) {
+      json_array_set(j_metadata_list, index, j_metadata);
+    }
+  }
+}
+
+/**
+ * Sets the metadata of the refresh tokens not found yet
+ */
+static int get_refresh_token_metadata_list(struct _oidc_config * config, json_t * j_cache, json_t * j_hash_list, json_t * j_metadata_list, const char * client_id, const char * expires_at_clause) {
+  json_t * j_query, * j_result = NULL, * j_scope_list = NULL, * j_enabled, * j_element = NULL, * j_client, * j_metadata;
+  char * hash_clause = get_token_hash_pending_clause(config, j_hash_list, j_metadata_list), * hash;
+  size_t index = 0;
+  int res, ret = G_OK;
+
+  if (hash_clause != NULL) {
+    j_query = json_pack("{sss[sssssssss]s{sss{ssss}s{ssss}}}",
+                        "table",
+                        GLEWLWYD_PLUGIN_OIDC_TABLE_REFRESH_TOKEN,
+                        "columns",
+                          "gpor_id",
+                          "gpor_token_hash",
+                          "gpor_username AS username",
+                          "gpor_client_id AS client_id",
+                          "gpor_client_id AS aud",
+                          SWITCH_DB_TYPE(config->glewlwyd_config->glewlwyd_config->conn->type, "UNIX_TIMESTAMP(gpor_issued_at) AS iat", "gpor_issued_at AS iat", "EXTRACT(EPOCH FROM gpor_issued_at)::integer AS iat"),
+                          SWITCH_DB_TYPE(config->glewlwyd_config->glewlwyd_config->conn->type, "UNIX_TIMESTAMP(gpor_issued_at) AS nbf", "gpor_issued_at AS nbf", "EXTRACT(EPOCH FROM gpor_issued_at)::integer AS nbf"),
+                          SWITCH_DB_TYPE(config->glewlwyd_config->glewlwyd_config->conn->type, "UNIX_TIMESTAMP(gpor_expires_at) AS exp", "gpor_expires_at AS exp", "EXTRACT(EPOCH FROM gpor_expires_at)::integer AS exp"),
+                          "gpor_enabled",
+                        "where",
+                          "gpor_plugin_name",
+                          config->name,
+                          "gpor_token_hash",
+                            "operator",
+                            "raw",
+                            "value",
+                            hash_clause,
+                          "gpor_expires_at",
+                            "operator",
+                            "raw",
+                            "value",
+                            expires_at_clause);
+    if (client_id != NULL) {
+      json_object_set_new(json_object_get(j_query, "where"), "gpor_client_id", json_string(client_id));
+    }
+    res = h_select(config->glewlwyd_config->glewlwyd_config->conn, j_query, &j_result, NULL);
+    json_decref(j_query);
+    if (res == H_OK) {
+      j_enabled = json_array();
+      json_array_foreach(j_result, index, j_element) {
+        if (json_integer_value(json_object_get(j_element, "gpor_enabled"))) {
+          json_array_append(j_enabled, j_element);
+        }
+      }
+      if ((j_scope_list = get_token_scope_list(config, j_enabled, GLEWLWYD_PLUGIN_OIDC_TABLE_REFRESH_TOKEN_SCOPE, "gpor_id", "gpors_scope")) != NULL) {
+        json_array_foreach(j_result, index, j_element) {
+          hash = o_strdup(json_string_value(json_object_get(j_element, "gpor_token_hash")));
+          json_object_del(j_element, "gpor_token_hash");
+          if (json_integer_value(json_object_get(j_element, "gpor_enabled"))) {
+            json_object_set_new(j_element, "active", json_true());
+            json_object_set_new(j_element, "token_type", json_string("refresh_token"));
+            json_object_del(j_element, "gpor_enabled");
+            j_client = set_token_sub(config, j_cache, j_element, 1, 0);
+            json_decref(j_client);
+            set_token_scope(j_element, j_scope_list, "gpor_id");
+            j_metadata = json_pack("{sO}", "token", j_element);
           } else {
-            j_return = json_pack("{sis{so}}", "result", G_OK, "token", "active", json_false());
+            j_metadata = json_pack("{s{so}}", "token", "active", json_false());
           }
+          set_token_metadata(j_hash_list, j_metadata_list, hash, j_metadata);
+          json_decref(j_metadata);
+          o_free(hash);
         }
-        json_decref(j_result);
+        json_decref(j_scope_list);
       } else {
-        y_log_message(Y_LOG_LEVEL_ERROR, "get_token_metadata - Error executing j_query refresh_token");
-        j_return = json_pack("{si}", "result", G_ERROR_DB);
+        y_log_message(Y_LOG_LEVEL_ERROR, "get_refresh_token_metadata_list - Error get_token_scope_list");
+        ret = G_ERROR_DB;
+      }
+      json_decref(j_enabled);
+      json_decref(j_result);
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "get_refresh_token_metadata_list - Error executing j_query");
+      ret = G_ERROR_DB;
+    }
+    o_free(hash_clause);
+  }
+  return ret;
+}
+
+/**
+ * Returns the metadata of a stateless access token, built from its claims
+ * The username isn't available since the access token isn't stored in the database
+ */
+static json_t * get_access_token_stateless_metadata(struct _oidc_config * config, json_t * j_cache, const char * token, const char * client_id, time_t now) {
+  json_t * j_return = NULL, * j_verified, * j_claims, * j_client;
+  const char * type;
+
+  // Reuses the verified access tokens cache of the resource check, e.g. when userinfo has already verified the token
+  j_verified = oidc_resource_verify_access_token(config->oidc_resource_config, token);
+  if (json_integer_value(json_object_get(j_verified, "result")) == G_TOKEN_OK) {
+    j_claims = json_object_get(j_verified, "grants");
+    type = json_string_value(json_object_get(j_claims, "type"));
+    if (0 != o_strcmp("access_token", type) && 0 != o_strcmp("client_token", type)) {
+      // Not an access token, e.g. an id_token
+      j_return = NULL;
+    } else if (0 == o_strcmp(json_string_value(json_object_get(config->j_params, "iss")), json_string_value(json_object_get(j_claims, "iss"))) &&
+        json_integer_value(json_object_get(j_claims, "exp")) > now &&
+        json_integer_value(json_object_get(j_claims, "iat")) + config->access_token_duration > now &&
+        (client_id == NULL || 0 == o_strcmp(client_id, json_string_value(json_object_get(j_claims, "client_id")))) &&
+        is_access_token_revoked(config, j_claims) == G_ERROR_NOT_FOUND) {
+      j_return = json_pack("{s{sosssO*sO*sO*sO*sO*sO*sO*sO*sO*sO*}}",
+                           "token",
+                             "active", json_true(),
+                             "token_type", "access_token",
+                             "sub", json_object_get(j_claims, "sub"),
+                             "aud", json_object_get(j_claims, "aud"),
+                             "client_id", json_object_get(j_claims, "client_id"),
+                             "iat", json_object_get(j_claims, "iat"),
+                             "nbf", json_object_get(j_claims, "nbf"),
+                             "exp", json_object_get(j_claims, "exp"),
+                             "jti", json_object_get(j_claims, "jti"),
+                             "scope", json_object_get(j_claims, "scope"),
+                             "cnf", json_object_get(j_claims, "cnf"),
+                             "authorization_details", json_object_get(j_claims, "authorization_details"));
+      if (0 == o_strcmp("access_token", type) && json_object_get(j_claims, "client_id") != NULL) {
+        j_client = get_client_cached(config, j_cache, json_string_value(json_object_get(j_claims, "client_id")));
+        if (check_result_value(j_client, G_OK) && json_object_get(json_object_get(j_client, "client"), "enabled") == json_true()) {
+          json_object_set(j_return, "client", json_object_get(j_client, "client"));
+        }
+        json_decref(j_client);
       }
+    } else {
+      j_return = json_pack("{s{so}}", "token", "active", json_false());
+    }
+  }
+  json_decref(j_verified);
+  return j_return;
+}
+
+/**
+ * Sets the metadata of the access tokens not found yet
+ */
+static int get_access_token_metadata_list(struct _oidc_config * config, json_t * j_cache, json_t * j_token_list, json_t * j_hash_list, json_t * j_metadata_list, const char * client_id, time_t now) {
+  json_t * j_query, * j_result = NULL, * j_scope_list = NULL, * j_enabled, * j_element = NULL, * j_client, * j_metadata, * j_hash = NULL, * j_cnf;
+  char * hash_clause = NULL, * hash;
+  size_t index = 0, index_h = 0;
+  int res, ret = G_OK;
+  jwt_t * jwt;
+
+  if (config->access_token_stateless) {
+    json_array_foreach(j_token_list, index, j_element) {
+      if (json_array_get(j_metadata_list, index) == json_null() && (j_metadata = get_access_token_stateless_metadata(config, j_cache, json_string_value(j_element), client_id, now)) != NULL) {
+        json_array_set_new(j_metadata_list, index, j_metadata);
+      }
+    }
+  } else if ((hash_clause = get_token_hash_pending_clause(config, j_hash_list, j_metadata_list)) != NULL) {
+    j_query = json_pack("{sss[ssssssssss]s{sss{ssss}}}",
+                        "table",
+                        GLEWLWYD_PLUGIN_OIDC_TABLE_ACCESS_TOKEN,
+                        "columns",
+                          "gpoa_id",
+                          "gpoa_token_hash",
+                          "gpoa_username AS username",
+                          "gpoa_client_id AS client_id",
+                          "gpoa_resource AS aud",
+                          SWITCH_DB_TYPE(config->glewlwyd_config->glewlwyd_config->conn->type, "UNIX_TIMESTAMP(gpoa_issued_at) AS iat", "gpoa_issued_at AS iat", "EXTRACT(EPOCH FROM gpoa_issued_at)::integer AS iat"),
+                          SWITCH_DB_TYPE(config->glewlwyd_config->glewlwyd_config->conn->type, "UNIX_TIMESTAMP(gpoa_issued_at) AS nbf", "gpoa_issued_at AS nbf", "EXTRACT(EPOCH FROM gpoa_issued_at)::integer AS nbf"),
+                          "gpoa_jti as jti",
+                          "gpoa_authorization_details",
+                          "gpoa_enabled",
+                        "where",
+                          "gpoa_plugin_name",
+                          config->name,
+                          "gpoa_token_hash",
+                            "operator",
+                            "raw",
+                            "value",
+                            hash_clause);
+    if (client_id != NULL) {
+      json_object_set_new(json_object_get(j_query, "where"), "gpoa_client_id", json_string(client_id));
     }
-    if ((token_type_hint == NULL && !found_refresh) || 0 == o_strcmp("access_token", token_type_hint)) {
-      j_query = json_pack("{sss[sssssssss]s{ssss}}",
-                          "table",
-                          GLEWLWYD_PLUGIN_OIDC_TABLE_ACCESS_TOKEN,
-                          "columns",
-                            "gpoa_id",
-                            "gpoa_username AS username",
-                            "gpoa_client_id AS client_id",
-                            "gpoa_resource AS aud",
-                            SWITCH_DB_TYPE(config->glewlwyd_config->glewlwyd_config->conn->type, "UNIX_TIMESTAMP(gpoa_issued_at) AS iat", "gpoa_issued_at AS iat", "EXTRACT(EPOCH FROM gpoa_issued_at)::integer AS iat"),
-                            SWITCH_DB_TYPE(config->glewlwyd_config->glewlwyd_config->conn->type, "UNIX_TIMESTAMP(gpoa_issued_at) AS nbf", "gpoa_issued_at AS nbf", "EXTRACT(EPOCH FROM gpoa_issued_at)::integer AS nbf"),
-                            "gpoa_jti as jti",
-                            "gpoa_authorization_details",
-                            "gpoa_enabled",
-                          "where",
-                            "gpoa_plugin_name",
-                            config->name,
-                            "gpoa_token_hash",
-                            token_hash);
-      if (client_id != NULL) {
-        json_object_set_new(json_object_get(j_query, "where"), "gpoa_client_id", json_string(client_id));
+    res = h_select(config->glewlwyd_config->glewlwyd_config->conn, j_query, &j_result, NULL);
+    json_decref(j_query);
+    if (res == H_OK) {
+      j_enabled = json_array();
+      json_array_foreach(j_result, index, j_element) {
+        if (json_integer_value(json_object_get(j_element, "gpoa_enabled")) && json_integer_value(json_object_get(j_element, "iat")) + json_integer_value(json_object_get(config->j_params, "access-token-duration")) > now) {
+          json_array_append(j_enabled, j_element);
+        }
       }
-      res = h_select(config->glewlwyd_config->glewlwyd_config->conn, j_query, &j_result, NULL);
-      json_decref(j_query);
-      if (res == H_OK) {
-        if (json_array_size(j_result)) {
-          found_access = 1;
-          if (json_integer_value(json_object_get(json_array_get(j_result, 0), "gpoa_enabled")) && json_integer_value(json_object_get(json_array_get(j_result, 0), "iat")) + json_integer_value(json_object_get(config->j_params, "access-token-duration")) > now) {
-            json_object_set_new(json_array_get(j_result, 0), "sub", json_string(sub));
-            json_object_set_new(json_array_get(j_result, 0), "active", json_true());
-            json_object_set_new(json_array_get(j_result, 0), "token_type", json_string("access_token"));
-            json_object_set_new(json_array_get(j_result, 0), "exp", json_integer(json_integer_value(json_object_get(json_array_get(j_result, 0), "iat")) + json_integer_value(json_object_get(config->j_params, "access-token-duration"))));
-            json_object_del(json_array_get(j_result, 0), "gpoa_enabled");
-            if (json_object_get(json_array_get(j_result, 0), "gpoa_authorization_details") != json_null()) {
-              json_object_set_new(json_array_get(j_result, 0), "authorization_details", json_loads(json_string_value(json_object_get(json_array_get(j_result, 0), "gpoa_authorization_details")), JSON_DECODE_ANY, NULL));
-            }
-            json_object_del(json_array_get(j_result, 0), "gpoa_authorization_details");
-            if (json_object_get(json_array_get(j_result, 0), "client_id") == json_null()) {
-              json_object_del(json_array_get(j_result, 0), "client_id");
-              sub = get_sub(config, json_string_value(json_object_get(json_array_get(j_result, 0), "username")), NULL);
-            } else if (json_object_get(json_array_get(j_result, 0), "username") != json_null()) {
-              j_client = config->glewlwyd_config->glewlwyd_plugin_callback_get_client(config->glewlwyd_config, json_string_value(json_object_get(json_array_get(j_result, 0), "client_id")));
-              if (check_result_value(j_client, G_OK) && json_object_get(json_object_get(j_client, "client"), "enabled") == json_true()) {
-                sub = get_sub(config, json_string_value(json_object_get(json_array_get(j_result, 0), "username")), json_object_get(j_client, "client"));
-              }
-            }
-            if (sub != NULL) {
-              json_object_set_new(json_array_get(j_result, 0), "sub", json_string(sub));
-              o_free(sub);
-            }
-            if (json_object_get(json_array_get(j_result, 0), "username") == json_null()) {
-              json_object_del(json_array_get(j_result, 0), "username");
-            }
-            j_query = json_pack("{sss[s]s{sO}}",
-                                "table",
-                                GLEWLWYD_PLUGIN_OIDC_TABLE_ACCESS_TOKEN_SCOPE,
-                                "columns",
-                                  "gpoas_scope AS scope",
-                                "where",
-                                  "gpoa_id",
-                                  json_object_get(json_array_get(j_result, 0), "gpoa_id"));
-            res = h_select(config->glewlwyd_config->glewlwyd_config->conn, j_query, &j_result_scope, NULL);
-            json_decref(j_query);
-            if (res == H_OK) {
-              json_array_foreach(j_result_scope, index, j_element) {
-                if (scope_list == NULL) {
-                  scope_list = o_strdup(json_string_value(json_object_get(j_element, "scope")));
-                } else {
-                  scope_list = mstrcatf(scope_list, " %s", json_string_value(json_object_get(j_element, "scope")));
+      if ((j_scope_list = get_token_scope_list(config, j_enabled, GLEWLWYD_PLUGIN_OIDC_TABLE_ACCESS_TOKEN_SCOPE, "gpoa_id", "gpoas_scope")) != NULL) {
+        json_array_foreach(j_result, index, j_element) {
+          hash = o_strdup(json_string_value(json_object_get(j_element, "gpoa_token_hash")));
+          json_object_del(j_element, "gpoa_token_hash");
+          if (json_integer_value(json_object_get(j_element, "gpoa_enabled")) && json_integer_value(json_object_get(j_element, "iat")) + json_integer_value(json_object_get(config->j_params, "access-token-duration")) > now) {
+            json_object_set_new(j_element, "active", json_true());
+            json_object_set_new(j_element, "token_type", json_string("access_token"));
+            json_object_set_new(j_element, "exp", json_integer(json_integer_value(json_object_get(j_element, "iat")) + json_integer_value(json_object_get(config->j_params, "access-token-duration"))));
+            json_object_del(j_element, "gpoa_enabled");
+            if (json_object_get(j_element, "gpoa_authorization_details") != json_null()) {
+              json_object_set_new(j_element, "authorization_details", json_loads(json_string_value(json_object_get(j_element, "gpoa_authorization_details")), JSON_DECODE_ANY, NULL));
+            }
+            json_object_del(j_element, "gpoa_authorization_details");
+            j_client = set_token_sub(config, j_cache, j_element, 0, 1);
+            set_token_scope(j_element, j_scope_list, "gpoa_id");
+            json_array_foreach(j_hash_list, index_h, j_hash) {
+              if (json_array_get(j_metadata_list, index_h) == json_null() && 0 == o_strcmp(hash, json_string_value(j_hash))) {
+                j_metadata = json_pack("{so}", "token", json_deep_copy(j_element));
+                if (j_client != NULL) {
+                  json_object_set(j_metadata, "client", json_object_get(j_client, "client"));
                 }
-              }
-              json_object_set_new(json_array_get(j_result, 0), "scope", json_string(scope_list));
-              o_free(scope_list);
-              json_decref(j_result_scope);
-              json_object_del(json_array_get(j_result, 0), "gpoa_id");
-              j_return = json_pack("{sisO}", "result", G_OK, "token", json_array_get(j_result, 0));
-              if (j_client != NULL) {
-                json_object_set(j_return, "client", json_object_get(j_client, "client"));
-              }
-              if (r_jwt_init(&jwt) == RHN_OK) {
-                if (r_jwt_parse(jwt, token, config->x5u_flags) == RHN_OK) {
-                  if ((j_cnf = r_jwt_get_claim_json_t_value(jwt, "cnf")) != NULL) {
-                    json_object_set_new(json_object_get(j_return, "token"), "cnf", j_cnf);
+                jwt = NULL;
+                if (r_jwt_init(&jwt) == RHN_OK) {
+                  if (r_jwt_parse(jwt, json_string_value(json_array_get(j_token_list, index_h)), config->x5u_flags) == RHN_OK) {
+                    if ((j_cnf = r_jwt_get_claim_json_t_value(jwt, "cnf")) != NULL) {
+                      json_object_set_new(json_object_get(j_metadata, "token"), "cnf", j_cnf);
+                    }
+                  } else {
+                    y_log_message(Y_LOG_LEVEL_ERROR, "get_access_token_metadata_list - Error r_jwt_parse");
+                    ret = G_ERROR;
                   }
                 } else {
-                  y_log_message(Y_LOG_LEVEL_ERROR, "get_token_metadata - Error r_jwt_parse");
-                  j_return = json_pack("{si}", "result", G_ERROR);
+                  y_log_message(Y_LOG_LEVEL_ERROR, "get_access_token_metadata_list - Error r_jwt_init");
+                  ret = G_ERROR;
                 }
-              } else {
-                y_log_message(Y_LOG_LEVEL_ERROR, "get_token_metadata - Error r_jwt_init");
-                j_return = json_pack("{si}", "result", G_ERROR);
+                r_jwt_free(jwt);
+                json_array_set_new(j_metadata_list, index_h, j_metadata);
               }
-              r_jwt_free(jwt);
-            } else {
-              y_log_message(Y_LOG_LEVEL_ERROR, "oidc validate_refresh_token - Error executing j_query scope access_token");
-              j_return = json_pack("{si}", "result", G_ERROR_DB);
             }
             json_decref(j_client);
           } else {
-            j_return = json_pack("{sis{so}}", "result", G_OK, "token", "active", json_false());
+            j_metadata = json_pack("{s{so}}", "token", "active", json_false());
+            set_token_metadata(j_hash_list, j_metadata_list, hash, j_metadata);
+            json_decref(j_metadata);
           }
+          o_free(hash);
         }
-        json_decref(j_result);
+        json_decref(j_scope_list);
       } else {
-        y_log_message(Y_LOG_LEVEL_ERROR, "get_token_metadata - Error executing j_query access_token");
-        j_return = json_pack("{si}", "result", G_ERROR_DB);
+        y_log_message(Y_LOG_LEVEL_ERROR, "get_access_token_metadata_list - Error get_token_scope_list");
+        ret = G_ERROR_DB;
       }
+      json_decref(j_enabled);
+      json_decref(j_result);
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "get_access_token_metadata_list - Error executing j_query");
+      ret = G_ERROR_DB;
     }
-    if ((token_type_hint == NULL && !found_refresh && !found_access) || 0 == o_strcmp("id_token", token_type_hint)) {
-      j_query = json_pack("{sss[ssssss]s{ssss}}",
-                          "table",
-                          GLEWLWYD_PLUGIN_OIDC_TABLE_ID_TOKEN,
-                          "columns",
-                            "gpoi_username AS username",
-                            "gpoi_client_id AS client_id",
-                            "gpoi_client_id AS aud",
-                            SWITCH_DB_TYPE(config->glewlwyd_config->glewlwyd_config->conn->type, "UNIX_TIMESTAMP(gpoi_issued_at) AS iat", "gpoi_issued_at AS iat", "EXTRACT(EPOCH FROM gpoi_issued_at)::integer AS iat"),
-                            SWITCH_DB_TYPE(config->glewlwyd_config->glewlwyd_config->conn->type, "UNIX_TIMESTAMP(gpoi_issued_at) AS nbf", "gpoi_issued_at AS nbf", "EXTRACT(EPOCH FROM gpoi_issued_at)::integer AS nbf"),
-                            "gpoi_enabled",
-                          "where",
-                            "gpoi_plugin_name",
-                            config->name,
-                            "gpoi_hash",
-                            token_hash);
-      if (client_id != NULL) {
-        json_object_set_new(json_object_get(j_query, "where"), "gpoi_client_id", json_string(client_id));
-      }
-      res = h_select(config->glewlwyd_config->glewlwyd_config->conn, j_query, &j_result, NULL);
-      json_decref(j_query);
-      if (res == H_OK) {
-        if (json_array_size(j_result)) {
-          found_id_token = 1;
-          if (json_integer_value(json_object_get(json_array_get(j_result, 0), "gpoi_enabled")) && json_integer_value(json_object_get(json_array_get(j_result, 0), "iat")) + json_integer_value(json_object_get(config->j_params, "access-token-duration")) > now) {
-            json_object_set_new(json_array_get(j_result, 0), "sub", json_string(sub));
-            json_object_set_new(json_array_get(j_result, 0), "active", json_true());
-            json_object_set_new(json_array_get(j_result, 0), "token_type", json_string("id_token"));
-            json_object_set_new(json_array_get(j_result, 0), "exp", json_integer(json_integer_value(json_object_get(json_array_get(j_result, 0), "iat")) + json_integer_value(json_object_get(config->j_params, "access-token-duration"))));
-            json_object_del(json_array_get(j_result, 0), "gpoi_enabled");
-            if (json_object_get(json_array_get(j_result, 0), "client_id") == json_null()) {
-              json_object_del(json_array_get(j_result, 0), "client_id");
-              json_object_del(json_array_get(j_result, 0), "aud");
-              sub = get_sub(config, json_string_value(json_object_get(json_array_get(j_result, 0), "username")), NULL);
-            } else {
-              j_client = config->glewlwyd_config->glewlwyd_plugin_callback_get_client(config->glewlwyd_config, json_string_value(json_object_get(json_array_get(j_result, 0), "client_id")));
-              if (check_result_value(j_client, G_OK) && json_object_get(json_object_get(j_client, "client"), "enabled") == json_true()) {
-                sub = get_sub(config, json_string_value(json_object_get(json_array_get(j_result, 0), "username")), json_object_get(j_client, "client"));
-              }
-              json_decref(j_client);
-            }
-            if (sub != NULL) {
-              json_object_set_new(json_array_get(j_result, 0), "sub", json_string(sub));
-              o_free(sub);
-            }
-            if (json_object_get(json_array_get(j_result, 0), "username") == json_null()) {
-              json_object_del(json_array_get(j_result, 0), "username");
-            }
-            j_return = json_pack("{sisO}", "result", G_OK, "token", json_array_get(j_result, 0));
-          } else {
-            j_return = json_pack("{sis{so}}", "result", G_OK, "token", "active", json_false());
-          }
+    o_free(hash_clause);
+  }
+  return ret;
+}
+
+/**
+ * Sets the metadata of the id_tokens not found yet
+ */
+static int get_id_token_metadata_list(struct _oidc_config * config, json_t * j_cache, json_t * j_hash_list, json_t * j_metadata_list, const char * client_id, time_t now) {
+  json_t * j_query, * j_result = NULL, * j_element = NULL, * j_client, * j_metadata;
+  char * hash_clause = get_token_hash_pending_clause(config, j_hash_list, j_metadata_list), * hash;
+  size_t index = 0;
+  int res, ret = G_OK;
+
+  if (hash_clause != NULL) {
+    j_query = json_pack("{sss[sssssss]s{sss{ssss}}}",
+                        "table",
+                        GLEWLWYD_PLUGIN_OIDC_TABLE_ID_TOKEN,
+                        "columns",
+                          "gpoi_hash",
+                          "gpoi_username AS username",
+                          "gpoi_client_id AS client_id",
+                          "gpoi_client_id AS aud",
+                          SWITCH_DB_TYPE(config->glewlwyd_config->glewlwyd_config->conn->type, "UNIX_TIMESTAMP(gpoi_issued_at) AS iat", "gpoi_issued_at AS iat", "EXTRACT(EPOCH FROM gpoi_issued_at)::integer AS iat"),
+                          SWITCH_DB_TYPE(config->glewlwyd_config->glewlwyd_config->conn->type, "UNIX_TIMESTAMP(gpoi_issued_at) AS nbf", "gpoi_issued_at AS nbf", "EXTRACT(EPOCH FROM gpoi_issued_at)::integer AS nbf"),
+                          "gpoi_enabled",
+                        "where",
+                          "gpoi_plugin_name",
+                          config->name,
+                          "gpoi_hash",
+                            "operator",
+                            "raw",
+                            "value",
+                            hash_clause);
+    if (client_id != NULL) {
+      json_object_set_new(json_object_get(j_query, "where"), "gpoi_client_id", json_string(client_id));
+    }
+    res = h_select(config->glewlwyd_config->glewlwyd_config->conn, j_query, &j_result, NULL);
+    json_decref(j_query);
+    if (res == H_OK) {
+      json_array_foreach(j_result, index, j_element) {
+        hash = o_strdup(json_string_value(json_object_get(j_element, "gpoi_hash")));
+        json_object_del(j_element, "gpoi_hash");
+        if (json_integer_value(json_object_get(j_element, "gpoi_enabled")) && json_integer_value(json_object_get(j_element, "iat")) + json_integer_value(json_object_get(config->j_params, "access-token-duration")) > now) {
+          json_object_set_new(j_element, "active", json_true());
+          json_object_set_new(j_element, "token_type", json_string("id_token"));
+          json_object_set_new(j_element, "exp", json_integer(json_integer_value(json_object_get(j_element, "iat")) + json_integer_value(json_object_get(config->j_params, "access-token-duration"))));
+          json_object_del(j_element, "gpoi_enabled");
+          j_client = set_token_sub(config, j_cache, j_element, 1, 0);
+          json_decref(j_client);
+          j_metadata = json_pack("{sO}", "token", j_element);
+        } else {
+          j_metadata = json_pack("{s{so}}", "token", "active", json_false());
         }
-        json_decref(j_result);
-      } else {
-        y_log_message(Y_LOG_LEVEL_ERROR, "get_token_metadata - Error executing j_query id_token");
-        j_return = json_pack("{si}", "result", G_ERROR_DB);
+        set_token_metadata(j_hash_list, j_metadata_list, hash, j_metadata);
+        json_decref(j_metadata);
+        o_free(hash);
       }
+      json_decref(j_result);
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "get_id_token_metadata_list - Error executing j_query");
+      ret = G_ERROR_DB;
     }
-    if (!found_refresh && !found_access && !found_id_token && j_return == NULL) {
-      j_return = json_pack("{sis{so}}", "result", G_OK, "token", "active", json_false());
+    o_free(hash_clause);
+  }
+  return ret;
+}
+
+/**
+ * Returns the metadata of a list of tokens, in the same order
+ * Each token is looked for in the refresh tokens, then the access tokens, then the id_tokens,
+ * with one query per table and per scope table for the whole list
+ * The clients and the subs are read once per list
+ */
+static json_t * get_token_metadata_list(struct _oidc_config * config, json_t * j_token_list, const char * token_type_hint, const char * client_id) {
+  json_t * j_hash_list = json_array(), * j_metadata_list = json_array(), * j_cache = json_pack("{s{}s{}}", "client", "sub"), * j_element = NULL, * j_return;
+  char * token_hash, * expires_at_clause;
+  size_t index = 0;
+  time_t now;
+  int ret = G_OK;
+
+  time(&now);
+  if (config->glewlwyd_config->glewlwyd_config->conn->type==HOEL_DB_TYPE_MARIADB) {
+    expires_at_clause = msprintf("> FROM_UNIXTIME(%u)", (now));
+  } else if (config->glewlwyd_config->glewlwyd_config->conn->type==HOEL_DB_TYPE_PGSQL) {
+    expires_at_clause = msprintf("> TO_TIMESTAMP(%u)", now);
+  } else { // HOEL_DB_TYPE_SQLITE
+    expires_at_clause = msprintf("> %u", (now));
+  }
+  json_array_foreach(j_token_list, index, j_element) {
+    if ((token_hash = config->glewlwyd_config->glewlwyd_callback_generate_hash(config->glewlwyd_config, json_string_value(j_element))) != NULL) {
+      json_array_append_new(j_hash_list, json_string(token_hash));
+      json_array_append(j_metadata_list, json_null());
+    } else {
+      // Keep the tokens and the hashes aligned, the token is inactive
+      y_log_message(Y_LOG_LEVEL_ERROR, "get_token_metadata_list - Error glewlwyd_callback_generate_hash at index %zu", index);
+      json_array_append(j_hash_list, json_null());
+      json_array_append_new(j_metadata_list, json_pack("{s{so}}", "token", "active", json_false()));
     }
     o_free(token_hash);
-    o_free(expires_at_clause);
+  }
+  if (token_type_hint == NULL || 0 == o_strcmp("refresh_token", token_type_hint)) {
+    ret = get_refresh_token_metadata_list(config, j_cache, j_hash_list, j_metadata_list, client_id, expires_at_clause);
+  }
+  if (ret == G_OK && (token_type_hint == NULL || 0 == o_strcmp("access_token", token_type_hint))) {
+    ret = get_access_token_metadata_list(config, j_cache, j_token_list, j_hash_list, j_metadata_list, client_id, now);
+  }
+  if (ret == G_OK && (token_type_hint == NULL || 0 == o_strcmp("id_token", token_type_hint))) {
+    ret = get_id_token_metadata_list(config, j_cache, j_hash_list, j_metadata_list, client_id, now);
+  }
+  if (ret == G_OK) {
+    json_array_foreach(j_metadata_list, index, j_element) {
+      if (j_element == json_null()) {
+        json_array_set_new(j_metadata_list, index, json_pack("{s{so}}", "token", "active", json_false()));
+      }
+    }
+    j_return = json_pack("{sisO}", "result", G_OK, "tokens", j_metadata_list);
+  } else {
+    j_return = json_pack("{si}", "result", ret);
+  }
+  json_decref(j_hash_list);
+  json_decref(j_metadata_list);
+  json_decref(j_cache);
+  o_free(expires_at_clause);
+  return j_return;
+}
+
+static json_t * get_token_metadata(struct _oidc_config * config, const char * token, const char * token_type_hint, const char * client_id) {
+  json_t * j_token_list, * j_result, * j_return;
+
+  if (o_strlen(token)) {
+    j_token_list = json_pack("[s]", token);
+    j_result = get_token_metadata_list(config, j_token_list, token_type_hint, client_id);
+    if (check_result_value(j_result, G_OK)) {
+      j_return = json_pack("{si}", "result", G_OK);
+      json_object_update(j_return, json_array_get(json_object_get(j_result, "tokens"), 0));
+    } else {
+      j_return = json_pack("{sO}", "result", json_object_get(j_result, "result"));
+    }
+    json_decref(j_result);
+    json_decref(j_token_list);
   } else {
     j_return = json_pack("{si}", "result", G_ERROR_PARAM);
   }
@@ -5185,7 +6499,8 @@ static int serialize_client_register(struct _oidc_config * config, const struct
   char * issued_for = get_client_hostname(request), * access_token_hash = NULL, * management_at_hash = NULL;
   json_int_t gpoa_id = 0;
 
-  if (json_array_size(json_object_get(config->j_params, "register-client-auth-scope"))) {
+  // Stateless access tokens aren't stored in the database, the registration isn't linked to the access token then
+  if (json_array_size(json_object_get(config->j_params, "register-client-auth-scope")) && !config->access_token_stateless) {
     access_token_hash = config->glewlwyd_config->glewlwyd_callback_generate_hash(config->glewlwyd_config, (u_map_get_case(request->map_header, HEADER_AUTHORIZATION) + o_strlen(HEADER_PREFIX_BEARER)));
     j_query = json_pack("{sss[s]s{ssss}}",
                         "table",
@@ -5489,7 +6804,7 @@ static json_t * is_client_registration_valid(struct _oidc_config * config, json_
           break;
         }
         r_jwks_init(&jwks);
-        if (r_jwks_import_from_uri(jwks, json_string_value(json_object_get(j_registration, "jwks_uri")), config->x5u_flags) != RHN_OK) {
+        if (import_jwks_from_uri(config, jwks, json_string_value(json_object_get(j_registration, "jwks_uri")), NULL) != RHN_OK) {
           j_error = json_pack("{ssss}", "error", "invalid_client_metadata", "error_description", "Invalid JWKS pointed by jwks_uri");
         }
         r_jwks_free(jwks);
@@ -5633,6 +6948,7 @@ static char * generate_session_state(const char * client_id, const char * redire
 }
 
 static json_t * generate_device_authorization(struct _oidc_config * config, const char * client_id, const char * scope_list, const char * resource, json_t * j_authorization_details, const char * ip_source) {
+  struct _h_connection * conn;
   char device_code[GLEWLWYD_DEVICE_AUTH_DEVICE_CODE_LENGTH+1] = {0}, user_code[GLEWLWYD_DEVICE_AUTH_USER_CODE_LENGTH+2] = {0}, * device_code_hash = NULL, * user_code_hash = NULL;
   json_t * j_return, * j_query, * j_device_auth_id;
   int res;
@@ -5640,8 +6956,8 @@ static json_t * generate_device_authorization(struct _oidc_config * config, cons
   char * expires_at_clause = NULL, * last_check_clause = NULL, ** scope_array = NULL, * str_authorization_details = NULL;
   size_t i;
 
-  if (pthread_mutex_lock(&config->insert_lock)) {
-    y_log_message(Y_LOG_LEVEL_ERROR, "generate_device_authorization oidc - Error pthread_mutex_lock");
+  if ((conn = insert_conn_acquire(config)) == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "generate_device_authorization oidc - Error insert_conn_acquire");
     j_return = json_pack("{si}", "result", G_ERROR);
   } else {
     if (rand_string(device_code, 32) != NULL && rand_string_from_charset(user_code, GLEWLWYD_DEVICE_AUTH_USER_CODE_LENGTH+1, "ABCDEFGHJKLMNOPQRSTUVWXYZ0123456789") != NULL) {
@@ -5649,10 +6965,10 @@ static json_t * generate_device_authorization(struct _oidc_config * config, cons
       device_code_hash = config->glewlwyd_config->glewlwyd_callback_generate_hash(config->glewlwyd_config, device_code);
       user_code_hash = config->glewlwyd_config->glewlwyd_callback_generate_hash(config->glewlwyd_config, user_code);
       time(&now);
-      if (config->glewlwyd_config->glewlwyd_config->conn->type==HOEL_DB_TYPE_MARIADB) {
+      if (conn->type==HOEL_DB_TYPE_MARIADB) {
         expires_at_clause = msprintf("FROM_UNIXTIME(%u)", (now + expiration));
         last_check_clause = msprintf("FROM_UNIXTIME(%u)", (now - (2*expiration)));
-      } else if (config->glewlwyd_config->glewlwyd_config->conn->type==HOEL_DB_TYPE_PGSQL) {
+      } else if (conn->type==HOEL_DB_TYPE_PGSQL) {
         expires_at_clause = msprintf("TO_TIMESTAMP(%u)", (now + expiration));
         last_check_clause = msprintf("TO_TIMESTAMP(%u)", (now - (2*expiration)));
       } else { // HOEL_DB_TYPE_SQLITE
@@ -5691,17 +7007,17 @@ static json_t * generate_device_authorization(struct _oidc_config * config, cons
       o_free(device_code_hash);
       o_free(user_code_hash);
       o_free(str_authorization_details);
-      res = h_insert(config->glewlwyd_config->glewlwyd_config->conn, j_query, NULL);
+      res = h_insert(conn, j_query, NULL);
       json_decref(j_query);
       if (res == H_OK) {
-        j_device_auth_id = h_last_insert_id(config->glewlwyd_config->glewlwyd_config->conn);
+        j_device_auth_id = h_last_insert_id(conn);
         if (j_device_auth_id != NULL) {
           if (split_string(scope_list, " ", &scope_array) > 0) {
             j_query = json_pack("{sss[]}", "table", GLEWLWYD_PLUGIN_OIDC_TABLE_DEVICE_AUTHORIZATION_SCOPE, "values");
             for (i=0; scope_array[i]!=NULL; i++) {
               json_array_append_new(json_object_get(j_query, "values"), json_pack("{sOss}", "gpoda_id", j_device_auth_id, "gpodas_scope", scope_array[i]));
             }
-            res = h_insert(config->glewlwyd_config->glewlwyd_config->conn, j_query, NULL);
+            res = h_insert(conn, j_query, NULL);
             json_decref(j_query);
             if (res == H_OK) {
               j_return = json_pack("{sis{ssss}}", "result", G_OK, "authorization", "device_code", device_code, "user_code", user_code);
@@ -5727,7 +7043,7 @@ static json_t * generate_device_authorization(struct _oidc_config * config, cons
       y_log_message(Y_LOG_LEVEL_ERROR, "generate_device_authorization - Error generating random code");
       j_return = json_pack("{si}", "result", G_ERROR);
     }
-    pthread_mutex_unlock(&config->insert_lock);
+    insert_conn_release(config, conn);
   }
   return j_return;
 }
@@ -6073,6 +7389,7 @@ static int check_auth_type_device_code(const struct _u_request * request,
                                                                             resource,
                                                                             now,
                                                                             jti,
+                                                                            jti_r,
                                                                             x5t_s256,
                                                                             json_string_value(json_object_get(j_jkt, "jkt")),
                                                                             json_object_get(json_array_get(j_result, 0), "authorization_details"),
@@ -6300,6 +7617,9 @@ static int check_auth_type_device_code(const struct _u_request * request,
         ulfius_set_json_body_response(response, 500, j_body);
         json_decref(j_body);
       }
+    } else if (check_result_value(j_client, G_ERROR_UNAVAILABLE)) {
+      u_map_put(response->map_header, "Retry-After", "1");
+      response->status = 503;
     } else {
       y_log_message(Y_LOG_LEVEL_WARNING, "Security - Authorization invalid for client_id %s at IP Address %s", client_id, ip_source);
       j_body = json_pack("{ss}", "error", "unauthorized_client");
@@ -6478,7 +7798,7 @@ static json_t * check_client_certificate_valid(struct _oidc_config * config, con
                     j_return = json_pack("{si}", "result", G_ERROR_UNAUTHORIZED);
                   }
                 } else if (json_string_length(json_object_get(json_object_get(j_client, "client"), "jwks_uri"))) {
-                  if (r_jwks_import_from_uri(jwks, json_string_value(json_object_get(json_object_get(j_client, "client"), "jwks_uri")), config->x5u_flags) == RHN_OK) {
+                  if (import_jwks_from_uri(config, jwks, json_string_value(json_object_get(json_object_get(j_client, "client"), "jwks_uri")), NULL) == RHN_OK) {
                     for (index = 0; index < r_jwks_size(jwks); index++) {
                       jwk = r_jwks_get_at(jwks, index);
                       if ((self_cert = r_jwk_export_to_gnutls_crt(jwk, config->x5u_flags)) != NULL) {
@@ -7311,13 +8631,63 @@ static int callback_revocation(const struct _u_request * request, struct _u_resp
   return U_CALLBACK_CONTINUE;
 }
 
+/**
+ * Introspects a list of tokens in one request
+ * The tokens are sent in the parameter tokens, separated by spaces
+ * The response is a JSON array with the introspection of each token in the same order
+ */
+static int callback_introspection_batch(const struct _u_request * request, struct _u_response * response, void * user_data) {
+  struct _oidc_config * config = (struct _oidc_config *)user_data;
+  json_t * j_token_list = json_array(), * j_result, * j_body, * j_element = NULL;
+  char ** token_array = NULL;
+  size_t index = 0;
+  int i;
+
+  u_map_put(response->map_header, "Cache-Control", "no-store");
+  u_map_put(response->map_header, "Pragma", "no-cache");
+  u_map_put(response->map_header, "Referrer-Policy", "no-referrer");
+
+  if (split_string(u_map_get(request->map_post_body, "tokens"), " ", &token_array) > 0) {
+    for (i=0; token_array[i]!=NULL; i++) {
+      if (o_strlen(token_array[i])) {
+        json_array_append_new(j_token_list, json_string(token_array[i]));
+      }
+    }
+  }
+  free_string_array(token_array);
+  if (!json_array_size(j_token_list)) {
+    j_body = json_pack("{ssss}", "error", "invalid_request", "error_description", "tokens missing");
+    ulfius_set_json_body_response(response, 400, j_body);
+    json_decref(j_body);
+  } else if ((json_int_t)json_array_size(j_token_list) > config->introspection_batch_max_tokens) {
+    j_body = json_pack("{ssss}", "error", "invalid_request", "error_description", "too many tokens");
+    ulfius_set_json_body_response(response, 400, j_body);
+    json_decref(j_body);
+  } else {
+    j_result = get_token_metadata_list(config, j_token_list, u_map_get(request->map_post_body, "token_type_hint"), get_client_id_for_introspection(config, request));
+    if (check_result_value(j_result, G_OK)) {
+      j_body = json_array();
+      json_array_foreach(json_object_get(j_result, "tokens"), index, j_element) {
+        json_array_append(j_body, json_object_get(j_element, "token"));
+      }
+      ulfius_set_json_body_response(response, 200, j_body);
+      json_decref(j_body);
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "callback_introspection_batch - Error get_token_metadata_list");
+      response->status = 500;
+    }
+    json_decref(j_result);
+  }
+  json_decref(j_token_list);
+  return U_CALLBACK_CONTINUE;
+}
+
 static int callback_introspection(const struct _u_request * request, struct _u_response * response, void * user_data) {
   struct _oidc_config * config = (struct _oidc_config *)user_data;
   json_t * j_result;
   jwt_t * jwt = NULL;
-  jwk_t * jwk = NULL;
+  const struct _oidc_sign_key * sign_key;
   time_t now;
-  const char * sign_kid = json_string_value(json_object_get(config->j_params, "client-sign_kid-parameter"));
   char * token = NULL, * token_out;
   int jwt_ok;
 
@@ -7329,7 +8699,7 @@ static int callback_introspection(const struct _u_request * request, struct _u_r
   if (check_result_value(j_result, G_OK)) {
     if (0 == o_strcmp("jwt", u_map_get(request->map_url, "format")) || 0 == o_strcmp("jwt", u_map_get(request->map_post_body, "format")) || 0 == o_strcasecmp("application/jwt", u_map_get_case(request->map_header, "Accept")) || 0 == o_strcasecmp("application/token-introspection+jwt", u_map_get_case(request->map_header, "Accept"))) {
       if (0 == o_strcmp("access_token", json_string_value(json_object_get(json_object_get(j_result, "token"), "token_type")))) {
-        if ((jwt = r_jwt_copy(config->jwt_sign)) != NULL) {
+        if ((sign_key = get_sign_key(config, json_object_get(j_result, "client"))) != NULL && (jwt = r_jwt_copy(sign_key->jwt)) != NULL) {
           time(&now);
           r_jwt_set_claim_json_t_value(jwt, "iss", json_object_get(config->j_params, "iss"));
           json_object_set(json_object_get(j_result, "token"), "iss", json_object_get(config->j_params, "iss"));
@@ -7356,16 +8726,7 @@ static int callback_introspection(const struct _u_request * request, struct _u_r
             }
           }
           if (jwt_ok) {
-            if (json_string_length(json_object_get(json_object_get(j_result, "client"), sign_kid))) {
-              jwk = r_jwks_get_by_kid(config->jwt_sign->jwks_privkey_sign, json_string_value(json_object_get(json_object_get(j_result, "client"), sign_kid)));
-            } else {
-              jwk = r_jwk_copy(config->jwk_sign_default);
-            }
-            if (r_jwk_get_property_str(jwk, "alg") != NULL) {
-              r_jwt_set_sign_alg(jwt, r_str_to_jwa_alg(r_jwk_get_property_str(jwk, "alg")));
-            }
-            token = r_jwt_serialize_signed(jwt, jwk, 0);
-            r_jwk_free(jwk);
+            token = r_jwt_serialize_signed(jwt, sign_key->jwk, 0);
             if (token != NULL) {
               if ((token_out = encrypt_token_if_required(config, token, json_object_get(j_result, "client"), GLEWLWYD_TOKEN_TYPE_INTROSPECTION)) != NULL) {
                 ulfius_set_string_body_response(response, 200, token_out);
@@ -7455,6 +8816,10 @@ static int callback_check_intropect_revoke(const struct _u_request * request, st
               ret = U_CALLBACK_CONTINUE;
             }
           }
+        } else if (check_result_value(j_client, G_ERROR_UNAVAILABLE)) {
+          u_map_put(response->map_header, "Retry-After", "1");
+          response->status = 503;
+          ret = U_CALLBACK_COMPLETE;
         }
         json_decref(j_client);
       }
@@ -8290,6 +9655,7 @@ static int check_auth_type_access_token_request (const struct _u_request * reque
                                                               resource,
                                                               now,
                                                               jti,
+                                                              jti_r,
                                                               x5t_s256,
                                                               json_string_value(json_object_get(j_jkt, "jkt")),
                                                               j_authorization_details_processed,
@@ -8492,6 +9858,9 @@ static int check_auth_type_access_token_request (const struct _u_request * reque
       }
       json_decref(j_code);
       json_decref(j_claims_request);
+    } else if (check_result_value(j_client, G_ERROR_UNAVAILABLE)) {
+      u_map_put(response->map_header, "Retry-After", "1");
+      response->status = 503;
     } else {
       j_body = json_pack("{ss}", "error", "unauthorized_client");
       ulfius_set_json_body_response(response, 403, j_body);
@@ -8577,6 +9946,8 @@ static int check_auth_type_resource_owner_pwd_cred (const struct _u_request * re
       }
     } else if (check_result_value(j_client, G_ERROR_NOT_FOUND) || check_result_value(j_client, G_ERROR_UNAUTHORIZED)) {
       ret = G_ERROR_PARAM;
+    } else if (check_result_value(j_client, G_ERROR_UNAVAILABLE)) {
+      ret = G_ERROR_UNAVAILABLE;
     } else {
       y_log_message(Y_LOG_LEVEL_ERROR, "oidc check_auth_type_resource_owner_pwd_cred - Error glewlwyd_callback_check_client_valid");
       ret = G_ERROR;
@@ -8642,6 +10013,7 @@ static int check_auth_type_resource_owner_pwd_cred (const struct _u_request * re
                                                             NULL,
                                                             now,
                                                             jti,
+                                                            jti_r,
                                                             x5t_s256,
                                                             NULL,
                                                             NULL,
@@ -8811,6 +10183,9 @@ static int check_auth_type_resource_owner_pwd_cred (const struct _u_request * re
       y_log_message(Y_LOG_LEVEL_WARNING, "Security - Authorization invalid for username %s at IP Address %s", username, ip_source);
       response->status = 403;
       config->glewlwyd_config->glewlwyd_plugin_callback_metrics_increment_counter(config->glewlwyd_config, GLWD_METRICS_OIDC_UNAUTHORIZED_CLIENT, 1, "plugin", config->name, NULL);
+    } else if (check_result_value(j_user, G_ERROR_UNAVAILABLE)) {
+      u_map_put(response->map_header, "Retry-After", "1");
+      response->status = 503;
     } else {
       y_log_message(Y_LOG_LEVEL_ERROR, "oidc check_auth_type_resource_owner_pwd_cred - glewlwyd_callback_check_user_valid");
       response->status = 403;
@@ -8821,6 +10196,9 @@ static int check_auth_type_resource_owner_pwd_cred (const struct _u_request * re
     response->status = 400;
   } else if (ret == G_ERROR_UNAUTHORIZED) {
     response->status = 403;
+  } else if (ret == G_ERROR_UNAVAILABLE) {
+    u_map_put(response->map_header, "Retry-After", "1");
+    response->status = 503;
   } else {
     response->status = 500;
   }
@@ -8975,6 +10353,9 @@ static int check_auth_type_client_credentials_grant (const struct _u_request * r
         response->status = 500;
       }
       free_string_array(scope_array);
+    } else if (check_result_value(j_client, G_ERROR_UNAVAILABLE)) {
+      u_map_put(response->map_header, "Retry-After", "1");
+      response->status = 503;
     } else {
       y_log_message(Y_LOG_LEVEL_DEBUG, "oidc check_auth_type_client_credentials_grant - Error client_id '%s' invalid", request->auth_basic_user);
       y_log_message(Y_LOG_LEVEL_WARNING, "Security - Authorization invalid for username %s at IP Address %s", request->auth_basic_user, ip_source);
@@ -9179,7 +10560,11 @@ static int check_pushed_authorization_request (const struct _u_request * request
       j_client = check_client_valid(config, client_id, client_secret, redirect_uri, auth_type, 0, ip_source);
     }
 
-    if (!check_result_value(j_client, G_OK)) {
+    if (check_result_value(j_client, G_ERROR_UNAVAILABLE)) {
+      u_map_put(response->map_header, "Retry-After", "1");
+      response->status = 503;
+      break;
+    } else if (!check_result_value(j_client, G_OK)) {
       y_log_message(Y_LOG_LEVEL_DEBUG, "check_pushed_authorization_request oidc - client '%s' is invalid, origin: %s", client_id, ip_source);
       response->status = 403;
       break;
@@ -9486,7 +10871,7 @@ static int get_access_token_from_refresh (const struct _u_request * request,
        * scope_joined = NULL,
        * issued_for = NULL,
          jti[OIDC_JTI_LENGTH+1] = {0};
-  int has_error = 0, has_issues = 0, resource_checked = 0, res;
+  int has_error = 0, has_issues = 0, has_unavailable = 0, resource_checked = 0, res;
   json_int_t gpor_id = 0;
 
   if (client_id == NULL && u_map_get(request->map_post_body, "client_id") != NULL) {
@@ -9509,9 +10894,9 @@ static int get_access_token_from_refresh (const struct _u_request * request,
           y_log_message(Y_LOG_LEVEL_ERROR, "get_access_token_from_refresh oidc - Error loading JSON claims request");
         }
       }
-      scope_joined = join_json_string_array(json_object_get(json_object_get(j_refresh, "token"), "scope"), " ");
+      scope_joined = o_strdup(json_string_value(json_object_get(json_object_get(j_refresh, "token"), "scope")));
       if (scope_joined == NULL) {
-        y_log_message(Y_LOG_LEVEL_ERROR, "get_access_token_from_refresh oidc - Error join_json_string_array");
+        y_log_message(Y_LOG_LEVEL_ERROR, "get_access_token_from_refresh oidc - Error o_strdup scope");
         has_error = 1;
       }
       if (json_object_get(json_object_get(j_refresh, "token"), "client_id") != json_null()) {
@@ -9528,7 +10913,10 @@ static int get_access_token_from_refresh (const struct _u_request * request,
             j_client = check_client_valid(config, client_id, client_secret, NULL, GLEWLWYD_AUTHORIZATION_TYPE_REFRESH_TOKEN_FLAG, 0, ip_source);
           }
         }
-        if (!check_result_value(j_client, G_OK) && is_client_auth_method_allowed(json_object_get(j_client, "client"), client_auth_method)) {
+        if (check_result_value(j_client, G_ERROR_UNAVAILABLE)) {
+          has_issues = 1;
+          has_unavailable = 1;
+        } else if (!check_result_value(j_client, G_OK) && is_client_auth_method_allowed(json_object_get(j_client, "client"), client_auth_method)) {
           has_issues = 1;
         } else if (client_id == NULL && client_secret == NULL && json_object_get(json_object_get(j_client, "client"), "confidential") == json_true()) {
           y_log_message(Y_LOG_LEVEL_DEBUG, "get_access_token_from_refresh oidc - client '%s' is invalid or is not confidential, origin: %s", client_id, ip_source);
@@ -9557,7 +10945,9 @@ static int get_access_token_from_refresh (const struct _u_request * request,
       if (resource_checked) {
         time(&now);
         issued_for = get_client_hostname(request);
-        if (is_refresh_token_one_use(config, json_object_get(j_client, "client"))) {
+        if (has_unavailable) {
+          // The client password couldn't be checked, the refresh token is kept as is so the client can retry
+        } else if (is_refresh_token_one_use(config, json_object_get(j_client, "client"))) {
           if (update_refresh_token(config,
                                    json_integer_value(json_object_get(json_object_get(j_refresh, "token"), "gpor_id")),
                                    0,
@@ -9627,6 +11017,7 @@ static int get_access_token_from_refresh (const struct _u_request * request,
                                                       resource,
                                                       now,
                                                       jti,
+                                                      json_string_value(json_object_get(json_object_get(j_refresh, "token"), "jti")),
                                                       x5t_s256,
                                                       json_string_value(json_object_get(json_object_get(j_refresh, "token"), "dpop_jkt")),
                                                       j_authorization_details_processed,
@@ -9707,6 +11098,9 @@ static int get_access_token_from_refresh (const struct _u_request * request,
             response->status = 500;
           }
           json_decref(j_user);
+        } else if (has_unavailable) {
+          u_map_put(response->map_header, "Retry-After", "1");
+          response->status = 503;
         } else if (has_issues) {
           response->status = 400;
         } else {
@@ -9733,8 +11127,12 @@ static int get_access_token_from_refresh (const struct _u_request * request,
           j_client = check_client_valid(config, json_string_value(json_object_get(json_object_get(j_refresh, "token"), "client_id")), client_secret, NULL, GLEWLWYD_AUTHORIZATION_TYPE_REFRESH_TOKEN_FLAG, 0, ip_source);
         }
       }
-      if (is_refresh_token_one_use(config, json_object_get(j_client, "client")) && disable_refresh_token_by_jti(config, json_string_value(json_object_get(json_object_get(j_refresh, "token"), "jti"))) != G_OK) {
-        y_log_message(Y_LOG_LEVEL_ERROR, "get_access_token_from_refresh oidc - Error disable_refresh_token_by_jti");
+      if (is_refresh_token_one_use(config, json_object_get(j_client, "client"))) {
+        if (disable_refresh_token_by_jti(config, json_string_value(json_object_get(json_object_get(j_refresh, "token"), "jti"))) != G_OK) {
+          y_log_message(Y_LOG_LEVEL_ERROR, "get_access_token_from_refresh oidc - Error disable_refresh_token_by_jti");
+        } else if (revoke_refresh_token_jti(config, json_string_value(json_object_get(json_object_get(j_refresh, "token"), "jti"))) != G_OK) {
+          y_log_message(Y_LOG_LEVEL_ERROR, "get_access_token_from_refresh oidc - Error revoke_refresh_token_jti");
+        }
       }
       json_decref(j_client);
       config->glewlwyd_config->glewlwyd_plugin_callback_metrics_increment_counter(config->glewlwyd_config, GLWD_METRICS_OIDC_INVALID_REFRESH_TOKEN, 1, "plugin", config->name, NULL);
@@ -9807,6 +11205,9 @@ static int delete_refresh_token (const struct _u_request * request, struct _u_re
         if (update_refresh_token(config, json_integer_value(json_object_get(json_object_get(j_refresh, "token"), "gpor_id")), 0, 1, now) != G_OK) {
           y_log_message(Y_LOG_LEVEL_ERROR, "oidc delete_refresh_token - Error update_refresh_token");
           response->status = 500;
+        } else if (revoke_refresh_token_jti(config, json_string_value(json_object_get(json_object_get(j_refresh, "token"), "jti"))) != G_OK) {
+          y_log_message(Y_LOG_LEVEL_ERROR, "oidc delete_refresh_token - Error revoke_refresh_token_jti");
+          response->status = 500;
         }
         o_free(issued_for);
       } else {
@@ -10333,6 +11734,7 @@ static int callback_oidc_authorization(const struct _u_request * request, struct
                                                       jti,
                                                       NULL,
                                                       NULL,
+                                                      NULL,
                                                       j_authorization_details_processed,
                                                       get_ip_source(request))) != NULL) {
               if (serialize_access_token(config,
@@ -10677,8 +12079,7 @@ static int callback_oidc_get_userinfo(const struct _u_request * request, struct
   char * username = get_username_from_sub(config, json_string_value(json_object_get((json_t *)response->shared_data, "sub"))), * token = NULL, * token_out = NULL;
   json_t * j_user, * j_userinfo, * j_client = config->glewlwyd_config->glewlwyd_plugin_callback_get_client(config->glewlwyd_config, json_string_value(json_object_get((json_t *)response->shared_data, "client_id")));
   jwt_t * jwt = NULL;
-  jwk_t * jwk = NULL;
-  const char * sign_kid = json_string_value(json_object_get(config->j_params, "client-sign_kid-parameter"));
+  const struct _oidc_sign_key * sign_key;
   json_t * j_jkt = NULL;
   int jkt_continue = 1;
   char * external_url, * htu;
@@ -10714,24 +12115,16 @@ static int callback_oidc_get_userinfo(const struct _u_request * request, struct
         j_userinfo = get_userinfo(config, json_string_value(json_object_get((json_t *)response->shared_data, "sub")), json_object_get(j_user, "user"), json_object_get((json_t *)response->shared_data, "claims"), json_string_value(json_object_get((json_t *)response->shared_data, "scope")));
         if (j_userinfo != NULL) {
           if (0 == o_strcmp("jwt", u_map_get(request->map_url, "format")) || 0 == o_strcmp("jwt", u_map_get(request->map_post_body, "format")) || 0 == o_strcasecmp("application/jwt", u_map_get_case(request->map_header, "Accept")) || 0 == o_strcasecmp("application/token-userinfo+jwt", u_map_get_case(request->map_header, "Accept"))) {
-            if ((jwt = r_jwt_copy(config->jwt_sign)) != NULL) {
+            if (check_result_value(j_client, G_OK) && json_object_get(json_object_get(j_client, "client"), "enabled") == json_true()) {
+              sign_key = get_sign_key(config, json_object_get(j_client, "client"));
+            } else {
+              sign_key = &config->sign_key_default;
+            }
+            if (sign_key != NULL && (jwt = r_jwt_copy(sign_key->jwt)) != NULL) {
               json_object_set(j_userinfo, "iss", json_object_get(config->j_params, "iss"));
               if (r_jwt_set_full_claims_json_t(jwt, j_userinfo) == RHN_OK) {
-                if (check_result_value(j_client, G_OK) && json_object_get(json_object_get(j_client, "client"), "enabled") == json_true()) {
-                  if (json_string_length(json_object_get(json_object_get(j_client, "client"), sign_kid))) {
-                    jwk = r_jwks_get_by_kid(config->jwt_sign->jwks_privkey_sign, json_string_value(json_object_get(json_object_get(j_client, "client"), sign_kid)));
-                  } else {
-                    jwk = r_jwk_copy(config->jwk_sign_default);
-                  }
-                } else {
-                  jwk = r_jwk_copy(config->jwk_sign_default);
-                }
-                if (r_jwk_get_property_str(jwk, "alg") != NULL) {
-                  r_jwt_set_sign_alg(jwt, r_str_to_jwa_alg(r_jwk_get_property_str(jwk, "alg")));
-                }
                 r_jwt_set_header_str_value(jwt, "typ", "token-userinfo+jwt");
-                token = r_jwt_serialize_signed(jwt, jwk, 0);
-                r_jwk_free(jwk);
+                token = r_jwt_serialize_signed(jwt, sign_key->jwk, 0);
                 if (token != NULL) {
                   if ((token_out = encrypt_token_if_required(config, token, json_object_get(j_client, "client"), GLEWLWYD_TOKEN_TYPE_USERINFO)) != NULL) {
                     ulfius_set_string_body_response(response, 200, token_out);
@@ -11505,7 +12898,7 @@ static int jwt_autocheck(struct _oidc_config * config) {
   int ret;
 
   time(&now);
-  token = generate_access_token(config, GLEWLWYD_CHECK_JWT_USERNAME, NULL, NULL, GLEWLWYD_CHECK_JWT_SCOPE, NULL, GLEWLWYD_CHECK_JWT_SCOPE, now, jti, NULL, NULL, NULL, NULL);
+  token = generate_access_token(config, GLEWLWYD_CHECK_JWT_USERNAME, NULL, NULL, GLEWLWYD_CHECK_JWT_SCOPE, NULL, GLEWLWYD_CHECK_JWT_SCOPE, now, jti, NULL, NULL, NULL, NULL, NULL);
   if (token != NULL) {
     jwt = r_jwt_copy(config->oidc_resource_config->jwt);
     if (r_jwt_parse(jwt, token, 0) == RHN_OK && r_jwt_verify_signature(jwt, config->oidc_resource_config->jwk_verify_default, 0) == RHN_OK) {
@@ -11523,6 +12916,128 @@ static int jwt_autocheck(struct _oidc_config * config) {
   return ret;
 }
 
+/**
+ * Increments the access token cache metrics on each lookup
+ */
+static void resource_cache_metrics(void * cls, unsigned short hit) {
+  struct _oidc_config * config = (struct _oidc_config *)cls;
+
+  config->glewlwyd_config->glewlwyd_plugin_callback_metrics_increment_counter(config->glewlwyd_config, GLWD_METRICS_OIDC_ACCESS_TOKEN_CACHE, 1, "plugin", config->name, "result", hit?"hit":"miss", NULL);
+}
+
+/**
+ * Checks the revoked jti list on each access token verified by a resource config
+ */
+static int resource_is_access_token_revoked(void * cls, json_t * j_access_token) {
+  return is_access_token_revoked((struct _oidc_config *)cls, j_access_token) != G_ERROR_NOT_FOUND;
+}
+
+/**
+ * Initializes the verified access tokens cache of the resource config
+ * The access tokens presented to /userinfo, /introspect or /register skip the signature verification
+ * until they expire, the cache is disabled if access-token-cache-size is 0
+ */
+static int init_resource_cache(struct _oidc_config * config, struct _oidc_resource_config * resource_config) {
+  json_int_t size = GLEWLWYD_ACCESS_TOKEN_CACHE_SIZE_DEFAULT;
+  int ret = G_OK;
+
+  if (json_object_get(config->j_params, "access-token-cache-size") != NULL) {
+    size = json_integer_value(json_object_get(config->j_params, "access-token-cache-size"));
+  }
+  if (size > 0 && oidc_resource_cache_init(resource_config, (size_t)size, &resource_cache_metrics, (void *)config) != G_TOKEN_OK) {
+    ret = G_ERROR;
+  }
+  return ret;
+}
+
+/**
+ * Starts the core reaper that deletes the expired codes, tokens, DPoP jti and PAR of this plugin instance
+ * Rows are kept reaper-retention seconds after their expiration
+ * Codes linked to a refresh token and access tokens linked to a client registration are kept
+ * Refresh tokens are kept until the access tokens issued from them expire, since deleting them deletes those access tokens
+ */
+static int start_reaper(struct _oidc_config * config) {
+  json_t * j_tasks;
+  json_int_t retention = GLEWLWYD_REAPER_RETENTION_DEFAULT, batch_size = GLEWLWYD_REAPER_BATCH_SIZE_DEFAULT, batch_delay = GLEWLWYD_REAPER_BATCH_DELAY_DEFAULT;
+  int ret;
+
+  if (json_object_get(config->j_params, "reaper-retention") != NULL) {
+    retention = json_integer_value(json_object_get(config->j_params, "reaper-retention"));
+  }
+  if (json_integer_value(json_object_get(config->j_params, "reaper-batch-size")) > 0) {
+    batch_size = json_integer_value(json_object_get(config->j_params, "reaper-batch-size"));
+  }
+  if (json_object_get(config->j_params, "reaper-batch-delay") != NULL) {
+    batch_delay = json_integer_value(json_object_get(config->j_params, "reaper-batch-delay"));
+  }
+  j_tasks = json_pack("[{sssssssIs{ss}}{sssssssIs{sss{ssss}}}{sssssssIs{sss{ssss}}}{sssssssIs{ss}}{sssssssIs{ss}}{sssssssIs{ss}}{sssssssIs{ss}}]",
+                      "table", GLEWLWYD_PLUGIN_OIDC_TABLE_REFRESH_TOKEN,
+                      "id", "gpor_id",
+                      "date", "gpor_expires_at",
+                      "age", config->access_token_duration + retention,
+                      "where",
+                        "gpor_plugin_name", config->name,
+                      "table", GLEWLWYD_PLUGIN_OIDC_TABLE_CODE,
+                      "id", "gpoc_id",
+                      "date", "gpoc_expires_at",
+                      "age", retention,
+                      "where",
+                        "gpoc_plugin_name", config->name,
+                        "gpoc_id",
+                          "operator", "raw",
+                          "value", "NOT IN (SELECT gpoc_id FROM " GLEWLWYD_PLUGIN_OIDC_TABLE_REFRESH_TOKEN " WHERE gpoc_id IS NOT NULL)",
+                      "table", GLEWLWYD_PLUGIN_OIDC_TABLE_ACCESS_TOKEN,
+                      "id", "gpoa_id",
+                      "date", "gpoa_issued_at",
+                      "age", config->access_token_duration + retention,
+                      "where",
+                        "gpoa_plugin_name", config->name,
+                        "gpoa_id",
+                          "operator", "raw",
+                          "value", "NOT IN (SELECT gpoa_id FROM " GLEWLWYD_PLUGIN_OIDC_TABLE_CLIENT_REGISTRATION " WHERE gpoa_id IS NOT NULL)",
+                      "table", GLEWLWYD_PLUGIN_OIDC_TABLE_ID_TOKEN,
+                      "id", "gpoi_id",
+                      "date", "gpoi_issued_at",
+                      "age", config->access_token_duration + retention,
+                      "where",
+                        "gpoi_plugin_name", config->name,
+                      "table", GLEWLWYD_PLUGIN_OIDC_TABLE_DEVICE_AUTHORIZATION,
+                      "id", "gpoda_id",
+                      "date", "gpoda_expires_at",
+                      "age", retention,
+                      "where",
+                        "gpoda_plugin_name", config->name,
+                      "table", GLEWLWYD_PLUGIN_OIDC_TABLE_PAR,
+                      "id", "gpop_id",
+                      "date", "gpop_expires_at",
+                      "age", retention,
+                      "where",
+                        "gpop_plugin_name", config->name,
+                      "table", GLEWLWYD_PLUGIN_OIDC_TABLE_ACCESS_TOKEN_REVOKED,
+                      "id", "gpoar_id",
+                      "date", "gpoar_expires_at",
+                      "age", retention,
+                      "where",
+                        "gpoar_plugin_name", config->name);
+  if (json_object_get(config->j_params, "oauth-dpop-allowed") == json_true()) {
+    json_array_append_new(j_tasks, json_pack("{sssssssIs{ss}}",
+                                             "table", GLEWLWYD_PLUGIN_OIDC_TABLE_DPOP,
+                                             "id", "gpod_id",
+                                             "date", "gpod_iat",
+                                             "age", json_integer_value(json_object_get(config->j_params, "oauth-dpop-iat-duration")) + retention,
+                                             "where",
+                                               "gpod_plugin_name", config->name));
+  }
+  ret = config->glewlwyd_config->glewlwyd_plugin_callback_reaper_start(config->glewlwyd_config,
+                                                                       config->name,
+                                                                       j_tasks,
+                                                                       (unsigned int)json_integer_value(json_object_get(config->j_params, "reaper-interval")),
+                                                                       (unsigned int)batch_size,
+                                                                       (unsigned int)batch_delay);
+  json_decref(j_tasks);
+  return ret;
+}
+
 json_t * plugin_module_load(struct config_plugin * config) {
   UNUSED(config);
   r_global_init();
@@ -11556,6 +13071,14 @@ json_t * plugin_module_init(struct config_plugin * config, const char * name, js
   *cls = o_malloc(sizeof(struct _oidc_config));
   if (*cls != NULL) {
     p_config = *cls;
+    p_config->j_jwks_cache = NULL;
+    p_config->revoked_jti.bloom = NULL;
+    p_config->revoked_jti.j_jti = NULL;
+    p_config->sign_key_default.kid = NULL;
+    p_config->sign_key_default.jwt = NULL;
+    p_config->sign_key_default.jwk = NULL;
+    p_config->sign_keys = NULL;
+    p_config->nb_sign_keys = 0;
 
     do {
       pthread_mutexattr_init ( &mutexattr );
@@ -11566,6 +13089,11 @@ json_t * plugin_module_init(struct config_plugin * config, const char * name, js
         break;
       }
       pthread_mutexattr_destroy(&mutexattr);
+      if (jwks_cache_init(p_config) != G_OK) {
+        y_log_message(Y_LOG_LEVEL_ERROR, "oidc plugin_module_init - Error jwks_cache_init");
+        j_return = json_pack("{si}", "result", G_ERROR);
+        break;
+      }
 
       // Initialize empty vaiables
       p_config->name = name;
@@ -11608,6 +13136,9 @@ json_t * plugin_module_init(struct config_plugin * config, const char * name, js
       p_config->oidc_resource_config->realm = NULL;
       p_config->oidc_resource_config->accept_access_token = 1;
       p_config->oidc_resource_config->accept_client_token = 0;
+      p_config->oidc_resource_config->cache = NULL;
+      p_config->oidc_resource_config->callback_is_revoked = NULL;
+      p_config->oidc_resource_config->callback_is_revoked_cls = NULL;
 
       // Set config variables with conig parameters
       p_config->x5u_flags = R_FLAG_FOLLOW_REDIRECT|(json_object_get(p_config->j_params, "request-uri-allow-https-non-secure")==json_true()?R_FLAG_IGNORE_SERVER_CERTIFICATE:0);
@@ -11616,6 +13147,16 @@ json_t * plugin_module_init(struct config_plugin * config, const char * name, js
       if (!p_config->access_token_duration) {
         p_config->access_token_duration = GLEWLWYD_ACCESS_TOKEN_EXP_DEFAULT;
       }
+      if (json_object_get(p_config->j_params, "introspection-batch-max-tokens") != NULL) {
+        p_config->introspection_batch_max_tokens = json_integer_value(json_object_get(p_config->j_params, "introspection-batch-max-tokens"));
+      } else {
+        p_config->introspection_batch_max_tokens = GLEWLWYD_INTROSPECTION_BATCH_MAX_TOKENS_DEFAULT;
+      }
+      if (json_object_get(p_config->j_params, "jwks-cache-duration") != NULL) {
+        p_config->jwks_cache_duration = json_integer_value(json_object_get(p_config->j_params, "jwks-cache-duration"));
+      } else {
+        p_config->jwks_cache_duration = GLEWLWYD_JWKS_CACHE_DURATION_DEFAULT;
+      }
       p_config->refresh_token_duration = json_integer_value(json_object_get(p_config->j_params, "refresh-token-duration"));
       if (!p_config->refresh_token_duration) {
         p_config->refresh_token_duration = GLEWLWYD_REFRESH_TOKEN_EXP_DEFAULT;
@@ -11629,6 +13170,16 @@ json_t * plugin_module_init(struct config_plugin * config, const char * name, js
       } else {
         p_config->refresh_token_rolling = 0;
       }
+      p_config->access_token_stateless = json_object_get(p_config->j_params, "access-token-stateless")==json_true()?1:0;
+      if (p_config->access_token_stateless) {
+        if (revoked_jti_init(p_config) != G_OK) {
+          y_log_message(Y_LOG_LEVEL_ERROR, "oidc plugin_module_init - Error revoked_jti_init");
+          j_return = json_pack("{si}", "result", G_ERROR);
+          break;
+        }
+        p_config->oidc_resource_config->callback_is_revoked = &resource_is_access_token_revoked;
+        p_config->oidc_resource_config->callback_is_revoked_cls = p_config;
+      }
       if (0 == o_strcmp("always", json_string_value(json_object_get(p_config->j_params, "refresh-token-one-use")))) {
         p_config->refresh_token_one_use = GLEWLWYD_REFRESH_TOKEN_ONE_USE_ALWAYS;
       } else if (0 == o_strcmp("client-driven", json_string_value(json_object_get(p_config->j_params, "refresh-token-one-use")))) {
@@ -12038,7 +13589,18 @@ json_t * plugin_module_init(struct config_plugin * config, const char * name, js
         break;
       }
 
+      if (sign_keys_init(p_config) != G_OK) {
+        y_log_message(Y_LOG_LEVEL_ERROR, "protocol_init - oidc - Error sign_keys_init");
+        j_return = json_pack("{si}", "result", G_ERROR);
+        break;
+      }
+
       p_config->oidc_resource_config->alg = alg;
+      if (init_resource_cache(p_config, p_config->oidc_resource_config) != G_OK) {
+        y_log_message(Y_LOG_LEVEL_ERROR, "protocol_init - oidc - Error init_resource_cache for oidc_resource_config");
+        j_return = json_pack("{si}", "result", G_ERROR);
+        break;
+      }
       if (r_jwk_init(&jwk) != RHN_OK) {
         y_log_message(Y_LOG_LEVEL_ERROR, "oidc protocol_init - oidc - Error r_jwk_init");
         j_return = json_pack("{si}", "result", G_ERROR);
@@ -12082,9 +13644,17 @@ json_t * plugin_module_init(struct config_plugin * config, const char * name, js
         p_config->introspect_revoke_resource_config->realm = NULL;
         p_config->introspect_revoke_resource_config->accept_access_token = 1;
         p_config->introspect_revoke_resource_config->accept_client_token = 1;
+        p_config->introspect_revoke_resource_config->cache = NULL;
+        p_config->introspect_revoke_resource_config->callback_is_revoked = p_config->oidc_resource_config->callback_is_revoked;
+        p_config->introspect_revoke_resource_config->callback_is_revoked_cls = p_config->oidc_resource_config->callback_is_revoked_cls;
         p_config->introspect_revoke_resource_config->jwt = r_jwt_copy(p_config->oidc_resource_config->jwt);
         p_config->introspect_revoke_resource_config->jwk_verify_default = r_jwk_copy(p_config->oidc_resource_config->jwk_verify_default);
         p_config->introspect_revoke_resource_config->alg = alg;
+        if (init_resource_cache(p_config, p_config->introspect_revoke_resource_config) != G_OK) {
+          y_log_message(Y_LOG_LEVEL_ERROR, "protocol_init - oidc - Error init_resource_cache for introspect_revoke_resource_config");
+          j_return = json_pack("{si}", "result", G_ERROR);
+          break;
+        }
         if (
           config->glewlwyd_callback_add_plugin_endpoint(config, "POST", name, "introspect/", GLEWLWYD_CALLBACK_PRIORITY_AUTHENTICATION, &callback_check_intropect_revoke, (void*)*cls) != G_OK ||
           config->glewlwyd_callback_add_plugin_endpoint(config, "POST", name, "introspect/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_introspection, (void*)*cls) != G_OK ||
@@ -12095,6 +13665,14 @@ json_t * plugin_module_init(struct config_plugin * config, const char * name, js
           j_return = json_pack("{si}", "result", G_ERROR);
           break;
         }
+        if (p_config->introspection_batch_max_tokens && (
+          config->glewlwyd_callback_add_plugin_endpoint(config, "POST", name, "introspect/batch/", GLEWLWYD_CALLBACK_PRIORITY_AUTHENTICATION, &callback_check_intropect_revoke, (void*)*cls) != G_OK ||
+          config->glewlwyd_callback_add_plugin_endpoint(config, "POST", name, "introspect/batch/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_introspection_batch, (void*)*cls) != G_OK
+          )) {
+          y_log_message(Y_LOG_LEVEL_ERROR, "protocol_init - oidc - Error adding introspect batch endpoints");
+          j_return = json_pack("{si}", "result", G_ERROR);
+          break;
+        }
       }
 
       if (json_object_get(p_config->j_params, "register-client-allowed") == json_true()) {
@@ -12115,9 +13693,17 @@ json_t * plugin_module_init(struct config_plugin * config, const char * name, js
         p_config->client_register_resource_config->realm = NULL;
         p_config->client_register_resource_config->accept_access_token = 1;
         p_config->client_register_resource_config->accept_client_token = 1;
+        p_config->client_register_resource_config->cache = NULL;
+        p_config->client_register_resource_config->callback_is_revoked = p_config->oidc_resource_config->callback_is_revoked;
+        p_config->client_register_resource_config->callback_is_revoked_cls = p_config->oidc_resource_config->callback_is_revoked_cls;
         p_config->client_register_resource_config->jwt = r_jwt_copy(p_config->oidc_resource_config->jwt);
         p_config->client_register_resource_config->jwk_verify_default = r_jwk_copy(p_config->oidc_resource_config->jwk_verify_default);
         p_config->client_register_resource_config->alg = alg;
+        if (init_resource_cache(p_config, p_config->client_register_resource_config) != G_OK) {
+          y_log_message(Y_LOG_LEVEL_ERROR, "protocol_init - oidc - Error init_resource_cache for client_register_resource_config");
+          j_return = json_pack("{si}", "result", G_ERROR);
+          break;
+        }
         if (
           config->glewlwyd_callback_add_plugin_endpoint(config, "POST", name, "register/", GLEWLWYD_CALLBACK_PRIORITY_AUTHENTICATION, &callback_check_registration, (void*)*cls) != G_OK ||
           config->glewlwyd_callback_add_plugin_endpoint(config, "POST", name, "register/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_client_registration, (void*)*cls) != G_OK
@@ -12198,6 +13784,14 @@ json_t * plugin_module_init(struct config_plugin * config, const char * name, js
             j_return = json_pack("{si}", "result", G_ERROR);
             break;
           }
+          if (p_config->introspection_batch_max_tokens && (
+            config->glewlwyd_callback_add_plugin_endpoint(config, "POST", name, "mtls/introspect/batch/", GLEWLWYD_CALLBACK_PRIORITY_AUTHENTICATION, &callback_check_intropect_revoke, (void*)*cls) != G_OK ||
+            config->glewlwyd_callback_add_plugin_endpoint(config, "POST", name, "mtls/introspect/batch/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_introspection_batch, (void*)*cls) != G_OK
+            )) {
+            y_log_message(Y_LOG_LEVEL_ERROR, "protocol_init - oidc - Error adding mtls introspect batch endpoints");
+            j_return = json_pack("{si}", "result", G_ERROR);
+            break;
+          }
         }
         if (json_object_get(p_config->j_params, "oauth-par-allowed") == json_true()) {
           if (config->glewlwyd_callback_add_plugin_endpoint(config, "POST", name, "mtls/par/", GLEWLWYD_CALLBACK_PRIORITY_APPLICATION, &callback_pushed_authorization_request, (void*)*cls) != G_OK) {
@@ -12247,6 +13841,7 @@ json_t * plugin_module_init(struct config_plugin * config, const char * name, js
       config->glewlwyd_plugin_callback_metrics_add_metric(config, GLWD_METRICS_OIDC_INVALID_DEVICE_CODE, "Total number of invalid device code");
       config->glewlwyd_plugin_callback_metrics_add_metric(config, GLWD_METRICS_OIDC_INVALID_REFRESH_TOKEN, "Total number of invalid refresh token");
       config->glewlwyd_plugin_callback_metrics_add_metric(config, GLWD_METRICS_OIDC_INVALID_ACCESS_TOKEN, "Total number of invalid access token");
+      config->glewlwyd_plugin_callback_metrics_add_metric(config, GLWD_METRICS_OIDC_ACCESS_TOKEN_CACHE, "Total number of access token verified cache lookups");
       config->glewlwyd_plugin_callback_metrics_increment_counter(config, GLWD_METRICS_OIDC_CODE, 0, "plugin", name, NULL);
       config->glewlwyd_plugin_callback_metrics_increment_counter(config, GLWD_METRICS_OIDC_ID_TOKEN, 0, "plugin", name, NULL);
       config->glewlwyd_plugin_callback_metrics_increment_counter(config, GLWD_METRICS_OIDC_REFRESH_TOKEN, 0, "plugin", name, NULL);
@@ -12283,6 +13878,11 @@ json_t * plugin_module_init(struct config_plugin * config, const char * name, js
       if (json_object_get(p_config->j_params, "introspection-revocation-allowed") == json_true()) {
         config->glewlwyd_plugin_callback_metrics_increment_counter(config, GLWD_METRICS_OIDC_INVALID_ACCESS_TOKEN, 0, "plugin", name, NULL);
       }
+      if (json_integer_value(json_object_get(p_config->j_params, "reaper-interval")) > 0 && start_reaper(p_config) != G_OK) {
+        y_log_message(Y_LOG_LEVEL_ERROR, "protocol_init - oidc - Error start_reaper");
+        j_return = json_pack("{si}", "result", G_ERROR);
+        break;
+      }
     } while (0);
     json_decref(j_result);
     r_jwk_free(jwk_pub);
@@ -12296,6 +13896,7 @@ json_t * plugin_module_init(struct config_plugin * config, const char * name, js
     } else {
       if (p_config != NULL) {
         if (p_config->introspect_revoke_resource_config != NULL) {
+          oidc_resource_cache_close(p_config->introspect_revoke_resource_config);
           o_free(p_config->introspect_revoke_resource_config->oauth_scope);
           o_free(p_config->introspect_revoke_resource_config->realm);
           r_jwt_free(p_config->introspect_revoke_resource_config->jwt);
@@ -12303,6 +13904,7 @@ json_t * plugin_module_init(struct config_plugin * config, const char * name, js
           o_free(p_config->introspect_revoke_resource_config);
         }
         if (p_config->client_register_resource_config != NULL) {
+          oidc_resource_cache_close(p_config->client_register_resource_config);
           o_free(p_config->client_register_resource_config->oauth_scope);
           o_free(p_config->client_register_resource_config->realm);
           r_jwt_free(p_config->client_register_resource_config->jwt);
@@ -12310,16 +13912,20 @@ json_t * plugin_module_init(struct config_plugin * config, const char * name, js
           o_free(p_config->client_register_resource_config);
         }
         if (p_config->oidc_resource_config != NULL) {
+          oidc_resource_cache_close(p_config->oidc_resource_config);
           o_free(p_config->oidc_resource_config->oauth_scope);
           o_free(p_config->oidc_resource_config->realm);
           r_jwt_free(p_config->oidc_resource_config->jwt);
           r_jwk_free(p_config->oidc_resource_config->jwk_verify_default);
           o_free(p_config->oidc_resource_config);
         }
+        sign_keys_close(p_config);
         r_jwt_free(p_config->jwt_sign);
         r_jwk_free(p_config->jwk_sign_default);
         json_decref(p_config->j_params);
         pthread_mutex_destroy(&p_config->insert_lock);
+        jwks_cache_close(p_config);
+        revoked_jti_close(p_config);
         o_free(p_config->discovery_str);
         o_free(p_config->jwks_str);
         o_free(p_config->check_session_iframe);
@@ -12338,6 +13944,9 @@ json_t * plugin_module_init(struct config_plugin * config, const char * name, js
 int plugin_module_close(struct config_plugin * config, const char * name, void * cls) {
   if (cls != NULL) {
     y_log_message(Y_LOG_LEVEL_INFO, "Close plugin Glewlwyd OpenID Connect '%s'", name);
+    if (json_integer_value(json_object_get(((struct _oidc_config *)cls)->j_params, "reaper-interval")) > 0) {
+      config->glewlwyd_plugin_callback_reaper_stop(config, name);
+    }
     config->glewlwyd_callback_remove_plugin_endpoint(config, "GET", name, "auth/");
     config->glewlwyd_callback_remove_plugin_endpoint(config, "POST", name, "auth/");
     config->glewlwyd_callback_remove_plugin_endpoint(config, "POST", name, "token/");
@@ -12355,7 +13964,11 @@ int plugin_module_close(struct config_plugin * config, const char * name, void *
     }
     if (((struct _oidc_config *)cls)->introspect_revoke_resource_config != NULL) {
       config->glewlwyd_callback_remove_plugin_endpoint(config, "POST", name, "introspect/");
+      if (((struct _oidc_config *)cls)->introspection_batch_max_tokens) {
+        config->glewlwyd_callback_remove_plugin_endpoint(config, "POST", name, "introspect/batch/");
+      }
       config->glewlwyd_callback_remove_plugin_endpoint(config, "POST", name, "revoke/");
+      oidc_resource_cache_close(((struct _oidc_config *)cls)->introspect_revoke_resource_config);
       o_free(((struct _oidc_config *)cls)->introspect_revoke_resource_config->oauth_scope);
       o_free(((struct _oidc_config *)cls)->introspect_revoke_resource_config->realm);
       r_jwt_free(((struct _oidc_config *)cls)->introspect_revoke_resource_config->jwt);
@@ -12364,6 +13977,7 @@ int plugin_module_close(struct config_plugin * config, const char * name, void *
     }
     if (((struct _oidc_config *)cls)->client_register_resource_config != NULL) {
       config->glewlwyd_callback_remove_plugin_endpoint(config, "POST", name, "register/");
+      oidc_resource_cache_close(((struct _oidc_config *)cls)->client_register_resource_config);
       o_free(((struct _oidc_config *)cls)->client_register_resource_config->oauth_scope);
       o_free(((struct _oidc_config *)cls)->client_register_resource_config->realm);
       r_jwt_free(((struct _oidc_config *)cls)->client_register_resource_config->jwt);
@@ -12377,6 +13991,7 @@ int plugin_module_close(struct config_plugin * config, const char * name, void *
       }
     }
     if (((struct _oidc_config *)cls)->oidc_resource_config != NULL) {
+      oidc_resource_cache_close(((struct _oidc_config *)cls)->oidc_resource_config);
       o_free(((struct _oidc_config *)cls)->oidc_resource_config->oauth_scope);
       o_free(((struct _oidc_config *)cls)->oidc_resource_config->realm);
       r_jwt_free(((struct _oidc_config *)cls)->oidc_resource_config->jwt);
@@ -12391,6 +14006,9 @@ int plugin_module_close(struct config_plugin * config, const char * name, void *
       config->glewlwyd_callback_remove_plugin_endpoint(config, "POST", name, "mtls/token/");
       if (json_object_get(((struct _oidc_config *)cls)->j_params, "introspection-revocation-allowed") == json_true()) {
         config->glewlwyd_callback_remove_plugin_endpoint(config, "POST", name, "mtls/introspect/");
+        if (((struct _oidc_config *)cls)->introspection_batch_max_tokens) {
+          config->glewlwyd_callback_remove_plugin_endpoint(config, "POST", name, "mtls/introspect/batch/");
+        }
         config->glewlwyd_callback_remove_plugin_endpoint(config, "POST", name, "mtls/revoke/");
       }
       if (json_object_get(((struct _oidc_config *)cls)->j_params, "auth-type-device-enabled") == json_true()) {
@@ -12406,10 +14024,13 @@ int plugin_module_close(struct config_plugin * config, const char * name, void *
     if (json_object_get(((struct _oidc_config *)cls)->j_params, "oauth-par-allowed") == json_true()) {
       config->glewlwyd_callback_remove_plugin_endpoint(config, "POST", name, "par/");
     }
+    sign_keys_close((struct _oidc_config *)cls);
     r_jwt_free(((struct _oidc_config *)cls)->jwt_sign);
     r_jwk_free(((struct _oidc_config *)cls)->jwk_sign_default);
     json_decref(((struct _oidc_config *)cls)->j_params);
     pthread_mutex_destroy(&((struct _oidc_config *)cls)->insert_lock);
+    jwks_cache_close((struct _oidc_config *)cls);
+    revoked_jti_close((struct _oidc_config *)cls);
     o_free(((struct _oidc_config *)cls)->discovery_str);
     o_free(((struct _oidc_config *)cls)->jwks_str);
     o_free(((struct _oidc_config *)cls)->check_session_iframe);
@@ -192,7 +192,7 @@ static json_t * register_generate_email_verification_code(struct _register_confi
               if ((token_hash = config->glewlwyd_config->glewlwyd_callback_generate_hash(config->glewlwyd_config, token)) != NULL) {
                 if ((tmp_body = str_replace(get_template_property(config->j_parameters, lang, "body-pattern"), "{TOKEN}", token)) != NULL) {
                   if ((body = str_replace(tmp_body, "{CODE}", code)) != NULL) {
-                    if (ulfius_send_smtp_rich_email(json_string_value(json_object_get(config->j_parameters, "host")),
+                    if (config->glewlwyd_config->glewlwyd_plugin_callback_send_email(config->glewlwyd_config, json_string_value(json_object_get(config->j_parameters, "host")),
                                                    json_integer_value(json_object_get(config->j_parameters, "port")),
                                                    json_object_get(config->j_parameters, "use-tls")==json_true()?1:0,
                                                    json_object_get(config->j_parameters, "verify-certificate")==json_false()?0:1,
@@ -200,11 +200,9 @@ static json_t * register_generate_email_verification_code(struct _register_confi
                                                    json_string_length(json_object_get(config->j_parameters, "password"))?json_string_value(json_object_get(config->j_parameters, "password")):NULL,
                                                    json_string_value(json_object_get(config->j_parameters, "from")),
                                                    email,
-                                                   NULL,
-                                                   NULL,
                                                    json_string_length(json_object_get(config->j_parameters, "content-type"))?json_string_value(json_object_get(config->j_parameters, "content-type")):"text/plain; charset=utf-8",
                                                    get_template_property(config->j_parameters, lang, "subject"),
-                                                   body) == U_OK) {
+                                                   body) == G_OK) {
                       y_log_message(Y_LOG_LEVEL_WARNING, "Security - Register new user - code sent to email %s at IP Address %s", email, ip_source);
                       if (config->glewlwyd_config->glewlwyd_config->conn->type==HOEL_DB_TYPE_MARIADB) {
                         expires_at_clause = msprintf("FROM_UNIXTIME(%u)", (now + (unsigned int)json_integer_value(json_object_get(config->j_parameters, "verification-code-duration"))));
@@ -246,7 +244,7 @@ static json_t * register_generate_email_verification_code(struct _register_confi
                         j_return = json_pack("{si}", "result", G_ERROR_DB);
                       }
                     } else {
-                      y_log_message(Y_LOG_LEVEL_ERROR, "register_generate_email_verification_code - Error ulfius_send_smtp_rich_email");
+                      y_log_message(Y_LOG_LEVEL_ERROR, "register_generate_email_verification_code - Error sending e-mail");
                       j_return = json_pack("{si}", "result", G_ERROR_MEMORY);
                     }
                     o_free(body);
@@ -902,7 +900,7 @@ static int register_update_email_trigger(struct _register_config * config, const
     if (rand_string(token, GLEWLWYD_TOKEN_LENGTH) != NULL) {
       if ((token_hash = config->glewlwyd_config->glewlwyd_callback_generate_hash(config->glewlwyd_config, token)) != NULL) {
         if ((body = str_replace(get_template_email_update_property(config->j_parameters, lang, "body-pattern"), "{TOKEN}", token)) != NULL) {
-          if (ulfius_send_smtp_rich_email(json_string_value(json_object_get(config->j_parameters, "host")),
+          if (config->glewlwyd_config->glewlwyd_plugin_callback_send_email(config->glewlwyd_config, json_string_value(json_object_get(config->j_parameters, "host")),
                                          json_integer_value(json_object_get(config->j_parameters, "port")),
                                          json_object_get(config->j_parameters, "use-tls")==json_true()?1:0,
                                          json_object_get(config->j_parameters, "verify-certificate")==json_false()?0:1,
@@ -910,11 +908,9 @@ static int register_update_email_trigger(struct _register_config * config, const
                                          json_string_length(json_object_get(config->j_parameters, "password"))?json_string_value(json_object_get(config->j_parameters, "password")):NULL,
                                          json_string_value(json_object_get(config->j_parameters, "update-email-from")),
                                          email,
-                                         NULL,
-                                         NULL,
                                          json_string_length(json_object_get(config->j_parameters, "update-email-content-type"))?json_string_value(json_object_get(config->j_parameters, "update-email-content-type")):"text/plain; charset=utf-8",
                                          get_template_email_update_property(config->j_parameters, lang, "subject"),
-                                         body) == U_OK) {
+                                         body) == G_OK) {
             y_log_message(Y_LOG_LEVEL_WARNING, "Security - Update e-mail - token sent to email %s at IP Address %s", email, ip_source);
             if (config->glewlwyd_config->glewlwyd_config->conn->type==HOEL_DB_TYPE_MARIADB) {
               expires_at_clause = msprintf("FROM_UNIXTIME(%u)", (now + (unsigned int)json_integer_value(json_object_get(config->j_parameters, "update-email-token-duration"))));
@@ -952,7 +948,7 @@ static int register_update_email_trigger(struct _register_config * config, const
               ret = G_ERROR_DB;
             }
           } else {
-            y_log_message(Y_LOG_LEVEL_ERROR, "register_update_email_trigger - Error ulfius_send_smtp_rich_email");
+            y_log_message(Y_LOG_LEVEL_ERROR, "register_update_email_trigger - Error sending e-mail");
             ret = G_ERROR;
           }
         } else {
@@ -1209,7 +1205,7 @@ static int register_reset_credentials_trigger(struct _register_config * config,
       if (rand_string(token, GLEWLWYD_TOKEN_LENGTH) != NULL) {
         if ((token_hash = config->glewlwyd_config->glewlwyd_callback_generate_hash(config->glewlwyd_config, token)) != NULL) {
           if ((body = str_replace(get_template_reset_credentials_property(config->j_parameters, lang, "body-pattern"), "{TOKEN}", token)) != NULL) {
-            if (ulfius_send_smtp_rich_email(json_string_value(json_object_get(config->j_parameters, "host")),
+            if (config->glewlwyd_config->glewlwyd_plugin_callback_send_email(config->glewlwyd_config, json_string_value(json_object_get(config->j_parameters, "host")),
                                            json_integer_value(json_object_get(config->j_parameters, "port")),
                                            json_object_get(config->j_parameters, "use-tls")==json_true()?1:0,
                                            json_object_get(config->j_parameters, "verify-certificate")==json_false()?0:1,
@@ -1217,11 +1213,9 @@ static int register_reset_credentials_trigger(struct _register_config * config,
                                            json_string_length(json_object_get(config->j_parameters, "password"))?json_string_value(json_object_get(config->j_parameters, "password")):NULL,
                                            json_string_value(json_object_get(config->j_parameters, "reset-credentials-from")),
                                            email,
-                                           NULL,
-                                           NULL,
                                            json_string_length(json_object_get(config->j_parameters, "reset-credentials-content-type"))?json_string_value(json_object_get(config->j_parameters, "reset-credentials-content-type")):"text/plain; charset=utf-8",
                                            get_template_reset_credentials_property(config->j_parameters, lang, "subject"),
-                                           body) == U_OK) {
+                                           body) == G_OK) {
               y_log_message(Y_LOG_LEVEL_WARNING, "Security - Reset credentials - token sent to email %s at IP Address %s", email, ip_source);
               if (config->glewlwyd_config->glewlwyd_config->conn->type==HOEL_DB_TYPE_MARIADB) {
                 expires_at_clause = msprintf("FROM_UNIXTIME(%u)", (now + (unsigned int)json_integer_value(json_object_get(config->j_parameters, "reset-credentials-token-duration"))));
@@ -1253,7 +1247,7 @@ static int register_reset_credentials_trigger(struct _register_config * config,
                 ret = G_ERROR_DB;
               }
             } else {
-              y_log_message(Y_LOG_LEVEL_ERROR, "register_reset_credentials_trigger - Error ulfius_send_smtp_rich_email");
+              y_log_message(Y_LOG_LEVEL_ERROR, "register_reset_credentials_trigger - Error sending e-mail");
               ret = G_ERROR;
             }
           } else {
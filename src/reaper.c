@@ -0,0 +1,324 @@
+/**
+ *
+ * Glewlwyd SSO Server
+ *
+ * Authentiation server
+ * Users are authenticated via various backend available: database, ldap
+ * Using various authentication methods available: password, OTP, send code, etc.
+ *
+ * Expired data reaper functions definitions
+ *
+ * Copyright 2016-2021 Nicolas Mora <mail@babelouest.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU GENERAL PUBLIC LICENSE
+ * License as published by the Free Software Foundation;
+ * version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU GENERAL PUBLIC LICENSE for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <time.h>
+
+#include "glewlwyd.h"
+
+#define GLEWLWYD_REAPER_SESSION_NAME "session"
+
+static void free_glwd_reaper(struct _glwd_reaper * reaper) {
+  pthread_cond_destroy(&reaper->cond);
+  pthread_mutex_destroy(&reaper->lock);
+  json_decref(reaper->j_tasks);
+  o_free(reaper->name);
+  o_free(reaper);
+}
+
+/**
+ * Waits delay milliseconds or until the reaper is stopped
+ * Returns 1 if the reaper is stopped
+ */
+static int glewlwyd_reaper_wait(struct _glwd_reaper * reaper, unsigned int delay) {
+  struct timespec abstime;
+  int stop = 1;
+
+  clock_gettime(CLOCK_REALTIME, &abstime);
+  abstime.tv_sec += delay / 1000;
+  abstime.tv_nsec += (long)(delay % 1000) * 1000000;
+  if (abstime.tv_nsec >= 1000000000) {
+    abstime.tv_sec++;
+    abstime.tv_nsec -= 1000000000;
+  }
+  if (!pthread_mutex_lock(&reaper->lock)) {
+    if (!reaper->stop && delay) {
+      pthread_cond_timedwait(&reaper->cond, &reaper->lock, &abstime);
+    }
+    stop = reaper->stop;
+    pthread_mutex_unlock(&reaper->lock);
+  }
+  return stop;
+}
+
+/**
+ * Deletes the rows of the task where the date column is older than now - age
+ * The rows are deleted by batches of batch_size rows, so the tables are never locked for long
+ * j_task format: {"table": string, "id": string, "date": string, "age": integer, "where": object (optional)}
+ */
+static size_t glewlwyd_reaper_purge(struct _glwd_reaper * reaper, json_t * j_task, time_t now, int * stop) {
+  struct _h_connection * conn;
+  json_t * j_query, * j_result = NULL, * j_element = NULL;
+  const char * table = json_string_value(json_object_get(j_task, "table")),
+             * id = json_string_value(json_object_get(j_task, "id")),
+             * date = json_string_value(json_object_get(j_task, "date"));
+  char * date_clause, * id_clause;
+  long long int limit = (long long int)now - (long long int)json_integer_value(json_object_get(j_task, "age"));
+  size_t deleted = 0, index = 0, nb_rows;
+  int res;
+
+  while (!(*stop)) {
+    nb_rows = 0;
+    conn = glewlwyd_db_pool_acquire(reaper->config);
+    if (conn->type==HOEL_DB_TYPE_MARIADB) {
+      date_clause = msprintf("< FROM_UNIXTIME(%lld)", limit);
+    } else if (conn->type==HOEL_DB_TYPE_PGSQL) {
+      date_clause = msprintf("< TO_TIMESTAMP(%lld)", limit);
+    } else { // HOEL_DB_TYPE_SQLITE
+      date_clause = msprintf("< %lld", limit);
+    }
+    j_query = json_pack("{sss[s]s{s{ssss}}si}",
+                        "table",
+                        table,
+                        "columns",
+                          id,
+                        "where",
+                          date,
+                            "operator",
+                            "raw",
+                            "value",
+                            date_clause,
+                        "limit",
+                        reaper->batch_size);
+    o_free(date_clause);
+    if (json_is_object(json_object_get(j_task, "where"))) {
+      json_object_update(json_object_get(j_query, "where"), json_object_get(j_task, "where"));
+    }
+    res = h_select(conn, j_query, &j_result, NULL);
+    json_decref(j_query);
+    if (res == H_OK) {
+      if ((nb_rows = json_array_size(j_result))) {
+        id_clause = o_strdup("IN (");
+        json_array_foreach(j_result, index, j_element) {
+          id_clause = mstrcatf(id_clause, "%s%" JSON_INTEGER_FORMAT, index?",":"", json_integer_value(json_object_get(j_element, id)));
+        }
+        id_clause = mstrcatf(id_clause, ")");
+        j_query = json_pack("{sss{s{ssss}}}",
+                            "table",
+                            table,
+                            "where",
+                              id,
+                                "operator",
+                                "raw",
+                                "value",
+                                id_clause);
+        o_free(id_clause);
+        res = h_delete(conn, j_query, NULL);
+        json_decref(j_query);
+        if (res == H_OK) {
+          deleted += nb_rows;
+          glewlwyd_metrics_increment_counter_va(reaper->config, GLWD_METRICS_REAPER_DELETED, nb_rows, "reaper", reaper->name, "table", table, NULL);
+        } else {
+          y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_reaper_purge - Error executing j_query (2) on table %s", table);
+          nb_rows = 0;
+        }
+      }
+      json_decref(j_result);
+      j_result = NULL;
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_reaper_purge - Error executing j_query (1) on table %s", table);
+    }
+    glewlwyd_db_pool_release(reaper->config, conn);
+    if (nb_rows < reaper->batch_size) {
+      break;
+    }
+    *stop = glewlwyd_reaper_wait(reaper, reaper->batch_delay);
+  }
+  return deleted;
+}
+
+static void * glewlwyd_reaper_run(void * args) {
+  struct _glwd_reaper * reaper = (struct _glwd_reaper *)args;
+  json_t * j_task = NULL;
+  size_t index = 0, deleted;
+  int stop = 0;
+
+  while (!stop) {
+    json_array_foreach(reaper->j_tasks, index, j_task) {
+      if ((deleted = glewlwyd_reaper_purge(reaper, j_task, time(NULL), &stop))) {
+        y_log_message(Y_LOG_LEVEL_DEBUG, "Reaper %s - %zu expired rows deleted from %s", reaper->name, deleted, json_string_value(json_object_get(j_task, "table")));
+      }
+      if (stop) {
+        break;
+      }
+    }
+    glewlwyd_metrics_increment_counter_va(reaper->config, GLWD_METRICS_REAPER_RUN, 1, "reaper", reaper->name, NULL);
+    if (!stop) {
+      stop = glewlwyd_reaper_wait(reaper, reaper->interval*1000);
+    }
+  }
+  return NULL;
+}
+
+int glewlwyd_reaper_init(struct config_elements * config) {
+  json_t * j_tasks;
+  int ret = G_OK;
+
+  glewlwyd_metrics_add_metric(config, GLWD_METRICS_REAPER_RUN, "Total number of expired data cleanup runs");
+  glewlwyd_metrics_add_metric(config, GLWD_METRICS_REAPER_DELETED, "Total number of expired rows deleted");
+  config->reaper.first = NULL;
+  if (!pthread_mutex_init(&config->reaper.lock, NULL)) {
+    config->reaper.initialized = 1;
+    if (config->reaper.interval) {
+      j_tasks = json_pack("[{sssssssI}{sssssssI}]",
+                            "table", GLEWLWYD_TABLE_USER_SESSION,
+                            "id", "gus_id",
+                            "date", "gus_expiration",
+                            "age", (json_int_t)config->reaper.session_retention,
+                            "table", GLEWLWYD_TABLE_USER_SESSION_SCHEME,
+                            "id", "guss_id",
+                            "date", "guss_expiration",
+                            "age", (json_int_t)config->reaper.session_retention);
+      ret = glewlwyd_reaper_start(config, GLEWLWYD_REAPER_SESSION_NAME, j_tasks, config->reaper.interval, config->reaper.batch_size, config->reaper.batch_delay);
+      json_decref(j_tasks);
+    }
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_reaper_init - Error initializing reaper lock");
+    ret = G_ERROR;
+  }
+  return ret;
+}
+
+void glewlwyd_reaper_close(struct config_elements * config) {
+  if (config->reaper.initialized) {
+    while (config->reaper.first != NULL) {
+      glewlwyd_reaper_stop(config, config->reaper.first->name);
+    }
+    pthread_mutex_destroy(&config->reaper.lock);
+    config->reaper.initialized = 0;
+  }
+}
+
+/**
+ * Starts a reaper thread that deletes the expired rows of j_tasks every interval seconds
+ */
+int glewlwyd_reaper_start(struct config_elements * config, const char * name, json_t * j_tasks, unsigned int interval, unsigned int batch_size, unsigned int batch_delay) {
+  struct _glwd_reaper * reaper, * cur;
+  int ret;
+
+  if (!config->reaper.initialized || !o_strlen(name) || !json_is_array(j_tasks) || !interval || !batch_size) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_reaper_start - Error input parameters");
+    ret = G_ERROR_PARAM;
+  } else if ((reaper = o_malloc(sizeof(struct _glwd_reaper))) != NULL) {
+    reaper->name = o_strdup(name);
+    reaper->config = config;
+    reaper->j_tasks = json_deep_copy(j_tasks);
+    reaper->interval = interval;
+    reaper->batch_size = batch_size;
+    reaper->batch_delay = batch_delay;
+    reaper->stop = 0;
+    reaper->next = NULL;
+    if (pthread_mutex_init(&reaper->lock, NULL)) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_reaper_start - Error initializing reaper lock");
+      json_decref(reaper->j_tasks);
+      o_free(reaper->name);
+      o_free(reaper);
+      ret = G_ERROR;
+    } else if (pthread_cond_init(&reaper->cond, NULL)) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_reaper_start - Error initializing reaper cond");
+      pthread_mutex_destroy(&reaper->lock);
+      json_decref(reaper->j_tasks);
+      o_free(reaper->name);
+      o_free(reaper);
+      ret = G_ERROR;
+    } else if (!pthread_mutex_lock(&config->reaper.lock)) {
+      for (cur = config->reaper.first; cur != NULL && 0 != o_strcmp(cur->name, name); cur = cur->next);
+      if (cur != NULL) {
+        y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_reaper_start - Error reaper %s already started", name);
+        free_glwd_reaper(reaper);
+        ret = G_ERROR_PARAM;
+      } else if (pthread_create(&reaper->thread, NULL, glewlwyd_reaper_run, (void *)reaper)) {
+        y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_reaper_start - Error pthread_create");
+        free_glwd_reaper(reaper);
+        ret = G_ERROR;
+      } else {
+        reaper->next = config->reaper.first;
+        config->reaper.first = reaper;
+        glewlwyd_metrics_increment_counter_va(config, GLWD_METRICS_REAPER_RUN, 0, "reaper", name, NULL);
+        y_log_message(Y_LOG_LEVEL_INFO, "Reaper %s started, interval %u seconds", name, interval);
+        ret = G_OK;
+      }
+      pthread_mutex_unlock(&config->reaper.lock);
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_reaper_start - Error lock");
+      free_glwd_reaper(reaper);
+      ret = G_ERROR;
+    }
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_reaper_start - Error allocating resources for reaper");
+    ret = G_ERROR_MEMORY;
+  }
+  return ret;
+}
+
+/**
+ * Stops the reaper thread, a batch in progress is completed before the thread ends
+ */
+int glewlwyd_reaper_stop(struct config_elements * config, const char * name) {
+  struct _glwd_reaper ** p_reaper, * reaper = NULL;
+  int ret;
+
+  if (config->reaper.initialized && !pthread_mutex_lock(&config->reaper.lock)) {
+    for (p_reaper = &config->reaper.first; *p_reaper != NULL; p_reaper = &(*p_reaper)->next) {
+      if (0 == o_strcmp((*p_reaper)->name, name)) {
+        reaper = *p_reaper;
+        *p_reaper = reaper->next;
+        break;
+      }
+    }
+    pthread_mutex_unlock(&config->reaper.lock);
+    if (reaper != NULL) {
+      if (!pthread_mutex_lock(&reaper->lock)) {
+        reaper->stop = 1;
+        pthread_cond_signal(&reaper->cond);
+        pthread_mutex_unlock(&reaper->lock);
+      }
+      pthread_join(reaper->thread, NULL);
+      y_log_message(Y_LOG_LEVEL_INFO, "Reaper %s stopped", name);
+      free_glwd_reaper(reaper);
+      ret = G_OK;
+    } else {
+      ret = G_ERROR_NOT_FOUND;
+    }
+  } else {
+    ret = G_ERROR;
+  }
+  return ret;
+}
+
+int glewlwyd_plugin_callback_reaper_start(struct config_plugin * config, const char * name, json_t * j_tasks, unsigned int interval, unsigned int batch_size, unsigned int batch_delay) {
+  char * reaper_name = msprintf("plugin/%s", name);
+  int ret = glewlwyd_reaper_start(config->glewlwyd_config, reaper_name, j_tasks, interval, batch_size, batch_delay);
+  o_free(reaper_name);
+  return ret;
+}
+
+int glewlwyd_plugin_callback_reaper_stop(struct config_plugin * config, const char * name) {
+  char * reaper_name = msprintf("plugin/%s", name);
+  int ret = glewlwyd_reaper_stop(config->glewlwyd_config, reaper_name);
+  o_free(reaper_name);
+  return ret;
+}
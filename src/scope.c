@@ -26,95 +26,229 @@
  */
 #include "glewlwyd.h"
 
-static json_t * get_current_session(struct config_elements * config, const char * session_hash) {
-  json_t * j_query, * j_result = NULL, * j_return;
+/**
+ * Loads the authentication state of the current session of session_uid in one query:
+ * the current user of the session, and the last login, expiration and use counter of each scheme authenticated in this session
+ * Format: {"result": G_OK, "session_hash": string, "session": {"gus_id", "username"},
+ *          "scheme": {"<guasmi_id, 0 for password>": [{"last_login", "expiration", "use_counter"}]}}
+ * The rows of each scheme are ordered by last login, the newest first
+ * The state can be used for all the scope lists checked during the same request
+ */
+json_t * get_session_auth_state(struct config_elements * config, const char * session_uid) {
+  struct _h_connection * conn;
+  json_t * j_result = NULL, * j_return, * j_element, * j_scheme_list;
+  char * session_hash, * session_hash_escaped, * str_query, * key;
+  size_t index;
   int res;
-  char * expire_clause;
 
-  if (config->conn->type==HOEL_DB_TYPE_MARIADB) {
-    expire_clause = o_strdup("> NOW()");
-  } else if (config->conn->type==HOEL_DB_TYPE_PGSQL) {
-    expire_clause = o_strdup("> NOW()");
-  } else { // HOEL_DB_TYPE_SQLITE
-    expire_clause = o_strdup("> (strftime('%s','now'))");
+  if (o_strlen(session_uid)) {
+    if ((session_hash = generate_hash(config->hash_algorithm, session_uid)) != NULL) {
+      conn = glewlwyd_db_pool_acquire(config);
+      session_hash_escaped = h_escape_string_with_quotes(conn, session_hash);
+      str_query = msprintf("SELECT " GLEWLWYD_TABLE_USER_SESSION ".gus_id AS gus_id, gus_username AS username, guss_id, guasmi_id, %s, %s, guss_use_counter AS use_counter "
+                           "FROM " GLEWLWYD_TABLE_USER_SESSION " LEFT JOIN " GLEWLWYD_TABLE_USER_SESSION_SCHEME " ON " GLEWLWYD_TABLE_USER_SESSION ".gus_id = " GLEWLWYD_TABLE_USER_SESSION_SCHEME ".gus_id AND guss_enabled=1 "
+                           "WHERE gus_session_hash=%s AND gus_enabled=1 AND gus_current=1 AND gus_expiration %s "
+                           "ORDER BY guss_last_login DESC",
+                           SWITCH_DB_TYPE(conn->type, "UNIX_TIMESTAMP(guss_last_login) AS last_login", "guss_last_login AS last_login", "EXTRACT(EPOCH FROM guss_last_login)::integer AS last_login"),
+                           SWITCH_DB_TYPE(conn->type, "UNIX_TIMESTAMP(guss_expiration) AS expiration", "guss_expiration AS expiration", "EXTRACT(EPOCH FROM guss_expiration)::integer AS expiration"),
+                           session_hash_escaped,
+                           SWITCH_DB_TYPE(conn->type, "> NOW()", "> (strftime('%s','now'))", "> NOW()"));
+      res = h_execute_query_json(conn, str_query, &j_result);
+      o_free(str_query);
+      o_free(session_hash_escaped);
+      glewlwyd_db_pool_release(config, conn);
+      if (res == H_OK) {
+        if (json_array_size(j_result)) {
+          j_return = json_pack("{sisss{sOsO}s{}}", "result", G_OK, "session_hash", session_hash, "session", "gus_id", json_object_get(json_array_get(j_result, 0), "gus_id"), "username", json_object_get(json_array_get(j_result, 0), "username"), "scheme");
+          json_array_foreach(j_result, index, j_element) {
+            if (json_integer_value(json_object_get(j_element, "guss_id"))) {
+              key = msprintf("%" JSON_INTEGER_FORMAT, json_integer_value(json_object_get(j_element, "guasmi_id")));
+              if ((j_scheme_list = json_object_get(json_object_get(j_return, "scheme"), key)) == NULL) {
+                j_scheme_list = json_array();
+                json_object_set_new(json_object_get(j_return, "scheme"), key, j_scheme_list);
+              }
+              json_array_append_new(j_scheme_list, json_pack("{sIsIsI}", "last_login", json_integer_value(json_object_get(j_element, "last_login")), "expiration", json_integer_value(json_object_get(j_element, "expiration")), "use_counter", json_integer_value(json_object_get(j_element, "use_counter"))));
+              o_free(key);
+            }
+          }
+        } else {
+          j_return = json_pack("{si}", "result", G_ERROR_NOT_FOUND);
+        }
+      } else {
+        y_log_message(Y_LOG_LEVEL_ERROR, "get_session_auth_state - Error executing str_query");
+        j_return = json_pack("{si}", "result", G_ERROR_DB);
+      }
+      json_decref(j_result);
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "get_session_auth_state - Error generate_hash");
+      j_return = json_pack("{si}", "result", G_ERROR);
+    }
+    o_free(session_hash);
+  } else {
+    j_return = json_pack("{si}", "result", G_ERROR_NOT_FOUND);
+  }
+  return j_return;
+}
+
+static json_t * get_current_user_from_session(struct config_elements * config, json_t * j_state) {
+  json_t * j_return, * j_user;
+
+  if (check_result_value(j_state, G_OK)) {
+    j_user = get_user(config, json_string_value(json_object_get(json_object_get(j_state, "session"), "username")), NULL);
+    if (check_result_value(j_user, G_OK)) {
+      j_return = json_pack("{sisO}", "result", G_OK, "user", json_object_get(j_user, "user"));
+    } else if (check_result_value(j_user, G_ERROR_NOT_FOUND)) {
+      j_return = json_pack("{si}", "result", G_ERROR_NOT_FOUND);
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "get_current_user_from_session - Error get_user");
+      j_return = json_pack("{si}", "result", G_ERROR);
+    }
+    json_decref(j_user);
+  } else if (check_result_value(j_state, G_ERROR_NOT_FOUND)) {
+    j_return = json_pack("{si}", "result", G_ERROR_NOT_FOUND);
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "get_current_user_from_session - Error get_session_auth_state");
+    j_return = json_pack("{si}", "result", G_ERROR);
   }
-  j_query = json_pack("{sss[ss]s{sssis{ssss}si}sssi}",
+  return j_return;
+}
+
+/**
+ * Loads all the scopes and their scheme groups in a new policy graph
+ * Format: {"<scope name>": {"name", "display_name", "description", "password_required", "password_max_age",
+ *          "scheme": {"<group name>": [{"scheme_type", "scheme_name", "scheme_display_name"}]}, "scheme_required": {"<group name>": integer}}}
+ * "scheme_required" is missing if the scope has no scheme group
+ */
+static json_t * get_scope_policy_db(struct config_elements * config) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
+  const char * str_query =
+    "SELECT \
+    " GLEWLWYD_TABLE_SCOPE ".gs_name AS scope_name, \
+    gsg_name AS group_name, \
+    gsg_scheme_required AS scheme_required, \
+    guasmi_module AS scheme_type, \
+    guasmi_name AS scheme_name, \
+    guasmi_display_name AS scheme_display_name \
+    FROM \
+    " GLEWLWYD_TABLE_SCOPE ", \
+    " GLEWLWYD_TABLE_SCOPE_GROUP ", \
+    " GLEWLWYD_TABLE_USER_AUTH_SCHEME_MODULE_INSTANCE ", \
+    " GLEWLWYD_TABLE_SCOPE_GROUP_AUTH_SCHEME_MODULE_INSTANCE " \
+    WHERE \
+    " GLEWLWYD_TABLE_SCOPE_GROUP_AUTH_SCHEME_MODULE_INSTANCE ".guasmi_id = " GLEWLWYD_TABLE_USER_AUTH_SCHEME_MODULE_INSTANCE ".guasmi_id AND \
+    " GLEWLWYD_TABLE_SCOPE_GROUP ".gsg_id = " GLEWLWYD_TABLE_SCOPE_GROUP_AUTH_SCHEME_MODULE_INSTANCE ".gsg_id AND \
+    " GLEWLWYD_TABLE_SCOPE ".gs_id = " GLEWLWYD_TABLE_SCOPE_GROUP ".gs_id \
+    ORDER BY \
+    " GLEWLWYD_TABLE_SCOPE_GROUP ".gsg_id, \
+    " GLEWLWYD_TABLE_USER_AUTH_SCHEME_MODULE_INSTANCE ".guasmi_name;";
+  json_t * j_query, * j_result = NULL, * j_policy = NULL, * j_element, * j_scope;
+  const char * group_name;
+  int res;
+  size_t index;
+
+  j_query = json_pack("{sss[sssss]}",
                       "table",
-                      GLEWLWYD_TABLE_USER_SESSION,
+                      GLEWLWYD_TABLE_SCOPE,
                       "columns",
-                        "gus_id",
-                        "gus_username AS username",
-                      "where",
-                        "gus_session_hash",
-                        session_hash,
-                        "gus_enabled",
-                        1,
-                        "gus_expiration",
-                          "operator",
-                          "raw",
-                          "value",
-                          expire_clause,
-                        "gus_current",
-                        1,
-                      "order_by",
-                      "gus_current DESC",
-                      "limit",
-                      1);
-  o_free(expire_clause);
-  res = h_select(config->conn, j_query, &j_result, NULL);
+                        "gs_name AS name",
+                        "gs_display_name AS display_name",
+                        "gs_description AS description",
+                        "gs_password_required",
+                        "gs_password_max_age AS password_max_age");
+  res = h_select(conn, j_query, &j_result, NULL);
   json_decref(j_query);
   if (res == H_OK) {
-    if (json_array_size(j_result) > 0) {
-      j_return = json_pack("{sisO}", "result", G_OK, "session", json_array_get(j_result, 0));
+    j_policy = json_object();
+    json_array_foreach(j_result, index, j_element) {
+      json_object_set(j_element, "password_required", json_integer_value(json_object_get(j_element, "gs_password_required"))?json_true():json_false());
+      json_object_del(j_element, "gs_password_required");
+      json_object_set_new(j_element, "scheme", json_object());
+      json_object_set(j_policy, json_string_value(json_object_get(j_element, "name")), j_element);
+    }
+    json_decref(j_result);
+    j_result = NULL;
+    if (h_execute_query_json(conn, str_query, &j_result) == H_OK) {
+      json_array_foreach(j_result, index, j_element) {
+        if ((j_scope = json_object_get(j_policy, json_string_value(json_object_get(j_element, "scope_name")))) != NULL) {
+          group_name = json_string_value(json_object_get(j_element, "group_name"));
+          if (json_object_get(j_scope, "scheme_required") == NULL) {
+            json_object_set_new(j_scope, "scheme_required", json_object());
+          }
+          if (json_object_get(json_object_get(j_scope, "scheme"), group_name) == NULL) {
+            json_object_set_new(json_object_get(j_scope, "scheme"), group_name, json_array());
+            json_object_set(json_object_get(j_scope, "scheme_required"), group_name, json_object_get(j_element, "scheme_required"));
+          }
+          json_array_append_new(json_object_get(json_object_get(j_scope, "scheme"), group_name), json_pack("{ssssss?}", "scheme_type", json_string_value(json_object_get(j_element, "scheme_type")), "scheme_name", json_string_value(json_object_get(j_element, "scheme_name")), "scheme_display_name", json_string_value(json_object_get(j_element, "scheme_display_name"))));
+        }
+      }
     } else {
-      j_return = json_pack("{si}", "result", G_ERROR_NOT_FOUND);
+      y_log_message(Y_LOG_LEVEL_ERROR, "get_scope_policy_db - Error executing str_query");
+      json_decref(j_policy);
+      j_policy = NULL;
     }
   } else {
-    y_log_message(Y_LOG_LEVEL_ERROR, "get_current_session - Error executing j_query");
-    j_return = json_pack("{si}", "result", G_ERROR_DB);
+    y_log_message(Y_LOG_LEVEL_ERROR, "get_scope_policy_db - Error executing j_query");
   }
   json_decref(j_result);
-  return j_return;
+  glewlwyd_db_pool_release(config, conn);
+  return j_policy;
 }
 
-static json_t * get_current_user_from_session(struct config_elements * config, const char * session_uid) {
-  char * session_hash;
-  json_t * j_session, * j_return, * j_user;
+/**
+ * Returns a reference to the scope policy graph, NULL on error, the caller must decref it
+ * If scope_policy_cache_max_age is 0, the graph is loaded from the database on every call
+ * Otherwise the graph is kept in memory for scope_policy_cache_max_age seconds or until an invalidation,
+ * the graph is immutable, it's replaced by a new one when it's reloaded
+ * The database is read without holding scope_policy_lock, a graph loaded while an invalidation happened isn't kept
+ */
+static json_t * get_scope_policy(struct config_elements * config) {
+  json_t * j_policy = NULL;
+  unsigned int generation;
+  time_t now;
 
-  if (session_uid != NULL && o_strlen(session_uid)) {
-    if ((session_hash = generate_hash(config->hash_algorithm, session_uid)) != NULL) {
-      j_session = get_current_session(config, session_hash);
-      if (check_result_value(j_session, G_OK)) {
-        j_user = get_user(config, json_string_value(json_object_get(json_object_get(j_session, "session"), "username")), NULL);
-        if (check_result_value(j_user, G_OK)) {
-          j_return = json_pack("{sisO}", "result", G_OK, "user", json_object_get(j_user, "user"));
-        } else if (check_result_value(j_user, G_ERROR_NOT_FOUND)) {
-          j_return = json_pack("{si}", "result", G_ERROR_NOT_FOUND);
-        } else {
-          y_log_message(Y_LOG_LEVEL_ERROR, "get_current_user_from_session - Error get_user");
-          j_return = json_pack("{si}", "result", G_ERROR);
+  if (!config->scope_policy_cache_max_age) {
+    j_policy = get_scope_policy_db(config);
+  } else if (!pthread_mutex_lock(&config->scope_policy_lock)) {
+    time(&now);
+    if (config->j_scope_policy != NULL && config->scope_policy_expires_at > now) {
+      j_policy = json_incref(config->j_scope_policy);
+    }
+    generation = config->scope_policy_generation;
+    pthread_mutex_unlock(&config->scope_policy_lock);
+    if (j_policy == NULL && (j_policy = get_scope_policy_db(config)) != NULL) {
+      if (!pthread_mutex_lock(&config->scope_policy_lock)) {
+        if (generation == config->scope_policy_generation) {
+          json_decref(config->j_scope_policy);
+          config->j_scope_policy = json_incref(j_policy);
+          config->scope_policy_expires_at = now + config->scope_policy_cache_max_age;
         }
-        json_decref(j_user);
-      } else if (check_result_value(j_session, G_ERROR_NOT_FOUND)) {
-        j_return = json_pack("{si}", "result", G_ERROR_NOT_FOUND);
-      } else {
-        y_log_message(Y_LOG_LEVEL_ERROR, "get_current_user_from_session - Error get_current_session");
-        j_return = json_pack("{si}", "result", G_ERROR);
+        pthread_mutex_unlock(&config->scope_policy_lock);
       }
-      json_decref(j_session);
-    } else {
-      y_log_message(Y_LOG_LEVEL_ERROR, "get_current_user_from_session - Error generate_hash");
-      j_return = json_pack("{si}", "result", G_ERROR);
     }
-    o_free(session_hash);
   } else {
-    j_return = json_pack("{si}", "result", G_ERROR_NOT_FOUND);
+    y_log_message(Y_LOG_LEVEL_ERROR, "get_scope_policy - Error lock");
+  }
+  return j_policy;
+}
+
+/**
+ * Removes the scope policy graph from memory, the next call to get_scope_policy will reload it
+ * Must be called after a change in the scopes or in the scheme instances used by the scopes
+ */
+void invalidate_scope_policy(struct config_elements * config) {
+  if (!pthread_mutex_lock(&config->scope_policy_lock)) {
+    json_decref(config->j_scope_policy);
+    config->j_scope_policy = NULL;
+    config->scope_policy_generation++;
+    pthread_mutex_unlock(&config->scope_policy_lock);
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "invalidate_scope_policy - Error lock");
   }
-  return j_return;
 }
 
 json_t * get_scope_list(struct config_elements * config, const char * pattern, size_t offset, size_t limit) {
-  json_t * j_query, * j_result, * j_return, * j_element, * j_scheme;
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
+  json_t * j_query, * j_result, * j_return, * j_element, * j_scheme, * j_policy;
   int res;
   size_t index;
   char * pattern_escaped, * pattern_clause;
@@ -136,172 +270,98 @@ json_t * get_scope_list(struct config_elements * config, const char * pattern, s
     json_object_set_new(j_query, "limit", json_integer(limit));
   }
   if (o_strlen(pattern)) {
-    pattern_escaped = h_escape_string_with_quotes(config->conn, pattern);
+    pattern_escaped = h_escape_string_with_quotes(conn, pattern);
     pattern_clause = msprintf("IN (SELECT gs_id FROM " GLEWLWYD_TABLE_SCOPE " WHERE gs_name LIKE '%%'||%s||'%%' OR gs_display_name LIKE '%%'||%s||'%%' OR gs_description LIKE '%%'||%s||'%%')", pattern_escaped, pattern_escaped, pattern_escaped);
     json_object_set_new(j_query, "where", json_pack("{s{ssss}}", "gs_id", "operator", "raw", "value", pattern_clause));
     o_free(pattern_escaped);
     o_free(pattern_clause);
   }
-  res = h_select(config->conn, j_query, &j_result, NULL);
+  res = h_select(conn, j_query, &j_result, NULL);
   json_decref(j_query);
   if (res == H_OK) {
-    json_array_foreach(j_result, index, j_element) {
-      json_object_set(j_element, "password_required", json_integer_value(json_object_get(j_element, "gs_password_required"))?json_true():json_false());
-      json_object_del(j_element, "gs_password_required");
-      j_scheme = get_auth_scheme_list_from_scope(config, json_string_value(json_object_get(j_element, "name")));
-      if (check_result_value(j_scheme, G_OK)) {
-        json_object_set(j_element, "scheme", json_object_get(j_scheme, "scheme"));
-        json_object_set(j_element, "scheme_required", json_object_get(j_scheme, "scheme_required"));
-      } else if (check_result_value(j_scheme, G_ERROR_NOT_FOUND)) {
-        json_object_set_new(j_element, "scheme", json_object());
-      } else {
-        y_log_message(Y_LOG_LEVEL_ERROR, "get_scope_list - Error get_auth_scheme_list_from_scope for scope %s", json_string_value(json_object_get(j_element, "name")));
+    if ((j_policy = get_scope_policy(config)) != NULL) {
+      json_array_foreach(j_result, index, j_element) {
+        json_object_set(j_element, "password_required", json_integer_value(json_object_get(j_element, "gs_password_required"))?json_true():json_false());
+        json_object_del(j_element, "gs_password_required");
+        j_scheme = json_object_get(j_policy, json_string_value(json_object_get(j_element, "name")));
+        if (json_object_size(json_object_get(j_scheme, "scheme"))) {
+          json_object_set_new(j_element, "scheme", json_deep_copy(json_object_get(j_scheme, "scheme")));
+          json_object_set_new(j_element, "scheme_required", json_deep_copy(json_object_get(j_scheme, "scheme_required")));
+        } else {
+          json_object_set_new(j_element, "scheme", json_object());
+        }
       }
-      json_decref(j_scheme);
+      j_return = json_pack("{siso}", "result", G_OK, "scope", j_result);
+      json_decref(j_policy);
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "get_scope_list - Error get_scope_policy");
+      j_return = json_pack("{si}", "result", G_ERROR);
+      json_decref(j_result);
     }
-    j_return = json_pack("{siso}", "result", G_OK, "scope", j_result);
   } else {
     y_log_message(Y_LOG_LEVEL_ERROR, "get_scope_list - Error executing j_query");
     j_return = json_pack("{si}", "result", G_ERROR_DB);
   }
+  glewlwyd_db_pool_release(config, conn);
   return j_return;
 }
 
+/**
+ * Returns a copy of the scope from the scope policy graph
+ */
 json_t * get_scope(struct config_elements * config, const char * scope) {
-  json_t * j_query, * j_result = NULL, * j_return, * j_scheme;
-  int res;
+  json_t * j_policy = get_scope_policy(config), * j_return;
 
-  j_query = json_pack("{sss[sssss]s{ss}}",
-                      "table",
-                      GLEWLWYD_TABLE_SCOPE,
-                      "columns",
-                        "gs_name AS name",
-                        "gs_display_name AS display_name",
-                        "gs_description AS description",
-                        "gs_password_required",
-                        "gs_password_max_age AS password_max_age",
-                      "where",
-                        "gs_name",
-                        scope);
-  res = h_select(config->conn, j_query, &j_result, NULL);
-  json_decref(j_query);
-  if (res == H_OK) {
-    if (json_array_size(j_result)) {
-      json_object_set(json_array_get(j_result, 0), "password_required", json_integer_value(json_object_get(json_array_get(j_result, 0), "gs_password_required"))?json_true():json_false());
-      json_object_del(json_array_get(j_result, 0), "gs_password_required");
-      j_scheme = get_auth_scheme_list_from_scope(config, scope);
-      if (check_result_value(j_scheme, G_OK)) {
-        json_object_set(json_array_get(j_result, 0), "scheme", json_object_get(j_scheme, "scheme"));
-        json_object_set(json_array_get(j_result, 0), "scheme_required", json_object_get(j_scheme, "scheme_required"));
-        j_return = json_pack("{sisO}", "result", G_OK, "scope", json_array_get(j_result, 0));
-      } else if (check_result_value(j_scheme, G_ERROR_NOT_FOUND)) {
-        json_object_set_new(json_array_get(j_result, 0), "scheme", json_object());
-        j_return = json_pack("{sisO}", "result", G_OK, "scope", json_array_get(j_result, 0));
-      } else {
-        y_log_message(Y_LOG_LEVEL_ERROR, "get_scope - Error get_auth_scheme_list_from_scope");
-        j_return = json_pack("{si}", "result", G_ERROR);
-      }
-      json_decref(j_scheme);
+  if (j_policy != NULL) {
+    if (json_object_get(j_policy, scope) != NULL) {
+      j_return = json_pack("{siso}", "result", G_OK, "scope", json_deep_copy(json_object_get(j_policy, scope)));
     } else {
       j_return = json_pack("{si}", "result", G_ERROR_NOT_FOUND);
     }
   } else {
-    y_log_message(Y_LOG_LEVEL_ERROR, "get_scope - Error executing j_query");
-    j_return = json_pack("{si}", "result", G_ERROR_DB);
+    y_log_message(Y_LOG_LEVEL_ERROR, "get_scope - Error get_scope_policy");
+    j_return = json_pack("{si}", "result", G_ERROR);
   }
-  json_decref(j_result);
+  json_decref(j_policy);
   return j_return;
 }
 
 json_t * get_auth_scheme_list_from_scope(struct config_elements * config, const char * scope) {
-  const char * str_query_pattern = 
-    "SELECT \
-    gsg_name AS group_name, \
-    gsg_scheme_required AS scheme_required, \
-    guasmi_module AS scheme_type, \
-    guasmi_name AS scheme_name, \
-    guasmi_display_name AS scheme_display_name \
-    FROM \
-    " GLEWLWYD_TABLE_SCOPE_GROUP ", \
-    " GLEWLWYD_TABLE_USER_AUTH_SCHEME_MODULE_INSTANCE ", \
-    " GLEWLWYD_TABLE_SCOPE_GROUP_AUTH_SCHEME_MODULE_INSTANCE " \
-    WHERE \
-    " GLEWLWYD_TABLE_SCOPE_GROUP_AUTH_SCHEME_MODULE_INSTANCE ".guasmi_id = " GLEWLWYD_TABLE_USER_AUTH_SCHEME_MODULE_INSTANCE ".guasmi_id AND \
-    " GLEWLWYD_TABLE_SCOPE_GROUP ".gsg_id = " GLEWLWYD_TABLE_SCOPE_GROUP_AUTH_SCHEME_MODULE_INSTANCE ".gsg_id AND \
-    " GLEWLWYD_TABLE_SCOPE_GROUP_AUTH_SCHEME_MODULE_INSTANCE ".gsg_id IN  \
-      (SELECT gsg_id FROM " GLEWLWYD_TABLE_SCOPE_GROUP " WHERE gs_id =  \
-        (SELECT gs_id FROM " GLEWLWYD_TABLE_SCOPE " WHERE gs_name=%s)) \
-    ORDER BY \
-    " GLEWLWYD_TABLE_SCOPE_GROUP ".gsg_id, \
-    " GLEWLWYD_TABLE_USER_AUTH_SCHEME_MODULE_INSTANCE ".guasmi_name;";
-  char * scope_escape = h_escape_string_with_quotes(config->conn, scope), * str_query = NULL;
-  json_t * j_return, * j_result = NULL, * j_element;
-  int res;
-  size_t index;
-  
-  if (scope_escape != NULL) {
-    str_query = msprintf(str_query_pattern, scope_escape);
-    if (str_query != NULL) {
-      res = h_execute_query_json(config->conn, str_query, &j_result);
-      if (res == H_OK) {
-        if (json_array_size(j_result)) {
-          j_return = json_pack("{sis{}s{}}", "result", G_OK, "scheme", "scheme_required");
-          if (j_return != NULL) {
-            json_array_foreach(j_result, index, j_element) {
-              if (json_object_get(json_object_get(j_return, "scheme"), json_string_value(json_object_get(j_element, "group_name"))) == NULL) {
-                json_object_set_new(json_object_get(j_return, "scheme"), json_string_value(json_object_get(j_element, "group_name")), json_array());
-                json_object_set(json_object_get(j_return, "scheme_required"), json_string_value(json_object_get(j_element, "group_name")), json_object_get(j_element, "scheme_required"));
-              }
-              if (json_object_get(json_object_get(j_return, "scheme"), json_string_value(json_object_get(j_element, "group_name"))) != NULL) {
-                json_array_append_new(json_object_get(json_object_get(j_return, "scheme"), json_string_value(json_object_get(j_element, "group_name"))), json_pack("{ssssss?}", "scheme_type", json_string_value(json_object_get(j_element, "scheme_type")), "scheme_name", json_string_value(json_object_get(j_element, "scheme_name")), "scheme_display_name", json_string_value(json_object_get(j_element, "scheme_display_name"))));
-              }
-            }
-          } else {
-            y_log_message(Y_LOG_LEVEL_ERROR, "get_auth_scheme_list_from_scope - Error allocating resources for j_return");
-            j_return = json_pack("{si}", "result", G_ERROR_MEMORY);
-          }
-        } else {
-          j_return = json_pack("{si}", "result", G_ERROR_NOT_FOUND);
-        }
-      } else {
-        y_log_message(Y_LOG_LEVEL_ERROR, "get_auth_scheme_list_from_scope - Error executing str_query");
-        j_return = json_pack("{si}", "result", G_ERROR_DB);
-      }
-      json_decref(j_result);
+  json_t * j_policy = get_scope_policy(config), * j_scope, * j_return;
+
+  if (j_policy != NULL) {
+    j_scope = json_object_get(j_policy, scope);
+    if (json_object_size(json_object_get(j_scope, "scheme"))) {
+      j_return = json_pack("{sisoso}", "result", G_OK, "scheme", json_deep_copy(json_object_get(j_scope, "scheme")), "scheme_required", json_deep_copy(json_object_get(j_scope, "scheme_required")));
     } else {
-      y_log_message(Y_LOG_LEVEL_ERROR, "get_auth_scheme_list_from_scope - Error allocating resources for str_query");
-      j_return = json_pack("{si}", "result", G_ERROR);
+      j_return = json_pack("{si}", "result", G_ERROR_NOT_FOUND);
     }
-    o_free(str_query);
   } else {
-    y_log_message(Y_LOG_LEVEL_ERROR, "get_auth_scheme_list_from_scope - Error h_escape_string");
+    y_log_message(Y_LOG_LEVEL_ERROR, "get_auth_scheme_list_from_scope - Error get_scope_policy");
     j_return = json_pack("{si}", "result", G_ERROR);
   }
-  o_free(scope_escape);
+  json_decref(j_policy);
   return j_return;
 }
 
-json_t * get_auth_scheme_list_from_scope_list(struct config_elements * config, const char * scope_list) {
+/**
+ * Returns the scheme groups of the scopes of scope_list from the policy graph j_policy
+ */
+static json_t * get_auth_scheme_list_from_scope_policy(json_t * j_policy, const char * scope_list) {
   char ** scope_array = NULL;
   int i;
-  json_t * j_result, * j_scheme_list, * j_scope;
+  json_t * j_result, * j_scope;
 
   if (split_string(scope_list, " ", &scope_array) > 0) {
     j_result = json_pack("{sis{}}", "result", G_OK, "scheme");
     if (j_result != NULL) {
       for (i=0; scope_array[i] != NULL; i++) {
-        if (json_object_get(json_object_get(j_result, "scheme"), scope_array[i]) == NULL) {
-          j_scope = get_scope(config, scope_array[i]);
-          if (check_result_value(j_scope, G_OK)) {
-            j_scheme_list = get_auth_scheme_list_from_scope(config, scope_array[i]);
-            if (check_result_value(j_scheme_list, G_OK)) {
-              json_object_set_new(json_object_get(j_result, "scheme"), scope_array[i], json_pack("{sOsOsOsO}", "password_required", json_object_get(json_object_get(j_scope, "scope"), "password_required"), "password_max_age", json_object_get(json_object_get(j_scope, "scope"), "password_max_age"), "schemes", json_object_get(j_scheme_list, "scheme"), "scheme_required", json_object_get(j_scheme_list, "scheme_required")));
-            } else if (check_result_value(j_scheme_list, G_ERROR_NOT_FOUND)) {
-              json_object_set_new(json_object_get(j_result, "scheme"), scope_array[i], json_pack("{sOsOs{}s{}}", "password_required", json_object_get(json_object_get(j_scope, "scope"), "password_required"), "password_max_age", json_object_get(json_object_get(j_scope, "scope"), "password_max_age"), "schemes", "scheme_required"));
-            }
-            json_decref(j_scheme_list);
+        if (json_object_get(json_object_get(j_result, "scheme"), scope_array[i]) == NULL && (j_scope = json_object_get(j_policy, scope_array[i])) != NULL) {
+          if (json_object_size(json_object_get(j_scope, "scheme"))) {
+            json_object_set_new(json_object_get(j_result, "scheme"), scope_array[i], json_pack("{sOsOsoso}", "password_required", json_object_get(j_scope, "password_required"), "password_max_age", json_object_get(j_scope, "password_max_age"), "schemes", json_deep_copy(json_object_get(j_scope, "scheme")), "scheme_required", json_deep_copy(json_object_get(j_scope, "scheme_required"))));
+          } else {
+            json_object_set_new(json_object_get(j_result, "scheme"), scope_array[i], json_pack("{sOsOs{}s{}}", "password_required", json_object_get(j_scope, "password_required"), "password_max_age", json_object_get(j_scope, "password_max_age"), "schemes", "scheme_required"));
           }
-          json_decref(j_scope);
         }
       }
       if (!json_object_size(json_object_get(j_result, "scheme"))) {
@@ -309,69 +369,67 @@ json_t * get_auth_scheme_list_from_scope_list(struct config_elements * config, c
         j_result = json_pack("{si}", "result", G_ERROR_NOT_FOUND);
       }
     } else {
-      y_log_message(Y_LOG_LEVEL_ERROR, "get_auth_scheme_list_from_scope_list - Error allocating resources for j_result");
+      y_log_message(Y_LOG_LEVEL_ERROR, "get_auth_scheme_list_from_scope_policy - Error allocating resources for j_result");
       j_result = json_pack("{si}", "result", G_ERROR);
     }
   } else {
-    y_log_message(Y_LOG_LEVEL_ERROR, "get_auth_scheme_list_from_scope_list - Error split_string");
+    y_log_message(Y_LOG_LEVEL_ERROR, "get_auth_scheme_list_from_scope_policy - Error split_string");
     j_result = json_pack("{si}", "result", G_ERROR);
   }
   free_string_array(scope_array);
   return j_result;
 }
 
-static json_t * is_scheme_valid_for_session(struct config_elements * config, json_int_t guasmi_id, json_int_t max_use, json_int_t password_max_age, const char * session_hash) {
-  json_t * j_query, * j_result = NULL, * j_session = get_current_session(config, session_hash), * j_return;
-  int res;
+json_t * get_auth_scheme_list_from_scope_list(struct config_elements * config, const char * scope_list) {
+  json_t * j_result, * j_policy = get_scope_policy(config);
+
+  if (j_policy != NULL) {
+    j_result = get_auth_scheme_list_from_scope_policy(j_policy, scope_list);
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "get_auth_scheme_list_from_scope_list - Error get_scope_policy");
+    j_result = json_pack("{si}", "result", G_ERROR);
+  }
+  json_decref(j_policy);
+  return j_result;
+}
+
+/**
+ * Evaluates a scheme from the session authentication state, guasmi_id is 0 for the password
+ * The most recent authentication of the scheme that hasn't reached max_use is used
+ */
+static json_t * is_scheme_valid_for_session(struct config_elements * config, json_t * j_state, json_int_t guasmi_id, json_int_t max_use, json_int_t password_max_age) {
+  json_t * j_scheme_list, * j_element, * j_last = NULL, * j_return;
+  char * key;
+  size_t index;
   time_t now;
 
-  if (check_result_value(j_session, G_OK)) {
-    j_query = json_pack("{sss[sss]s{sOsosi}}",
-                        "table",
-                        GLEWLWYD_TABLE_USER_SESSION_SCHEME,
-                        "columns",
-                          "guss_id",
-                          SWITCH_DB_TYPE(config->conn->type, "UNIX_TIMESTAMP(guss_last_login) AS guss_last_login", "guss_last_login AS guss_last_login", "EXTRACT(EPOCH FROM guss_last_login)::integer AS guss_last_login"),
-                          SWITCH_DB_TYPE(config->conn->type, "UNIX_TIMESTAMP(guss_expiration) AS guss_expiration", "guss_expiration AS guss_expiration", "EXTRACT(EPOCH FROM guss_expiration)::integer AS guss_expiration"),
-                        "where",
-                          "gus_id",
-                          json_object_get(json_object_get(j_session, "session"), "gus_id"),
-                          "guasmi_id",
-                          guasmi_id?json_integer(guasmi_id):json_null(),
-                          "guss_enabled",
-                          1,
-                          "order_by",
-                          "guss_last_login DESC");
+  if (check_result_value(j_state, G_OK)) {
+    key = msprintf("%" JSON_INTEGER_FORMAT, guasmi_id);
+    j_scheme_list = json_object_get(json_object_get(j_state, "scheme"), key);
+    o_free(key);
     if (max_use > 0) {
-      json_object_set_new(json_object_get(j_query, "where"), "guss_use_counter", json_pack("{sssI}", "operator", "<", "value", max_use));
-    }
-    res = h_select(config->conn, j_query, &j_result, NULL);
-    json_decref(j_query);
-    if (res == H_OK) {
-      time(&now);
-      if (guasmi_id || !password_max_age) {
-        if (json_array_size(j_result)) {
-          j_return = json_pack("{sisbsO}", "result", G_OK, "valid", (json_integer_value(json_object_get(json_array_get(j_result, 0), "guss_expiration")) > (json_int_t)now), "last_login", json_object_get(json_array_get(j_result, 0), "guss_last_login"));
-        } else {
-          j_return = json_pack("{sisOsi}", "result", G_OK, "valid", json_false(), "last_login", 0);
-        }
-      } else {
-        if (json_array_size(j_result)) {
-          j_return = json_pack("{sisbsO}", "result", G_OK, "valid", (json_integer_value(json_object_get(json_array_get(j_result, 0), "guss_last_login")) + (json_int_t)password_max_age > (json_int_t)now), "last_login", json_object_get(json_array_get(j_result, 0), "guss_last_login"));
-        } else {
-          j_return = json_pack("{sisOsi}", "result", G_OK, "valid", json_false(), "last_login", 0);
+      // Uses not written in the database yet by the session usage write-behind are counted as well
+      max_use -= glewlwyd_session_usage_get_pending(config, json_string_value(json_object_get(j_state, "session_hash")), json_string_value(json_object_get(json_object_get(j_state, "session"), "username")), guasmi_id);
+      json_array_foreach(j_scheme_list, index, j_element) {
+        if (j_last == NULL && json_integer_value(json_object_get(j_element, "use_counter")) < max_use) {
+          j_last = j_element;
         }
       }
     } else {
-      y_log_message(Y_LOG_LEVEL_ERROR, "is_password_valid_for_session - Error executing j_query");
-      j_return = json_pack("{si}", "result", G_ERROR_DB);
+      j_last = json_array_get(j_scheme_list, 0);
+    }
+    time(&now);
+    if (j_last == NULL) {
+      j_return = json_pack("{sisOsi}", "result", G_OK, "valid", json_false(), "last_login", 0);
+    } else if (guasmi_id || !password_max_age) {
+      j_return = json_pack("{sisbsO}", "result", G_OK, "valid", (json_integer_value(json_object_get(j_last, "expiration")) > (json_int_t)now), "last_login", json_object_get(j_last, "last_login"));
+    } else {
+      j_return = json_pack("{sisbsO}", "result", G_OK, "valid", (json_integer_value(json_object_get(j_last, "last_login")) + (json_int_t)password_max_age > (json_int_t)now), "last_login", json_object_get(j_last, "last_login"));
     }
-    json_decref(j_result);
   } else {
-    y_log_message(Y_LOG_LEVEL_ERROR, "is_password_valid_for_session - Error get_current_session");
+    y_log_message(Y_LOG_LEVEL_ERROR, "is_scheme_valid_for_session - Error session authentication state");
     j_return = json_pack("{si}", "result", G_ERROR);
   }
-  json_decref(j_session);
   return j_return;
 }
 
@@ -412,22 +470,40 @@ int is_scope_list_valid_for_session(struct config_elements * config, const char
 }
 
 json_t * get_validated_auth_scheme_list_from_scope_list(struct config_elements * config, const char * scope_list, const char * session_uid) {
-  char * session_hash = generate_hash(config->hash_algorithm, session_uid);
-  json_t * j_scheme_list = get_auth_scheme_list_from_scope_list(config, scope_list), * j_cur_scope, * j_scope, * j_scheme, * j_group, * j_user = get_current_user_from_session(config, session_uid), * j_scheme_remove, * j_scheme_password_valid, * j_scheme_valid;
+  json_t * j_state = get_session_auth_state(config, session_uid), * j_return;
+
+  j_return = get_validated_auth_scheme_list_from_session_auth_state(config, scope_list, j_state);
+  json_decref(j_state);
+  return j_return;
+}
+
+/**
+ * Evaluates the schemes required by scope_list with the session authentication state j_state returned by get_session_auth_state
+ * No query is made on the session tables
+ */
+json_t * get_validated_auth_scheme_list_from_session_auth_state(struct config_elements * config, const char * scope_list, json_t * j_state) {
+  json_t * j_policy = get_scope_policy(config), * j_scheme_list, * j_cur_scope, * j_scope, * j_scheme, * j_group, * j_user = get_current_user_from_session(config, j_state), * j_scheme_remove, * j_scheme_password_valid, * j_scheme_valid;
   const char * key_scope, * key_group;
   size_t index_scheme;
   struct _user_auth_scheme_module_instance * scheme;
   int can_use_scheme;
   
+  // The policy graph is read once for all the scopes of scope_list
+  if (j_policy != NULL) {
+    j_scheme_list = get_auth_scheme_list_from_scope_policy(j_policy, scope_list);
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "get_validated_auth_scheme_list_from_scope_list - Error get_scope_policy");
+    j_scheme_list = json_pack("{si}", "result", G_ERROR);
+  }
   if (check_result_value(j_scheme_list, G_OK)) {
     json_object_foreach(json_object_get(j_scheme_list, "scheme"), key_scope, j_cur_scope) {
-      j_scope = get_scope(config, key_scope);
-      if (check_result_value(j_scope, G_OK)) {
+      j_scope = json_object_get(j_policy, key_scope);
+      if (j_scope != NULL) {
         if (check_result_value(j_user, G_OK)) {
-          j_scheme_password_valid = is_scheme_valid_for_session(config, 0, 0, json_object_get(j_cur_scope, "password_required")==json_true()?json_integer_value(json_object_get(j_cur_scope, "password_max_age")):0, session_hash);
+          j_scheme_password_valid = is_scheme_valid_for_session(config, j_state, 0, 0, json_object_get(j_cur_scope, "password_required")==json_true()?json_integer_value(json_object_get(j_cur_scope, "password_max_age")):0);
           if (check_result_value(j_scheme_password_valid, G_OK)) {
-            json_object_set(j_cur_scope, "display_name", json_object_get(json_object_get(j_scope, "scope"), "display_name"));
-            json_object_set(j_cur_scope, "description", json_object_get(json_object_get(j_scope, "scope"), "description"));
+            json_object_set(j_cur_scope, "display_name", json_object_get(j_scope, "display_name"));
+            json_object_set(j_cur_scope, "description", json_object_get(j_scope, "description"));
             json_object_set(j_cur_scope, "password_authenticated", json_object_get(j_scheme_password_valid, "valid"));
             json_object_set(j_cur_scope, "password_last_login", json_object_get(j_scheme_password_valid, "last_login"));
             if (user_has_scope(json_object_get(j_user, "user"), key_scope)) {
@@ -440,7 +516,7 @@ json_t * get_validated_auth_scheme_list_from_scope_list(struct config_elements *
                     if (scheme != NULL) {
                       if (scheme->enabled && (can_use_scheme = scheme->module->user_auth_scheme_module_can_use(config->config_m, json_string_value(json_object_get(json_object_get(j_user, "user"), "username")), scheme->cls)) != GLEWLWYD_IS_NOT_AVAILABLE) {
                         if (can_use_scheme == GLEWLWYD_IS_REGISTERED) {
-                          j_scheme_valid = is_scheme_valid_for_session(config, scheme->guasmi_id, scheme->guasmi_max_use, 0, session_hash);
+                          j_scheme_valid = is_scheme_valid_for_session(config, j_state, scheme->guasmi_id, scheme->guasmi_max_use, 0);
                           if (check_result_value(j_scheme_valid, G_OK)) {
                             json_object_set(j_scheme, "scheme_authenticated", json_object_get(j_scheme_valid, "valid"));
                             json_object_set(j_scheme, "scheme_last_login", json_object_get(j_scheme_valid, "last_login"));
@@ -497,17 +573,17 @@ json_t * get_validated_auth_scheme_list_from_scope_list(struct config_elements *
         }
         json_object_del(j_cur_scope, "password_max_age");
       } else {
-        y_log_message(Y_LOG_LEVEL_ERROR, "get_validated_auth_scheme_list_from_scope_list - Error get_scope");
+        y_log_message(Y_LOG_LEVEL_ERROR, "get_validated_auth_scheme_list_from_scope_list - Error scope '%s' not in policy", key_scope);
       }
-      json_decref(j_scope);
     }
   }
   json_decref(j_user);
-  o_free(session_hash);
+  json_decref(j_policy);
   return j_scheme_list;
 }
 
 json_t * get_client_user_scope_grant(struct config_elements * config, const char * client_id, const char * username, const char * scope_list) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   char ** scope_array = NULL;
   json_t * j_query, * j_result = NULL, * j_return, * j_element;
   int res, i;
@@ -516,7 +592,7 @@ json_t * get_client_user_scope_grant(struct config_elements * config, const char
   
   if (split_string(scope_list, " ", &scope_array) > 0) {
     for (i=0; scope_array[i] != NULL; i++) {
-      scope_escaped = h_escape_string_with_quotes(config->conn, scope_array[i]);
+      scope_escaped = h_escape_string_with_quotes(conn, scope_array[i]);
       if (scope_name_list == NULL) {
         scope_name_list = o_strdup(scope_escaped);
       } else {
@@ -525,8 +601,8 @@ json_t * get_client_user_scope_grant(struct config_elements * config, const char
       o_free(scope_escaped);
     }
     if (scope_name_list != NULL) {
-      username_escaped = h_escape_string_with_quotes(config->conn, username);
-      client_id_escaped = h_escape_string_with_quotes(config->conn, client_id);
+      username_escaped = h_escape_string_with_quotes(conn, username);
+      client_id_escaped = h_escape_string_with_quotes(conn, client_id);
       scope_clause = msprintf("IN (SELECT gs_id FROM " GLEWLWYD_TABLE_CLIENT_USER_SCOPE " WHERE gs_id IN (SELECT gs_id FROM " GLEWLWYD_TABLE_SCOPE " WHERE gs_name IN (%s)) AND gcus_username=%s AND gcus_client_id=%s AND gcus_enabled=1)", scope_name_list, username_escaped, client_id_escaped);
       j_query = json_pack("{sss[ssss]s{s{ssss}}}",
                           "table",
@@ -546,7 +622,7 @@ json_t * get_client_user_scope_grant(struct config_elements * config, const char
       o_free(username_escaped);
       o_free(client_id_escaped);
       o_free(scope_clause);
-      res = h_select(config->conn, j_query, &j_result, NULL);
+      res = h_select(conn, j_query, &j_result, NULL);
       json_decref(j_query);
       if (res == H_OK) {
         json_array_foreach(j_result, index, j_element) {
@@ -568,6 +644,7 @@ json_t * get_client_user_scope_grant(struct config_elements * config, const char
     j_return = json_pack("{si}", "result", G_ERROR);
   }
   free_string_array(scope_array);
+  glewlwyd_db_pool_release(config, conn);
   return j_return;
 }
 
@@ -639,6 +716,7 @@ json_t * get_granted_scopes_for_client(struct config_elements * config, json_t *
 }
 
 json_t * get_client_grant_list(struct config_elements * config, const char * username, size_t offset, size_t limit) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   json_t * j_query, * j_result = NULL, * j_result_scope = NULL, * j_return, * j_client, * j_element = NULL;
   int res;
   size_t index = 0;
@@ -656,15 +734,15 @@ json_t * get_client_grant_list(struct config_elements * config, const char * use
   if (limit) {
     json_object_set_new(j_query, "limit", json_integer(limit));
   }
-  res = h_select(config->conn, j_query, &j_result, NULL);
+  res = h_select(conn, j_query, &j_result, NULL);
   json_decref(j_query);
   if (res == H_OK) {
     j_return = json_pack("{sis[]}", "result", G_OK, "client_grant");
     json_array_foreach(j_result, index, j_element) {
       j_client = get_client(config, json_string_value(json_object_get(j_element, "client_id")), NULL);
       if (check_result_value(j_client, G_OK) && json_object_get(json_object_get(j_client, "client"), "enabled") == json_true()) {
-        username_escaped = h_escape_string_with_quotes(config->conn, username);
-        client_id_escaped = h_escape_string_with_quotes(config->conn, json_string_value(json_object_get(j_element, "client_id")));
+        username_escaped = h_escape_string_with_quotes(conn, username);
+        client_id_escaped = h_escape_string_with_quotes(conn, json_string_value(json_object_get(j_element, "client_id")));
         scope_clause = msprintf("IN (SELECT gs_id FROM " GLEWLWYD_TABLE_CLIENT_USER_SCOPE " WHERE gcus_username=%s AND gcus_client_id=%s AND gcus_enabled=1)", username_escaped, client_id_escaped);
         j_query = json_pack("{sss[sss]s{s{ssss}}}",
                             "table", GLEWLWYD_TABLE_SCOPE,
@@ -681,7 +759,7 @@ json_t * get_client_grant_list(struct config_elements * config, const char * use
         o_free(scope_clause);
         o_free(client_id_escaped);
         o_free(username_escaped);
-        res = h_select(config->conn, j_query, &j_result_scope, NULL);
+        res = h_select(conn, j_query, &j_result_scope, NULL);
         json_decref(j_query);
         if (res == H_OK) {
           json_array_append_new(json_object_get(j_return, "client_grant"), json_pack("{sOsOsOsO}", "client_id", json_object_get(json_object_get(j_client, "client"), "client_id"), "name", json_object_get(json_object_get(j_client, "client"), "name"), "description", json_object_get(json_object_get(j_client, "client"), "description"), "scope", j_result_scope));
@@ -699,10 +777,12 @@ json_t * get_client_grant_list(struct config_elements * config, const char * use
     y_log_message(Y_LOG_LEVEL_ERROR, "get_client_grant_list - Error executing j_query (1)");
     j_return = json_pack("{si}", "result", G_ERROR_DB);
   }
+  glewlwyd_db_pool_release(config, conn);
   return j_return;
 }
 
 int set_granted_scopes_for_client(struct config_elements * config, json_t * j_user, const char * client_id, const char * scope_list) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   json_t * j_query, * j_element;
   char * scope_clause = NULL, * scope_escaped, ** scope_array = NULL;
   int res, ret = G_OK, i, has_granted;
@@ -719,7 +799,7 @@ int set_granted_scopes_for_client(struct config_elements * config, json_t * j_us
                        json_string_value(json_object_get(j_user, "username")),
                        "gcus_client_id",
                        client_id);
-  res = h_update(config->conn, j_query, NULL);
+  res = h_update(conn, j_query, NULL);
   json_decref(j_query);
   if (res == H_OK) {
     if (scope_list != NULL && o_strlen(scope_list)) {
@@ -729,7 +809,7 @@ int set_granted_scopes_for_client(struct config_elements * config, json_t * j_us
           json_array_foreach(json_object_get(j_user, "scope"), index, j_element) {
             if (0 == o_strcmp(scope_array[i], json_string_value(j_element)) && ret != G_ERROR_DB) {
               has_granted = 1;
-              scope_escaped = h_escape_string_with_quotes(config->conn, scope_array[i]);
+              scope_escaped = h_escape_string_with_quotes(conn, scope_array[i]);
               scope_clause = msprintf("(SELECT gs_id FROM " GLEWLWYD_TABLE_SCOPE " WHERE gs_name=%s)", scope_escaped);
               j_query = json_pack("{sss{s{ss}ssss}}",
                                   "table",
@@ -743,7 +823,7 @@ int set_granted_scopes_for_client(struct config_elements * config, json_t * j_us
                                     "gcus_client_id",
                                     client_id);
               o_free(scope_clause);
-              res = h_insert(config->conn, j_query, NULL);
+              res = h_insert(conn, j_query, NULL);
               if (res != H_OK) {
                 y_log_message(Y_LOG_LEVEL_ERROR, "set_granted_scopes_for_client - Error executing j_query (2)");
                 ret = G_ERROR_DB;
@@ -767,6 +847,7 @@ int set_granted_scopes_for_client(struct config_elements * config, json_t * j_us
     y_log_message(Y_LOG_LEVEL_ERROR, "set_granted_scopes_for_client - Error executing j_query (1)");
     ret = G_ERROR_DB;
   }
+  glewlwyd_db_pool_release(config, conn);
   return ret;
 }
 
@@ -907,13 +988,14 @@ json_t * is_scope_valid(struct config_elements * config, json_t * j_scope, int a
 }
 
 static int add_scope_scheme_groups(struct config_elements * config, const char * scope, json_t * j_scheme, json_t * j_scheme_required) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   json_t * j_query, * j_scope_group, * j_scope_group_id, * j_scheme_module;
   int res, ret = G_OK;
   char * scope_escaped, * scope_clause, * scheme_escaped, * scheme_module_clause;
   const char * group_name;
   size_t index;
 
-  scope_escaped = h_escape_string_with_quotes(config->conn, scope);
+  scope_escaped = h_escape_string_with_quotes(conn, scope);
   scope_clause = msprintf("(SELECT gs_id FROM " GLEWLWYD_TABLE_SCOPE " WHERE gs_name=%s)", scope_escaped);
 
   json_object_foreach(j_scheme, group_name, j_scope_group) {
@@ -929,13 +1011,13 @@ static int add_scope_scheme_groups(struct config_elements * config, const char *
     if (json_object_get(j_scheme_required, group_name) != NULL) {
       json_object_set(json_object_get(j_query, "values"), "gsg_scheme_required", json_object_get(j_scheme_required, group_name));
     }
-    res = h_insert(config->conn, j_query, NULL);
+    res = h_insert(conn, j_query, NULL);
     json_decref(j_query);
     if (res == H_OK) {
-      j_scope_group_id = h_last_insert_id(config->conn);
+      j_scope_group_id = h_last_insert_id(conn);
       if (j_scope_group_id != NULL && json_integer_value(j_scope_group_id) > 0) {
         json_array_foreach(j_scope_group, index, j_scheme_module) {
-          scheme_escaped = h_escape_string_with_quotes(config->conn, json_string_value(json_object_get(j_scheme_module, "scheme_name")));
+          scheme_escaped = h_escape_string_with_quotes(conn, json_string_value(json_object_get(j_scheme_module, "scheme_name")));
           scheme_module_clause = msprintf("(SELECT guasmi_id FROM " GLEWLWYD_TABLE_USER_AUTH_SCHEME_MODULE_INSTANCE " WHERE guasmi_name=%s)", scheme_escaped);
           j_query = json_pack("{sss{sOs{ss}}}",
                               "table",
@@ -948,7 +1030,7 @@ static int add_scope_scheme_groups(struct config_elements * config, const char *
                                   scheme_module_clause);
           o_free(scheme_module_clause);
           o_free(scheme_escaped);
-          res = h_insert(config->conn, j_query, NULL);
+          res = h_insert(conn, j_query, NULL);
           json_decref(j_query);
           if (res != H_OK) {
             y_log_message(Y_LOG_LEVEL_ERROR, "add_scope_scheme_groups - Error executing j_query (2)");
@@ -967,10 +1049,12 @@ static int add_scope_scheme_groups(struct config_elements * config, const char *
   }
   o_free(scope_escaped);
   o_free(scope_clause);
+  glewlwyd_db_pool_release(config, conn);
   return ret;
 }
 
 int add_scope(struct config_elements * config, json_t * j_scope) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   json_t * j_query;
   int res, ret;
 
@@ -988,7 +1072,7 @@ int add_scope(struct config_elements * config, json_t * j_scope) {
                         json_object_get(j_scope, "password_required")==json_false()?0:1,
                         "gs_password_max_age",
                         json_object_get(j_scope, "password_max_age")!=NULL?json_integer_value(json_object_get(j_scope, "password_max_age")):0);
-  res = h_insert(config->conn, j_query, NULL);
+  res = h_insert(conn, j_query, NULL);
   json_decref(j_query);
   if (res == H_OK) {
     if (json_object_get(j_scope, "scheme") != NULL && json_object_size(json_object_get(j_scope, "scheme"))) {
@@ -1005,15 +1089,18 @@ int add_scope(struct config_elements * config, json_t * j_scope) {
     y_log_message(Y_LOG_LEVEL_ERROR, "add_scope - Error executing j_query");
     ret = G_ERROR_DB;
   }
+  invalidate_scope_policy(config);
+  glewlwyd_db_pool_release(config, conn);
   return ret;
 }
 
 int set_scope(struct config_elements * config, const char * scope, json_t * j_scope) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   json_t * j_query;
   char * scope_escaped, * scope_clause;
   int res, ret;
 
-  scope_escaped = h_escape_string_with_quotes(config->conn, scope);
+  scope_escaped = h_escape_string_with_quotes(conn, scope);
   scope_clause = msprintf("IN (SELECT gs_id FROM " GLEWLWYD_TABLE_SCOPE " WHERE gs_name=%s)", scope_escaped);
   j_query = json_pack("{sss{s{ssss}}}",
                       "table",
@@ -1026,7 +1113,7 @@ int set_scope(struct config_elements * config, const char * scope, json_t * j_sc
                           scope_clause);
   o_free(scope_clause);
   o_free(scope_escaped);
-  res = h_delete(config->conn, j_query, NULL);
+  res = h_delete(conn, j_query, NULL);
   json_decref(j_query);
   if (res == H_OK) {
     j_query = json_pack("{sss{sOsOsisI}s{ss}}",
@@ -1044,7 +1131,7 @@ int set_scope(struct config_elements * config, const char * scope, json_t * j_sc
                         "where",
                           "gs_name",
                           scope);
-    res = h_update(config->conn, j_query, NULL);
+    res = h_update(conn, j_query, NULL);
     json_decref(j_query);
     if (res == H_OK) {
       if (add_scope_scheme_groups(config, scope, json_object_get(j_scope, "scheme"), json_object_get(j_scope, "scheme_required")) == G_OK) {
@@ -1061,10 +1148,13 @@ int set_scope(struct config_elements * config, const char * scope, json_t * j_sc
     y_log_message(Y_LOG_LEVEL_ERROR, "set_scope - Error executing j_query (1)");
     ret = G_ERROR_DB;
   }
+  invalidate_scope_policy(config);
+  glewlwyd_db_pool_release(config, conn);
   return ret;
 }
 
 int delete_scope(struct config_elements * config, const char * scope) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   json_t * j_query;
   int res, ret;
 
@@ -1074,7 +1164,7 @@ int delete_scope(struct config_elements * config, const char * scope) {
                       "where",
                         "gs_name",
                         scope);
-  res = h_delete(config->conn, j_query, NULL);
+  res = h_delete(conn, j_query, NULL);
   json_decref(j_query);
   if (res == H_OK) {
     ret = G_OK;
@@ -1082,5 +1172,7 @@ int delete_scope(struct config_elements * config, const char * scope) {
     y_log_message(Y_LOG_LEVEL_ERROR, "delete_scope - Error executing j_query");
     ret = G_ERROR_DB;
   }
+  invalidate_scope_policy(config);
+  glewlwyd_db_pool_release(config, conn);
   return ret;
 }
@@ -26,14 +26,374 @@
  */
 #include "glewlwyd.h"
 
+/**
+ * FNV-1a hash of the session id
+ */
+static unsigned int glewlwyd_session_cache_hash(const char * session_uid) {
+  unsigned int hash = 2166136261U;
+  const char * c;
+
+  for (c = session_uid; c != NULL && *c; c++) {
+    hash = (hash ^ (unsigned char)*c) * 16777619U;
+  }
+  return hash;
+}
+
+static void glewlwyd_session_cache_free_entry(struct _glwd_session_cache_entry * entry) {
+  o_free(entry->session_uid);
+  o_free(entry->session_hash);
+  o_free(entry->current_username);
+  json_decref(entry->j_session);
+  o_free(entry);
+}
+
+/**
+ * Returns the expiration of a session value as a timestamp, 0 if unknown
+ */
+static time_t glewlwyd_session_cache_get_expiration(json_t * j_expiration) {
+  time_t expiration = 0;
+
+  if (json_is_integer(j_expiration)) {
+    expiration = (time_t)json_integer_value(j_expiration);
+  } else if (json_is_string(j_expiration)) {
+    expiration = (time_t)strtol(json_string_value(j_expiration), NULL, 10);
+  }
+  return expiration;
+}
+
+/**
+ * Removes all the expired entries of a shard, the shard must be locked
+ */
+static void glewlwyd_session_cache_purge_shard(struct _glwd_session_cache_shard * shard, time_t now) {
+  struct _glwd_session_cache_entry ** p_entry, * entry;
+  size_t i;
+
+  for (i=0; i<GLWD_SESSION_CACHE_BUCKETS; i++) {
+    p_entry = &shard->buckets[i];
+    while (*p_entry != NULL) {
+      entry = *p_entry;
+      if (entry->expires_at <= now) {
+        *p_entry = entry->next;
+        glewlwyd_session_cache_free_entry(entry);
+        shard->count--;
+      } else {
+        p_entry = &entry->next;
+      }
+    }
+  }
+}
+
+/**
+ * Removes the entry that expires first in a shard, the shard must be locked
+ */
+static void glewlwyd_session_cache_evict_shard(struct _glwd_session_cache_shard * shard) {
+  struct _glwd_session_cache_entry ** p_entry, ** p_evict = NULL, * entry;
+  size_t i;
+
+  for (i=0; i<GLWD_SESSION_CACHE_BUCKETS; i++) {
+    for (p_entry = &shard->buckets[i]; *p_entry != NULL; p_entry = &(*p_entry)->next) {
+      if (p_evict == NULL || (*p_entry)->expires_at < (*p_evict)->expires_at) {
+        p_evict = p_entry;
+      }
+    }
+  }
+  if (p_evict != NULL) {
+    entry = *p_evict;
+    *p_evict = entry->next;
+    glewlwyd_session_cache_free_entry(entry);
+    shard->count--;
+  }
+}
+
+/**
+ * Returns the entry of a session id, NULL if not found or expired, the shard must be locked
+ * An expired entry is removed from the shard
+ */
+static struct _glwd_session_cache_entry * glewlwyd_session_cache_lookup(struct _glwd_session_cache_shard * shard, const char * session_uid, unsigned int hash, time_t now) {
+  struct _glwd_session_cache_entry ** p_entry, * entry = NULL;
+
+  for (p_entry = &shard->buckets[(hash/GLWD_SESSION_CACHE_SHARDS)%GLWD_SESSION_CACHE_BUCKETS]; *p_entry != NULL; p_entry = &(*p_entry)->next) {
+    if ((*p_entry)->hash == hash && 0 == o_strcmp((*p_entry)->session_uid, session_uid)) {
+      entry = *p_entry;
+      if (entry->expires_at <= now) {
+        *p_entry = entry->next;
+        glewlwyd_session_cache_free_entry(entry);
+        shard->count--;
+        entry = NULL;
+      }
+      break;
+    }
+  }
+  return entry;
+}
+
+/**
+ * Returns the entry of a session id, creates it if it doesn't exist, the shard must be locked
+ */
+static struct _glwd_session_cache_entry * glewlwyd_session_cache_get_or_create(struct config_elements * config, struct _glwd_session_cache_shard * shard, const char * session_uid, const char * session_hash, unsigned int hash, time_t now) {
+  struct _glwd_session_cache_entry * entry;
+  size_t bucket = (hash/GLWD_SESSION_CACHE_SHARDS)%GLWD_SESSION_CACHE_BUCKETS, shard_size = config->session_cache.size/GLWD_SESSION_CACHE_SHARDS;
+
+  if ((entry = glewlwyd_session_cache_lookup(shard, session_uid, hash, now)) == NULL) {
+    if (shard->count >= (shard_size?shard_size:1)) {
+      glewlwyd_session_cache_purge_shard(shard, now);
+      if (shard->count >= (shard_size?shard_size:1)) {
+        glewlwyd_session_cache_evict_shard(shard);
+      }
+    }
+    if ((entry = o_malloc(sizeof(struct _glwd_session_cache_entry))) != NULL) {
+      entry->session_uid = o_strdup(session_uid);
+      entry->session_hash = o_strdup(session_hash);
+      entry->hash = hash;
+      entry->current_username = NULL;
+      entry->j_session = json_object();
+      entry->expires_at = now + config->session_cache.max_age;
+      entry->next = shard->buckets[bucket];
+      shard->buckets[bucket] = entry;
+      shard->count++;
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_session_cache_get_or_create - Error allocating resources for entry");
+    }
+  }
+  return entry;
+}
+
+/**
+ * Returns the generation of the shard of a session id, must be read before reading the session in the database
+ */
+static unsigned int glewlwyd_session_cache_get_generation(struct config_elements * config, const char * session_uid) {
+  unsigned int generation = 0;
+
+  if (config->session_cache.initialized) {
+    generation = __atomic_load_n(&config->session_cache.shards[glewlwyd_session_cache_hash(session_uid)%GLWD_SESSION_CACHE_SHARDS].generation, __ATOMIC_ACQUIRE);
+  }
+  return generation;
+}
+
+/**
+ * Returns the cached username of the current user for the session, NULL if not in cache
+ * Returned value must be o_free'd after use
+ */
+static char * glewlwyd_session_cache_get_current_username(struct config_elements * config, const char * session_uid) {
+  struct _glwd_session_cache_shard * shard;
+  struct _glwd_session_cache_entry * entry;
+  unsigned int hash;
+  char * username = NULL;
+
+  if (config->session_cache.initialized) {
+    hash = glewlwyd_session_cache_hash(session_uid);
+    shard = &config->session_cache.shards[hash%GLWD_SESSION_CACHE_SHARDS];
+    if (!pthread_mutex_lock(&shard->lock)) {
+      if ((entry = glewlwyd_session_cache_lookup(shard, session_uid, hash, time(NULL))) != NULL) {
+        username = o_strdup(entry->current_username);
+      }
+      pthread_mutex_unlock(&shard->lock);
+    }
+  }
+  return username;
+}
+
+static void glewlwyd_session_cache_set_current_username(struct config_elements * config, unsigned int generation, const char * session_uid, const char * session_hash, const char * username, json_t * j_expiration) {
+  struct _glwd_session_cache_shard * shard;
+  struct _glwd_session_cache_entry * entry;
+  unsigned int hash;
+  time_t now = time(NULL), expiration = glewlwyd_session_cache_get_expiration(j_expiration);
+
+  if (config->session_cache.initialized && expiration > now) {
+    hash = glewlwyd_session_cache_hash(session_uid);
+    shard = &config->session_cache.shards[hash%GLWD_SESSION_CACHE_SHARDS];
+    if (!pthread_mutex_lock(&shard->lock)) {
+      if (shard->generation == generation && (entry = glewlwyd_session_cache_get_or_create(config, shard, session_uid, session_hash, hash, now)) != NULL) {
+        o_free(entry->current_username);
+        entry->current_username = o_strdup(username);
+        if (expiration < entry->expires_at) {
+          entry->expires_at = expiration;
+        }
+      }
+      pthread_mutex_unlock(&shard->lock);
+    }
+  }
+}
+
+/**
+ * Returns a copy of the cached session object for the username, NULL if not in cache
+ */
+static json_t * glewlwyd_session_cache_get_session(struct config_elements * config, const char * session_uid, const char * username) {
+  struct _glwd_session_cache_shard * shard;
+  struct _glwd_session_cache_entry * entry;
+  unsigned int hash;
+  json_t * j_session = NULL;
+
+  if (config->session_cache.initialized) {
+    hash = glewlwyd_session_cache_hash(session_uid);
+    shard = &config->session_cache.shards[hash%GLWD_SESSION_CACHE_SHARDS];
+    if (!pthread_mutex_lock(&shard->lock)) {
+      if ((entry = glewlwyd_session_cache_lookup(shard, session_uid, hash, time(NULL))) != NULL) {
+        j_session = json_deep_copy(json_object_get(entry->j_session, username));
+      }
+      pthread_mutex_unlock(&shard->lock);
+    }
+  }
+  return j_session;
+}
+
+static void glewlwyd_session_cache_set_session(struct config_elements * config, unsigned int generation, const char * session_uid, const char * session_hash, const char * username, json_t * j_session) {
+  struct _glwd_session_cache_shard * shard;
+  struct _glwd_session_cache_entry * entry;
+  unsigned int hash;
+  time_t now = time(NULL), expiration = glewlwyd_session_cache_get_expiration(json_object_get(j_session, "expiration")), scheme_expiration;
+  json_t * j_scheme;
+  size_t index;
+
+  json_array_foreach(json_object_get(j_session, "scheme"), index, j_scheme) {
+    scheme_expiration = glewlwyd_session_cache_get_expiration(json_object_get(j_scheme, "expiration"));
+    if (scheme_expiration < expiration) {
+      expiration = scheme_expiration;
+    }
+  }
+  if (config->session_cache.initialized && expiration > now) {
+    hash = glewlwyd_session_cache_hash(session_uid);
+    shard = &config->session_cache.shards[hash%GLWD_SESSION_CACHE_SHARDS];
+    if (!pthread_mutex_lock(&shard->lock)) {
+      if (shard->generation == generation && (entry = glewlwyd_session_cache_get_or_create(config, shard, session_uid, session_hash, hash, now)) != NULL) {
+        json_object_set_new(entry->j_session, username, json_deep_copy(j_session));
+        if (expiration < entry->expires_at) {
+          entry->expires_at = expiration;
+        }
+      }
+      pthread_mutex_unlock(&shard->lock);
+    }
+  }
+}
+
+int glewlwyd_session_cache_init(struct config_elements * config) {
+  size_t i;
+  int ret = G_OK;
+
+  if (config->session_cache.size && config->session_cache.max_age) {
+    for (i=0; i<GLWD_SESSION_CACHE_SHARDS; i++) {
+      memset(config->session_cache.shards[i].buckets, 0, sizeof(config->session_cache.shards[i].buckets));
+      config->session_cache.shards[i].count = 0;
+      if (pthread_mutex_init(&config->session_cache.shards[i].lock, NULL)) {
+        y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_session_cache_init - Error pthread_mutex_init");
+        ret = G_ERROR;
+        break;
+      }
+    }
+    if (ret == G_OK) {
+      config->session_cache.initialized = 1;
+    } else {
+      while (i--) {
+        pthread_mutex_destroy(&config->session_cache.shards[i].lock);
+      }
+    }
+  }
+  return ret;
+}
+
+/**
+ * Removes all the entries of the session cache
+ */
+void glewlwyd_session_cache_clear(struct config_elements * config) {
+  struct _glwd_session_cache_entry * entry;
+  size_t i, j;
+
+  if (config->session_cache.initialized) {
+    for (i=0; i<GLWD_SESSION_CACHE_SHARDS; i++) {
+      if (!pthread_mutex_lock(&config->session_cache.shards[i].lock)) {
+        for (j=0; j<GLWD_SESSION_CACHE_BUCKETS; j++) {
+          while ((entry = config->session_cache.shards[i].buckets[j]) != NULL) {
+            config->session_cache.shards[i].buckets[j] = entry->next;
+            glewlwyd_session_cache_free_entry(entry);
+          }
+        }
+        config->session_cache.shards[i].count = 0;
+        __atomic_add_fetch(&config->session_cache.shards[i].generation, 1, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&config->session_cache.shards[i].lock);
+      }
+    }
+  }
+}
+
+void glewlwyd_session_cache_close(struct config_elements * config) {
+  size_t i;
+
+  if (config->session_cache.initialized) {
+    glewlwyd_session_cache_clear(config);
+    for (i=0; i<GLWD_SESSION_CACHE_SHARDS; i++) {
+      pthread_mutex_destroy(&config->session_cache.shards[i].lock);
+    }
+    config->session_cache.initialized = 0;
+  }
+}
+
+/**
+ * Removes the entry of a session id from the session cache
+ */
+void glewlwyd_session_cache_invalidate(struct config_elements * config, const char * session_uid) {
+  struct _glwd_session_cache_shard * shard;
+  struct _glwd_session_cache_entry ** p_entry, * entry;
+  unsigned int hash;
+
+  if (config->session_cache.initialized && session_uid != NULL) {
+    hash = glewlwyd_session_cache_hash(session_uid);
+    shard = &config->session_cache.shards[hash%GLWD_SESSION_CACHE_SHARDS];
+    if (!pthread_mutex_lock(&shard->lock)) {
+      __atomic_add_fetch(&shard->generation, 1, __ATOMIC_RELEASE);
+      for (p_entry = &shard->buckets[(hash/GLWD_SESSION_CACHE_SHARDS)%GLWD_SESSION_CACHE_BUCKETS]; *p_entry != NULL; p_entry = &(*p_entry)->next) {
+        if ((*p_entry)->hash == hash && 0 == o_strcmp((*p_entry)->session_uid, session_uid)) {
+          entry = *p_entry;
+          *p_entry = entry->next;
+          glewlwyd_session_cache_free_entry(entry);
+          shard->count--;
+          break;
+        }
+      }
+      pthread_mutex_unlock(&shard->lock);
+    }
+  }
+}
+
+/**
+ * Removes the entry of a session hash from the session cache
+ * The session id is unknown so all the shards are scanned
+ */
+void glewlwyd_session_cache_invalidate_hash(struct config_elements * config, const char * session_hash) {
+  struct _glwd_session_cache_entry ** p_entry, * entry;
+  size_t i, j;
+
+  if (config->session_cache.initialized && session_hash != NULL) {
+    for (i=0; i<GLWD_SESSION_CACHE_SHARDS; i++) {
+      if (!pthread_mutex_lock(&config->session_cache.shards[i].lock)) {
+        __atomic_add_fetch(&config->session_cache.shards[i].generation, 1, __ATOMIC_RELEASE);
+        for (j=0; j<GLWD_SESSION_CACHE_BUCKETS; j++) {
+          p_entry = &config->session_cache.shards[i].buckets[j];
+          while (*p_entry != NULL) {
+            entry = *p_entry;
+            if (0 == o_strcmp(entry->session_hash, session_hash)) {
+              *p_entry = entry->next;
+              glewlwyd_session_cache_free_entry(entry);
+              config->session_cache.shards[i].count--;
+            } else {
+              p_entry = &entry->next;
+            }
+          }
+        }
+        pthread_mutex_unlock(&config->session_cache.shards[i].lock);
+      }
+    }
+  }
+}
+
 json_t * get_session_scheme(struct config_elements * config, json_int_t gus_id) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   json_t * j_query, * j_result, * j_return;
   int res;
   char * expire_clause;
   
-  if (config->conn->type==HOEL_DB_TYPE_MARIADB) {
+  if (conn->type==HOEL_DB_TYPE_MARIADB) {
     expire_clause = o_strdup("> NOW()");
-  } else if (config->conn->type==HOEL_DB_TYPE_PGSQL) {
+  } else if (conn->type==HOEL_DB_TYPE_PGSQL) {
     expire_clause = o_strdup("> NOW()");
   } else { // HOEL_DB_TYPE_SQLITE
     expire_clause = o_strdup("> (strftime('%s','now'))");
@@ -43,7 +403,7 @@ json_t * get_session_scheme(struct config_elements * config, json_int_t gus_id)
                       GLEWLWYD_TABLE_USER_SESSION_SCHEME,
                       "columns",
                         "guasmi_id",
-                        SWITCH_DB_TYPE(config->conn->type, "UNIX_TIMESTAMP(guss_expiration) AS expiration", "guss_expiration AS expiration", "EXTRACT(EPOCH FROM guss_expiration)::integer AS expiration"),
+                        SWITCH_DB_TYPE(conn->type, "UNIX_TIMESTAMP(guss_expiration) AS expiration", "guss_expiration AS expiration", "EXTRACT(EPOCH FROM guss_expiration)::integer AS expiration"),
                       "where",
                         "gus_id",
                         gus_id,
@@ -55,7 +415,7 @@ json_t * get_session_scheme(struct config_elements * config, json_int_t gus_id)
                           "value",
                           expire_clause);
   o_free(expire_clause);
-  res = h_select(config->conn, j_query, &j_result, NULL);
+  res = h_select(conn, j_query, &j_result, NULL);
   json_decref(j_query);
   if (res == H_OK) {
     j_return = json_pack("{siso}", "result", G_OK, "scheme", j_result);
@@ -63,18 +423,21 @@ json_t * get_session_scheme(struct config_elements * config, json_int_t gus_id)
     y_log_message(Y_LOG_LEVEL_ERROR, "get_session_scheme - Error executing j_query");
     j_return = json_pack("{si}", "result", G_ERROR_DB);
   }
+  glewlwyd_db_pool_release(config, conn);
   return j_return;
 }
 
-json_t * get_session_for_username(struct config_elements * config, const char * session_uid, const char * username) {
+static json_t * get_session_for_username_db(struct config_elements * config, const char * session_uid, const char * username) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   json_t * j_query, * j_result, * j_return, * j_session_scheme;
   int res;
+  unsigned int generation = glewlwyd_session_cache_get_generation(config, session_uid);
   char * expire_clause;
   char * session_uid_hash = generate_hash(config->hash_algorithm, session_uid);
 
-  if (config->conn->type==HOEL_DB_TYPE_MARIADB) {
+  if (conn->type==HOEL_DB_TYPE_MARIADB) {
     expire_clause = o_strdup("> NOW()");
-  } else if (config->conn->type==HOEL_DB_TYPE_PGSQL) {
+  } else if (conn->type==HOEL_DB_TYPE_PGSQL) {
     expire_clause = o_strdup("> NOW()");
   } else { // HOEL_DB_TYPE_SQLITE
     expire_clause = o_strdup("> (strftime('%s','now'))");
@@ -85,7 +448,7 @@ json_t * get_session_for_username(struct config_elements * config, const char *
                         GLEWLWYD_TABLE_USER_SESSION,
                         "columns",
                           "gus_id",
-                          SWITCH_DB_TYPE(config->conn->type, "UNIX_TIMESTAMP(gus_expiration) AS expiration", "gus_expiration AS expiration", "EXTRACT(EPOCH FROM gus_expiration)::integer AS expiration"),
+                          SWITCH_DB_TYPE(conn->type, "UNIX_TIMESTAMP(gus_expiration) AS expiration", "gus_expiration AS expiration", "EXTRACT(EPOCH FROM gus_expiration)::integer AS expiration"),
                         "where",
                           "gus_session_hash",
                           session_uid_hash,
@@ -99,7 +462,7 @@ json_t * get_session_for_username(struct config_elements * config, const char *
                             "value",
                             expire_clause);
     o_free(expire_clause);
-    res = h_select(config->conn, j_query, &j_result, NULL);
+    res = h_select(conn, j_query, &j_result, NULL);
     json_decref(j_query);
     if (res == H_OK) {
       if (json_array_size(j_result) > 0) {
@@ -117,6 +480,7 @@ json_t * get_session_for_username(struct config_elements * config, const char *
                                   json_object_get(j_session_scheme, "scheme"),
                                   "gus_id",
                                   json_integer_value(json_object_get(json_array_get(j_result, 0), "gus_id")));
+          glewlwyd_session_cache_set_session(config, generation, session_uid, session_uid_hash, username, json_object_get(j_return, "session"));
         } else {
           y_log_message(Y_LOG_LEVEL_ERROR, "get_session_for_username - Error get_session_scheme");
           j_return = json_pack("{si}", "result", G_ERROR);
@@ -135,19 +499,33 @@ json_t * get_session_for_username(struct config_elements * config, const char *
     y_log_message(Y_LOG_LEVEL_ERROR, "get_session_for_username - Error generate_hash");
     j_return = json_pack("{si}", "result", G_ERROR);
   }
+  glewlwyd_db_pool_release(config, conn);
+  return j_return;
+}
+
+json_t * get_session_for_username(struct config_elements * config, const char * session_uid, const char * username) {
+  json_t * j_session, * j_return;
+
+  if ((j_session = glewlwyd_session_cache_get_session(config, session_uid, username)) != NULL) {
+    j_return = json_pack("{sisO}", "result", G_OK, "session", j_session);
+    json_decref(j_session);
+  } else {
+    j_return = get_session_for_username_db(config, session_uid, username);
+  }
   return j_return;
 }
 
 json_t * get_users_for_session(struct config_elements * config, const char * session_uid) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   json_t * j_query, * j_result, * j_return, * j_element, * j_user, * j_session_array;
   int res;
   size_t index;
   char * expire_clause, * session_uid_hash;
 
   if (session_uid != NULL && o_strlen(session_uid)) {
-    if (config->conn->type==HOEL_DB_TYPE_MARIADB) {
+    if (conn->type==HOEL_DB_TYPE_MARIADB) {
       expire_clause = o_strdup("> NOW()");
-    } else if (config->conn->type==HOEL_DB_TYPE_PGSQL) {
+    } else if (conn->type==HOEL_DB_TYPE_PGSQL) {
       expire_clause = o_strdup("> NOW()");
     } else { // HOEL_DB_TYPE_SQLITE
       expire_clause = o_strdup("> (strftime('%s','now'))");
@@ -159,7 +537,7 @@ json_t * get_users_for_session(struct config_elements * config, const char * ses
                           GLEWLWYD_TABLE_USER_SESSION,
                           "columns",
                             "gus_username",
-                            SWITCH_DB_TYPE(config->conn->type, "UNIX_TIMESTAMP(gus_last_login) AS last_login", "gus_last_login AS last_login", "EXTRACT(EPOCH FROM gus_last_login)::integer AS last_login"),
+                            SWITCH_DB_TYPE(conn->type, "UNIX_TIMESTAMP(gus_last_login) AS last_login", "gus_last_login AS last_login", "EXTRACT(EPOCH FROM gus_last_login)::integer AS last_login"),
                           "where",
                             "gus_session_hash",
                             session_uid_hash,
@@ -174,7 +552,7 @@ json_t * get_users_for_session(struct config_elements * config, const char * ses
                           "gus_current DESC");
       o_free(expire_clause);
       o_free(session_uid_hash);
-      res = h_select(config->conn, j_query, &j_result, NULL);
+      res = h_select(conn, j_query, &j_result, NULL);
       json_decref(j_query);
       if (res == H_OK) {
         if (json_array_size(j_result) > 0) {
@@ -215,18 +593,21 @@ json_t * get_users_for_session(struct config_elements * config, const char * ses
   } else {
     j_return = json_pack("{si}", "result", G_ERROR_NOT_FOUND);
   }
+  glewlwyd_db_pool_release(config, conn);
   return j_return;
 }
 
-json_t * get_current_user_for_session(struct config_elements * config, const char * session_uid) {
+static json_t * get_current_user_for_session_db(struct config_elements * config, const char * session_uid) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   json_t * j_query, * j_result, * j_return;
   int res;
+  unsigned int generation = glewlwyd_session_cache_get_generation(config, session_uid);
   char * expire_clause, * session_uid_hash;
 
   if (o_strlen(session_uid)) {
-    if (config->conn->type==HOEL_DB_TYPE_MARIADB) {
+    if (conn->type==HOEL_DB_TYPE_MARIADB) {
       expire_clause = o_strdup("> NOW()");
-    } else if (config->conn->type==HOEL_DB_TYPE_PGSQL) {
+    } else if (conn->type==HOEL_DB_TYPE_PGSQL) {
       expire_clause = o_strdup("> NOW()");
     } else { // HOEL_DB_TYPE_SQLITE
       expire_clause = o_strdup("> (strftime('%s','now'))");
@@ -238,7 +619,7 @@ json_t * get_current_user_for_session(struct config_elements * config, const cha
                           GLEWLWYD_TABLE_USER_SESSION,
                           "columns",
                             "gus_username",
-                            SWITCH_DB_TYPE(config->conn->type, "UNIX_TIMESTAMP(gus_expiration) AS expiration", "gus_expiration AS expiration", "EXTRACT(EPOCH FROM gus_expiration)::integer AS expiration"),
+                            SWITCH_DB_TYPE(conn->type, "UNIX_TIMESTAMP(gus_expiration) AS expiration", "gus_expiration AS expiration", "EXTRACT(EPOCH FROM gus_expiration)::integer AS expiration"),
                           "where",
                             "gus_session_hash",
                             session_uid_hash,
@@ -255,10 +636,11 @@ json_t * get_current_user_for_session(struct config_elements * config, const cha
                           "gus_current DESC",
                           "limit",
                           1);
-      res = h_select(config->conn, j_query, &j_result, NULL);
+      res = h_select(conn, j_query, &j_result, NULL);
       json_decref(j_query);
       if (res == H_OK) {
         if (json_array_size(j_result) > 0) {
+          glewlwyd_session_cache_set_current_username(config, generation, session_uid, session_uid_hash, json_string_value(json_object_get(json_array_get(j_result, 0), "gus_username")), json_object_get(json_array_get(j_result, 0), "expiration"));
           j_return = get_user(config, json_string_value(json_object_get(json_array_get(j_result, 0), "gus_username")), NULL);
         } else {
           j_return = json_pack("{si}", "result", G_ERROR_NOT_FOUND);
@@ -279,17 +661,34 @@ json_t * get_current_user_for_session(struct config_elements * config, const cha
   } else {
     j_return = json_pack("{si}", "result", G_ERROR_NOT_FOUND);
   }
+  glewlwyd_db_pool_release(config, conn);
+  return j_return;
+}
+
+json_t * get_current_user_for_session(struct config_elements * config, const char * session_uid) {
+  json_t * j_return;
+  char * username;
+
+  if (o_strlen(session_uid) && (username = glewlwyd_session_cache_get_current_username(config, session_uid)) != NULL) {
+    j_return = get_user(config, username, NULL);
+    o_free(username);
+  } else {
+    j_return = get_current_user_for_session_db(config, session_uid);
+  }
   return j_return;
 }
 
 int user_session_update(struct config_elements * config, const char * session_uid, const char * user_agent, const char * issued_for, const char * username, const char * scheme_name, int update_login) {
-  json_t * j_query, * j_session = get_session_for_username(config, session_uid, username);
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
+  json_t * j_query, * j_session;
   struct _user_auth_scheme_module_instance * scheme_instance = NULL;
   int res, ret;
   time_t now;
   char * expiration_clause, * last_login_clause;
   char * session_uid_hash = generate_hash(config->hash_algorithm, session_uid);
   
+  glewlwyd_session_cache_invalidate(config, session_uid);
+  j_session = get_session_for_username_db(config, session_uid, username);
   time(&now);
   if (session_uid_hash != NULL) {
     if (check_result_value(j_session, G_ERROR_NOT_FOUND)) {
@@ -302,7 +701,7 @@ int user_session_update(struct config_elements * config, const char * session_ui
                           "where",
                             "gus_session_hash",
                             session_uid_hash);
-      res = h_update(config->conn, j_query, NULL);
+      res = h_update(conn, j_query, NULL);
       json_decref(j_query);
       if (res == H_OK) {
         // Create session for user if not exist
@@ -321,16 +720,16 @@ int user_session_update(struct config_elements * config, const char * session_ui
                               "gus_current",
                               1);
         if (update_login) {
-          if (config->conn->type==HOEL_DB_TYPE_MARIADB) {
+          if (conn->type==HOEL_DB_TYPE_MARIADB) {
             expiration_clause = msprintf("FROM_UNIXTIME(%u)", (now + config->session_expiration));
-          } else if (config->conn->type==HOEL_DB_TYPE_PGSQL) {
+          } else if (conn->type==HOEL_DB_TYPE_PGSQL) {
             expiration_clause = msprintf("TO_TIMESTAMP(%u)", (now + config->session_expiration));
           } else { // HOEL_DB_TYPE_SQLITE
             expiration_clause = msprintf("%u", (now + config->session_expiration));
           }
-          if (config->conn->type==HOEL_DB_TYPE_MARIADB) {
+          if (conn->type==HOEL_DB_TYPE_MARIADB) {
             last_login_clause = msprintf("FROM_UNIXTIME(%u)", (now));
-          } else if (config->conn->type==HOEL_DB_TYPE_PGSQL) {
+          } else if (conn->type==HOEL_DB_TYPE_PGSQL) {
             last_login_clause = msprintf("TO_TIMESTAMP(%u)", (now));
           } else { // HOEL_DB_TYPE_SQLITE
             last_login_clause = msprintf("%u", (now));
@@ -340,11 +739,11 @@ int user_session_update(struct config_elements * config, const char * session_ui
           o_free(last_login_clause);
           o_free(expiration_clause);
         }
-        res = h_insert(config->conn, j_query, NULL);
+        res = h_insert(conn, j_query, NULL);
         json_decref(j_query);
         json_decref(j_session);
         if (res == H_OK) {
-          j_session = get_session_for_username(config, session_uid, username);
+          j_session = get_session_for_username_db(config, session_uid, username);
         } else {
           y_log_message(Y_LOG_LEVEL_ERROR, "user_session_update - Error h_insert session");
           j_session = json_pack("{si}", "result", G_ERROR_DB);
@@ -363,7 +762,7 @@ int user_session_update(struct config_elements * config, const char * session_ui
                           "where",
                             "gus_session_hash",
                             session_uid_hash);
-      res = h_update(config->conn, j_query, NULL);
+      res = h_update(conn, j_query, NULL);
       json_decref(j_query);
       if (res == H_OK) {
         j_query = json_pack("{sss{sssi}s{ssss}}",
@@ -381,16 +780,16 @@ int user_session_update(struct config_elements * config, const char * session_ui
                               username);
         if (update_login) {
           // Refresh session for user
-          if (config->conn->type==HOEL_DB_TYPE_MARIADB) {
+          if (conn->type==HOEL_DB_TYPE_MARIADB) {
             expiration_clause = msprintf("FROM_UNIXTIME(%u)", (now + config->session_expiration));
-          } else if (config->conn->type==HOEL_DB_TYPE_PGSQL) {
+          } else if (conn->type==HOEL_DB_TYPE_PGSQL) {
             expiration_clause = msprintf("TO_TIMESTAMP(%u)", (now + config->session_expiration));
           } else { // HOEL_DB_TYPE_SQLITE
             expiration_clause = msprintf("%u", (now + config->session_expiration));
           }
-          if (config->conn->type==HOEL_DB_TYPE_MARIADB) {
+          if (conn->type==HOEL_DB_TYPE_MARIADB) {
             last_login_clause = msprintf("FROM_UNIXTIME(%u)", (now));
-          } else if (config->conn->type==HOEL_DB_TYPE_PGSQL) {
+          } else if (conn->type==HOEL_DB_TYPE_PGSQL) {
             last_login_clause = msprintf("TO_TIMESTAMP(%u)", (now));
           } else { // HOEL_DB_TYPE_SQLITE
             last_login_clause = msprintf("%u", (now));
@@ -400,11 +799,11 @@ int user_session_update(struct config_elements * config, const char * session_ui
           o_free(last_login_clause);
           o_free(expiration_clause);
         }
-        res = h_update(config->conn, j_query, NULL);
+        res = h_update(conn, j_query, NULL);
         json_decref(j_query);
         json_decref(j_session);
         if (res == H_OK) {
-          j_session = get_session_for_username(config, session_uid, username);
+          j_session = get_session_for_username_db(config, session_uid, username);
         } else {
           y_log_message(Y_LOG_LEVEL_ERROR, "user_session_update - Error h_update session (2)");
           j_session = json_pack("{si}", "result", G_ERROR_DB);
@@ -431,13 +830,13 @@ int user_session_update(struct config_elements * config, const char * session_ui
                                   json_object_get(json_object_get(j_session, "session"), "gus_id"),
                                   "guasmi_id",
                                   scheme_instance->guasmi_id);
-            res = h_update(config->conn, j_query, NULL);
+            res = h_update(conn, j_query, NULL);
             json_decref(j_query);
             if (res == H_OK) {
               // Set session scheme for this scheme with the timeout
-              if (config->conn->type==HOEL_DB_TYPE_MARIADB) {
+              if (conn->type==HOEL_DB_TYPE_MARIADB) {
                 expiration_clause = msprintf("FROM_UNIXTIME(%u)", (now + (unsigned int)scheme_instance->guasmi_expiration));
-              } else if (config->conn->type==HOEL_DB_TYPE_PGSQL) {
+              } else if (conn->type==HOEL_DB_TYPE_PGSQL) {
                 expiration_clause = msprintf("TO_TIMESTAMP(%u)", (now + (unsigned int)scheme_instance->guasmi_expiration));
               } else { // HOEL_DB_TYPE_SQLITE
                 expiration_clause = msprintf("%u", (now + (unsigned int)scheme_instance->guasmi_expiration));
@@ -454,9 +853,9 @@ int user_session_update(struct config_elements * config, const char * session_ui
                                       "raw",
                                       expiration_clause);
               if (update_login) {
-                if (config->conn->type==HOEL_DB_TYPE_MARIADB) {
+                if (conn->type==HOEL_DB_TYPE_MARIADB) {
                   last_login_clause = msprintf("FROM_UNIXTIME(%u)", (now));
-                } else if (config->conn->type==HOEL_DB_TYPE_PGSQL) {
+                } else if (conn->type==HOEL_DB_TYPE_PGSQL) {
                   last_login_clause = msprintf("TO_TIMESTAMP(%u)", (now));
                 } else { // HOEL_DB_TYPE_SQLITE
                   last_login_clause = msprintf("%u", (now));
@@ -465,7 +864,7 @@ int user_session_update(struct config_elements * config, const char * session_ui
                 o_free(last_login_clause);
               }
               o_free(expiration_clause);
-              res = h_insert(config->conn, j_query, NULL);
+              res = h_insert(conn, j_query, NULL);
               json_decref(j_query);
               if (res == H_OK) {
                 ret = G_OK;
@@ -492,13 +891,13 @@ int user_session_update(struct config_elements * config, const char * session_ui
                                 "gus_id",
                                 json_object_get(json_object_get(j_session, "session"), "gus_id"),
                                 "guasmi_id");
-          res = h_update(config->conn, j_query, NULL);
+          res = h_update(conn, j_query, NULL);
           json_decref(j_query);
           if (res == H_OK) {
             // Set session scheme password with the timeout
-            if (config->conn->type==HOEL_DB_TYPE_MARIADB) {
+            if (conn->type==HOEL_DB_TYPE_MARIADB) {
               expiration_clause = msprintf("FROM_UNIXTIME(%u)", (now + GLEWLWYD_RESET_PASSWORD_DEFAULT_SESSION_EXPIRATION));
-            } else if (config->conn->type==HOEL_DB_TYPE_PGSQL) {
+            } else if (conn->type==HOEL_DB_TYPE_PGSQL) {
               expiration_clause = msprintf("TO_TIMESTAMP(%u)", (now + GLEWLWYD_RESET_PASSWORD_DEFAULT_SESSION_EXPIRATION));
             } else { // HOEL_DB_TYPE_SQLITE
               expiration_clause = msprintf("%u", (now + GLEWLWYD_RESET_PASSWORD_DEFAULT_SESSION_EXPIRATION));
@@ -514,9 +913,9 @@ int user_session_update(struct config_elements * config, const char * session_ui
                                     "raw",
                                     expiration_clause);
             if (update_login) {
-              if (config->conn->type==HOEL_DB_TYPE_MARIADB) {
+              if (conn->type==HOEL_DB_TYPE_MARIADB) {
                 last_login_clause = msprintf("FROM_UNIXTIME(%u)", (now));
-              } else if (config->conn->type==HOEL_DB_TYPE_PGSQL) {
+              } else if (conn->type==HOEL_DB_TYPE_PGSQL) {
                 last_login_clause = msprintf("TO_TIMESTAMP(%u)", (now));
               } else { // HOEL_DB_TYPE_SQLITE
                 last_login_clause = msprintf("%u", (now));
@@ -525,7 +924,7 @@ int user_session_update(struct config_elements * config, const char * session_ui
               o_free(last_login_clause);
             }
             o_free(expiration_clause);
-            res = h_insert(config->conn, j_query, NULL);
+            res = h_insert(conn, j_query, NULL);
             json_decref(j_query);
             if (res == H_OK) {
               ret = G_OK;
@@ -550,15 +949,20 @@ int user_session_update(struct config_elements * config, const char * session_ui
     y_log_message(Y_LOG_LEVEL_ERROR, "user_session_update - Error generate_hash");
     ret = G_ERROR;
   }
+  // The session schemes have changed after the last read
+  glewlwyd_session_cache_invalidate(config, session_uid);
   json_decref(j_session);
+  glewlwyd_db_pool_release(config, conn);
   return ret;
 }
 
 int user_session_delete(struct config_elements * config, const char * session_uid, const char * username) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   json_t * j_query;
   int res, ret;
   char * session_uid_hash = generate_hash(config->hash_algorithm, session_uid);
 
+  glewlwyd_session_cache_invalidate(config, session_uid);
   if (session_uid_hash != NULL) {
     j_query = json_pack("{sss{sisi}s{ss}}",
                         "table",
@@ -574,7 +978,7 @@ int user_session_delete(struct config_elements * config, const char * session_ui
     if (username != NULL) {
       json_object_set_new(json_object_get(j_query, "where"), "gus_username", json_string(username));
     }
-    res = h_update(config->conn, j_query, NULL);
+    res = h_update(conn, j_query, NULL);
     json_decref(j_query);
     if (res == H_OK) {
       if (username != NULL) {
@@ -590,7 +994,7 @@ int user_session_delete(struct config_elements * config, const char * session_ui
                               "gus_session_hash",
                               session_uid_hash,
                             "limit", 1);
-        res = h_update(config->conn, j_query, NULL);
+        res = h_update(conn, j_query, NULL);
         json_decref(j_query);
         if (res == H_OK) {
           ret = G_OK;
@@ -610,6 +1014,9 @@ int user_session_delete(struct config_elements * config, const char * session_ui
     y_log_message(Y_LOG_LEVEL_ERROR, "user_session_delete - Error generate_hash");
     ret = G_ERROR;
   }
+  // A concurrent read may have cached the session again before the update
+  glewlwyd_session_cache_invalidate(config, session_uid);
+  glewlwyd_db_pool_release(config, conn);
   return ret;
 }
 
@@ -628,6 +1035,7 @@ char * generate_session_id() {
 }
 
 json_t * get_user_session_list(struct config_elements * config, const char * username, const char * pattern, size_t offset, size_t limit, const char * sort) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   json_t * j_query, * j_result, * j_return, * j_element;
   int res;
   size_t index, session_hash_url_len = 0;
@@ -641,8 +1049,8 @@ json_t * get_user_session_list(struct config_elements * config, const char * use
                         "gus_session_hash",
                         "gus_user_agent AS user_agent",
                         "gus_issued_for AS issued_for",
-                        SWITCH_DB_TYPE(config->conn->type, "UNIX_TIMESTAMP(gus_expiration) AS expiration", "gus_expiration AS expiration", "EXTRACT(EPOCH FROM gus_expiration)::integer AS expiration"),
-                        SWITCH_DB_TYPE(config->conn->type, "UNIX_TIMESTAMP(gus_last_login) AS last_login", "gus_last_login AS last_login", "EXTRACT(EPOCH FROM gus_last_login)::integer AS last_login"),
+                        SWITCH_DB_TYPE(conn->type, "UNIX_TIMESTAMP(gus_expiration) AS expiration", "gus_expiration AS expiration", "EXTRACT(EPOCH FROM gus_expiration)::integer AS expiration"),
+                        SWITCH_DB_TYPE(conn->type, "UNIX_TIMESTAMP(gus_last_login) AS last_login", "gus_last_login AS last_login", "EXTRACT(EPOCH FROM gus_last_login)::integer AS last_login"),
                         "gus_enabled",
                       "where",
                         "gus_username",
@@ -657,13 +1065,13 @@ json_t * get_user_session_list(struct config_elements * config, const char * use
     json_object_set_new(j_query, "order_by", json_string(sort));
   }
   if (pattern != NULL) {
-    pattern_escaped = h_escape_string_with_quotes(config->conn, pattern);
+    pattern_escaped = h_escape_string_with_quotes(conn, pattern);
     pattern_clause = msprintf("IN (SELECT gus_id FROM "GLEWLWYD_TABLE_USER_SESSION" WHERE gus_user_agent LIKE '%%'||%s||'%%' OR gus_issued_for LIKE '%%'||%s||'%%')", pattern_escaped, pattern_escaped);
     json_object_set_new(json_object_get(j_query, "where"), "gus_id", json_pack("{ssss}", "operator", "raw", "value", pattern_clause));
     o_free(pattern_clause);
     o_free(pattern_escaped);
   }
-  res = h_select(config->conn, j_query, &j_result, NULL);
+  res = h_select(conn, j_query, &j_result, NULL);
   json_decref(j_query);
   if (res == H_OK) {
     json_array_foreach(j_result, index, j_element) {
@@ -683,10 +1091,12 @@ json_t * get_user_session_list(struct config_elements * config, const char * use
     y_log_message(Y_LOG_LEVEL_ERROR, "user_session_delete - Error executing j_query");
     j_return = json_pack("{si}", "result", G_ERROR_DB);
   }
+  glewlwyd_db_pool_release(config, conn);
   return j_return;
 }
 
 int delete_user_session_from_hash(struct config_elements * config, const char * username, const char * session_hash) {
+  struct _h_connection * conn = glewlwyd_db_pool_acquire(config);
   json_t * j_query, * j_result;
   int res, ret;
   unsigned char session_hash_dec[128];
@@ -704,7 +1114,7 @@ int delete_user_session_from_hash(struct config_elements * config, const char *
                           session_hash_dec_len,
                           "gus_username",
                           username);
-    res = h_select(config->conn, j_query, &j_result, NULL);
+    res = h_select(conn, j_query, &j_result, NULL);
     json_decref(j_query);
     if (res == H_OK) {
       if (json_array_size(j_result)) {
@@ -717,9 +1127,15 @@ int delete_user_session_from_hash(struct config_elements * config, const char *
                             "where",
                               "gus_id",
                               json_object_get(json_array_get(j_result, 0), "gus_id"));
-        res = h_update(config->conn, j_query, NULL);
+        res = h_update(conn, j_query, NULL);
         json_decref(j_query);
         if (res == H_OK) {
+          if (session_hash_dec_len < sizeof(session_hash_dec)) {
+            session_hash_dec[session_hash_dec_len] = '\0';
+            glewlwyd_session_cache_invalidate_hash(config, (const char *)session_hash_dec);
+          } else {
+            glewlwyd_session_cache_clear(config);
+          }
           ret = G_OK;
         } else {
           y_log_message(Y_LOG_LEVEL_ERROR, "delete_user_session_from_hash - Error executing j_query (2)");
@@ -737,6 +1153,7 @@ int delete_user_session_from_hash(struct config_elements * config, const char *
     y_log_message(Y_LOG_LEVEL_ERROR, "delete_user_session_from_hash - Error o_base64url_2_base64");
     ret = G_ERROR_PARAM;
   }
+  glewlwyd_db_pool_release(config, conn);
   return ret;
 }
 
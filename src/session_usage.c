@@ -0,0 +1,299 @@
+/**
+ *
+ * Glewlwyd SSO Server
+ *
+ * Authentiation server
+ * Users are authenticated via various backend available: database, ldap
+ * Using various authentication methods available: password, OTP, send code, etc.
+ *
+ * Session schemes use counters write-behind functions definitions
+ *
+ * Copyright 2016-2021 Nicolas Mora <mail@babelouest.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU GENERAL PUBLIC LICENSE
+ * License as published by the Free Software Foundation;
+ * version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU GENERAL PUBLIC LICENSE for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <time.h>
+
+#include "glewlwyd.h"
+
+#define GLEWLWYD_SESSION_USAGE_MAX_PENDING 10000
+#define GLEWLWYD_SESSION_USAGE_BATCH_SIZE  100
+
+/**
+ * Writes the use counters of a list of sessions with the same scheme and the same increment in one query
+ */
+static int glewlwyd_session_usage_update(struct _h_connection * conn, const char * key_scheme, const char * increment, json_t * j_session_list) {
+  json_t * j_query, * j_session = NULL;
+  char * session_clause = NULL, * hash_escaped, * username_escaped, * counter_clause;
+  size_t index = 0;
+  int res, ret;
+
+  json_array_foreach(j_session_list, index, j_session) {
+    hash_escaped = h_escape_string_with_quotes(conn, json_string_value(json_object_get(j_session, "session_hash")));
+    username_escaped = h_escape_string_with_quotes(conn, json_string_value(json_object_get(j_session, "username")));
+    if (session_clause == NULL) {
+      session_clause = msprintf("IN (SELECT gus_id FROM " GLEWLWYD_TABLE_USER_SESSION " WHERE gus_enabled=1 AND gus_current=1 AND gus_expiration %s AND ((gus_session_hash=%s AND gus_username=%s)", SWITCH_DB_TYPE(conn->type, "> NOW()", "> (strftime('%s','now'))", "> NOW()"), hash_escaped, username_escaped);
+    } else {
+      session_clause = mstrcatf(session_clause, " OR (gus_session_hash=%s AND gus_username=%s)", hash_escaped, username_escaped);
+    }
+    o_free(hash_escaped);
+    o_free(username_escaped);
+  }
+  session_clause = mstrcatf(session_clause, "))");
+  counter_clause = msprintf("(guss_use_counter + %s)", increment);
+  j_query = json_pack("{sss{s{ss}}s{sos{ssss}sis{ssss}}}",
+                      "table",
+                      GLEWLWYD_TABLE_USER_SESSION_SCHEME,
+                      "set",
+                        "guss_use_counter",
+                          "raw",
+                          counter_clause,
+                      "where",
+                        "guasmi_id",
+                        0==o_strcmp("0", key_scheme)?json_null():json_integer(strtoll(key_scheme, NULL, 10)),
+                        "gus_id",
+                          "operator",
+                          "raw",
+                          "value",
+                          session_clause,
+                        "guss_enabled",
+                        1,
+                        "guss_expiration",
+                          "operator",
+                          "raw",
+                          "value",
+                          SWITCH_DB_TYPE(conn->type, "> NOW()", "> (strftime('%s','now'))", "> NOW()"));
+  o_free(counter_clause);
+  o_free(session_clause);
+  res = h_update(conn, j_query, NULL);
+  json_decref(j_query);
+  if (res == H_OK) {
+    ret = G_OK;
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_session_usage_update - Error executing j_query");
+    ret = G_ERROR_DB;
+  }
+  return ret;
+}
+
+/**
+ * Writes the pending use counters in the database
+ * The sessions with the same scheme and the same increment are updated together,
+ * by batches of GLEWLWYD_SESSION_USAGE_BATCH_SIZE sessions
+ */
+static void glewlwyd_session_usage_flush(struct config_elements * config) {
+  struct _glwd_session_usage * session_usage = &config->session_usage;
+  struct _h_connection * conn;
+  json_t * j_flushing = NULL, * j_sessions = NULL, * j_session = NULL, * j_groups, * j_group = NULL, * j_batch;
+  const char * key_scheme = NULL, * key_session = NULL, * key_count = NULL;
+  char * count;
+  size_t index = 0;
+
+  if (!pthread_mutex_lock(&session_usage->lock)) {
+    if (session_usage->nb_pending) {
+      // The counters being written are still counted by glewlwyd_session_usage_get_pending until the end of the flush
+      j_flushing = session_usage->j_pending;
+      session_usage->j_pending = json_object();
+      session_usage->j_flushing = json_incref(j_flushing);
+      session_usage->nb_pending = 0;
+    }
+    pthread_mutex_unlock(&session_usage->lock);
+  }
+  if (j_flushing != NULL) {
+    conn = glewlwyd_db_pool_acquire(config);
+    json_object_foreach(j_flushing, key_scheme, j_sessions) {
+      j_groups = json_object();
+      json_object_foreach(j_sessions, key_session, j_session) {
+        count = msprintf("%" JSON_INTEGER_FORMAT, json_integer_value(json_object_get(j_session, "count")));
+        if (json_object_get(j_groups, count) == NULL) {
+          json_object_set_new(j_groups, count, json_array());
+        }
+        json_array_append(json_object_get(j_groups, count), j_session);
+        o_free(count);
+      }
+      json_object_foreach(j_groups, key_count, j_group) {
+        j_batch = json_array();
+        json_array_foreach(j_group, index, j_session) {
+          json_array_append(j_batch, j_session);
+          if (json_array_size(j_batch) == GLEWLWYD_SESSION_USAGE_BATCH_SIZE || index == json_array_size(j_group)-1) {
+            if (glewlwyd_session_usage_update(conn, key_scheme, key_count, j_batch) != G_OK) {
+              y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_session_usage_flush - Error glewlwyd_session_usage_update, %zu use counters lost", json_array_size(j_batch));
+            }
+            json_array_clear(j_batch);
+          }
+        }
+        json_decref(j_batch);
+      }
+      json_decref(j_groups);
+    }
+    glewlwyd_db_pool_release(config, conn);
+    if (!pthread_mutex_lock(&session_usage->lock)) {
+      json_decref(session_usage->j_flushing);
+      session_usage->j_flushing = NULL;
+      pthread_mutex_unlock(&session_usage->lock);
+    }
+    json_decref(j_flushing);
+  }
+}
+
+/**
+ * Worker thread, flushes the pending use counters every flush_interval seconds,
+ * or sooner if GLEWLWYD_SESSION_USAGE_MAX_PENDING sessions are pending
+ * The remaining counters are flushed when the thread is stopped
+ */
+static void * glewlwyd_session_usage_run(void * args) {
+  struct config_elements * config = (struct config_elements *)args;
+  struct _glwd_session_usage * session_usage = &config->session_usage;
+  struct timespec abstime;
+  int end = 0;
+
+  while (!end) {
+    if (!pthread_mutex_lock(&session_usage->lock)) {
+      if (!session_usage->stop && session_usage->nb_pending < GLEWLWYD_SESSION_USAGE_MAX_PENDING) {
+        clock_gettime(CLOCK_REALTIME, &abstime);
+        abstime.tv_sec += session_usage->flush_interval;
+        pthread_cond_timedwait(&session_usage->cond, &session_usage->lock, &abstime);
+      }
+      end = session_usage->stop;
+      pthread_mutex_unlock(&session_usage->lock);
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_session_usage_run - Error lock");
+      end = 1;
+    }
+    glewlwyd_session_usage_flush(config);
+  }
+  return NULL;
+}
+
+int glewlwyd_session_usage_init(struct config_elements * config) {
+  struct _glwd_session_usage * session_usage = &config->session_usage;
+  int ret = G_OK;
+
+  session_usage->initialized = 0;
+  session_usage->stop = 0;
+  session_usage->nb_pending = 0;
+  session_usage->j_pending = NULL;
+  session_usage->j_flushing = NULL;
+  if (session_usage->flush_interval) {
+    if (!pthread_mutex_init(&session_usage->lock, NULL)) {
+      if (!pthread_cond_init(&session_usage->cond, NULL)) {
+        session_usage->j_pending = json_object();
+        if (!pthread_create(&session_usage->thread, NULL, glewlwyd_session_usage_run, (void *)config)) {
+          session_usage->initialized = 1;
+        } else {
+          y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_session_usage_init - Error pthread_create");
+          json_decref(session_usage->j_pending);
+          session_usage->j_pending = NULL;
+          pthread_cond_destroy(&session_usage->cond);
+          pthread_mutex_destroy(&session_usage->lock);
+          ret = G_ERROR;
+        }
+      } else {
+        y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_session_usage_init - Error initializing cond");
+        pthread_mutex_destroy(&session_usage->lock);
+        ret = G_ERROR;
+      }
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_session_usage_init - Error initializing lock");
+      ret = G_ERROR;
+    }
+  }
+  return ret;
+}
+
+/**
+ * Stops the worker thread after the pending use counters are written in the database
+ */
+void glewlwyd_session_usage_close(struct config_elements * config) {
+  struct _glwd_session_usage * session_usage = &config->session_usage;
+
+  if (session_usage->initialized) {
+    if (!pthread_mutex_lock(&session_usage->lock)) {
+      session_usage->stop = 1;
+      pthread_cond_signal(&session_usage->cond);
+      pthread_mutex_unlock(&session_usage->lock);
+    }
+    pthread_join(session_usage->thread, NULL);
+    json_decref(session_usage->j_pending);
+    session_usage->j_pending = NULL;
+    pthread_cond_destroy(&session_usage->cond);
+    pthread_mutex_destroy(&session_usage->lock);
+    session_usage->initialized = 0;
+  }
+}
+
+/**
+ * Increments the use counter of a scheme for a session, the counter is written later in the database
+ * guasmi_id is 0 for the password scheme
+ * Returns G_ERROR_PARAM if the write-behind is disabled, then the caller must update the database itself
+ */
+int glewlwyd_session_usage_add(struct config_elements * config, const char * session_hash, const char * username, json_int_t guasmi_id) {
+  struct _glwd_session_usage * session_usage = &config->session_usage;
+  json_t * j_sessions, * j_session;
+  char * key_scheme, * key_session;
+  int ret;
+
+  if (session_usage->initialized && o_strlen(session_hash) && o_strlen(username)) {
+    key_scheme = msprintf("%" JSON_INTEGER_FORMAT, guasmi_id);
+    key_session = msprintf("%s:%s", session_hash, username);
+    if (!pthread_mutex_lock(&session_usage->lock)) {
+      if ((j_sessions = json_object_get(session_usage->j_pending, key_scheme)) == NULL) {
+        j_sessions = json_object();
+        json_object_set_new(session_usage->j_pending, key_scheme, j_sessions);
+      }
+      if ((j_session = json_object_get(j_sessions, key_session)) == NULL) {
+        json_object_set_new(j_sessions, key_session, json_pack("{sssssi}", "session_hash", session_hash, "username", username, "count", 1));
+        if (++session_usage->nb_pending >= GLEWLWYD_SESSION_USAGE_MAX_PENDING) {
+          pthread_cond_signal(&session_usage->cond);
+        }
+      } else {
+        json_object_set_new(j_session, "count", json_integer(json_integer_value(json_object_get(j_session, "count"))+1));
+      }
+      pthread_mutex_unlock(&session_usage->lock);
+      ret = G_OK;
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_session_usage_add - Error lock");
+      ret = G_ERROR;
+    }
+    o_free(key_scheme);
+    o_free(key_session);
+  } else {
+    ret = G_ERROR_PARAM;
+  }
+  return ret;
+}
+
+/**
+ * Returns the number of uses of a scheme for a session not written in the database yet
+ */
+json_int_t glewlwyd_session_usage_get_pending(struct config_elements * config, const char * session_hash, const char * username, json_int_t guasmi_id) {
+  struct _glwd_session_usage * session_usage = &config->session_usage;
+  char * key_scheme, * key_session;
+  json_int_t pending = 0;
+
+  if (session_usage->initialized && o_strlen(session_hash) && o_strlen(username)) {
+    key_scheme = msprintf("%" JSON_INTEGER_FORMAT, guasmi_id);
+    key_session = msprintf("%s:%s", session_hash, username);
+    if (!pthread_mutex_lock(&session_usage->lock)) {
+      pending = json_integer_value(json_object_get(json_object_get(json_object_get(session_usage->j_pending, key_scheme), key_session), "count")) +
+                json_integer_value(json_object_get(json_object_get(json_object_get(session_usage->j_flushing, key_scheme), key_session), "count"));
+      pthread_mutex_unlock(&session_usage->lock);
+    }
+    o_free(key_scheme);
+    o_free(key_session);
+  }
+  return pending;
+}
@@ -39,6 +39,10 @@
  * `lock`: mutex lock (do not touch this variable)
  * `gzip_files`: a `struct _u_map` containing cached gzip files
  * `deflate_files`: a `struct _u_map` containing cached deflate files
+ * `max_age`: max-age value of the Cache-Control header of the preloaded files, 0 means no-cache (default 0)
+ * `assets`: table of the files preloaded by u_load_compressed_inmemory_website (do not touch this variable)
+ * `assets_lock`: read-write lock of assets (do not touch this variable)
+ * `watch_*`: inotify watcher started by u_watch_compressed_inmemory_website (do not touch these variables)
  * 
  * example of mime-types used in Hutch:
  * {
@@ -90,7 +94,15 @@
 #include <pthread.h>
 #include <zlib.h>
 #include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
 #include <ulfius.h>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
 
 #include "static_compressed_inmemory_website_callback.h"
 
@@ -109,6 +121,12 @@
 
 #define CHUNK 0x4000
 
+#define U_PRELOAD_MAX_SIZE     (16*1024*1024)
+#define U_WATCH_POLL_TIMEOUT   1000
+#define U_WATCH_EVENTS_SIZE    4096
+#define U_IF_NONE_MATCH        "If-None-Match"
+#define U_IF_MODIFIED_SINCE    "If-Modified-Since"
+
 static void * u_zalloc(void * q, unsigned n, unsigned m) {
   (void)q;
   return o_malloc((size_t) n * m);
@@ -222,6 +240,376 @@ static int callback_static_file_uncompressed (const struct _u_request * request,
   return ret;
 }
 
+/**
+ * Compresses a buffer in one pass, the output buffer is allocated with the size given by deflateBound
+ */
+static int u_compress_buffer(const char * data, size_t data_len, int gzip, int level, char ** data_zip, size_t * data_zip_len) {
+  z_stream defstream;
+  uLong bound;
+  int ret = U_OK, res;
+
+  *data_zip = NULL;
+  *data_zip_len = 0;
+  defstream.zalloc = u_zalloc;
+  defstream.zfree = u_zfree;
+  defstream.opaque = Z_NULL;
+  if (gzip) {
+    res = deflateInit2(&defstream, level, Z_DEFLATED, U_GZIP_WINDOW_BITS | U_GZIP_ENCODING, 8, Z_DEFAULT_STRATEGY);
+  } else {
+    res = deflateInit(&defstream, level);
+  }
+  if (res == Z_OK) {
+    bound = deflateBound(&defstream, (uLong)data_len);
+    if ((*data_zip = o_malloc(bound)) != NULL) {
+      defstream.avail_in = (uInt)data_len;
+      defstream.next_in = (Bytef *)data;
+      defstream.avail_out = (uInt)bound;
+      defstream.next_out = (Bytef *)*data_zip;
+      if ((res = deflate(&defstream, Z_FINISH)) == Z_STREAM_END) {
+        *data_zip_len = defstream.total_out;
+      } else {
+        y_log_message(Y_LOG_LEVEL_ERROR, "u_compress_buffer - Error deflate %d", res);
+        o_free(*data_zip);
+        *data_zip = NULL;
+        ret = U_ERROR;
+      }
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "u_compress_buffer - Error allocating resources for data_zip");
+      ret = U_ERROR_MEMORY;
+    }
+    deflateEnd(&defstream);
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "u_compress_buffer - Error deflateInit");
+    ret = U_ERROR;
+  }
+  return ret;
+}
+
+/**
+ * FNV-1a hash of a file path
+ */
+static unsigned int u_asset_hash(const char * path) {
+  unsigned int hash = 2166136261u;
+
+  for (; *path; path++) {
+    hash ^= (unsigned char)*path;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static void u_free_asset(struct _u_compressed_inmemory_asset * asset) {
+  if (asset != NULL) {
+    o_free(asset->path);
+    o_free(asset->content_type);
+    o_free(asset->etag);
+    o_free(asset->last_modified);
+    o_free(asset->data);
+    o_free(asset->gzip);
+    o_free(asset->etag_gzip);
+    o_free(asset->deflate);
+    o_free(asset->etag_deflate);
+    o_free(asset);
+  }
+}
+
+static void u_free_asset_table(struct _u_compressed_inmemory_asset_table * assets) {
+  struct _u_compressed_inmemory_asset * asset, * next;
+  size_t i;
+
+  if (assets != NULL) {
+    for (i=0; i<assets->nb_buckets; i++) {
+      for (asset = assets->buckets[i]; asset != NULL; asset = next) {
+        next = asset->next;
+        u_free_asset(asset);
+      }
+    }
+    o_free(assets->buckets);
+    o_free(assets);
+  }
+}
+
+/**
+ * Reads a file and builds its asset: strong ETag, Last-Modified date and compressed versions
+ * A compressed version is kept only if it's smaller than the file, with its own strong ETag
+ */
+static struct _u_compressed_inmemory_asset * u_load_asset(struct _u_compressed_inmemory_website_config * config, const char * file_path, const char * path, struct stat * file_stat) {
+  struct _u_compressed_inmemory_asset * asset = NULL;
+  const char * content_type;
+  char date[32] = {0};
+  size_t read_length, offset = 0;
+  struct tm tm_modified;
+  FILE * f;
+
+  if ((f = fopen(file_path, "rb")) != NULL) {
+    if ((asset = o_malloc(sizeof(struct _u_compressed_inmemory_asset))) != NULL) {
+      memset(asset, 0, sizeof(struct _u_compressed_inmemory_asset));
+      asset->path = o_strdup(path);
+      asset->hash = u_asset_hash(path);
+      asset->data_len = (size_t)file_stat->st_size;
+      if ((asset->data = o_malloc(asset->data_len+1)) != NULL) {
+        while (offset < asset->data_len && (read_length = fread(asset->data+offset, sizeof(char), asset->data_len-offset, f))) {
+          offset += read_length;
+        }
+        asset->data_len = offset;
+        content_type = u_map_get_case(&config->mime_types, get_filename_ext(asset->path));
+        if (content_type == NULL) {
+          content_type = u_map_get(&config->mime_types, "*");
+          y_log_message(Y_LOG_LEVEL_WARNING, "Static File Server - Unknown mime type for extension %s", get_filename_ext(asset->path));
+        }
+        asset->content_type = o_strdup(content_type);
+        asset->etag = msprintf("\"%zx-%08lx\"", asset->data_len, crc32(0L, (const Bytef *)asset->data, (uInt)asset->data_len));
+        gmtime_r(&file_stat->st_mtime, &tm_modified);
+        strftime(date, sizeof(date)-1, "%a, %d %b %Y %H:%M:%S GMT", &tm_modified);
+        asset->last_modified = o_strdup(date);
+        if (string_array_has_value((const char **)config->mime_types_compressed, asset->content_type)) {
+          if (config->allow_gzip && u_compress_buffer(asset->data, asset->data_len, 1, Z_BEST_COMPRESSION, &asset->gzip, &asset->gzip_len) == U_OK && asset->gzip_len >= asset->data_len) {
+            o_free(asset->gzip);
+            asset->gzip = NULL;
+          }
+          if (asset->gzip != NULL) {
+            asset->etag_gzip = msprintf("\"%zx-%08lx-" U_ACCEPT_GZIP "\"", asset->data_len, crc32(0L, (const Bytef *)asset->data, (uInt)asset->data_len));
+          }
+          if (config->allow_deflate && u_compress_buffer(asset->data, asset->data_len, 0, Z_BEST_COMPRESSION, &asset->deflate, &asset->deflate_len) == U_OK && asset->deflate_len >= asset->data_len) {
+            o_free(asset->deflate);
+            asset->deflate = NULL;
+          }
+          if (asset->deflate != NULL) {
+            asset->etag_deflate = msprintf("\"%zx-%08lx-" U_ACCEPT_DEFLATE "\"", asset->data_len, crc32(0L, (const Bytef *)asset->data, (uInt)asset->data_len));
+          }
+        }
+      } else {
+        y_log_message(Y_LOG_LEVEL_ERROR, "u_load_asset - Error allocating resources for data %s", path);
+        u_free_asset(asset);
+        asset = NULL;
+      }
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "u_load_asset - Error allocating resources for asset %s", path);
+    }
+    fclose(f);
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "u_load_asset - Error opening file %s", file_path);
+  }
+  return asset;
+}
+
+/**
+ * Loads all the files of a directory and its subdirectories in a list of assets
+ * Files larger than U_PRELOAD_MAX_SIZE are left on the disk
+ * Symbolic links to files are followed, symbolic links to directories are skipped to avoid loops
+ */
+static int u_load_directory(struct _u_compressed_inmemory_website_config * config, const char * dir_path, const char * prefix, struct _u_compressed_inmemory_asset ** asset_list, size_t * nb_assets) {
+  DIR * dir;
+  struct dirent * entry;
+  struct stat file_stat;
+  struct _u_compressed_inmemory_asset * asset;
+  char * file_path, * path;
+  int ret = U_OK;
+
+  if ((dir = opendir(dir_path)) != NULL) {
+    while (ret == U_OK && (entry = readdir(dir)) != NULL) {
+      if (o_strcmp(entry->d_name, ".") && o_strcmp(entry->d_name, "..")) {
+        file_path = msprintf("%s/%s", dir_path, entry->d_name);
+        path = prefix!=NULL?msprintf("%s/%s", prefix, entry->d_name):o_strdup(entry->d_name);
+        if (!lstat(file_path, &file_stat)) {
+          if (S_ISDIR(file_stat.st_mode)) {
+            ret = u_load_directory(config, file_path, path, asset_list, nb_assets);
+          } else if ((S_ISREG(file_stat.st_mode) || (S_ISLNK(file_stat.st_mode) && !stat(file_path, &file_stat) && S_ISREG(file_stat.st_mode))) && file_stat.st_size <= U_PRELOAD_MAX_SIZE) {
+            if ((asset = u_load_asset(config, file_path, path, &file_stat)) != NULL) {
+              asset->next = *asset_list;
+              *asset_list = asset;
+              (*nb_assets)++;
+            }
+          }
+        }
+        o_free(file_path);
+        o_free(path);
+      }
+    }
+    closedir(dir);
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "u_load_directory - Error opening directory %s", dir_path);
+    ret = U_ERROR;
+  }
+  return ret;
+}
+
+static struct _u_compressed_inmemory_asset * u_get_asset(struct _u_compressed_inmemory_asset_table * assets, const char * path) {
+  struct _u_compressed_inmemory_asset * asset = NULL;
+  unsigned int hash;
+
+  if (assets != NULL && assets->nb_buckets) {
+    hash = u_asset_hash(path);
+    for (asset = assets->buckets[hash&(assets->nb_buckets-1)]; asset != NULL; asset = asset->next) {
+      if (asset->hash == hash && 0 == o_strcmp(asset->path, path)) {
+        break;
+      }
+    }
+  }
+  return asset;
+}
+
+/**
+ * Returns true if the header If-None-Match contains the ETag of the asset, weak comparison
+ */
+static int u_etag_match(const char * if_none_match, const char * etag) {
+  char ** etag_list = NULL, * weak_etag = msprintf("W/%s", etag);
+  int ret = 0;
+
+  if (split_string(if_none_match, ",", &etag_list)) {
+    ret = string_array_has_trimmed_value((const char **)etag_list, "*") ||
+          string_array_has_trimmed_value((const char **)etag_list, etag) ||
+          string_array_has_trimmed_value((const char **)etag_list, weak_etag);
+  }
+  free_string_array(etag_list);
+  o_free(weak_etag);
+  return ret;
+}
+
+/**
+ * Sends a file from the preloaded files table
+ * The variant sent depends on the header Accept-Encoding, each variant has its own ETag
+ * Responds 304 if the ETag of the variant or the Last-Modified date match the request
+ * Returns U_ERROR_NOT_FOUND if the file isn't preloaded
+ */
+static int u_send_preloaded_asset(struct _u_compressed_inmemory_website_config * config, const struct _u_request * request, struct _u_response * response, const char * file_requested) {
+  struct _u_compressed_inmemory_asset * asset;
+  char ** accept_list = NULL, * cache_control;
+  const char * if_none_match, * if_modified_since, * body, * etag, * encoding;
+  size_t body_len;
+  int ret = U_ERROR_NOT_FOUND;
+
+  if (!u_map_has_key_case(response->map_header, U_CONTENT_HEADER) && !pthread_rwlock_rdlock(&config->assets_lock)) {
+    if ((asset = u_get_asset(config->assets, file_requested)) != NULL) {
+      u_map_put(response->map_header, "Content-Type", asset->content_type);
+      u_map_copy_into(response->map_header, &config->map_header);
+      split_string(u_map_get_case(request->map_header, U_ACCEPT_HEADER), ",", &accept_list);
+      if (asset->gzip != NULL && string_array_has_trimmed_value((const char **)accept_list, U_ACCEPT_GZIP)) {
+        body = asset->gzip;
+        body_len = asset->gzip_len;
+        etag = asset->etag_gzip;
+        encoding = U_ACCEPT_GZIP;
+      } else if (asset->deflate != NULL && string_array_has_trimmed_value((const char **)accept_list, U_ACCEPT_DEFLATE)) {
+        body = asset->deflate;
+        body_len = asset->deflate_len;
+        etag = asset->etag_deflate;
+        encoding = U_ACCEPT_DEFLATE;
+      } else {
+        body = asset->data;
+        body_len = asset->data_len;
+        etag = asset->etag;
+        encoding = NULL;
+      }
+      free_string_array(accept_list);
+      u_map_put(response->map_header, "ETag", etag);
+      u_map_put(response->map_header, "Last-Modified", asset->last_modified);
+      if (config->max_age) {
+        cache_control = msprintf("public, max-age=%u", config->max_age);
+        u_map_put(response->map_header, "Cache-Control", cache_control);
+        o_free(cache_control);
+      } else {
+        u_map_put(response->map_header, "Cache-Control", "no-cache");
+      }
+      if (asset->gzip != NULL || asset->deflate != NULL) {
+        u_map_put(response->map_header, "Vary", U_ACCEPT_HEADER);
+      }
+      if_none_match = u_map_get_case(request->map_header, U_IF_NONE_MATCH);
+      if_modified_since = u_map_get_case(request->map_header, U_IF_MODIFIED_SINCE);
+      if ((if_none_match != NULL && u_etag_match(if_none_match, etag)) || (if_none_match == NULL && 0 == o_strcmp(if_modified_since, asset->last_modified))) {
+        response->status = 304;
+      } else {
+        ulfius_set_binary_body_response(response, 200, body, body_len);
+        if (encoding != NULL) {
+          u_map_put(response->map_header, U_CONTENT_HEADER, encoding);
+        }
+      }
+      ret = U_OK;
+    }
+    pthread_rwlock_unlock(&config->assets_lock);
+  }
+  return ret;
+}
+
+#ifdef __linux__
+/**
+ * Adds an inotify watch on a directory and its subdirectories
+ * Symbolic links to directories are skipped like in u_load_directory
+ */
+static void u_watch_add_directory(int fd, const char * dir_path) {
+  DIR * dir;
+  struct dirent * entry;
+  struct stat file_stat;
+  char * file_path;
+
+  if (inotify_add_watch(fd, dir_path, IN_CLOSE_WRITE|IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO) == -1) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "u_watch_add_directory - Error inotify_add_watch %s", dir_path);
+  }
+  if ((dir = opendir(dir_path)) != NULL) {
+    while ((entry = readdir(dir)) != NULL) {
+      if (o_strcmp(entry->d_name, ".") && o_strcmp(entry->d_name, "..")) {
+        file_path = msprintf("%s/%s", dir_path, entry->d_name);
+        if (!lstat(file_path, &file_stat) && S_ISDIR(file_stat.st_mode)) {
+          u_watch_add_directory(fd, file_path);
+        }
+        o_free(file_path);
+      }
+    }
+    closedir(dir);
+  }
+}
+
+static int u_watch_init(struct _u_compressed_inmemory_website_config * config) {
+  int fd;
+
+  if ((fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC)) != -1) {
+    u_watch_add_directory(fd, config->files_path);
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "u_watch_init - Error inotify_init1");
+  }
+  return fd;
+}
+
+/**
+ * Watcher thread, reloads the preloaded files table when the files stop changing for U_WATCH_POLL_TIMEOUT milliseconds
+ * The watches are created again before each reload to follow new subdirectories
+ */
+static void * u_watch_run(void * args) {
+  struct _u_compressed_inmemory_website_config * config = (struct _u_compressed_inmemory_website_config *)args;
+  struct pollfd pfd;
+  char events[U_WATCH_EVENTS_SIZE];
+  int fd, res, dirty = 0, end = 0;
+
+  fd = u_watch_init(config);
+  while (!end && fd != -1) {
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if ((res = poll(&pfd, 1, U_WATCH_POLL_TIMEOUT)) > 0) {
+      while (read(fd, events, sizeof(events)) > 0);
+      dirty = 1;
+    } else if (!res && dirty) {
+      close(fd);
+      fd = u_watch_init(config);
+      if (u_load_compressed_inmemory_website(config) != U_OK) {
+        y_log_message(Y_LOG_LEVEL_ERROR, "u_watch_run - Error u_load_compressed_inmemory_website");
+      }
+      dirty = 0;
+    } else if (res < 0 && errno != EINTR) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "u_watch_run - Error poll");
+      end = 1;
+    }
+    if (!pthread_mutex_lock(&config->lock)) {
+      end |= config->watch_stop;
+      pthread_mutex_unlock(&config->lock);
+    }
+  }
+  if (fd != -1) {
+    close(fd);
+  }
+  return NULL;
+}
+#endif
+
 int u_init_compressed_inmemory_website_config(struct _u_compressed_inmemory_website_config * config) {
   int ret = U_OK;
   pthread_mutexattr_t mutexattr;
@@ -235,6 +623,10 @@ int u_init_compressed_inmemory_website_config(struct _u_compressed_inmemory_webs
     config->mime_types_compressed      = NULL;
     config->mime_types_compressed_size = 0;
     config->allow_cache_compressed     = 1;
+    config->max_age                    = 0;
+    config->assets                     = NULL;
+    config->watch_started              = 0;
+    config->watch_stop                 = 0;
     if ((ret = u_map_init(&(config->mime_types))) != U_OK) {
       y_log_message(Y_LOG_LEVEL_ERROR, "u_init_compressed_inmemory_website_config - Error u_map_init mime_types");
     } else if ((ret = u_map_init(&(config->map_header))) != U_OK) {
@@ -249,6 +641,10 @@ int u_init_compressed_inmemory_website_config(struct _u_compressed_inmemory_webs
       if (pthread_mutex_init(&(config->lock), &mutexattr) != 0) {
         y_log_message(Y_LOG_LEVEL_ERROR, "u_init_compressed_inmemory_website_config - Error pthread_mutex_init");
         ret = U_ERROR;
+      } else if (pthread_rwlock_init(&(config->assets_lock), NULL) != 0) {
+        y_log_message(Y_LOG_LEVEL_ERROR, "u_init_compressed_inmemory_website_config - Error pthread_rwlock_init");
+        pthread_mutex_destroy(&(config->lock));
+        ret = U_ERROR;
       }
     }
   }
@@ -257,6 +653,17 @@ int u_init_compressed_inmemory_website_config(struct _u_compressed_inmemory_webs
 
 void u_clean_compressed_inmemory_website_config(struct _u_compressed_inmemory_website_config * config) {
   if (config != NULL) {
+    if (config->watch_started) {
+      if (!pthread_mutex_lock(&(config->lock))) {
+        config->watch_stop = 1;
+        pthread_mutex_unlock(&(config->lock));
+      }
+      pthread_join(config->watch_thread, NULL);
+      config->watch_started = 0;
+    }
+    u_free_asset_table(config->assets);
+    config->assets = NULL;
+    pthread_rwlock_destroy(&(config->assets_lock));
     u_map_clean(&(config->mime_types));
     u_map_clean(&(config->map_header));
     u_map_clean(&(config->gzip_files));
@@ -284,11 +691,91 @@ int u_add_mime_types_compressed(struct _u_compressed_inmemory_website_config * c
   return ret;
 }
 
+/**
+ * Loads all the files of files_path in memory, with their ETag and their compressed versions
+ * The new files table replaces the previous one, the files not preloaded are still served from the disk
+ */
+int u_load_compressed_inmemory_website(struct _u_compressed_inmemory_website_config * config) {
+  struct _u_compressed_inmemory_asset_table * assets, * assets_old = NULL;
+  struct _u_compressed_inmemory_asset * asset_list = NULL, * asset, * next;
+  size_t nb_assets = 0, index;
+  int ret;
+
+  if (config != NULL && o_strlen(config->files_path)) {
+    if ((ret = u_load_directory(config, config->files_path, NULL, &asset_list, &nb_assets)) == U_OK) {
+      if ((assets = o_malloc(sizeof(struct _u_compressed_inmemory_asset_table))) != NULL) {
+        assets->nb_assets = nb_assets;
+        for (assets->nb_buckets = 16; assets->nb_buckets < 2*nb_assets; assets->nb_buckets <<= 1);
+        if ((assets->buckets = o_malloc(assets->nb_buckets*sizeof(struct _u_compressed_inmemory_asset *))) != NULL) {
+          memset(assets->buckets, 0, assets->nb_buckets*sizeof(struct _u_compressed_inmemory_asset *));
+          for (asset = asset_list; asset != NULL; asset = next) {
+            next = asset->next;
+            index = asset->hash&(assets->nb_buckets-1);
+            asset->next = assets->buckets[index];
+            assets->buckets[index] = asset;
+          }
+          asset_list = NULL;
+          if (!pthread_rwlock_wrlock(&config->assets_lock)) {
+            assets_old = config->assets;
+            config->assets = assets;
+            pthread_rwlock_unlock(&config->assets_lock);
+            u_free_asset_table(assets_old);
+            y_log_message(Y_LOG_LEVEL_INFO, "Static File Server - %zu files loaded in memory", nb_assets);
+          } else {
+            y_log_message(Y_LOG_LEVEL_ERROR, "u_load_compressed_inmemory_website - Error pthread_rwlock_wrlock");
+            u_free_asset_table(assets);
+            ret = U_ERROR;
+          }
+        } else {
+          y_log_message(Y_LOG_LEVEL_ERROR, "u_load_compressed_inmemory_website - Error allocating resources for buckets");
+          o_free(assets);
+          ret = U_ERROR_MEMORY;
+        }
+      } else {
+        y_log_message(Y_LOG_LEVEL_ERROR, "u_load_compressed_inmemory_website - Error allocating resources for assets");
+        ret = U_ERROR_MEMORY;
+      }
+    }
+    for (asset = asset_list; asset != NULL; asset = next) {
+      next = asset->next;
+      u_free_asset(asset);
+    }
+  } else {
+    ret = U_ERROR_PARAMS;
+  }
+  return ret;
+}
+
+/**
+ * Starts a thread that reloads the preloaded files when files_path changes, uses inotify, available on Linux only
+ */
+int u_watch_compressed_inmemory_website(struct _u_compressed_inmemory_website_config * config) {
+  int ret;
+
+  if (config != NULL && o_strlen(config->files_path) && !config->watch_started) {
+#ifdef __linux__
+    config->watch_stop = 0;
+    if (!pthread_create(&config->watch_thread, NULL, u_watch_run, (void *)config)) {
+      config->watch_started = 1;
+      ret = U_OK;
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "u_watch_compressed_inmemory_website - Error pthread_create");
+      ret = U_ERROR;
+    }
+#else
+    y_log_message(Y_LOG_LEVEL_ERROR, "u_watch_compressed_inmemory_website - inotify not available on this system");
+    ret = U_ERROR;
+#endif
+  } else {
+    ret = U_ERROR_PARAMS;
+  }
+  return ret;
+}
+
 int callback_static_compressed_inmemory_website (const struct _u_request * request, struct _u_response * response, void * user_data) {
   struct _u_compressed_inmemory_website_config * config = (struct _u_compressed_inmemory_website_config *)user_data;
   char ** accept_list = NULL;
-  int ret = U_CALLBACK_CONTINUE, compress_mode = U_COMPRESS_NONE, res;
-  z_stream defstream;
+  int ret = U_CALLBACK_CONTINUE, compress_mode = U_COMPRESS_NONE;
   unsigned char * file_content, * file_content_orig = NULL;
   size_t length, read_length, offset, data_zip_len = 0;
   FILE * f;
@@ -323,7 +810,9 @@ int callback_static_compressed_inmemory_website (const struct _u_request * reque
     }
     file_path = msprintf("%s/%s", ((struct _u_compressed_inmemory_website_config *)user_data)->files_path, file_requested);
 
-    if (access(file_path, F_OK) != -1) {
+    if (u_send_preloaded_asset(config, request, response, file_requested) == U_OK) {
+      // The file is served from the preloaded files table, without access to the disk
+    } else if (access(file_path, F_OK) != -1) {
       if (!u_map_has_key_case(response->map_header, U_CONTENT_HEADER)) {
         if (split_string(u_map_get_case(request->map_header, U_ACCEPT_HEADER), ",", &accept_list)) {
           if (config->allow_gzip && string_array_has_trimmed_value((const char **)accept_list, U_ACCEPT_GZIP)) {
@@ -359,74 +848,25 @@ int callback_static_compressed_inmemory_website (const struct _u_request * reque
                   offset = length = ftell (f);
                   fseek (f, 0, SEEK_SET);
 
-                  if ((file_content_orig = file_content = o_malloc(length)) != NULL && (data_zip = o_malloc((2*length)+20)) != NULL) {
-                    defstream.zalloc = u_zalloc;
-                    defstream.zfree = u_zfree;
-                    defstream.opaque = Z_NULL;
-                    defstream.avail_in = (uInt)length;
-                    defstream.next_in = (Bytef *)file_content;
+                  if ((file_content_orig = file_content = o_malloc(length)) != NULL) {
                     while ((read_length = fread(file_content, sizeof(char), offset, f))) {
                       file_content += read_length;
                       offset -= read_length;
                     }
 
-                    if (compress_mode == U_COMPRESS_GZIP) {
-                      if (deflateInit2(&defstream, 
-                                       Z_DEFAULT_COMPRESSION, 
-                                       Z_DEFLATED,
-                                       U_GZIP_WINDOW_BITS | U_GZIP_ENCODING,
-                                       8,
-                                       Z_DEFAULT_STRATEGY) != Z_OK) {
-                        y_log_message(Y_LOG_LEVEL_ERROR, "callback_static_compressed_inmemory_website - Error deflateInit (gzip)");
-                        ret = U_CALLBACK_ERROR;
+                    if (u_compress_buffer((const char *)file_content_orig, length, compress_mode==U_COMPRESS_GZIP, compress_mode==U_COMPRESS_GZIP?Z_DEFAULT_COMPRESSION:Z_BEST_COMPRESSION, &data_zip, &data_zip_len) == U_OK) {
+                      if (config->allow_cache_compressed) {
+                        u_map_put_binary(compress_mode==U_COMPRESS_GZIP?&config->gzip_files:&config->deflate_files, file_requested, data_zip, 0, data_zip_len);
                       }
+                      ulfius_set_binary_body_response(response, 200, data_zip, data_zip_len);
+                      u_map_put(response->map_header, U_CONTENT_HEADER, compress_mode==U_COMPRESS_GZIP?U_ACCEPT_GZIP:U_ACCEPT_DEFLATE);
                     } else {
-                      if (deflateInit(&defstream, Z_BEST_COMPRESSION) != Z_OK) {
-                        y_log_message(Y_LOG_LEVEL_ERROR, "callback_static_compressed_inmemory_website - Error deflateInit (deflate)");
-                        ret = U_CALLBACK_ERROR;
-                      }
-                    }
-                    if (ret == U_CALLBACK_CONTINUE) {
-                      do {
-                        if ((data_zip = o_realloc(data_zip, data_zip_len+_U_W_BLOCK_SIZE)) != NULL) {
-                          defstream.avail_out = _U_W_BLOCK_SIZE;
-                          defstream.next_out = ((Bytef *)data_zip)+data_zip_len;
-                          switch ((res = deflate(&defstream, Z_FINISH))) {
-                            case Z_OK:
-                            case Z_STREAM_END:
-                            case Z_BUF_ERROR:
-                              break;
-                            default:
-                              y_log_message(Y_LOG_LEVEL_ERROR, "callback_static_compressed_inmemory_website - Error deflate %d", res);
-                              ret = U_CALLBACK_ERROR;
-                              break;
-                          }
-                          data_zip_len += _U_W_BLOCK_SIZE - defstream.avail_out;
-                        } else {
-                          y_log_message(Y_LOG_LEVEL_ERROR, "callback_static_compressed_inmemory_website - Error allocating resources for data_zip");
-                          ret = U_CALLBACK_ERROR;
-                        }
-                      } while (U_CALLBACK_CONTINUE == ret && defstream.avail_out == 0);
-                      
-                      if (ret == U_CALLBACK_CONTINUE) {
-                        if (compress_mode == U_COMPRESS_GZIP) {
-                          if (config->allow_cache_compressed) {
-                            u_map_put_binary(&config->gzip_files, file_requested, data_zip, 0, defstream.total_out);
-                          }
-                          ulfius_set_binary_body_response(response, 200, u_map_get(&config->gzip_files, file_requested), u_map_get_length(&config->gzip_files, file_requested));
-                        } else {
-                          if (config->allow_cache_compressed) {
-                            u_map_put_binary(&config->deflate_files, file_requested, data_zip, 0, defstream.total_out);
-                          }
-                          ulfius_set_binary_body_response(response, 200, u_map_get(&config->deflate_files, file_requested), u_map_get_length(&config->deflate_files, file_requested));
-                        }
-                        u_map_put(response->map_header, U_CONTENT_HEADER, compress_mode==U_COMPRESS_GZIP?U_ACCEPT_GZIP:U_ACCEPT_DEFLATE);
-                      }
+                      y_log_message(Y_LOG_LEVEL_ERROR, "callback_static_compressed_inmemory_website - Error u_compress_buffer");
+                      ret = U_CALLBACK_ERROR;
                     }
-                    deflateEnd(&defstream);
                     o_free(data_zip);
                   } else {
-                    y_log_message(Y_LOG_LEVEL_ERROR, "callback_static_compressed_inmemory_website - Error allocating resource for file_content or data_zip");
+                    y_log_message(Y_LOG_LEVEL_ERROR, "callback_static_compressed_inmemory_website - Error allocating resource for file_content");
                     ret = U_CALLBACK_ERROR;
                   }
                   o_free(file_content_orig);
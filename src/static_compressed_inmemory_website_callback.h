@@ -39,6 +39,10 @@
  * `lock`: mutex lock (do not touch this variable)
  * `gzip_files`: a `struct _u_map` containing cached gzip files
  * `deflate_files`: a `struct _u_map` containing cached deflate files
+ * `max_age`: max-age value of the Cache-Control header of the preloaded files, 0 means no-cache (default 0)
+ * `assets`: table of the files preloaded by u_load_compressed_inmemory_website (do not touch this variable)
+ * `assets_lock`: read-write lock of assets (do not touch this variable)
+ * `watch_*`: inotify watcher started by u_watch_compressed_inmemory_website (do not touch these variables)
  * 
  * example of mime-types used in Hutch:
  * {
@@ -93,6 +97,36 @@
 
 #define _U_W_BLOCK_SIZE 256
 
+/**
+ * A file preloaded in memory with its compressed versions
+ * gzip and deflate are NULL if the file isn't compressed
+ */
+struct _u_compressed_inmemory_asset {
+  char                                * path;
+  char                                * content_type;
+  char                                * etag;
+  char                                * last_modified;
+  char                                * data;
+  size_t                                data_len;
+  char                                * gzip;
+  size_t                                gzip_len;
+  char                                * etag_gzip;
+  char                                * deflate;
+  size_t                                deflate_len;
+  char                                * etag_deflate;
+  unsigned int                          hash;
+  struct _u_compressed_inmemory_asset * next;
+};
+
+/**
+ * Immutable table of the preloaded files, indexed by the hash of their path
+ */
+struct _u_compressed_inmemory_asset_table {
+  size_t                                 nb_assets;
+  size_t                                 nb_buckets;
+  struct _u_compressed_inmemory_asset ** buckets;
+};
+
 struct _u_compressed_inmemory_website_config {
   char          * files_path;
   char          * url_prefix;
@@ -107,6 +141,12 @@ struct _u_compressed_inmemory_website_config {
   pthread_mutex_t lock;
   struct _u_map   gzip_files;
   struct _u_map   deflate_files;
+  unsigned int    max_age;
+  struct _u_compressed_inmemory_asset_table * assets;
+  pthread_rwlock_t assets_lock;
+  int             watch_started;
+  int             watch_stop;
+  pthread_t       watch_thread;
 };
 
 int u_init_compressed_inmemory_website_config(struct _u_compressed_inmemory_website_config * config);
@@ -115,6 +155,10 @@ void u_clean_compressed_inmemory_website_config(struct _u_compressed_inmemory_we
 
 int u_add_mime_types_compressed(struct _u_compressed_inmemory_website_config * config, const char * mime_type);
 
+int u_load_compressed_inmemory_website(struct _u_compressed_inmemory_website_config * config);
+
+int u_watch_compressed_inmemory_website(struct _u_compressed_inmemory_website_config * config);
+
 int callback_static_compressed_inmemory_website (const struct _u_request * request, struct _u_response * response, void * user_data);
 
 #endif
@@ -24,27 +24,508 @@
  * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
  *
  */
+#include <ctype.h>
+
 #include "glewlwyd.h"
 
+/**
+ * FNV-1a hash of the username, case insensitive
+ */
+static unsigned int glewlwyd_username_hash(const char * username) {
+  unsigned int hash = 2166136261U;
+  const char * c;
+
+  for (c = username; c != NULL && *c; c++) {
+    hash = (hash ^ (unsigned char)tolower((unsigned char)*c)) * 16777619U;
+  }
+  return hash;
+}
+
+static void glewlwyd_user_route_free_entry(struct _glwd_user_route_entry * entry) {
+  o_free(entry->username);
+  o_free(entry->source);
+  o_free(entry);
+}
+
+int glewlwyd_user_route_init(struct config_elements * config) {
+  size_t i;
+  int ret = G_OK;
+
+  if (config->user_route.size) {
+    for (i=0; i<GLWD_USER_ROUTE_SHARDS; i++) {
+      memset(config->user_route.shards[i].buckets, 0, sizeof(config->user_route.shards[i].buckets));
+      config->user_route.shards[i].count = 0;
+      if (pthread_mutex_init(&config->user_route.shards[i].lock, NULL)) {
+        y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_user_route_init - Error pthread_mutex_init");
+        ret = G_ERROR;
+        break;
+      }
+    }
+    if (ret == G_OK) {
+      config->user_route.initialized = 1;
+    } else {
+      while (i--) {
+        pthread_mutex_destroy(&config->user_route.shards[i].lock);
+      }
+    }
+  }
+  return ret;
+}
+
+/**
+ * Removes all the entries of the username routing index
+ */
+void glewlwyd_user_route_clear(struct config_elements * config) {
+  struct _glwd_user_route_entry * entry;
+  size_t i, j;
+
+  if (config->user_route.initialized) {
+    for (i=0; i<GLWD_USER_ROUTE_SHARDS; i++) {
+      if (!pthread_mutex_lock(&config->user_route.shards[i].lock)) {
+        for (j=0; j<GLWD_USER_ROUTE_BUCKETS; j++) {
+          while ((entry = config->user_route.shards[i].buckets[j]) != NULL) {
+            config->user_route.shards[i].buckets[j] = entry->next;
+            glewlwyd_user_route_free_entry(entry);
+          }
+        }
+        config->user_route.shards[i].count = 0;
+        pthread_mutex_unlock(&config->user_route.shards[i].lock);
+      }
+    }
+  }
+}
+
+void glewlwyd_user_route_close(struct config_elements * config) {
+  size_t i;
+
+  if (config->user_route.initialized) {
+    glewlwyd_user_route_clear(config);
+    for (i=0; i<GLWD_USER_ROUTE_SHARDS; i++) {
+      pthread_mutex_destroy(&config->user_route.shards[i].lock);
+    }
+    config->user_route.initialized = 0;
+  }
+}
+
+/**
+ * Returns the name of the first user module instance in the list order where the username was found, NULL if unknown
+ * An expired entry is removed from the index
+ * Returned value must be o_free'd after use
+ */
+char * glewlwyd_user_route_get(struct config_elements * config, const char * username) {
+  struct _glwd_user_route_shard * shard;
+  struct _glwd_user_route_entry ** p_entry, * entry;
+  unsigned int hash;
+  char * source = NULL;
+
+  if (config->user_route.initialized && username != NULL) {
+    hash = glewlwyd_username_hash(username);
+    shard = &config->user_route.shards[hash%GLWD_USER_ROUTE_SHARDS];
+    if (!pthread_mutex_lock(&shard->lock)) {
+      for (p_entry = &shard->buckets[(hash/GLWD_USER_ROUTE_SHARDS)%GLWD_USER_ROUTE_BUCKETS]; *p_entry != NULL; p_entry = &(*p_entry)->next) {
+        if ((*p_entry)->hash == hash && 0 == o_strcasecmp((*p_entry)->username, username)) {
+          if ((*p_entry)->expires_at <= time(NULL)) {
+            entry = *p_entry;
+            *p_entry = entry->next;
+            glewlwyd_user_route_free_entry(entry);
+            shard->count--;
+          } else {
+            source = o_strdup((*p_entry)->source);
+          }
+          break;
+        }
+      }
+      pthread_mutex_unlock(&shard->lock);
+    }
+  }
+  return source;
+}
+
+/**
+ * Sets the user module instance where the username is, or removes the username from the index if source is NULL
+ * If the shard is full, the oldest entries of the bucket are removed
+ */
+void glewlwyd_user_route_set(struct config_elements * config, const char * username, const char * source) {
+  struct _glwd_user_route_shard * shard;
+  struct _glwd_user_route_entry ** p_entry, * entry = NULL;
+  unsigned int hash;
+  size_t bucket, shard_size = config->user_route.size/GLWD_USER_ROUTE_SHARDS, i;
+
+  if (config->user_route.initialized && username != NULL) {
+    hash = glewlwyd_username_hash(username);
+    bucket = (hash/GLWD_USER_ROUTE_SHARDS)%GLWD_USER_ROUTE_BUCKETS;
+    shard = &config->user_route.shards[hash%GLWD_USER_ROUTE_SHARDS];
+    if (!pthread_mutex_lock(&shard->lock)) {
+      for (p_entry = &shard->buckets[bucket]; *p_entry != NULL; p_entry = &(*p_entry)->next) {
+        if ((*p_entry)->hash == hash && 0 == o_strcasecmp((*p_entry)->username, username)) {
+          entry = *p_entry;
+          *p_entry = entry->next;
+          shard->count--;
+          break;
+        }
+      }
+      if (source != NULL) {
+        if (entry == NULL) {
+          // Evict the last entries of the bucket, or of the following buckets if the bucket is empty
+          for (i=0; shard->count >= (shard_size?shard_size:1) && i<GLWD_USER_ROUTE_BUCKETS; i++) {
+            while (shard->count >= (shard_size?shard_size:1) && shard->buckets[(bucket+i)%GLWD_USER_ROUTE_BUCKETS] != NULL) {
+              for (p_entry = &shard->buckets[(bucket+i)%GLWD_USER_ROUTE_BUCKETS]; (*p_entry)->next != NULL; p_entry = &(*p_entry)->next);
+              glewlwyd_user_route_free_entry(*p_entry);
+              *p_entry = NULL;
+              shard->count--;
+            }
+          }
+          if ((entry = o_malloc(sizeof(struct _glwd_user_route_entry))) != NULL) {
+            entry->username = o_strdup(username);
+            entry->source = NULL;
+            entry->hash = hash;
+          } else {
+            y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_user_route_set - Error allocating resources for entry");
+          }
+        }
+        if (entry != NULL) {
+          if (0 != o_strcmp(entry->source, source)) {
+            o_free(entry->source);
+            entry->source = o_strdup(source);
+          }
+          entry->expires_at = time(NULL) + config->user_route.max_age;
+          entry->next = shard->buckets[bucket];
+          shard->buckets[bucket] = entry;
+          shard->count++;
+        }
+      } else if (entry != NULL) {
+        glewlwyd_user_route_free_entry(entry);
+      }
+      pthread_mutex_unlock(&shard->lock);
+    }
+  }
+}
+
+/**
+ * Returns the names of the user module instances in the order they must be queried for the username
+ * The instances are always queried in the instance list order, the index is only a negative cache:
+ * the instances before the first one where the username was found don't have it and are skipped
+ * The returned array is NULL terminated, it must be o_free'd after use, the names belong to j_module_list
+ */
+static const char ** get_user_module_lookup_order(json_t * j_module_list, const char * route) {
+  const char ** names;
+  json_t * j_module;
+  size_t index, i = 0, start = 0;
+
+  if ((names = o_malloc((json_array_size(json_object_get(j_module_list, "module"))+1)*sizeof(char *))) != NULL) {
+    if (route != NULL) {
+      json_array_foreach(json_object_get(j_module_list, "module"), index, j_module) {
+        if (0 == o_strcmp(route, json_string_value(json_object_get(j_module, "name")))) {
+          start = index;
+          break;
+        }
+      }
+    }
+    json_array_foreach(json_object_get(j_module_list, "module"), index, j_module) {
+      if (index >= start) {
+        names[i++] = json_string_value(json_object_get(j_module, "name"));
+      }
+    }
+    names[i] = NULL;
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "get_user_module_lookup_order - Error allocating resources for names");
+  }
+  return names;
+}
+
+/**
+ * Updates the routing index and the metrics after looking up a username in the user module instances
+ */
+static void glewlwyd_user_route_update(struct config_elements * config, const char * username, const char * route, struct _user_module_instance * found_module) {
+  if (found_module != NULL) {
+    if (0 == o_strcmp(route, found_module->name)) {
+      glewlwyd_metrics_counter_add(found_module->metrics_route_hit, 1);
+    } else {
+      glewlwyd_user_route_set(config, username, found_module->name);
+    }
+  } else if (route != NULL) {
+    glewlwyd_user_route_set(config, username, NULL);
+  }
+}
+
+static void glewlwyd_user_cache_free_entry(struct _glwd_user_cache_entry * entry) {
+  o_free(entry->source);
+  o_free(entry->username);
+  json_decref(entry->j_user);
+  o_free(entry);
+}
+
+/**
+ * Removes all the expired entries of a shard, the shard must be locked
+ */
+static void glewlwyd_user_cache_purge_shard(struct _glwd_user_cache_shard * shard, time_t now) {
+  struct _glwd_user_cache_entry ** p_entry, * entry;
+  size_t i;
+
+  for (i=0; i<GLWD_USER_CACHE_BUCKETS; i++) {
+    p_entry = &shard->buckets[i];
+    while (*p_entry != NULL) {
+      entry = *p_entry;
+      if (entry->expires_at <= now) {
+        *p_entry = entry->next;
+        glewlwyd_user_cache_free_entry(entry);
+        shard->count--;
+      } else {
+        p_entry = &entry->next;
+      }
+    }
+  }
+}
+
+/**
+ * Removes the entry that expires first in a shard, the shard must be locked
+ */
+static void glewlwyd_user_cache_evict_shard(struct _glwd_user_cache_shard * shard) {
+  struct _glwd_user_cache_entry ** p_entry, ** p_evict = NULL, * entry;
+  size_t i;
+
+  for (i=0; i<GLWD_USER_CACHE_BUCKETS; i++) {
+    for (p_entry = &shard->buckets[i]; *p_entry != NULL; p_entry = &(*p_entry)->next) {
+      if (p_evict == NULL || (*p_entry)->expires_at < (*p_evict)->expires_at) {
+        p_evict = p_entry;
+      }
+    }
+  }
+  if (p_evict != NULL) {
+    entry = *p_evict;
+    *p_evict = entry->next;
+    glewlwyd_user_cache_free_entry(entry);
+    shard->count--;
+  }
+}
+
+/**
+ * Returns a pointer to the entry of a source and a username, NULL if not found, the shard must be locked
+ * An expired entry is removed from the shard
+ */
+static struct _glwd_user_cache_entry ** glewlwyd_user_cache_lookup(struct _glwd_user_cache_shard * shard, const char * source, const char * username, unsigned int hash, time_t now) {
+  struct _glwd_user_cache_entry ** p_entry, ** p_return = NULL, * entry;
+
+  for (p_entry = &shard->buckets[(hash/GLWD_USER_CACHE_SHARDS)%GLWD_USER_CACHE_BUCKETS]; *p_entry != NULL; p_entry = &(*p_entry)->next) {
+    if ((*p_entry)->hash == hash && 0 == o_strcasecmp((*p_entry)->username, username) && 0 == o_strcmp((*p_entry)->source, source)) {
+      if ((*p_entry)->expires_at <= now) {
+        entry = *p_entry;
+        *p_entry = entry->next;
+        glewlwyd_user_cache_free_entry(entry);
+        shard->count--;
+      } else {
+        p_return = p_entry;
+      }
+      break;
+    }
+  }
+  return p_return;
+}
+
+/**
+ * Returns the generation of the shard of a username, must be read before reading the user in the backend
+ */
+static unsigned int glewlwyd_user_cache_get_generation(struct config_elements * config, const char * username) {
+  unsigned int generation = 0;
+
+  if (config->user_cache.initialized) {
+    generation = __atomic_load_n(&config->user_cache.shards[glewlwyd_username_hash(username)%GLWD_USER_CACHE_SHARDS].generation, __ATOMIC_ACQUIRE);
+  }
+  return generation;
+}
+
+/**
+ * Returns a copy of the cached user of source, NULL if not in the cache
+ * If source is NULL, returns the user found first in all the user module instances
+ */
+static json_t * glewlwyd_user_cache_get(struct config_elements * config, const char * username, const char * source) {
+  struct _glwd_user_cache_shard * shard;
+  struct _glwd_user_cache_entry ** p_entry;
+  unsigned int hash;
+  json_t * j_user = NULL;
+
+  if (config->user_cache.initialized && username != NULL) {
+    hash = glewlwyd_username_hash(username);
+    shard = &config->user_cache.shards[hash%GLWD_USER_CACHE_SHARDS];
+    if (!pthread_mutex_lock(&shard->lock)) {
+      if ((p_entry = glewlwyd_user_cache_lookup(shard, source, username, hash, time(NULL))) != NULL) {
+        j_user = json_deep_copy((*p_entry)->j_user);
+      }
+      pthread_mutex_unlock(&shard->lock);
+    }
+  }
+  return j_user;
+}
+
+/**
+ * Stores a copy of the user of source in the cache, unless the shard was invalidated since generation was read
+ * The shard is chosen with the username only, so the entries of all the sources of a username share the same generation
+ */
+static void glewlwyd_user_cache_set(struct config_elements * config, unsigned int generation, const char * source, const char * username, json_t * j_user) {
+  struct _glwd_user_cache_shard * shard;
+  struct _glwd_user_cache_entry ** p_entry, * entry;
+  unsigned int hash;
+  size_t bucket, shard_size = config->user_cache.size/GLWD_USER_CACHE_SHARDS;
+  time_t now = time(NULL);
+
+  if (config->user_cache.initialized && username != NULL) {
+    hash = glewlwyd_username_hash(username);
+    bucket = (hash/GLWD_USER_CACHE_SHARDS)%GLWD_USER_CACHE_BUCKETS;
+    shard = &config->user_cache.shards[hash%GLWD_USER_CACHE_SHARDS];
+    if (!pthread_mutex_lock(&shard->lock)) {
+      if (shard->generation == generation) {
+        if ((p_entry = glewlwyd_user_cache_lookup(shard, source, username, hash, now)) != NULL) {
+          entry = *p_entry;
+          json_decref(entry->j_user);
+        } else {
+          if (shard->count >= (shard_size?shard_size:1)) {
+            glewlwyd_user_cache_purge_shard(shard, now);
+            if (shard->count >= (shard_size?shard_size:1)) {
+              glewlwyd_user_cache_evict_shard(shard);
+            }
+          }
+          if ((entry = o_malloc(sizeof(struct _glwd_user_cache_entry))) != NULL) {
+            entry->source = o_strdup(source);
+            entry->username = o_strdup(username);
+            entry->hash = hash;
+            entry->next = shard->buckets[bucket];
+            shard->buckets[bucket] = entry;
+            shard->count++;
+          } else {
+            y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_user_cache_set - Error allocating resources for entry");
+          }
+        }
+        if (entry != NULL) {
+          entry->j_user = json_deep_copy(j_user);
+          entry->expires_at = now + config->user_cache.max_age;
+        }
+      }
+      pthread_mutex_unlock(&shard->lock);
+    }
+  }
+}
+
+int glewlwyd_user_cache_init(struct config_elements * config) {
+  size_t i;
+  int ret = G_OK;
+
+  if (config->user_cache.size && config->user_cache.max_age) {
+    for (i=0; i<GLWD_USER_CACHE_SHARDS; i++) {
+      memset(config->user_cache.shards[i].buckets, 0, sizeof(config->user_cache.shards[i].buckets));
+      config->user_cache.shards[i].count = 0;
+      if (pthread_mutex_init(&config->user_cache.shards[i].lock, NULL)) {
+        y_log_message(Y_LOG_LEVEL_ERROR, "glewlwyd_user_cache_init - Error pthread_mutex_init");
+        ret = G_ERROR;
+        break;
+      }
+    }
+    if (ret == G_OK) {
+      config->user_cache.initialized = 1;
+    } else {
+      while (i--) {
+        pthread_mutex_destroy(&config->user_cache.shards[i].lock);
+      }
+    }
+  }
+  return ret;
+}
+
+/**
+ * Removes all the entries of the user cache
+ */
+void glewlwyd_user_cache_clear(struct config_elements * config) {
+  struct _glwd_user_cache_entry * entry;
+  size_t i, j;
+
+  if (config->user_cache.initialized) {
+    for (i=0; i<GLWD_USER_CACHE_SHARDS; i++) {
+      if (!pthread_mutex_lock(&config->user_cache.shards[i].lock)) {
+        for (j=0; j<GLWD_USER_CACHE_BUCKETS; j++) {
+          while ((entry = config->user_cache.shards[i].buckets[j]) != NULL) {
+            config->user_cache.shards[i].buckets[j] = entry->next;
+            glewlwyd_user_cache_free_entry(entry);
+          }
+        }
+        config->user_cache.shards[i].count = 0;
+        __atomic_add_fetch(&config->user_cache.shards[i].generation, 1, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&config->user_cache.shards[i].lock);
+      }
+    }
+  }
+}
+
+void glewlwyd_user_cache_close(struct config_elements * config) {
+  size_t i;
+
+  if (config->user_cache.initialized) {
+    glewlwyd_user_cache_clear(config);
+    for (i=0; i<GLWD_USER_CACHE_SHARDS; i++) {
+      pthread_mutex_destroy(&config->user_cache.shards[i].lock);
+    }
+    config->user_cache.initialized = 0;
+  }
+}
+
+/**
+ * Removes the user of source from the cache, after a write in this user module instance
+ * The user looked up in all the instances is removed too, since the write may change which instance has it first
+ * If source is NULL, the user is removed for all the sources
+ * A change in the user module instances clears the whole cache
+ */
+void glewlwyd_user_cache_invalidate(struct config_elements * config, const char * source, const char * username) {
+  struct _glwd_user_cache_shard * shard;
+  struct _glwd_user_cache_entry ** p_entry, * entry;
+  unsigned int hash;
+
+  if (config->user_cache.initialized && username != NULL) {
+    hash = glewlwyd_username_hash(username);
+    shard = &config->user_cache.shards[hash%GLWD_USER_CACHE_SHARDS];
+    if (!pthread_mutex_lock(&shard->lock)) {
+      p_entry = &shard->buckets[(hash/GLWD_USER_CACHE_SHARDS)%GLWD_USER_CACHE_BUCKETS];
+      while (*p_entry != NULL) {
+        entry = *p_entry;
+        if (entry->hash == hash && 0 == o_strcasecmp(entry->username, username) && (source == NULL || entry->source == NULL || 0 == o_strcmp(entry->source, source))) {
+          *p_entry = entry->next;
+          glewlwyd_user_cache_free_entry(entry);
+          shard->count--;
+        } else {
+          p_entry = &entry->next;
+        }
+      }
+      __atomic_add_fetch(&shard->generation, 1, __ATOMIC_RELEASE);
+      pthread_mutex_unlock(&shard->lock);
+    }
+  }
+}
+
 json_t * auth_check_user_credentials(struct config_elements * config, const char * username, const char * password) {
   int res;
-  json_t * j_return = NULL, * j_module_list = get_user_module_list(config), * j_module, * j_user;
-  struct _user_module_instance * user_module;
+  json_t * j_return = NULL, * j_module_list = get_user_module_list(config), * j_user;
+  struct _user_module_instance * user_module, * found_module = NULL;
+  const char ** names = NULL;
+  char * route = NULL;
   size_t index;
   
-  if (check_result_value(j_module_list, G_OK)) {
-    json_array_foreach(json_object_get(j_module_list, "module"), index, j_module) {
+  if (check_result_value(j_module_list, G_OK) && (names = get_user_module_lookup_order(j_module_list, (route = glewlwyd_user_route_get(config, username)))) != NULL) {
+    for (index=0; names[index]!=NULL; index++) {
       if (j_return == NULL) {
-        user_module = get_user_module_instance(config, json_string_value(json_object_get(j_module, "name")));
+        user_module = get_user_module_instance(config, names[index]);
         if (user_module != NULL) {
           if (user_module->enabled) {
-            j_user = user_module->module->user_module_get(config->config_m, username, user_module->cls);
+            j_user = user_module_instance_get(config, user_module, username);
+            if (check_result_value(j_user, G_OK) && found_module == NULL) {
+              found_module = user_module;
+            } else if (check_result_value(j_user, G_ERROR_NOT_FOUND)) {
+              glewlwyd_metrics_counter_add(user_module->metrics_route_miss, 1);
+            }
             if (check_result_value(j_user, G_OK) && json_object_get(json_object_get(j_user, "user"), "enabled") == json_true()) {
-              res = user_module->module->user_module_check_password(config->config_m, username, password, user_module->cls);
+              res = user_module_instance_check_password(config, user_module, username, password);
               if (res == G_OK) {
                 j_return = json_pack("{si}", "result", G_OK);
               } else if (res == G_ERROR_UNAUTHORIZED) {
                 j_return = json_pack("{si}", "result", G_ERROR_UNAUTHORIZED);
+              } else if (res == G_ERROR_UNAVAILABLE) {
+                j_return = json_pack("{si}", "result", G_ERROR_UNAVAILABLE);
               } else if (res != G_ERROR_NOT_FOUND) {
                 y_log_message(Y_LOG_LEVEL_ERROR, "auth_check_user_credentials - Error, user_module_check_password for module '%s', skip", user_module->name);
               }
@@ -54,10 +535,11 @@ json_t * auth_check_user_credentials(struct config_elements * config, const char
             json_decref(j_user);
           }
         } else {
-          y_log_message(Y_LOG_LEVEL_ERROR, "auth_check_user_credentials - Error, user_module_instance %s is NULL", json_string_value(json_object_get(j_module, "name")));
+          y_log_message(Y_LOG_LEVEL_ERROR, "auth_check_user_credentials - Error, user_module_instance %s is NULL", names[index]);
         }
       }
     }
+    glewlwyd_user_route_update(config, username, route, found_module);
   } else {
     y_log_message(Y_LOG_LEVEL_ERROR, "auth_check_user_credentials - Error get_user_module_list");
     j_return = json_pack("{si}", "result", G_ERROR);
@@ -65,6 +547,8 @@ json_t * auth_check_user_credentials(struct config_elements * config, const char
   if (j_return == NULL) {
     j_return = json_pack("{si}", "result", G_ERROR_UNAUTHORIZED);
   }
+  o_free(names);
+  o_free(route);
   json_decref(j_module_list);
   return j_return;
 }
@@ -305,10 +789,12 @@ int user_has_scheme(struct config_elements * config, const char * username, cons
   return ret;
 }
 
-json_t * get_user(struct config_elements * config, const char * username, const char * source) {
+static json_t * get_user_backend(struct config_elements * config, const char * username, const char * source) {
   int found = 0, result;
-  json_t * j_return = NULL, * j_user, * j_module_list, * j_module;
+  json_t * j_return = NULL, * j_user, * j_module_list;
   struct _user_module_instance * user_module;
+  const char ** names = NULL;
+  char * route = NULL;
   struct _user_middleware_module_instance * user_middleware_module;
   size_t index, i;
   
@@ -317,7 +803,7 @@ json_t * get_user(struct config_elements * config, const char * username, const
   } else if (source != NULL) {
     user_module = get_user_module_instance(config, source);
     if (user_module != NULL) {
-      j_user = user_module->module->user_module_get(config->config_m, username, user_module->cls);
+      j_user = user_module_instance_get(config, user_module, username);
       if (check_result_value(j_user, G_OK)) {
         result = G_OK;
         for (i=0; i<pointer_list_size(config->user_middleware_module_instance_list); i++) {
@@ -349,15 +835,16 @@ json_t * get_user(struct config_elements * config, const char * username, const
     }
   } else {
     j_module_list = get_user_module_list(config);
-    if (check_result_value(j_module_list, G_OK)) {
-      json_array_foreach(json_object_get(j_module_list, "module"), index, j_module) {
+    if (check_result_value(j_module_list, G_OK) && (names = get_user_module_lookup_order(j_module_list, (route = glewlwyd_user_route_get(config, username)))) != NULL) {
+      for (index=0; names[index]!=NULL; index++) {
         if (!found) {
-          user_module = get_user_module_instance(config, json_string_value(json_object_get(j_module, "name")));
+          user_module = get_user_module_instance(config, names[index]);
           if (user_module != NULL) {
             if (user_module->enabled) {
-              j_user = user_module->module->user_module_get(config->config_m, username, user_module->cls);
+              j_user = user_module_instance_get(config, user_module, username);
               if (check_result_value(j_user, G_OK)) {
                 found = 1;
+                glewlwyd_user_route_update(config, username, route, user_module);
                 result = G_OK;
                 for (i=0; i<pointer_list_size(config->user_middleware_module_instance_list); i++) {
                   user_middleware_module = (struct _user_middleware_module_instance *)pointer_list_get_at(config->user_middleware_module_instance_list, i);
@@ -376,20 +863,27 @@ json_t * get_user(struct config_elements * config, const char * username, const
                 } else {
                   j_return = json_pack("{si}", "result", result);
                 }
-              } else if (!check_result_value(j_user, G_ERROR_NOT_FOUND)) {
+              } else if (check_result_value(j_user, G_ERROR_NOT_FOUND)) {
+                glewlwyd_metrics_counter_add(user_module->metrics_route_miss, 1);
+              } else {
                 y_log_message(Y_LOG_LEVEL_ERROR, "get_user - Error, user_module_get for module %s", user_module->name);
               }
               json_decref(j_user);
             }
           } else {
-            y_log_message(Y_LOG_LEVEL_ERROR, "get_user - Error, user_module_instance %s is NULL", json_string_value(json_object_get(j_module, "name")));
+            y_log_message(Y_LOG_LEVEL_ERROR, "get_user - Error, user_module_instance %s is NULL", names[index]);
           }
         }
       }
+      if (!found) {
+        glewlwyd_user_route_update(config, username, route, NULL);
+      }
     } else {
       y_log_message(Y_LOG_LEVEL_ERROR, "get_user - Error get_user_module_list");
       j_return = json_pack("{si}", "result", G_ERROR_NOT_FOUND);
     }
+    o_free(names);
+    o_free(route);
     json_decref(j_module_list);
   }
   if (j_return == NULL) {
@@ -398,17 +892,39 @@ json_t * get_user(struct config_elements * config, const char * username, const
   return j_return;
 }
 
+/**
+ * Returns the user from the cache if available, otherwise from the user backends
+ * The user is cached with the source, or with a NULL source if looked up in all the backends
+ */
+json_t * get_user(struct config_elements * config, const char * username, const char * source) {
+  unsigned int generation = glewlwyd_user_cache_get_generation(config, username);
+  json_t * j_return, * j_user;
+
+  if ((j_user = glewlwyd_user_cache_get(config, username, source)) != NULL) {
+    j_return = json_pack("{sisO}", "result", G_OK, "user", j_user);
+    json_decref(j_user);
+  } else {
+    j_return = get_user_backend(config, username, source);
+    if (check_result_value(j_return, G_OK)) {
+      glewlwyd_user_cache_set(config, generation, source, username, json_object_get(j_return, "user"));
+    }
+  }
+  return j_return;
+}
+
 json_t * get_user_profile(struct config_elements * config, const char * username, const char * source) {
   int found = 0, result;
-  json_t * j_return = NULL, * j_module_list, * j_module, * j_profile;
+  json_t * j_return = NULL, * j_module_list, * j_profile;
   struct _user_module_instance * user_module;
+  const char ** names = NULL;
+  char * route = NULL;
   struct _user_middleware_module_instance * user_middleware_module;
   size_t index, i;
   
   if (source != NULL) {
     user_module = get_user_module_instance(config, source);
     if (user_module != NULL) {
-      j_profile = user_module->module->user_module_get_profile(config->config_m, username, user_module->cls);
+      j_profile = user_module_instance_get_profile(config, user_module, username);
       if (check_result_value(j_profile, G_OK)) {
         result = G_OK;
         for (i=0; i<pointer_list_size(config->user_middleware_module_instance_list); i++) {
@@ -439,14 +955,15 @@ json_t * get_user_profile(struct config_elements * config, const char * username
     }
   } else {
     j_module_list = get_user_module_list(config);
-    if (check_result_value(j_module_list, G_OK)) {
-      json_array_foreach(json_object_get(j_module_list, "module"), index, j_module) {
+    if (check_result_value(j_module_list, G_OK) && (names = get_user_module_lookup_order(j_module_list, (route = glewlwyd_user_route_get(config, username)))) != NULL) {
+      for (index=0; names[index]!=NULL; index++) {
         if (!found) {
-          user_module = get_user_module_instance(config, json_string_value(json_object_get(j_module, "name")));
+          user_module = get_user_module_instance(config, names[index]);
           if (user_module != NULL) {
             if (user_module->enabled) {
-              j_profile = user_module->module->user_module_get_profile(config->config_m, username, user_module->cls);
+              j_profile = user_module_instance_get_profile(config, user_module, username);
               if (check_result_value(j_profile, G_OK)) {
+                glewlwyd_user_route_update(config, username, route, user_module);
                 result = G_OK;
                 for (i=0; i<pointer_list_size(config->user_middleware_module_instance_list); i++) {
                   user_middleware_module = (struct _user_middleware_module_instance *)pointer_list_get_at(config->user_middleware_module_instance_list, i);
@@ -465,18 +982,25 @@ json_t * get_user_profile(struct config_elements * config, const char * username
                   j_return = json_pack("{si}", "result", result);
                 }
                 found = 1;
+              } else if (check_result_value(j_profile, G_ERROR_NOT_FOUND)) {
+                glewlwyd_metrics_counter_add(user_module->metrics_route_miss, 1);
               }
               json_decref(j_profile);
             }
           } else {
-            y_log_message(Y_LOG_LEVEL_ERROR, "get_user_profile - Error, user_module_instance %s is NULL", json_string_value(json_object_get(j_module, "name")));
+            y_log_message(Y_LOG_LEVEL_ERROR, "get_user_profile - Error, user_module_instance %s is NULL", names[index]);
           }
         }
       }
+      if (!found) {
+        glewlwyd_user_route_update(config, username, route, NULL);
+      }
     } else {
       y_log_message(Y_LOG_LEVEL_ERROR, "get_user_profile - Error get_user_module_list");
       j_return = json_pack("{si}", "result", G_ERROR);
     }
+    o_free(names);
+    o_free(route);
     json_decref(j_module_list);
   }
   if (j_return == NULL) {
@@ -495,7 +1019,7 @@ json_t * get_user_list(struct config_elements * config, const char * pattern, si
   if (source != NULL) {
     user_module = get_user_module_instance(config, source);
     if (user_module != NULL && user_module->enabled) {
-      j_result = user_module->module->user_module_get_list(config->config_m, pattern, offset, limit, user_module->cls);
+      j_result = user_module_instance_get_list(config, user_module, pattern, offset, limit);
       if (check_result_value(j_result, G_OK)) {
         json_array_foreach(json_object_get(j_result, "list"), index, j_element) {
           json_object_set_new(j_element, "source", json_string(source));
@@ -523,8 +1047,8 @@ json_t * get_user_list(struct config_elements * config, const char * pattern, si
           if (cur_limit) {
             user_module = get_user_module_instance(config, json_string_value(json_object_get(j_module, "name")));
             if (user_module != NULL && user_module->enabled) {
-              if ((count_total = user_module->module->user_module_count_total(config->config_m, pattern, user_module->cls)) > cur_offset && cur_limit) {
-                j_result = user_module->module->user_module_get_list(config->config_m, pattern, cur_offset, cur_limit, user_module->cls);
+              if ((count_total = user_module_instance_count_total(config, user_module, pattern)) > cur_offset && cur_limit) {
+                j_result = user_module_instance_get_list(config, user_module, pattern, cur_offset, cur_limit);
                 if (check_result_value(j_result, G_OK)) {
                   json_array_foreach(json_object_get(j_result, "list"), index_u, j_element) {
                     json_object_set_new(j_element, "source", json_string(user_module->name));
@@ -586,7 +1110,7 @@ json_t * is_user_valid(struct config_elements * config, const char * username, j
   if (source != NULL) {
     user_module = get_user_module_instance(config, source);
     if (user_module != NULL && user_module->enabled && !user_module->readonly) {
-      j_error_list = user_module->module->user_module_is_valid(config->config_m, username, j_user, add?GLEWLWYD_IS_VALID_MODE_ADD:GLEWLWYD_IS_VALID_MODE_UPDATE, user_module->cls);
+      j_error_list = user_module_instance_is_valid(config, user_module, username, j_user, add?GLEWLWYD_IS_VALID_MODE_ADD:GLEWLWYD_IS_VALID_MODE_UPDATE);
       if (check_result_value(j_error_list, G_ERROR_PARAM)) {
         j_return = json_incref(j_error_list);
       } else if (check_result_value(j_error_list, G_OK)) {
@@ -612,7 +1136,7 @@ json_t * is_user_valid(struct config_elements * config, const char * username, j
           user_module = get_user_module_instance(config, json_string_value(json_object_get(j_module, "name")));
           if (user_module != NULL && user_module->enabled && !user_module->readonly) {
             found = 1;
-            j_error_list = user_module->module->user_module_is_valid(config->config_m, username, j_user, add?GLEWLWYD_IS_VALID_MODE_ADD:GLEWLWYD_IS_VALID_MODE_UPDATE, user_module->cls);
+            j_error_list = user_module_instance_is_valid(config, user_module, username, j_user, add?GLEWLWYD_IS_VALID_MODE_ADD:GLEWLWYD_IS_VALID_MODE_UPDATE);
             if (check_result_value(j_error_list, G_ERROR_PARAM)) {
               j_return = json_incref(j_error_list);
             } else if (check_result_value(j_error_list, G_OK)) {
@@ -663,8 +1187,9 @@ int add_user(struct config_elements * config, json_t * j_user, const char * sour
         }
       }
       if (result == G_OK) {
-        result = user_module->module->user_module_add(config->config_m, j_user, user_module->cls);
+        result = user_module_instance_add(config, user_module, j_user);
         if (result == G_OK) {
+          glewlwyd_user_route_set(config, json_string_value(json_object_get(j_user, "username")), NULL);
           ret = G_OK;
         } else {
           y_log_message(Y_LOG_LEVEL_ERROR, "add_user - Error user_module_add");
@@ -698,8 +1223,9 @@ int add_user(struct config_elements * config, json_t * j_user, const char * sour
             }
             found = 1;
             if (result == G_OK) {
-              result = user_module->module->user_module_add(config->config_m, j_user, user_module->cls);
+              result = user_module_instance_add(config, user_module, j_user);
               if (result == G_OK) {
+                glewlwyd_user_route_set(config, json_string_value(json_object_get(j_user, "username")), NULL);
                 ret = G_OK;
               } else {
                 y_log_message(Y_LOG_LEVEL_ERROR, "add_user - Error user_module_add");
@@ -745,9 +1271,9 @@ int set_user(struct config_elements * config, const char * username, json_t * j_
         }
       }
       if (result == G_OK) {
-        j_cur_user = user_module->module->user_module_get(config->config_m, username, user_module->cls);
+        j_cur_user = user_module_instance_get(config, user_module, username);
         if (check_result_value(j_cur_user, G_OK)) {
-          ret = user_module->module->user_module_update(config->config_m, username, j_user, user_module->cls);
+          ret = user_module_instance_update(config, user_module, username, j_user);
           if (ret != G_OK) {
             y_log_message(Y_LOG_LEVEL_ERROR, "set_user - Error user_module_update");
           }
@@ -783,7 +1309,7 @@ int delete_user(struct config_elements * config, const char * username, const ch
   if (source != NULL) {
     user_module = get_user_module_instance(config, source);
     if (user_module != NULL && user_module->enabled && !user_module->readonly) {
-      j_cur_user = user_module->module->user_module_get(config->config_m, username, user_module->cls);
+      j_cur_user = user_module_instance_get(config, user_module, username);
       if (check_result_value(j_cur_user, G_OK)) {
         for (i=0; i<pointer_list_size(config->user_middleware_module_instance_list); i++) {
           user_middleware_module = (struct _user_middleware_module_instance *)pointer_list_get_at(config->user_middleware_module_instance_list, i);
@@ -796,8 +1322,9 @@ int delete_user(struct config_elements * config, const char * username, const ch
             y_log_message(Y_LOG_LEVEL_ERROR, "delete_user - Error pointer_list_get_at for user_middleware module at index %zu", i);
           }
         }
-        result = user_module->module->user_module_delete(config->config_m, username, user_module->cls);
+        result = user_module_instance_delete(config, user_module, username);
         if (result == G_OK) {
+          glewlwyd_user_route_set(config, username, NULL);
           ret = G_OK;
         } else {
           y_log_message(Y_LOG_LEVEL_ERROR, "delete_user - Error user_module_delete");
@@ -840,7 +1367,7 @@ json_t * user_get_profile(struct config_elements * config, const char * username
   if (check_result_value(j_user, G_OK)) {
     user_module = get_user_module_instance(config, json_string_value(json_object_get(json_object_get(j_user, "user"), "source")));
     if (user_module != NULL && user_module->enabled) {
-      j_profile = user_module->module->user_module_get_profile(config->config_m, username, user_module->cls);
+      j_profile = user_module_instance_get_profile(config, user_module, username);
       if (check_result_value(j_profile, G_OK)) {
         j_return = json_pack("{sisO}", "result", G_OK, "profile", j_profile);
       } else {
@@ -869,7 +1396,7 @@ json_t * user_set_profile(struct config_elements * config, const char * username
   if (check_result_value(j_user, G_OK)) {
     user_module = get_user_module_instance(config, json_string_value(json_object_get(json_object_get(j_user, "user"), "source")));
     if (user_module != NULL && user_module->enabled && !user_module->readonly) {
-      j_return = json_pack("{si}", "result", user_module->module->user_module_update_profile(config->config_m, username, j_profile, user_module->cls));
+      j_return = json_pack("{si}", "result", user_module_instance_update_profile(config, user_module, username, j_profile));
     } else if (user_module != NULL && (user_module->readonly || !user_module->enabled)) {
       j_return = json_pack("{sis[s]}", "result", G_ERROR_PARAM, "error", "profile update is not allowed");
     } else {
@@ -899,11 +1426,11 @@ int user_delete_profile(struct config_elements * config, const char * username)
       ret = G_OK;
       if (config->delete_profile & GLEWLWYD_PROFILE_DELETE_DISABLE_PROFILE) {
         json_object_set(json_object_get(j_user, "user"), "enabled", json_false());
-        if ((ret = user_module->module->user_module_update(config->config_m, username, json_object_get(j_user, "user"), user_module->cls)) != G_OK) {
+        if ((ret = user_module_instance_update(config, user_module, username, json_object_get(j_user, "user"))) != G_OK) {
           y_log_message(Y_LOG_LEVEL_ERROR, "user_delete_profile - Error user_module_update_profile");
         }
       } else {
-        if ((ret = user_module->module->user_module_delete(config->config_m, username, user_module->cls)) != G_OK) {
+        if ((ret = user_module_instance_delete(config, user_module, username)) != G_OK) {
           y_log_message(Y_LOG_LEVEL_ERROR, "user_delete_profile - Error user_module_delete");
         }
       }
@@ -941,11 +1468,11 @@ int user_update_password(struct config_elements * config, const char * username,
   if (check_result_value(j_user, G_OK)) {
     user_module = get_user_module_instance(config, json_string_value(json_object_get(json_object_get(j_user, "user"), "source")));
     if (user_module != NULL && user_module->enabled && !user_module->readonly) {
-      if ((ret = user_module->module->user_module_check_password(config->config_m, username, old_password, user_module->cls)) == G_OK) {
-        ret = user_module->module->user_module_update_password(config->config_m, username, new_passwords, new_passwords_len, user_module->cls);
+      if ((ret = user_module_instance_check_password(config, user_module, username, old_password)) == G_OK) {
+        ret = user_module_instance_update_password(config, user_module, username, new_passwords, new_passwords_len);
       } else if (ret == G_ERROR_UNAUTHORIZED) {
         ret = G_ERROR_PARAM;
-      } else {
+      } else if (ret != G_ERROR_UNAVAILABLE) {
         y_log_message(Y_LOG_LEVEL_ERROR, "user_set_profile - Error user_module_check_password");
         ret = G_ERROR;
       }
@@ -973,7 +1500,7 @@ int user_set_password(struct config_elements * config, const char * username, co
   if (check_result_value(j_user, G_OK)) {
     user_module = get_user_module_instance(config, json_string_value(json_object_get(json_object_get(j_user, "user"), "source")));
     if (user_module != NULL && user_module->enabled && !user_module->readonly) {
-      ret = user_module->module->user_module_update_password(config->config_m, username, new_passwords, new_passwords_len, user_module->cls);
+      ret = user_module_instance_update_password(config, user_module, username, new_passwords, new_passwords_len);
     } else if (user_module != NULL && (user_module->readonly || !user_module->enabled)) {
       ret = G_ERROR_PARAM;
     } else {
@@ -1048,3 +1575,150 @@ json_t * glewlwyd_module_callback_check_user_session(struct config_module * conf
   o_free(session_uid);
   return j_return;
 }
+
+/**
+ * User module calls, measure the duration and the number of concurrent calls of each module function
+ * Calls that change a user remove it from the user cache
+ */
+json_t * user_module_instance_init(struct config_elements * config, struct _user_module_instance * instance, json_t * j_parameters) {
+  struct timespec start;
+  json_t * j_return;
+
+  glewlwyd_metrics_call_start(instance->metrics_in_flight, &start);
+  j_return = instance->module->user_module_init(config->config_m, instance->readonly, instance->multiple_passwords, j_parameters, &instance->cls);
+  glewlwyd_metrics_call_end(instance->metrics_in_flight, instance->metrics_duration[GLWD_METRICS_USER_MODULE_INIT], &start);
+  return j_return;
+}
+
+int user_module_instance_close(struct config_elements * config, struct _user_module_instance * instance) {
+  struct timespec start;
+  int ret;
+
+  glewlwyd_metrics_call_start(instance->metrics_in_flight, &start);
+  ret = instance->module->user_module_close(config->config_m, instance->cls);
+  glewlwyd_metrics_call_end(instance->metrics_in_flight, instance->metrics_duration[GLWD_METRICS_USER_MODULE_CLOSE], &start);
+  return ret;
+}
+
+size_t user_module_instance_count_total(struct config_elements * config, struct _user_module_instance * instance, const char * pattern) {
+  struct timespec start;
+  size_t ret;
+
+  glewlwyd_metrics_call_start(instance->metrics_in_flight, &start);
+  ret = instance->module->user_module_count_total(config->config_m, pattern, instance->cls);
+  glewlwyd_metrics_call_end(instance->metrics_in_flight, instance->metrics_duration[GLWD_METRICS_USER_MODULE_COUNT_TOTAL], &start);
+  return ret;
+}
+
+json_t * user_module_instance_get_list(struct config_elements * config, struct _user_module_instance * instance, const char * pattern, size_t offset, size_t limit) {
+  struct timespec start;
+  json_t * j_return;
+
+  glewlwyd_metrics_call_start(instance->metrics_in_flight, &start);
+  j_return = instance->module->user_module_get_list(config->config_m, pattern, offset, limit, instance->cls);
+  glewlwyd_metrics_call_end(instance->metrics_in_flight, instance->metrics_duration[GLWD_METRICS_USER_MODULE_GET_LIST], &start);
+  return j_return;
+}
+
+json_t * user_module_instance_get(struct config_elements * config, struct _user_module_instance * instance, const char * username) {
+  struct timespec start;
+  json_t * j_return;
+
+  glewlwyd_metrics_call_start(instance->metrics_in_flight, &start);
+  j_return = instance->module->user_module_get(config->config_m, username, instance->cls);
+  glewlwyd_metrics_call_end(instance->metrics_in_flight, instance->metrics_duration[GLWD_METRICS_USER_MODULE_GET], &start);
+  return j_return;
+}
+
+json_t * user_module_instance_get_profile(struct config_elements * config, struct _user_module_instance * instance, const char * username) {
+  struct timespec start;
+  json_t * j_return;
+
+  glewlwyd_metrics_call_start(instance->metrics_in_flight, &start);
+  j_return = instance->module->user_module_get_profile(config->config_m, username, instance->cls);
+  glewlwyd_metrics_call_end(instance->metrics_in_flight, instance->metrics_duration[GLWD_METRICS_USER_MODULE_GET_PROFILE], &start);
+  return j_return;
+}
+
+json_t * user_module_instance_is_valid(struct config_elements * config, struct _user_module_instance * instance, const char * username, json_t * j_user, int mode) {
+  struct timespec start;
+  json_t * j_return;
+
+  glewlwyd_metrics_call_start(instance->metrics_in_flight, &start);
+  j_return = instance->module->user_module_is_valid(config->config_m, username, j_user, mode, instance->cls);
+  glewlwyd_metrics_call_end(instance->metrics_in_flight, instance->metrics_duration[GLWD_METRICS_USER_MODULE_IS_VALID], &start);
+  return j_return;
+}
+
+int user_module_instance_add(struct config_elements * config, struct _user_module_instance * instance, json_t * j_user) {
+  struct timespec start;
+  int ret;
+
+  glewlwyd_metrics_call_start(instance->metrics_in_flight, &start);
+  ret = instance->module->user_module_add(config->config_m, j_user, instance->cls);
+  glewlwyd_metrics_call_end(instance->metrics_in_flight, instance->metrics_duration[GLWD_METRICS_USER_MODULE_ADD], &start);
+  glewlwyd_user_cache_invalidate(config, instance->name, json_string_value(json_object_get(j_user, "username")));
+  return ret;
+}
+
+int user_module_instance_update(struct config_elements * config, struct _user_module_instance * instance, const char * username, json_t * j_user) {
+  struct timespec start;
+  int ret;
+
+  glewlwyd_metrics_call_start(instance->metrics_in_flight, &start);
+  ret = instance->module->user_module_update(config->config_m, username, j_user, instance->cls);
+  glewlwyd_metrics_call_end(instance->metrics_in_flight, instance->metrics_duration[GLWD_METRICS_USER_MODULE_UPDATE], &start);
+  glewlwyd_user_cache_invalidate(config, instance->name, username);
+  return ret;
+}
+
+int user_module_instance_update_profile(struct config_elements * config, struct _user_module_instance * instance, const char * username, json_t * j_user) {
+  struct timespec start;
+  int ret;
+
+  glewlwyd_metrics_call_start(instance->metrics_in_flight, &start);
+  ret = instance->module->user_module_update_profile(config->config_m, username, j_user, instance->cls);
+  glewlwyd_metrics_call_end(instance->metrics_in_flight, instance->metrics_duration[GLWD_METRICS_USER_MODULE_UPDATE_PROFILE], &start);
+  glewlwyd_user_cache_invalidate(config, instance->name, username);
+  return ret;
+}
+
+int user_module_instance_delete(struct config_elements * config, struct _user_module_instance * instance, const char * username) {
+  struct timespec start;
+  int ret;
+
+  glewlwyd_metrics_call_start(instance->metrics_in_flight, &start);
+  ret = instance->module->user_module_delete(config->config_m, username, instance->cls);
+  glewlwyd_metrics_call_end(instance->metrics_in_flight, instance->metrics_duration[GLWD_METRICS_USER_MODULE_DELETE], &start);
+  glewlwyd_user_cache_invalidate(config, instance->name, username);
+  return ret;
+}
+
+static int user_module_instance_run_check_password(struct config_elements * config, void * instance, const char * username, const char * password) {
+  struct _user_module_instance * user_module = (struct _user_module_instance *)instance;
+  struct timespec start;
+  int ret;
+
+  glewlwyd_metrics_call_start(user_module->metrics_in_flight, &start);
+  ret = user_module->module->user_module_check_password(config->config_m, username, password, user_module->cls);
+  glewlwyd_metrics_call_end(user_module->metrics_in_flight, user_module->metrics_duration[GLWD_METRICS_USER_MODULE_CHECK_PASSWORD], &start);
+  return ret;
+}
+
+/**
+ * The password check is run by the password pool if enabled, returns G_ERROR_UNAVAILABLE if the pool is busy
+ */
+int user_module_instance_check_password(struct config_elements * config, struct _user_module_instance * instance, const char * username, const char * password) {
+  return glewlwyd_password_pool_run(config, 0, &user_module_instance_run_check_password, (void *)instance, username, password);
+}
+
+int user_module_instance_update_password(struct config_elements * config, struct _user_module_instance * instance, const char * username, const char ** new_passwords, size_t new_passwords_len) {
+  struct timespec start;
+  int ret;
+
+  glewlwyd_metrics_call_start(instance->metrics_in_flight, &start);
+  ret = instance->module->user_module_update_password(config->config_m, username, new_passwords, new_passwords_len, instance->cls);
+  glewlwyd_metrics_call_end(instance->metrics_in_flight, instance->metrics_duration[GLWD_METRICS_USER_MODULE_UPDATE_PASSWORD], &start);
+  glewlwyd_user_cache_invalidate(config, instance->name, username);
+  return ret;
+}
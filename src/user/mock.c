@@ -33,6 +33,7 @@
  */
 
 #include <string.h>
+#include <unistd.h>
 #include <jansson.h>
 #include <yder.h>
 #include <orcania.h>
@@ -254,6 +255,10 @@ json_t * user_module_init(struct config_module * config, int readonly, int multi
                                 "scope1",
                                 "scope2",
                                 "scope3");
+    if (json_integer_value(json_object_get(j_parameters, "password-check-delay")) > 0) {
+      // Delay of the password checks in milliseconds, used to test the password pool
+      json_object_set((json_t *)*cls, "password-check-delay", json_object_get(j_parameters, "password-check-delay"));
+    }
     y_log_message(Y_LOG_LEVEL_DEBUG, "user_module_init - success prefix: '%s', profile_scope: '%s', admin_scope: '%s'", prefix, config->profile_scope, config->admin_scope);
     j_return = json_pack("{si}", "result", G_OK);
   } else {
@@ -709,6 +714,9 @@ int user_module_check_password(struct config_module * config, const char * usern
   size_t index = 0;
   
   if (check_result_value(j_user, G_OK)) {
+    if (json_integer_value(json_object_get((json_t *)cls, "password-check-delay")) > 0) {
+      usleep((useconds_t)json_integer_value(json_object_get((json_t *)cls, "password-check-delay"))*1000);
+    }
     if (json_is_array(json_object_get((json_t *)cls, "password"))) {
       ret = G_ERROR_UNAUTHORIZED;
       json_array_foreach(json_object_get((json_t *)cls, "password"), index, j_element) {
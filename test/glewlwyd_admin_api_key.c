@@ -5,6 +5,7 @@
 #include <string.h>
 #include <errno.h>
 #include <time.h>
+#include <unistd.h>
 
 #include <check.h>
 #include <ulfius.h>
@@ -17,8 +18,73 @@
 #define USERNAME "admin"
 #define PASSWORD "password"
 
+// api_key_flush_interval of the test instance, the API keys counters are written and the enabled API keys are reloaded at this interval
+#define API_KEY_FLUSH_INTERVAL 2
+#define API_KEY_NB_USE 5
+
 struct _u_request admin_req;
 
+/**
+ * Adds an API key issued for user_agent, returns the Authorization header value and the token hash
+ */
+static void api_key_add(const char * user_agent, char ** header, char ** token_hash) {
+  struct _u_request req;
+  struct _u_response resp;
+  json_t * j_body;
+  char * url = msprintf(SERVER_URI "/key?pattern=%s", user_agent);
+
+  ulfius_init_request(&req);
+  ulfius_copy_request(&req, &admin_req);
+  ulfius_init_response(&resp);
+  ck_assert_int_eq(ulfius_set_request_properties(&req, U_OPT_HTTP_VERB, "POST", U_OPT_HTTP_URL, SERVER_URI "/key", U_OPT_HEADER_PARAMETER, "User-Agent", user_agent, U_OPT_NONE), U_OK);
+  ck_assert_int_eq(ulfius_send_http_request(&req, &resp), U_OK);
+  ck_assert_int_eq(200, resp.status);
+  ck_assert_ptr_ne(NULL, j_body = ulfius_get_json_body_response(&resp, NULL));
+  ck_assert_int_gt(json_string_length(json_object_get(j_body, "key")), 0);
+  *header = msprintf("token %s", json_string_value(json_object_get(j_body, "key")));
+  json_decref(j_body);
+  ulfius_clean_response(&resp);
+
+  ulfius_init_response(&resp);
+  ck_assert_int_eq(ulfius_set_request_properties(&req, U_OPT_HTTP_VERB, "GET", U_OPT_HTTP_URL, url, U_OPT_NONE), U_OK);
+  ck_assert_int_eq(ulfius_send_http_request(&req, &resp), U_OK);
+  ck_assert_int_eq(200, resp.status);
+  ck_assert_ptr_ne(NULL, j_body = ulfius_get_json_body_response(&resp, NULL));
+  ck_assert_int_eq(json_array_size(j_body), 1);
+  *token_hash = o_strdup(json_string_value(json_object_get(json_array_get(j_body, 0), "token_hash")));
+  json_decref(j_body);
+  ulfius_clean_response(&resp);
+
+  ulfius_clean_request(&req);
+  o_free(url);
+}
+
+/**
+ * Returns the counter of the API key issued for user_agent
+ */
+static json_int_t api_key_get_counter(const char * user_agent) {
+  struct _u_request req;
+  struct _u_response resp;
+  json_t * j_body;
+  json_int_t counter = -1;
+  char * url = msprintf(SERVER_URI "/key?pattern=%s", user_agent);
+
+  ulfius_init_request(&req);
+  ulfius_copy_request(&req, &admin_req);
+  ulfius_init_response(&resp);
+  ulfius_set_request_properties(&req, U_OPT_HTTP_VERB, "GET", U_OPT_HTTP_URL, url, U_OPT_NONE);
+  if (ulfius_send_http_request(&req, &resp) == U_OK && resp.status == 200 && (j_body = ulfius_get_json_body_response(&resp, NULL)) != NULL) {
+    if (json_array_size(j_body) == 1) {
+      counter = json_integer_value(json_object_get(json_array_get(j_body, 0), "counter"));
+    }
+    json_decref(j_body);
+  }
+  ulfius_clean_response(&resp);
+  ulfius_clean_request(&req);
+  o_free(url);
+  return counter;
+}
+
 START_TEST(test_glwd_admin_api_key_add)
 {
   ck_assert_int_eq(run_simple_test(NULL, "POST", SERVER_URI "/key", NULL, NULL, NULL, NULL, 401, NULL, NULL, NULL), 1);
@@ -110,6 +176,68 @@ START_TEST(test_glwd_admin_api_key_disable)
 }
 END_TEST
 
+START_TEST(test_glwd_admin_api_key_counter)
+{
+  struct _u_request req_api;
+  // The user agent identifies the API key in the list, it must be unique if the test is run again
+  char * header = NULL, * token_hash = NULL, * user_agent = msprintf("glewlwyd_admin_api_key_counter-%ld", (long)time(NULL));
+  int i;
+
+  ulfius_init_request(&req_api);
+  api_key_add(user_agent, &header, &token_hash);
+  ck_assert_int_eq(ulfius_set_request_properties(&req_api, U_OPT_HEADER_PARAMETER, "Authorization", header, U_OPT_NONE), U_OK);
+
+  for (i=0; i<API_KEY_NB_USE; i++) {
+    ck_assert_int_eq(run_simple_test(&req_api, "GET", SERVER_URI "/mod/type", NULL, NULL, NULL, NULL, 200, NULL, NULL, NULL), 1);
+  }
+  // The counters used in the same interval are written in the database in one batch
+  sleep(API_KEY_FLUSH_INTERVAL+1);
+  ck_assert_int_eq(api_key_get_counter(user_agent), API_KEY_NB_USE);
+
+  ck_assert_int_eq(run_simple_test(&req_api, "GET", SERVER_URI "/mod/type", NULL, NULL, NULL, NULL, 200, NULL, NULL, NULL), 1);
+  sleep(API_KEY_FLUSH_INTERVAL+1);
+  ck_assert_int_eq(api_key_get_counter(user_agent), API_KEY_NB_USE+1);
+
+  o_free(header);
+  o_free(token_hash);
+  o_free(user_agent);
+  ulfius_clean_request(&req_api);
+}
+END_TEST
+
+START_TEST(test_glwd_admin_api_key_revoked)
+{
+  struct _u_request req_api;
+  // The user agent identifies the API key in the list, it must be unique if the test is run again
+  char * header = NULL, * token_hash = NULL, * url, * user_agent = msprintf("glewlwyd_admin_api_key_revoked-%ld", (long)time(NULL));
+  int i;
+
+  ulfius_init_request(&req_api);
+  api_key_add(user_agent, &header, &token_hash);
+  ck_assert_int_eq(ulfius_set_request_properties(&req_api, U_OPT_HEADER_PARAMETER, "Authorization", header, U_OPT_NONE), U_OK);
+
+  for (i=0; i<API_KEY_NB_USE; i++) {
+    ck_assert_int_eq(run_simple_test(&req_api, "GET", SERVER_URI "/user", NULL, NULL, NULL, NULL, 200, NULL, NULL, NULL), 1);
+  }
+
+  // The API key disabled by the admin API is removed from the enabled API keys set immediately
+  url = msprintf(SERVER_URI "/key/%s", token_hash);
+  ck_assert_int_eq(run_simple_test(&admin_req, "DELETE", url, NULL, NULL, NULL, NULL, 200, NULL, NULL, NULL), 1);
+  ck_assert_int_eq(run_simple_test(&req_api, "GET", SERVER_URI "/user", NULL, NULL, NULL, NULL, 401, NULL, NULL, NULL), 1);
+
+  // The API key is still rejected after the enabled API keys set is reloaded, and the uses before it was disabled are counted
+  sleep(API_KEY_FLUSH_INTERVAL+1);
+  ck_assert_int_eq(run_simple_test(&req_api, "GET", SERVER_URI "/user", NULL, NULL, NULL, NULL, 401, NULL, NULL, NULL), 1);
+  ck_assert_int_eq(api_key_get_counter(user_agent), API_KEY_NB_USE);
+
+  o_free(url);
+  o_free(header);
+  o_free(token_hash);
+  o_free(user_agent);
+  ulfius_clean_request(&req_api);
+}
+END_TEST
+
 static Suite *glewlwyd_suite(void)
 {
   Suite *s;
@@ -120,6 +248,8 @@ static Suite *glewlwyd_suite(void)
   tcase_add_test(tc_core, test_glwd_admin_api_key_add);
   tcase_add_test(tc_core, test_glwd_admin_api_key_use);
   tcase_add_test(tc_core, test_glwd_admin_api_key_disable);
+  tcase_add_test(tc_core, test_glwd_admin_api_key_counter);
+  tcase_add_test(tc_core, test_glwd_admin_api_key_revoked);
   tcase_set_timeout(tc_core, 30);
   suite_add_tcase(s, tc_core);
 
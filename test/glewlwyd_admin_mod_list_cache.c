@@ -0,0 +1,245 @@
+/* Public domain, no copyright. Use at your own risk. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <check.h>
+#include <ulfius.h>
+#include <orcania.h>
+#include <yder.h>
+
+#include "unit-tests.h"
+
+#define SERVER_URI "http://localhost:4593/api"
+#define USERNAME "admin"
+#define PASSWORD "password"
+#define MODULE_MODULE "mock"
+#define MODULE_NAME_1 "mod_list_cache_1"
+#define MODULE_NAME_2 "mod_list_cache_2"
+#define MODULE_DISPLAY_NAME "module list cache"
+#define USER_PREFIX "list-cache-"
+#define CLIENT_PREFIX "list-cache-"
+
+// Both instances of each module type have the same users or clients, the first one in the lookup order is the source
+#define USER_URL SERVER_URI "/user/" USER_PREFIX "user1"
+#define CLIENT_URL SERVER_URI "/client/" CLIENT_PREFIX "client1_id"
+
+struct _u_request admin_req;
+
+/**
+ * Returns the source of the user or client at url, NULL if not found
+ */
+static char * get_source(const char * url) {
+  struct _u_response resp;
+  json_t * j_body;
+  char * source = NULL;
+
+  ulfius_init_response(&resp);
+  o_free(admin_req.http_verb);
+  o_free(admin_req.http_url);
+  admin_req.http_verb = o_strdup("GET");
+  admin_req.http_url = o_strdup(url);
+  ck_assert_int_eq(ulfius_send_http_request(&admin_req, &resp), U_OK);
+  if (resp.status == 200) {
+    j_body = ulfius_get_json_body_response(&resp, NULL);
+    source = o_strdup(json_string_value(json_object_get(j_body, "source")));
+    json_decref(j_body);
+  } else {
+    ck_assert_int_eq(resp.status, 404);
+  }
+  ulfius_clean_response(&resp);
+  return source;
+}
+
+static void check_source(const char * url, const char * expected) {
+  char * source = get_source(url);
+
+  if (expected != NULL) {
+    ck_assert_ptr_ne(source, NULL);
+    ck_assert_str_eq(source, expected);
+  } else {
+    ck_assert_ptr_eq(source, NULL);
+  }
+  o_free(source);
+}
+
+/**
+ * Checks that the module instance list at url has name with display_name, or hasn't name if display_name is NULL
+ */
+static void check_module_list(const char * url, const char * name, const char * display_name) {
+  struct _u_response resp;
+  json_t * j_body, * j_element = NULL, * j_module = NULL;
+  size_t index = 0;
+
+  ulfius_init_response(&resp);
+  o_free(admin_req.http_verb);
+  o_free(admin_req.http_url);
+  admin_req.http_verb = o_strdup("GET");
+  admin_req.http_url = o_strdup(url);
+  ck_assert_int_eq(ulfius_send_http_request(&admin_req, &resp), U_OK);
+  ck_assert_int_eq(resp.status, 200);
+  j_body = ulfius_get_json_body_response(&resp, NULL);
+  json_array_foreach(j_body, index, j_element) {
+    if (0 == o_strcmp(name, json_string_value(json_object_get(j_element, "name")))) {
+      j_module = j_element;
+    }
+  }
+  if (display_name != NULL) {
+    ck_assert_ptr_ne(j_module, NULL);
+    ck_assert_str_eq(json_string_value(json_object_get(j_module, "display_name")), display_name);
+  } else {
+    ck_assert_ptr_eq(j_module, NULL);
+  }
+  json_decref(j_body);
+  ulfius_clean_response(&resp);
+}
+
+START_TEST(test_glwd_admin_mod_list_cache_user)
+{
+  json_t * j_parameters;
+
+  check_source(USER_URL, NULL);
+
+  // A new instance is used by the next lookup
+  j_parameters = json_pack("{sssssssisos{ss}}", "module", MODULE_MODULE, "name", MODULE_NAME_1, "display_name", MODULE_DISPLAY_NAME, "order_rank", 100, "readonly", json_false(), "parameters", "username-prefix", USER_PREFIX);
+  ck_assert_int_eq(run_simple_test(&admin_req, "POST", SERVER_URI "/mod/user/", NULL, NULL, j_parameters, NULL, 200, NULL, NULL, NULL), 1);
+  json_decref(j_parameters);
+  check_module_list(SERVER_URI "/mod/user/", MODULE_NAME_1, MODULE_DISPLAY_NAME);
+  check_source(USER_URL, MODULE_NAME_1);
+
+  j_parameters = json_pack("{sssssssisos{ss}}", "module", MODULE_MODULE, "name", MODULE_NAME_2, "display_name", MODULE_DISPLAY_NAME, "order_rank", 99, "readonly", json_false(), "parameters", "username-prefix", USER_PREFIX);
+  ck_assert_int_eq(run_simple_test(&admin_req, "POST", SERVER_URI "/mod/user/", NULL, NULL, j_parameters, NULL, 200, NULL, NULL, NULL), 1);
+  json_decref(j_parameters);
+  check_source(USER_URL, MODULE_NAME_2);
+
+  // The new order is used by the next lookup
+  j_parameters = json_pack("{sssisos{ss}}", "display_name", MODULE_DISPLAY_NAME "-2", "order_rank", 101, "readonly", json_false(), "parameters", "username-prefix", USER_PREFIX);
+  ck_assert_int_eq(run_simple_test(&admin_req, "PUT", SERVER_URI "/mod/user/" MODULE_NAME_2, NULL, NULL, j_parameters, NULL, 200, NULL, NULL, NULL), 1);
+  json_decref(j_parameters);
+  check_module_list(SERVER_URI "/mod/user/", MODULE_NAME_2, MODULE_DISPLAY_NAME "-2");
+  check_source(USER_URL, MODULE_NAME_1);
+
+  // A disabled instance is skipped
+  ck_assert_int_eq(run_simple_test(&admin_req, "PUT", SERVER_URI "/mod/user/" MODULE_NAME_1 "/disable", NULL, NULL, NULL, NULL, 200, NULL, NULL, NULL), 1);
+  check_source(USER_URL, MODULE_NAME_2);
+  ck_assert_int_eq(run_simple_test(&admin_req, "PUT", SERVER_URI "/mod/user/" MODULE_NAME_1 "/enable", NULL, NULL, NULL, NULL, 200, NULL, NULL, NULL), 1);
+  check_source(USER_URL, MODULE_NAME_1);
+
+  // A deleted instance isn't used anymore
+  ck_assert_int_eq(run_simple_test(&admin_req, "DELETE", SERVER_URI "/mod/user/" MODULE_NAME_1, NULL, NULL, NULL, NULL, 200, NULL, NULL, NULL), 1);
+  check_module_list(SERVER_URI "/mod/user/", MODULE_NAME_1, NULL);
+  check_source(USER_URL, MODULE_NAME_2);
+  ck_assert_int_eq(run_simple_test(&admin_req, "DELETE", SERVER_URI "/mod/user/" MODULE_NAME_2, NULL, NULL, NULL, NULL, 200, NULL, NULL, NULL), 1);
+  check_module_list(SERVER_URI "/mod/user/", MODULE_NAME_2, NULL);
+  check_source(USER_URL, NULL);
+}
+END_TEST
+
+START_TEST(test_glwd_admin_mod_list_cache_client)
+{
+  json_t * j_parameters;
+
+  check_source(CLIENT_URL, NULL);
+
+  // A new instance is used by the next lookup
+  j_parameters = json_pack("{sssssssisos{ss}}", "module", MODULE_MODULE, "name", MODULE_NAME_1, "display_name", MODULE_DISPLAY_NAME, "order_rank", 100, "readonly", json_false(), "parameters", "client-id-prefix", CLIENT_PREFIX);
+  ck_assert_int_eq(run_simple_test(&admin_req, "POST", SERVER_URI "/mod/client/", NULL, NULL, j_parameters, NULL, 200, NULL, NULL, NULL), 1);
+  json_decref(j_parameters);
+  check_module_list(SERVER_URI "/mod/client/", MODULE_NAME_1, MODULE_DISPLAY_NAME);
+  check_source(CLIENT_URL, MODULE_NAME_1);
+
+  j_parameters = json_pack("{sssssssisos{ss}}", "module", MODULE_MODULE, "name", MODULE_NAME_2, "display_name", MODULE_DISPLAY_NAME, "order_rank", 99, "readonly", json_false(), "parameters", "client-id-prefix", CLIENT_PREFIX);
+  ck_assert_int_eq(run_simple_test(&admin_req, "POST", SERVER_URI "/mod/client/", NULL, NULL, j_parameters, NULL, 200, NULL, NULL, NULL), 1);
+  json_decref(j_parameters);
+  check_source(CLIENT_URL, MODULE_NAME_2);
+
+  // The new order is used by the next lookup
+  j_parameters = json_pack("{sssisos{ss}}", "display_name", MODULE_DISPLAY_NAME "-2", "order_rank", 101, "readonly", json_false(), "parameters", "client-id-prefix", CLIENT_PREFIX);
+  ck_assert_int_eq(run_simple_test(&admin_req, "PUT", SERVER_URI "/mod/client/" MODULE_NAME_2, NULL, NULL, j_parameters, NULL, 200, NULL, NULL, NULL), 1);
+  json_decref(j_parameters);
+  check_module_list(SERVER_URI "/mod/client/", MODULE_NAME_2, MODULE_DISPLAY_NAME "-2");
+  check_source(CLIENT_URL, MODULE_NAME_1);
+
+  // A disabled instance is skipped
+  ck_assert_int_eq(run_simple_test(&admin_req, "PUT", SERVER_URI "/mod/client/" MODULE_NAME_1 "/disable", NULL, NULL, NULL, NULL, 200, NULL, NULL, NULL), 1);
+  check_source(CLIENT_URL, MODULE_NAME_2);
+  ck_assert_int_eq(run_simple_test(&admin_req, "PUT", SERVER_URI "/mod/client/" MODULE_NAME_1 "/enable", NULL, NULL, NULL, NULL, 200, NULL, NULL, NULL), 1);
+  check_source(CLIENT_URL, MODULE_NAME_1);
+
+  // A deleted instance isn't used anymore
+  ck_assert_int_eq(run_simple_test(&admin_req, "DELETE", SERVER_URI "/mod/client/" MODULE_NAME_1, NULL, NULL, NULL, NULL, 200, NULL, NULL, NULL), 1);
+  check_module_list(SERVER_URI "/mod/client/", MODULE_NAME_1, NULL);
+  check_source(CLIENT_URL, MODULE_NAME_2);
+  ck_assert_int_eq(run_simple_test(&admin_req, "DELETE", SERVER_URI "/mod/client/" MODULE_NAME_2, NULL, NULL, NULL, NULL, 200, NULL, NULL, NULL), 1);
+  check_module_list(SERVER_URI "/mod/client/", MODULE_NAME_2, NULL);
+  check_source(CLIENT_URL, NULL);
+}
+END_TEST
+
+static Suite *glewlwyd_suite(void)
+{
+  Suite *s;
+  TCase *tc_core;
+
+  s = suite_create("Glewlwyd admin module list cache");
+  tc_core = tcase_create("test_glwd_admin_mod_list_cache");
+  tcase_add_test(tc_core, test_glwd_admin_mod_list_cache_user);
+  tcase_add_test(tc_core, test_glwd_admin_mod_list_cache_client);
+  tcase_set_timeout(tc_core, 30);
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
+
+int main(int argc, char *argv[])
+{
+  int number_failed = 0;
+  Suite *s;
+  SRunner *sr;
+  struct _u_request auth_req;
+  struct _u_response auth_resp;
+  int res, do_test = 0, i;
+  json_t * j_body;
+
+  y_init_logs("Glewlwyd test", Y_LOG_MODE_CONSOLE, Y_LOG_LEVEL_DEBUG, NULL, "Starting Glewlwyd test");
+
+  // Getting a valid session id for authenticated http requests
+  ulfius_init_request(&auth_req);
+  ulfius_init_request(&admin_req);
+  ulfius_init_response(&auth_resp);
+  auth_req.http_verb = strdup("POST");
+  auth_req.http_url = msprintf("%s/auth/", SERVER_URI);
+  j_body = json_pack("{ssss}", "username", USERNAME, "password", PASSWORD);
+  ulfius_set_json_body_request(&auth_req, j_body);
+  json_decref(j_body);
+  res = ulfius_send_http_request(&auth_req, &auth_resp);
+  if (res == U_OK && auth_resp.status == 200) {
+    for (i=0; i<auth_resp.nb_cookies; i++) {
+      char * cookie = msprintf("%s=%s", auth_resp.map_cookie[i].key, auth_resp.map_cookie[i].value);
+      u_map_put(admin_req.map_header, "Cookie", cookie);
+      o_free(cookie);
+      do_test = 1;
+    }
+    ulfius_clean_response(&auth_resp);
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "Error authentication");
+  }
+  ulfius_clean_request(&auth_req);
+
+  if (do_test) {
+    s = glewlwyd_suite();
+    sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_VERBOSE);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+  }
+
+  ulfius_clean_request(&admin_req);
+  y_close_logs();
+
+  return (do_test && number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
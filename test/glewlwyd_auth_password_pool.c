@@ -0,0 +1,172 @@
+/* Public domain, no copyright. Use at your own risk. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <check.h>
+#include <ulfius.h>
+#include <orcania.h>
+#include <yder.h>
+
+#include "unit-tests.h"
+
+#define SERVER_URI "http://localhost:4593/api"
+#define USERNAME "admin"
+#define PASSWORD "password"
+
+#define MODULE_MODULE "mock"
+#define MODULE_NAME "mock_password_pool"
+#define MODULE_DISPLAY_NAME "Mock password pool"
+#define MODULE_PREFIX "pool-"
+#define MODULE_CHECK_DELAY 1500
+
+#define POOL_USERNAME MODULE_PREFIX "user1"
+
+// The test instance has 2 workers, a queue of 2 password checks and a max wait of 500 ms
+#define NB_THREADS 5
+
+struct _u_request admin_req;
+
+struct _auth_worker {
+  pthread_t thread;
+  long      status;
+  char    * retry_after;
+};
+
+static void * auth_worker_run(void * args) {
+  struct _auth_worker * worker = (struct _auth_worker *)args;
+  struct _u_request req;
+  struct _u_response resp;
+  json_t * j_body = json_pack("{ssss}", "username", POOL_USERNAME, "password", PASSWORD);
+
+  ulfius_init_request(&req);
+  ulfius_init_response(&resp);
+  ulfius_set_request_properties(&req, U_OPT_HTTP_VERB, "POST", U_OPT_HTTP_URL, SERVER_URI "/auth/", U_OPT_JSON_BODY, j_body, U_OPT_NONE);
+  if (ulfius_send_http_request(&req, &resp) == U_OK) {
+    worker->status = resp.status;
+    worker->retry_after = o_strdup(u_map_get_case(resp.map_header, "Retry-After"));
+  }
+  ulfius_clean_request(&req);
+  ulfius_clean_response(&resp);
+  json_decref(j_body);
+  return NULL;
+}
+
+START_TEST(test_glwd_auth_password_pool_add_module)
+{
+  json_t * j_parameters = json_pack("{sssssssis{sssi}}", "module", MODULE_MODULE, "name", MODULE_NAME, "display_name", MODULE_DISPLAY_NAME, "order_rank", 10, "parameters", "username-prefix", MODULE_PREFIX, "password-check-delay", MODULE_CHECK_DELAY);
+  ck_assert_int_eq(run_simple_test(&admin_req, "POST", SERVER_URI "/mod/user/", NULL, NULL, j_parameters, NULL, 200, NULL, NULL, NULL), 1);
+  json_decref(j_parameters);
+}
+END_TEST
+
+START_TEST(test_glwd_auth_password_pool_delete_module)
+{
+  ck_assert_int_eq(run_simple_test(&admin_req, "DELETE", SERVER_URI "/mod/user/" MODULE_NAME, NULL, NULL, NULL, NULL, 200, NULL, NULL, NULL), 1);
+}
+END_TEST
+
+START_TEST(test_glwd_auth_password_pool_unavailable)
+{
+  struct _auth_worker workers[NB_THREADS];
+  json_t * j_body = json_pack("{ssss}", "username", POOL_USERNAME, "password", PASSWORD);
+  size_t nb_ok = 0, nb_unavailable = 0;
+  int i;
+
+  for (i=0; i<NB_THREADS; i++) {
+    workers[i].status = 0;
+    workers[i].retry_after = NULL;
+    ck_assert_int_eq(pthread_create(&workers[i].thread, NULL, auth_worker_run, &workers[i]), 0);
+  }
+  for (i=0; i<NB_THREADS; i++) {
+    pthread_join(workers[i].thread, NULL);
+  }
+  // The checks run by the workers succeed, the checks rejected because the queue is full or after max_wait respond 503 with Retry-After
+  for (i=0; i<NB_THREADS; i++) {
+    if (workers[i].status == 200) {
+      nb_ok++;
+    } else {
+      ck_assert_int_eq(workers[i].status, 503);
+      ck_assert_str_eq(workers[i].retry_after, "1");
+      nb_unavailable++;
+    }
+    o_free(workers[i].retry_after);
+  }
+  ck_assert_int_gt(nb_ok, 0);
+  ck_assert_int_gt(nb_unavailable, 0);
+
+  // The pool is available again
+  ck_assert_int_eq(run_simple_test(NULL, "POST", SERVER_URI "/auth/", NULL, NULL, j_body, NULL, 200, NULL, NULL, NULL), 1);
+  json_decref(j_body);
+}
+END_TEST
+
+static Suite *glewlwyd_suite(void)
+{
+  Suite *s;
+  TCase *tc_core;
+
+  s = suite_create("Glewlwyd auth password pool");
+  tc_core = tcase_create("test_glwd_auth_password_pool");
+  tcase_add_test(tc_core, test_glwd_auth_password_pool_add_module);
+  tcase_add_test(tc_core, test_glwd_auth_password_pool_unavailable);
+  tcase_add_test(tc_core, test_glwd_auth_password_pool_delete_module);
+  tcase_set_timeout(tc_core, 30);
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
+
+int main(int argc, char *argv[])
+{
+  int number_failed = 0;
+  Suite *s;
+  SRunner *sr;
+  struct _u_request auth_req;
+  struct _u_response auth_resp;
+  int res, do_test = 0, i;
+  json_t * j_body;
+
+  y_init_logs("Glewlwyd test", Y_LOG_MODE_CONSOLE, Y_LOG_LEVEL_DEBUG, NULL, "Starting Glewlwyd test");
+
+  // Getting a valid session id for authenticated http requests
+  ulfius_init_request(&auth_req);
+  ulfius_init_request(&admin_req);
+  ulfius_init_response(&auth_resp);
+  auth_req.http_verb = strdup("POST");
+  auth_req.http_url = msprintf("%s/auth/", SERVER_URI);
+  j_body = json_pack("{ssss}", "username", USERNAME, "password", PASSWORD);
+  ulfius_set_json_body_request(&auth_req, j_body);
+  json_decref(j_body);
+  res = ulfius_send_http_request(&auth_req, &auth_resp);
+  if (res == U_OK && auth_resp.status == 200) {
+    for (i=0; i<auth_resp.nb_cookies; i++) {
+      char * cookie = msprintf("%s=%s", auth_resp.map_cookie[i].key, auth_resp.map_cookie[i].value);
+      u_map_put(admin_req.map_header, "Cookie", cookie);
+      o_free(cookie);
+      do_test = 1;
+    }
+    ulfius_clean_response(&auth_resp);
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "Error authentication");
+  }
+  ulfius_clean_request(&auth_req);
+
+  if (do_test) {
+    s = glewlwyd_suite();
+    sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_VERBOSE);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+  }
+
+  ulfius_clean_request(&admin_req);
+  y_close_logs();
+
+  return (do_test && number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
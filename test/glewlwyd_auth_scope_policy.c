@@ -0,0 +1,162 @@
+/* Public domain, no copyright. Use at your own risk. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <check.h>
+#include <ulfius.h>
+#include <orcania.h>
+#include <yder.h>
+
+#include "unit-tests.h"
+
+#define SERVER_URI "http://localhost:4593/api"
+#define ADMIN_USERNAME "admin"
+#define USERNAME "user1"
+#define PASSWORD "password"
+
+#define SCOPE "scope3"
+#define SCOPE_DISPLAY_NAME "Glewlwyd mock scope with password"
+#define SCOPE_DESCRIPTION "Glewlwyd scope 3 scope description"
+#define GROUP "3"
+#define GROUP_NEW "3-new"
+#define SCHEME_TYPE "mock"
+#define SCHEME_ORIG "mock_scheme_88"
+#define SCHEME_NEW "mock_scheme_42"
+
+struct _u_request admin_req;
+struct _u_request user_req;
+
+/**
+ * Returns the schemes required by SCOPE for the user session
+ */
+static json_t * get_scope_schemes(void) {
+  struct _u_response resp;
+  json_t * j_body, * j_schemes;
+
+  ulfius_init_response(&resp);
+  o_free(user_req.http_verb);
+  o_free(user_req.http_url);
+  user_req.http_verb = o_strdup("GET");
+  user_req.http_url = o_strdup(SERVER_URI "/auth/scheme/?scope=" SCOPE);
+  ck_assert_int_eq(ulfius_send_http_request(&user_req, &resp), U_OK);
+  ck_assert_int_eq(resp.status, 200);
+  j_body = ulfius_get_json_body_response(&resp, NULL);
+  ck_assert_ptr_eq(json_object_get(json_object_get(j_body, SCOPE), "available"), json_true());
+  j_schemes = json_incref(json_object_get(json_object_get(j_body, SCOPE), "schemes"));
+  json_decref(j_body);
+  ulfius_clean_response(&resp);
+  return j_schemes;
+}
+
+static void set_scope_scheme(const char * group, const char * scheme_name) {
+  json_t * j_scope = json_pack("{ss ss so si s{s[{ssss}]}}", "display_name", SCOPE_DISPLAY_NAME, "description", SCOPE_DESCRIPTION, "password_required", json_true(), "password_max_age", 0, "scheme", group, "scheme_name", scheme_name, "scheme_type", SCHEME_TYPE);
+
+  ck_assert_int_eq(run_simple_test(&admin_req, "PUT", SERVER_URI "/scope/" SCOPE, NULL, NULL, j_scope, NULL, 200, NULL, NULL, NULL), 1);
+  json_decref(j_scope);
+}
+
+START_TEST(test_glwd_auth_scope_policy_change_scheme)
+{
+  json_t * j_schemes;
+
+  j_schemes = get_scope_schemes();
+  ck_assert_int_eq(json_object_size(j_schemes), 1);
+  ck_assert_str_eq(json_string_value(json_object_get(json_array_get(json_object_get(j_schemes, GROUP), 0), "scheme_name")), SCHEME_ORIG);
+  json_decref(j_schemes);
+
+  // The scheme group of the scope is changed, the next check uses the new group
+  set_scope_scheme(GROUP_NEW, SCHEME_NEW);
+  j_schemes = get_scope_schemes();
+  ck_assert_int_eq(json_object_size(j_schemes), 1);
+  ck_assert_ptr_eq(json_object_get(j_schemes, GROUP), NULL);
+  ck_assert_int_eq(json_array_size(json_object_get(j_schemes, GROUP_NEW)), 1);
+  ck_assert_str_eq(json_string_value(json_object_get(json_array_get(json_object_get(j_schemes, GROUP_NEW), 0), "scheme_name")), SCHEME_NEW);
+  json_decref(j_schemes);
+
+  // The original scheme group is set back
+  set_scope_scheme(GROUP, SCHEME_ORIG);
+  j_schemes = get_scope_schemes();
+  ck_assert_int_eq(json_object_size(j_schemes), 1);
+  ck_assert_ptr_eq(json_object_get(j_schemes, GROUP_NEW), NULL);
+  ck_assert_str_eq(json_string_value(json_object_get(json_array_get(json_object_get(j_schemes, GROUP), 0), "scheme_name")), SCHEME_ORIG);
+  json_decref(j_schemes);
+}
+END_TEST
+
+static Suite *glewlwyd_suite(void)
+{
+  Suite *s;
+  TCase *tc_core;
+
+  s = suite_create("Glewlwyd auth scope policy");
+  tc_core = tcase_create("test_glwd_auth_scope_policy");
+  tcase_add_test(tc_core, test_glwd_auth_scope_policy_change_scheme);
+  tcase_set_timeout(tc_core, 30);
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
+
+/**
+ * Authenticates username and sets its session cookie in req
+ */
+static int session_login(struct _u_request * req, const char * username) {
+  struct _u_request auth_req;
+  struct _u_response auth_resp;
+  json_t * j_body;
+  int ret = 0, i;
+
+  ulfius_init_request(&auth_req);
+  ulfius_init_response(&auth_resp);
+  auth_req.http_verb = strdup("POST");
+  auth_req.http_url = msprintf("%s/auth/", SERVER_URI);
+  j_body = json_pack("{ssss}", "username", username, "password", PASSWORD);
+  ulfius_set_json_body_request(&auth_req, j_body);
+  json_decref(j_body);
+  if (ulfius_send_http_request(&auth_req, &auth_resp) == U_OK && auth_resp.status == 200) {
+    for (i=0; i<auth_resp.nb_cookies; i++) {
+      char * cookie = msprintf("%s=%s", auth_resp.map_cookie[i].key, auth_resp.map_cookie[i].value);
+      u_map_put(req->map_header, "Cookie", cookie);
+      o_free(cookie);
+      ret = 1;
+    }
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "Error authentication %s", username);
+  }
+  ulfius_clean_request(&auth_req);
+  ulfius_clean_response(&auth_resp);
+  return ret;
+}
+
+int main(int argc, char *argv[])
+{
+  int number_failed = 0;
+  Suite *s;
+  SRunner *sr;
+  int do_test;
+
+  y_init_logs("Glewlwyd test", Y_LOG_MODE_CONSOLE, Y_LOG_LEVEL_DEBUG, NULL, "Starting Glewlwyd test");
+
+  ulfius_init_request(&admin_req);
+  ulfius_init_request(&user_req);
+  do_test = session_login(&admin_req, ADMIN_USERNAME) && session_login(&user_req, USERNAME);
+
+  if (do_test) {
+    s = glewlwyd_suite();
+    sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_VERBOSE);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+  }
+
+  ulfius_clean_request(&admin_req);
+  ulfius_clean_request(&user_req);
+  y_close_logs();
+
+  return (do_test && number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,223 @@
+/* Public domain, no copyright. Use at your own risk. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <check.h>
+#include <ulfius.h>
+#include <orcania.h>
+#include <yder.h>
+
+#include "unit-tests.h"
+
+#define SERVER_URI "http://localhost:4593/api"
+#define ADMIN_USERNAME "admin"
+#define USERNAME "user1"
+#define PASSWORD "password"
+
+// The test instance caches the sessions, the admin endpoint is allowed only if the current user of the session is the admin
+#define ADMIN_ENDPOINT SERVER_URI "/mod/user/"
+
+struct _u_request admin_req;
+
+/**
+ * Authenticates a user with its password in the session of req,
+ * a new session cookie is set in req if it has none
+ */
+static void session_login(struct _u_request * req, const char * username, const char * user_agent) {
+  struct _u_request auth_req;
+  struct _u_response auth_resp;
+  json_t * j_body = json_pack("{ssss}", "username", username, "password", PASSWORD);
+  char * cookie;
+
+  ulfius_init_request(&auth_req);
+  ulfius_init_response(&auth_resp);
+  ulfius_set_request_properties(&auth_req, U_OPT_HTTP_VERB, "POST", U_OPT_HTTP_URL, SERVER_URI "/auth/", U_OPT_HEADER_PARAMETER, "User-Agent", user_agent, U_OPT_JSON_BODY, j_body, U_OPT_NONE);
+  if (u_map_get(req->map_header, "Cookie") != NULL) {
+    u_map_put(auth_req.map_header, "Cookie", u_map_get(req->map_header, "Cookie"));
+  }
+  ck_assert_int_eq(ulfius_send_http_request(&auth_req, &auth_resp), U_OK);
+  ck_assert_int_eq(auth_resp.status, 200);
+  if (u_map_get(req->map_header, "Cookie") == NULL) {
+    ck_assert_int_gt(auth_resp.nb_cookies, 0);
+    cookie = msprintf("%s=%s", auth_resp.map_cookie[0].key, auth_resp.map_cookie[0].value);
+    u_map_put(req->map_header, "Cookie", cookie);
+    o_free(cookie);
+  }
+  ulfius_clean_request(&auth_req);
+  ulfius_clean_response(&auth_resp);
+  json_decref(j_body);
+}
+
+/**
+ * Runs the admin endpoint twice so the session is in the cache
+ */
+static void session_check_admin(struct _u_request * req, int expected_status) {
+  ck_assert_int_eq(run_simple_test(req, "GET", ADMIN_ENDPOINT, NULL, NULL, NULL, NULL, expected_status, NULL, NULL, NULL), 1);
+  ck_assert_int_eq(run_simple_test(req, "GET", ADMIN_ENDPOINT, NULL, NULL, NULL, NULL, expected_status, NULL, NULL, NULL), 1);
+}
+
+START_TEST(test_glwd_auth_session_cache_logout)
+{
+  struct _u_request req;
+  char * user_agent = msprintf("glwd-session-cache-logout-%ld", (long)time(NULL));
+
+  ulfius_init_request(&req);
+  session_login(&req, ADMIN_USERNAME, user_agent);
+  session_check_admin(&req, 200);
+  ck_assert_int_eq(run_simple_test(&req, "GET", SERVER_URI "/profile/session/", NULL, NULL, NULL, NULL, 200, NULL, NULL, NULL), 1);
+
+  // The cached session is removed on logout
+  ck_assert_int_eq(run_simple_test(&req, "DELETE", SERVER_URI "/auth/", NULL, NULL, NULL, NULL, 200, NULL, NULL, NULL), 1);
+  ck_assert_int_eq(run_simple_test(&req, "GET", ADMIN_ENDPOINT, NULL, NULL, NULL, NULL, 401, NULL, NULL, NULL), 1);
+  ck_assert_int_eq(run_simple_test(&req, "GET", SERVER_URI "/profile/session/", NULL, NULL, NULL, NULL, 401, NULL, NULL, NULL), 1);
+  ck_assert_int_eq(run_simple_test(&req, "GET", SERVER_URI "/profile_list/", NULL, NULL, NULL, NULL, 401, NULL, NULL, NULL), 1);
+
+  ulfius_clean_request(&req);
+  o_free(user_agent);
+}
+END_TEST
+
+START_TEST(test_glwd_auth_session_cache_change_user)
+{
+  struct _u_request req;
+  char * user_agent = msprintf("glwd-session-cache-change-%ld", (long)time(NULL));
+  json_t * j_body = json_pack("{ss}", "username", ADMIN_USERNAME);
+
+  ulfius_init_request(&req);
+  session_login(&req, ADMIN_USERNAME, user_agent);
+  session_check_admin(&req, 200);
+
+  // A new user authenticated in the session becomes the current user, the cached admin isn't used anymore
+  session_login(&req, USERNAME, user_agent);
+  session_check_admin(&req, 401);
+  ck_assert_int_eq(run_simple_test(&req, "GET", SERVER_URI "/profile/session/", NULL, NULL, NULL, NULL, 200, NULL, NULL, NULL), 1);
+
+  // The admin is selected again as the current user
+  ck_assert_int_eq(run_simple_test(&req, "POST", SERVER_URI "/auth/", NULL, NULL, j_body, NULL, 200, NULL, NULL, NULL), 1);
+  session_check_admin(&req, 200);
+
+  // The admin logs out of the session, user1 becomes the current user
+  ck_assert_int_eq(run_simple_test(&req, "DELETE", SERVER_URI "/auth/?username=" ADMIN_USERNAME, NULL, NULL, NULL, NULL, 200, NULL, NULL, NULL), 1);
+  session_check_admin(&req, 401);
+  ck_assert_int_eq(run_simple_test(&req, "GET", SERVER_URI "/profile/session/", NULL, NULL, NULL, NULL, 200, NULL, NULL, NULL), 1);
+
+  ck_assert_int_eq(run_simple_test(&req, "DELETE", SERVER_URI "/auth/", NULL, NULL, NULL, NULL, 200, NULL, NULL, NULL), 1);
+  ck_assert_int_eq(run_simple_test(&req, "GET", SERVER_URI "/profile/session/", NULL, NULL, NULL, NULL, 401, NULL, NULL, NULL), 1);
+
+  ulfius_clean_request(&req);
+  json_decref(j_body);
+  o_free(user_agent);
+}
+END_TEST
+
+START_TEST(test_glwd_auth_session_cache_delete_session)
+{
+  struct _u_request req;
+  struct _u_response resp;
+  char * user_agent = msprintf("glwd-session-cache-delete-%ld", (long)time(NULL)), * session_hash_encoded, * url;
+  json_t * j_body;
+
+  ulfius_init_request(&req);
+  session_login(&req, ADMIN_USERNAME, user_agent);
+  session_check_admin(&req, 200);
+
+  // Get the session hash from another session of the admin
+  ulfius_init_response(&resp);
+  url = msprintf(SERVER_URI "/profile/session/?pattern=%s", user_agent);
+  o_free(admin_req.http_verb);
+  o_free(admin_req.http_url);
+  admin_req.http_verb = o_strdup("GET");
+  admin_req.http_url = url;
+  ck_assert_int_eq(ulfius_send_http_request(&admin_req, &resp), U_OK);
+  ck_assert_int_eq(resp.status, 200);
+  j_body = ulfius_get_json_body_response(&resp, NULL);
+  ck_assert_int_eq(json_array_size(j_body), 1);
+  session_hash_encoded = ulfius_url_encode(json_string_value(json_object_get(json_array_get(j_body, 0), "session_hash")));
+  json_decref(j_body);
+  ulfius_clean_response(&resp);
+
+  // The cached session is removed when it's disabled from another session
+  url = msprintf(SERVER_URI "/profile/session/%s", session_hash_encoded);
+  ck_assert_int_eq(run_simple_test(&admin_req, "DELETE", url, NULL, NULL, NULL, NULL, 200, NULL, NULL, NULL), 1);
+  ck_assert_int_eq(run_simple_test(&req, "GET", ADMIN_ENDPOINT, NULL, NULL, NULL, NULL, 401, NULL, NULL, NULL), 1);
+  ck_assert_int_eq(run_simple_test(&req, "GET", SERVER_URI "/profile/session/", NULL, NULL, NULL, NULL, 401, NULL, NULL, NULL), 1);
+
+  // The other session is still valid
+  session_check_admin(&admin_req, 200);
+
+  ulfius_clean_request(&req);
+  o_free(url);
+  o_free(session_hash_encoded);
+  o_free(user_agent);
+}
+END_TEST
+
+static Suite *glewlwyd_suite(void)
+{
+  Suite *s;
+  TCase *tc_core;
+
+  s = suite_create("Glewlwyd auth session cache");
+  tc_core = tcase_create("test_glwd_auth_session_cache");
+  tcase_add_test(tc_core, test_glwd_auth_session_cache_logout);
+  tcase_add_test(tc_core, test_glwd_auth_session_cache_change_user);
+  tcase_add_test(tc_core, test_glwd_auth_session_cache_delete_session);
+  tcase_set_timeout(tc_core, 30);
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
+
+int main(int argc, char *argv[])
+{
+  int number_failed = 0;
+  Suite *s;
+  SRunner *sr;
+  struct _u_request auth_req;
+  struct _u_response auth_resp;
+  int res, do_test = 0, i;
+  json_t * j_body;
+
+  y_init_logs("Glewlwyd test", Y_LOG_MODE_CONSOLE, Y_LOG_LEVEL_DEBUG, NULL, "Starting Glewlwyd test");
+
+  // Getting a valid session id for authenticated http requests
+  ulfius_init_request(&auth_req);
+  ulfius_init_request(&admin_req);
+  ulfius_init_response(&auth_resp);
+  auth_req.http_verb = strdup("POST");
+  auth_req.http_url = msprintf("%s/auth/", SERVER_URI);
+  j_body = json_pack("{ssss}", "username", ADMIN_USERNAME, "password", PASSWORD);
+  ulfius_set_json_body_request(&auth_req, j_body);
+  json_decref(j_body);
+  res = ulfius_send_http_request(&auth_req, &auth_resp);
+  if (res == U_OK && auth_resp.status == 200) {
+    for (i=0; i<auth_resp.nb_cookies; i++) {
+      char * cookie = msprintf("%s=%s", auth_resp.map_cookie[i].key, auth_resp.map_cookie[i].value);
+      u_map_put(admin_req.map_header, "Cookie", cookie);
+      o_free(cookie);
+      do_test = 1;
+    }
+    ulfius_clean_response(&auth_resp);
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "Error authentication");
+  }
+  ulfius_clean_request(&auth_req);
+
+  if (do_test) {
+    s = glewlwyd_suite();
+    sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_VERBOSE);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+  }
+
+  ulfius_clean_request(&admin_req);
+  y_close_logs();
+
+  return (do_test && number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,695 @@
+/* Public domain, no copyright. Use at your own risk. */
+
+/**
+ *
+ * Glewlwyd SSO Server
+ *
+ * Load generator for the authentication and token endpoints
+ *
+ * Runs concurrent workloads against a Glewlwyd instance in test mode
+ * (mock user and client backends, database initialized with glewlwyd-test.sql)
+ * and prints the throughput and latency percentiles of each workload in JSON
+ *
+ * Usage: glewlwyd_benchmark [-u url] [-c concurrency] [-d duration] [-n requests] [-w workload[,workload...]] [-o output_file]
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <jansson.h>
+#include <ulfius.h>
+#include <orcania.h>
+#include <yder.h>
+
+#define SERVER_URI "http://localhost:4593/api"
+#define ADMIN_USERNAME "admin"
+#define ADMIN_PASSWORD "password"
+#define USERNAME "user1"
+#define PASSWORD "password"
+#define CLIENT_PUBLIC "client1_id"
+#define CLIENT_PUBLIC_REDIRECT_URI "../../test-oidc.html?param=client1_cb1"
+#define CLIENT_PUBLIC_REDIRECT_URI_ENCODED "..%2f..%2ftest-oidc.html%3fparam%3dclient1_cb1"
+#define CLIENT_CONFIDENTIAL "client3_id"
+#define CLIENT_CONFIDENTIAL_SECRET "password"
+#define SCOPE_LIST "openid g_profile"
+#define SCOPE_LIST_ENCODED "openid%20g_profile"
+#define SCOPE_LIST_CLIENT "scope2 scope3"
+
+#define PLUGIN_MODULE "oidc"
+#define PLUGIN_NAME "benchmark"
+#define PLUGIN_DISPLAY_NAME "Benchmark"
+#define PLUGIN_ISS "https://glewlwyd.tld"
+#define PLUGIN_JWT_TYPE "sha"
+#define PLUGIN_JWT_KEY_SIZE "256"
+#define PLUGIN_KEY "secret"
+#define PLUGIN_CODE_DURATION 600
+#define PLUGIN_REFRESH_TOKEN_DURATION 1209600
+#define PLUGIN_ACCESS_TOKEN_DURATION 3600
+
+#define DEFAULT_CONCURRENCY 4
+#define DEFAULT_DURATION 10
+#define LATENCIES_BLOCK 1024
+
+struct bench_context {
+  const char   * server_uri;
+  unsigned int   concurrency;
+  unsigned int   duration;
+  unsigned int   max_requests;
+  char         * admin_cookie;
+  char         * user_cookie;
+  char         * access_token;
+  char         * refresh_token;
+};
+
+struct bench_workload {
+  const char * name;
+  int       (* run)(struct bench_context * ctx);
+};
+
+struct bench_worker {
+  struct bench_context        * ctx;
+  const struct bench_workload * workload;
+  struct timespec               end;
+  unsigned int                * nb_started;
+  double                      * latencies;
+  size_t                        nb_latencies;
+  size_t                        size_latencies;
+  size_t                        nb_errors;
+};
+
+static double elapsed_ms(const struct timespec * start, const struct timespec * stop) {
+  return (double)(stop->tv_sec - start->tv_sec) * 1000.0 + (double)(stop->tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+static int compare_double(const void * a, const void * b) {
+  double da = *(const double *)a, db = *(const double *)b;
+  return (da > db) - (da < db);
+}
+
+/**
+ * Sends the request and returns 0 if the response status is the expected one
+ * The response is returned to the caller if resp isn't NULL
+ */
+static int send_request(struct _u_request * req, struct _u_response * resp, long expected_status) {
+  struct _u_response local_resp;
+  int ret;
+
+  if (resp == NULL) {
+    ulfius_init_response(&local_resp);
+    resp = &local_resp;
+  }
+  if (ulfius_send_http_request(req, resp) == U_OK && resp->status == expected_status) {
+    ret = 0;
+  } else {
+    ret = 1;
+  }
+  if (resp == &local_resp) {
+    ulfius_clean_response(&local_resp);
+  }
+  return ret;
+}
+
+/**
+ * Returns the session cookie of a user authenticated with a password
+ */
+static char * get_session_cookie(const char * server_uri, const char * username, const char * password) {
+  struct _u_request req;
+  struct _u_response resp;
+  json_t * j_body = json_pack("{ssss}", "username", username, "password", password);
+  char * cookie = NULL;
+  unsigned int i;
+
+  ulfius_init_request(&req);
+  ulfius_init_response(&resp);
+  req.http_verb = o_strdup("POST");
+  req.http_url = msprintf("%s/auth/", server_uri);
+  ulfius_set_json_body_request(&req, j_body);
+  if (!send_request(&req, &resp, 200)) {
+    for (i=0; i<resp.nb_cookies; i++) {
+      if (cookie == NULL) {
+        cookie = msprintf("%s=%s", resp.map_cookie[i].key, resp.map_cookie[i].value);
+      } else {
+        cookie = mstrcatf(cookie, "; %s=%s", resp.map_cookie[i].key, resp.map_cookie[i].value);
+      }
+    }
+  }
+  json_decref(j_body);
+  ulfius_clean_request(&req);
+  ulfius_clean_response(&resp);
+  return cookie;
+}
+
+/**
+ * Workload password: authenticates the user with its password
+ */
+static int bench_password(struct bench_context * ctx) {
+  struct _u_request req;
+  json_t * j_body = json_pack("{ssss}", "username", USERNAME, "password", PASSWORD);
+  int ret;
+
+  ulfius_init_request(&req);
+  req.http_verb = o_strdup("POST");
+  req.http_url = msprintf("%s/auth/", ctx->server_uri);
+  ulfius_set_json_body_request(&req, j_body);
+  ret = send_request(&req, NULL, 200);
+  json_decref(j_body);
+  ulfius_clean_request(&req);
+  return ret;
+}
+
+/**
+ * Workload code: gets a code with the user session then exchanges it for tokens
+ */
+static int bench_code(struct bench_context * ctx) {
+  struct _u_request req;
+  struct _u_response resp;
+  const char * location;
+  char * code = NULL;
+  int ret = 1;
+
+  ulfius_init_request(&req);
+  ulfius_init_response(&resp);
+  req.http_verb = o_strdup("GET");
+  req.http_url = msprintf("%s/%s/auth?response_type=code&nonce=nonce1234&g_continue&client_id=%s&redirect_uri=%s&scope=%s", ctx->server_uri, PLUGIN_NAME, CLIENT_PUBLIC, CLIENT_PUBLIC_REDIRECT_URI_ENCODED, SCOPE_LIST_ENCODED);
+  u_map_put(req.map_header, "Cookie", ctx->user_cookie);
+  if (!send_request(&req, &resp, 302) && (location = o_strstr(u_map_get(resp.map_header, "Location"), "code=")) != NULL) {
+    code = o_strdup(location+o_strlen("code="));
+    if (o_strchr(code, '&') != NULL) {
+      *o_strchr(code, '&') = '\0';
+    }
+  }
+  ulfius_clean_request(&req);
+  ulfius_clean_response(&resp);
+
+  if (code != NULL) {
+    ulfius_init_request(&req);
+    req.http_verb = o_strdup("POST");
+    req.http_url = msprintf("%s/%s/token/", ctx->server_uri, PLUGIN_NAME);
+    u_map_put(req.map_post_body, "grant_type", "authorization_code");
+    u_map_put(req.map_post_body, "client_id", CLIENT_PUBLIC);
+    u_map_put(req.map_post_body, "redirect_uri", CLIENT_PUBLIC_REDIRECT_URI);
+    u_map_put(req.map_post_body, "code", code);
+    ret = send_request(&req, NULL, 200);
+    ulfius_clean_request(&req);
+    o_free(code);
+  }
+  return ret;
+}
+
+/**
+ * Workload refresh: gets a new access token with the refresh token
+ */
+static int bench_refresh(struct bench_context * ctx) {
+  struct _u_request req;
+  int ret;
+
+  ulfius_init_request(&req);
+  req.http_verb = o_strdup("POST");
+  req.http_url = msprintf("%s/%s/token/", ctx->server_uri, PLUGIN_NAME);
+  req.auth_basic_user = o_strdup(CLIENT_CONFIDENTIAL);
+  req.auth_basic_password = o_strdup(CLIENT_CONFIDENTIAL_SECRET);
+  u_map_put(req.map_post_body, "grant_type", "refresh_token");
+  u_map_put(req.map_post_body, "refresh_token", ctx->refresh_token);
+  ret = send_request(&req, NULL, 200);
+  ulfius_clean_request(&req);
+  return ret;
+}
+
+/**
+ * Workload introspection: introspects the access token as the target client
+ */
+static int bench_introspection(struct bench_context * ctx) {
+  struct _u_request req;
+  int ret;
+
+  ulfius_init_request(&req);
+  req.http_verb = o_strdup("POST");
+  req.http_url = msprintf("%s/%s/introspect", ctx->server_uri, PLUGIN_NAME);
+  req.auth_basic_user = o_strdup(CLIENT_CONFIDENTIAL);
+  req.auth_basic_password = o_strdup(CLIENT_CONFIDENTIAL_SECRET);
+  u_map_put(req.map_post_body, "token", ctx->access_token);
+  u_map_put(req.map_post_body, "token_type_hint", "access_token");
+  ret = send_request(&req, NULL, 200);
+  ulfius_clean_request(&req);
+  return ret;
+}
+
+/**
+ * Workload userinfo: gets the userinfo with the access token
+ */
+static int bench_userinfo(struct bench_context * ctx) {
+  struct _u_request req;
+  char * bearer = msprintf("Bearer %s", ctx->access_token);
+  int ret;
+
+  ulfius_init_request(&req);
+  req.http_verb = o_strdup("GET");
+  req.http_url = msprintf("%s/%s/userinfo/", ctx->server_uri, PLUGIN_NAME);
+  u_map_put(req.map_header, "Authorization", bearer);
+  ret = send_request(&req, NULL, 200);
+  ulfius_clean_request(&req);
+  o_free(bearer);
+  return ret;
+}
+
+/**
+ * Workload client_credentials: gets an access token for the confidential client
+ */
+static int bench_client_credentials(struct bench_context * ctx) {
+  struct _u_request req;
+  int ret;
+
+  ulfius_init_request(&req);
+  req.http_verb = o_strdup("POST");
+  req.http_url = msprintf("%s/%s/token/", ctx->server_uri, PLUGIN_NAME);
+  req.auth_basic_user = o_strdup(CLIENT_CONFIDENTIAL);
+  req.auth_basic_password = o_strdup(CLIENT_CONFIDENTIAL_SECRET);
+  u_map_put(req.map_post_body, "grant_type", "client_credentials");
+  u_map_put(req.map_post_body, "scope", SCOPE_LIST_CLIENT);
+  ret = send_request(&req, NULL, 200);
+  ulfius_clean_request(&req);
+  return ret;
+}
+
+static const struct bench_workload workloads[] = {
+  {"password", bench_password},
+  {"code", bench_code},
+  {"refresh", bench_refresh},
+  {"introspection", bench_introspection},
+  {"userinfo", bench_userinfo},
+  {"client_credentials", bench_client_credentials},
+  {NULL, NULL}
+};
+
+/**
+ * Adds the OIDC plugin instance used by the workloads, with introspection enabled,
+ * then gets the user session, grants the scopes to the public client
+ * and gets the access and refresh tokens used by the workloads
+ */
+static int bench_setup(struct bench_context * ctx) {
+  struct _u_request req;
+  struct _u_response resp;
+  json_t * j_body;
+  int ret = 0;
+
+  if ((ctx->admin_cookie = get_session_cookie(ctx->server_uri, ADMIN_USERNAME, ADMIN_PASSWORD)) == NULL) {
+    fprintf(stderr, "Error authenticating user %s\n", ADMIN_USERNAME);
+    ret = 1;
+  }
+
+  if (!ret) {
+    j_body = json_pack("{sssssssos{sssssssssisisisosososososososososo}}",
+                       "module", PLUGIN_MODULE,
+                       "name", PLUGIN_NAME,
+                       "display_name", PLUGIN_DISPLAY_NAME,
+                       "enabled", json_true(),
+                       "parameters",
+                         "iss", PLUGIN_ISS,
+                         "jwt-type", PLUGIN_JWT_TYPE,
+                         "jwt-key-size", PLUGIN_JWT_KEY_SIZE,
+                         "key", PLUGIN_KEY,
+                         "code-duration", PLUGIN_CODE_DURATION,
+                         "refresh-token-duration", PLUGIN_REFRESH_TOKEN_DURATION,
+                         "access-token-duration", PLUGIN_ACCESS_TOKEN_DURATION,
+                         "allow-non-oidc", json_true(),
+                         "auth-type-client-enabled", json_true(),
+                         "auth-type-code-enabled", json_true(),
+                         "auth-type-implicit-enabled", json_true(),
+                         "auth-type-password-enabled", json_true(),
+                         "auth-type-refresh-enabled", json_true(),
+                         "refresh-token-rolling", json_true(),
+                         "introspection-revocation-allowed", json_true(),
+                         "introspection-revocation-allow-target-client", json_true());
+    ulfius_init_request(&req);
+    req.http_verb = o_strdup("POST");
+    req.http_url = msprintf("%s/mod/plugin/", ctx->server_uri);
+    u_map_put(req.map_header, "Cookie", ctx->admin_cookie);
+    ulfius_set_json_body_request(&req, j_body);
+    if (send_request(&req, NULL, 200)) {
+      fprintf(stderr, "Error adding plugin instance %s\n", PLUGIN_NAME);
+      ret = 1;
+    }
+    ulfius_clean_request(&req);
+    json_decref(j_body);
+  }
+
+  if (!ret && (ctx->user_cookie = get_session_cookie(ctx->server_uri, USERNAME, PASSWORD)) == NULL) {
+    fprintf(stderr, "Error authenticating user %s\n", USERNAME);
+    ret = 1;
+  }
+
+  if (!ret) {
+    j_body = json_pack("{ss}", "scope", SCOPE_LIST);
+    ulfius_init_request(&req);
+    req.http_verb = o_strdup("PUT");
+    req.http_url = msprintf("%s/auth/grant/%s", ctx->server_uri, CLIENT_PUBLIC);
+    u_map_put(req.map_header, "Cookie", ctx->user_cookie);
+    ulfius_set_json_body_request(&req, j_body);
+    if (send_request(&req, NULL, 200)) {
+      fprintf(stderr, "Error granting scopes to client %s\n", CLIENT_PUBLIC);
+      ret = 1;
+    }
+    ulfius_clean_request(&req);
+    json_decref(j_body);
+  }
+
+  if (!ret) {
+    ulfius_init_request(&req);
+    ulfius_init_response(&resp);
+    req.http_verb = o_strdup("POST");
+    req.http_url = msprintf("%s/%s/token/", ctx->server_uri, PLUGIN_NAME);
+    req.auth_basic_user = o_strdup(CLIENT_CONFIDENTIAL);
+    req.auth_basic_password = o_strdup(CLIENT_CONFIDENTIAL_SECRET);
+    u_map_put(req.map_post_body, "grant_type", "password");
+    u_map_put(req.map_post_body, "username", USERNAME);
+    u_map_put(req.map_post_body, "password", PASSWORD);
+    u_map_put(req.map_post_body, "scope", SCOPE_LIST);
+    if (!send_request(&req, &resp, 200)) {
+      j_body = ulfius_get_json_body_response(&resp, NULL);
+      ctx->access_token = o_strdup(json_string_value(json_object_get(j_body, "access_token")));
+      ctx->refresh_token = o_strdup(json_string_value(json_object_get(j_body, "refresh_token")));
+      json_decref(j_body);
+    }
+    if (ctx->access_token == NULL || ctx->refresh_token == NULL) {
+      fprintf(stderr, "Error getting tokens for user %s\n", USERNAME);
+      ret = 1;
+    }
+    ulfius_clean_request(&req);
+    ulfius_clean_response(&resp);
+  }
+  return ret;
+}
+
+/**
+ * Removes the plugin instance and closes the sessions
+ */
+static void bench_teardown(struct bench_context * ctx) {
+  struct _u_request req;
+
+  if (ctx->user_cookie != NULL) {
+    ulfius_init_request(&req);
+    req.http_verb = o_strdup("DELETE");
+    req.http_url = msprintf("%s/auth/", ctx->server_uri);
+    u_map_put(req.map_header, "Cookie", ctx->user_cookie);
+    send_request(&req, NULL, 200);
+    ulfius_clean_request(&req);
+  }
+  if (ctx->admin_cookie != NULL) {
+    ulfius_init_request(&req);
+    req.http_verb = o_strdup("DELETE");
+    req.http_url = msprintf("%s/mod/plugin/%s", ctx->server_uri, PLUGIN_NAME);
+    u_map_put(req.map_header, "Cookie", ctx->admin_cookie);
+    send_request(&req, NULL, 200);
+    ulfius_clean_request(&req);
+
+    ulfius_init_request(&req);
+    req.http_verb = o_strdup("DELETE");
+    req.http_url = msprintf("%s/auth/", ctx->server_uri);
+    u_map_put(req.map_header, "Cookie", ctx->admin_cookie);
+    send_request(&req, NULL, 200);
+    ulfius_clean_request(&req);
+  }
+  o_free(ctx->admin_cookie);
+  o_free(ctx->user_cookie);
+  o_free(ctx->access_token);
+  o_free(ctx->refresh_token);
+}
+
+/**
+ * Runs the workload until the duration is over or the maximum number of requests is reached
+ */
+static void * bench_worker_run(void * args) {
+  struct bench_worker * worker = (struct bench_worker *)args;
+  struct timespec start, stop;
+  double * latencies;
+  int error;
+
+  while (1) {
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (elapsed_ms(&start, &worker->end) <= 0) {
+      break;
+    }
+    if (worker->ctx->max_requests && __atomic_fetch_add(worker->nb_started, 1, __ATOMIC_RELAXED) >= worker->ctx->max_requests) {
+      break;
+    }
+    error = worker->workload->run(worker->ctx);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    if (error) {
+      worker->nb_errors++;
+    } else {
+      if (worker->nb_latencies == worker->size_latencies) {
+        if ((latencies = o_realloc(worker->latencies, (worker->size_latencies+LATENCIES_BLOCK)*sizeof(double))) == NULL) {
+          fprintf(stderr, "Error allocating resources for latencies\n");
+          break;
+        }
+        worker->latencies = latencies;
+        worker->size_latencies += LATENCIES_BLOCK;
+      }
+      worker->latencies[worker->nb_latencies++] = elapsed_ms(&start, &stop);
+    }
+  }
+  return NULL;
+}
+
+static double percentile(const double * latencies, size_t nb_latencies, unsigned int percent) {
+  size_t index;
+
+  if (!nb_latencies) {
+    return 0;
+  }
+  index = (nb_latencies * percent + 99) / 100;
+  return latencies[index?index-1:0];
+}
+
+/**
+ * Runs the workload with ctx->concurrency threads and returns its results
+ */
+static json_t * bench_run_workload(struct bench_context * ctx, const struct bench_workload * workload) {
+  struct bench_worker * workers = o_malloc(ctx->concurrency*sizeof(struct bench_worker));
+  pthread_t * threads = o_malloc(ctx->concurrency*sizeof(pthread_t));
+  struct timespec start, stop;
+  unsigned int i, nb_threads = 0, nb_started = 0;
+  double * latencies = NULL, total = 0, duration;
+  size_t nb_latencies = 0, nb_errors = 0;
+  json_t * j_result = NULL;
+
+  if (workers != NULL && threads != NULL) {
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i=0; i<ctx->concurrency; i++) {
+      memset(&workers[i], 0, sizeof(struct bench_worker));
+      workers[i].ctx = ctx;
+      workers[i].workload = workload;
+      workers[i].nb_started = &nb_started;
+      workers[i].end = start;
+      workers[i].end.tv_sec += ctx->duration;
+      if (pthread_create(&threads[i], NULL, bench_worker_run, &workers[i])) {
+        fprintf(stderr, "Error creating worker thread %u for workload %s\n", i, workload->name);
+        break;
+      }
+      nb_threads++;
+    }
+    for (i=0; i<nb_threads; i++) {
+      pthread_join(threads[i], NULL);
+      nb_latencies += workers[i].nb_latencies;
+      nb_errors += workers[i].nb_errors;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    duration = elapsed_ms(&start, &stop) / 1000.0;
+
+    if (nb_latencies && (latencies = o_malloc(nb_latencies*sizeof(double))) == NULL) {
+      fprintf(stderr, "Error allocating resources for latencies\n");
+      nb_latencies = 0;
+    }
+    nb_latencies = 0;
+    for (i=0; i<nb_threads; i++) {
+      if (latencies != NULL) {
+        memcpy(latencies+nb_latencies, workers[i].latencies, workers[i].nb_latencies*sizeof(double));
+        nb_latencies += workers[i].nb_latencies;
+      }
+      o_free(workers[i].latencies);
+    }
+    qsort(latencies, nb_latencies, sizeof(double), compare_double);
+    for (i=0; i<nb_latencies; i++) {
+      total += latencies[i];
+    }
+
+    j_result = json_pack("{sssisIsIsfs{sfsfsfsfsfsfsf}}",
+                         "name", workload->name,
+                         "concurrency", nb_threads,
+                         "requests", (json_int_t)nb_latencies,
+                         "errors", (json_int_t)nb_errors,
+                         "requests_per_second", duration>0?(double)nb_latencies/duration:0.0,
+                         "latency_ms",
+                           "min", nb_latencies?latencies[0]:0.0,
+                           "mean", nb_latencies?total/(double)nb_latencies:0.0,
+                           "p50", percentile(latencies, nb_latencies, 50),
+                           "p90", percentile(latencies, nb_latencies, 90),
+                           "p95", percentile(latencies, nb_latencies, 95),
+                           "p99", percentile(latencies, nb_latencies, 99),
+                           "max", nb_latencies?latencies[nb_latencies-1]:0.0);
+    o_free(latencies);
+  } else {
+    fprintf(stderr, "Error allocating resources for workload %s\n", workload->name);
+  }
+  o_free(workers);
+  o_free(threads);
+  return j_result;
+}
+
+static void print_help(FILE * output) {
+  int i;
+
+  fprintf(output, "Glewlwyd benchmark\n\n");
+  fprintf(output, "Runs concurrent workloads against a Glewlwyd instance in test mode and prints the results in JSON\n\n");
+  fprintf(output, "-u --url=URL\n");
+  fprintf(output, "\tGlewlwyd API url, default %s\n", SERVER_URI);
+  fprintf(output, "-c --concurrency=NUMBER\n");
+  fprintf(output, "\tNumber of concurrent clients per workload, default %d\n", DEFAULT_CONCURRENCY);
+  fprintf(output, "-d --duration=SECONDS\n");
+  fprintf(output, "\tDuration of each workload in seconds, default %d\n", DEFAULT_DURATION);
+  fprintf(output, "-n --requests=NUMBER\n");
+  fprintf(output, "\tMaximum number of requests per workload, default unlimited\n");
+  fprintf(output, "-w --workload=NAME[,NAME...]\n");
+  fprintf(output, "\tWorkloads to run, default all, available workloads:");
+  for (i=0; workloads[i].name != NULL; i++) {
+    fprintf(output, " %s", workloads[i].name);
+  }
+  fprintf(output, "\n");
+  fprintf(output, "-o --output=FILE\n");
+  fprintf(output, "\tWrite the results in FILE instead of the standard output\n");
+  fprintf(output, "-h --help\n");
+  fprintf(output, "\tPrint this message\n");
+}
+
+int main(int argc, char *argv[]) {
+  struct bench_context ctx;
+  const char * short_options = "u:c:d:n:w:o:h";
+  static const struct option long_options[] = {
+    {"url", required_argument, NULL, 'u'},
+    {"concurrency", required_argument, NULL, 'c'},
+    {"duration", required_argument, NULL, 'd'},
+    {"requests", required_argument, NULL, 'n'},
+    {"workload", required_argument, NULL, 'w'},
+    {"output", required_argument, NULL, 'o'},
+    {"help", no_argument, NULL, 'h'},
+    {NULL, 0, NULL, 0}
+  };
+  char * workload_list = NULL, * output_file = NULL, ** workload_names = NULL;
+  const char * server_uri = SERVER_URI;
+  int next_option, i, j, ret = EXIT_SUCCESS, selected;
+  long value;
+  json_t * j_output, * j_workloads, * j_result;
+
+  memset(&ctx, 0, sizeof(struct bench_context));
+  ctx.concurrency = DEFAULT_CONCURRENCY;
+  ctx.duration = DEFAULT_DURATION;
+
+  while ((next_option = getopt_long(argc, argv, short_options, long_options, NULL)) != -1) {
+    switch (next_option) {
+      case 'u':
+        server_uri = optarg;
+        break;
+      case 'c':
+        value = strtol(optarg, NULL, 10);
+        if (value <= 0) {
+          fprintf(stderr, "Error - concurrency invalid\n");
+          ret = EXIT_FAILURE;
+        } else {
+          ctx.concurrency = (unsigned int)value;
+        }
+        break;
+      case 'd':
+        value = strtol(optarg, NULL, 10);
+        if (value <= 0) {
+          fprintf(stderr, "Error - duration invalid\n");
+          ret = EXIT_FAILURE;
+        } else {
+          ctx.duration = (unsigned int)value;
+        }
+        break;
+      case 'n':
+        value = strtol(optarg, NULL, 10);
+        if (value < 0) {
+          fprintf(stderr, "Error - requests invalid\n");
+          ret = EXIT_FAILURE;
+        } else {
+          ctx.max_requests = (unsigned int)value;
+        }
+        break;
+      case 'w':
+        workload_list = optarg;
+        break;
+      case 'o':
+        output_file = optarg;
+        break;
+      case 'h':
+        print_help(stdout);
+        return EXIT_SUCCESS;
+      default:
+        print_help(stderr);
+        return EXIT_FAILURE;
+    }
+  }
+  ctx.server_uri = server_uri;
+
+  if (workload_list != NULL) {
+    split_string(workload_list, ",", &workload_names);
+    for (i=0; workload_names[i] != NULL; i++) {
+      selected = 0;
+      for (j=0; workloads[j].name != NULL; j++) {
+        if (0 == o_strcmp(workload_names[i], workloads[j].name)) {
+          selected = 1;
+        }
+      }
+      if (!selected) {
+        fprintf(stderr, "Error - workload %s invalid\n", workload_names[i]);
+        ret = EXIT_FAILURE;
+      }
+    }
+  }
+
+  if (ret == EXIT_SUCCESS) {
+    y_init_logs("Glewlwyd benchmark", Y_LOG_MODE_CONSOLE, Y_LOG_LEVEL_ERROR, NULL, "Starting Glewlwyd benchmark");
+    if (!bench_setup(&ctx)) {
+      j_workloads = json_array();
+      for (i=0; workloads[i].name != NULL; i++) {
+        if (workload_names == NULL || string_array_has_value((const char **)workload_names, workloads[i].name)) {
+          fprintf(stderr, "Run workload %s\n", workloads[i].name);
+          if ((j_result = bench_run_workload(&ctx, &workloads[i])) != NULL) {
+            json_array_append_new(j_workloads, j_result);
+          } else {
+            ret = EXIT_FAILURE;
+          }
+        }
+      }
+      j_output = json_pack("{sssisisiso}",
+                           "server", ctx.server_uri,
+                           "concurrency", ctx.concurrency,
+                           "duration", ctx.duration,
+                           "max_requests", ctx.max_requests,
+                           "workloads", j_workloads);
+      if (output_file != NULL) {
+        if (json_dump_file(j_output, output_file, JSON_INDENT(2))) {
+          fprintf(stderr, "Error writing results in %s\n", output_file);
+          ret = EXIT_FAILURE;
+        }
+      } else {
+        json_dumpf(j_output, stdout, JSON_INDENT(2));
+        fprintf(stdout, "\n");
+      }
+      json_decref(j_output);
+    } else {
+      ret = EXIT_FAILURE;
+    }
+    bench_teardown(&ctx);
+    y_close_logs();
+  }
+  free_string_array(workload_names);
+
+  return ret;
+}
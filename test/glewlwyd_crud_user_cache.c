@@ -0,0 +1,179 @@
+/* Public domain, no copyright. Use at your own risk. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <check.h>
+#include <ulfius.h>
+#include <orcania.h>
+#include <yder.h>
+
+#include "unit-tests.h"
+
+#define SERVER_URI "http://localhost:4593/api"
+#define USERNAME "admin"
+#define PASSWORD "password"
+
+#define NEW_USERNAME "cache_user"
+#define NEW_NAME_HIGH "Dave Lopper High"
+#define NEW_NAME_LOW "Dave Lopper Low"
+#define NEW_NAME_LOW_UPDATED "Dave Lopper Low Updated"
+#define NEW_EMAIL "cache_user@glewlwyd"
+
+#define MODULE_MODULE "mock"
+#define MODULE_NAME_HIGH "mock_cache_high"
+#define MODULE_NAME_LOW "mock_cache_low"
+#define MODULE_DISPLAY_NAME "Mock cache"
+#define MODULE_PREFIX_HIGH "cache_high-"
+#define MODULE_PREFIX_LOW "cache_low-"
+
+struct _u_request admin_req;
+
+/**
+ * Runs the same GET twice, the first one may store the user in the cache, the second one may use it
+ */
+static int get_user_twice(const char * url, int expected_status, json_t * j_expected) {
+  return run_simple_test(&admin_req, "GET", url, NULL, NULL, NULL, NULL, expected_status, j_expected, NULL, NULL) &&
+         run_simple_test(&admin_req, "GET", url, NULL, NULL, NULL, NULL, expected_status, j_expected, NULL, NULL);
+}
+
+START_TEST(test_glwd_crud_user_cache_add_module_instances)
+{
+  json_t * j_parameters = json_pack("{sssssssis{ss}}", "module", MODULE_MODULE, "name", MODULE_NAME_HIGH, "display_name", MODULE_DISPLAY_NAME, "order_rank", 1, "parameters", "username-prefix", MODULE_PREFIX_HIGH);
+  ck_assert_int_eq(run_simple_test(&admin_req, "POST", SERVER_URI "/mod/user/", NULL, NULL, j_parameters, NULL, 200, NULL, NULL, NULL), 1);
+  json_decref(j_parameters);
+  j_parameters = json_pack("{sssssssis{ss}}", "module", MODULE_MODULE, "name", MODULE_NAME_LOW, "display_name", MODULE_DISPLAY_NAME, "order_rank", 2, "parameters", "username-prefix", MODULE_PREFIX_LOW);
+  ck_assert_int_eq(run_simple_test(&admin_req, "POST", SERVER_URI "/mod/user/", NULL, NULL, j_parameters, NULL, 200, NULL, NULL, NULL), 1);
+  json_decref(j_parameters);
+}
+END_TEST
+
+START_TEST(test_glwd_crud_user_cache_delete_module_instances)
+{
+  ck_assert_int_eq(run_simple_test(&admin_req, "DELETE", SERVER_URI "/mod/user/" MODULE_NAME_HIGH, NULL, NULL, NULL, NULL, 200, NULL, NULL, NULL), 1);
+  ck_assert_int_eq(run_simple_test(&admin_req, "DELETE", SERVER_URI "/mod/user/" MODULE_NAME_LOW, NULL, NULL, NULL, NULL, 200, NULL, NULL, NULL), 1);
+}
+END_TEST
+
+START_TEST(test_glwd_crud_user_cache_same_username_in_two_instances)
+{
+  json_t * j_parameters = json_pack("{ssssss}", "username", NEW_USERNAME, "name", NEW_NAME_LOW, "email", NEW_EMAIL),
+         * j_expected_high = json_pack("{ssssss}", "username", NEW_USERNAME, "name", NEW_NAME_HIGH, "source", MODULE_NAME_HIGH),
+         * j_expected_low = json_pack("{ssssss}", "username", NEW_USERNAME, "name", NEW_NAME_LOW, "source", MODULE_NAME_LOW);
+
+  ck_assert_int_eq(run_simple_test(&admin_req, "POST", SERVER_URI "/user/?source=" MODULE_NAME_LOW, NULL, NULL, j_parameters, NULL, 200, NULL, NULL, NULL), 1);
+  ck_assert_int_eq(get_user_twice(SERVER_URI "/user/" NEW_USERNAME, 200, j_expected_low), 1);
+  json_object_set_new(j_parameters, "name", json_string(NEW_NAME_HIGH));
+  ck_assert_int_eq(run_simple_test(&admin_req, "POST", SERVER_URI "/user/?source=" MODULE_NAME_HIGH, NULL, NULL, j_parameters, NULL, 200, NULL, NULL, NULL), 1);
+
+  // Each instance has its own cache entry for the same username
+  ck_assert_int_eq(get_user_twice(SERVER_URI "/user/" NEW_USERNAME "?source=" MODULE_NAME_LOW, 200, j_expected_low), 1);
+  ck_assert_int_eq(get_user_twice(SERVER_URI "/user/" NEW_USERNAME "?source=" MODULE_NAME_HIGH, 200, j_expected_high), 1);
+  // The user added in the higher instance is now found first in all the instances
+  ck_assert_int_eq(get_user_twice(SERVER_URI "/user/" NEW_USERNAME, 200, j_expected_high), 1);
+  json_decref(j_parameters);
+  json_decref(j_expected_high);
+  json_decref(j_expected_low);
+}
+END_TEST
+
+START_TEST(test_glwd_crud_user_cache_update_in_one_instance)
+{
+  json_t * j_parameters = json_pack("{ssss}", "name", NEW_NAME_LOW_UPDATED, "email", NEW_EMAIL),
+         * j_expected_high = json_pack("{ssssss}", "username", NEW_USERNAME, "name", NEW_NAME_HIGH, "source", MODULE_NAME_HIGH),
+         * j_expected_low = json_pack("{ssssss}", "username", NEW_USERNAME, "name", NEW_NAME_LOW_UPDATED, "source", MODULE_NAME_LOW);
+
+  ck_assert_int_eq(run_simple_test(&admin_req, "PUT", SERVER_URI "/user/" NEW_USERNAME "?source=" MODULE_NAME_LOW, NULL, NULL, j_parameters, NULL, 200, NULL, NULL, NULL), 1);
+  ck_assert_int_eq(get_user_twice(SERVER_URI "/user/" NEW_USERNAME "?source=" MODULE_NAME_LOW, 200, j_expected_low), 1);
+  ck_assert_int_eq(get_user_twice(SERVER_URI "/user/" NEW_USERNAME "?source=" MODULE_NAME_HIGH, 200, j_expected_high), 1);
+  ck_assert_int_eq(get_user_twice(SERVER_URI "/user/" NEW_USERNAME, 200, j_expected_high), 1);
+  json_decref(j_parameters);
+  json_decref(j_expected_high);
+  json_decref(j_expected_low);
+}
+END_TEST
+
+START_TEST(test_glwd_crud_user_cache_delete_in_one_instance)
+{
+  json_t * j_expected_low = json_pack("{ssssss}", "username", NEW_USERNAME, "name", NEW_NAME_LOW_UPDATED, "source", MODULE_NAME_LOW);
+
+  // Deleting the user in the higher instance invalidates the user looked up in all the instances
+  ck_assert_int_eq(run_simple_test(&admin_req, "DELETE", SERVER_URI "/user/" NEW_USERNAME "?source=" MODULE_NAME_HIGH, NULL, NULL, NULL, NULL, 200, NULL, NULL, NULL), 1);
+  ck_assert_int_eq(get_user_twice(SERVER_URI "/user/" NEW_USERNAME "?source=" MODULE_NAME_HIGH, 404, NULL), 1);
+  ck_assert_int_eq(get_user_twice(SERVER_URI "/user/" NEW_USERNAME, 200, j_expected_low), 1);
+  ck_assert_int_eq(get_user_twice(SERVER_URI "/user/" NEW_USERNAME "?source=" MODULE_NAME_LOW, 200, j_expected_low), 1);
+  ck_assert_int_eq(run_simple_test(&admin_req, "DELETE", SERVER_URI "/user/" NEW_USERNAME "?source=" MODULE_NAME_LOW, NULL, NULL, NULL, NULL, 200, NULL, NULL, NULL), 1);
+  ck_assert_int_eq(get_user_twice(SERVER_URI "/user/" NEW_USERNAME, 404, NULL), 1);
+  json_decref(j_expected_low);
+}
+END_TEST
+
+static Suite *glewlwyd_suite(void)
+{
+  Suite *s;
+  TCase *tc_core;
+
+  s = suite_create("Glewlwyd CRUD user");
+  tc_core = tcase_create("test_glwd_crud_user_cache");
+  tcase_add_test(tc_core, test_glwd_crud_user_cache_add_module_instances);
+  tcase_add_test(tc_core, test_glwd_crud_user_cache_same_username_in_two_instances);
+  tcase_add_test(tc_core, test_glwd_crud_user_cache_update_in_one_instance);
+  tcase_add_test(tc_core, test_glwd_crud_user_cache_delete_in_one_instance);
+  tcase_add_test(tc_core, test_glwd_crud_user_cache_delete_module_instances);
+  tcase_set_timeout(tc_core, 30);
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
+
+int main(int argc, char *argv[])
+{
+  int number_failed = 0;
+  Suite *s;
+  SRunner *sr;
+  struct _u_request auth_req;
+  struct _u_response auth_resp;
+  int res, do_test = 0, i;
+  json_t * j_body;
+
+  y_init_logs("Glewlwyd test", Y_LOG_MODE_CONSOLE, Y_LOG_LEVEL_DEBUG, NULL, "Starting Glewlwyd test");
+
+  // Getting a valid session id for authenticated http requests
+  ulfius_init_request(&auth_req);
+  ulfius_init_request(&admin_req);
+  ulfius_init_response(&auth_resp);
+  auth_req.http_verb = strdup("POST");
+  auth_req.http_url = msprintf("%s/auth/", SERVER_URI);
+  j_body = json_pack("{ssss}", "username", USERNAME, "password", PASSWORD);
+  ulfius_set_json_body_request(&auth_req, j_body);
+  json_decref(j_body);
+  res = ulfius_send_http_request(&auth_req, &auth_resp);
+  if (res == U_OK && auth_resp.status == 200) {
+    for (i=0; i<auth_resp.nb_cookies; i++) {
+      char * cookie = msprintf("%s=%s", auth_resp.map_cookie[i].key, auth_resp.map_cookie[i].value);
+      u_map_put(admin_req.map_header, "Cookie", cookie);
+      o_free(cookie);
+      do_test = 1;
+    }
+    ulfius_clean_response(&auth_resp);
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "Error authentication");
+  }
+  ulfius_clean_request(&auth_req);
+
+  if (do_test) {
+    s = glewlwyd_suite();
+    sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_VERBOSE);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+  }
+
+  ulfius_clean_request(&admin_req);
+
+  return (do_test && number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,202 @@
+/* Public domain, no copyright. Use at your own risk. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <check.h>
+#include <ulfius.h>
+#include <orcania.h>
+#include <yder.h>
+
+#include "unit-tests.h"
+
+#define SERVER_URI "http://localhost:4593/api"
+#define METRICS_URI "http://localhost:4594/"
+#define USERNAME "admin"
+#define PASSWORD "password"
+
+#define NB_THREADS 16
+#define NB_REQUESTS 20
+
+#define POOL_MODE_SQLITE    "sqlite"
+#define POOL_MODE_ENABLED   "enabled"
+#define POOL_MODE_EXHAUSTED "exhausted"
+
+#define METRICS_POOL_WAIT    "glewlwyd_database_pool_wait"
+#define METRICS_POOL_TIMEOUT "glewlwyd_database_pool_timeout"
+
+struct _u_request admin_req;
+const char * pool_mode = POOL_MODE_SQLITE;
+
+struct _pool_worker {
+  pthread_t thread;
+  size_t    nb_errors;
+};
+
+/**
+ * Returns the value of the counter name in the metrics endpoint, -1 if the endpoint isn't available
+ */
+static long long get_metrics_counter(const char * name) {
+  struct _u_request req;
+  struct _u_response resp;
+  char * body, * line, * saveptr = NULL, * prefix = msprintf("%s ", name);
+  long long value = -1;
+
+  ulfius_init_request(&req);
+  ulfius_init_response(&resp);
+  ulfius_copy_request(&req, &admin_req);
+  ulfius_set_request_properties(&req, U_OPT_HTTP_VERB, "GET", U_OPT_HTTP_URL, METRICS_URI, U_OPT_NONE);
+  if (ulfius_send_http_request(&req, &resp) == U_OK && resp.status == 200) {
+    body = o_strndup(resp.binary_body, resp.binary_body_length);
+    for (line = strtok_r(body, "\n", &saveptr); line != NULL; line = strtok_r(NULL, "\n", &saveptr)) {
+      if (0 == o_strncmp(line, prefix, o_strlen(prefix))) {
+        value = strtoll(line+o_strlen(prefix), NULL, 10);
+        break;
+      }
+    }
+    o_free(body);
+  }
+  ulfius_clean_request(&req);
+  ulfius_clean_response(&resp);
+  o_free(prefix);
+  return value;
+}
+
+/**
+ * Runs requests that use the sessions and the scopes tables, so each request checks out a database connection
+ */
+static void * pool_worker_run(void * args) {
+  struct _pool_worker * worker = (struct _pool_worker *)args;
+  struct _u_request req;
+  struct _u_response resp;
+  int i;
+
+  for (i=0; i<NB_REQUESTS; i++) {
+    ulfius_init_request(&req);
+    ulfius_init_response(&resp);
+    ulfius_copy_request(&req, &admin_req);
+    ulfius_set_request_properties(&req, U_OPT_HTTP_VERB, "GET", U_OPT_HTTP_URL, (i%2)?SERVER_URI "/scope/":SERVER_URI "/profile/", U_OPT_NONE);
+    if (ulfius_send_http_request(&req, &resp) != U_OK || resp.status != 200) {
+      worker->nb_errors++;
+    }
+    ulfius_clean_request(&req);
+    ulfius_clean_response(&resp);
+  }
+  return NULL;
+}
+
+START_TEST(test_glwd_database_pool_concurrent_requests)
+{
+  struct _pool_worker workers[NB_THREADS];
+  long long nb_wait_before = get_metrics_counter(METRICS_POOL_WAIT), nb_timeout_before = get_metrics_counter(METRICS_POOL_TIMEOUT), nb_wait_after, nb_timeout_after;
+  size_t nb_errors = 0;
+  int i;
+
+  for (i=0; i<NB_THREADS; i++) {
+    workers[i].nb_errors = 0;
+    ck_assert_int_eq(pthread_create(&workers[i].thread, NULL, pool_worker_run, &workers[i]), 0);
+  }
+  for (i=0; i<NB_THREADS; i++) {
+    pthread_join(workers[i].thread, NULL);
+    nb_errors += workers[i].nb_errors;
+  }
+  // Every request must succeed, even when the pool is exhausted and the main connection is used
+  ck_assert_int_eq(nb_errors, 0);
+
+  nb_wait_after = get_metrics_counter(METRICS_POOL_WAIT);
+  nb_timeout_after = get_metrics_counter(METRICS_POOL_TIMEOUT);
+  if (nb_wait_before >= 0 && nb_wait_after >= 0 && nb_timeout_before >= 0 && nb_timeout_after >= 0) {
+    if (0 == o_strcmp(POOL_MODE_SQLITE, pool_mode)) {
+      // The pool isn't used with SQLite3, no request waits for a connection
+      ck_assert_int_eq(nb_wait_after, 0);
+      ck_assert_int_eq(nb_timeout_after, 0);
+    } else if (0 == o_strcmp(POOL_MODE_ENABLED, pool_mode)) {
+      // There are enough connections in the pool for every request
+      ck_assert_int_eq(nb_timeout_after, nb_timeout_before);
+    } else if (0 == o_strcmp(POOL_MODE_EXHAUSTED, pool_mode)) {
+      // Some requests have waited for a connection, then used the main connection
+      ck_assert_int_gt(nb_wait_after, nb_wait_before);
+      ck_assert_int_gt(nb_timeout_after, nb_timeout_before);
+    }
+  } else {
+    y_log_message(Y_LOG_LEVEL_WARNING, "Metrics endpoint not available, database pool counters not checked");
+  }
+}
+END_TEST
+
+static Suite *glewlwyd_suite(void)
+{
+  Suite *s;
+  TCase *tc_core;
+
+  s = suite_create("Glewlwyd database pool");
+  tc_core = tcase_create("test_glwd_database_pool");
+  tcase_add_test(tc_core, test_glwd_database_pool_concurrent_requests);
+  tcase_set_timeout(tc_core, 60);
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
+
+int main(int argc, char *argv[])
+{
+  int number_failed = 0;
+  Suite *s;
+  SRunner *sr;
+  struct _u_request auth_req;
+  struct _u_response auth_resp;
+  int res, do_test = 0, i;
+  json_t * j_body;
+
+  y_init_logs("Glewlwyd test", Y_LOG_MODE_CONSOLE, Y_LOG_LEVEL_DEBUG, NULL, "Starting Glewlwyd test");
+
+  if (argc > 1) {
+    pool_mode = argv[1];
+  }
+  if (0 != o_strcmp(POOL_MODE_SQLITE, pool_mode) && 0 != o_strcmp(POOL_MODE_ENABLED, pool_mode) && 0 != o_strcmp(POOL_MODE_EXHAUSTED, pool_mode)) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "Invalid pool mode %s, expected " POOL_MODE_SQLITE ", " POOL_MODE_ENABLED " or " POOL_MODE_EXHAUSTED, pool_mode);
+    y_close_logs();
+    return EXIT_FAILURE;
+  }
+
+  // Getting a valid session id for authenticated http requests
+  ulfius_init_request(&auth_req);
+  ulfius_init_request(&admin_req);
+  ulfius_init_response(&auth_resp);
+  auth_req.http_verb = strdup("POST");
+  auth_req.http_url = msprintf("%s/auth/", SERVER_URI);
+  j_body = json_pack("{ssss}", "username", USERNAME, "password", PASSWORD);
+  ulfius_set_json_body_request(&auth_req, j_body);
+  json_decref(j_body);
+  res = ulfius_send_http_request(&auth_req, &auth_resp);
+  if (res == U_OK && auth_resp.status == 200) {
+    for (i=0; i<auth_resp.nb_cookies; i++) {
+      char * cookie = msprintf("%s=%s", auth_resp.map_cookie[i].key, auth_resp.map_cookie[i].value);
+      u_map_put(admin_req.map_header, "Cookie", cookie);
+      o_free(cookie);
+      do_test = 1;
+    }
+    ulfius_clean_response(&auth_resp);
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "Error authentication");
+  }
+  ulfius_clean_request(&auth_req);
+
+  if (do_test) {
+    s = glewlwyd_suite();
+    sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_VERBOSE);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+  }
+
+  ulfius_clean_request(&admin_req);
+  y_close_logs();
+
+  return (do_test && number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,204 @@
+/* Public domain, no copyright. Use at your own risk. */
+
+/**
+ * Tests the http compression callback without a Glewlwyd instance,
+ * src/http_compression_callback.c is built with this file and compresses the responses of a local ulfius instance
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <zlib.h>
+
+#include <check.h>
+#include <ulfius.h>
+#include <orcania.h>
+#include <yder.h>
+
+#include "http_compression_callback.h"
+
+#define COMPRESSION_PORT 7599
+#define COMPRESSION_URI "http://localhost:7599"
+#define COMPRESSION_MIN_SIZE 256
+
+#define BODY_SIZE 1024
+
+struct _http_compression_config compression_config;
+struct _u_instance instance;
+
+/**
+ * Builds a compressible body
+ */
+static char * body_text(size_t size) {
+  char * body = o_malloc(size);
+  size_t i;
+
+  for (i=0; i<size; i++) {
+    body[i] = (char)('a' + (i/8)%4);
+  }
+  return body;
+}
+
+/**
+ * Builds a body that can't be compressed, always the same for a size
+ */
+static char * body_random(size_t size) {
+  char * body = o_malloc(size);
+  unsigned int seed = (unsigned int)size;
+  size_t i;
+
+  for (i=0; i<size; i++) {
+    seed = seed*1103515245 + 12345;
+    body[i] = (char)(seed >> 16);
+  }
+  return body;
+}
+
+static int callback_body(const struct _u_request * request, struct _u_response * response, void * user_data) {
+  size_t size = (size_t)strtoul(u_map_get(request->map_url, "size"), NULL, 10);
+  char * body = user_data!=NULL?body_random(size):body_text(size);
+
+  ulfius_set_binary_body_response(response, 200, body, size);
+  o_free(body);
+  return U_CALLBACK_CONTINUE;
+}
+
+static void compression_start(size_t min_size, int allow_gzip, int allow_deflate) {
+  compression_config.allow_gzip = allow_gzip;
+  compression_config.allow_deflate = allow_deflate;
+  compression_config.min_size = min_size;
+  compression_config.level = Z_DEFAULT_COMPRESSION;
+  ck_assert_int_eq(ulfius_init_instance(&instance, COMPRESSION_PORT, NULL, NULL), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&instance, "GET", NULL, "/text/:size", 0, &callback_body, NULL), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&instance, "GET", NULL, "/random/:size", 0, &callback_body, (void *)&instance), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&instance, "GET", NULL, "*", 1, &callback_http_compression, &compression_config), U_OK);
+  ck_assert_int_eq(ulfius_start_framework(&instance), U_OK);
+}
+
+static void compression_stop(void) {
+  ulfius_stop_framework(&instance);
+  ulfius_clean_instance(&instance);
+}
+
+/**
+ * Sends a GET request and checks the Content-Encoding and the body, uncompressed if the encoding is deflate
+ */
+static void compression_get(const char * path, size_t size, const char * accept_encoding, const char * expected_encoding) {
+  struct _u_request req;
+  struct _u_response resp;
+  char * url = msprintf(COMPRESSION_URI "/%s/%zu", path, size), * body = 0==o_strcmp("random", path)?body_random(size):body_text(size), * body_uncompressed;
+  uLongf body_uncompressed_len = (uLongf)size;
+
+  ulfius_init_request(&req);
+  ulfius_init_response(&resp);
+  ulfius_set_request_properties(&req, U_OPT_HTTP_VERB, "GET", U_OPT_HTTP_URL, url, U_OPT_NONE);
+  if (accept_encoding != NULL) {
+    u_map_put(req.map_header, "Accept-Encoding", accept_encoding);
+  }
+  ck_assert_int_eq(ulfius_send_http_request(&req, &resp), U_OK);
+  ck_assert_int_eq(resp.status, 200);
+  if (expected_encoding == NULL) {
+    ck_assert_ptr_eq(u_map_get_case(resp.map_header, "Content-Encoding"), NULL);
+    ck_assert_int_eq(resp.binary_body_length, size);
+    ck_assert_int_eq(memcmp(resp.binary_body, body, size), 0);
+  } else {
+    ck_assert_str_eq(u_map_get_case(resp.map_header, "Content-Encoding"), expected_encoding);
+    ck_assert_int_lt(resp.binary_body_length, size);
+    if (0 == o_strcmp("deflate", expected_encoding)) {
+      body_uncompressed = o_malloc(size);
+      ck_assert_int_eq(uncompress((Bytef *)body_uncompressed, &body_uncompressed_len, (const Bytef *)resp.binary_body, (uLong)resp.binary_body_length), Z_OK);
+      ck_assert_int_eq(body_uncompressed_len, size);
+      ck_assert_int_eq(memcmp(body_uncompressed, body, size), 0);
+      o_free(body_uncompressed);
+    }
+  }
+  ulfius_clean_request(&req);
+  ulfius_clean_response(&resp);
+  o_free(url);
+  o_free(body);
+}
+
+START_TEST(test_glwd_http_compression_encoding)
+{
+  compression_start(0, 1, 1);
+
+  compression_get("text", BODY_SIZE, NULL, NULL);
+  compression_get("text", BODY_SIZE, "gzip", "gzip");
+  compression_get("text", BODY_SIZE, "deflate", "deflate");
+  compression_get("text", BODY_SIZE, "br, deflate, gzip", "gzip");
+  compression_get("text", BODY_SIZE, "br", NULL);
+
+  compression_stop();
+
+  // gzip isn't allowed, deflate is used if accepted
+  compression_start(0, 0, 1);
+  compression_get("text", BODY_SIZE, "gzip", NULL);
+  compression_get("text", BODY_SIZE, "gzip, deflate", "deflate");
+  compression_stop();
+}
+END_TEST
+
+START_TEST(test_glwd_http_compression_min_size)
+{
+  compression_start(COMPRESSION_MIN_SIZE, 1, 1);
+
+  // The bodies smaller than min_size aren't compressed
+  compression_get("text", COMPRESSION_MIN_SIZE-1, "gzip, deflate", NULL);
+  compression_get("text", COMPRESSION_MIN_SIZE-1, "deflate", NULL);
+  compression_get("text", COMPRESSION_MIN_SIZE, "gzip, deflate", "gzip");
+  compression_get("text", COMPRESSION_MIN_SIZE, "deflate", "deflate");
+
+  compression_stop();
+}
+END_TEST
+
+START_TEST(test_glwd_http_compression_not_smaller)
+{
+  compression_start(0, 1, 1);
+
+  // The compressed body isn't smaller, the original body is sent without Content-Encoding
+  compression_get("random", BODY_SIZE, "gzip", NULL);
+  compression_get("random", BODY_SIZE, "deflate", NULL);
+  compression_get("text", 8, "gzip, deflate", NULL);
+
+  compression_stop();
+}
+END_TEST
+
+static Suite *glewlwyd_suite(void)
+{
+  Suite *s;
+  TCase *tc_core;
+
+  s = suite_create("Glewlwyd http compression");
+  tc_core = tcase_create("test_glwd_http_compression");
+  tcase_add_test(tc_core, test_glwd_http_compression_encoding);
+  tcase_add_test(tc_core, test_glwd_http_compression_min_size);
+  tcase_add_test(tc_core, test_glwd_http_compression_not_smaller);
+  tcase_set_timeout(tc_core, 30);
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
+
+int main(int argc, char *argv[])
+{
+  int number_failed;
+  Suite *s;
+  SRunner *sr;
+
+  y_init_logs("Glewlwyd test", Y_LOG_MODE_CONSOLE, Y_LOG_LEVEL_DEBUG, NULL, "Starting Glewlwyd test");
+
+  s = glewlwyd_suite();
+  sr = srunner_create(s);
+
+  srunner_run_all(sr, CK_VERBOSE);
+  number_failed = srunner_ntests_failed(sr);
+  srunner_free(sr);
+
+  y_close_logs();
+
+  return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
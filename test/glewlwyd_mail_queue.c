@@ -0,0 +1,364 @@
+/* Public domain, no copyright. Use at your own risk. */
+
+/**
+ * Tests the mail queue without a Glewlwyd instance,
+ * src/mail_queue.c is built with this file and sends the e-mails to a local SMTP server
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+#include <check.h>
+#include <ulfius.h>
+#include <orcania.h>
+#include <yder.h>
+
+#include "glewlwyd.h"
+
+#define MAIL_HOST "localhost"
+#define MAIL_PORT 2530
+#define MAIL_FROM "glewlwyd@glewlwyd.tld"
+#define MAIL_TO "user1@glewlwyd.tld"
+#define MAIL_CONTENT_TYPE "text/plain; charset=utf-8"
+#define MAIL_SUBJECT "Mail queue"
+#define MAIL_BODY "Mail queue test"
+
+#define MAIL_NB_SHUTDOWN 10
+#define MAIL_CLOSE_TIMEOUT 2
+#define MAIL_REPLY_DELAY 1
+
+#define BUF_SIZE 4096
+
+struct smtp_server {
+  unsigned int port;
+  unsigned int reply_delay;
+  unsigned int nb_mails;
+  unsigned int listening;
+  unsigned int stop;
+  pthread_t    thread;
+};
+
+struct config_elements config;
+struct _glwd_metrics_data metrics_depth, metrics_sent, metrics_retry, metrics_failed;
+
+/**
+ * The metrics functions used by the mail queue, the values are stored in the first shard
+ */
+int glewlwyd_metrics_add_metric(struct config_elements * config, const char * name, const char * help) {
+  return G_OK;
+}
+
+int glewlwyd_metrics_add_metric_type(struct config_elements * config, const char * name, const char * help, unsigned short type) {
+  return G_OK;
+}
+
+struct _glwd_metrics_data * glewlwyd_metrics_get_gauge(struct config_elements * config, const char * name, const char * label) {
+  return 0 == o_strcmp(GLWD_METRICS_MAIL_QUEUE_DEPTH, name) ? &metrics_depth : NULL;
+}
+
+struct _glwd_metrics_data * glewlwyd_metrics_get_counter(struct config_elements * config, const char * name, const char * label) {
+  if (0 == o_strcmp(GLWD_METRICS_MAIL_SENT, name)) {
+    return &metrics_sent;
+  } else if (0 == o_strcmp(GLWD_METRICS_MAIL_RETRY, name)) {
+    return &metrics_retry;
+  } else if (0 == o_strcmp(GLWD_METRICS_MAIL_FAILED, name)) {
+    return &metrics_failed;
+  } else {
+    return NULL;
+  }
+}
+
+void glewlwyd_metrics_counter_add(struct _glwd_metrics_data * counter, size_t inc) {
+  if (counter != NULL) {
+    __atomic_fetch_add(&counter->shards[0].value, inc, __ATOMIC_RELAXED);
+  }
+}
+
+void glewlwyd_metrics_gauge_add(struct _glwd_metrics_data * gauge, long delta) {
+  if (gauge != NULL) {
+    __atomic_fetch_add(&gauge->shards[0].value, (size_t)delta, __ATOMIC_RELAXED);
+  }
+}
+
+static long long metrics_value(struct _glwd_metrics_data * data) {
+  return (long long)__atomic_load_n(&data->shards[0].value, __ATOMIC_RELAXED);
+}
+
+/**
+ * Answers the SMTP commands of one connection, the end of the e-mail data is answered after reply_delay seconds
+ */
+static void smtp_server_handle(struct smtp_server * server, int sockfd) {
+  char buffer[BUF_SIZE+1], * eol;
+  const char * reply;
+  size_t offset = 0, line_len;
+  ssize_t rc;
+  int in_data = 0, end = 0;
+  fd_set sockset;
+  struct timeval tv;
+
+  reply = "220 " MAIL_HOST " ESMTP\r\n";
+  send(sockfd, reply, o_strlen(reply), 0);
+  while (!end) {
+    FD_ZERO(&sockset);
+    FD_SET(sockfd, &sockset);
+    tv.tv_sec = 5;
+    tv.tv_usec = 0;
+    if (select(sockfd+1, &sockset, NULL, NULL, &tv) <= 0 || (rc = recv(sockfd, buffer+offset, BUF_SIZE-offset, 0)) <= 0) {
+      break;
+    }
+    offset += (size_t)rc;
+    buffer[offset] = '\0';
+    while (!end && (eol = o_strstr(buffer, "\r\n")) != NULL) {
+      *eol = '\0';
+      line_len = (size_t)(eol - buffer) + 2;
+      reply = NULL;
+      if (in_data) {
+        if (0 == o_strcmp(buffer, ".")) {
+          in_data = 0;
+          sleep(server->reply_delay);
+          __atomic_fetch_add(&server->nb_mails, 1, __ATOMIC_RELAXED);
+          reply = "250 OK\r\n";
+        }
+      } else if (0 == o_strncasecmp(buffer, "DATA", 4)) {
+        in_data = 1;
+        reply = "354 End data with <CR><LF>.<CR><LF>\r\n";
+      } else if (0 == o_strncasecmp(buffer, "QUIT", 4)) {
+        reply = "221 Bye\r\n";
+        end = 1;
+      } else if (0 == o_strncasecmp(buffer, "EHLO", 4) || 0 == o_strncasecmp(buffer, "HELO", 4)) {
+        reply = "250 " MAIL_HOST "\r\n";
+      } else {
+        reply = "250 OK\r\n";
+      }
+      if (reply != NULL) {
+        send(sockfd, reply, o_strlen(reply), 0);
+      }
+      memmove(buffer, buffer+line_len, offset-line_len+1);
+      offset -= line_len;
+    }
+    if (offset >= BUF_SIZE) {
+      // Line too long, the content isn't needed
+      offset = 0;
+    }
+  }
+  shutdown(sockfd, SHUT_WR);
+  close(sockfd);
+}
+
+static void * smtp_server_run(void * args) {
+  struct smtp_server * server = (struct smtp_server *)args;
+  struct sockaddr_in address;
+  int server_fd, sockfd, opt = 1;
+  fd_set sockset;
+  struct timeval tv;
+
+  if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) >= 0) {
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(server->port);
+    if (!setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) && !bind(server_fd, (struct sockaddr *)&address, sizeof(address)) && !listen(server_fd, 16)) {
+      __atomic_store_n(&server->listening, 1, __ATOMIC_RELAXED);
+      while (!__atomic_load_n(&server->stop, __ATOMIC_RELAXED)) {
+        FD_ZERO(&sockset);
+        FD_SET(server_fd, &sockset);
+        tv.tv_sec = 0;
+        tv.tv_usec = 100000;
+        if (select(server_fd+1, &sockset, NULL, NULL, &tv) > 0 && (sockfd = accept(server_fd, NULL, NULL)) >= 0) {
+          smtp_server_handle(server, sockfd);
+        }
+      }
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "smtp_server_run - Error starting server on port %u", server->port);
+    }
+    close(server_fd);
+  }
+  return NULL;
+}
+
+static void smtp_server_start(struct smtp_server * server, unsigned int reply_delay) {
+  int i;
+
+  memset(server, 0, sizeof(struct smtp_server));
+  server->port = MAIL_PORT;
+  server->reply_delay = reply_delay;
+  ck_assert_int_eq(pthread_create(&server->thread, NULL, smtp_server_run, server), 0);
+  for (i=0; i<50 && !__atomic_load_n(&server->listening, __ATOMIC_RELAXED); i++) {
+    usleep(100000);
+  }
+  ck_assert_int_eq(server->listening, 1);
+}
+
+static void smtp_server_stop(struct smtp_server * server) {
+  __atomic_store_n(&server->stop, 1, __ATOMIC_RELAXED);
+  pthread_join(server->thread, NULL);
+}
+
+static void mail_queue_init(size_t nb_workers, unsigned int max_attempts, unsigned int retry_delay, unsigned int close_timeout) {
+  memset(&config, 0, sizeof(struct config_elements));
+  memset(&metrics_depth, 0, sizeof(struct _glwd_metrics_data));
+  memset(&metrics_sent, 0, sizeof(struct _glwd_metrics_data));
+  memset(&metrics_retry, 0, sizeof(struct _glwd_metrics_data));
+  memset(&metrics_failed, 0, sizeof(struct _glwd_metrics_data));
+  config.mail_queue.nb_workers = nb_workers;
+  config.mail_queue.max_size = GLEWLWYD_DEFAULT_MAIL_QUEUE_MAX_SIZE;
+  config.mail_queue.max_attempts = max_attempts;
+  config.mail_queue.retry_delay = retry_delay;
+  config.mail_queue.close_timeout = close_timeout;
+  ck_assert_int_eq(glewlwyd_mail_queue_init(&config), G_OK);
+}
+
+static int mail_queue_push(void) {
+  return glewlwyd_mail_queue_push(&config, MAIL_HOST, MAIL_PORT, 0, 0, NULL, NULL, MAIL_FROM, MAIL_TO, MAIL_CONTENT_TYPE, MAIL_SUBJECT, MAIL_BODY);
+}
+
+START_TEST(test_glwd_mail_queue_enqueue)
+{
+  struct smtp_server server;
+  time_t start;
+  int i;
+
+  smtp_server_start(&server, MAIL_REPLY_DELAY*2);
+  mail_queue_init(1, 1, 1, MAIL_CLOSE_TIMEOUT);
+
+  // The e-mail is sent by the worker, the push doesn't wait for the SMTP server
+  time(&start);
+  ck_assert_int_eq(mail_queue_push(), G_OK);
+  ck_assert_int_lt(time(NULL)-start, MAIL_REPLY_DELAY*2);
+  for (i=0; i<50 && metrics_value(&metrics_sent) < 1; i++) {
+    usleep(100000);
+  }
+  ck_assert_int_eq(server.nb_mails, 1);
+  ck_assert_int_eq(metrics_value(&metrics_sent), 1);
+  ck_assert_int_eq(metrics_value(&metrics_depth), 0);
+
+  glewlwyd_mail_queue_close(&config);
+  smtp_server_stop(&server);
+}
+END_TEST
+
+START_TEST(test_glwd_mail_queue_retry)
+{
+  struct smtp_server server;
+  int i;
+
+  mail_queue_init(1, 3, 1, MAIL_CLOSE_TIMEOUT);
+
+  // The SMTP server isn't available yet, the e-mail is queued again
+  ck_assert_int_eq(mail_queue_push(), G_OK);
+  for (i=0; i<30 && metrics_value(&metrics_retry) < 1; i++) {
+    usleep(100000);
+  }
+  ck_assert_int_eq(metrics_value(&metrics_retry), 1);
+  ck_assert_int_eq(metrics_value(&metrics_sent), 0);
+
+  // The next attempt sends the e-mail
+  smtp_server_start(&server, 0);
+  for (i=0; i<100 && metrics_value(&metrics_sent) < 1; i++) {
+    usleep(100000);
+  }
+  ck_assert_int_eq(server.nb_mails, 1);
+  ck_assert_int_eq(metrics_value(&metrics_sent), 1);
+  ck_assert_int_eq(metrics_value(&metrics_failed), 0);
+  ck_assert_int_eq(metrics_value(&metrics_depth), 0);
+
+  glewlwyd_mail_queue_close(&config);
+  smtp_server_stop(&server);
+}
+END_TEST
+
+START_TEST(test_glwd_mail_queue_retry_dropped)
+{
+  int i;
+
+  mail_queue_init(1, 2, 1, MAIL_CLOSE_TIMEOUT);
+
+  // No SMTP server, the e-mail is dropped after max_attempts
+  ck_assert_int_eq(mail_queue_push(), G_OK);
+  for (i=0; i<50 && metrics_value(&metrics_failed) < 1; i++) {
+    usleep(100000);
+  }
+  ck_assert_int_eq(metrics_value(&metrics_retry), 1);
+  ck_assert_int_eq(metrics_value(&metrics_failed), 1);
+  ck_assert_int_eq(metrics_value(&metrics_depth), 0);
+
+  glewlwyd_mail_queue_close(&config);
+}
+END_TEST
+
+START_TEST(test_glwd_mail_queue_shutdown)
+{
+  struct smtp_server server;
+  time_t start;
+  int i;
+
+  smtp_server_start(&server, MAIL_REPLY_DELAY);
+  mail_queue_init(1, 1, 1, MAIL_CLOSE_TIMEOUT);
+
+  for (i=0; i<MAIL_NB_SHUTDOWN; i++) {
+    ck_assert_int_eq(mail_queue_push(), G_OK);
+  }
+
+  // The queue is drained until the close timeout, then the e-mails left are dropped
+  time(&start);
+  glewlwyd_mail_queue_close(&config);
+  ck_assert_int_le(time(NULL)-start, MAIL_CLOSE_TIMEOUT+MAIL_REPLY_DELAY+1);
+  ck_assert_int_lt(metrics_value(&metrics_sent), MAIL_NB_SHUTDOWN);
+  ck_assert_int_gt(metrics_value(&metrics_failed), 0);
+  ck_assert_int_eq(metrics_value(&metrics_sent)+metrics_value(&metrics_failed), MAIL_NB_SHUTDOWN);
+  ck_assert_int_eq(metrics_value(&metrics_depth), 0);
+
+  // The e-mails sent after the queue is closed are sent in the current thread
+  ck_assert_int_eq(mail_queue_push(), G_OK);
+  ck_assert_int_eq(metrics_value(&metrics_sent)+metrics_value(&metrics_failed), MAIL_NB_SHUTDOWN+1);
+
+  smtp_server_stop(&server);
+}
+END_TEST
+
+static Suite *glewlwyd_suite(void)
+{
+  Suite *s;
+  TCase *tc_core;
+
+  s = suite_create("Glewlwyd mail queue");
+  tc_core = tcase_create("test_glwd_mail_queue");
+  tcase_add_test(tc_core, test_glwd_mail_queue_enqueue);
+  tcase_add_test(tc_core, test_glwd_mail_queue_retry);
+  tcase_add_test(tc_core, test_glwd_mail_queue_retry_dropped);
+  tcase_add_test(tc_core, test_glwd_mail_queue_shutdown);
+  tcase_set_timeout(tc_core, 30);
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
+
+int main(int argc, char *argv[])
+{
+  int number_failed;
+  Suite *s;
+  SRunner *sr;
+
+  y_init_logs("Glewlwyd test", Y_LOG_MODE_CONSOLE, Y_LOG_LEVEL_DEBUG, NULL, "Starting Glewlwyd test");
+
+  s = glewlwyd_suite();
+  sr = srunner_create(s);
+
+  srunner_run_all(sr, CK_VERBOSE);
+  number_failed = srunner_ntests_failed(sr);
+  srunner_free(sr);
+
+  y_close_logs();
+
+  return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,239 @@
+/* Public domain, no copyright. Use at your own risk. */
+
+/**
+ * Tests the prometheus metrics without a Glewlwyd instance,
+ * src/metrics.c is built with this file and the output of glewlwyd_metrics_export is checked
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <check.h>
+#include <ulfius.h>
+#include <orcania.h>
+#include <yder.h>
+
+#include "glewlwyd.h"
+
+#define NB_THREADS 8
+#define NB_INCREMENTS 1000
+
+#define COUNTER_NAME "glewlwyd_test_counter"
+#define COUNTER_HELP "Test counter"
+#define GAUGE_NAME "glewlwyd_test_gauge"
+#define GAUGE_HELP "Test gauge"
+#define HISTOGRAM_NAME "glewlwyd_test_duration_seconds"
+#define HISTOGRAM_HELP "Test histogram"
+
+struct config_elements config;
+
+static void metrics_init(void) {
+  memset(&config, 0, sizeof(struct config_elements));
+  config.metrics_endpoint = 1;
+  ck_assert_int_eq(glewlwyd_metrics_init(&config), G_OK);
+}
+
+static void metrics_clean(void) {
+  glewlwyd_metrics_close(&config);
+}
+
+/**
+ * Checks that the prometheus output contains the line expected
+ */
+static void metrics_check_line(const char * expected) {
+  char * content = glewlwyd_metrics_export(&config), * line = msprintf("\n%s\n", expected);
+
+  ck_assert_ptr_ne(content, NULL);
+  ck_assert_ptr_ne(o_strstr(content, line), NULL);
+  o_free(line);
+  o_free(content);
+}
+
+static void * metrics_increment_thread(void * args) {
+  size_t i;
+
+  for (i=0; i<NB_INCREMENTS; i++) {
+    glewlwyd_metrics_increment_counter_va(&config, COUNTER_NAME, 1, "module", "test \"quoted\"", NULL);
+    glewlwyd_metrics_counter_add((struct _glwd_metrics_data *)args, 2);
+  }
+  return NULL;
+}
+
+START_TEST(test_glwd_metrics_counter)
+{
+  struct _glwd_metrics_data * counter;
+  pthread_t threads[NB_THREADS];
+  size_t i;
+
+  metrics_init();
+  ck_assert_int_eq(glewlwyd_metrics_add_metric(&config, COUNTER_NAME, COUNTER_HELP), G_OK);
+  ck_assert_ptr_ne(counter = glewlwyd_metrics_get_counter(&config, COUNTER_NAME, NULL), NULL);
+  metrics_check_line("# HELP " COUNTER_NAME " " COUNTER_HELP);
+  metrics_check_line("# TYPE " COUNTER_NAME " counter");
+  metrics_check_line(COUNTER_NAME " 0");
+
+  // The increments of each thread go to its own shard, the exported value is the sum of the shards
+  for (i=0; i<NB_THREADS; i++) {
+    ck_assert_int_eq(pthread_create(&threads[i], NULL, metrics_increment_thread, counter), 0);
+  }
+  for (i=0; i<NB_THREADS; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  ck_assert_int_eq(glewlwyd_metrics_counter_value(counter), NB_THREADS*NB_INCREMENTS*2);
+  metrics_check_line(COUNTER_NAME " 16000");
+  metrics_check_line(COUNTER_NAME "{module=\"test \\\"quoted\\\"\"} 8000");
+
+  // The labels are case insensitive
+  ck_assert_ptr_eq(glewlwyd_metrics_get_counter(&config, COUNTER_NAME, "module=\"TEST\""), glewlwyd_metrics_get_counter(&config, COUNTER_NAME, "module=\"test\""));
+  ck_assert_ptr_ne(glewlwyd_metrics_get_counter(&config, COUNTER_NAME, "module=\"test\""), counter);
+
+  // A metric must be registered before it's used
+  ck_assert_ptr_eq(glewlwyd_metrics_get_counter(&config, "glewlwyd_test_unknown", NULL), NULL);
+  ck_assert_int_eq(glewlwyd_metrics_increment_counter(&config, "glewlwyd_test_unknown", NULL, 1), G_ERROR);
+  ck_assert_int_eq(glewlwyd_metrics_increment_counter(&config, NULL, NULL, 1), G_ERROR_PARAM);
+
+  metrics_clean();
+}
+END_TEST
+
+START_TEST(test_glwd_metrics_gauge)
+{
+  struct _glwd_metrics_data * gauge;
+
+  metrics_init();
+  ck_assert_int_eq(glewlwyd_metrics_add_metric_type(&config, GAUGE_NAME, GAUGE_HELP, GLWD_METRICS_TYPE_GAUGE), G_OK);
+  ck_assert_ptr_ne(gauge = glewlwyd_metrics_get_gauge(&config, GAUGE_NAME, "queue=\"mail\""), NULL);
+  metrics_check_line("# TYPE " GAUGE_NAME " gauge");
+  glewlwyd_metrics_gauge_add(gauge, 2);
+  metrics_check_line(GAUGE_NAME "{queue=\"mail\"} 2");
+
+  // A gauge can be negative
+  glewlwyd_metrics_gauge_add(gauge, -5);
+  ck_assert_int_eq(glewlwyd_metrics_gauge_value(gauge), -3);
+  metrics_check_line(GAUGE_NAME "{queue=\"mail\"} -3");
+
+  metrics_clean();
+}
+END_TEST
+
+START_TEST(test_glwd_metrics_histogram)
+{
+  struct _glwd_metrics_data * histogram;
+
+  metrics_init();
+  ck_assert_int_eq(glewlwyd_metrics_add_metric_type(&config, HISTOGRAM_NAME, HISTOGRAM_HELP, GLWD_METRICS_TYPE_HISTOGRAM), G_OK);
+  ck_assert_ptr_ne(glewlwyd_metrics_get_histogram(&config, HISTOGRAM_NAME, NULL), NULL);
+  ck_assert_ptr_ne(histogram = glewlwyd_metrics_get_histogram(&config, HISTOGRAM_NAME, "function=\"get\""), NULL);
+  metrics_check_line("# TYPE " HISTOGRAM_NAME " histogram");
+
+  // An empty histogram has all its buckets
+  metrics_check_line(HISTOGRAM_NAME "_bucket{le=\"0.001\"} 0");
+  metrics_check_line(HISTOGRAM_NAME "_bucket{le=\"+Inf\"} 0");
+  metrics_check_line(HISTOGRAM_NAME "_sum 0.000000");
+  metrics_check_line(HISTOGRAM_NAME "_count 0");
+
+  // The observations are in microseconds, the buckets are cumulative and the sum is in seconds
+  glewlwyd_metrics_histogram_observe(histogram, 500);
+  glewlwyd_metrics_histogram_observe(histogram, 1000);
+  glewlwyd_metrics_histogram_observe(histogram, 3000);
+  glewlwyd_metrics_histogram_observe(histogram, 20000000);
+  metrics_check_line(HISTOGRAM_NAME "_bucket{function=\"get\", le=\"0.001\"} 2");
+  metrics_check_line(HISTOGRAM_NAME "_bucket{function=\"get\", le=\"0.0025\"} 2");
+  metrics_check_line(HISTOGRAM_NAME "_bucket{function=\"get\", le=\"0.005\"} 3");
+  metrics_check_line(HISTOGRAM_NAME "_bucket{function=\"get\", le=\"10\"} 3");
+  metrics_check_line(HISTOGRAM_NAME "_bucket{function=\"get\", le=\"+Inf\"} 4");
+  metrics_check_line(HISTOGRAM_NAME "_sum{function=\"get\"} 20.004500");
+  metrics_check_line(HISTOGRAM_NAME "_count{function=\"get\"} 4");
+
+  metrics_clean();
+}
+END_TEST
+
+START_TEST(test_glwd_metrics_call)
+{
+  struct _glwd_metrics_data * histogram, * in_flight;
+  struct timespec start;
+
+  metrics_init();
+  ck_assert_int_eq(glewlwyd_metrics_add_metric_type(&config, HISTOGRAM_NAME, HISTOGRAM_HELP, GLWD_METRICS_TYPE_HISTOGRAM), G_OK);
+  ck_assert_int_eq(glewlwyd_metrics_add_metric_type(&config, GAUGE_NAME, GAUGE_HELP, GLWD_METRICS_TYPE_GAUGE), G_OK);
+  ck_assert_ptr_ne(histogram = glewlwyd_metrics_get_histogram(&config, HISTOGRAM_NAME, NULL), NULL);
+  ck_assert_ptr_ne(in_flight = glewlwyd_metrics_get_gauge(&config, GAUGE_NAME, NULL), NULL);
+
+  // The call is in flight until it ends, then its duration is added to the histogram
+  glewlwyd_metrics_call_start(in_flight, &start);
+  ck_assert_int_eq(glewlwyd_metrics_gauge_value(in_flight), 1);
+  metrics_check_line(HISTOGRAM_NAME "_count 0");
+  glewlwyd_metrics_call_end(in_flight, histogram, &start);
+  ck_assert_int_eq(glewlwyd_metrics_gauge_value(in_flight), 0);
+  metrics_check_line(GAUGE_NAME " 0");
+  metrics_check_line(HISTOGRAM_NAME "_bucket{le=\"+Inf\"} 1");
+  metrics_check_line(HISTOGRAM_NAME "_count 1");
+
+  // Nothing is measured when the metrics are disabled
+  glewlwyd_metrics_call_start(NULL, &start);
+  glewlwyd_metrics_call_end(NULL, histogram, &start);
+  glewlwyd_metrics_histogram_observe(NULL, 1000);
+  metrics_check_line(HISTOGRAM_NAME "_count 1");
+
+  metrics_clean();
+}
+END_TEST
+
+START_TEST(test_glwd_metrics_disabled)
+{
+  memset(&config, 0, sizeof(struct config_elements));
+  ck_assert_int_eq(glewlwyd_metrics_init(&config), G_OK);
+  ck_assert_int_eq(glewlwyd_metrics_add_metric(&config, COUNTER_NAME, COUNTER_HELP), G_OK);
+  ck_assert_ptr_eq(glewlwyd_metrics_get_counter(&config, COUNTER_NAME, NULL), NULL);
+  ck_assert_int_eq(glewlwyd_metrics_increment_counter_va(&config, COUNTER_NAME, 1, "module", "test", NULL), G_OK);
+  // The handles are NULL when the metrics are disabled, using them does nothing
+  glewlwyd_metrics_counter_add(NULL, 1);
+  glewlwyd_metrics_gauge_add(NULL, 1);
+  ck_assert_int_eq(glewlwyd_metrics_counter_value(NULL), 0);
+  glewlwyd_metrics_close(&config);
+  pthread_mutex_destroy(&config.metrics_lock);
+}
+END_TEST
+
+static Suite *glewlwyd_suite(void)
+{
+  Suite *s;
+  TCase *tc_core;
+
+  s = suite_create("Glewlwyd metrics");
+  tc_core = tcase_create("test_glwd_metrics");
+  tcase_add_test(tc_core, test_glwd_metrics_counter);
+  tcase_add_test(tc_core, test_glwd_metrics_gauge);
+  tcase_add_test(tc_core, test_glwd_metrics_histogram);
+  tcase_add_test(tc_core, test_glwd_metrics_call);
+  tcase_add_test(tc_core, test_glwd_metrics_disabled);
+  tcase_set_timeout(tc_core, 30);
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
+
+int main(int argc, char *argv[])
+{
+  int number_failed;
+  Suite *s;
+  SRunner *sr;
+
+  y_init_logs("Glewlwyd test", Y_LOG_MODE_CONSOLE, Y_LOG_LEVEL_DEBUG, NULL, "Starting Glewlwyd test");
+
+  s = glewlwyd_suite();
+  sr = srunner_create(s);
+
+  srunner_run_all(sr, CK_VERBOSE);
+  number_failed = srunner_ntests_failed(sr);
+  srunner_free(sr);
+
+  y_close_logs();
+
+  return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,539 @@
+/* Public domain, no copyright. Use at your own risk. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <check.h>
+#include <ulfius.h>
+#include <orcania.h>
+#include <yder.h>
+#include <hoel.h>
+
+#include "unit-tests.h"
+
+#define SERVER_URI "http://localhost:4593/api"
+#define USERNAME "user1"
+#define PASSWORD "password"
+#define SCOPE_LIST "openid"
+#define CLIENT_ID "client3_id"
+#define CLIENT_SECRET "password"
+#define CLIENT_REDIRECT_URI "../../test-oauth2.html?param=client3"
+#define CLIENT_REDIRECT_URI_ENCODED "..%2F..%2Ftest-oauth2.html%3Fparam%3Dclient3"
+#define ADMIN_USERNAME "admin"
+#define ADMIN_PASSWORD "password"
+
+#define PLUGIN_MODULE "oidc"
+#define PLUGIN_NAME "oidc_stateless"
+#define PLUGIN_ISS "https://glewlwyd.tld"
+#define PLUGIN_JWT_TYPE "sha"
+#define PLUGIN_JWT_KEY_SIZE "256"
+#define PLUGIN_KEY "secret_" PLUGIN_NAME
+#define PLUGIN_CODE_DURATION 600
+#define PLUGIN_REFRESH_TOKEN_DURATION 1209600
+#define PLUGIN_ACCESS_TOKEN_DURATION 3600
+
+#define TOKEN_TYPE_HINT_ACCESS "access_token"
+#define NB_TOKENS 16
+
+#define DEFAULT_DB_PATH "/tmp/glewlwyd.db"
+#define TABLE_ACCESS_TOKEN "gpo_access_token"
+#define TABLE_ACCESS_TOKEN_REVOKED "gpo_access_token_revoked"
+#define TABLE_ACCESS_TOKEN_REVOKED_RENAMED "gpo_access_token_revoked_unavailable"
+#define REVOKED_JTI_SYNC_INTERVAL 10
+
+struct _u_request admin_req;
+struct _u_request user_req;
+struct _h_connection * conn = NULL;
+
+static char * get_access_token_password() {
+  struct _u_request req;
+  struct _u_response resp;
+  json_t * j_body;
+  char * token = NULL;
+
+  ulfius_init_request(&req);
+  ulfius_init_response(&resp);
+  ulfius_set_request_properties(&req,
+                                U_OPT_HTTP_VERB, "POST",
+                                U_OPT_HTTP_URL, SERVER_URI "/" PLUGIN_NAME "/token",
+                                U_OPT_AUTH_BASIC_USER, CLIENT_ID,
+                                U_OPT_AUTH_BASIC_PASSWORD, CLIENT_SECRET,
+                                U_OPT_POST_BODY_PARAMETER, "grant_type", "password",
+                                U_OPT_POST_BODY_PARAMETER, "scope", SCOPE_LIST,
+                                U_OPT_POST_BODY_PARAMETER, "username", USERNAME,
+                                U_OPT_POST_BODY_PARAMETER, "password", PASSWORD,
+                                U_OPT_NONE);
+  if (ulfius_send_http_request(&req, &resp) == U_OK && resp.status == 200) {
+    j_body = ulfius_get_json_body_response(&resp, NULL);
+    token = o_strdup(json_string_value(json_object_get(j_body, "access_token")));
+    json_decref(j_body);
+  }
+  ulfius_clean_response(&resp);
+  ulfius_clean_request(&req);
+  return token;
+}
+
+static int introspect_access_token(const char * token, json_t * j_active) {
+  struct _u_map param;
+  json_t * j_response = json_pack("{sO}", "active", j_active);
+  int ret;
+
+  u_map_init(&param);
+  u_map_put(&param, "token", token);
+  u_map_put(&param, "token_type_hint", TOKEN_TYPE_HINT_ACCESS);
+  ret = run_simple_test(NULL, "POST", SERVER_URI "/" PLUGIN_NAME "/introspect", CLIENT_ID, CLIENT_SECRET, NULL, &param, 200, j_response, NULL, NULL);
+  u_map_clean(&param);
+  json_decref(j_response);
+  return ret;
+}
+
+static int userinfo_access_token(const char * token, int expected_status) {
+  struct _u_request req;
+  char * bearer = msprintf("Bearer %s", token);
+  int ret;
+
+  ulfius_init_request(&req);
+  u_map_put(req.map_header, "Authorization", bearer);
+  ret = run_simple_test(&req, "GET", SERVER_URI "/" PLUGIN_NAME "/userinfo/", NULL, NULL, NULL, NULL, expected_status, NULL, NULL, NULL);
+  ulfius_clean_request(&req);
+  o_free(bearer);
+  return ret;
+}
+
+/**
+ * Returns the number of access tokens stored in the database for the plugin instance, -1 on error
+ */
+static json_int_t count_access_token_rows() {
+  json_t * j_query = json_pack("{sss[s]s{ss}}",
+                               "table", TABLE_ACCESS_TOKEN,
+                               "columns", "COUNT(*) AS nb",
+                               "where", "gpoa_plugin_name", PLUGIN_NAME), * j_result = NULL;
+  json_int_t nb = -1;
+
+  if (h_select(conn, j_query, &j_result, NULL) == H_OK) {
+    nb = json_integer_value(json_object_get(json_array_get(j_result, 0), "nb"));
+    json_decref(j_result);
+  }
+  json_decref(j_query);
+  return nb;
+}
+
+static int rename_table(const char * from, const char * to) {
+  char * query = msprintf("ALTER TABLE %s RENAME TO %s", from, to);
+  int ret = h_execute_query(conn, query, NULL, H_OPTION_EXEC);
+
+  o_free(query);
+  return ret;
+}
+
+static char * get_code() {
+  struct _u_request req;
+  struct _u_response resp;
+  char * code = NULL;
+
+  ulfius_init_request(&req);
+  ulfius_init_response(&resp);
+  ulfius_copy_request(&req, &user_req);
+  ulfius_set_request_properties(&req,
+                                U_OPT_HTTP_VERB, "GET",
+                                U_OPT_HTTP_URL, SERVER_URI "/" PLUGIN_NAME "/auth?response_type=code&nonce=nonce1234&client_id=" CLIENT_ID "&redirect_uri=" CLIENT_REDIRECT_URI_ENCODED "&scope=" SCOPE_LIST "&g_continue",
+                                U_OPT_NONE);
+  if (ulfius_send_http_request(&req, &resp) == U_OK && resp.status == 302 && o_strstr(u_map_get(resp.map_header, "Location"), "code=") != NULL) {
+    code = o_strdup(o_strstr(u_map_get(resp.map_header, "Location"), "code=")+strlen("code="));
+    if (strchr(code, '&') != NULL) {
+      *strchr(code, '&') = '\0';
+    }
+  }
+  ulfius_clean_response(&resp);
+  ulfius_clean_request(&req);
+  return code;
+}
+
+static json_t * get_tokens(const char * grant_type, const char * parameter_name, const char * parameter_value) {
+  struct _u_request req;
+  struct _u_response resp;
+  json_t * j_body = NULL;
+
+  ulfius_init_request(&req);
+  ulfius_init_response(&resp);
+  ulfius_set_request_properties(&req,
+                                U_OPT_HTTP_VERB, "POST",
+                                U_OPT_HTTP_URL, SERVER_URI "/" PLUGIN_NAME "/token",
+                                U_OPT_AUTH_BASIC_USER, CLIENT_ID,
+                                U_OPT_AUTH_BASIC_PASSWORD, CLIENT_SECRET,
+                                U_OPT_POST_BODY_PARAMETER, "grant_type", grant_type,
+                                U_OPT_POST_BODY_PARAMETER, "client_id", CLIENT_ID,
+                                U_OPT_POST_BODY_PARAMETER, "redirect_uri", CLIENT_REDIRECT_URI,
+                                U_OPT_POST_BODY_PARAMETER, parameter_name, parameter_value,
+                                U_OPT_NONE);
+  if (ulfius_send_http_request(&req, &resp) == U_OK && resp.status == 200) {
+    j_body = ulfius_get_json_body_response(&resp, NULL);
+  }
+  ulfius_clean_response(&resp);
+  ulfius_clean_request(&req);
+  return j_body;
+}
+
+static int revoke_access_token(const char * token) {
+  struct _u_map param;
+  int ret;
+
+  u_map_init(&param);
+  u_map_put(&param, "token", token);
+  u_map_put(&param, "token_type_hint", TOKEN_TYPE_HINT_ACCESS);
+  ret = run_simple_test(NULL, "POST", SERVER_URI "/" PLUGIN_NAME "/revoke", CLIENT_ID, CLIENT_SECRET, NULL, &param, 200, NULL, NULL, NULL);
+  u_map_clean(&param);
+  return ret;
+}
+
+START_TEST(test_oidc_stateless_add_plugin)
+{
+  json_t * j_parameters = json_pack("{sssssssos{sssssssssisisisosososososososo}}",
+                                "module", PLUGIN_MODULE,
+                                "name", PLUGIN_NAME,
+                                "display_name", PLUGIN_NAME,
+                                "enabled", json_true(),
+                                "parameters",
+                                  "iss", PLUGIN_ISS,
+                                  "jwt-type", PLUGIN_JWT_TYPE,
+                                  "jwt-key-size", PLUGIN_JWT_KEY_SIZE,
+                                  "key", PLUGIN_KEY,
+                                  "code-duration", PLUGIN_CODE_DURATION,
+                                  "refresh-token-duration", PLUGIN_REFRESH_TOKEN_DURATION,
+                                  "access-token-duration", PLUGIN_ACCESS_TOKEN_DURATION,
+                                  "access-token-stateless", json_true(),
+                                  "allow-non-oidc", json_true(),
+                                  "auth-type-code-enabled", json_true(),
+                                  "auth-type-code-revoke-replayed", json_true(),
+                                  "auth-type-password-enabled", json_true(),
+                                  "auth-type-refresh-enabled", json_true(),
+                                  "introspection-revocation-allowed", json_true(),
+                                  "introspection-revocation-allow-target-client", json_true());
+
+  ck_assert_int_eq(run_simple_test(&admin_req, "POST", SERVER_URI "/mod/plugin/", NULL, NULL, j_parameters, NULL, 200, NULL, NULL, NULL), 1);
+  json_decref(j_parameters);
+}
+END_TEST
+
+START_TEST(test_oidc_stateless_delete_plugin)
+{
+  ck_assert_int_eq(run_simple_test(&admin_req, "DELETE", SERVER_URI "/mod/plugin/" PLUGIN_NAME, NULL, NULL, NULL, NULL, 200, NULL, NULL, NULL), 1);
+}
+END_TEST
+
+START_TEST(test_oidc_stateless_revoke_access_token)
+{
+  struct _u_map param;
+  char * token;
+
+  ck_assert_ptr_ne(token = get_access_token_password(), NULL);
+  ck_assert_int_eq(introspect_access_token(token, json_true()), 1);
+  ck_assert_int_eq(userinfo_access_token(token, 200), 1);
+
+  ck_assert_int_eq(u_map_init(&param), U_OK);
+  ck_assert_int_eq(u_map_put(&param, "token", token), U_OK);
+  ck_assert_int_eq(u_map_put(&param, "token_type_hint", TOKEN_TYPE_HINT_ACCESS), U_OK);
+  ck_assert_int_eq(run_simple_test(NULL, "POST", SERVER_URI "/" PLUGIN_NAME "/revoke", CLIENT_ID, CLIENT_SECRET, NULL, &param, 200, NULL, NULL, NULL), 1);
+  u_map_clean(&param);
+
+  ck_assert_int_eq(introspect_access_token(token, json_false()), 1);
+  ck_assert_int_eq(userinfo_access_token(token, 401), 1);
+  o_free(token);
+}
+END_TEST
+
+START_TEST(test_oidc_stateless_revoked_list_bloom_filter)
+{
+  struct _u_map param;
+  char * token[NB_TOKENS];
+  int i;
+
+  for (i=0; i<NB_TOKENS; i++) {
+    ck_assert_ptr_ne(token[i] = get_access_token_password(), NULL);
+  }
+
+  // Revoke one token out of two, the others must not be reported as revoked by the bloom filter
+  for (i=0; i<NB_TOKENS; i+=2) {
+    ck_assert_int_eq(u_map_init(&param), U_OK);
+    ck_assert_int_eq(u_map_put(&param, "token", token[i]), U_OK);
+    ck_assert_int_eq(u_map_put(&param, "token_type_hint", TOKEN_TYPE_HINT_ACCESS), U_OK);
+    ck_assert_int_eq(run_simple_test(NULL, "POST", SERVER_URI "/" PLUGIN_NAME "/revoke", CLIENT_ID, CLIENT_SECRET, NULL, &param, 200, NULL, NULL, NULL), 1);
+    u_map_clean(&param);
+  }
+
+  for (i=0; i<NB_TOKENS; i++) {
+    ck_assert_int_eq(introspect_access_token(token[i], (i%2)?json_true():json_false()), 1);
+    ck_assert_int_eq(userinfo_access_token(token[i], (i%2)?200:401), 1);
+    o_free(token[i]);
+  }
+}
+END_TEST
+
+START_TEST(test_oidc_stateless_code_replay_revoke_access_tokens)
+{
+  struct _u_request req;
+  struct _u_response resp;
+  char * code;
+  const char * refresh_token, * access_token, * access_token_refreshed;
+  json_t * j_body_code, * j_body_refresh;
+
+  ck_assert_int_eq(ulfius_init_request(&req), U_OK);
+  ck_assert_int_eq(ulfius_init_response(&resp), U_OK);
+  ck_assert_int_eq(ulfius_copy_request(&req, &user_req), U_OK);
+  ck_assert_int_eq(ulfius_set_request_properties(&req,
+      U_OPT_HTTP_VERB, "GET",
+      U_OPT_HTTP_URL, SERVER_URI "/" PLUGIN_NAME "/auth?response_type=code&nonce=nonce1234&client_id=" CLIENT_ID "&redirect_uri=" CLIENT_REDIRECT_URI_ENCODED "&scope=" SCOPE_LIST "&g_continue",
+      U_OPT_NONE), U_OK);
+  ck_assert_int_eq(ulfius_send_http_request(&req, &resp), U_OK);
+  ck_assert_int_eq(resp.status, 302);
+  ck_assert_ptr_ne(o_strstr(u_map_get(resp.map_header, "Location"), "code="), NULL);
+  code = o_strdup(o_strstr(u_map_get(resp.map_header, "Location"), "code=")+strlen("code="));
+  ck_assert_ptr_ne(NULL, code);
+  if (strchr(code, '&') != NULL) {
+    *strchr(code, '&') = '\0';
+  }
+  ulfius_clean_request(&req);
+  ulfius_clean_response(&resp);
+
+  ck_assert_int_eq(ulfius_init_request(&req), U_OK);
+  ck_assert_int_eq(ulfius_init_response(&resp), U_OK);
+  ck_assert_int_eq(ulfius_set_request_properties(&req,
+      U_OPT_HTTP_VERB, "POST",
+      U_OPT_HTTP_URL, SERVER_URI "/" PLUGIN_NAME "/token",
+      U_OPT_AUTH_BASIC_USER, CLIENT_ID,
+      U_OPT_AUTH_BASIC_PASSWORD, CLIENT_SECRET,
+      U_OPT_POST_BODY_PARAMETER, "grant_type", "authorization_code",
+      U_OPT_POST_BODY_PARAMETER, "client_id", CLIENT_ID,
+      U_OPT_POST_BODY_PARAMETER, "redirect_uri", CLIENT_REDIRECT_URI,
+      U_OPT_POST_BODY_PARAMETER, "code", code,
+      U_OPT_NONE), U_OK);
+  ck_assert_int_eq(ulfius_send_http_request(&req, &resp), U_OK);
+  ck_assert_int_eq(resp.status, 200);
+  ck_assert_ptr_ne(j_body_code = ulfius_get_json_body_response(&resp, NULL), NULL);
+  ck_assert_ptr_ne(refresh_token = json_string_value(json_object_get(j_body_code, "refresh_token")), NULL);
+  ck_assert_ptr_ne(access_token = json_string_value(json_object_get(j_body_code, "access_token")), NULL);
+  ulfius_clean_request(&req);
+  ulfius_clean_response(&resp);
+
+  ck_assert_int_eq(ulfius_init_request(&req), U_OK);
+  ck_assert_int_eq(ulfius_init_response(&resp), U_OK);
+  ck_assert_int_eq(ulfius_set_request_properties(&req,
+      U_OPT_HTTP_VERB, "POST",
+      U_OPT_HTTP_URL, SERVER_URI "/" PLUGIN_NAME "/token",
+      U_OPT_AUTH_BASIC_USER, CLIENT_ID,
+      U_OPT_AUTH_BASIC_PASSWORD, CLIENT_SECRET,
+      U_OPT_POST_BODY_PARAMETER, "grant_type", "refresh_token",
+      U_OPT_POST_BODY_PARAMETER, "client_id", CLIENT_ID,
+      U_OPT_POST_BODY_PARAMETER, "refresh_token", refresh_token,
+      U_OPT_NONE), U_OK);
+  ck_assert_int_eq(ulfius_send_http_request(&req, &resp), U_OK);
+  ck_assert_int_eq(resp.status, 200);
+  ck_assert_ptr_ne(j_body_refresh = ulfius_get_json_body_response(&resp, NULL), NULL);
+  ck_assert_ptr_ne(access_token_refreshed = json_string_value(json_object_get(j_body_refresh, "access_token")), NULL);
+  ulfius_clean_request(&req);
+  ulfius_clean_response(&resp);
+
+  ck_assert_int_eq(introspect_access_token(access_token, json_true()), 1);
+  ck_assert_int_eq(introspect_access_token(access_token_refreshed, json_true()), 1);
+
+  // Replaying the code revokes the stateless access tokens issued from it
+  ck_assert_int_eq(ulfius_init_request(&req), U_OK);
+  ck_assert_int_eq(ulfius_init_response(&resp), U_OK);
+  ck_assert_int_eq(ulfius_set_request_properties(&req,
+      U_OPT_HTTP_VERB, "POST",
+      U_OPT_HTTP_URL, SERVER_URI "/" PLUGIN_NAME "/token",
+      U_OPT_AUTH_BASIC_USER, CLIENT_ID,
+      U_OPT_AUTH_BASIC_PASSWORD, CLIENT_SECRET,
+      U_OPT_POST_BODY_PARAMETER, "grant_type", "authorization_code",
+      U_OPT_POST_BODY_PARAMETER, "client_id", CLIENT_ID,
+      U_OPT_POST_BODY_PARAMETER, "redirect_uri", CLIENT_REDIRECT_URI,
+      U_OPT_POST_BODY_PARAMETER, "code", code,
+      U_OPT_NONE), U_OK);
+  ck_assert_int_eq(ulfius_send_http_request(&req, &resp), U_OK);
+  ck_assert_int_eq(resp.status, 403);
+  ulfius_clean_request(&req);
+  ulfius_clean_response(&resp);
+
+  ck_assert_int_eq(introspect_access_token(access_token, json_false()), 1);
+  ck_assert_int_eq(introspect_access_token(access_token_refreshed, json_false()), 1);
+  ck_assert_int_eq(userinfo_access_token(access_token, 401), 1);
+  ck_assert_int_eq(userinfo_access_token(access_token_refreshed, 401), 1);
+
+  json_decref(j_body_refresh);
+  json_decref(j_body_code);
+  o_free(code);
+}
+END_TEST
+
+START_TEST(test_oidc_stateless_grants_no_access_token_stored)
+{
+  char * code, * token_password;
+  json_t * j_body_code, * j_body_refresh;
+  json_int_t nb_rows;
+
+  ck_assert_int_ge(nb_rows = count_access_token_rows(), 0);
+
+  ck_assert_ptr_ne(token_password = get_access_token_password(), NULL);
+  ck_assert_ptr_ne(code = get_code(), NULL);
+  ck_assert_ptr_ne(j_body_code = get_tokens("authorization_code", "code", code), NULL);
+  ck_assert_ptr_ne(json_object_get(j_body_code, "access_token"), NULL);
+  ck_assert_ptr_ne(j_body_refresh = get_tokens("refresh_token", "refresh_token", json_string_value(json_object_get(j_body_code, "refresh_token"))), NULL);
+  ck_assert_ptr_ne(json_object_get(j_body_refresh, "access_token"), NULL);
+
+  // The password, code and refresh grants don't store the stateless access tokens
+  ck_assert_int_eq(count_access_token_rows(), nb_rows);
+
+  json_decref(j_body_refresh);
+  json_decref(j_body_code);
+  o_free(code);
+  o_free(token_password);
+}
+END_TEST
+
+START_TEST(test_oidc_stateless_revoked_list_sync_error)
+{
+  char * token_revoked, * token_valid;
+
+  ck_assert_ptr_ne(token_revoked = get_access_token_password(), NULL);
+  ck_assert_ptr_ne(token_valid = get_access_token_password(), NULL);
+  ck_assert_int_eq(revoke_access_token(token_revoked), 1);
+
+  // Make the next syncs of the revoked list fail
+  ck_assert_int_eq(rename_table(TABLE_ACCESS_TOKEN_REVOKED, TABLE_ACCESS_TOKEN_REVOKED_RENAMED), H_OK);
+  sleep(REVOKED_JTI_SYNC_INTERVAL+2);
+
+  // The revoked list loaded before the errors is still used and a valid token isn't reported as revoked
+  ck_assert_int_eq(introspect_access_token(token_revoked, json_false()), 1);
+  ck_assert_int_eq(userinfo_access_token(token_revoked, 401), 1);
+  ck_assert_int_eq(introspect_access_token(token_valid, json_true()), 1);
+  ck_assert_int_eq(userinfo_access_token(token_valid, 200), 1);
+
+  ck_assert_int_eq(rename_table(TABLE_ACCESS_TOKEN_REVOKED_RENAMED, TABLE_ACCESS_TOKEN_REVOKED), H_OK);
+
+  o_free(token_revoked);
+  o_free(token_valid);
+}
+END_TEST
+
+static Suite *glewlwyd_suite(void)
+{
+  Suite *s;
+  TCase *tc_core;
+
+  s = suite_create("Glewlwyd oidc stateless access token");
+  tc_core = tcase_create("test_oidc_access_token_stateless");
+  tcase_add_test(tc_core, test_oidc_stateless_add_plugin);
+  tcase_add_test(tc_core, test_oidc_stateless_revoke_access_token);
+  tcase_add_test(tc_core, test_oidc_stateless_revoked_list_bloom_filter);
+  tcase_add_test(tc_core, test_oidc_stateless_code_replay_revoke_access_tokens);
+  if (conn != NULL) {
+    tcase_add_test(tc_core, test_oidc_stateless_grants_no_access_token_stored);
+    tcase_add_test(tc_core, test_oidc_stateless_revoked_list_sync_error);
+  } else {
+    y_log_message(Y_LOG_LEVEL_WARNING, "Database not available, skip the database tests");
+  }
+  tcase_add_test(tc_core, test_oidc_stateless_delete_plugin);
+  tcase_set_timeout(tc_core, 60);
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
+
+int main(int argc, char *argv[])
+{
+  int number_failed = 0;
+  Suite *s;
+  SRunner *sr;
+  struct _u_request auth_req;
+  struct _u_response auth_resp;
+  int res, do_test = 0;
+  json_t * j_body;
+  char * cookie;
+
+  y_init_logs("Glewlwyd test", Y_LOG_MODE_CONSOLE, Y_LOG_LEVEL_DEBUG, NULL, "Starting Glewlwyd test");
+
+  // The database tests need the SQLite database of the Glewlwyd test instance, given as first argument
+  if ((conn = h_connect_sqlite(argc>1?argv[1]:DEFAULT_DB_PATH)) != NULL && count_access_token_rows() < 0) {
+    h_close_db(conn);
+    h_clean_connection(conn);
+    conn = NULL;
+  }
+
+  ulfius_init_request(&admin_req);
+  ulfius_init_request(&user_req);
+
+  // Getting a valid session id for authenticated http requests
+  ulfius_init_request(&auth_req);
+  ulfius_init_response(&auth_resp);
+  auth_req.http_verb = strdup("POST");
+  auth_req.http_url = msprintf("%s/auth/", SERVER_URI);
+  j_body = json_pack("{ssss}", "username", ADMIN_USERNAME, "password", ADMIN_PASSWORD);
+  ulfius_set_json_body_request(&auth_req, j_body);
+  json_decref(j_body);
+  res = ulfius_send_http_request(&auth_req, &auth_resp);
+  if (res == U_OK && auth_resp.status == 200) {
+    if (auth_resp.nb_cookies) {
+      y_log_message(Y_LOG_LEVEL_DEBUG, "Admin %s authenticated", ADMIN_USERNAME);
+      cookie = msprintf("%s=%s", auth_resp.map_cookie[0].key, auth_resp.map_cookie[0].value);
+      u_map_put(admin_req.map_header, "Cookie", cookie);
+      o_free(cookie);
+      do_test = 1;
+    }
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "Error authentication admin");
+  }
+  ulfius_clean_response(&auth_resp);
+  ulfius_clean_request(&auth_req);
+
+  if (do_test) {
+    // Getting a valid session id for authenticated http requests
+    ulfius_init_request(&auth_req);
+    ulfius_init_response(&auth_resp);
+    auth_req.http_verb = strdup("POST");
+    auth_req.http_url = msprintf("%s/auth/", SERVER_URI);
+    j_body = json_pack("{ssss}", "username", USERNAME, "password", PASSWORD);
+    ulfius_set_json_body_request(&auth_req, j_body);
+    json_decref(j_body);
+    res = ulfius_send_http_request(&auth_req, &auth_resp);
+    if (res == U_OK && auth_resp.status == 200) {
+      if (auth_resp.nb_cookies) {
+        y_log_message(Y_LOG_LEVEL_DEBUG, "User %s authenticated", USERNAME);
+        cookie = msprintf("%s=%s", auth_resp.map_cookie[0].key, auth_resp.map_cookie[0].value);
+        u_map_put(user_req.map_header, "Cookie", cookie);
+        o_free(cookie);
+      } else {
+        do_test = 0;
+      }
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "Error authentication user");
+      do_test = 0;
+    }
+    ulfius_clean_response(&auth_resp);
+    ulfius_clean_request(&auth_req);
+  }
+
+  if (do_test) {
+    s = glewlwyd_suite();
+    sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_VERBOSE);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+  }
+
+  run_simple_test(&user_req, "DELETE", SERVER_URI "/auth/", NULL, NULL, NULL, NULL, 200, NULL, NULL, NULL);
+
+  ulfius_clean_request(&admin_req);
+  ulfius_clean_request(&user_req);
+  if (conn != NULL) {
+    h_close_db(conn);
+    h_clean_connection(conn);
+  }
+  y_close_logs();
+
+  return (do_test && number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
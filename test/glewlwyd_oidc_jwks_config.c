@@ -1169,6 +1169,68 @@ START_TEST(test_oidc_jwks_client_cred_valid_sign_kid_invalid)
 }
 END_TEST
 
+/**
+ * Sets the sign_kid of the client CLIENT_ID, the other properties are the ones of test_oidc_jwks_add_client_sign_kid
+ */
+static void set_client_sign_kid(const char * kid) {
+  json_t * j_client = json_pack("{ss ss ss so s[s] s[sssss] s[s] ss ss ss ss ss ss ss ss ss so}", "client_id", CLIENT_ID, "client_secret", CLIENT_SECRET, "name", CLIENT_NAME, "confidential", json_true(), "redirect_uri", CLIENT_REDIRECT, "authorization_type", "code", "token", "id_token", "password", "client_credentials", "scope", CLIENT_SCOPE, "sign_kid", kid, "pubkey", pubkey_1_pem, "enc", CLIENT_ENC, "alg", CLIENT_PUBKEY_ALG, "encrypt_code", "1", "encrypt_at", "nay", "encrypt_userinfo", "Hell no", "encrypt_id_token", "nope", "encrypt_refresh_token", "absolutely not!", "enabled", json_true());
+  ck_assert_int_eq(run_simple_test(&admin_req, "PUT", SERVER_URI "/client/" CLIENT_ID, NULL, NULL, j_client, NULL, 200, NULL, NULL, NULL), 1);
+  json_decref(j_client);
+}
+
+START_TEST(test_oidc_jwks_sign_kid_changed_invalid)
+{
+  struct _u_response resp;
+  struct _u_request req;
+  char * access_token, * bearer;
+  jwt_t * jwt;
+
+  // The access token is signed with the client kid
+  ulfius_init_response(&resp);
+  o_free(user_req.http_url);
+  user_req.http_url = msprintf("%s/%s/auth?response_type=token&g_continue&client_id=%s&redirect_uri=%s&nonce=nonce1234&scope=%s", SERVER_URI, PLUGIN_NAME, CLIENT_ID, CLIENT_REDIRECT, SCOPE_LIST);
+  o_free(user_req.http_verb);
+  user_req.http_verb = o_strdup("GET");
+  ck_assert_int_eq(ulfius_send_http_request(&user_req, &resp), U_OK);
+  ck_assert_int_eq(resp.status, 302);
+  ck_assert_ptr_ne(o_strstr(u_map_get(resp.map_header, "Location"), "access_token="), NULL);
+  access_token = o_strdup(o_strstr(u_map_get(resp.map_header, "Location"), "access_token=") + o_strlen("access_token="));
+  if (o_strchr(access_token, '&')) {
+    *(o_strchr(access_token, '&')) = '\0';
+  }
+  ulfius_clean_response(&resp);
+  ck_assert_int_eq(r_jwt_init(&jwt), RHN_OK);
+  ck_assert_int_eq(r_jwt_parse(jwt, access_token, 0), RHN_OK);
+  ck_assert_str_eq(KID_2, r_jwt_get_header_str_value(jwt, "kid"));
+  r_jwt_free(jwt);
+
+  // The client kid isn't in the private keys anymore, the JWT responses aren't signed with another key
+  set_client_sign_kid("error");
+  ulfius_init_request(&req);
+  bearer = msprintf("Bearer %s", access_token);
+  u_map_put(req.map_header, "Authorization", bearer);
+  ck_assert_int_eq(run_simple_test(&req, "GET", SERVER_URI "/" PLUGIN_NAME "/userinfo/", NULL, NULL, NULL, NULL, 200, NULL, NULL, NULL), 1);
+  u_map_put(req.map_header, "Accept", "application/jwt");
+  ck_assert_int_eq(run_simple_test(&req, "GET", SERVER_URI "/" PLUGIN_NAME "/userinfo/", NULL, NULL, NULL, NULL, 500, NULL, NULL, NULL), 1);
+
+  ck_assert_int_eq(ulfius_init_response(&resp), U_OK);
+  o_free(user_req.http_url);
+  user_req.http_url = msprintf("%s/%s/auth?response_type=token&g_continue&client_id=%s&redirect_uri=%s&nonce=nonce1234&scope=%s", SERVER_URI, PLUGIN_NAME, CLIENT_ID, CLIENT_REDIRECT, SCOPE_LIST);
+  ck_assert_int_eq(ulfius_send_http_request(&user_req, &resp), U_OK);
+  ck_assert_int_eq(resp.status, 302);
+  ck_assert_ptr_eq(o_strstr(u_map_get(resp.map_header, "Location"), "access_token="), NULL);
+  ck_assert_ptr_ne(o_strstr(u_map_get(resp.map_header, "Location"), "server_error"), NULL);
+  ulfius_clean_response(&resp);
+
+  set_client_sign_kid(KID_2);
+  ck_assert_int_eq(run_simple_test(&req, "GET", SERVER_URI "/" PLUGIN_NAME "/userinfo/", NULL, NULL, NULL, NULL, 200, NULL, NULL, NULL), 1);
+
+  ulfius_clean_request(&req);
+  o_free(access_token);
+  o_free(bearer);
+}
+END_TEST
+
 START_TEST(test_oidc_jwks_implicit_id_token_valid_no_sign_kid)
 {
   struct _u_response resp;
@@ -1533,6 +1595,7 @@ static Suite *glewlwyd_suite(void)
   tcase_add_test(tc_core, test_oidc_jwks_implicit_id_token_valid_sign_kid);
   tcase_add_test(tc_core, test_oidc_jwks_userinfo_jwt_sign_kid);
   tcase_add_test(tc_core, test_oidc_jwks_client_cred_valid_sign_kid);
+  tcase_add_test(tc_core, test_oidc_jwks_sign_kid_changed_invalid);
   tcase_add_test(tc_core, test_oidc_jwks_request_token_jwt_nested_rsa_kid_1_ok);
   tcase_add_test(tc_core, test_oidc_jwks_request_token_jwt_nested_rsa_kid_2_ok);
   tcase_add_test(tc_core, test_oidc_jwks_request_token_jwt_nested_rsa_no_kid_ok);
@@ -0,0 +1,197 @@
+/* Public domain, no copyright. Use at your own risk. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <check.h>
+#include <ulfius.h>
+#include <orcania.h>
+#include <yder.h>
+
+#include "unit-tests.h"
+
+#define SERVER_URI "http://localhost:4593/api"
+#define ADMIN_USERNAME "admin"
+#define ADMIN_PASSWORD "password"
+#define USER_USERNAME "long_scope_user"
+#define USER_PASSWORD "password"
+
+// 12 scopes of 110 bytes make a scope list longer than 1024 bytes, the default group_concat_max_len on MariaDB
+#define NB_SCOPES 12
+#define SCOPE_PADDING_LENGTH 96
+
+struct _u_request admin_req;
+char * scope_name[NB_SCOPES];
+char * scope_list = NULL;
+
+START_TEST(test_oidc_refresh_token_long_scope_add)
+{
+  json_t * j_parameters, * j_scope = json_array();
+  int i;
+
+  for (i=0; i<NB_SCOPES; i++) {
+    j_parameters = json_pack("{sssssssb}", "name", scope_name[i], "display_name", scope_name[i], "description", "Long scope", "password_required", 0);
+    ck_assert_int_eq(run_simple_test(&admin_req, "POST", SERVER_URI "/scope/", NULL, NULL, j_parameters, NULL, 200, NULL, NULL, NULL), 1);
+    json_decref(j_parameters);
+    json_array_append_new(j_scope, json_string(scope_name[i]));
+  }
+
+  j_parameters = json_pack("{sssosOss}", "username", USER_USERNAME, "enabled", json_true(), "scope", j_scope, "password", USER_PASSWORD);
+  ck_assert_int_eq(run_simple_test(&admin_req, "POST", SERVER_URI "/user/", NULL, NULL, j_parameters, NULL, 200, NULL, NULL, NULL), 1);
+  json_decref(j_parameters);
+  json_decref(j_scope);
+}
+END_TEST
+
+START_TEST(test_oidc_refresh_token_long_scope_delete)
+{
+  char * url;
+  int i;
+
+  ck_assert_int_eq(run_simple_test(&admin_req, "DELETE", SERVER_URI "/user/" USER_USERNAME, NULL, NULL, NULL, NULL, 200, NULL, NULL, NULL), 1);
+  for (i=0; i<NB_SCOPES; i++) {
+    url = msprintf(SERVER_URI "/scope/%s", scope_name[i]);
+    ck_assert_int_eq(run_simple_test(&admin_req, "DELETE", url, NULL, NULL, NULL, NULL, 200, NULL, NULL, NULL), 1);
+    o_free(url);
+  }
+}
+END_TEST
+
+START_TEST(test_oidc_refresh_token_long_scope_refresh)
+{
+  struct _u_request req;
+  struct _u_response resp;
+  json_t * j_body;
+  char * refresh_token, ** scope_array = NULL;
+  int i;
+
+  ck_assert_int_gt(o_strlen(scope_list), 1024);
+
+  ulfius_init_request(&req);
+  ulfius_init_response(&resp);
+  ck_assert_int_eq(ulfius_set_request_properties(&req,
+                                                 U_OPT_HTTP_VERB, "POST",
+                                                 U_OPT_HTTP_URL, SERVER_URI "/oidc/token/",
+                                                 U_OPT_POST_BODY_PARAMETER, "grant_type", "password",
+                                                 U_OPT_POST_BODY_PARAMETER, "username", USER_USERNAME,
+                                                 U_OPT_POST_BODY_PARAMETER, "password", USER_PASSWORD,
+                                                 U_OPT_POST_BODY_PARAMETER, "scope", scope_list,
+                                                 U_OPT_NONE), U_OK);
+  ck_assert_int_eq(ulfius_send_http_request(&req, &resp), U_OK);
+  ck_assert_int_eq(resp.status, 200);
+  ck_assert_ptr_ne(j_body = ulfius_get_json_body_response(&resp, NULL), NULL);
+  ck_assert_ptr_ne(refresh_token = o_strdup(json_string_value(json_object_get(j_body, "refresh_token"))), NULL);
+  json_decref(j_body);
+  ulfius_clean_request(&req);
+  ulfius_clean_response(&resp);
+
+  // The scope list of the refresh token must be complete
+  ulfius_init_request(&req);
+  ulfius_init_response(&resp);
+  ck_assert_int_eq(ulfius_set_request_properties(&req,
+                                                 U_OPT_HTTP_VERB, "POST",
+                                                 U_OPT_HTTP_URL, SERVER_URI "/oidc/token/",
+                                                 U_OPT_POST_BODY_PARAMETER, "grant_type", "refresh_token",
+                                                 U_OPT_POST_BODY_PARAMETER, "refresh_token", refresh_token,
+                                                 U_OPT_NONE), U_OK);
+  ck_assert_int_eq(ulfius_send_http_request(&req, &resp), U_OK);
+  ck_assert_int_eq(resp.status, 200);
+  ck_assert_ptr_ne(j_body = ulfius_get_json_body_response(&resp, NULL), NULL);
+  ck_assert_int_eq(json_string_length(json_object_get(j_body, "scope")), o_strlen(scope_list));
+  ck_assert_int_eq(split_string(json_string_value(json_object_get(j_body, "scope")), " ", &scope_array), NB_SCOPES);
+  for (i=0; i<NB_SCOPES; i++) {
+    ck_assert_int_eq(string_array_has_value((const char **)scope_array, scope_name[i]), 1);
+  }
+  free_string_array(scope_array);
+  json_decref(j_body);
+  ulfius_clean_request(&req);
+  ulfius_clean_response(&resp);
+  o_free(refresh_token);
+}
+END_TEST
+
+static Suite *glewlwyd_suite(void)
+{
+  Suite *s;
+  TCase *tc_core;
+
+  s = suite_create("Glewlwyd oidc refresh token long scope list");
+  tc_core = tcase_create("test_oidc_refresh_token_long_scope");
+  tcase_add_test(tc_core, test_oidc_refresh_token_long_scope_add);
+  tcase_add_test(tc_core, test_oidc_refresh_token_long_scope_refresh);
+  tcase_add_test(tc_core, test_oidc_refresh_token_long_scope_delete);
+  tcase_set_timeout(tc_core, 30);
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
+
+int main(int argc, char *argv[])
+{
+  int number_failed = 0;
+  Suite *s;
+  SRunner *sr;
+  struct _u_request auth_req;
+  struct _u_response auth_resp;
+  int res, do_test = 0, i;
+  json_t * j_body;
+  char * cookie, padding[SCOPE_PADDING_LENGTH+1];
+
+  y_init_logs("Glewlwyd test", Y_LOG_MODE_CONSOLE, Y_LOG_LEVEL_DEBUG, NULL, "Starting Glewlwyd test");
+
+  memset(padding, 'x', SCOPE_PADDING_LENGTH);
+  padding[SCOPE_PADDING_LENGTH] = '\0';
+  for (i=0; i<NB_SCOPES; i++) {
+    scope_name[i] = msprintf("long_scope_%02d_%s", i, padding);
+    if (scope_list == NULL) {
+      scope_list = o_strdup(scope_name[i]);
+    } else {
+      scope_list = mstrcatf(scope_list, " %s", scope_name[i]);
+    }
+  }
+
+  // Getting a valid session id for authenticated http requests
+  ulfius_init_request(&auth_req);
+  ulfius_init_request(&admin_req);
+  ulfius_init_response(&auth_resp);
+  auth_req.http_verb = strdup("POST");
+  auth_req.http_url = msprintf("%s/auth/", SERVER_URI);
+  j_body = json_pack("{ssss}", "username", ADMIN_USERNAME, "password", ADMIN_PASSWORD);
+  ulfius_set_json_body_request(&auth_req, j_body);
+  json_decref(j_body);
+  res = ulfius_send_http_request(&auth_req, &auth_resp);
+  if (res == U_OK && auth_resp.status == 200) {
+    if (auth_resp.nb_cookies) {
+      y_log_message(Y_LOG_LEVEL_DEBUG, "Admin %s authenticated", ADMIN_USERNAME);
+      cookie = msprintf("%s=%s", auth_resp.map_cookie[0].key, auth_resp.map_cookie[0].value);
+      u_map_put(admin_req.map_header, "Cookie", cookie);
+      o_free(cookie);
+      do_test = 1;
+    }
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "Error authentication admin");
+  }
+  ulfius_clean_response(&auth_resp);
+  ulfius_clean_request(&auth_req);
+
+  if (do_test) {
+    s = glewlwyd_suite();
+    sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_VERBOSE);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+  }
+
+  ulfius_clean_request(&admin_req);
+  for (i=0; i<NB_SCOPES; i++) {
+    o_free(scope_name[i]);
+  }
+  o_free(scope_list);
+  y_close_logs();
+
+  return (do_test && number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -56,10 +56,22 @@
 #define CLIENT_SCOPE "scope1"
 #define KID_PUB "pubkey"
 
+#define CLIENT_JWKS_CACHE_ID "client_jwks_cache"
+#define CLIENT_JWKS_STALE_ID "client_jwks_stale"
+#define JWKS_CACHE_ETAG "\"jwks-cache-etag\""
+#define JWKS_CACHE_MAX_AGE 60
+#define KID_UNKNOWN "unknown"
+
 struct _u_request admin_req;
 struct _u_request user_req;
 char * code;
 
+struct _jwks_cache_server {
+  unsigned int nb_requests;
+  unsigned int nb_not_modified;
+  unsigned int status;
+};
+
 const char pubkey_1_jwk[] = "{\"keys\":[{\"kty\":\"RSA\",\"n\":\"AMWhdXoJpkPtPwABHL_yXUwgcYuwNOVbw70YGmMzhFqiRd6r92-onw-BOAvfnIq-rSMgjidllxOE1fXwlgUIyKJmnHUI3RMDABFmGFRM-Dz6VmQxHgiioLM-Q5yzcj85zIqJvNrw0RL0qhvssQBG5Fta_jLXBUXeGEmciWA0lSfrdlS-zbfxsWqPzAvKyT_0B80m1o8K7ksFtyTPu-cHbCVGx4ciGeZUNrtOnevGQPUOE-tIvsxOPcqC3fPjyI3K4TN5GCCZHEyso1qmRFfsHtenq6EvD1_2DebcODnfnym-iNFyC4YsgqipToNxR3WPIgCu-WrSOk71-93ovs0hd1MhBYw03J4Xupjxy_URCFZm9Pp-9H3j_0hUKmhUWmpsQTpAT7FWvTT-MyyYkZ-9Y33-6KR3E-82kdfXIoEMbGJnfq2Z4Yh_lF3pfD-5FUzOzgnOy0UiTxusWOBbaVhNqmm6xmlHwQjBrax9Bqo7WzQpwXgXgooo6TeVz6pxpUl6V63d5o5XZaxYYilUpZ78qXpHQMwNFr6a2gct-dU8zLF6YaJHIaMp6XT9OD8r-w7SOkq1O7J-UGRqGbUVczYzhApY1Q-B2ZnO18P5KQnG97AbU_Sjk5Rnf6HJ-w-E8NOIwgo5jzloV_5Ck6w-DH_sL5FDca89BGuzwpQEH_h3ma43\",\"e\":\"AQAB\",\"kid\":\"" KID_PUB "\"}]}";
 const char privkey_1_jwk[] = "{\"kty\":\"RSA\",\"n\":\"AMWhdXoJpkPtPwABHL_yXUwgcYuwNOVbw70YGmMzhFqiRd6r92-onw-BOAvfnIq-rSMgjidllxOE1fXwlgUIyKJmnHUI3RMDABFmGFRM-Dz6VmQxHgiioLM-Q5yzcj85zIqJvNrw0RL0qhvssQBG5Fta_jLXBUXeGEmciWA0lSfrdlS-zbfxsWqPzAvKyT_0B80m1o8K7ksFtyTPu-cHbCVGx4ciGeZUNrtOnevGQPUOE-tIvsxOPcqC3fPjyI3K4TN5GCCZHEyso1qmRFfsHtenq6EvD1_2DebcODnfnym-iNFyC4YsgqipToNxR3WPIgCu-WrSOk71-93ovs0hd1MhBYw03J4Xupjxy_URCFZm9Pp-9H3j_0hUKmhUWmpsQTpAT7FWvTT-MyyYkZ-9Y33-6KR3E-82kdfXIoEMbGJnfq2Z4Yh_lF3pfD-5FUzOzgnOy0UiTxusWOBbaVhNqmm6xmlHwQjBrax9Bqo7WzQpwXgXgooo6TeVz6pxpUl6V63d5o5XZaxYYilUpZ78qXpHQMwNFr6a2gct-dU8zLF6YaJHIaMp6XT9OD8r-w7SOkq1O7J-UGRqGbUVczYzhApY1Q-B2ZnO18P5KQnG97AbU_Sjk5Rnf6HJ-w-E8NOIwgo5jzloV_5Ck6w-DH_sL5FDca89BGuzwpQEH_h3ma43\",\"e\":\"AQAB\",\"d\":\"AIiu6F7k-ZcVKHNKUaX3a8tQzPb9gTf3xWKsnuNpJ-q_PG-Ko_EXwBqrFiYwG0ZiJcCbrXVV76zSPGCCal9E-e5H5YGUBcI2Wv-tiroTGcSipslYpxr1zwrozz47ZZKQ2QQfyvvpfdAMYvI5Oxmj7h-4yQJEcCMoPcf7eY-ODnKziP2HkSPdBwVaOpcVQyb2EcczS0VXHAPLCiVtftmD6qnFUA4H6b3BFLFq6BG-5gIWIHSjtUH8AwRiijs5mOVoIWTGJYe2HTpyU_BH-hCM_6_LCQrLT2jg9jBqsoBkRuJKIroolAvSEPOxVNnXqMKHoc6zNVFJ4IXn3rBVXlDlCm69xoe67-X2M4o8LXpdnwFtvao3YYKqAqv1kH0JZE9kJyY3odhXa-SRZpvOCoE3YpDr5UTlRkEWZATQjqtGP7JEq_RQwtDwM1NpANIl4cFAJVhUJbndjMeJqBcA4-NEV6bBjWkenw179H6UuWNXNzXklPsgtMnF_PwcBFKutwnFqHAE5g6w9iHQ5yG7_2m4zModfBiGiSy3cdQ2f3MEHRRoBmqooEGU_6Urrn6iyAFxk_sINEnT_7Emygle_QwP5N-BQuFpD_NWojGirWwOwiWYBHRBXP0ub17bNx7w4gha6CxHnXyJ0MZBayOIMrnQGeWC7o5a932LCTQfegdBh5xh\",\"p\":\"APQQSKxv01Oky-jENQwxiZcpI4a5PzLPFFCgEqIjSRamCzrCQ07e97iqhU1b8IvRwxDtX358pFKAq7tmwpN2QQb1T9fqUwCpeQuMwRsZwoaM7ZcTSj2FZ_2djN1ixQfzqQ21VxkMRbrdyExqCSJXnHMcLeiFmu81dVopV2iwDbUQv4jZe_ktPUTH4HKle48Y0v9pu22lD5cknAQGB1gUNfyJ0PbUxZMITrZDz4khhYgxqvJ7GluYRNv2tezV-bb5leXbSLDrRgTKqcl5ZjkgLm9FRNGZZAmlsCHEeB3nvCs2ePQYDuLgEkNtuu39kpLFJO6j70bjnvpaIAcDVpPmEE8\",\"q\":\"AM9L09Grg2uSrNUGfj9pfpsMn0k5kqV0n3WjX9z5ZLkwLNNrs0SJjb93haO2MPNlyYhctCpPKnfHJKZWaLhFDV6xr-ubf7c3DbBJjPhlV8dUkgmHfIqWDPl6pzN0xC61zC4IE15LgW_JEMpq53fRWnIHdufs-105QO8YOo0CVYKYjqut4hVbYRBSTaeVLb1vj_yhaL0qV7orQoTrpr6Bg20nftBBa-8Md_B5l0QyiSfvOjKnXsjULQdQGbtypQZvu2jUasnUVUQHBgeF5W5WFj8qCGGnmehqY6QissipLoRMcGPaV_gJKisgcorF7sSU_QzcBUmPk377LkzZXGNUYZk\",\"qi\":\"AILHVNisODhO4GC8P709DqGdVdufLZf2Bl7AwjWyYTkpEzEfQCHHUnmOoTCn-OEvnn9lWiaCaTijtlUmos0fCfvSQLk9elciIOmlRk8G1EtnnzYQsTmerLoMJBgQ02hhip8GK47Y7mbZIjaPB625Dv8F4RHd9ZiTzXTGcNc6bldWlNNbbqw9DWS1DORPhdQEPU424qcYvHq_eklFCujWukO8ul3FEZYnTcth2ODSFMb0a0SCuDGkGI8BDI-_4n6-4wIlAXtc8Vt9Ko8WxJjCK_v2Ae9x05eknWZj0JxuyoAjPtJApp0pt25omJwZr_lY5i8T0cL6dDF5nZcA9hN__eo\",\"dp\":\"ALL4hfI9BmCdxhFoX-YTJWw9dJnEmf1uMN12pHNVILGFDVMHRUg-5LT8BkhWFSzSoxJ0nsQoLm95f3Uqw6BS5RhvJx-T603e-K5phumSmD0GduuD77rxavJlZ_ioBwfvu5Yb1kS95RxEqi6uywft6wHWNiv-XUDwmJ-HFVvlTgfqwileIjT04argT0yC4PpsH73AEPs0QRx6chXZPeVu3K_Vd_Co0kEhpGavjy5l8H-QvGSXtRpZrJUIcxu7RSTSHQOzK7jgrjWxT5Q4e6eEW8ioqPByZRNV9rSsV9DGMAwYI9YLFk90NLBRdPQ0MBmEi7KbcEkxfVDkafv6jLBj0q0\",\"dq\":\"AJldyYY7dczVxMcKucbinwfJq-N6E_QTt5JKYDdV0F5utQtqiEQx3MyGejooJkk9yn_3zlfrIElj7cqe7XU_qWeg4L3Y2wHLWnZNxF1WZT4VZMJmGg9SeqDtTNz2C9tfJ4P695FxHX99681GkKAGJPtuaFuo6kQLgu4iJ9eBnZA0nIGJ8VXJuKNhsRBGf4PDEW1gYeRqemNDdEBxNHmHypusd9dOP7OpruccnnyXQwBnrtAhIjBFQldBvPgBFvUPH0GsvqE6VicxZxWTy635RRZQW8kcPfNFGxkpjsqE2OSKxTArL6BT733e0L-5NzD75cho1ASblA2DerriqcbXfCk\",\"kid\":\"" KID_PUB "\"}";
 const char pubkey_1_pem[] = "-----BEGIN PUBLIC KEY-----\n"\
@@ -223,6 +235,69 @@ int callback_jwks_ok (const struct _u_request * request, struct _u_response * re
   return U_CALLBACK_CONTINUE;
 }
 
+/**
+ * Counts the JWKS downloads, returns 304 if the JWKS isn't modified, or the error status set in user_data
+ */
+static int callback_jwks_cache (const struct _u_request * request, struct _u_response * response, void * user_data) {
+  struct _jwks_cache_server * server = (struct _jwks_cache_server *)user_data;
+  json_t * j_jwks;
+  char * cache_control = msprintf("max-age=%d", JWKS_CACHE_MAX_AGE);
+
+  server->nb_requests++;
+  if (server->status != 200) {
+    response->status = server->status;
+  } else if (0 == o_strcmp(JWKS_CACHE_ETAG, u_map_get_case(request->map_header, "If-None-Match"))) {
+    server->nb_not_modified++;
+    response->status = 304;
+  } else {
+    j_jwks = json_loads(pubkey_1_jwk, JSON_DECODE_ANY, NULL);
+    ulfius_set_json_body_response(response, 200, j_jwks);
+    json_decref(j_jwks);
+    u_map_put(response->map_header, "ETag", JWKS_CACHE_ETAG);
+  }
+  u_map_put(response->map_header, "Cache-Control", cache_control);
+  o_free(cache_control);
+  return U_CALLBACK_COMPLETE;
+}
+
+/**
+ * Requests a client_credentials token with a client_assertion signed with the key of pubkey_1_jwk and the kid specified
+ */
+static int jwks_cache_request_token(const char * client_id, const char * kid, int status) {
+  jwt_t * jwt_request = NULL;
+  const char * aud = SERVER_URI "/" PLUGIN_NAME "/token";
+  char * request;
+  int rnd, ret;
+  char jti[12] = {0};
+  struct _u_map body;
+
+  gnutls_rnd(GNUTLS_RND_NONCE, &rnd, sizeof(int));
+  snprintf(jti, 11, "jti_%06d", rnd);
+  r_jwt_init(&jwt_request);
+  r_jwt_set_sign_alg(jwt_request, R_JWA_ALG_RS256);
+  r_jwt_add_sign_keys_json_str(jwt_request, privkey_1_jwk, NULL);
+  r_jwt_set_claim_str_value(jwt_request, "iss", client_id);
+  r_jwt_set_claim_str_value(jwt_request, "sub", client_id);
+  r_jwt_set_claim_str_value(jwt_request, "aud", aud);
+  r_jwt_set_claim_str_value(jwt_request, "jti", jti);
+  r_jwt_set_claim_int_value(jwt_request, "exp", time(NULL)+(CLIENT_AUTH_TOKEN_MAX_AGE/2));
+  r_jwt_set_claim_int_value(jwt_request, "iat", time(NULL));
+  r_jwt_set_header_str_value(jwt_request, "kid", kid);
+  request = r_jwt_serialize_signed(jwt_request, NULL, 0);
+
+  u_map_init(&body);
+  u_map_put(&body, "grant_type", "client_credentials");
+  u_map_put(&body, "scope", CLIENT_SCOPE);
+  u_map_put(&body, "client_assertion", request);
+  u_map_put(&body, "client_assertion_type", "urn:ietf:params:oauth:client-assertion-type:jwt-bearer");
+  ret = run_simple_test(&user_req, "POST", aud, NULL, NULL, NULL, &body, status, NULL, NULL, NULL);
+
+  u_map_clean(&body);
+  o_free(request);
+  r_jwt_free(jwt_request);
+  return ret;
+}
+
 START_TEST(test_oidc_request_jwt_redirect_login)
 {
   jwt_t * jwt_request = NULL;
@@ -2750,10 +2825,112 @@ START_TEST(test_oidc_request_uri_ietf_jwt_response_invalid_typ)
 }
 END_TEST
 
+START_TEST(test_oidc_request_jwt_add_client_jwks_cache)
+{
+  json_t * j_client = json_pack("{ss ss ss so s[s] s[s] s[s] ss so}", "client_id", CLIENT_JWKS_CACHE_ID, "secret", CLIENT_SECRET, "name", CLIENT_PUBKEY_NAME, "confidential", json_true(), "redirect_uri", CLIENT_PUBKEY_REDIRECT, "authorization_type", "client_credentials", "scope", CLIENT_SCOPE, "jwks_uri", "http://localhost:7462/jwks_cache", "enabled", json_true());
+  ck_assert_int_eq(run_simple_test(&admin_req, "POST", SERVER_URI "/client/", NULL, NULL, j_client, NULL, 200, NULL, NULL, NULL), 1);
+  json_decref(j_client);
+
+  j_client = json_pack("{ss ss ss so s[s] s[s] s[s] ss so}", "client_id", CLIENT_JWKS_STALE_ID, "secret", CLIENT_SECRET, "name", CLIENT_PUBKEY_NAME, "confidential", json_true(), "redirect_uri", CLIENT_PUBKEY_REDIRECT, "authorization_type", "client_credentials", "scope", CLIENT_SCOPE, "jwks_uri", "http://localhost:7462/jwks_stale", "enabled", json_true());
+  ck_assert_int_eq(run_simple_test(&admin_req, "POST", SERVER_URI "/client/", NULL, NULL, j_client, NULL, 200, NULL, NULL, NULL), 1);
+  json_decref(j_client);
+}
+END_TEST
+
+START_TEST(test_oidc_request_jwt_delete_client_jwks_cache)
+{
+  ck_assert_int_eq(run_simple_test(&admin_req, "DELETE", SERVER_URI "/client/" CLIENT_JWKS_CACHE_ID, NULL, NULL, NULL, NULL, 200, NULL, NULL, NULL), 1);
+  ck_assert_int_eq(run_simple_test(&admin_req, "DELETE", SERVER_URI "/client/" CLIENT_JWKS_STALE_ID, NULL, NULL, NULL, NULL, 200, NULL, NULL, NULL), 1);
+}
+END_TEST
+
+START_TEST(test_oidc_request_jwt_jwks_cache_hit)
+{
+  struct _u_instance instance;
+  struct _jwks_cache_server cache_server = {0, 0, 200}, stale_server = {0, 0, 200};
+
+  ck_assert_int_eq(ulfius_init_instance(&instance, 7462, NULL, NULL), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&instance, "GET", "/jwks_cache", NULL, 0, &callback_jwks_cache, &cache_server), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&instance, "GET", "/jwks_stale", NULL, 0, &callback_jwks_cache, &stale_server), U_OK);
+  ck_assert_int_eq(ulfius_start_framework(&instance), U_OK);
+
+  // The JWKS is downloaded once, then taken from the cache
+  ck_assert_int_eq(jwks_cache_request_token(CLIENT_JWKS_CACHE_ID, KID_PUB, 200), 1);
+  ck_assert_int_eq(jwks_cache_request_token(CLIENT_JWKS_CACHE_ID, KID_PUB, 200), 1);
+  ck_assert_int_eq(cache_server.nb_requests, 1);
+
+  // A kid missing in the JWKS just downloaded doesn't download it again
+  ck_assert_int_eq(jwks_cache_request_token(CLIENT_JWKS_CACHE_ID, KID_UNKNOWN, 403), 1);
+  ck_assert_int_eq(jwks_cache_request_token(CLIENT_JWKS_CACHE_ID, KID_UNKNOWN, 403), 1);
+  ck_assert_int_eq(cache_server.nb_requests, 1);
+
+  ck_assert_int_eq(jwks_cache_request_token(CLIENT_JWKS_STALE_ID, KID_PUB, 200), 1);
+  ck_assert_int_eq(stale_server.nb_requests, 1);
+
+  ulfius_stop_framework(&instance);
+  ulfius_clean_instance(&instance);
+}
+END_TEST
+
+START_TEST(test_oidc_request_jwt_jwks_cache_refresh)
+{
+  struct _u_instance instance;
+  struct _jwks_cache_server cache_server = {0, 0, 200}, stale_server = {0, 0, 500};
+  int i;
+
+  // Wait until the cached JWKS must be refreshed, before it expires
+  // and after the delay to download it again if a kid is missing
+  sleep((JWKS_CACHE_MAX_AGE*3)/4+1);
+
+  ck_assert_int_eq(ulfius_init_instance(&instance, 7462, NULL, NULL), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&instance, "GET", "/jwks_cache", NULL, 0, &callback_jwks_cache, &cache_server), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&instance, "GET", "/jwks_stale", NULL, 0, &callback_jwks_cache, &stale_server), U_OK);
+  ck_assert_int_eq(ulfius_start_framework(&instance), U_OK);
+
+  // A kid missing in the cached JWKS downloads it again with its ETag, the server answers 304
+  ck_assert_int_eq(jwks_cache_request_token(CLIENT_JWKS_CACHE_ID, KID_UNKNOWN, 403), 1);
+  ck_assert_int_eq(cache_server.nb_requests, 1);
+  ck_assert_int_eq(cache_server.nb_not_modified, 1);
+  ck_assert_int_eq(jwks_cache_request_token(CLIENT_JWKS_CACHE_ID, KID_PUB, 200), 1);
+  ck_assert_int_eq(cache_server.nb_requests, 1);
+
+  // The cached JWKS is used while it's downloaded again in background, the download fails
+  ck_assert_int_eq(jwks_cache_request_token(CLIENT_JWKS_STALE_ID, KID_PUB, 200), 1);
+  for (i=0; i<10 && !stale_server.nb_requests; i++) {
+    sleep(1);
+  }
+  ck_assert_int_eq(stale_server.nb_requests, 1);
+
+  ulfius_stop_framework(&instance);
+  ulfius_clean_instance(&instance);
+}
+END_TEST
+
+START_TEST(test_oidc_request_jwt_jwks_cache_stale)
+{
+  struct _u_instance instance;
+  struct _jwks_cache_server stale_server = {0, 0, 500};
+
+  // Wait until the cached JWKS has expired
+  sleep(JWKS_CACHE_MAX_AGE/4+1);
+
+  ck_assert_int_eq(ulfius_init_instance(&instance, 7462, NULL, NULL), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&instance, "GET", "/jwks_stale", NULL, 0, &callback_jwks_cache, &stale_server), U_OK);
+  ck_assert_int_eq(ulfius_start_framework(&instance), U_OK);
+
+  // The download fails, the expired JWKS is used
+  ck_assert_int_eq(jwks_cache_request_token(CLIENT_JWKS_STALE_ID, KID_PUB, 200), 1);
+  ck_assert_int_eq(stale_server.nb_requests, 1);
+
+  ulfius_stop_framework(&instance);
+  ulfius_clean_instance(&instance);
+}
+END_TEST
+
 static Suite *glewlwyd_suite(void)
 {
   Suite *s;
-  TCase *tc_core;
+  TCase *tc_core, *tc_jwks_cache;
 
   s = suite_create("Glewlwyd oidc request_jwt");
   tc_core = tcase_create("test_oidc_request_jwt");
@@ -2869,6 +3046,17 @@ static Suite *glewlwyd_suite(void)
   tcase_set_timeout(tc_core, 30);
   suite_add_tcase(s, tc_core);
 
+  tc_jwks_cache = tcase_create("test_oidc_request_jwt_jwks_cache");
+  tcase_add_test(tc_jwks_cache, test_oidc_request_jwt_add_module_request_signed);
+  tcase_add_test(tc_jwks_cache, test_oidc_request_jwt_add_client_jwks_cache);
+  tcase_add_test(tc_jwks_cache, test_oidc_request_jwt_jwks_cache_hit);
+  tcase_add_test(tc_jwks_cache, test_oidc_request_jwt_jwks_cache_refresh);
+  tcase_add_test(tc_jwks_cache, test_oidc_request_jwt_jwks_cache_stale);
+  tcase_add_test(tc_jwks_cache, test_oidc_request_jwt_delete_client_jwks_cache);
+  tcase_add_test(tc_jwks_cache, test_oidc_request_jwt_delete_module_request_signed);
+  tcase_set_timeout(tc_jwks_cache, 90);
+  suite_add_tcase(s, tc_jwks_cache);
+
   return s;
 }
 
@@ -0,0 +1,279 @@
+/* Public domain, no copyright. Use at your own risk. */
+
+/**
+ * Tests the verified access tokens cache of the OIDC resource check without a Glewlwyd instance,
+ * docs/resources/ulfius/oidc_resource.c is built with this file and verifies tokens signed with a symmetric key
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <check.h>
+#include <ulfius.h>
+#include <orcania.h>
+#include <yder.h>
+#include <rhonabwy.h>
+
+#include "../docs/resources/ulfius/oidc_resource.h"
+
+#define SECRET "my-super-secret-key-for-the-cache-tests"
+#define SECRET_INVALID "another-secret-key-for-the-cache-tests"
+#define USERNAME "user1"
+#define SCOPE "scope1"
+#define CACHE_SIZE 64
+
+struct _oidc_resource_config config = OIDC_RESOURCE_CONFIG_INIT;
+unsigned int nb_hit, nb_miss, revoked;
+
+static void cache_metrics(void * cls, unsigned short hit) {
+  if (hit) {
+    nb_hit++;
+  } else {
+    nb_miss++;
+  }
+}
+
+static int is_revoked(void * cls, json_t * j_access_token) {
+  return revoked;
+}
+
+/**
+ * Returns an access token signed with secret that expires in duration seconds
+ */
+static char * get_access_token(const char * secret, time_t duration, const char * jti) {
+  jwt_t * jwt;
+  jwk_t * jwk;
+  json_t * j_claims;
+  char * token;
+  time_t now;
+
+  time(&now);
+  j_claims = json_pack("{sssssssssIsI}", "sub", USERNAME, "type", "access_token", "scope", SCOPE, "jti", jti, "iat", (json_int_t)now, "exp", (json_int_t)(now+duration));
+  ck_assert_int_eq(r_jwt_init(&jwt), RHN_OK);
+  ck_assert_int_eq(r_jwk_init(&jwk), RHN_OK);
+  ck_assert_int_eq(r_jwk_import_from_symmetric_key(jwk, (const unsigned char *)secret, o_strlen(secret)), RHN_OK);
+  ck_assert_int_eq(r_jwt_set_sign_alg(jwt, R_JWA_ALG_HS256), RHN_OK);
+  ck_assert_int_eq(r_jwt_set_full_claims_json_t(jwt, j_claims), RHN_OK);
+  ck_assert_ptr_ne(token = r_jwt_serialize_signed(jwt, jwk, 0), NULL);
+  json_decref(j_claims);
+  r_jwk_free(jwk);
+  r_jwt_free(jwt);
+  return token;
+}
+
+static void resource_cache_init(size_t size) {
+  nb_hit = nb_miss = revoked = 0;
+  config.method = G_METHOD_HEADER;
+  config.oauth_scope = SCOPE;
+  config.alg = R_JWA_ALG_HS256;
+  config.accept_access_token = 1;
+  config.callback_is_revoked = &is_revoked;
+  ck_assert_int_eq(r_jwt_init(&config.jwt), RHN_OK);
+  ck_assert_int_eq(r_jwk_init(&config.jwk_verify_default), RHN_OK);
+  ck_assert_int_eq(r_jwk_import_from_symmetric_key(config.jwk_verify_default, (const unsigned char *)SECRET, o_strlen(SECRET)), RHN_OK);
+  ck_assert_int_eq(oidc_resource_cache_init(&config, size, &cache_metrics, NULL), G_TOKEN_OK);
+}
+
+static void resource_cache_clean(void) {
+  oidc_resource_cache_close(&config);
+  ck_assert_ptr_eq(config.cache, NULL);
+  r_jwt_free(config.jwt);
+  r_jwk_free(config.jwk_verify_default);
+  config.jwt = NULL;
+  config.jwk_verify_default = NULL;
+}
+
+/**
+ * Runs the resource callback with the access token in the header Authorization
+ */
+static int resource_check(const char * token) {
+  struct _u_request request;
+  struct _u_response response;
+  char * bearer = msprintf(HEADER_PREFIX_BEARER "%s", token);
+  int res;
+
+  ulfius_init_request(&request);
+  ulfius_init_response(&response);
+  u_map_put(request.map_header, HEADER_AUTHORIZATION, bearer);
+  res = callback_check_glewlwyd_oidc_access_token(&request, &response, &config);
+  ulfius_clean_request(&request);
+  ulfius_clean_response(&response);
+  o_free(bearer);
+  return res;
+}
+
+static int verify_access_token(const char * token) {
+  json_t * j_result = oidc_resource_verify_access_token(&config, token);
+  int res = json_integer_value(json_object_get(j_result, "result"));
+
+  json_decref(j_result);
+  return res;
+}
+
+START_TEST(test_glwd_oidc_resource_cache_init)
+{
+  struct _oidc_resource_config config_zero;
+
+  // The initializer leaves the optional fields disabled
+  ck_assert_ptr_eq(config.cache, NULL);
+  ck_assert_ptr_eq(config.callback_is_revoked, NULL);
+  ck_assert_ptr_eq(config.callback_is_revoked_cls, NULL);
+
+  // A size of 0 disables the cache
+  memset(&config_zero, 0, sizeof(struct _oidc_resource_config));
+  ck_assert_int_eq(oidc_resource_cache_init(&config_zero, 0, NULL, NULL), G_TOKEN_OK);
+  ck_assert_ptr_eq(config_zero.cache, NULL);
+  oidc_resource_cache_close(&config_zero);
+  ck_assert_int_eq(oidc_resource_cache_init(NULL, CACHE_SIZE, NULL, NULL), G_TOKEN_ERROR_INVALID_REQUEST);
+}
+END_TEST
+
+START_TEST(test_glwd_oidc_resource_cache_hit)
+{
+  char * token, * token_2, * token_invalid;
+
+  resource_cache_init(CACHE_SIZE);
+  token = get_access_token(SECRET, 3600, "jti1");
+  token_2 = get_access_token(SECRET, 3600, "jti2");
+  token_invalid = get_access_token(SECRET_INVALID, 3600, "jti3");
+
+  ck_assert_int_eq(verify_access_token(token), G_TOKEN_OK);
+  ck_assert_int_eq(nb_miss, 1);
+  ck_assert_int_eq(nb_hit, 0);
+  ck_assert_int_eq(verify_access_token(token), G_TOKEN_OK);
+  ck_assert_int_eq(resource_check(token), U_CALLBACK_CONTINUE);
+  ck_assert_int_eq(nb_miss, 1);
+  ck_assert_int_eq(nb_hit, 2);
+
+  // Another token isn't served from the cache
+  ck_assert_int_eq(resource_check(token_2), U_CALLBACK_CONTINUE);
+  ck_assert_int_eq(nb_miss, 2);
+
+  // A token with an invalid signature isn't cached
+  ck_assert_int_eq(verify_access_token(token_invalid), G_TOKEN_ERROR_INVALID_TOKEN);
+  ck_assert_int_eq(verify_access_token(token_invalid), G_TOKEN_ERROR_INVALID_TOKEN);
+  ck_assert_int_eq(resource_check(token_invalid), U_CALLBACK_UNAUTHORIZED);
+  ck_assert_int_eq(nb_miss, 5);
+  ck_assert_int_eq(nb_hit, 2);
+
+  o_free(token);
+  o_free(token_2);
+  o_free(token_invalid);
+  resource_cache_clean();
+}
+END_TEST
+
+START_TEST(test_glwd_oidc_resource_cache_expired)
+{
+  char * token, * token_expired;
+
+  resource_cache_init(CACHE_SIZE);
+  token = get_access_token(SECRET, 2, "jti1");
+  token_expired = get_access_token(SECRET, -10, "jti2");
+
+  ck_assert_int_eq(resource_check(token), U_CALLBACK_CONTINUE);
+  ck_assert_int_eq(resource_check(token), U_CALLBACK_CONTINUE);
+  ck_assert_int_eq(nb_hit, 1);
+
+  // The token is removed from the cache when it expires
+  sleep(3);
+  ck_assert_int_eq(resource_check(token), U_CALLBACK_UNAUTHORIZED);
+  ck_assert_int_eq(nb_hit, 1);
+  ck_assert_int_eq(nb_miss, 2);
+
+  // An expired token isn't cached
+  ck_assert_int_eq(resource_check(token_expired), U_CALLBACK_UNAUTHORIZED);
+  ck_assert_int_eq(resource_check(token_expired), U_CALLBACK_UNAUTHORIZED);
+  ck_assert_int_eq(nb_hit, 1);
+  ck_assert_int_eq(nb_miss, 4);
+
+  o_free(token);
+  o_free(token_expired);
+  resource_cache_clean();
+}
+END_TEST
+
+START_TEST(test_glwd_oidc_resource_cache_revoked)
+{
+  char * token;
+
+  resource_cache_init(CACHE_SIZE);
+  token = get_access_token(SECRET, 3600, "jti1");
+
+  ck_assert_int_eq(resource_check(token), U_CALLBACK_CONTINUE);
+  ck_assert_int_eq(resource_check(token), U_CALLBACK_CONTINUE);
+  ck_assert_int_eq(nb_hit, 1);
+
+  // The revocation is checked on cache hit
+  revoked = 1;
+  ck_assert_int_eq(resource_check(token), U_CALLBACK_UNAUTHORIZED);
+  ck_assert_int_eq(nb_hit, 2);
+  revoked = 0;
+  ck_assert_int_eq(resource_check(token), U_CALLBACK_CONTINUE);
+
+  o_free(token);
+  resource_cache_clean();
+}
+END_TEST
+
+START_TEST(test_glwd_oidc_resource_cache_disabled)
+{
+  char * token;
+
+  resource_cache_init(0);
+  token = get_access_token(SECRET, 3600, "jti1");
+
+  ck_assert_int_eq(resource_check(token), U_CALLBACK_CONTINUE);
+  ck_assert_int_eq(resource_check(token), U_CALLBACK_CONTINUE);
+  revoked = 1;
+  ck_assert_int_eq(resource_check(token), U_CALLBACK_UNAUTHORIZED);
+  ck_assert_int_eq(nb_hit, 0);
+  ck_assert_int_eq(nb_miss, 0);
+
+  o_free(token);
+  resource_cache_clean();
+}
+END_TEST
+
+static Suite *glewlwyd_suite(void)
+{
+  Suite *s;
+  TCase *tc_core;
+
+  s = suite_create("Glewlwyd OIDC resource cache");
+  tc_core = tcase_create("test_glwd_oidc_resource_cache");
+  tcase_add_test(tc_core, test_glwd_oidc_resource_cache_init);
+  tcase_add_test(tc_core, test_glwd_oidc_resource_cache_hit);
+  tcase_add_test(tc_core, test_glwd_oidc_resource_cache_expired);
+  tcase_add_test(tc_core, test_glwd_oidc_resource_cache_revoked);
+  tcase_add_test(tc_core, test_glwd_oidc_resource_cache_disabled);
+  tcase_set_timeout(tc_core, 30);
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
+
+int main(int argc, char *argv[])
+{
+  int number_failed;
+  Suite *s;
+  SRunner *sr;
+
+  y_init_logs("Glewlwyd test", Y_LOG_MODE_CONSOLE, Y_LOG_LEVEL_DEBUG, NULL, "Starting Glewlwyd test");
+
+  s = glewlwyd_suite();
+  sr = srunner_create(s);
+
+  srunner_run_all(sr, CK_VERBOSE);
+  number_failed = srunner_ntests_failed(sr);
+  srunner_free(sr);
+
+  y_close_logs();
+
+  return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
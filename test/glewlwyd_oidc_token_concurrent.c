@@ -0,0 +1,171 @@
+/* Public domain, no copyright. Use at your own risk. */
+
+/**
+ * Requests tokens with the password grant from concurrent threads,
+ * then refreshes each refresh token and checks that its scope list read from the database
+ * is the scope list of the token issued, so the scope rows are stored with the right token id
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <check.h>
+#include <ulfius.h>
+#include <orcania.h>
+#include <yder.h>
+
+#include "unit-tests.h"
+
+#define SERVER_URI "http://localhost:4593/api/oidc"
+#define USERNAME "user1"
+#define PASSWORD "password"
+
+// The test instance has 2 password workers and a queue of 2 password checks, so no check is rejected
+#define NB_THREADS 4
+#define NB_REQUESTS 10
+
+static const char * scope_lists[] = {"g_profile", "g_profile scope3", "g_profile openid", "scope3 openid"};
+
+struct _token_worker {
+  pthread_t    thread;
+  const char * scope;
+  json_t     * j_refresh_tokens;
+  size_t       nb_error;
+};
+
+/**
+ * Returns true if both scope lists have the same scopes, in any order
+ */
+static int scope_list_equals(const char * scope_1, const char * scope_2) {
+  char ** scope_array_1 = NULL, ** scope_array_2 = NULL;
+  size_t i;
+  int ret = 0;
+
+  if (split_string(scope_1, " ", &scope_array_1) && split_string(scope_2, " ", &scope_array_2) && string_array_size(scope_array_1) == string_array_size(scope_array_2)) {
+    ret = 1;
+    for (i=0; scope_array_1[i]!=NULL; i++) {
+      if (!string_array_has_value((const char **)scope_array_2, scope_array_1[i])) {
+        ret = 0;
+      }
+    }
+  }
+  free_string_array(scope_array_1);
+  free_string_array(scope_array_2);
+  return ret;
+}
+
+static json_t * token_request(const char * grant_type, const char * name, const char * value) {
+  struct _u_request req;
+  struct _u_response resp;
+  json_t * j_body = NULL;
+
+  ulfius_init_request(&req);
+  ulfius_init_response(&resp);
+  ulfius_set_request_properties(&req, U_OPT_HTTP_VERB, "POST", U_OPT_HTTP_URL, SERVER_URI "/token/", U_OPT_POST_BODY_PARAMETER, "grant_type", grant_type, U_OPT_NONE);
+  if (0 == o_strcmp(grant_type, "password")) {
+    ulfius_set_request_properties(&req, U_OPT_POST_BODY_PARAMETER, "username", USERNAME, U_OPT_POST_BODY_PARAMETER, "password", PASSWORD, U_OPT_POST_BODY_PARAMETER, "scope", value, U_OPT_NONE);
+  } else {
+    ulfius_set_request_properties(&req, U_OPT_POST_BODY_PARAMETER, name, value, U_OPT_NONE);
+  }
+  if (ulfius_send_http_request(&req, &resp) == U_OK && resp.status == 200) {
+    j_body = ulfius_get_json_body_response(&resp, NULL);
+  }
+  ulfius_clean_request(&req);
+  ulfius_clean_response(&resp);
+  return j_body;
+}
+
+static void * token_worker_run(void * args) {
+  struct _token_worker * worker = (struct _token_worker *)args;
+  json_t * j_token, * j_refresh;
+  size_t i;
+
+  for (i=0; i<NB_REQUESTS; i++) {
+    if ((j_token = token_request("password", NULL, worker->scope)) != NULL && json_string_length(json_object_get(j_token, "refresh_token"))) {
+      json_array_append(worker->j_refresh_tokens, json_object_get(j_token, "refresh_token"));
+      // The refresh token scope list is read from the scope rows stored with the refresh token
+      if ((j_refresh = token_request("refresh_token", "refresh_token", json_string_value(json_object_get(j_token, "refresh_token")))) != NULL) {
+        if (!json_string_length(json_object_get(j_refresh, "access_token")) ||
+            json_equal(json_object_get(j_refresh, "access_token"), json_object_get(j_token, "access_token")) ||
+            !scope_list_equals(json_string_value(json_object_get(j_refresh, "scope")), json_string_value(json_object_get(j_token, "scope")))) {
+          worker->nb_error++;
+        }
+      } else {
+        worker->nb_error++;
+      }
+      json_decref(j_refresh);
+    } else {
+      worker->nb_error++;
+    }
+    json_decref(j_token);
+  }
+  return NULL;
+}
+
+START_TEST(test_oidc_token_concurrent_password)
+{
+  struct _token_worker workers[NB_THREADS];
+  json_t * j_refresh_tokens = json_object(), * j_element = NULL;
+  size_t index = 0;
+  int i;
+
+  for (i=0; i<NB_THREADS; i++) {
+    workers[i].scope = scope_lists[i%4];
+    workers[i].j_refresh_tokens = json_array();
+    workers[i].nb_error = 0;
+    ck_assert_int_eq(pthread_create(&workers[i].thread, NULL, token_worker_run, &workers[i]), 0);
+  }
+  for (i=0; i<NB_THREADS; i++) {
+    pthread_join(workers[i].thread, NULL);
+  }
+  for (i=0; i<NB_THREADS; i++) {
+    ck_assert_int_eq(workers[i].nb_error, 0);
+    ck_assert_int_eq(json_array_size(workers[i].j_refresh_tokens), NB_REQUESTS);
+    json_array_foreach(workers[i].j_refresh_tokens, index, j_element) {
+      json_object_set(j_refresh_tokens, json_string_value(j_element), json_true());
+    }
+    json_decref(workers[i].j_refresh_tokens);
+  }
+  // Every refresh token issued is different
+  ck_assert_int_eq(json_object_size(j_refresh_tokens), NB_THREADS*NB_REQUESTS);
+  json_decref(j_refresh_tokens);
+}
+END_TEST
+
+static Suite *glewlwyd_suite(void)
+{
+  Suite *s;
+  TCase *tc_core;
+
+  s = suite_create("Glewlwyd oidc token concurrent");
+  tc_core = tcase_create("test_oidc_token_concurrent");
+  tcase_add_test(tc_core, test_oidc_token_concurrent_password);
+  tcase_set_timeout(tc_core, 30);
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
+
+int main(int argc, char *argv[])
+{
+  int number_failed;
+  Suite *s;
+  SRunner *sr;
+
+  y_init_logs("Glewlwyd test", Y_LOG_MODE_CONSOLE, Y_LOG_LEVEL_DEBUG, NULL, "Starting Glewlwyd test");
+
+  s = glewlwyd_suite();
+  sr = srunner_create(s);
+
+  srunner_run_all(sr, CK_VERBOSE);
+  number_failed = srunner_ntests_failed(sr);
+  srunner_free(sr);
+
+  y_close_logs();
+
+  return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -44,6 +44,7 @@
 #define TOKEN_TYPE_HINT_REFRESH "refresh_token"
 #define TOKEN_TYPE_HINT_ACCESS "access_token"
 #define TOKEN_TYPE_HINT_ID_TOKEN "id_token"
+#define PLUGIN_INTROSPECTION_BATCH_MAX_TOKENS 4
 
 struct _u_request admin_req;
 
@@ -134,6 +135,36 @@ START_TEST(test_oidc_introspection_plugin_add_target_client_check_expiration)
 }
 END_TEST
 
+START_TEST(test_oidc_introspection_plugin_add_target_client_batch)
+{
+  json_t * j_parameters = json_pack("{sssssssos{sssssssssisisisososososososososi}}",
+                                "module", PLUGIN_MODULE,
+                                "name", PLUGIN_NAME,
+                                "display_name", PLUGIN_DISPLAY_NAME,
+                                "enabled", json_true(),
+                                "parameters",
+                                  "iss", PLUGIN_ISS,
+                                  "jwt-type", PLUGIN_JWT_TYPE,
+                                  "jwt-key-size", PLUGIN_JWT_KEY_SIZE,
+                                  "key", PLUGIN_KEY,
+                                  "code-duration", PLUGIN_CODE_DURATION,
+                                  "refresh-token-duration", PLUGIN_REFRESH_TOKEN_DURATION,
+                                  "access-token-duration", PLUGIN_ACCESS_TOKEN_DURATION,
+                                  "allow-non-oidc", json_true(),
+                                  "auth-type-client-enabled", json_true(),
+                                  "auth-type-code-enabled", json_true(),
+                                  "auth-type-implicit-enabled", json_true(),
+                                  "auth-type-password-enabled", json_true(),
+                                  "auth-type-refresh-enabled", json_true(),
+                                  "introspection-revocation-allowed", json_true(),
+                                  "introspection-revocation-allow-target-client", json_true(),
+                                  "introspection-batch-max-tokens", PLUGIN_INTROSPECTION_BATCH_MAX_TOKENS);
+
+  ck_assert_int_eq(run_simple_test(&admin_req, "POST", SERVER_URI "/mod/plugin/", NULL, NULL, j_parameters, NULL, 200, NULL, NULL, NULL), 1);
+  json_decref(j_parameters);
+}
+END_TEST
+
 START_TEST(test_oidc_introspection_plugin_remove)
 {
   ck_assert_int_eq(run_simple_test(&admin_req, "DELETE", SERVER_URI "/mod/plugin/" PLUGIN_NAME, NULL, NULL, NULL, NULL, 200, NULL, NULL, NULL), 1);
@@ -895,6 +926,118 @@ START_TEST(test_oidc_introspection_id_token)
 }
 END_TEST
 
+START_TEST(test_oidc_introspection_batch_mixed_target_client)
+{
+  struct _u_request req;
+  struct _u_response resp;
+  json_t * j_body, * j_response;
+  char * tokens;
+  struct _u_map param;
+  
+  ulfius_init_request(&req);
+  ulfius_init_response(&resp);
+  req.http_verb = o_strdup("POST");
+  req.http_url = o_strdup(SERVER_URI "/" PLUGIN_NAME "/token");
+  u_map_put(req.map_post_body, "grant_type", "password");
+  u_map_put(req.map_post_body, "scope", SCOPE_LIST);
+  u_map_put(req.map_post_body, "username", USERNAME);
+  u_map_put(req.map_post_body, "password", PASSWORD);
+  req.auth_basic_user = o_strdup(CLIENT_CONFIDENTIAL_1);
+  req.auth_basic_password = o_strdup(CLIENT_CONFIDENTIAL_1_SECRET);
+  ck_assert_int_eq(ulfius_send_http_request(&req, &resp), U_OK);
+  ck_assert_int_eq(resp.status, 200);
+  j_body = ulfius_get_json_body_response(&resp, NULL);
+  ck_assert_ptr_ne(json_object_get(j_body, "access_token"), NULL);
+  ck_assert_ptr_ne(json_object_get(j_body, "refresh_token"), NULL);
+  ulfius_clean_response(&resp);
+  ulfius_clean_request(&req);
+  
+  // The tokens are returned in the same order, an invalid token is inactive
+  tokens = msprintf("%s %s error %s", json_string_value(json_object_get(j_body, "access_token")), json_string_value(json_object_get(j_body, "refresh_token")), json_string_value(json_object_get(j_body, "access_token")));
+  ck_assert_int_eq(u_map_init(&param), U_OK);
+  ck_assert_int_eq(u_map_put(&param, "tokens", tokens), U_OK);
+  ulfius_init_request(&req);
+  ulfius_init_response(&resp);
+  req.http_verb = o_strdup("POST");
+  req.http_url = o_strdup(SERVER_URI "/" PLUGIN_NAME "/introspect/batch/");
+  req.auth_basic_user = o_strdup(CLIENT_CONFIDENTIAL_1);
+  req.auth_basic_password = o_strdup(CLIENT_CONFIDENTIAL_1_SECRET);
+  u_map_copy_into(req.map_post_body, &param);
+  ck_assert_int_eq(ulfius_send_http_request(&req, &resp), U_OK);
+  ck_assert_int_eq(resp.status, 200);
+  j_response = ulfius_get_json_body_response(&resp, NULL);
+  ck_assert_int_eq(json_array_size(j_response), 4);
+  ck_assert_ptr_eq(json_object_get(json_array_get(j_response, 0), "active"), json_true());
+  ck_assert_str_eq(json_string_value(json_object_get(json_array_get(j_response, 0), "token_type")), TOKEN_TYPE_HINT_ACCESS);
+  ck_assert_str_eq(json_string_value(json_object_get(json_array_get(j_response, 0), "username")), USERNAME);
+  ck_assert_str_eq(json_string_value(json_object_get(json_array_get(j_response, 0), "scope")), SCOPE_LIST);
+  ck_assert_ptr_ne(json_object_get(json_array_get(j_response, 0), "sub"), NULL);
+  ck_assert_ptr_eq(json_object_get(json_array_get(j_response, 1), "active"), json_true());
+  ck_assert_str_eq(json_string_value(json_object_get(json_array_get(j_response, 1), "token_type")), TOKEN_TYPE_HINT_REFRESH);
+  ck_assert_str_eq(json_string_value(json_object_get(json_array_get(j_response, 1), "client_id")), CLIENT_CONFIDENTIAL_1);
+  ck_assert_ptr_eq(json_object_get(json_array_get(j_response, 2), "active"), json_false());
+  ck_assert_ptr_eq(json_object_get(json_array_get(j_response, 3), "active"), json_true());
+  ck_assert_str_eq(json_string_value(json_object_get(json_array_get(j_response, 3), "token_type")), TOKEN_TYPE_HINT_ACCESS);
+  ck_assert_str_eq(json_string_value(json_object_get(json_array_get(j_response, 3), "sub")), json_string_value(json_object_get(json_array_get(j_response, 0), "sub")));
+  json_decref(j_response);
+  ulfius_clean_response(&resp);
+
+  // With a token_type_hint, the other tokens are inactive
+  ulfius_init_response(&resp);
+  u_map_put(req.map_post_body, "token_type_hint", TOKEN_TYPE_HINT_REFRESH);
+  ck_assert_int_eq(ulfius_send_http_request(&req, &resp), U_OK);
+  ck_assert_int_eq(resp.status, 200);
+  j_response = ulfius_get_json_body_response(&resp, NULL);
+  ck_assert_int_eq(json_array_size(j_response), 4);
+  ck_assert_ptr_eq(json_object_get(json_array_get(j_response, 0), "active"), json_false());
+  ck_assert_ptr_eq(json_object_get(json_array_get(j_response, 1), "active"), json_true());
+  ck_assert_ptr_eq(json_object_get(json_array_get(j_response, 2), "active"), json_false());
+  ck_assert_ptr_eq(json_object_get(json_array_get(j_response, 3), "active"), json_false());
+  json_decref(j_response);
+  ulfius_clean_response(&resp);
+  ulfius_clean_request(&req);
+
+  // Another client can't see the tokens of client3_id
+  j_response = json_pack("[{so}{so}{so}{so}]", "active", json_false(), "active", json_false(), "active", json_false(), "active", json_false());
+  ck_assert_int_eq(run_simple_test(NULL, "POST", SERVER_URI "/" PLUGIN_NAME "/introspect/batch/", CLIENT_CONFIDENTIAL_2, CLIENT_CONFIDENTIAL_2_SECRET, NULL, &param, 200, j_response, NULL, NULL), 1);
+  json_decref(j_response);
+  u_map_clean(&param);
+  o_free(tokens);
+  json_decref(j_body);
+}
+END_TEST
+
+START_TEST(test_oidc_introspection_batch_max_tokens)
+{
+  struct _u_map param;
+  json_t * j_response;
+  
+  ck_assert_int_eq(u_map_init(&param), U_OK);
+  ck_assert_int_eq(run_simple_test(NULL, "POST", SERVER_URI "/" PLUGIN_NAME "/introspect/batch/", CLIENT_CONFIDENTIAL_1, CLIENT_CONFIDENTIAL_1_SECRET, NULL, &param, 400, NULL, NULL, NULL), 1);
+  ck_assert_int_eq(u_map_put(&param, "tokens", " "), U_OK);
+  ck_assert_int_eq(run_simple_test(NULL, "POST", SERVER_URI "/" PLUGIN_NAME "/introspect/batch/", CLIENT_CONFIDENTIAL_1, CLIENT_CONFIDENTIAL_1_SECRET, NULL, &param, 400, NULL, NULL, NULL), 1);
+  ck_assert_int_eq(u_map_put(&param, "tokens", "error1 error2 error3 error4"), U_OK);
+  j_response = json_pack("[{so}{so}{so}{so}]", "active", json_false(), "active", json_false(), "active", json_false(), "active", json_false());
+  ck_assert_int_eq(run_simple_test(NULL, "POST", SERVER_URI "/" PLUGIN_NAME "/introspect/batch/", CLIENT_CONFIDENTIAL_1, CLIENT_CONFIDENTIAL_1_SECRET, NULL, &param, 200, j_response, NULL, NULL), 1);
+  json_decref(j_response);
+  ck_assert_int_eq(u_map_put(&param, "tokens", "error1 error2 error3 error4 error5"), U_OK);
+  ck_assert_int_eq(run_simple_test(NULL, "POST", SERVER_URI "/" PLUGIN_NAME "/introspect/batch/", CLIENT_CONFIDENTIAL_1, CLIENT_CONFIDENTIAL_1_SECRET, NULL, &param, 400, NULL, NULL, NULL), 1);
+  u_map_clean(&param);
+}
+END_TEST
+
+START_TEST(test_oidc_introspection_batch_unauthorized)
+{
+  struct _u_map param;
+  
+  ck_assert_int_eq(u_map_init(&param), U_OK);
+  ck_assert_int_eq(u_map_put(&param, "tokens", "error1 error2"), U_OK);
+  ck_assert_int_eq(run_simple_test(NULL, "POST", SERVER_URI "/" PLUGIN_NAME "/introspect/batch/", NULL, NULL, NULL, &param, 401, NULL, NULL, NULL), 1);
+  ck_assert_int_eq(run_simple_test(NULL, "POST", SERVER_URI "/" PLUGIN_NAME "/introspect/batch/", CLIENT_CONFIDENTIAL_1, "error", NULL, &param, 401, NULL, NULL, NULL), 1);
+  u_map_clean(&param);
+}
+END_TEST
+
 static Suite *glewlwyd_suite(void)
 {
   Suite *s;
@@ -920,6 +1063,11 @@ static Suite *glewlwyd_suite(void)
   tcase_add_test(tc_core, test_oidc_introspection_plugin_add_target_client_check_expiration);
   tcase_add_test(tc_core, test_oidc_introspection_token_target_client_check_expiration);
   tcase_add_test(tc_core, test_oidc_introspection_plugin_remove);
+  tcase_add_test(tc_core, test_oidc_introspection_plugin_add_target_client_batch);
+  tcase_add_test(tc_core, test_oidc_introspection_batch_mixed_target_client);
+  tcase_add_test(tc_core, test_oidc_introspection_batch_max_tokens);
+  tcase_add_test(tc_core, test_oidc_introspection_batch_unauthorized);
+  tcase_add_test(tc_core, test_oidc_introspection_plugin_remove);
   tcase_set_timeout(tc_core, 30);
   suite_add_tcase(s, tc_core);
 
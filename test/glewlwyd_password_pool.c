@@ -0,0 +1,308 @@
+/* Public domain, no copyright. Use at your own risk. */
+
+/**
+ * Tests the password check pool without a Glewlwyd instance,
+ * src/password_pool.c is built with this file and runs password checks that wait until the test lets them end
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <check.h>
+#include <ulfius.h>
+#include <orcania.h>
+#include <yder.h>
+
+#include "glewlwyd.h"
+
+#define USERNAME "user1"
+#define PASSWORD "password"
+#define PASSWORD_INVALID "invalid"
+
+#define MAX_WAIT 500
+
+struct _pool_call {
+  pthread_t      thread;
+  unsigned short is_client;
+  int            result;
+};
+
+struct config_elements config;
+struct _glwd_metrics_data metrics_depth, metrics_rejected;
+
+pthread_mutex_t check_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t check_cond = PTHREAD_COND_INITIALIZER;
+unsigned int check_open = 0, check_started = 0;
+
+/**
+ * The metrics functions used by the password pool, the values are stored in the first shard
+ */
+int glewlwyd_metrics_add_metric(struct config_elements * config, const char * name, const char * help) {
+  return G_OK;
+}
+
+int glewlwyd_metrics_add_metric_type(struct config_elements * config, const char * name, const char * help, unsigned short type) {
+  return G_OK;
+}
+
+struct _glwd_metrics_data * glewlwyd_metrics_get_gauge(struct config_elements * config, const char * name, const char * label) {
+  return 0 == o_strcmp(GLWD_METRICS_PASSWORD_POOL_DEPTH, name) ? &metrics_depth : NULL;
+}
+
+struct _glwd_metrics_data * glewlwyd_metrics_get_histogram(struct config_elements * config, const char * name, const char * label) {
+  return NULL;
+}
+
+struct _glwd_metrics_data * glewlwyd_metrics_get_counter(struct config_elements * config, const char * name, const char * label) {
+  return 0 == o_strcmp(GLWD_METRICS_PASSWORD_POOL_REJECTED, name) ? &metrics_rejected : NULL;
+}
+
+void glewlwyd_metrics_counter_add(struct _glwd_metrics_data * counter, size_t inc) {
+  if (counter != NULL) {
+    __atomic_fetch_add(&counter->shards[0].value, inc, __ATOMIC_RELAXED);
+  }
+}
+
+void glewlwyd_metrics_gauge_add(struct _glwd_metrics_data * gauge, long delta) {
+  if (gauge != NULL) {
+    __atomic_fetch_add(&gauge->shards[0].value, (size_t)delta, __ATOMIC_RELAXED);
+  }
+}
+
+void glewlwyd_metrics_histogram_observe(struct _glwd_metrics_data * histogram, size_t value) {
+}
+
+static long long metrics_value(struct _glwd_metrics_data * data) {
+  return (long long)__atomic_load_n(&data->shards[0].value, __ATOMIC_RELAXED);
+}
+
+/**
+ * Password check that waits until check_open is set
+ */
+static int check_password(struct config_elements * config, void * instance, const char * name, const char * password) {
+  pthread_mutex_lock(&check_lock);
+  check_started++;
+  while (!check_open) {
+    pthread_cond_wait(&check_cond, &check_lock);
+  }
+  pthread_mutex_unlock(&check_lock);
+  return 0 == o_strcmp(PASSWORD, password) ? G_OK : G_ERROR_UNAUTHORIZED;
+}
+
+static void check_password_open(void) {
+  pthread_mutex_lock(&check_lock);
+  check_open = 1;
+  pthread_cond_broadcast(&check_cond);
+  pthread_mutex_unlock(&check_lock);
+}
+
+static unsigned int check_password_started(void) {
+  unsigned int started;
+
+  pthread_mutex_lock(&check_lock);
+  started = check_started;
+  pthread_mutex_unlock(&check_lock);
+  return started;
+}
+
+static size_t password_pool_size(void) {
+  size_t size;
+
+  pthread_mutex_lock(&config.password_pool.lock);
+  size = config.password_pool.size;
+  pthread_mutex_unlock(&config.password_pool.lock);
+  return size;
+}
+
+static void * pool_call_run(void * args) {
+  struct _pool_call * call = (struct _pool_call *)args;
+
+  call->result = glewlwyd_password_pool_run(&config, call->is_client, &check_password, NULL, USERNAME, PASSWORD);
+  return NULL;
+}
+
+/**
+ * Runs a password check in a new thread
+ */
+static void pool_call_start(struct _pool_call * call, unsigned short is_client) {
+  call->is_client = is_client;
+  call->result = G_ERROR;
+  ck_assert_int_eq(pthread_create(&call->thread, NULL, pool_call_run, call), 0);
+}
+
+/**
+ * Waits until the first password check is run by the worker and nb_queued checks are waiting in the queue
+ */
+static void pool_wait(size_t nb_queued) {
+  int i;
+
+  for (i=0; i<50 && (!check_password_started() || password_pool_size() < nb_queued); i++) {
+    usleep(100000);
+  }
+  ck_assert_int_eq(check_password_started(), 1);
+  ck_assert_int_eq(password_pool_size(), nb_queued);
+}
+
+static void password_pool_init(size_t nb_workers, size_t max_queue, unsigned int max_wait, size_t client_max) {
+  memset(&config, 0, sizeof(struct config_elements));
+  memset(&metrics_depth, 0, sizeof(struct _glwd_metrics_data));
+  memset(&metrics_rejected, 0, sizeof(struct _glwd_metrics_data));
+  check_open = 0;
+  check_started = 0;
+  config.password_pool.nb_workers = nb_workers;
+  config.password_pool.max_queue = max_queue;
+  config.password_pool.max_wait = max_wait;
+  config.password_pool.client_max = client_max;
+  ck_assert_int_eq(glewlwyd_password_pool_init(&config), G_OK);
+}
+
+START_TEST(test_glwd_password_pool_run)
+{
+  password_pool_init(2, 4, MAX_WAIT, 0);
+  check_password_open();
+
+  ck_assert_int_eq(glewlwyd_password_pool_run(&config, 0, &check_password, NULL, USERNAME, PASSWORD), G_OK);
+  ck_assert_int_eq(glewlwyd_password_pool_run(&config, 0, &check_password, NULL, USERNAME, PASSWORD_INVALID), G_ERROR_UNAUTHORIZED);
+  ck_assert_int_eq(glewlwyd_password_pool_run(&config, 1, &check_password, NULL, USERNAME, PASSWORD), G_OK);
+  ck_assert_int_eq(check_password_started(), 3);
+  ck_assert_int_eq(metrics_value(&metrics_depth), 0);
+  ck_assert_int_eq(metrics_value(&metrics_rejected), 0);
+
+  glewlwyd_password_pool_close(&config);
+
+  // The pool is disabled, the password is checked in the current thread
+  password_pool_init(0, 0, 0, 0);
+  check_password_open();
+  ck_assert_int_eq(glewlwyd_password_pool_run(&config, 0, &check_password, NULL, USERNAME, PASSWORD), G_OK);
+  glewlwyd_password_pool_close(&config);
+}
+END_TEST
+
+START_TEST(test_glwd_password_pool_queue_full)
+{
+  struct _pool_call call_running, call_queued;
+
+  password_pool_init(1, 1, 0, 0);
+
+  pool_call_start(&call_running, 0);
+  pool_wait(0);
+  pool_call_start(&call_queued, 0);
+  pool_wait(1);
+
+  // The queue is full, the password check is rejected without waiting
+  ck_assert_int_eq(glewlwyd_password_pool_run(&config, 0, &check_password, NULL, USERNAME, PASSWORD), G_ERROR_UNAVAILABLE);
+  ck_assert_int_eq(check_password_started(), 1);
+  ck_assert_int_eq(metrics_value(&metrics_rejected), 1);
+
+  check_password_open();
+  pthread_join(call_running.thread, NULL);
+  pthread_join(call_queued.thread, NULL);
+  ck_assert_int_eq(call_running.result, G_OK);
+  ck_assert_int_eq(call_queued.result, G_OK);
+  ck_assert_int_eq(metrics_value(&metrics_depth), 0);
+
+  glewlwyd_password_pool_close(&config);
+}
+END_TEST
+
+START_TEST(test_glwd_password_pool_max_wait)
+{
+  struct _pool_call call_running;
+  struct timespec start, end;
+  long elapsed;
+
+  password_pool_init(1, 4, MAX_WAIT, 0);
+
+  pool_call_start(&call_running, 0);
+  pool_wait(0);
+
+  // The password check is removed from the queue after max_wait milliseconds
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  ck_assert_int_eq(glewlwyd_password_pool_run(&config, 0, &check_password, NULL, USERNAME, PASSWORD), G_ERROR_UNAVAILABLE);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  elapsed = (end.tv_sec - start.tv_sec)*1000 + (end.tv_nsec - start.tv_nsec)/1000000;
+  ck_assert_int_ge(elapsed, MAX_WAIT-50);
+  ck_assert_int_eq(password_pool_size(), 0);
+  ck_assert_int_eq(check_password_started(), 1);
+  ck_assert_int_eq(metrics_value(&metrics_rejected), 1);
+  ck_assert_int_eq(metrics_value(&metrics_depth), 0);
+
+  check_password_open();
+  pthread_join(call_running.thread, NULL);
+  ck_assert_int_eq(call_running.result, G_OK);
+
+  glewlwyd_password_pool_close(&config);
+}
+END_TEST
+
+START_TEST(test_glwd_password_pool_client_max)
+{
+  struct _pool_call call_client, call_user;
+
+  password_pool_init(1, 4, 0, 1);
+
+  pool_call_start(&call_client, 1);
+  pool_wait(0);
+
+  // client_max client checks are running, the next client check is rejected but the user checks are queued
+  ck_assert_int_eq(glewlwyd_password_pool_run(&config, 1, &check_password, NULL, USERNAME, PASSWORD), G_ERROR_UNAVAILABLE);
+  ck_assert_int_eq(metrics_value(&metrics_rejected), 1);
+  pool_call_start(&call_user, 0);
+  pool_wait(1);
+
+  check_password_open();
+  pthread_join(call_client.thread, NULL);
+  pthread_join(call_user.thread, NULL);
+  ck_assert_int_eq(call_client.result, G_OK);
+  ck_assert_int_eq(call_user.result, G_OK);
+
+  // The client check has ended, a new client check is accepted
+  ck_assert_int_eq(glewlwyd_password_pool_run(&config, 1, &check_password, NULL, USERNAME, PASSWORD), G_OK);
+  ck_assert_int_eq(metrics_value(&metrics_rejected), 1);
+  ck_assert_int_eq(metrics_value(&metrics_depth), 0);
+
+  glewlwyd_password_pool_close(&config);
+}
+END_TEST
+
+static Suite *glewlwyd_suite(void)
+{
+  Suite *s;
+  TCase *tc_core;
+
+  s = suite_create("Glewlwyd password pool");
+  tc_core = tcase_create("test_glwd_password_pool");
+  tcase_add_test(tc_core, test_glwd_password_pool_run);
+  tcase_add_test(tc_core, test_glwd_password_pool_queue_full);
+  tcase_add_test(tc_core, test_glwd_password_pool_max_wait);
+  tcase_add_test(tc_core, test_glwd_password_pool_client_max);
+  tcase_set_timeout(tc_core, 30);
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
+
+int main(int argc, char *argv[])
+{
+  int number_failed;
+  Suite *s;
+  SRunner *sr;
+
+  y_init_logs("Glewlwyd test", Y_LOG_MODE_CONSOLE, Y_LOG_LEVEL_DEBUG, NULL, "Starting Glewlwyd test");
+
+  s = glewlwyd_suite();
+  sr = srunner_create(s);
+
+  srunner_run_all(sr, CK_VERBOSE);
+  number_failed = srunner_ntests_failed(sr);
+  srunner_free(sr);
+
+  y_close_logs();
+
+  return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
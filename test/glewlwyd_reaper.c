@@ -0,0 +1,328 @@
+/* Public domain, no copyright. Use at your own risk. */
+
+/**
+ * Tests the expired data reaper without a Glewlwyd instance,
+ * src/reaper.c is built with this file and deletes the expired rows of a temporary SQLite3 database
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <check.h>
+#include <ulfius.h>
+#include <orcania.h>
+#include <yder.h>
+
+#include "glewlwyd.h"
+
+#define DB_PATH "/tmp/glewlwyd_reaper.db"
+
+#define BATCH_SIZE 2
+#define ACCESS_TOKEN_DURATION 3600
+#define PLUGIN_NAME "oidc"
+#define PLUGIN_NAME_OTHER "oidc_other"
+
+#define TABLE_CODE "gpo_code"
+#define TABLE_REFRESH_TOKEN "gpo_refresh_token"
+#define TABLE_ACCESS_TOKEN "gpo_access_token"
+#define TABLE_CLIENT_REGISTRATION "gpo_client_registration"
+
+struct config_elements config;
+time_t now;
+
+pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t metrics_cond = PTHREAD_COND_INITIALIZER;
+unsigned int nb_runs;
+json_t * j_deleted;
+
+/**
+ * The functions of the other source files used by src/reaper.c
+ */
+struct _h_connection * glewlwyd_db_pool_acquire(struct config_elements * config) {
+  return config->conn;
+}
+
+void glewlwyd_db_pool_release(struct config_elements * config, struct _h_connection * conn) {
+}
+
+int glewlwyd_metrics_add_metric(struct config_elements * config, const char * name, const char * help) {
+  return G_OK;
+}
+
+/**
+ * Stores the number of rows deleted by each batch in j_deleted with the table as key,
+ * and counts the complete runs of the reapers
+ */
+int glewlwyd_metrics_increment_counter_va(struct config_elements * config, const char * name, size_t inc, ...) {
+  va_list vl;
+  const char * key, * value, * table = NULL;
+
+  va_start(vl, inc);
+  for (key = va_arg(vl, const char *); key != NULL; key = va_arg(vl, const char *)) {
+    value = va_arg(vl, const char *);
+    if (0 == o_strcmp("table", key)) {
+      table = value;
+    }
+  }
+  va_end(vl);
+  pthread_mutex_lock(&metrics_lock);
+  if (0 == o_strcmp(GLWD_METRICS_REAPER_DELETED, name) && table != NULL) {
+    if (json_object_get(j_deleted, table) == NULL) {
+      json_object_set_new(j_deleted, table, json_array());
+    }
+    json_array_append_new(json_object_get(j_deleted, table), json_integer((json_int_t)inc));
+  } else if (0 == o_strcmp(GLWD_METRICS_REAPER_RUN, name) && inc) {
+    nb_runs++;
+    pthread_cond_broadcast(&metrics_cond);
+  }
+  pthread_mutex_unlock(&metrics_lock);
+  return G_OK;
+}
+
+static void reaper_query(const char * query) {
+  ck_assert_int_eq(h_execute_query(config.conn, query, NULL, H_OPTION_EXEC), H_OK);
+}
+
+static void reaper_init(void) {
+  const char * tables[] = {
+    "CREATE TABLE " GLEWLWYD_TABLE_USER_SESSION " (gus_id INTEGER PRIMARY KEY AUTOINCREMENT, gus_session_hash TEXT NOT NULL, gus_expiration TIMESTAMP NOT NULL)",
+    "CREATE TABLE " GLEWLWYD_TABLE_USER_SESSION_SCHEME " (guss_id INTEGER PRIMARY KEY AUTOINCREMENT, gus_id INTEGER NOT NULL, guss_expiration TIMESTAMP NOT NULL)",
+    "CREATE TABLE " TABLE_CODE " (gpoc_id INTEGER PRIMARY KEY AUTOINCREMENT, gpoc_plugin_name TEXT NOT NULL, gpoc_expires_at TIMESTAMP NOT NULL)",
+    "CREATE TABLE " TABLE_REFRESH_TOKEN " (gpor_id INTEGER PRIMARY KEY AUTOINCREMENT, gpor_plugin_name TEXT NOT NULL, gpoc_id INTEGER DEFAULT NULL, gpor_expires_at TIMESTAMP NOT NULL)",
+    "CREATE TABLE " TABLE_ACCESS_TOKEN " (gpoa_id INTEGER PRIMARY KEY AUTOINCREMENT, gpoa_plugin_name TEXT NOT NULL, gpoa_issued_at TIMESTAMP NOT NULL)",
+    "CREATE TABLE " TABLE_CLIENT_REGISTRATION " (gpocr_id INTEGER PRIMARY KEY AUTOINCREMENT, gpoa_id INTEGER DEFAULT NULL)",
+    NULL
+  };
+  int i;
+
+  memset(&config, 0, sizeof(struct config_elements));
+  time(&now);
+  nb_runs = 0;
+  j_deleted = json_object();
+  unlink(DB_PATH);
+  ck_assert_ptr_ne(config.conn = h_connect_sqlite(DB_PATH), NULL);
+  for (i=0; tables[i] != NULL; i++) {
+    reaper_query(tables[i]);
+  }
+}
+
+static void reaper_clean(void) {
+  json_decref(j_deleted);
+  j_deleted = NULL;
+  h_close_db(config.conn);
+  h_clean_connection(config.conn);
+  unlink(DB_PATH);
+}
+
+/**
+ * Waits until the reapers have completed nb runs
+ */
+static void reaper_wait_runs(unsigned int nb) {
+  struct timespec abstime;
+
+  clock_gettime(CLOCK_REALTIME, &abstime);
+  abstime.tv_sec += 10;
+  pthread_mutex_lock(&metrics_lock);
+  while (nb_runs < nb) {
+    if (pthread_cond_timedwait(&metrics_cond, &metrics_lock, &abstime) == ETIMEDOUT) {
+      break;
+    }
+  }
+  ck_assert_int_ge(nb_runs, nb);
+  pthread_mutex_unlock(&metrics_lock);
+}
+
+static json_int_t reaper_count(const char * table, const char * where) {
+  json_t * j_result = NULL;
+  char * query = msprintf("SELECT COUNT(*) AS nb FROM %s WHERE %s", table, where);
+  json_int_t nb;
+
+  ck_assert_int_eq(h_execute_query_json(config.conn, query, &j_result), H_OK);
+  nb = json_integer_value(json_object_get(json_array_get(j_result, 0), "nb"));
+  json_decref(j_result);
+  o_free(query);
+  return nb;
+}
+
+static void reaper_check_batches(const char * table, const char * expected) {
+  json_t * j_expected = json_loads(expected, JSON_DECODE_ANY, NULL);
+
+  ck_assert_int_eq(json_equal(json_object_get(j_deleted, table), j_expected), 1);
+  json_decref(j_expected);
+}
+
+START_TEST(test_glwd_reaper_session)
+{
+  char * query;
+
+  reaper_init();
+  config.reaper.interval = 3600;
+  config.reaper.session_retention = 60;
+  config.reaper.batch_size = BATCH_SIZE;
+  config.reaper.batch_delay = 0;
+  // 5 sessions expired for more than session_retention, 1 expired for less and 1 valid
+  query = msprintf("INSERT INTO " GLEWLWYD_TABLE_USER_SESSION " (gus_id, gus_session_hash, gus_expiration) VALUES "
+                   "(1, 'expired1', %lld), (2, 'expired2', %lld), (3, 'expired3', %lld), (4, 'expired4', %lld), (5, 'expired5', %lld), (6, 'retained', %lld), (7, 'valid', %lld)",
+                   (long long)now-120, (long long)now-120, (long long)now-120, (long long)now-120, (long long)now-120, (long long)now-30, (long long)now+3600);
+  reaper_query(query);
+  o_free(query);
+  query = msprintf("INSERT INTO " GLEWLWYD_TABLE_USER_SESSION_SCHEME " (gus_id, guss_expiration) VALUES (1, %lld), (6, %lld), (7, %lld)",
+                   (long long)now-120, (long long)now-30, (long long)now+3600);
+  reaper_query(query);
+  o_free(query);
+
+  ck_assert_int_eq(glewlwyd_reaper_init(&config), G_OK);
+  reaper_wait_runs(1);
+  glewlwyd_reaper_close(&config);
+
+  // The rows are deleted by batches of BATCH_SIZE rows
+  reaper_check_batches(GLEWLWYD_TABLE_USER_SESSION, "[2,2,1]");
+  reaper_check_batches(GLEWLWYD_TABLE_USER_SESSION_SCHEME, "[1]");
+  ck_assert_int_eq(reaper_count(GLEWLWYD_TABLE_USER_SESSION, "1=1"), 2);
+  ck_assert_int_eq(reaper_count(GLEWLWYD_TABLE_USER_SESSION, "gus_id IN (6,7)"), 2);
+  ck_assert_int_eq(reaper_count(GLEWLWYD_TABLE_USER_SESSION_SCHEME, "1=1"), 2);
+
+  reaper_clean();
+}
+END_TEST
+
+/**
+ * Uses the tasks of start_reaper in src/plugin/protocol_oidc.c for the codes, refresh tokens and access tokens, with a retention of 0
+ */
+START_TEST(test_glwd_reaper_plugin_tokens)
+{
+  json_t * j_tasks;
+  char * query;
+
+  reaper_init();
+  config.reaper.interval = 0;
+  // Refresh tokens: 1 expired with an access token still valid, 2 expired for more than the access token duration, 3 of another plugin
+  query = msprintf("INSERT INTO " TABLE_REFRESH_TOKEN " (gpor_id, gpor_plugin_name, gpoc_id, gpor_expires_at) VALUES "
+                   "(1, '" PLUGIN_NAME "', 1, %lld), (2, '" PLUGIN_NAME "', NULL, %lld), (3, '" PLUGIN_NAME_OTHER "', NULL, %lld)",
+                   (long long)now-100, (long long)now-ACCESS_TOKEN_DURATION-100, (long long)now-ACCESS_TOKEN_DURATION-100);
+  reaper_query(query);
+  o_free(query);
+  // Codes: 1 expired and linked to the refresh token 1, 2 to 4 expired, 5 valid
+  query = msprintf("INSERT INTO " TABLE_CODE " (gpoc_id, gpoc_plugin_name, gpoc_expires_at) VALUES "
+                   "(1, '" PLUGIN_NAME "', %lld), (2, '" PLUGIN_NAME "', %lld), (3, '" PLUGIN_NAME "', %lld), (4, '" PLUGIN_NAME "', %lld), (5, '" PLUGIN_NAME "', %lld)",
+                   (long long)now-100, (long long)now-100, (long long)now-100, (long long)now-100, (long long)now+600);
+  reaper_query(query);
+  o_free(query);
+  // Access tokens: 1 expired and used by a client registration, 2 expired, 3 valid
+  query = msprintf("INSERT INTO " TABLE_ACCESS_TOKEN " (gpoa_id, gpoa_plugin_name, gpoa_issued_at) VALUES "
+                   "(1, '" PLUGIN_NAME "', %lld), (2, '" PLUGIN_NAME "', %lld), (3, '" PLUGIN_NAME "', %lld)",
+                   (long long)now-ACCESS_TOKEN_DURATION-100, (long long)now-ACCESS_TOKEN_DURATION-100, (long long)now-100);
+  reaper_query(query);
+  o_free(query);
+  reaper_query("INSERT INTO " TABLE_CLIENT_REGISTRATION " (gpocr_id, gpoa_id) VALUES (1, 1), (2, NULL)");
+
+  j_tasks = json_pack("[{sssssssIs{ss}}{sssssssIs{sss{ssss}}}{sssssssIs{sss{ssss}}}]",
+                      "table", TABLE_REFRESH_TOKEN,
+                      "id", "gpor_id",
+                      "date", "gpor_expires_at",
+                      "age", (json_int_t)ACCESS_TOKEN_DURATION,
+                      "where",
+                        "gpor_plugin_name", PLUGIN_NAME,
+                      "table", TABLE_CODE,
+                      "id", "gpoc_id",
+                      "date", "gpoc_expires_at",
+                      "age", (json_int_t)0,
+                      "where",
+                        "gpoc_plugin_name", PLUGIN_NAME,
+                        "gpoc_id",
+                          "operator", "raw",
+                          "value", "NOT IN (SELECT gpoc_id FROM " TABLE_REFRESH_TOKEN " WHERE gpoc_id IS NOT NULL)",
+                      "table", TABLE_ACCESS_TOKEN,
+                      "id", "gpoa_id",
+                      "date", "gpoa_issued_at",
+                      "age", (json_int_t)ACCESS_TOKEN_DURATION,
+                      "where",
+                        "gpoa_plugin_name", PLUGIN_NAME,
+                        "gpoa_id",
+                          "operator", "raw",
+                          "value", "NOT IN (SELECT gpoa_id FROM " TABLE_CLIENT_REGISTRATION " WHERE gpoa_id IS NOT NULL)");
+  ck_assert_int_eq(glewlwyd_reaper_init(&config), G_OK);
+  ck_assert_int_eq(glewlwyd_reaper_start(&config, "plugin/" PLUGIN_NAME, j_tasks, 3600, BATCH_SIZE, 0), G_OK);
+  ck_assert_int_eq(glewlwyd_reaper_start(&config, "plugin/" PLUGIN_NAME, j_tasks, 3600, BATCH_SIZE, 0), G_ERROR_PARAM);
+  reaper_wait_runs(1);
+  ck_assert_int_eq(glewlwyd_reaper_stop(&config, "plugin/" PLUGIN_NAME), G_OK);
+  ck_assert_int_eq(glewlwyd_reaper_stop(&config, "plugin/" PLUGIN_NAME), G_ERROR_NOT_FOUND);
+  glewlwyd_reaper_close(&config);
+  json_decref(j_tasks);
+
+  // The refresh token with an access token still valid and the refresh token of the other plugin are kept
+  reaper_check_batches(TABLE_REFRESH_TOKEN, "[1]");
+  ck_assert_int_eq(reaper_count(TABLE_REFRESH_TOKEN, "gpor_id IN (1,3)"), 2);
+  ck_assert_int_eq(reaper_count(TABLE_REFRESH_TOKEN, "1=1"), 2);
+  // The code linked to the refresh token is kept
+  reaper_check_batches(TABLE_CODE, "[2,1]");
+  ck_assert_int_eq(reaper_count(TABLE_CODE, "gpoc_id IN (1,5)"), 2);
+  ck_assert_int_eq(reaper_count(TABLE_CODE, "1=1"), 2);
+  // The access token of the client registration is kept
+  reaper_check_batches(TABLE_ACCESS_TOKEN, "[1]");
+  ck_assert_int_eq(reaper_count(TABLE_ACCESS_TOKEN, "gpoa_id IN (1,3)"), 2);
+  ck_assert_int_eq(reaper_count(TABLE_ACCESS_TOKEN, "1=1"), 2);
+
+  reaper_clean();
+}
+END_TEST
+
+START_TEST(test_glwd_reaper_start_error)
+{
+  json_t * j_tasks = json_array();
+
+  reaper_init();
+  ck_assert_int_eq(glewlwyd_reaper_start(&config, "plugin/" PLUGIN_NAME, j_tasks, 3600, BATCH_SIZE, 0), G_ERROR_PARAM);
+  ck_assert_int_eq(glewlwyd_reaper_init(&config), G_OK);
+  ck_assert_int_eq(glewlwyd_reaper_start(&config, NULL, j_tasks, 3600, BATCH_SIZE, 0), G_ERROR_PARAM);
+  ck_assert_int_eq(glewlwyd_reaper_start(&config, "plugin/" PLUGIN_NAME, NULL, 3600, BATCH_SIZE, 0), G_ERROR_PARAM);
+  ck_assert_int_eq(glewlwyd_reaper_start(&config, "plugin/" PLUGIN_NAME, j_tasks, 0, BATCH_SIZE, 0), G_ERROR_PARAM);
+  ck_assert_int_eq(glewlwyd_reaper_start(&config, "plugin/" PLUGIN_NAME, j_tasks, 3600, 0, 0), G_ERROR_PARAM);
+  glewlwyd_reaper_close(&config);
+  json_decref(j_tasks);
+
+  reaper_clean();
+}
+END_TEST
+
+static Suite *glewlwyd_suite(void)
+{
+  Suite *s;
+  TCase *tc_core;
+
+  s = suite_create("Glewlwyd reaper");
+  tc_core = tcase_create("test_glwd_reaper");
+  tcase_add_test(tc_core, test_glwd_reaper_session);
+  tcase_add_test(tc_core, test_glwd_reaper_plugin_tokens);
+  tcase_add_test(tc_core, test_glwd_reaper_start_error);
+  tcase_set_timeout(tc_core, 30);
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
+
+int main(int argc, char *argv[])
+{
+  int number_failed;
+  Suite *s;
+  SRunner *sr;
+
+  y_init_logs("Glewlwyd test", Y_LOG_MODE_CONSOLE, Y_LOG_LEVEL_DEBUG, NULL, "Starting Glewlwyd test");
+
+  s = glewlwyd_suite();
+  sr = srunner_create(s);
+
+  srunner_run_all(sr, CK_VERBOSE);
+  number_failed = srunner_ntests_failed(sr);
+  srunner_free(sr);
+
+  y_close_logs();
+
+  return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
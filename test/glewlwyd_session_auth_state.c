@@ -0,0 +1,496 @@
+/* Public domain, no copyright. Use at your own risk. */
+
+/**
+ * Tests the session authentication state without a Glewlwyd instance,
+ * src/scope.c is built with this file and evaluates the scopes against the sessions of a temporary SQLite3 database
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <check.h>
+#include <ulfius.h>
+#include <orcania.h>
+#include <yder.h>
+
+#include "glewlwyd.h"
+
+#define DB_PATH "/tmp/glewlwyd_session_auth_state.db"
+
+#define USERNAME "user1"
+
+// The session hash is the session id, see generate_hash below
+#define SESSION_MIXED "session_mixed"
+#define SESSION_OTHER "session_other"
+#define SESSION_EXPIRED "session_expired"
+#define SESSION_NOT_CURRENT "session_not_current"
+
+#define SCOPE_SCHEMES "scope_schemes"
+#define SCOPE_PASSWORD_OLD "scope_password_old"
+#define SCOPE_NO_PASSWORD "scope_no_password"
+
+#define SCHEME_VALID_ID 1
+#define SCHEME_EXPIRED_ID 2
+#define SCHEME_MISSING_ID 3
+#define SCHEME_DISABLED_ID 4
+#define SCHEME_MAX_USE_ID 5
+#define SCHEME_OTHER_ID 6
+#define SCHEME_NOT_REGISTERED_ID 7
+
+#define SCHEME_MAX_USE 2
+#define PASSWORD_MAX_AGE 600
+#define PASSWORD_MAX_AGE_OLD 120
+
+struct config_elements config;
+time_t now;
+json_int_t pending_max_use = 0;
+
+int can_use_registered = GLEWLWYD_IS_REGISTERED, can_use_available = GLEWLWYD_IS_AVAILABLE;
+
+static int scheme_can_use(struct config_module * config, const char * username, void * cls) {
+  return *(int *)cls;
+}
+
+struct _user_auth_scheme_module scheme_module = {
+  .user_auth_scheme_module_can_use = &scheme_can_use
+};
+
+struct _user_auth_scheme_module_instance scheme_instances[] = {
+  {.name = "scheme_valid", .module = &scheme_module, .guasmi_id = SCHEME_VALID_ID, .cls = &can_use_registered, .enabled = 1},
+  {.name = "scheme_expired", .module = &scheme_module, .guasmi_id = SCHEME_EXPIRED_ID, .cls = &can_use_registered, .enabled = 1},
+  {.name = "scheme_missing", .module = &scheme_module, .guasmi_id = SCHEME_MISSING_ID, .cls = &can_use_registered, .enabled = 1},
+  {.name = "scheme_disabled", .module = &scheme_module, .guasmi_id = SCHEME_DISABLED_ID, .cls = &can_use_registered, .enabled = 1},
+  {.name = "scheme_max_use", .module = &scheme_module, .guasmi_id = SCHEME_MAX_USE_ID, .guasmi_max_use = SCHEME_MAX_USE, .cls = &can_use_registered, .enabled = 1},
+  {.name = "scheme_other", .module = &scheme_module, .guasmi_id = SCHEME_OTHER_ID, .cls = &can_use_registered, .enabled = 1},
+  {.name = "scheme_not_registered", .module = &scheme_module, .guasmi_id = SCHEME_NOT_REGISTERED_ID, .cls = &can_use_available, .enabled = 1},
+  {.name = NULL}
+};
+
+/**
+ * The functions of the other source files used by src/scope.c
+ */
+struct _h_connection * glewlwyd_db_pool_acquire(struct config_elements * config) {
+  return config->conn;
+}
+
+void glewlwyd_db_pool_release(struct config_elements * config, struct _h_connection * conn) {
+}
+
+char * generate_hash(digest_algorithm digest, const char * data) {
+  return o_strdup(data);
+}
+
+int check_result_value(json_t * result, const int value) {
+  return (json_is_integer(json_object_get(result, "result")) &&
+          json_integer_value(json_object_get(result, "result")) == value);
+}
+
+json_t * get_user(struct config_elements * config, const char * username, const char * source) {
+  if (0 == o_strcmp(USERNAME, username)) {
+    return json_pack("{sis{sssos[sss]}}", "result", G_OK, "user", "username", USERNAME, "enabled", json_true(), "scope", SCOPE_SCHEMES, SCOPE_PASSWORD_OLD, SCOPE_NO_PASSWORD);
+  } else {
+    return json_pack("{si}", "result", G_ERROR_NOT_FOUND);
+  }
+}
+
+int user_has_scope(json_t * j_user, const char * scope) {
+  json_t * j_element;
+  size_t index;
+
+  json_array_foreach(json_object_get(j_user, "scope"), index, j_element) {
+    if (0 == o_strcmp(scope, json_string_value(j_element))) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+struct _user_auth_scheme_module_instance * get_user_auth_scheme_module_instance(struct config_elements * config, const char * name) {
+  int i;
+
+  for (i=0; scheme_instances[i].name != NULL; i++) {
+    if (0 == o_strcmp(scheme_instances[i].name, name)) {
+      return &scheme_instances[i];
+    }
+  }
+  return NULL;
+}
+
+json_t * get_user_auth_scheme_module(struct config_elements * config, const char * name) {
+  return json_pack("{si}", "result", G_ERROR_NOT_FOUND);
+}
+
+json_t * get_client(struct config_elements * config, const char * client_id, const char * source) {
+  return json_pack("{si}", "result", G_ERROR_NOT_FOUND);
+}
+
+json_int_t glewlwyd_session_usage_get_pending(struct config_elements * config, const char * session_hash, const char * username, json_int_t guasmi_id) {
+  return (0 == o_strcmp(SESSION_MIXED, session_hash) && guasmi_id == SCHEME_MAX_USE_ID) ? pending_max_use : 0;
+}
+
+/**
+ * Creates the scopes and the sessions
+ * The scope SCOPE_SCHEMES requires the password and 2 schemes of the group group1
+ * The session SESSION_MIXED has for each scheme:
+ * - password: valid, last login 300 seconds ago
+ * - scheme_valid: a valid authentication and an older expired one
+ * - scheme_expired: an expired authentication
+ * - scheme_missing: no authentication
+ * - scheme_disabled: a disabled authentication
+ * - scheme_max_use: a valid authentication used SCHEME_MAX_USE times and an older one not used yet
+ * - scheme_other: no authentication, the session SESSION_OTHER has a valid one
+ */
+static void session_auth_state_init(void) {
+  const char * tables[] = {
+    "CREATE TABLE " GLEWLWYD_TABLE_SCOPE " (gs_id INTEGER PRIMARY KEY AUTOINCREMENT, gs_name TEXT NOT NULL, gs_display_name TEXT, gs_description TEXT, gs_password_required INTEGER DEFAULT 1, gs_password_max_age INTEGER DEFAULT 0)",
+    "CREATE TABLE " GLEWLWYD_TABLE_SCOPE_GROUP " (gsg_id INTEGER PRIMARY KEY AUTOINCREMENT, gs_id INTEGER, gsg_name TEXT NOT NULL, gsg_scheme_required INTEGER DEFAULT 1)",
+    "CREATE TABLE " GLEWLWYD_TABLE_USER_AUTH_SCHEME_MODULE_INSTANCE " (guasmi_id INTEGER PRIMARY KEY AUTOINCREMENT, guasmi_module TEXT NOT NULL, guasmi_name TEXT NOT NULL, guasmi_display_name TEXT DEFAULT '')",
+    "CREATE TABLE " GLEWLWYD_TABLE_SCOPE_GROUP_AUTH_SCHEME_MODULE_INSTANCE " (gsgasmi_id INTEGER PRIMARY KEY AUTOINCREMENT, gsg_id INTEGER NOT NULL, guasmi_id INTEGER NOT NULL)",
+    "CREATE TABLE " GLEWLWYD_TABLE_USER_SESSION " (gus_id INTEGER PRIMARY KEY AUTOINCREMENT, gus_session_hash TEXT NOT NULL, gus_username TEXT NOT NULL, gus_expiration TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP, gus_current INTEGER, gus_enabled INTEGER DEFAULT 1)",
+    "CREATE TABLE " GLEWLWYD_TABLE_USER_SESSION_SCHEME " (guss_id INTEGER PRIMARY KEY AUTOINCREMENT, gus_id INTEGER NOT NULL, guasmi_id INTEGER DEFAULT NULL, guss_expiration TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP, guss_last_login TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP, guss_use_counter INTEGER DEFAULT 0, guss_enabled INTEGER DEFAULT 1)",
+    "INSERT INTO " GLEWLWYD_TABLE_SCOPE " (gs_id, gs_name, gs_password_required, gs_password_max_age) VALUES (1, '" SCOPE_SCHEMES "', 1, 600)",
+    "INSERT INTO " GLEWLWYD_TABLE_SCOPE " (gs_id, gs_name, gs_password_required, gs_password_max_age) VALUES (2, '" SCOPE_PASSWORD_OLD "', 1, 120)",
+    "INSERT INTO " GLEWLWYD_TABLE_SCOPE " (gs_id, gs_name, gs_password_required, gs_password_max_age) VALUES (3, '" SCOPE_NO_PASSWORD "', 0, 0)",
+    "INSERT INTO " GLEWLWYD_TABLE_SCOPE_GROUP " (gsg_id, gs_id, gsg_name, gsg_scheme_required) VALUES (1, 1, 'group1', 2)",
+    "INSERT INTO " GLEWLWYD_TABLE_USER_AUTH_SCHEME_MODULE_INSTANCE " (guasmi_id, guasmi_module, guasmi_name) VALUES (1, 'mock', 'scheme_valid')",
+    "INSERT INTO " GLEWLWYD_TABLE_USER_AUTH_SCHEME_MODULE_INSTANCE " (guasmi_id, guasmi_module, guasmi_name) VALUES (2, 'mock', 'scheme_expired')",
+    "INSERT INTO " GLEWLWYD_TABLE_USER_AUTH_SCHEME_MODULE_INSTANCE " (guasmi_id, guasmi_module, guasmi_name) VALUES (3, 'mock', 'scheme_missing')",
+    "INSERT INTO " GLEWLWYD_TABLE_USER_AUTH_SCHEME_MODULE_INSTANCE " (guasmi_id, guasmi_module, guasmi_name) VALUES (4, 'mock', 'scheme_disabled')",
+    "INSERT INTO " GLEWLWYD_TABLE_USER_AUTH_SCHEME_MODULE_INSTANCE " (guasmi_id, guasmi_module, guasmi_name) VALUES (5, 'mock', 'scheme_max_use')",
+    "INSERT INTO " GLEWLWYD_TABLE_USER_AUTH_SCHEME_MODULE_INSTANCE " (guasmi_id, guasmi_module, guasmi_name) VALUES (6, 'mock', 'scheme_other')",
+    "INSERT INTO " GLEWLWYD_TABLE_USER_AUTH_SCHEME_MODULE_INSTANCE " (guasmi_id, guasmi_module, guasmi_name) VALUES (7, 'mock', 'scheme_not_registered')",
+    "INSERT INTO " GLEWLWYD_TABLE_SCOPE_GROUP_AUTH_SCHEME_MODULE_INSTANCE " (gsg_id, guasmi_id) VALUES (1, 1), (1, 2), (1, 3), (1, 4), (1, 5), (1, 6), (1, 7)",
+    NULL
+  };
+  // Format: gus_id, guasmi_id or NULL, expiration delta, last login delta, use counter, enabled
+  const char * session_schemes[] = {
+    "1, NULL, 3600, -300, 0, 1",
+    "1, 1, 3600, -200, 0, 1",
+    "1, 1, -500, -1000, 0, 1",
+    "1, 2, -100, -2000, 0, 1",
+    "1, 4, 3600, -50, 0, 0",
+    "1, 5, 3600, -100, 2, 1",
+    "1, 5, 3600, -400, 0, 1",
+    "2, 6, 3600, -100, 0, 1",
+    "3, NULL, 3600, -100, 0, 1",
+    "3, 1, 3600, -100, 0, 1",
+    "4, NULL, 3600, -100, 0, 1",
+    NULL
+  };
+  char * query, ** values = NULL;
+  int i;
+
+  memset(&config, 0, sizeof(struct config_elements));
+  pending_max_use = 0;
+  time(&now);
+  unlink(DB_PATH);
+  ck_assert_ptr_ne(config.conn = h_connect_sqlite(DB_PATH), NULL);
+  for (i=0; tables[i] != NULL; i++) {
+    ck_assert_int_eq(h_execute_query(config.conn, tables[i], NULL, H_OPTION_EXEC), H_OK);
+  }
+  query = msprintf("INSERT INTO " GLEWLWYD_TABLE_USER_SESSION " (gus_id, gus_session_hash, gus_username, gus_expiration, gus_current, gus_enabled) VALUES "
+                   "(1, '" SESSION_MIXED "', '" USERNAME "', %lld, 1, 1), "
+                   "(2, '" SESSION_OTHER "', '" USERNAME "', %lld, 1, 1), "
+                   "(3, '" SESSION_EXPIRED "', '" USERNAME "', %lld, 1, 1), "
+                   "(4, '" SESSION_NOT_CURRENT "', '" USERNAME "', %lld, 0, 1)",
+                   (long long)now+3600, (long long)now+3600, (long long)now-10, (long long)now+3600);
+  ck_assert_int_eq(h_execute_query(config.conn, query, NULL, H_OPTION_EXEC), H_OK);
+  o_free(query);
+  for (i=0; session_schemes[i] != NULL; i++) {
+    ck_assert_int_eq(split_string(session_schemes[i], ", ", &values), 6);
+    query = msprintf("INSERT INTO " GLEWLWYD_TABLE_USER_SESSION_SCHEME " (gus_id, guasmi_id, guss_expiration, guss_last_login, guss_use_counter, guss_enabled) VALUES (%s, %s, %lld, %lld, %s, %s)",
+                     values[0], values[1], (long long)now+strtoll(values[2], NULL, 10), (long long)now+strtoll(values[3], NULL, 10), values[4], values[5]);
+    ck_assert_int_eq(h_execute_query(config.conn, query, NULL, H_OPTION_EXEC), H_OK);
+    o_free(query);
+    free_string_array(values);
+    values = NULL;
+  }
+}
+
+static void session_auth_state_clean(void) {
+  h_close_db(config.conn);
+  h_clean_connection(config.conn);
+  unlink(DB_PATH);
+}
+
+/**
+ * Returns the scheme scheme_name of the scope in the result of get_validated_auth_scheme_list_from_scope_list
+ */
+static json_t * get_validated_scheme(json_t * j_validated, const char * scope, const char * scheme_name) {
+  json_t * j_group, * j_scheme;
+  const char * key;
+  size_t index;
+
+  json_object_foreach(json_object_get(json_object_get(json_object_get(j_validated, "scheme"), scope), "schemes"), key, j_group) {
+    json_array_foreach(j_group, index, j_scheme) {
+      if (0 == o_strcmp(scheme_name, json_string_value(json_object_get(j_scheme, "scheme_name")))) {
+        return j_scheme;
+      }
+    }
+  }
+  return NULL;
+}
+
+static void check_scheme(json_t * j_validated, const char * scheme_name, json_t * j_authenticated, json_int_t last_login) {
+  json_t * j_scheme = get_validated_scheme(j_validated, SCOPE_SCHEMES, scheme_name);
+
+  ck_assert_ptr_ne(j_scheme, NULL);
+  ck_assert_ptr_eq(json_object_get(j_scheme, "scheme_registered"), json_true());
+  ck_assert_ptr_eq(json_object_get(j_scheme, "scheme_authenticated"), j_authenticated);
+  ck_assert_int_eq(json_integer_value(json_object_get(j_scheme, "scheme_last_login")), last_login);
+}
+
+START_TEST(test_glwd_session_auth_state_get)
+{
+  json_t * j_state;
+
+  session_auth_state_init();
+
+  j_state = get_session_auth_state(&config, SESSION_MIXED);
+  ck_assert_int_eq(check_result_value(j_state, G_OK), 1);
+  ck_assert_str_eq(json_string_value(json_object_get(json_object_get(j_state, "session"), "username")), USERNAME);
+  ck_assert_str_eq(json_string_value(json_object_get(j_state, "session_hash")), SESSION_MIXED);
+  // The password is stored with the key 0, the disabled and missing schemes aren't in the state
+  ck_assert_int_eq(json_array_size(json_object_get(json_object_get(j_state, "scheme"), "0")), 1);
+  ck_assert_int_eq(json_array_size(json_object_get(json_object_get(j_state, "scheme"), "1")), 2);
+  ck_assert_int_eq(json_integer_value(json_object_get(json_array_get(json_object_get(json_object_get(j_state, "scheme"), "1"), 0), "last_login")), (json_int_t)now-200);
+  ck_assert_int_eq(json_array_size(json_object_get(json_object_get(j_state, "scheme"), "2")), 1);
+  ck_assert_ptr_eq(json_object_get(json_object_get(j_state, "scheme"), "3"), NULL);
+  ck_assert_ptr_eq(json_object_get(json_object_get(j_state, "scheme"), "4"), NULL);
+  ck_assert_int_eq(json_array_size(json_object_get(json_object_get(j_state, "scheme"), "5")), 2);
+  ck_assert_ptr_eq(json_object_get(json_object_get(j_state, "scheme"), "6"), NULL);
+  json_decref(j_state);
+
+  // The session is expired, not current or unknown
+  j_state = get_session_auth_state(&config, SESSION_EXPIRED);
+  ck_assert_int_eq(check_result_value(j_state, G_ERROR_NOT_FOUND), 1);
+  json_decref(j_state);
+  j_state = get_session_auth_state(&config, SESSION_NOT_CURRENT);
+  ck_assert_int_eq(check_result_value(j_state, G_ERROR_NOT_FOUND), 1);
+  json_decref(j_state);
+  j_state = get_session_auth_state(&config, "session_unknown");
+  ck_assert_int_eq(check_result_value(j_state, G_ERROR_NOT_FOUND), 1);
+  json_decref(j_state);
+  j_state = get_session_auth_state(&config, NULL);
+  ck_assert_int_eq(check_result_value(j_state, G_ERROR_NOT_FOUND), 1);
+  json_decref(j_state);
+
+  session_auth_state_clean();
+}
+END_TEST
+
+START_TEST(test_glwd_session_auth_state_mixed)
+{
+  json_t * j_validated, * j_scope;
+
+  session_auth_state_init();
+
+  j_validated = get_validated_auth_scheme_list_from_scope_list(&config, SCOPE_SCHEMES " " SCOPE_PASSWORD_OLD " " SCOPE_NO_PASSWORD, SESSION_MIXED);
+  ck_assert_int_eq(check_result_value(j_validated, G_OK), 1);
+
+  j_scope = json_object_get(json_object_get(j_validated, "scheme"), SCOPE_SCHEMES);
+  ck_assert_ptr_eq(json_object_get(j_scope, "available"), json_true());
+  ck_assert_ptr_eq(json_object_get(j_scope, "password_authenticated"), json_true());
+  ck_assert_int_eq(json_integer_value(json_object_get(j_scope, "password_last_login")), (json_int_t)now-300);
+  // The most recent authentication is used, the older expired one is ignored
+  check_scheme(j_validated, "scheme_valid", json_true(), (json_int_t)now-200);
+  check_scheme(j_validated, "scheme_expired", json_false(), (json_int_t)now-2000);
+  check_scheme(j_validated, "scheme_missing", json_false(), 0);
+  check_scheme(j_validated, "scheme_disabled", json_false(), 0);
+  // The most recent authentication has reached max_use, the older one is used
+  check_scheme(j_validated, "scheme_max_use", json_true(), (json_int_t)now-400);
+  check_scheme(j_validated, "scheme_other", json_false(), 0);
+  ck_assert_ptr_eq(json_object_get(get_validated_scheme(j_validated, SCOPE_SCHEMES, "scheme_not_registered"), "scheme_registered"), json_false());
+  ck_assert_ptr_eq(json_object_get(get_validated_scheme(j_validated, SCOPE_SCHEMES, "scheme_not_registered"), "scheme_authenticated"), json_false());
+
+  // The password was authenticated before password_max_age
+  j_scope = json_object_get(json_object_get(j_validated, "scheme"), SCOPE_PASSWORD_OLD);
+  ck_assert_ptr_eq(json_object_get(j_scope, "password_authenticated"), json_false());
+  ck_assert_int_eq(json_integer_value(json_object_get(j_scope, "password_last_login")), (json_int_t)now-300);
+
+  // Without password_max_age, the password is valid until its expiration
+  j_scope = json_object_get(json_object_get(j_validated, "scheme"), SCOPE_NO_PASSWORD);
+  ck_assert_ptr_eq(json_object_get(j_scope, "password_authenticated"), json_true());
+  json_decref(j_validated);
+
+  ck_assert_int_eq(is_scope_list_valid_for_session(&config, SCOPE_SCHEMES, SESSION_MIXED), G_OK);
+  ck_assert_int_eq(is_scope_list_valid_for_session(&config, SCOPE_PASSWORD_OLD, SESSION_MIXED), G_ERROR_UNAUTHORIZED);
+  ck_assert_int_eq(is_scope_list_valid_for_session(&config, SCOPE_SCHEMES " " SCOPE_PASSWORD_OLD, SESSION_MIXED), G_ERROR_UNAUTHORIZED);
+  ck_assert_int_eq(is_scope_list_valid_for_session(&config, SCOPE_NO_PASSWORD, SESSION_MIXED), G_OK);
+
+  session_auth_state_clean();
+}
+END_TEST
+
+START_TEST(test_glwd_session_auth_state_pending)
+{
+  json_t * j_validated;
+
+  session_auth_state_init();
+
+  // The pending uses of the session usage write-behind are added to the use counters
+  pending_max_use = 1;
+  j_validated = get_validated_auth_scheme_list_from_scope_list(&config, SCOPE_SCHEMES, SESSION_MIXED);
+  check_scheme(j_validated, "scheme_max_use", json_true(), (json_int_t)now-400);
+  json_decref(j_validated);
+  ck_assert_int_eq(is_scope_list_valid_for_session(&config, SCOPE_SCHEMES, SESSION_MIXED), G_OK);
+
+  pending_max_use = SCHEME_MAX_USE;
+  j_validated = get_validated_auth_scheme_list_from_scope_list(&config, SCOPE_SCHEMES, SESSION_MIXED);
+  check_scheme(j_validated, "scheme_max_use", json_false(), 0);
+  check_scheme(j_validated, "scheme_valid", json_true(), (json_int_t)now-200);
+  json_decref(j_validated);
+  // Only one scheme of group1 is valid
+  ck_assert_int_eq(is_scope_list_valid_for_session(&config, SCOPE_SCHEMES, SESSION_MIXED), G_ERROR_UNAUTHORIZED);
+
+  session_auth_state_clean();
+}
+END_TEST
+
+START_TEST(test_glwd_session_auth_state_other_sessions)
+{
+  json_t * j_validated, * j_scope;
+
+  session_auth_state_init();
+
+  // The session has a scheme authenticated but not the password
+  j_validated = get_validated_auth_scheme_list_from_scope_list(&config, SCOPE_SCHEMES " " SCOPE_NO_PASSWORD, SESSION_OTHER);
+  ck_assert_int_eq(check_result_value(j_validated, G_OK), 1);
+  j_scope = json_object_get(json_object_get(j_validated, "scheme"), SCOPE_SCHEMES);
+  ck_assert_ptr_eq(json_object_get(j_scope, "available"), json_true());
+  ck_assert_ptr_eq(json_object_get(j_scope, "password_authenticated"), json_false());
+  ck_assert_int_eq(json_integer_value(json_object_get(j_scope, "password_last_login")), 0);
+  check_scheme(j_validated, "scheme_other", json_true(), (json_int_t)now-100);
+  check_scheme(j_validated, "scheme_valid", json_false(), 0);
+  check_scheme(j_validated, "scheme_max_use", json_false(), 0);
+  ck_assert_ptr_eq(json_object_get(json_object_get(json_object_get(j_validated, "scheme"), SCOPE_NO_PASSWORD), "password_authenticated"), json_false());
+  json_decref(j_validated);
+  ck_assert_int_eq(is_scope_list_valid_for_session(&config, SCOPE_SCHEMES, SESSION_OTHER), G_ERROR_UNAUTHORIZED);
+
+  // The session is expired, the schemes aren't evaluated
+  j_validated = get_validated_auth_scheme_list_from_scope_list(&config, SCOPE_SCHEMES, SESSION_EXPIRED);
+  ck_assert_int_eq(check_result_value(j_validated, G_OK), 1);
+  j_scope = json_object_get(json_object_get(j_validated, "scheme"), SCOPE_SCHEMES);
+  ck_assert_ptr_ne(j_scope, NULL);
+  ck_assert_ptr_eq(json_object_get(j_scope, "schemes"), NULL);
+  ck_assert_ptr_eq(json_object_get(j_scope, "password_authenticated"), NULL);
+  json_decref(j_validated);
+
+  // The session isn't the current one, the schemes aren't evaluated
+  j_validated = get_validated_auth_scheme_list_from_scope_list(&config, SCOPE_SCHEMES, SESSION_NOT_CURRENT);
+  ck_assert_int_eq(check_result_value(j_validated, G_OK), 1);
+  ck_assert_ptr_eq(json_object_get(json_object_get(json_object_get(j_validated, "scheme"), SCOPE_SCHEMES), "schemes"), NULL);
+  json_decref(j_validated);
+
+  session_auth_state_clean();
+}
+END_TEST
+
+/**
+ * Changes the scheme groups of SCOPE_SCHEMES in the database, as set_scope does
+ */
+static void scope_policy_update(const char * query) {
+  ck_assert_int_eq(h_execute_query(config.conn, query, NULL, H_OPTION_EXEC), H_OK);
+}
+
+START_TEST(test_glwd_session_auth_state_scope_policy_no_cache)
+{
+  session_auth_state_init();
+
+  // Without cache, the next check reads the changes
+  ck_assert_int_eq(is_scope_list_valid_for_session(&config, SCOPE_SCHEMES, SESSION_MIXED), G_OK);
+  scope_policy_update("UPDATE " GLEWLWYD_TABLE_SCOPE_GROUP " SET gsg_scheme_required=3 WHERE gsg_id=1");
+  ck_assert_int_eq(is_scope_list_valid_for_session(&config, SCOPE_SCHEMES, SESSION_MIXED), G_ERROR_UNAUTHORIZED);
+  scope_policy_update("UPDATE " GLEWLWYD_TABLE_SCOPE_GROUP " SET gsg_scheme_required=2 WHERE gsg_id=1");
+  ck_assert_int_eq(is_scope_list_valid_for_session(&config, SCOPE_SCHEMES, SESSION_MIXED), G_OK);
+  scope_policy_update("DELETE FROM " GLEWLWYD_TABLE_SCOPE_GROUP_AUTH_SCHEME_MODULE_INSTANCE " WHERE guasmi_id=5");
+  ck_assert_int_eq(is_scope_list_valid_for_session(&config, SCOPE_SCHEMES, SESSION_MIXED), G_ERROR_UNAUTHORIZED);
+  ck_assert_ptr_eq(config.j_scope_policy, NULL);
+
+  session_auth_state_clean();
+}
+END_TEST
+
+START_TEST(test_glwd_session_auth_state_scope_policy_cache)
+{
+  json_t * j_validated;
+
+  session_auth_state_init();
+  config.scope_policy_cache_max_age = 60;
+  ck_assert_int_eq(pthread_mutex_init(&config.scope_policy_lock, NULL), 0);
+
+  ck_assert_int_eq(is_scope_list_valid_for_session(&config, SCOPE_SCHEMES, SESSION_MIXED), G_OK);
+  ck_assert_ptr_ne(config.j_scope_policy, NULL);
+
+  // The policy graph in memory is used until it's invalidated
+  scope_policy_update("UPDATE " GLEWLWYD_TABLE_SCOPE_GROUP " SET gsg_scheme_required=3 WHERE gsg_id=1");
+  ck_assert_int_eq(is_scope_list_valid_for_session(&config, SCOPE_SCHEMES, SESSION_MIXED), G_OK);
+  invalidate_scope_policy(&config);
+  ck_assert_ptr_eq(config.j_scope_policy, NULL);
+  ck_assert_int_eq(is_scope_list_valid_for_session(&config, SCOPE_SCHEMES, SESSION_MIXED), G_ERROR_UNAUTHORIZED);
+
+  // A scheme is removed from the group
+  scope_policy_update("UPDATE " GLEWLWYD_TABLE_SCOPE_GROUP " SET gsg_scheme_required=2 WHERE gsg_id=1");
+  scope_policy_update("DELETE FROM " GLEWLWYD_TABLE_SCOPE_GROUP_AUTH_SCHEME_MODULE_INSTANCE " WHERE guasmi_id=5");
+  invalidate_scope_policy(&config);
+  j_validated = get_validated_auth_scheme_list_from_scope_list(&config, SCOPE_SCHEMES, SESSION_MIXED);
+  ck_assert_ptr_eq(get_validated_scheme(j_validated, SCOPE_SCHEMES, "scheme_max_use"), NULL);
+  check_scheme(j_validated, "scheme_valid", json_true(), (json_int_t)now-200);
+  json_decref(j_validated);
+  ck_assert_int_eq(is_scope_list_valid_for_session(&config, SCOPE_SCHEMES, SESSION_MIXED), G_ERROR_UNAUTHORIZED);
+
+  // The graph expires after scope_policy_cache_max_age
+  scope_policy_update("UPDATE " GLEWLWYD_TABLE_SCOPE_GROUP " SET gsg_scheme_required=1 WHERE gsg_id=1");
+  ck_assert_int_eq(is_scope_list_valid_for_session(&config, SCOPE_SCHEMES, SESSION_MIXED), G_ERROR_UNAUTHORIZED);
+  config.scope_policy_expires_at = 0;
+  ck_assert_int_eq(is_scope_list_valid_for_session(&config, SCOPE_SCHEMES, SESSION_MIXED), G_OK);
+
+  json_decref(config.j_scope_policy);
+  pthread_mutex_destroy(&config.scope_policy_lock);
+  session_auth_state_clean();
+}
+END_TEST
+
+static Suite *glewlwyd_suite(void)
+{
+  Suite *s;
+  TCase *tc_core;
+
+  s = suite_create("Glewlwyd session auth state");
+  tc_core = tcase_create("test_glwd_session_auth_state");
+  tcase_add_test(tc_core, test_glwd_session_auth_state_get);
+  tcase_add_test(tc_core, test_glwd_session_auth_state_mixed);
+  tcase_add_test(tc_core, test_glwd_session_auth_state_pending);
+  tcase_add_test(tc_core, test_glwd_session_auth_state_other_sessions);
+  tcase_add_test(tc_core, test_glwd_session_auth_state_scope_policy_no_cache);
+  tcase_add_test(tc_core, test_glwd_session_auth_state_scope_policy_cache);
+  tcase_set_timeout(tc_core, 30);
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
+
+int main(int argc, char *argv[])
+{
+  int number_failed;
+  Suite *s;
+  SRunner *sr;
+
+  y_init_logs("Glewlwyd test", Y_LOG_MODE_CONSOLE, Y_LOG_LEVEL_DEBUG, NULL, "Starting Glewlwyd test");
+
+  s = glewlwyd_suite();
+  sr = srunner_create(s);
+
+  srunner_run_all(sr, CK_VERBOSE);
+  number_failed = srunner_ntests_failed(sr);
+  srunner_free(sr);
+
+  y_close_logs();
+
+  return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
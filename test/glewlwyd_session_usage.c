@@ -0,0 +1,226 @@
+/* Public domain, no copyright. Use at your own risk. */
+
+/**
+ * Tests the session schemes use counters write-behind without a Glewlwyd instance,
+ * src/session_usage.c is built with this file and writes the counters in a temporary SQLite3 database
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <check.h>
+#include <ulfius.h>
+#include <orcania.h>
+#include <yder.h>
+
+#include "glewlwyd.h"
+
+#define DB_PATH "/tmp/glewlwyd_session_usage.db"
+
+#define SESSION_HASH "session_usage_hash"
+#define USERNAME "user1"
+#define SCHEME_ID 5
+#define SCHEME_EXPIRED_ID 6
+
+#define GUSS_ID_PASSWORD 1
+#define GUSS_ID_SCHEME 2
+#define GUSS_ID_SCHEME_EXPIRED 3
+
+#define FLUSH_INTERVAL 1
+#define FLUSH_INTERVAL_LONG 60
+
+struct config_elements config;
+
+/**
+ * The database pool isn't tested here, the main connection is used
+ */
+struct _h_connection * glewlwyd_db_pool_acquire(struct config_elements * config) {
+  return config->conn;
+}
+
+void glewlwyd_db_pool_release(struct config_elements * config, struct _h_connection * conn) {
+}
+
+/**
+ * Creates the session tables with one valid session,
+ * the password scheme and the scheme SCHEME_ID are valid, the scheme SCHEME_EXPIRED_ID is expired
+ */
+static void session_usage_init(unsigned int flush_interval) {
+  const char * queries[] = {
+    "CREATE TABLE " GLEWLWYD_TABLE_USER_SESSION " (gus_id INTEGER PRIMARY KEY AUTOINCREMENT, gus_session_hash TEXT NOT NULL, gus_username TEXT NOT NULL, gus_expiration TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP, gus_current INTEGER, gus_enabled INTEGER DEFAULT 1)",
+    "CREATE TABLE " GLEWLWYD_TABLE_USER_SESSION_SCHEME " (guss_id INTEGER PRIMARY KEY AUTOINCREMENT, gus_id INTEGER NOT NULL, guasmi_id INTEGER DEFAULT NULL, guss_expiration TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP, guss_use_counter INTEGER DEFAULT 0, guss_enabled INTEGER DEFAULT 1)",
+    "INSERT INTO " GLEWLWYD_TABLE_USER_SESSION " (gus_id, gus_session_hash, gus_username, gus_expiration, gus_current, gus_enabled) VALUES (1, '" SESSION_HASH "', '" USERNAME "', strftime('%s','now')+3600, 1, 1)",
+    "INSERT INTO " GLEWLWYD_TABLE_USER_SESSION_SCHEME " (guss_id, gus_id, guasmi_id, guss_expiration) VALUES (1, 1, NULL, strftime('%s','now')+3600)",
+    "INSERT INTO " GLEWLWYD_TABLE_USER_SESSION_SCHEME " (guss_id, gus_id, guasmi_id, guss_expiration) VALUES (2, 1, 5, strftime('%s','now')+3600)",
+    "INSERT INTO " GLEWLWYD_TABLE_USER_SESSION_SCHEME " (guss_id, gus_id, guasmi_id, guss_expiration) VALUES (3, 1, 6, strftime('%s','now')-3600)",
+    NULL
+  };
+  int i;
+
+  memset(&config, 0, sizeof(struct config_elements));
+  unlink(DB_PATH);
+  ck_assert_ptr_ne(config.conn = h_connect_sqlite(DB_PATH), NULL);
+  for (i=0; queries[i] != NULL; i++) {
+    ck_assert_int_eq(h_execute_query(config.conn, queries[i], NULL, H_OPTION_EXEC), H_OK);
+  }
+  config.session_usage.flush_interval = flush_interval;
+  ck_assert_int_eq(glewlwyd_session_usage_init(&config), G_OK);
+}
+
+static void session_usage_clean(void) {
+  h_close_db(config.conn);
+  h_clean_connection(config.conn);
+  unlink(DB_PATH);
+}
+
+static json_int_t get_use_counter(json_int_t guss_id) {
+  json_t * j_result = NULL;
+  char * query = msprintf("SELECT guss_use_counter FROM " GLEWLWYD_TABLE_USER_SESSION_SCHEME " WHERE guss_id=%" JSON_INTEGER_FORMAT, guss_id);
+  json_int_t counter = -1;
+
+  if (h_execute_query_json(config.conn, query, &j_result) == H_OK && json_array_size(j_result) == 1) {
+    counter = json_integer_value(json_object_get(json_array_get(j_result, 0), "guss_use_counter"));
+  }
+  json_decref(j_result);
+  o_free(query);
+  return counter;
+}
+
+static void session_usage_add(json_int_t guasmi_id, int nb) {
+  int i;
+
+  for (i=0; i<nb; i++) {
+    ck_assert_int_eq(glewlwyd_session_usage_add(&config, SESSION_HASH, USERNAME, guasmi_id), G_OK);
+  }
+}
+
+START_TEST(test_glwd_session_usage_disabled)
+{
+  session_usage_init(0);
+
+  // The caller must update the database itself
+  ck_assert_int_eq(glewlwyd_session_usage_add(&config, SESSION_HASH, USERNAME, 0), G_ERROR_PARAM);
+  ck_assert_int_eq(glewlwyd_session_usage_get_pending(&config, SESSION_HASH, USERNAME, 0), 0);
+
+  glewlwyd_session_usage_close(&config);
+  session_usage_clean();
+}
+END_TEST
+
+START_TEST(test_glwd_session_usage_pending)
+{
+  session_usage_init(FLUSH_INTERVAL_LONG);
+
+  session_usage_add(0, 3);
+  session_usage_add(SCHEME_ID, 2);
+
+  // The uses are pending, they aren't in the database yet
+  ck_assert_int_eq(glewlwyd_session_usage_get_pending(&config, SESSION_HASH, USERNAME, 0), 3);
+  ck_assert_int_eq(glewlwyd_session_usage_get_pending(&config, SESSION_HASH, USERNAME, SCHEME_ID), 2);
+  ck_assert_int_eq(glewlwyd_session_usage_get_pending(&config, SESSION_HASH, USERNAME, SCHEME_EXPIRED_ID), 0);
+  ck_assert_int_eq(glewlwyd_session_usage_get_pending(&config, SESSION_HASH, "user2", 0), 0);
+  ck_assert_int_eq(glewlwyd_session_usage_get_pending(&config, "other_hash", USERNAME, 0), 0);
+  ck_assert_int_eq(get_use_counter(GUSS_ID_PASSWORD), 0);
+  ck_assert_int_eq(get_use_counter(GUSS_ID_SCHEME), 0);
+
+  glewlwyd_session_usage_close(&config);
+  session_usage_clean();
+}
+END_TEST
+
+START_TEST(test_glwd_session_usage_flush)
+{
+  int i;
+
+  session_usage_init(FLUSH_INTERVAL);
+
+  session_usage_add(0, 3);
+  session_usage_add(SCHEME_ID, 2);
+  session_usage_add(SCHEME_EXPIRED_ID, 1);
+
+  // Every use is either pending or written in the database
+  ck_assert_int_eq(glewlwyd_session_usage_get_pending(&config, SESSION_HASH, USERNAME, 0)+get_use_counter(GUSS_ID_PASSWORD), 3);
+
+  for (i=0; i<50 && (glewlwyd_session_usage_get_pending(&config, SESSION_HASH, USERNAME, 0) || glewlwyd_session_usage_get_pending(&config, SESSION_HASH, USERNAME, SCHEME_ID)); i++) {
+    usleep(100000);
+  }
+  ck_assert_int_eq(glewlwyd_session_usage_get_pending(&config, SESSION_HASH, USERNAME, 0), 0);
+  ck_assert_int_eq(glewlwyd_session_usage_get_pending(&config, SESSION_HASH, USERNAME, SCHEME_ID), 0);
+  ck_assert_int_eq(get_use_counter(GUSS_ID_PASSWORD), 3);
+  ck_assert_int_eq(get_use_counter(GUSS_ID_SCHEME), 2);
+  // The uses of an expired scheme aren't counted
+  ck_assert_int_eq(get_use_counter(GUSS_ID_SCHEME_EXPIRED), 0);
+
+  // The next uses are added to the counters in the database
+  session_usage_add(0, 2);
+  for (i=0; i<50 && glewlwyd_session_usage_get_pending(&config, SESSION_HASH, USERNAME, 0); i++) {
+    usleep(100000);
+  }
+  ck_assert_int_eq(glewlwyd_session_usage_get_pending(&config, SESSION_HASH, USERNAME, 0), 0);
+  ck_assert_int_eq(get_use_counter(GUSS_ID_PASSWORD), 5);
+
+  glewlwyd_session_usage_close(&config);
+  session_usage_clean();
+}
+END_TEST
+
+START_TEST(test_glwd_session_usage_close)
+{
+  session_usage_init(FLUSH_INTERVAL_LONG);
+
+  session_usage_add(0, 4);
+  session_usage_add(SCHEME_ID, 1);
+  ck_assert_int_eq(get_use_counter(GUSS_ID_PASSWORD), 0);
+
+  // The pending uses are written when the write-behind is closed
+  glewlwyd_session_usage_close(&config);
+  ck_assert_int_eq(get_use_counter(GUSS_ID_PASSWORD), 4);
+  ck_assert_int_eq(get_use_counter(GUSS_ID_SCHEME), 1);
+  ck_assert_int_eq(glewlwyd_session_usage_get_pending(&config, SESSION_HASH, USERNAME, 0), 0);
+  ck_assert_int_eq(glewlwyd_session_usage_add(&config, SESSION_HASH, USERNAME, 0), G_ERROR_PARAM);
+
+  session_usage_clean();
+}
+END_TEST
+
+static Suite *glewlwyd_suite(void)
+{
+  Suite *s;
+  TCase *tc_core;
+
+  s = suite_create("Glewlwyd session usage");
+  tc_core = tcase_create("test_glwd_session_usage");
+  tcase_add_test(tc_core, test_glwd_session_usage_disabled);
+  tcase_add_test(tc_core, test_glwd_session_usage_pending);
+  tcase_add_test(tc_core, test_glwd_session_usage_flush);
+  tcase_add_test(tc_core, test_glwd_session_usage_close);
+  tcase_set_timeout(tc_core, 30);
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
+
+int main(int argc, char *argv[])
+{
+  int number_failed;
+  Suite *s;
+  SRunner *sr;
+
+  y_init_logs("Glewlwyd test", Y_LOG_MODE_CONSOLE, Y_LOG_LEVEL_DEBUG, NULL, "Starting Glewlwyd test");
+
+  s = glewlwyd_suite();
+  sr = srunner_create(s);
+
+  srunner_run_all(sr, CK_VERBOSE);
+  number_failed = srunner_ntests_failed(sr);
+  srunner_free(sr);
+
+  y_close_logs();
+
+  return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,387 @@
+/* Public domain, no copyright. Use at your own risk. */
+
+/**
+ * Tests the static files endpoint without a Glewlwyd instance,
+ * src/static_compressed_inmemory_website_callback.c is built with this file
+ * and serves the files of a temporary directory on a local ulfius instance
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <check.h>
+#include <ulfius.h>
+#include <orcania.h>
+#include <yder.h>
+
+#include "static_compressed_inmemory_website_callback.h"
+
+#define STATIC_PORT 7598
+#define STATIC_URI "http://localhost:7598"
+#define STATIC_MAX_AGE 3600
+
+#define FILE_INDEX "index.html"
+#define FILE_SMALL "small.txt"
+#define FILE_IMAGE "image.png"
+#define FILE_NEW "new.txt"
+
+#define CONTENT_SMALL "a"
+#define CONTENT_IMAGE "\x89PNG\r\n\x1a\n"
+#define CONTENT_NEW "new file"
+
+#define NB_INDEX_LINES 200
+
+#define FILES_PATH_TEMPLATE "/tmp/glewlwyd_static_XXXXXX"
+
+struct _u_compressed_inmemory_website_config config;
+struct _u_instance instance;
+char files_path[sizeof(FILES_PATH_TEMPLATE)];
+
+struct _static_response {
+  long   status;
+  char * body;
+  size_t body_len;
+  char * etag;
+  char * last_modified;
+  char * cache_control;
+  char * vary;
+  char * content_encoding;
+};
+
+static void write_file(const char * name, const char * content, size_t content_len) {
+  char * path = msprintf("%s/%s", files_path, name);
+  FILE * f;
+
+  ck_assert_ptr_ne((f = fopen(path, "wb")), NULL);
+  ck_assert_int_eq(fwrite(content, 1, content_len, f), content_len);
+  fclose(f);
+  o_free(path);
+}
+
+static void remove_file(const char * name) {
+  char * path = msprintf("%s/%s", files_path, name);
+
+  unlink(path);
+  o_free(path);
+}
+
+/**
+ * Builds a compressible html page, the version is written in each line
+ */
+static char * index_content(int version) {
+  char * content = o_strdup("<html><body>\n");
+  int i;
+
+  for (i=0; i<NB_INDEX_LINES; i++) {
+    content = mstrcatf(content, "<p>Glewlwyd static file version %d, line %d</p>\n", version, i);
+  }
+  return mstrcatf(content, "</body></html>\n");
+}
+
+/**
+ * Sends a GET request to the static endpoint with the optional headers Accept-Encoding, If-None-Match and If-Modified-Since
+ */
+static void static_get(const char * file, const char * accept_encoding, const char * if_none_match, const char * if_modified_since, struct _static_response * static_resp) {
+  struct _u_request req;
+  struct _u_response resp;
+  char * url = msprintf(STATIC_URI "/%s", file);
+
+  memset(static_resp, 0, sizeof(struct _static_response));
+  ulfius_init_request(&req);
+  ulfius_init_response(&resp);
+  ulfius_set_request_properties(&req, U_OPT_HTTP_VERB, "GET", U_OPT_HTTP_URL, url, U_OPT_NONE);
+  if (accept_encoding != NULL) {
+    u_map_put(req.map_header, "Accept-Encoding", accept_encoding);
+  }
+  if (if_none_match != NULL) {
+    u_map_put(req.map_header, "If-None-Match", if_none_match);
+  }
+  if (if_modified_since != NULL) {
+    u_map_put(req.map_header, "If-Modified-Since", if_modified_since);
+  }
+  ck_assert_int_eq(ulfius_send_http_request(&req, &resp), U_OK);
+  static_resp->status = resp.status;
+  static_resp->body = o_strndup(resp.binary_body, resp.binary_body_length);
+  static_resp->body_len = resp.binary_body_length;
+  static_resp->etag = o_strdup(u_map_get_case(resp.map_header, "ETag"));
+  static_resp->last_modified = o_strdup(u_map_get_case(resp.map_header, "Last-Modified"));
+  static_resp->cache_control = o_strdup(u_map_get_case(resp.map_header, "Cache-Control"));
+  static_resp->vary = o_strdup(u_map_get_case(resp.map_header, "Vary"));
+  static_resp->content_encoding = o_strdup(u_map_get_case(resp.map_header, "Content-Encoding"));
+  ulfius_clean_request(&req);
+  ulfius_clean_response(&resp);
+  o_free(url);
+}
+
+static void static_response_clean(struct _static_response * static_resp) {
+  o_free(static_resp->body);
+  o_free(static_resp->etag);
+  o_free(static_resp->last_modified);
+  o_free(static_resp->cache_control);
+  o_free(static_resp->vary);
+  o_free(static_resp->content_encoding);
+}
+
+static void static_website_start(int watch) {
+  char * content = index_content(1);
+
+  o_strcpy(files_path, FILES_PATH_TEMPLATE);
+  ck_assert_ptr_ne(mkdtemp(files_path), NULL);
+  write_file(FILE_INDEX, content, o_strlen(content));
+  write_file(FILE_SMALL, CONTENT_SMALL, o_strlen(CONTENT_SMALL));
+  write_file(FILE_IMAGE, CONTENT_IMAGE, o_strlen(CONTENT_IMAGE));
+  o_free(content);
+
+  ck_assert_int_eq(u_init_compressed_inmemory_website_config(&config), U_OK);
+  config.files_path = files_path;
+  config.max_age = STATIC_MAX_AGE;
+  u_map_put(&config.mime_types, ".html", "text/html");
+  u_map_put(&config.mime_types, ".txt", "text/plain");
+  u_map_put(&config.mime_types, ".png", "image/png");
+  u_map_put(&config.mime_types, "*", "application/octet-stream");
+  ck_assert_int_eq(u_add_mime_types_compressed(&config, "text/html"), U_OK);
+  ck_assert_int_eq(u_add_mime_types_compressed(&config, "text/plain"), U_OK);
+  ck_assert_int_eq(u_load_compressed_inmemory_website(&config), U_OK);
+  if (watch) {
+    ck_assert_int_eq(u_watch_compressed_inmemory_website(&config), U_OK);
+  }
+
+  ck_assert_int_eq(ulfius_init_instance(&instance, STATIC_PORT, NULL, NULL), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&instance, "GET", NULL, "*", 0, &callback_static_compressed_inmemory_website, &config), U_OK);
+  ck_assert_int_eq(ulfius_start_framework(&instance), U_OK);
+}
+
+static void static_website_stop(void) {
+  ulfius_stop_framework(&instance);
+  ulfius_clean_instance(&instance);
+  config.files_path = NULL;
+  u_clean_compressed_inmemory_website_config(&config);
+  remove_file(FILE_INDEX);
+  remove_file(FILE_SMALL);
+  remove_file(FILE_IMAGE);
+  remove_file(FILE_NEW);
+  rmdir(files_path);
+}
+
+START_TEST(test_glwd_static_website_etag)
+{
+  struct _static_response resp, resp_cond;
+  char * weak_etag;
+
+  static_website_start(0);
+
+  static_get(FILE_INDEX, NULL, NULL, NULL, &resp);
+  ck_assert_int_eq(resp.status, 200);
+  ck_assert_ptr_ne(resp.etag, NULL);
+  ck_assert_ptr_ne(resp.last_modified, NULL);
+  ck_assert_str_eq(resp.cache_control, "public, max-age=3600");
+  // The file has compressed versions, the response depends on Accept-Encoding
+  ck_assert_str_eq(resp.vary, "Accept-Encoding");
+  ck_assert_ptr_eq(resp.content_encoding, NULL);
+
+  // The ETag matches, strong or weak, the body isn't sent
+  static_get(FILE_INDEX, NULL, resp.etag, NULL, &resp_cond);
+  ck_assert_int_eq(resp_cond.status, 304);
+  ck_assert_int_eq(resp_cond.body_len, 0);
+  ck_assert_str_eq(resp_cond.etag, resp.etag);
+  ck_assert_str_eq(resp_cond.cache_control, "public, max-age=3600");
+  static_response_clean(&resp_cond);
+  weak_etag = msprintf("\"other\", W/%s", resp.etag);
+  static_get(FILE_INDEX, NULL, weak_etag, NULL, &resp_cond);
+  ck_assert_int_eq(resp_cond.status, 304);
+  static_response_clean(&resp_cond);
+  o_free(weak_etag);
+  static_get(FILE_INDEX, NULL, "*", NULL, &resp_cond);
+  ck_assert_int_eq(resp_cond.status, 304);
+  static_response_clean(&resp_cond);
+
+  // The ETag doesn't match
+  static_get(FILE_INDEX, NULL, "\"other\"", NULL, &resp_cond);
+  ck_assert_int_eq(resp_cond.status, 200);
+  ck_assert_int_eq(resp_cond.body_len, resp.body_len);
+  static_response_clean(&resp_cond);
+
+  // If-Modified-Since is used only without If-None-Match
+  static_get(FILE_INDEX, NULL, NULL, resp.last_modified, &resp_cond);
+  ck_assert_int_eq(resp_cond.status, 304);
+  static_response_clean(&resp_cond);
+  static_get(FILE_INDEX, NULL, "\"other\"", resp.last_modified, &resp_cond);
+  ck_assert_int_eq(resp_cond.status, 200);
+  static_response_clean(&resp_cond);
+
+  // Without max_age, the clients must validate the file before using it
+  config.max_age = 0;
+  static_get(FILE_INDEX, NULL, NULL, NULL, &resp_cond);
+  ck_assert_str_eq(resp_cond.cache_control, "no-cache");
+  static_response_clean(&resp_cond);
+
+  static_response_clean(&resp);
+  static_website_stop();
+}
+END_TEST
+
+START_TEST(test_glwd_static_website_etag_encoding)
+{
+  struct _static_response resp, resp_gzip, resp_deflate, resp_cond;
+
+  static_website_start(0);
+
+  static_get(FILE_INDEX, NULL, NULL, NULL, &resp);
+  static_get(FILE_INDEX, "gzip, deflate", NULL, NULL, &resp_gzip);
+  static_get(FILE_INDEX, "deflate", NULL, NULL, &resp_deflate);
+  ck_assert_int_eq(resp_gzip.status, 200);
+  ck_assert_str_eq(resp_gzip.content_encoding, "gzip");
+  ck_assert_int_lt(resp_gzip.body_len, resp.body_len);
+  ck_assert_str_eq(resp_gzip.vary, "Accept-Encoding");
+  ck_assert_int_eq(resp_deflate.status, 200);
+  ck_assert_str_eq(resp_deflate.content_encoding, "deflate");
+  ck_assert_int_lt(resp_deflate.body_len, resp.body_len);
+
+  // Each variant has its own ETag
+  ck_assert_str_ne(resp_gzip.etag, resp.etag);
+  ck_assert_str_ne(resp_deflate.etag, resp.etag);
+  ck_assert_str_ne(resp_gzip.etag, resp_deflate.etag);
+
+  static_get(FILE_INDEX, "gzip", resp_gzip.etag, NULL, &resp_cond);
+  ck_assert_int_eq(resp_cond.status, 304);
+  ck_assert_str_eq(resp_cond.etag, resp_gzip.etag);
+  static_response_clean(&resp_cond);
+  static_get(FILE_INDEX, "deflate", resp_deflate.etag, NULL, &resp_cond);
+  ck_assert_int_eq(resp_cond.status, 304);
+  static_response_clean(&resp_cond);
+
+  // The ETag of another variant doesn't match
+  static_get(FILE_INDEX, "gzip", resp.etag, NULL, &resp_cond);
+  ck_assert_int_eq(resp_cond.status, 200);
+  ck_assert_str_eq(resp_cond.content_encoding, "gzip");
+  static_response_clean(&resp_cond);
+  static_get(FILE_INDEX, NULL, resp_gzip.etag, NULL, &resp_cond);
+  ck_assert_int_eq(resp_cond.status, 200);
+  ck_assert_ptr_eq(resp_cond.content_encoding, NULL);
+  static_response_clean(&resp_cond);
+
+  static_response_clean(&resp);
+  static_response_clean(&resp_gzip);
+  static_response_clean(&resp_deflate);
+  static_website_stop();
+}
+END_TEST
+
+START_TEST(test_glwd_static_website_not_compressed)
+{
+  struct _static_response resp;
+
+  static_website_start(0);
+
+  // The compressed version of a small file isn't smaller, the file is sent as is
+  static_get(FILE_SMALL, "gzip, deflate", NULL, NULL, &resp);
+  ck_assert_int_eq(resp.status, 200);
+  ck_assert_str_eq(resp.body, CONTENT_SMALL);
+  ck_assert_ptr_eq(resp.content_encoding, NULL);
+  ck_assert_ptr_eq(resp.vary, NULL);
+  ck_assert_ptr_ne(resp.etag, NULL);
+  static_response_clean(&resp);
+
+  // The mime type isn't in the compressed mime types
+  static_get(FILE_IMAGE, "gzip, deflate", NULL, NULL, &resp);
+  ck_assert_int_eq(resp.status, 200);
+  ck_assert_int_eq(resp.body_len, o_strlen(CONTENT_IMAGE));
+  ck_assert_ptr_eq(resp.content_encoding, NULL);
+  ck_assert_ptr_eq(resp.vary, NULL);
+  static_response_clean(&resp);
+
+  static_website_stop();
+}
+END_TEST
+
+START_TEST(test_glwd_static_website_reload)
+{
+  struct _static_response resp, resp_new;
+  char * content = index_content(2);
+  int i;
+
+  static_website_start(1);
+
+  static_get(FILE_INDEX, NULL, NULL, NULL, &resp);
+  ck_assert_int_eq(resp.status, 200);
+
+  // The preloaded files are reloaded after the files stop changing
+  write_file(FILE_INDEX, content, o_strlen(content));
+  write_file(FILE_NEW, CONTENT_NEW, o_strlen(CONTENT_NEW));
+  remove_file(FILE_SMALL);
+  memset(&resp_new, 0, sizeof(struct _static_response));
+  for (i=0; i<50; i++) {
+    static_get(FILE_INDEX, NULL, NULL, NULL, &resp_new);
+    if (0 != o_strcmp(resp_new.etag, resp.etag)) {
+      break;
+    }
+    static_response_clean(&resp_new);
+    usleep(100000);
+  }
+  ck_assert_int_eq(resp_new.status, 200);
+  ck_assert_str_ne(resp_new.etag, resp.etag);
+  ck_assert_str_eq(resp_new.body, content);
+  static_response_clean(&resp_new);
+
+  // The previous ETag doesn't match anymore
+  static_get(FILE_INDEX, NULL, resp.etag, NULL, &resp_new);
+  ck_assert_int_eq(resp_new.status, 200);
+  static_response_clean(&resp_new);
+
+  static_get(FILE_NEW, NULL, NULL, NULL, &resp_new);
+  ck_assert_int_eq(resp_new.status, 200);
+  ck_assert_str_eq(resp_new.body, CONTENT_NEW);
+  ck_assert_ptr_ne(resp_new.etag, NULL);
+  static_response_clean(&resp_new);
+
+  static_get(FILE_SMALL, NULL, NULL, NULL, &resp_new);
+  ck_assert_int_eq(resp_new.status, 404);
+  static_response_clean(&resp_new);
+
+  static_response_clean(&resp);
+  o_free(content);
+  static_website_stop();
+}
+END_TEST
+
+static Suite *glewlwyd_suite(void)
+{
+  Suite *s;
+  TCase *tc_core;
+
+  s = suite_create("Glewlwyd static website");
+  tc_core = tcase_create("test_glwd_static_website");
+  tcase_add_test(tc_core, test_glwd_static_website_etag);
+  tcase_add_test(tc_core, test_glwd_static_website_etag_encoding);
+  tcase_add_test(tc_core, test_glwd_static_website_not_compressed);
+  tcase_add_test(tc_core, test_glwd_static_website_reload);
+  tcase_set_timeout(tc_core, 30);
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
+
+int main(int argc, char *argv[])
+{
+  int number_failed;
+  Suite *s;
+  SRunner *sr;
+
+  y_init_logs("Glewlwyd test", Y_LOG_MODE_CONSOLE, Y_LOG_LEVEL_DEBUG, NULL, "Starting Glewlwyd test");
+
+  s = glewlwyd_suite();
+  sr = srunner_create(s);
+
+  srunner_run_all(sr, CK_VERBOSE);
+  number_failed = srunner_ntests_failed(sr);
+  srunner_free(sr);
+
+  y_close_logs();
+
+  return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
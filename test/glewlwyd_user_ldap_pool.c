@@ -0,0 +1,440 @@
+/* Public domain, no copyright. Use at your own risk. */
+
+/**
+ * Tests the connection pool of the LDAP user module without a LDAP server,
+ * src/user/ldap.c is built with this file and the libldap functions it uses are replaced
+ * by functions that count the connections, the binds and the unbinds
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include <check.h>
+#include <ldap.h>
+#include <jansson.h>
+#include <orcania.h>
+#include <yder.h>
+
+#include "glewlwyd-common.h"
+
+#define LDAP_URI "ldap://localhost:3890"
+#define BIND_DN "cn=operator,dc=example,dc=com"
+#define BIND_PASSWORD "password"
+#define USER_DN "cn=user1,ou=users,dc=example,dc=com"
+#define USER_PASSWORD "user1password"
+
+/**
+ * A fake connection, fd[0] is the socket polled by the pool,
+ * the server closes the connection by writing in fd[1]
+ */
+struct ldap {
+  int fd[2];
+  int result_code;
+};
+
+static pthread_mutex_t ldap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  ldap_cond = PTHREAD_COND_INITIALIZER;
+static int nb_connect, nb_bind_service, nb_bind_user, nb_unbind;
+static int search_result, search_block, search_waiting, search_resume;
+static LDAP * last_ldap;
+static int ldap_entry;
+
+static void ldap_counters_reset(void) {
+  pthread_mutex_lock(&ldap_lock);
+  nb_connect = nb_bind_service = nb_bind_user = nb_unbind = 0;
+  search_result = LDAP_SUCCESS;
+  search_block = search_waiting = search_resume = 0;
+  last_ldap = NULL;
+  pthread_mutex_unlock(&ldap_lock);
+}
+
+int ldap_initialize(LDAP ** ldp, LDAP_CONST char * url) {
+  struct ldap * ldap;
+
+  if (o_strcmp(url, LDAP_URI) || (ldap = o_malloc(sizeof(struct ldap))) == NULL) {
+    return LDAP_PARAM_ERROR;
+  }
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, ldap->fd)) {
+    o_free(ldap);
+    return LDAP_LOCAL_ERROR;
+  }
+  ldap->result_code = LDAP_SUCCESS;
+  pthread_mutex_lock(&ldap_lock);
+  nb_connect++;
+  last_ldap = ldap;
+  pthread_mutex_unlock(&ldap_lock);
+  *ldp = ldap;
+  return LDAP_SUCCESS;
+}
+
+int ldap_set_option(LDAP * ld, int option, LDAP_CONST void * invalue) {
+  (void)ld;
+  (void)option;
+  (void)invalue;
+  return LDAP_OPT_SUCCESS;
+}
+
+int ldap_get_option(LDAP * ld, int option, void * outvalue) {
+  if (option == LDAP_OPT_DESC) {
+    *(int *)outvalue = ld->fd[0];
+  } else if (option == LDAP_OPT_RESULT_CODE) {
+    *(int *)outvalue = ld->result_code;
+  } else {
+    return LDAP_OPT_ERROR;
+  }
+  return LDAP_OPT_SUCCESS;
+}
+
+int ldap_sasl_bind_s(LDAP * ld, LDAP_CONST char * dn, LDAP_CONST char * mechanism, struct berval * cred, LDAPControl ** serverctrls, LDAPControl ** clientctrls, struct berval ** servercredp) {
+  int ret = LDAP_INVALID_CREDENTIALS;
+  (void)mechanism;
+  (void)serverctrls;
+  (void)clientctrls;
+  (void)servercredp;
+
+  pthread_mutex_lock(&ldap_lock);
+  if (0 == o_strcmp(dn, BIND_DN)) {
+    nb_bind_service++;
+    if (cred->bv_len == o_strlen(BIND_PASSWORD) && 0 == o_strncmp(cred->bv_val, BIND_PASSWORD, cred->bv_len)) {
+      ret = LDAP_SUCCESS;
+    }
+  } else if (0 == o_strcmp(dn, USER_DN)) {
+    nb_bind_user++;
+    if (cred->bv_len == o_strlen(USER_PASSWORD) && 0 == o_strncmp(cred->bv_val, USER_PASSWORD, cred->bv_len)) {
+      ret = LDAP_SUCCESS;
+    }
+  }
+  pthread_mutex_unlock(&ldap_lock);
+  ld->result_code = ret;
+  return ret;
+}
+
+int ldap_unbind_ext(LDAP * ld, LDAPControl ** serverctrls, LDAPControl ** clientctrls) {
+  (void)serverctrls;
+  (void)clientctrls;
+
+  pthread_mutex_lock(&ldap_lock);
+  nb_unbind++;
+  pthread_mutex_unlock(&ldap_lock);
+  close(ld->fd[0]);
+  close(ld->fd[1]);
+  o_free(ld);
+  return LDAP_SUCCESS;
+}
+
+/**
+ * The first search after search_block is set waits until search_resume is set
+ */
+int ldap_search_ext_s(LDAP * ld, LDAP_CONST char * base, int scope, LDAP_CONST char * filter, char ** attrs, int attrsonly, LDAPControl ** serverctrls, LDAPControl ** clientctrls, struct timeval * timeout, int sizelimit, LDAPMessage ** res) {
+  int ret;
+  (void)base;
+  (void)scope;
+  (void)filter;
+  (void)attrs;
+  (void)attrsonly;
+  (void)serverctrls;
+  (void)clientctrls;
+  (void)timeout;
+  (void)sizelimit;
+
+  pthread_mutex_lock(&ldap_lock);
+  if (search_block) {
+    search_block = 0;
+    search_waiting = 1;
+    pthread_cond_broadcast(&ldap_cond);
+    while (!search_resume) {
+      pthread_cond_wait(&ldap_cond, &ldap_lock);
+    }
+  }
+  ret = search_result;
+  pthread_mutex_unlock(&ldap_lock);
+  ld->result_code = ret;
+  *res = NULL;
+  return ret;
+}
+
+int ldap_count_entries(LDAP * ld, LDAPMessage * chain) {
+  (void)ld;
+  (void)chain;
+  return 1;
+}
+
+LDAPMessage * ldap_first_entry(LDAP * ld, LDAPMessage * chain) {
+  (void)ld;
+  (void)chain;
+  return (LDAPMessage *)&ldap_entry;
+}
+
+char * ldap_get_dn(LDAP * ld, LDAPMessage * entry) {
+  (void)ld;
+  (void)entry;
+  return o_strdup(USER_DN);
+}
+
+void ldap_memfree(void * p) {
+  o_free(p);
+}
+
+int ldap_msgfree(LDAPMessage * lm) {
+  (void)lm;
+  return LDAP_RES_SEARCH_RESULT;
+}
+
+static void * ldap_pool_init(json_t * j_params, json_int_t pool_size, json_int_t idle_timeout) {
+  void * cls = NULL;
+  json_t * j_result;
+
+  json_object_set_new(j_params, "pool-size", json_integer(pool_size));
+  json_object_set_new(j_params, "pool-idle-timeout", json_integer(idle_timeout));
+  j_result = user_module_init(NULL, 1, 0, j_params, &cls);
+  ck_assert_int_eq(check_result_value(j_result, G_OK), 1);
+  ck_assert_ptr_ne(cls, NULL);
+  json_decref(j_result);
+  ldap_counters_reset();
+  return cls;
+}
+
+static json_t * ldap_params(void) {
+  return json_pack("{ss ss ss ss ss ss ss ss ss}",
+                   "uri", LDAP_URI,
+                   "bind-dn", BIND_DN,
+                   "bind-password", BIND_PASSWORD,
+                   "base-search", "ou=users,dc=example,dc=com",
+                   "filter", "objectClass=inetOrgPerson",
+                   "username-property", "cn",
+                   "scope-property", "o",
+                   "name-property", "sn",
+                   "email-property", "mail");
+}
+
+static void * ldap_count_thread(void * cls) {
+  user_module_count_total(NULL, NULL, cls);
+  return NULL;
+}
+
+START_TEST(test_glwd_user_ldap_pool_reuse)
+{
+  json_t * j_params = ldap_params();
+  void * cls = ldap_pool_init(j_params, 2, 300);
+
+  // The first request opens a connection, the next ones use it again
+  ck_assert_int_eq(user_module_count_total(NULL, NULL, cls), 1);
+  ck_assert_int_eq(user_module_count_total(NULL, NULL, cls), 1);
+  ck_assert_int_eq(user_module_count_total(NULL, "user", cls), 1);
+  ck_assert_int_eq(nb_connect, 1);
+  ck_assert_int_eq(nb_bind_service, 1);
+  ck_assert_int_eq(nb_unbind, 0);
+
+  // The pooled connections are closed with the instance
+  ck_assert_int_eq(user_module_close(NULL, cls), G_OK);
+  ck_assert_int_eq(nb_unbind, 1);
+  json_decref(j_params);
+}
+END_TEST
+
+START_TEST(test_glwd_user_ldap_pool_idle_timeout)
+{
+  json_t * j_params = ldap_params();
+  void * cls = ldap_pool_init(j_params, 2, 2);
+
+  ck_assert_int_eq(user_module_count_total(NULL, NULL, cls), 1);
+  ck_assert_int_eq(nb_connect, 1);
+
+  // A connection idle for pool-idle-timeout seconds is closed, then a new connection is opened and bound
+  sleep(3);
+  ck_assert_int_eq(user_module_count_total(NULL, NULL, cls), 1);
+  ck_assert_int_eq(nb_connect, 2);
+  ck_assert_int_eq(nb_bind_service, 2);
+  ck_assert_int_eq(nb_unbind, 1);
+
+  // The new connection is used again before the timeout
+  ck_assert_int_eq(user_module_count_total(NULL, NULL, cls), 1);
+  ck_assert_int_eq(nb_connect, 2);
+
+  ck_assert_int_eq(user_module_close(NULL, cls), G_OK);
+  ck_assert_int_eq(nb_unbind, 2);
+  json_decref(j_params);
+}
+END_TEST
+
+START_TEST(test_glwd_user_ldap_pool_server_closed)
+{
+  json_t * j_params = ldap_params();
+  void * cls = ldap_pool_init(j_params, 2, 300);
+
+  ck_assert_int_eq(user_module_count_total(NULL, NULL, cls), 1);
+  ck_assert_int_eq(nb_connect, 1);
+
+  // The server closed the connection, the socket is readable, the pool reconnects
+  ck_assert_int_eq(write(last_ldap->fd[1], "x", 1), 1);
+  ck_assert_int_eq(user_module_count_total(NULL, NULL, cls), 1);
+  ck_assert_int_eq(nb_connect, 2);
+  ck_assert_int_eq(nb_bind_service, 2);
+  ck_assert_int_eq(nb_unbind, 1);
+
+  ck_assert_int_eq(user_module_close(NULL, cls), G_OK);
+  json_decref(j_params);
+}
+END_TEST
+
+START_TEST(test_glwd_user_ldap_pool_connection_error)
+{
+  json_t * j_params = ldap_params();
+  void * cls = ldap_pool_init(j_params, 2, 300);
+
+  // A connection error drops the connection on release
+  search_result = LDAP_SERVER_DOWN;
+  ck_assert_int_eq(user_module_count_total(NULL, NULL, cls), 0);
+  ck_assert_int_eq(nb_connect, 1);
+  ck_assert_int_eq(nb_unbind, 1);
+
+  // Another error keeps the connection
+  search_result = LDAP_NO_SUCH_OBJECT;
+  ck_assert_int_eq(user_module_count_total(NULL, NULL, cls), 0);
+  ck_assert_int_eq(nb_connect, 2);
+  ck_assert_int_eq(nb_unbind, 1);
+
+  search_result = LDAP_SUCCESS;
+  ck_assert_int_eq(user_module_count_total(NULL, NULL, cls), 1);
+  ck_assert_int_eq(nb_connect, 2);
+  ck_assert_int_eq(nb_bind_service, 2);
+
+  ck_assert_int_eq(user_module_close(NULL, cls), G_OK);
+  ck_assert_int_eq(nb_unbind, 2);
+  json_decref(j_params);
+}
+END_TEST
+
+START_TEST(test_glwd_user_ldap_pool_busy)
+{
+  json_t * j_params = ldap_params();
+  void * cls = ldap_pool_init(j_params, 1, 300);
+  pthread_t thread;
+
+  ck_assert_int_eq(user_module_count_total(NULL, NULL, cls), 1);
+  ck_assert_int_eq(nb_connect, 1);
+
+  // The only pooled connection is in use by the thread
+  pthread_mutex_lock(&ldap_lock);
+  search_block = 1;
+  pthread_mutex_unlock(&ldap_lock);
+  ck_assert_int_eq(pthread_create(&thread, NULL, ldap_count_thread, cls), 0);
+  pthread_mutex_lock(&ldap_lock);
+  while (!search_waiting) {
+    pthread_cond_wait(&ldap_cond, &ldap_lock);
+  }
+  pthread_mutex_unlock(&ldap_lock);
+
+  // A temporary connection is opened, then closed on release
+  ck_assert_int_eq(user_module_count_total(NULL, NULL, cls), 1);
+  ck_assert_int_eq(nb_connect, 2);
+  ck_assert_int_eq(nb_bind_service, 2);
+  ck_assert_int_eq(nb_unbind, 1);
+
+  pthread_mutex_lock(&ldap_lock);
+  search_resume = 1;
+  pthread_cond_broadcast(&ldap_cond);
+  pthread_mutex_unlock(&ldap_lock);
+  pthread_join(thread, NULL);
+
+  // The pooled connection is free again
+  ck_assert_int_eq(user_module_count_total(NULL, NULL, cls), 1);
+  ck_assert_int_eq(nb_connect, 2);
+  ck_assert_int_eq(nb_unbind, 1);
+
+  ck_assert_int_eq(user_module_close(NULL, cls), G_OK);
+  ck_assert_int_eq(nb_unbind, 2);
+  json_decref(j_params);
+}
+END_TEST
+
+START_TEST(test_glwd_user_ldap_pool_check_password)
+{
+  json_t * j_params = ldap_params();
+  void * cls = ldap_pool_init(j_params, 2, 300);
+
+  // The user is bound on its own connection, the pooled connection stays bound with the service account
+  ck_assert_int_eq(user_module_check_password(NULL, "user1", USER_PASSWORD, cls), G_OK);
+  ck_assert_int_eq(nb_connect, 2);
+  ck_assert_int_eq(nb_bind_service, 1);
+  ck_assert_int_eq(nb_bind_user, 1);
+  ck_assert_int_eq(nb_unbind, 1);
+
+  ck_assert_int_eq(user_module_check_password(NULL, "user1", "error", cls), G_ERROR_UNAUTHORIZED);
+  ck_assert_int_eq(nb_connect, 3);
+  ck_assert_int_eq(nb_bind_service, 1);
+  ck_assert_int_eq(nb_bind_user, 2);
+  ck_assert_int_eq(nb_unbind, 2);
+
+  ck_assert_int_eq(user_module_count_total(NULL, NULL, cls), 1);
+  ck_assert_int_eq(nb_connect, 3);
+  ck_assert_int_eq(nb_bind_service, 1);
+
+  ck_assert_int_eq(user_module_close(NULL, cls), G_OK);
+  ck_assert_int_eq(nb_unbind, 3);
+  json_decref(j_params);
+}
+END_TEST
+
+START_TEST(test_glwd_user_ldap_pool_disabled)
+{
+  json_t * j_params = ldap_params();
+  void * cls = ldap_pool_init(j_params, 0, 300);
+
+  // With pool-size 0, every request opens and closes its connection
+  ck_assert_int_eq(user_module_count_total(NULL, NULL, cls), 1);
+  ck_assert_int_eq(user_module_count_total(NULL, NULL, cls), 1);
+  ck_assert_int_eq(nb_connect, 2);
+  ck_assert_int_eq(nb_bind_service, 2);
+  ck_assert_int_eq(nb_unbind, 2);
+
+  ck_assert_int_eq(user_module_close(NULL, cls), G_OK);
+  ck_assert_int_eq(nb_unbind, 2);
+  json_decref(j_params);
+}
+END_TEST
+
+static Suite *glewlwyd_suite(void)
+{
+  Suite *s;
+  TCase *tc_core;
+
+  s = suite_create("Glewlwyd user module LDAP connection pool");
+  tc_core = tcase_create("test_glwd_user_ldap_pool");
+  tcase_add_test(tc_core, test_glwd_user_ldap_pool_reuse);
+  tcase_add_test(tc_core, test_glwd_user_ldap_pool_idle_timeout);
+  tcase_add_test(tc_core, test_glwd_user_ldap_pool_server_closed);
+  tcase_add_test(tc_core, test_glwd_user_ldap_pool_connection_error);
+  tcase_add_test(tc_core, test_glwd_user_ldap_pool_busy);
+  tcase_add_test(tc_core, test_glwd_user_ldap_pool_check_password);
+  tcase_add_test(tc_core, test_glwd_user_ldap_pool_disabled);
+  tcase_set_timeout(tc_core, 30);
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
+
+int main(int argc, char *argv[])
+{
+  int number_failed;
+  Suite *s;
+  SRunner *sr;
+
+  y_init_logs("Glewlwyd test", Y_LOG_MODE_CONSOLE, Y_LOG_LEVEL_DEBUG, NULL, "Starting Glewlwyd test");
+
+  s = glewlwyd_suite();
+  sr = srunner_create(s);
+
+  srunner_run_all(sr, CK_VERBOSE);
+  number_failed = srunner_ntests_failed(sr);
+  srunner_free(sr);
+
+  y_close_logs();
+
+  return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
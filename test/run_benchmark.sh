@@ -0,0 +1,61 @@
+#!/bin/bash
+#
+# Glewlwyd SSO
+#
+# Starts a Glewlwyd instance in test mode on a new SQLite database,
+# runs glewlwyd_benchmark against it, then stops the instance
+#
+# Usage: run_benchmark.sh [glewlwyd_benchmark options]
+#
+# Environment variables:
+# GLEWLWYD: path to the glewlwyd program, default glewlwyd
+# GLEWLWYD_CONFIG: config file, default glewlwyd-ci.conf in this directory
+# GLEWLWYD_DB: path of the SQLite database to create, the file is overwritten and kept after the run,
+#              default a new temporary file removed after the run
+# BENCHMARK: path to the glewlwyd_benchmark program, default ./glewlwyd_benchmark
+#
+# Public domain, no copyright. Use at your own risk.
+#
+
+TEST_DIR=$(cd "$(dirname "$0")" && pwd)
+GLEWLWYD=${GLEWLWYD:-glewlwyd}
+GLEWLWYD_CONFIG=${GLEWLWYD_CONFIG:-$TEST_DIR/glewlwyd-ci.conf}
+BENCHMARK=${BENCHMARK:-./glewlwyd_benchmark}
+G_PID=
+
+if [ -z "$GLEWLWYD_DB" ]; then
+  GLEWLWYD_DB=$(mktemp "${TMPDIR:-/tmp}/glewlwyd_benchmark.XXXXXX") || exit 1
+  REMOVE_DB=1
+else
+  rm -f "$GLEWLWYD_DB"
+  REMOVE_DB=0
+fi
+
+cleanup() {
+  if [ -n "$G_PID" ]; then
+    kill $G_PID 2>/dev/null
+    wait $G_PID 2>/dev/null
+  fi
+  if [ "$REMOVE_DB" = "1" ]; then
+    rm -f "$GLEWLWYD_DB"
+  fi
+}
+trap cleanup EXIT
+
+sqlite3 "$GLEWLWYD_DB" < "$TEST_DIR/../docs/database/init.sqlite3.sql" || exit 1
+sqlite3 "$GLEWLWYD_DB" < "$TEST_DIR/glewlwyd-test.sql" || exit 1
+
+# The database of the config file is replaced by GLEWLWYD_DB
+GLWD_DATABASE_TYPE=sqlite3 GLWD_DATABASE_SQLITE3_PATH="$GLEWLWYD_DB" $GLEWLWYD --config-file="$GLEWLWYD_CONFIG" --env-variables &
+G_PID=$!
+
+for i in $(seq 1 30)
+do
+  if curl -s -o /dev/null http://localhost:4593/; then
+    break
+  fi
+  sleep 1
+done
+
+$BENCHMARK "$@"
+exit $?
@@ -1966,6 +1966,34 @@ class GlwdOIDCParams extends Component {
                   </div>
                   {this.state.errorList["code-duration"]?<span className="error-input">{this.state.errorList["code-duration"]}</span>:""}
                 </div>
+                <div className="form-group">
+                  <div className="input-group mb-3">
+                    <div className="input-group-prepend">
+                      <label className="input-group-text" htmlFor="mod-glwd-reaper-interval">{i18next.t("admin.mod-glwd-reaper-interval")}</label>
+                    </div>
+                    <input type="number" min="0" step="1" className="form-control" id="mod-glwd-reaper-interval" onChange={(e) => this.changeNumberParam(e, "reaper-interval")} value={this.state.mod.parameters["reaper-interval"]} placeholder={i18next.t("admin.mod-glwd-reaper-interval-ph")} />
+                  </div>
+                </div>
+                <div className="form-group">
+                  <div className="input-group mb-3">
+                    <div className="input-group-prepend">
+                      <label className="input-group-text" htmlFor="mod-glwd-reaper-retention">{i18next.t("admin.mod-glwd-reaper-retention")}</label>
+                    </div>
+                    <input type="number" min="0" step="1" className="form-control" id="mod-glwd-reaper-retention" onChange={(e) => this.changeNumberParam(e, "reaper-retention")} value={this.state.mod.parameters["reaper-retention"]} placeholder={i18next.t("admin.mod-glwd-reaper-retention-ph")} />
+                  </div>
+                </div>
+                <div className="form-group">
+                  <div className="input-group mb-3">
+                    <div className="input-group-prepend">
+                      <label className="input-group-text" htmlFor="mod-glwd-access-token-cache-size">{i18next.t("admin.mod-glwd-access-token-cache-size")}</label>
+                    </div>
+                    <input type="number" min="0" step="1" className="form-control" id="mod-glwd-access-token-cache-size" onChange={(e) => this.changeNumberParam(e, "access-token-cache-size")} value={this.state.mod.parameters["access-token-cache-size"]} placeholder={i18next.t("admin.mod-glwd-access-token-cache-size-ph")} />
+                  </div>
+                </div>
+                <div className="form-group form-check">
+                  <input type="checkbox" className="form-check-input" id="mod-glwd-access-token-stateless" onChange={(e) => this.toggleParam(e, "access-token-stateless")} checked={this.state.mod.parameters["access-token-stateless"]} />
+                  <label className="form-check-label" htmlFor="mod-glwd-access-token-stateless">{i18next.t("admin.mod-glwd-access-token-stateless")}</label>
+                </div>
                 <div className="form-group form-check">
                   <input type="checkbox" className="form-check-input" id="mod-glwd-refresh-token-rolling" onChange={(e) => this.toggleParam(e, "refresh-token-rolling")} checked={this.state.mod.parameters["refresh-token-rolling"]} />
                   <label className="form-check-label" htmlFor="mod-glwd-refresh-token-rolling">{i18next.t("admin.mod-glwd-refresh-token-rolling")}</label>
@@ -2389,6 +2417,14 @@ class GlwdOIDCParams extends Component {
                     <input type="text" className="form-control" id="mod-glwd-jwt-request-pubkey-client-jwks_uri-parameter" onChange={(e) => this.changeParam(e, "client-jwks_uri-parameter")} value={this.state.mod.parameters["client-jwks_uri-parameter"]} placeholder={i18next.t("admin.mod-glwd-jwt-request-pubkey-client-jwks_uri-parameter-ph")} />
                   </div>
                 </div>
+                <div className="form-group">
+                  <div className="input-group mb-3">
+                    <div className="input-group-prepend">
+                      <label className="input-group-text" htmlFor="mod-glwd-jwks-cache-duration">{i18next.t("admin.mod-glwd-jwks-cache-duration")}</label>
+                    </div>
+                    <input type="number" min="0" step="1" className="form-control" id="mod-glwd-jwks-cache-duration" onChange={(e) => this.changeNumberParam(e, "jwks-cache-duration")} value={this.state.mod.parameters["jwks-cache-duration"]} placeholder={i18next.t("admin.mod-glwd-jwks-cache-duration-ph")} />
+                  </div>
+                </div>
               </div>
             </div>
           </div>
@@ -2538,6 +2574,14 @@ class GlwdOIDCParams extends Component {
                     {scopeIntrospectJsx}
                   </div>
                 </div>
+                <div className="form-group">
+                  <div className="input-group mb-3">
+                    <div className="input-group-prepend">
+                      <label className="input-group-text" htmlFor="mod-glwd-introspection-batch-max-tokens">{i18next.t("admin.mod-glwd-introspection-batch-max-tokens")}</label>
+                    </div>
+                    <input type="number" min="0" step="1" className="form-control" id="mod-glwd-introspection-batch-max-tokens" onChange={(e) => this.changeNumberParam(e, "introspection-batch-max-tokens")} value={this.state.mod.parameters["introspection-batch-max-tokens"]} placeholder={i18next.t("admin.mod-glwd-introspection-batch-max-tokens-ph")} disabled={!this.state.mod.parameters["introspection-revocation-allowed"]} />
+                  </div>
+                </div>
               </div>
             </div>
           </div>
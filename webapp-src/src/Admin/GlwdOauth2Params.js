@@ -618,6 +618,22 @@ class GlwdOauth2Params extends Component {
                   </div>
                   {this.state.errorList["code-duration"]?<span className="error-input">{this.state.errorList["code-duration"]}</span>:""}
                 </div>
+                <div className="form-group">
+                  <div className="input-group mb-3">
+                    <div className="input-group-prepend">
+                      <label className="input-group-text" htmlFor="mod-glwd-reaper-interval">{i18next.t("admin.mod-glwd-reaper-interval")}</label>
+                    </div>
+                    <input type="number" min="0" step="1" className="form-control" id="mod-glwd-reaper-interval" onChange={(e) => this.changeNumberParam(e, "reaper-interval")} value={this.state.mod.parameters["reaper-interval"]} placeholder={i18next.t("admin.mod-glwd-reaper-interval-ph")} />
+                  </div>
+                </div>
+                <div className="form-group">
+                  <div className="input-group mb-3">
+                    <div className="input-group-prepend">
+                      <label className="input-group-text" htmlFor="mod-glwd-reaper-retention">{i18next.t("admin.mod-glwd-reaper-retention")}</label>
+                    </div>
+                    <input type="number" min="0" step="1" className="form-control" id="mod-glwd-reaper-retention" onChange={(e) => this.changeNumberParam(e, "reaper-retention")} value={this.state.mod.parameters["reaper-retention"]} placeholder={i18next.t("admin.mod-glwd-reaper-retention-ph")} />
+                  </div>
+                </div>
                 <div className="form-group form-check">
                   <input type="checkbox" className="form-check-input" id="mod-glwd-refresh-token-rolling" onChange={(e) => this.toggleParam(e, "refresh-token-rolling")} checked={this.state.mod.parameters["refresh-token-rolling"]} />
                   <label className="form-check-label" htmlFor="mod-glwd-refresh-token-rolling">{i18next.t("admin.mod-glwd-refresh-token-rolling")}</label>
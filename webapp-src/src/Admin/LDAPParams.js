@@ -40,6 +40,8 @@ class LDAPParams extends Component {
     this.changePasswordAlgorithm = this.changePasswordAlgorithm.bind(this);
     this.getMatchType = this.getMatchType.bind(this);
     this.changePageSize = this.changePageSize.bind(this);
+    this.changePoolSize = this.changePoolSize.bind(this);
+    this.changePoolIdleTimeout = this.changePoolIdleTimeout.bind(this);
     this.checkParameters = this.checkParameters.bind(this);
     this.deleteScopeMatch = this.deleteScopeMatch.bind(this);
     this.changeSearchScope = this.changeSearchScope.bind(this);
@@ -171,6 +173,18 @@ class LDAPParams extends Component {
     this.setState({mod: mod});
   }
   
+  changePoolSize(e) {
+    var mod = this.state.mod;
+    mod.parameters["pool-size"] = parseInt(e.target.value);
+    this.setState({mod: mod});
+  }
+  
+  changePoolIdleTimeout(e) {
+    var mod = this.state.mod;
+    mod.parameters["pool-idle-timeout"] = parseInt(e.target.value);
+    this.setState({mod: mod});
+  }
+  
   deleteScopeMatch(index) {
     var mod = this.state.mod;
     mod.parameters["scope-match"].splice(index, 1);
@@ -500,6 +514,22 @@ class LDAPParams extends Component {
             <input type="number" min="0" step="1" className="form-control" id="mod-ldap-page-size" onChange={this.changePageSize} value={this.state.mod.parameters["page-size"]||""} placeholder={i18next.t("admin.mod-ldap-page-size-ph")} />
           </div>
         </div>
+        <div className="form-group">
+          <div className="input-group mb-3">
+            <div className="input-group-prepend">
+              <label className="input-group-text" htmlFor="mod-ldap-pool-size">{i18next.t("admin.mod-ldap-pool-size")}</label>
+            </div>
+            <input type="number" min="0" step="1" className="form-control" id="mod-ldap-pool-size" onChange={this.changePoolSize} value={this.state.mod.parameters["pool-size"]!==undefined?this.state.mod.parameters["pool-size"]:""} placeholder={i18next.t("admin.mod-ldap-pool-size-ph")} />
+          </div>
+        </div>
+        <div className="form-group">
+          <div className="input-group mb-3">
+            <div className="input-group-prepend">
+              <label className="input-group-text" htmlFor="mod-ldap-pool-idle-timeout">{i18next.t("admin.mod-ldap-pool-idle-timeout")}</label>
+            </div>
+            <input type="number" min="0" step="1" className="form-control" id="mod-ldap-pool-idle-timeout" onChange={this.changePoolIdleTimeout} value={this.state.mod.parameters["pool-idle-timeout"]!==undefined?this.state.mod.parameters["pool-idle-timeout"]:""} placeholder={i18next.t("admin.mod-ldap-pool-idle-timeout-ph")} />
+          </div>
+        </div>
         <div className="form-group">
           <div className="input-group mb-3">
             <div className="input-group-prepend">